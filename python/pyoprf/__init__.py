@@ -187,6 +187,7 @@ def unblind_finalize(r: bytes, Z: bytes, x: bytes) -> bytes:
 
 TOPRF_Share_BYTES=pysodium.crypto_core_ristretto255_SCALARBYTES+1
 TOPRF_Part_BYTES=pysodium.crypto_core_ristretto255_BYTES+1
+TOPRF_WideShare_BYTES=pysodium.crypto_core_ristretto255_SCALARBYTES+2
 
 # This function calculates a lagrange coefficient based on the index
 # and the indexes of the other contributing shareholders.
@@ -269,6 +270,43 @@ def thresholdmult(responses: bytes_list_t) -> bytes:
     return result.raw
 
 
+ristretto255_table_BYTES = 1280
+
+class TOPRF_Combiner(ctypes.Structure):
+    _fields_ = [('threshold', ctypes.c_uint8),
+                ('len',       ctypes.c_uint8),
+                ('indexes',   ctypes.c_uint8 * 255),
+                ('tables',    ctypes.c_void_p),
+                ]
+
+class Combiner:
+    """ combines threshold responses as they arrive, like
+    thresholdmult() but without waiting for a fixed set of responses
+
+    c = Combiner(t)
+    for response in responses_as_they_arrive():
+        result = c.add(response)
+        if result is not None: break
+    """
+    def __init__(self, threshold: int):
+        if threshold < 1 or threshold > 255: raise ValueError("threshold must be between 1 and 255")
+        # ristretto255_table is made of uint64_t, keep it aligned
+        self.tables = (ctypes.c_uint64 * (ristretto255_table_BYTES // 8 * threshold))()
+        self.ctx = TOPRF_Combiner()
+        liboprf.toprf_combiner_init(ctypes.byref(self.ctx), ctypes.c_uint8(threshold), self.tables)
+
+    def add(self, response: bytes):
+        """ returns None while more responses are needed, the combined
+        result otherwise. raises ValueError on invalid responses """
+        if len(response)!=TOPRF_Part_BYTES:
+            raise ValueError("response is not of correct size")
+        result = ctypes.create_string_buffer(pysodium.crypto_core_ristretto255_BYTES)
+        ret = liboprf.toprf_combiner_add(ctypes.byref(self.ctx), response, result)
+        if ret == 0: return None
+        if ret == 1: return result.raw
+        raise ValueError("invalid response" if ret == -1 else "combiner is already done")
+
+
 # This function is the efficient threshold version of oprf_Evaluate.
 #
 # This function needs to know in advance the indexes of all the
@@ -344,6 +382,208 @@ def threshold_combine(responses: bytes_list_t) -> bytes:
     __check(liboprf.toprf_thresholdcombine(responses_len, responses_buf, result))
     return result.raw
 
+# batch section
+#
+# The batch functions take contiguous buffers holding n elements back
+# to back - bytes, bytearray, memoryview or any other object
+# supporting the buffer protocol like numpy arrays of shape (n,32) and
+# dtype uint8 - and make a single call into liboprf. Writable inputs
+# and the outputs are passed to liboprf without copying. The outputs
+# can be preallocated by the caller and passed in as out parameters,
+# otherwise new bytearrays are returned. fails[i] is 1 if element i
+# could not be processed, its output is then zeroed.
+
+def _inbuf(buf, item_size: int, name: str):
+    """ returns a pointer to buf for ctypes and the number of items in it """
+    if isinstance(buf, bytes):
+        size = len(buf)
+        ptr = buf
+    else:
+        mv = memoryview(buf).cast('B')
+        size = mv.nbytes
+        # readonly buffers other than bytes cannot be passed without a copy
+        ptr = mv.tobytes() if mv.readonly else (ctypes.c_char * size).from_buffer(mv)
+    if size % item_size != 0:
+        raise ValueError(f"{name} is not a multiple of {item_size} bytes")
+    return ptr, size // item_size
+
+def _outbuf(out, size: int, name: str):
+    """ returns the output buffer - out or a new bytearray - and a pointer to it for ctypes """
+    if out is None:
+        out = bytearray(size)
+    mv = memoryview(out).cast('B')
+    if mv.readonly:
+        raise ValueError(f"{name} is not writable")
+    if mv.nbytes != size:
+        raise ValueError(f"{name} must be {size} bytes")
+    return out, (ctypes.c_char * size).from_buffer(mv)
+
+def _check_batch(code):
+    # 1 means some elements failed, which is reported in fails
+    if code not in (0, 1):
+        raise ValueError(f"error: {code}")
+
+#int oprf_BlindBatch(const size_t n,
+#                    const uint8_t *const x[n], const size_t x_len[n],
+#                    uint8_t r[n][crypto_core_ristretto255_SCALARBYTES],
+#                    uint8_t blinded[n][crypto_core_ristretto255_BYTES]);
+def blind_batch(xs: bytes_list_t, r_out=None, blinded_out=None):
+    """ blinds all inputs in xs, returns the blinding scalars and the
+    blinded elements as contiguous buffers """
+    n = len(xs)
+    if not all(isinstance(x, bytes) for x in xs):
+        raise ValueError("inputs must be bytes")
+    x = (ctypes.c_char_p * n)(*xs)
+    x_len = (ctypes.c_size_t * n)(*(len(e) for e in xs))
+    r, r_ptr = _outbuf(r_out, n * pysodium.crypto_core_ristretto255_SCALARBYTES, "r_out")
+    blinded, blinded_ptr = _outbuf(blinded_out, n * pysodium.crypto_core_ristretto255_BYTES, "blinded_out")
+    __check(liboprf.oprf_BlindBatch(ctypes.c_size_t(n), x, x_len, r_ptr, blinded_ptr))
+    return r, blinded
+
+#int oprf_EvaluateBatch(const uint8_t k[crypto_core_ristretto255_SCALARBYTES],
+#                       const size_t n,
+#                       const uint8_t blinded[n][crypto_core_ristretto255_BYTES],
+#                       uint8_t Z[n][crypto_core_ristretto255_BYTES],
+#                       uint8_t fails[n]);
+def evaluate_batch(key: bytes, blinded, out=None, fails_out=None):
+    """ evaluates all blinded elements with key, returns Z and fails """
+    if len(key) != pysodium.crypto_core_ristretto255_SCALARBYTES:
+        raise ValueError("key has incorrect length")
+    blinded_ptr, n = _inbuf(blinded, pysodium.crypto_core_ristretto255_BYTES, "blinded")
+    Z, Z_ptr = _outbuf(out, n * pysodium.crypto_core_ristretto255_BYTES, "out")
+    fails, fails_ptr = _outbuf(fails_out, n, "fails_out")
+    _check_batch(liboprf.oprf_EvaluateBatch(key, ctypes.c_size_t(n), blinded_ptr, Z_ptr, fails_ptr))
+    return Z, fails
+
+#int oprf_UnblindBatch(const size_t n,
+#                      const uint8_t r[n][crypto_core_ristretto255_SCALARBYTES],
+#                      const uint8_t Z[n][crypto_core_ristretto255_BYTES],
+#                      uint8_t N[n][crypto_core_ristretto255_BYTES],
+#                      uint8_t fails[n]);
+def unblind_batch(r, Z, out=None, fails_out=None):
+    """ unblinds all evaluated elements in Z with the scalars in r, returns N and fails """
+    r_ptr, n = _inbuf(r, pysodium.crypto_core_ristretto255_SCALARBYTES, "r")
+    Z_ptr, nz = _inbuf(Z, pysodium.crypto_core_ristretto255_BYTES, "Z")
+    if n != nz:
+        raise ValueError("r and Z must have the same number of elements")
+    N, N_ptr = _outbuf(out, n * pysodium.crypto_core_ristretto255_BYTES, "out")
+    fails, fails_ptr = _outbuf(fails_out, n, "fails_out")
+    _check_batch(liboprf.oprf_UnblindBatch(ctypes.c_size_t(n), r_ptr, Z_ptr, N_ptr, fails_ptr))
+    return N, fails
+
+#int toprf_EvaluateBatch(const uint8_t k[TOPRF_Share_BYTES],
+#                        const size_t n,
+#                        const uint8_t blinded[n][crypto_core_ristretto255_BYTES],
+#                        const uint8_t self, const uint8_t *indexes, const uint16_t index_len,
+#                        uint8_t Z[n][TOPRF_Part_BYTES],
+#                        uint8_t fails[n]);
+def threshold_evaluate_batch(k: bytes, blinded, self: int, indexes: list, out=None, fails_out=None):
+    """ the batch version of threshold_evaluate(), returns the parts -
+    n items of TOPRF_Part_BYTES - and fails """
+    if len(k) != TOPRF_Share_BYTES:
+        raise ValueError("param k has incorrect length")
+    if(self>255 or self<1):
+        raise ValueError("self outside valid range")
+    if(not all(i>0 and i<256 for i in indexes)):
+        raise ValueError("index(es) outside valid range")
+    blinded_ptr, n = _inbuf(blinded, pysodium.crypto_core_ristretto255_BYTES, "blinded")
+    Z, Z_ptr = _outbuf(out, n * TOPRF_Part_BYTES, "out")
+    fails, fails_ptr = _outbuf(fails_out, n, "fails_out")
+    _check_batch(liboprf.toprf_EvaluateBatch(k, ctypes.c_size_t(n), blinded_ptr, ctypes.c_uint8(self),
+                                             bytes(indexes), ctypes.c_uint16(len(indexes)), Z_ptr, fails_ptr))
+    return Z, fails
+
+# HashDH key rotation section
+#
+# The HashDH outputs of unblind() - without finalize() - can be moved
+# to a new server key using a public delta value, without running the
+# protocol again, see the documentation of unblind().
+
+#int oprf_KeyDelta(const uint8_t k_old[crypto_core_ristretto255_SCALARBYTES],
+#                  const uint8_t k_new[crypto_core_ristretto255_SCALARBYTES],
+#                  uint8_t delta[crypto_core_ristretto255_SCALARBYTES]);
+def key_delta(k_old: bytes, k_new: bytes) -> bytes:
+    """ returns the public delta updating HashDH outputs from k_old to k_new """
+    if len(k_old) != pysodium.crypto_core_ristretto255_SCALARBYTES:
+        raise ValueError("param k_old has incorrect length")
+    if len(k_new) != pysodium.crypto_core_ristretto255_SCALARBYTES:
+        raise ValueError("param k_new has incorrect length")
+    delta = ctypes.create_string_buffer(pysodium.crypto_core_ristretto255_SCALARBYTES)
+    __check(liboprf.oprf_KeyDelta(k_old, k_new, delta))
+    return delta.raw
+
+#int toprf_KeyDelta(const size_t old_len, const uint8_t old_shares[old_len][TOPRF_Share_BYTES],
+#                   const size_t new_len, const uint8_t new_shares[new_len][TOPRF_Share_BYTES],
+#                   uint8_t delta[crypto_core_ristretto255_SCALARBYTES]);
+def threshold_key_delta(old_shares: bytes_list_t, new_shares: bytes_list_t) -> bytes:
+    """ returns the delta between two threshold-shared keys, at least
+    threshold shares of each key are needed. Whoever runs this learns
+    both keys, see update_share() for rotating without that. """
+    if not all(len(s) == TOPRF_Share_BYTES for s in old_shares + new_shares):
+        raise ValueError("shares have incorrect length")
+    delta = ctypes.create_string_buffer(pysodium.crypto_core_ristretto255_SCALARBYTES)
+    __check(liboprf.toprf_KeyDelta(ctypes.c_size_t(len(old_shares)), b''.join(old_shares),
+                                   ctypes.c_size_t(len(new_shares)), b''.join(new_shares), delta))
+    return delta.raw
+
+#int toprf_UpdateShare(const uint8_t share[TOPRF_Share_BYTES],
+#                      const uint8_t delta[crypto_core_ristretto255_SCALARBYTES],
+#                      uint8_t updated[TOPRF_Share_BYTES]);
+def update_share(share: bytes, delta: bytes) -> bytes:
+    """ returns the share of the key delta * k, for rotating a shared
+    key with a random public delta, e.g. from pysodium.crypto_core_ristretto255_scalar_random() """
+    if len(share) != TOPRF_Share_BYTES:
+        raise ValueError("param share has incorrect length")
+    if len(delta) != pysodium.crypto_core_ristretto255_SCALARBYTES:
+        raise ValueError("param delta has incorrect length")
+    updated = ctypes.create_string_buffer(TOPRF_Share_BYTES)
+    __check(liboprf.toprf_UpdateShare(share, delta, updated))
+    return updated.raw
+
+#int oprf_ApplyDelta(const uint8_t delta[crypto_core_ristretto255_SCALARBYTES],
+#                    const uint8_t N[crypto_core_ristretto255_BYTES],
+#                    uint8_t N_new[crypto_core_ristretto255_BYTES]);
+def apply_delta(delta: bytes, N: bytes) -> bytes:
+    """ updates the HashDH output N to the new key """
+    if len(delta) != pysodium.crypto_core_ristretto255_SCALARBYTES:
+        raise ValueError("param delta has incorrect length")
+    if len(N) != pysodium.crypto_core_ristretto255_BYTES:
+        raise ValueError("param N has incorrect length")
+    N_new = ctypes.create_string_buffer(pysodium.crypto_core_ristretto255_BYTES)
+    __check(liboprf.oprf_ApplyDelta(delta, N, N_new))
+    return N_new.raw
+
+liboprf.workerpool_new.restype = ctypes.c_void_p
+
+#int oprf_ApplyDeltaBatch(const uint8_t delta[crypto_core_ristretto255_SCALARBYTES],
+#                         const size_t n,
+#                         const uint8_t N[n][crypto_core_ristretto255_BYTES],
+#                         uint8_t N_new[n][crypto_core_ristretto255_BYTES],
+#                         uint8_t fails[n],
+#                         const oprf_parallel_fn parallel, void *pool);
+def apply_delta_batch(delta: bytes, N, out=None, fails_out=None, threads: int = 0):
+    """ updates all HashDH outputs in N to the new key, in threads
+    additional threads if threads > 0. Passing N as out updates a
+    writable buffer in place. Returns the updated outputs and fails. """
+    if len(delta) != pysodium.crypto_core_ristretto255_SCALARBYTES:
+        raise ValueError("param delta has incorrect length")
+    N_ptr, n = _inbuf(N, pysodium.crypto_core_ristretto255_BYTES, "N")
+    N_new, N_new_ptr = _outbuf(out, n * pysodium.crypto_core_ristretto255_BYTES, "out")
+    fails, fails_ptr = _outbuf(fails_out, n, "fails_out")
+    pool, run = None, None
+    if threads > 0:
+        pool = liboprf.workerpool_new(ctypes.c_uint(threads))
+        if not pool:
+            raise ValueError("failed to start worker threads")
+        run = ctypes.cast(liboprf.workerpool_run, ctypes.c_void_p)
+    try:
+        _check_batch(liboprf.oprf_ApplyDeltaBatch(delta, ctypes.c_size_t(n), N_ptr, N_new_ptr, fails_ptr,
+                                                  run, ctypes.c_void_p(pool)))
+    finally:
+        if pool:
+            liboprf.workerpool_free(ctypes.c_void_p(pool))
+    return N_new, fails
+
 # todo documentation!
 #int dkg_start(const uint8_t n,
 #              const uint8_t threshold,
@@ -412,36 +652,49 @@ def dkg_finish(n: int, shares: List[bytes], self: int, ) -> bytes:
     liboprf.dkg_finish(n, shares, self, xi)
     return xi.raw
 
-#void dkg_reconstruct(const size_t response_len,
-#                     const TOPRF_Share responses[response_len][2],
-#                     uint8_t result[crypto_scalarmult_ristretto255_BYTES]);
+#int dkg_reconstruct(const size_t response_len,
+#                    const TOPRF_Share responses[response_len][2],
+#                    uint8_t result[crypto_scalarmult_ristretto255_BYTES]);
 def dkg_reconstruct(responses) -> bytes_list_t:
     rlen = len(responses)
     responses = ctypes.create_string_buffer(b''.join(responses))
     result = ctypes.create_string_buffer(pysodium.crypto_core_ristretto255_BYTES)
 
-    liboprf.dkg_reconstruct(rlen, responses, result)
+    __check(liboprf.dkg_reconstruct(rlen, responses, result))
     return result.raw
 
 tpdkg_sessionid_SIZE=32
-tpdkg_msg0_SIZE = 177 # ( sizeof(TP_DKG_Message)                       \
+tpdkg_VERSION = 1
+tpdkg_MAX_PEERS = 1024
+tpdkg_BROADCAST = 0xffff
+tpdkg_msg0_SIZE = 215 # ( sizeof(TP_DKG_Message)                       \
                       # + crypto_generichash_BYTES/*dst*/              \
-                      # + 2 /*n,t*/                                    \
+                      # + 6 /*version,n,t,flags*/                      \
+                      # + tpdkg_sessionid_SIZE /* resume id */         \
                       # + crypto_sign_PUBLICKEYBYTES /* tp_sign_pk */)
-tpdkg_msg8_SIZE = 256 # (sizeof(TP_DKG_Message) /* header */                             \
+tpdkg_msg8_SIZE = 259 # (sizeof(TP_DKG_Message) /* header */                             \
                       #  + noise_xk_handshake3_SIZE /* 4th&final noise handshake */      \
-                      #  + sizeof(TOPRF_Share) /* msg: the noise_xk wrapped share */     \
+                      #  + sizeof(TOPRF_WideShare) /* msg: the noise_xk wrapped share */ \
                       #  + crypto_secretbox_xchacha20poly1305_MACBYTES /* mac of msg */  \
                       #  + crypto_auth_hmacsha256_BYTES /* key-committing mac over msg*/ )
+tpdkg_encrypted_share_SIZE = 82 # (sizeof(TOPRF_WideShare)                        \
+                                #  + crypto_secretbox_xchacha20poly1305_MACBYTES \
+                                #  + crypto_auth_hmacsha256_BYTES                )
 tpdkg_max_err_SIZE = 128
+tpdkg_OPTIMISTIC = 1
+tpdkg_REFRESH = 2
+tpdkg_RESUME = 4
+tpdkg_resume_USES = 16
+def tpdkg_resume_SIZE(n):
+    return tpdkg_sessionid_SIZE + 5 + n * 2 * 32
 
 class TP_DKG_PeerState(ctypes.Structure):
     _fields_ = [('step',             ctypes.c_int),
                 ('prev',             ctypes.c_int),
                 ('sessionid',        ctypes.c_uint8 * tpdkg_sessionid_SIZE),
-                ('n',                ctypes.c_uint8),
-                ('t',                ctypes.c_uint8),
-                ('index',            ctypes.c_uint8),
+                ('n',                ctypes.c_uint16),
+                ('t',                ctypes.c_uint16),
+                ('index',            ctypes.c_uint16),
                 ('lt_sk',            ctypes.c_uint8 * pysodium.crypto_sign_SECRETKEYBYTES),
                 ('sig_pk',           ctypes.c_uint8 * pysodium.crypto_sign_PUBLICKEYBYTES),
                 ('sig_sk',           ctypes.c_uint8 * pysodium.crypto_sign_SECRETKEYBYTES),
@@ -459,20 +712,29 @@ class TP_DKG_PeerState(ctypes.Structure):
                 ('commitments',      ctypes.c_char_p),
                 ('shares',           ctypes.c_void_p),
                 ('xshares',          ctypes.c_void_p),
-                ('complaints_len',   ctypes.c_uint16),
-                ('complaints',       ctypes.POINTER(ctypes.c_uint16)),
-                ('my_complaints_len',ctypes.c_uint8),
-                ('my_complaints',    ctypes.c_char_p),
+                ('complaints_len',   ctypes.c_uint32),
+                ('complaints',       ctypes.POINTER(ctypes.c_uint32)),
+                ('my_complaints_len',ctypes.c_uint16),
+                ('my_complaints',    ctypes.POINTER(ctypes.c_uint16)),
                 ('padding',          ctypes.c_byte * 24), # important padding generichash_state must be 64byte aligned
                 ('transcript',       ctypes.c_uint8 * pysodium.crypto_generichash_STATEBYTES),
-                ('share',            ctypes.c_uint8 * 33),
+                ('share',            ctypes.c_uint8 * TOPRF_WideShare_BYTES),
+                ('metrics',          ctypes.c_void_p),
+                ('refresh',          ctypes.c_uint8),
+                ('old_share',        ctypes.c_uint8 * TOPRF_WideShare_BYTES),
+                ('optimistic',       ctypes.c_uint8),
+                ('parallel',         ctypes.c_void_p),
+                ('pool',             ctypes.c_void_p),
+                ('resume',           ctypes.c_uint8),
+                ('resume_cache',     ctypes.c_void_p),
+                ('tail_padding',     ctypes.c_byte * 8), # the C struct is padded to the 64 byte alignment of transcript
                 ]
 
 class TP_DKG_Cheater(ctypes.Structure):
     _fields_ = [('step',             ctypes.c_int),
                 ('error',            ctypes.c_int),
-                ('peer',             ctypes.c_uint8),
-                ('other_peer',       ctypes.c_uint8),
+                ('peer',             ctypes.c_uint16),
+                ('other_peer',       ctypes.c_uint16),
                 ('invalid_index',    ctypes.c_int),
                 ]
 
@@ -480,8 +742,8 @@ class TP_DKG_TPState(ctypes.Structure):
     _fields_ = [('step',             ctypes.c_int),
                 ('prev',             ctypes.c_int),
                 ('sessionid',        ctypes.c_uint8 * tpdkg_sessionid_SIZE),
-                ('n',                ctypes.c_uint8),
-                ('t',                ctypes.c_uint8),
+                ('n',                ctypes.c_uint16),
+                ('t',                ctypes.c_uint16),
                 ('sig_pk',           ctypes.c_uint8 * pysodium.crypto_sign_PUBLICKEYBYTES),
                 ('sig_sk',           ctypes.c_uint8 * pysodium.crypto_sign_SECRETKEYBYTES),
                 ('last_ts',          ctypes.c_void_p),
@@ -490,13 +752,21 @@ class TP_DKG_TPState(ctypes.Structure):
                 ('peer_lt_pks',      ctypes.c_char_p),
                 ('commitments',      ctypes.c_char_p),
                 ('encrypted_shares', ctypes.c_char_p),
-                ('complaints_len',   ctypes.c_uint16),
-                ('complaints',       ctypes.POINTER(ctypes.c_uint16)),
+                ('complaints_len',   ctypes.c_uint32),
+                ('complaints',       ctypes.POINTER(ctypes.c_uint32)),
                 ('cheater_len',      ctypes.c_size_t),
                 ('cheaters',         ctypes.c_void_p),
                 ('cheater_max',      ctypes.c_size_t),
                 ('padding',          ctypes.c_byte * 24), # important padding generichash_state must be 64byte aligned
                 ('transcript',       ctypes.c_uint8 * pysodium.crypto_generichash_STATEBYTES),
+                ('parallel',         ctypes.c_void_p),
+                ('pool',             ctypes.c_void_p),
+                ('fed',              ctypes.c_void_p),
+                ('metrics',          ctypes.c_void_p),
+                ('refresh',          ctypes.c_uint8),
+                ('optimistic',       ctypes.c_uint8),
+                ('resume',           ctypes.c_uint8),
+                ('tail_padding',     ctypes.c_byte * 29), # the C struct is padded to the 64 byte alignment of transcript
                 ]
 
 #int tpdkg_start_tp(TP_DKG_TPState *ctx, const uint64_t ts_epsilon,
@@ -504,44 +774,45 @@ class TP_DKG_TPState(ctypes.Structure):
 #             const char *proto_name, const size_t proto_name_len,
 #             const size_t msg0_len, TP_DKG_Message *msg0);
 #
+# or tpdkg_start_tp_flags() with the flags tpdkg_REFRESH - which
+# refreshes the shares of an earlier dkg with the same peers in the same
+# order, see tpdkg_peer_start() - and tpdkg_OPTIMISTIC which saves a
+# round-trip when there are no complaints
+#
+# or if resume_id - the sessionid of an earlier run of the same peers
+# which saved their channels with tpdkg_peer_save_resume() - is set
+# tpdkg_start_tp_resume(), which saves the two round-trips of the noise
+# handshakes
+#
 # also wraps conveniently:
 #
-# void tpdkg_tp_set_bufs(TP_DKG_TPState *ctx,
-#                  uint8_t (*commitments)[][crypto_core_ristretto255_BYTES],
-#                  uint16_t (*complaints)[],
-#                  uint8_t (*suspicious)[],
-#                  uint8_t (*tp_peers_sig_pks)[][crypto_sign_PUBLICKEYBYTES],
-#                  uint8_t (*peer_lt_pks)[][crypto_sign_PUBLICKEYBYTES],
-#                  uint64_t (*last_ts)[]);
-def tpdkg_start_tp(n, t, ts_epsilon, proto_name, peer_lt_pks):
+# int tpdkg_tp_set_arena(TP_DKG_TPState *ctx, uint8_t *arena, const size_t arena_len,
+#                        const uint8_t (*peer_lt_pks)[][crypto_sign_PUBLICKEYBYTES],
+#                        const int lock);
+def tpdkg_start_tp(n, t, ts_epsilon, proto_name, peer_lt_pks, refresh=False, optimistic=False, resume_id=None):
     state = TP_DKG_TPState()
-    # force 32 byte alignment of state
+    # force 32 byte alignment of state, the misaligned ones are kept
+    # until we are done, so that the allocator does not return them again
+    misaligned = []
     while ctypes.addressof(state) % 32 != 0:
+      misaligned.append(state)
       state = TP_DKG_TPState()
 
     msg = ctypes.create_string_buffer(tpdkg_msg0_SIZE)
-    __check(liboprf.tpdkg_start_tp(ctypes.byref(state), ts_epsilon, n, t, proto_name, ctypes.c_size_t(len(proto_name)), ctypes.c_size_t(len(msg.raw)), msg))
+    flags = (tpdkg_REFRESH if refresh else 0) | (tpdkg_OPTIMISTIC if optimistic else 0)
+    if resume_id is None:
+        __check(liboprf.tpdkg_start_tp_flags(ctypes.byref(state), ts_epsilon, n, t, proto_name, ctypes.c_size_t(len(proto_name)), flags, ctypes.c_size_t(len(msg.raw)), msg))
+    else:
+        if len(resume_id) != tpdkg_sessionid_SIZE: raise ValueError(f"resume_id has incorrect length: {len(resume_id)}, must be {tpdkg_sessionid_SIZE}")
+        __check(liboprf.tpdkg_start_tp_resume(ctypes.byref(state), ts_epsilon, n, t, proto_name, ctypes.c_size_t(len(proto_name)), flags, resume_id, ctypes.c_size_t(len(msg.raw)), msg))
 
-    peers_sig_pks = ctypes.create_string_buffer(n*pysodium.crypto_sign_PUBLICKEYBYTES)
-    commitments = ctypes.create_string_buffer(n*t*pysodium.crypto_core_ristretto255_BYTES)
-    complaints = ctypes.create_string_buffer(n*n*2)
-    noisy_shares = ctypes.create_string_buffer(n*n*tpdkg_msg8_SIZE)
-    cheaters = (TP_DKG_Cheater * (t*t - 1))()
     peer_lt_pks = b''.join(peer_lt_pks)
-    last_ts = (ctypes.c_uint64 * n)()
-
-    liboprf.tpdkg_tp_set_bufs(ctypes.byref(state),
-                              ctypes.byref(commitments),
-                              ctypes.byref(complaints),
-                              ctypes.byref(noisy_shares),
-                              ctypes.byref(cheaters),
-                              len(cheaters),
-                              ctypes.byref(peers_sig_pks),
-                              peer_lt_pks,
-                              ctypes.byref(last_ts))
+    arena = ctypes.create_string_buffer(liboprf.tpdkg_tp_arena_size(n, t))
+    __check(liboprf.tpdkg_tp_set_arena(ctypes.byref(state), arena, ctypes.c_size_t(len(arena)), peer_lt_pks, 0))
+    cheaters = ctypes.cast(state.cheaters, ctypes.POINTER(TP_DKG_Cheater))
 
-    # we need to keep these arrays around, otherwise the gc eats them up.
-    ctx = (state, cheaters, peers_sig_pks, commitments, complaints, noisy_shares, peer_lt_pks, last_ts)
+    # we need to keep the arena around, otherwise the gc eats it up.
+    ctx = (state, cheaters, arena)
 
     return ctx, msg.raw
 
@@ -569,7 +840,19 @@ def tpdkg_tp_next(ctx, msg):
     __check(liboprf.tpdkg_tp_next(ctypes.byref(ctx[0]), msg, input_len, output, output_len))
     return output
 
-#int tpdkg_tp_peer_msg(const TP_DKG_TPState *ctx, const uint8_t *base, const size_t base_size, const uint8_t peer, const uint8_t **msg, size_t *len);
+#int tpdkg_tp_feed(TP_DKG_TPState *ctx, const uint16_t peer, const uint8_t *msg, const size_t msg_len, uint8_t *input, const size_t input_len);
+def tpdkg_tp_feed(ctx, peer, msg, input):
+    """ absorbs the message of peer (starting from 0) for the current
+    step into input - a ctypes.create_string_buffer(tpdkg_tp_input_size(ctx))
+    which is passed to tpdkg_tp_next() once all peers have been fed.
+    returns False if the message failed verification, the cheater is
+    recorded by tpdkg_tp_next() """
+    ret = liboprf.tpdkg_tp_feed(ctypes.byref(ctx[0]), peer, msg, len(msg), input, len(input.raw))
+    if ret == 5: return False
+    __check(ret)
+    return True
+
+#int tpdkg_tp_peer_msg(const TP_DKG_TPState *ctx, const uint8_t *base, const size_t base_size, const uint16_t peer, const uint8_t **msg, size_t *len);
 def tpdkg_tp_peer_msg(ctx, base, peer):
     msg = ctypes.POINTER(ctypes.c_char)()
     size = ctypes.c_size_t()
@@ -581,6 +864,7 @@ def tpdkg_tp_peer_msg(ctx, base, peer):
 def tpdkg_tp_not_done(ctx):
     return liboprf.tpdkg_tp_not_done(ctypes.byref(ctx[0])) == 1
 
+liboprf.tpdkg_cheater_msg.restype = ctypes.c_uint16
 def tpdkg_get_cheaters(ctx):
     cheats = []
     cheaters = set()
@@ -598,50 +882,41 @@ def tpdkg_get_cheaters(ctx):
 #               const uint8_t peer_lt_sk[crypto_sign_SECRETKEYBYTES],
 #               const TP_DKG_Message *msg0);
 #
+# or if share is set - the existing share of the peer as returned by an
+# earlier dkg - tpdkg_start_peer_refresh(), in which case the result of
+# the protocol is the refreshed share
+#
+# or if cache is set - as returned by tpdkg_peer_save_resume() -
+# tpdkg_start_peer_resume(), which resumes the channels from cache if
+# the tp asks for it
+#
 # also wraps conveniently
 #
-#void tpdkg_peer_set_bufs(TP_DKG_PeerState *ctx,
-#                         uint8_t (*peers_sig_pks)[][crypto_sign_PUBLICKEYBYTES],
-#                         uint8_t (*peers_noise_pks)[][crypto_scalarmult_BYTES],
-#                         Noise_XK_session_t *(*noise_outs)[],
-#                         Noise_XK_session_t *(*noise_ins)[],
-#                         TOPRF_Share (*shares)[],
-#                         TOPRF_Share (*xshares)[],
-#                         uint8_t (*commitments)[][crypto_core_ristretto255_BYTES],
-#                         uint16_t (*complaints)[],
-#                         uint8_t (*my_complaints)[]);
-def tpdkg_peer_start(ts_epsilon, peer_lt_sk, msg0):
+#int tpdkg_peer_set_arena(TP_DKG_PeerState *ctx, uint8_t *arena, const size_t arena_len, const int lock);
+def tpdkg_peer_start(ts_epsilon, peer_lt_sk, msg0, share=None, cache=None):
     state = TP_DKG_PeerState()
-    # force 32 byte alignment of state
+    # force 32 byte alignment of state, the misaligned ones are kept
+    # until we are done, so that the allocator does not return them again
+    misaligned = []
     while ctypes.addressof(state) % 32 != 0:
+      misaligned.append(state)
       state = TP_DKG_PeerState()
 
-    __check(liboprf.tpdkg_start_peer(ctypes.byref(state), ts_epsilon, peer_lt_sk, msg0))
-
-    peers_sig_pks = ctypes.create_string_buffer(b"peer_sig_pks", state.n * pysodium.crypto_sign_PUBLICKEYBYTES)
-    peers_noise_pks = ctypes.create_string_buffer(b"peer_noise_pks", state.n * pysodium.crypto_scalarmult_BYTES)
-    noise_outs = (ctypes.c_void_p * state.n)()
-    noise_ins = (ctypes.c_void_p * state.n)()
-    shares = ctypes.create_string_buffer(state.n * TOPRF_Share_BYTES)
-    xshares = ctypes.create_string_buffer(state.n * TOPRF_Share_BYTES)
-    commitments = ctypes.create_string_buffer(state.n * state.t * pysodium.crypto_core_ristretto255_BYTES)
-    complaints = ctypes.create_string_buffer(state.n * state.n * 2)
-    my_complaints = ctypes.create_string_buffer(state.n)
-    last_ts = (ctypes.c_uint64 * state.n)()
-    liboprf.tpdkg_peer_set_bufs(ctypes.byref(state),
-                                ctypes.byref(peers_sig_pks),
-                                ctypes.byref(peers_noise_pks),
-                                noise_outs,
-                                noise_ins,
-                                ctypes.byref(shares),
-                                ctypes.byref(xshares),
-                                ctypes.byref(commitments),
-                                ctypes.byref(complaints),
-                                ctypes.byref(my_complaints),
-                                ctypes.byref(last_ts))
-
-    # we need to keep these arrays around, otherwise the gc eats them up.
-    ctx = (state, peers_sig_pks, peers_noise_pks, noise_outs, noise_ins, shares, xshares, commitments, complaints, my_complaints, last_ts)
+    if share is not None and len(share) != TOPRF_WideShare_BYTES: raise ValueError(f"share has incorrect length: {len(share)}, must be {TOPRF_WideShare_BYTES}")
+    if cache is not None:
+        # the cache is read during the whole protocol, it must outlive it
+        cache = ctypes.create_string_buffer(bytes(cache), len(cache))
+        __check(liboprf.tpdkg_start_peer_resume(ctypes.byref(state), ts_epsilon, peer_lt_sk, msg0, share, cache, ctypes.c_size_t(len(cache.raw))))
+    elif share is None:
+        __check(liboprf.tpdkg_start_peer(ctypes.byref(state), ts_epsilon, peer_lt_sk, msg0))
+    else:
+        __check(liboprf.tpdkg_start_peer_refresh(ctypes.byref(state), ts_epsilon, peer_lt_sk, msg0, share))
+
+    arena = ctypes.create_string_buffer(liboprf.tpdkg_peer_arena_size(state.n, state.t))
+    __check(liboprf.tpdkg_peer_set_arena(ctypes.byref(state), arena, ctypes.c_size_t(len(arena)), 0))
+
+    # we need to keep the arena and the cache around, otherwise the gc eats them up.
+    ctx = (state, arena, cache)
     return ctx
 
 #size_t tpdkg_peer_input_size(const TP_DKG_PeerState *ctx);
@@ -665,6 +940,122 @@ def tpdkg_peer_next(ctx, msg):
 def tpdkg_peer_not_done(ctx):
     return liboprf.tpdkg_peer_not_done(ctypes.byref(ctx[0])) == 1
 
+#int tpdkg_peer_save_resume(const TP_DKG_PeerState *ctx, uint8_t *cache, const size_t cache_len);
+def tpdkg_peer_save_resume(ctx):
+    """ returns the cache of the channels of a finished run of the
+    protocol, for resuming them in the next run of the same peers,
+    must be called before tpdkg_peer_free() """
+    cache = ctypes.create_string_buffer(tpdkg_resume_SIZE(ctx[0].n))
+    __check(liboprf.tpdkg_peer_save_resume(ctypes.byref(ctx[0]), cache, ctypes.c_size_t(len(cache.raw))))
+    return cache.raw
+
 #void tpdkg_peer_free(TP_DKG_PeerState *ctx);
 def tpdkg_peer_free(ctx):
     liboprf.tpdkg_peer_free(ctypes.byref(ctx[0]))
+
+# share store section, see sharestore.h
+
+SHARESTORE_CREATE = 1
+SHARESTORE_NOSYNC = 2
+sharestore_ID_BYTES = 32
+sharestore_KEYBYTES = 32
+
+liboprf.sharestore_open.restype = ctypes.c_void_p
+
+class ShareStore:
+    """ a persistent, memory mapped store of shares by key id, opening
+    it does not read or parse the shares, optionally encrypted with key
+
+    with ShareStore(path, key, SHARESTORE_CREATE) as store:
+        store[id] = share
+        share = store[id]
+    """
+    def __init__(self, path: str, key: bytes = None, flags: int = 0):
+        if key is not None and len(key) != sharestore_KEYBYTES:
+            raise ValueError("key has incorrect length")
+        self.ctx = liboprf.sharestore_open(path.encode('utf8'), key, ctypes.c_int(flags))
+        if not self.ctx: raise ValueError(f"failed to open share store {path}")
+
+    @staticmethod
+    def _check(code):
+        # __check() would be mangled in a class
+        if code != 0: raise ValueError(f"error: {code}")
+
+    def _id(self, id: bytes):
+        if len(id) != sharestore_ID_BYTES:
+            raise ValueError("id has incorrect length")
+        if self.ctx is None:
+            raise ValueError("share store is closed")
+        return id
+
+    def get(self, id: bytes, default=None):
+        share = ctypes.create_string_buffer(TOPRF_Share_BYTES)
+        ret = liboprf.sharestore_get(ctypes.c_void_p(self.ctx), self._id(id), share)
+        if ret == 1: return default
+        self._check(ret)
+        return share.raw
+
+    def __getitem__(self, id: bytes) -> bytes:
+        share = self.get(id)
+        if share is None: raise KeyError(id)
+        return share
+
+    def __setitem__(self, id: bytes, share: bytes):
+        if len(share) != TOPRF_Share_BYTES:
+            raise ValueError("share has incorrect length")
+        self._check(liboprf.sharestore_put(ctypes.c_void_p(self.ctx), self._id(id), share))
+
+    def __delitem__(self, id: bytes):
+        ret = liboprf.sharestore_del(ctypes.c_void_p(self.ctx), self._id(id))
+        if ret == 1: raise KeyError(id)
+        self._check(ret)
+
+    def sync(self):
+        if self.ctx is None: raise ValueError("share store is closed")
+        self._check(liboprf.sharestore_sync(ctypes.c_void_p(self.ctx)))
+
+    def close(self):
+        if self.ctx is not None:
+            liboprf.sharestore_close(ctypes.c_void_p(self.ctx))
+            self.ctx = None
+
+    def __enter__(self):
+        return self
+
+    def __exit__(self, *args):
+        self.close()
+
+    def __del__(self):
+        self.close()
+
+# native section
+#
+# pyoprf._native is an optional compiled extension implementing the
+# hot paths above without ctypes marshalling, with the GIL released
+# during all calls into liboprf, so that multi-threaded programs can
+# run evaluations on all cores. If it is available - and
+# PYOPRF_NO_NATIVE is not set in the environment - its functions
+# replace the ctypes versions, they have the same parameters and
+# results. The extension links liboprf itself, so the library loaded
+# via BYZANTINE_DKG and the one used by the extension must be the same
+# for oprf_set_evalproxy() to affect both.
+try:
+    if "PYOPRF_NO_NATIVE" in os.environ:
+        raise ImportError("disabled")
+    from . import _native
+except ImportError:
+    _native = None
+
+if _native is not None:
+    from ._native import (keygen, blind, evaluate, unblind, finalize, unblind_finalize,
+                          create_shares, thresholdmult, threshold_evaluate, threshold_combine,
+                          evaluate_batch, unblind_batch, threshold_evaluate_batch,
+                          dkg_start, dkg_verify_commitments, dkg_finish, dkg_reconstruct)
+
+    def tpdkg_tp_next(ctx, msg):
+        output = ctypes.create_string_buffer(tpdkg_tp_output_size(ctx))
+        _native.tpdkg_tp_next(ctx[0], msg, output)
+        return output
+
+    def tpdkg_peer_next(ctx, msg):
+        return _native.tpdkg_peer_next(ctx[0], msg)
@@ -0,0 +1,724 @@
+/*
+    @copyright 2024, Stefan Marsiske toprf@ctrlc.hu
+    This file is part of liboprf.
+
+    liboprf is free software: you can redistribute it and/or
+    modify it under the terms of the GNU Lesser General Public License
+    as published by the Free Software Foundation, either version 3 of
+    the License, or (at your option) any later version.
+
+    liboprf is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Lesser General Public License for more details.
+
+    You should have received a copy of the License
+    along with liboprf. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/*
+   Optional native implementation of the hot paths of pyoprf.
+
+   The functions here have the same names, parameters and results as
+   their ctypes counterparts in pyoprf/__init__.py, which imports them
+   over the ctypes versions if this module is available. The arguments
+   are parsed directly from the python objects, inputs can be any
+   object supporting the buffer protocol, and all calls into liboprf
+   run with the GIL released, so that multi-threaded servers can
+   evaluate on all cores.
+
+   The buffers are held with PyObject_GetBuffer() while the GIL is
+   released, other threads must not modify them concurrently.
+*/
+
+#define PY_SSIZE_T_CLEAN
+#include <Python.h>
+#include <sodium.h>
+#include "oprf.h"
+#include "toprf.h"
+#include "dkg.h"
+#include "tp-dkg.h"
+
+static PyObject *raise_error(const int code) {
+  return PyErr_Format(PyExc_ValueError, "error: %d", code);
+}
+
+static int check_len(const Py_buffer *buf, const size_t len, const char *name) {
+  if((size_t) buf->len == len) return 0;
+  PyErr_Format(PyExc_ValueError, "%s has incorrect length", name);
+  return 1;
+}
+
+// copies a sequence of buffers of item_len bytes each into one new
+// contiguous buffer, which must be freed with free_items()
+static uint8_t *join_items(PyObject *seq, const size_t item_len, size_t *n, const char *name) {
+  PyObject *items = PySequence_Fast(seq, name);
+  if(items==NULL) return NULL;
+  const Py_ssize_t len = PySequence_Fast_GET_SIZE(items);
+  uint8_t *buf = PyMem_Malloc(len > 0 ? (size_t) len * item_len : 1);
+  if(buf==NULL) {
+    Py_DECREF(items);
+    PyErr_NoMemory();
+    return NULL;
+  }
+  for(Py_ssize_t i=0;i<len;i++) {
+    Py_buffer item;
+    if(PyObject_GetBuffer(PySequence_Fast_GET_ITEM(items, i), &item, PyBUF_SIMPLE)!=0) goto fail;
+    if((size_t) item.len != item_len) {
+      PyBuffer_Release(&item);
+      PyErr_Format(PyExc_ValueError, "at least one of the %s is not of correct size", name);
+      goto fail;
+    }
+    memcpy(buf + (size_t) i * item_len, item.buf, item_len);
+    PyBuffer_Release(&item);
+  }
+  Py_DECREF(items);
+  *n = (size_t) len;
+  return buf;
+
+fail:
+  Py_DECREF(items);
+  PyMem_Free(buf);
+  return NULL;
+}
+
+static void free_items(uint8_t *buf, const size_t len) {
+  sodium_memzero(buf, len);
+  PyMem_Free(buf);
+}
+
+// splits buf into a tuple of n bytes objects of item_len bytes each
+static PyObject *split_items(const uint8_t *buf, const size_t n, const size_t item_len) {
+  PyObject *ret = PyTuple_New((Py_ssize_t) n);
+  if(ret==NULL) return NULL;
+  for(size_t i=0;i<n;i++) {
+    PyObject *item = PyBytes_FromStringAndSize((const char*) buf + i*item_len, (Py_ssize_t) item_len);
+    if(item==NULL) {
+      Py_DECREF(ret);
+      return NULL;
+    }
+    PyTuple_SET_ITEM(ret, (Py_ssize_t) i, item);
+  }
+  return ret;
+}
+
+// converts a list of peer indexes into bytes
+static int get_indexes(PyObject *seq, uint8_t indexes[255], uint16_t *len) {
+  PyObject *items = PySequence_Fast(seq, "indexes must be a sequence");
+  if(items==NULL) return 1;
+  const Py_ssize_t n = PySequence_Fast_GET_SIZE(items);
+  if(n > 255) {
+    Py_DECREF(items);
+    PyErr_SetString(PyExc_ValueError, "too many indexes");
+    return 1;
+  }
+  for(Py_ssize_t i=0;i<n;i++) {
+    const long idx = PyLong_AsLong(PySequence_Fast_GET_ITEM(items, i));
+    if(idx==-1 && PyErr_Occurred()) {
+      Py_DECREF(items);
+      return 1;
+    }
+    if(idx<1 || idx>255) {
+      Py_DECREF(items);
+      PyErr_SetString(PyExc_ValueError, "index(es) outside valid range");
+      return 1;
+    }
+    indexes[i] = (uint8_t) idx;
+  }
+  Py_DECREF(items);
+  *len = (uint16_t) n;
+  return 0;
+}
+
+// the output buffer of a batch function, either provided by the
+// caller or a new bytearray
+typedef struct {
+  PyObject *obj;
+  Py_buffer view;
+} OutBuf;
+
+static int get_outbuf(PyObject *out, const size_t len, const char *name, OutBuf *ret) {
+  if(out==NULL || out==Py_None) {
+    ret->obj = PyByteArray_FromStringAndSize(NULL, (Py_ssize_t) len);
+  } else {
+    Py_INCREF(out);
+    ret->obj = out;
+  }
+  if(ret->obj==NULL) return 1;
+  if(PyObject_GetBuffer(ret->obj, &ret->view, PyBUF_WRITABLE | PyBUF_C_CONTIGUOUS)!=0) {
+    Py_CLEAR(ret->obj);
+    return 1;
+  }
+  if((size_t) ret->view.len != len) {
+    PyBuffer_Release(&ret->view);
+    Py_CLEAR(ret->obj);
+    PyErr_Format(PyExc_ValueError, "%s must be %zu bytes", name, len);
+    return 1;
+  }
+  return 0;
+}
+
+static PyObject *batch_result(const int ret, OutBuf *out, OutBuf *fails) {
+  PyBuffer_Release(&out->view);
+  PyBuffer_Release(&fails->view);
+  // 1 means some elements failed, which is reported in fails
+  if(ret!=0 && ret!=1) {
+    Py_DECREF(out->obj);
+    Py_DECREF(fails->obj);
+    return raise_error(ret);
+  }
+  PyObject *result = PyTuple_Pack(2, out->obj, fails->obj);
+  Py_DECREF(out->obj);
+  Py_DECREF(fails->obj);
+  return result;
+}
+
+static PyObject *py_keygen(PyObject *self, PyObject *args) {
+  (void) self; (void) args;
+  PyObject *k = PyBytes_FromStringAndSize(NULL, crypto_core_ristretto255_SCALARBYTES);
+  if(k==NULL) return NULL;
+  uint8_t *kp = (uint8_t*) PyBytes_AS_STRING(k);
+  Py_BEGIN_ALLOW_THREADS
+  oprf_KeyGen(kp);
+  Py_END_ALLOW_THREADS
+  return k;
+}
+
+static PyObject *py_blind(PyObject *self, PyObject *args) {
+  (void) self;
+  Py_buffer x;
+  if(!PyArg_ParseTuple(args, "y*:blind", &x)) return NULL;
+  if(x.len > 255) {
+    PyBuffer_Release(&x);
+    PyErr_SetString(PyExc_ValueError, "param x is too long");
+    return NULL;
+  }
+  uint8_t r[crypto_core_ristretto255_SCALARBYTES], blinded[crypto_core_ristretto255_BYTES];
+  int ret;
+  Py_BEGIN_ALLOW_THREADS
+  ret = oprf_Blind(x.buf, (uint8_t) x.len, r, blinded);
+  Py_END_ALLOW_THREADS
+  PyBuffer_Release(&x);
+  if(ret!=0) return raise_error(ret);
+  PyObject *result = Py_BuildValue("(y#y#)", r, (Py_ssize_t) sizeof r, blinded, (Py_ssize_t) sizeof blinded);
+  sodium_memzero(r, sizeof r);
+  return result;
+}
+
+static PyObject *py_evaluate(PyObject *self, PyObject *args) {
+  (void) self;
+  Py_buffer key, blinded;
+  if(!PyArg_ParseTuple(args, "y*y*:evaluate", &key, &blinded)) return NULL;
+  PyObject *result = NULL;
+  if(check_len(&key, crypto_core_ristretto255_SCALARBYTES, "key") ||
+     check_len(&blinded, crypto_core_ristretto255_BYTES, "blinded param")) goto done;
+  uint8_t Z[crypto_core_ristretto255_BYTES];
+  int ret;
+  Py_BEGIN_ALLOW_THREADS
+  ret = oprf_Evaluate(key.buf, blinded.buf, Z);
+  Py_END_ALLOW_THREADS
+  if(ret!=0) raise_error(ret);
+  else result = PyBytes_FromStringAndSize((const char*) Z, sizeof Z);
+done:
+  PyBuffer_Release(&key);
+  PyBuffer_Release(&blinded);
+  return result;
+}
+
+static PyObject *py_unblind(PyObject *self, PyObject *args) {
+  (void) self;
+  Py_buffer r, Z;
+  if(!PyArg_ParseTuple(args, "y*y*:unblind", &r, &Z)) return NULL;
+  PyObject *result = NULL;
+  if(check_len(&r, crypto_core_ristretto255_SCALARBYTES, "param r") ||
+     check_len(&Z, crypto_core_ristretto255_BYTES, "param Z")) goto done;
+  uint8_t N[crypto_core_ristretto255_BYTES];
+  int ret;
+  Py_BEGIN_ALLOW_THREADS
+  ret = oprf_Unblind(r.buf, Z.buf, N);
+  Py_END_ALLOW_THREADS
+  if(ret!=0) raise_error(ret);
+  else result = PyBytes_FromStringAndSize((const char*) N, sizeof N);
+done:
+  PyBuffer_Release(&r);
+  PyBuffer_Release(&Z);
+  return result;
+}
+
+static PyObject *py_finalize(PyObject *self, PyObject *args) {
+  (void) self;
+  Py_buffer x, N;
+  if(!PyArg_ParseTuple(args, "y*y*:finalize", &x, &N)) return NULL;
+  PyObject *result = NULL;
+  if(check_len(&N, crypto_core_ristretto255_BYTES, "param N")) goto done;
+  if(x.len > UINT16_MAX) {
+    PyErr_SetString(PyExc_ValueError, "param x is too long");
+    goto done;
+  }
+  uint8_t y[OPRF_BYTES];
+  int ret;
+  Py_BEGIN_ALLOW_THREADS
+  ret = oprf_Finalize(x.buf, (uint16_t) x.len, N.buf, y);
+  Py_END_ALLOW_THREADS
+  if(ret!=0) raise_error(ret);
+  else result = PyBytes_FromStringAndSize((const char*) y, sizeof y);
+  sodium_memzero(y, sizeof y);
+done:
+  PyBuffer_Release(&x);
+  PyBuffer_Release(&N);
+  return result;
+}
+
+static PyObject *py_unblind_finalize(PyObject *self, PyObject *args) {
+  (void) self;
+  Py_buffer r, Z, x;
+  if(!PyArg_ParseTuple(args, "y*y*y*:unblind_finalize", &r, &Z, &x)) return NULL;
+  PyObject *result = NULL;
+  if(check_len(&r, crypto_core_ristretto255_SCALARBYTES, "param r") ||
+     check_len(&Z, crypto_core_ristretto255_BYTES, "param Z")) goto done;
+  if(x.len > UINT16_MAX) {
+    PyErr_SetString(PyExc_ValueError, "param x is too long");
+    goto done;
+  }
+  uint8_t N[crypto_core_ristretto255_BYTES], y[OPRF_BYTES];
+  int ret;
+  Py_BEGIN_ALLOW_THREADS
+  ret = oprf_Unblind(r.buf, Z.buf, N);
+  if(ret==0) ret = oprf_Finalize(x.buf, (uint16_t) x.len, N, y);
+  Py_END_ALLOW_THREADS
+  if(ret!=0) raise_error(ret);
+  else result = PyBytes_FromStringAndSize((const char*) y, sizeof y);
+  sodium_memzero(y, sizeof y);
+done:
+  PyBuffer_Release(&r);
+  PyBuffer_Release(&Z);
+  PyBuffer_Release(&x);
+  return result;
+}
+
+static PyObject *py_create_shares(PyObject *self, PyObject *args) {
+  (void) self;
+  Py_buffer secret;
+  int n, t;
+  if(!PyArg_ParseTuple(args, "y*ii:create_shares", &secret, &n, &t)) return NULL;
+  PyObject *result = NULL;
+  if(check_len(&secret, crypto_core_ristretto255_SCALARBYTES, "secret")) goto done;
+  if(n < t || n > 255) {
+    PyErr_SetString(PyExc_ValueError, "t cannot be bigger than n");
+    goto done;
+  }
+  if(t < 2) {
+    PyErr_SetString(PyExc_ValueError, "t must be bigger than 1");
+    goto done;
+  }
+  {
+    uint8_t shares[n][TOPRF_Share_BYTES];
+    Py_BEGIN_ALLOW_THREADS
+    toprf_create_shares(secret.buf, (uint8_t) n, (uint8_t) t, shares);
+    Py_END_ALLOW_THREADS
+    result = split_items((const uint8_t*) shares, (size_t) n, TOPRF_Share_BYTES);
+    sodium_memzero(shares, sizeof shares);
+  }
+done:
+  PyBuffer_Release(&secret);
+  return result;
+}
+
+static PyObject *py_thresholdmult(PyObject *self, PyObject *args) {
+  (void) self;
+  PyObject *seq;
+  if(!PyArg_ParseTuple(args, "O:thresholdmult", &seq)) return NULL;
+  size_t n;
+  uint8_t *responses = join_items(seq, TOPRF_Part_BYTES, &n, "responses");
+  if(responses==NULL) return NULL;
+  uint8_t result[crypto_scalarmult_ristretto255_BYTES];
+  int ret;
+  Py_BEGIN_ALLOW_THREADS
+  ret = toprf_thresholdmult(n, (const uint8_t (*)[TOPRF_Part_BYTES]) responses, result);
+  Py_END_ALLOW_THREADS
+  free_items(responses, n * TOPRF_Part_BYTES);
+  if(ret!=0) return raise_error(ret);
+  return PyBytes_FromStringAndSize((const char*) result, sizeof result);
+}
+
+static PyObject *py_threshold_evaluate(PyObject *self, PyObject *args) {
+  (void) self;
+  Py_buffer k, blinded;
+  int index;
+  PyObject *seq;
+  if(!PyArg_ParseTuple(args, "y*y*iO:threshold_evaluate", &k, &blinded, &index, &seq)) return NULL;
+  PyObject *result = NULL;
+  uint8_t indexes[255];
+  uint16_t index_len;
+  if(check_len(&k, TOPRF_Share_BYTES, "param k") ||
+     check_len(&blinded, crypto_core_ristretto255_BYTES, "blinded param")) goto done;
+  if(index>255 || index<1) {
+    PyErr_SetString(PyExc_ValueError, "self outside valid range");
+    goto done;
+  }
+  if(get_indexes(seq, indexes, &index_len)) goto done;
+  uint8_t Z[TOPRF_Part_BYTES];
+  int ret;
+  Py_BEGIN_ALLOW_THREADS
+  ret = toprf_Evaluate(k.buf, blinded.buf, (uint8_t) index, indexes, index_len, Z);
+  Py_END_ALLOW_THREADS
+  if(ret!=0) raise_error(ret);
+  else result = PyBytes_FromStringAndSize((const char*) Z, sizeof Z);
+done:
+  PyBuffer_Release(&k);
+  PyBuffer_Release(&blinded);
+  return result;
+}
+
+static PyObject *py_threshold_combine(PyObject *self, PyObject *args) {
+  (void) self;
+  PyObject *seq;
+  if(!PyArg_ParseTuple(args, "O:threshold_combine", &seq)) return NULL;
+  size_t n;
+  uint8_t *responses = join_items(seq, TOPRF_Part_BYTES, &n, "responses");
+  if(responses==NULL) return NULL;
+  uint8_t result[crypto_scalarmult_ristretto255_BYTES];
+  Py_BEGIN_ALLOW_THREADS
+  toprf_thresholdcombine(n, (const uint8_t (*)[TOPRF_Part_BYTES]) responses, result);
+  Py_END_ALLOW_THREADS
+  free_items(responses, n * TOPRF_Part_BYTES);
+  return PyBytes_FromStringAndSize((const char*) result, sizeof result);
+}
+
+static PyObject *py_evaluate_batch(PyObject *self, PyObject *args, PyObject *kwargs) {
+  (void) self;
+  static char *kwlist[] = {"key", "blinded", "out", "fails_out", NULL};
+  Py_buffer key, blinded;
+  PyObject *out_obj = NULL, *fails_obj = NULL;
+  if(!PyArg_ParseTupleAndKeywords(args, kwargs, "y*y*|OO:evaluate_batch", kwlist,
+                                  &key, &blinded, &out_obj, &fails_obj)) return NULL;
+  PyObject *result = NULL;
+  OutBuf out, fails;
+  if(check_len(&key, crypto_core_ristretto255_SCALARBYTES, "key")) goto done;
+  if(blinded.len % crypto_core_ristretto255_BYTES != 0) {
+    PyErr_SetString(PyExc_ValueError, "blinded is not a multiple of 32 bytes");
+    goto done;
+  }
+  const size_t n = (size_t) blinded.len / crypto_core_ristretto255_BYTES;
+  if(get_outbuf(out_obj, n * crypto_core_ristretto255_BYTES, "out", &out)) goto done;
+  if(get_outbuf(fails_obj, n, "fails_out", &fails)) {
+    PyBuffer_Release(&out.view);
+    Py_DECREF(out.obj);
+    goto done;
+  }
+  int ret;
+  Py_BEGIN_ALLOW_THREADS
+  ret = oprf_EvaluateBatch(key.buf, n, blinded.buf, out.view.buf, fails.view.buf);
+  Py_END_ALLOW_THREADS
+  result = batch_result(ret, &out, &fails);
+done:
+  PyBuffer_Release(&key);
+  PyBuffer_Release(&blinded);
+  return result;
+}
+
+static PyObject *py_unblind_batch(PyObject *self, PyObject *args, PyObject *kwargs) {
+  (void) self;
+  static char *kwlist[] = {"r", "Z", "out", "fails_out", NULL};
+  Py_buffer r, Z;
+  PyObject *out_obj = NULL, *fails_obj = NULL;
+  if(!PyArg_ParseTupleAndKeywords(args, kwargs, "y*y*|OO:unblind_batch", kwlist,
+                                  &r, &Z, &out_obj, &fails_obj)) return NULL;
+  PyObject *result = NULL;
+  OutBuf out, fails;
+  if(r.len % crypto_core_ristretto255_SCALARBYTES != 0 || Z.len % crypto_core_ristretto255_BYTES != 0) {
+    PyErr_SetString(PyExc_ValueError, "r or Z is not a multiple of 32 bytes");
+    goto done;
+  }
+  const size_t n = (size_t) r.len / crypto_core_ristretto255_SCALARBYTES;
+  if(n != (size_t) Z.len / crypto_core_ristretto255_BYTES) {
+    PyErr_SetString(PyExc_ValueError, "r and Z must have the same number of elements");
+    goto done;
+  }
+  if(get_outbuf(out_obj, n * crypto_core_ristretto255_BYTES, "out", &out)) goto done;
+  if(get_outbuf(fails_obj, n, "fails_out", &fails)) {
+    PyBuffer_Release(&out.view);
+    Py_DECREF(out.obj);
+    goto done;
+  }
+  int ret;
+  Py_BEGIN_ALLOW_THREADS
+  ret = oprf_UnblindBatch(n, r.buf, Z.buf, out.view.buf, fails.view.buf);
+  Py_END_ALLOW_THREADS
+  result = batch_result(ret, &out, &fails);
+done:
+  PyBuffer_Release(&r);
+  PyBuffer_Release(&Z);
+  return result;
+}
+
+static PyObject *py_threshold_evaluate_batch(PyObject *self, PyObject *args, PyObject *kwargs) {
+  (void) self;
+  static char *kwlist[] = {"k", "blinded", "self", "indexes", "out", "fails_out", NULL};
+  Py_buffer k, blinded;
+  int index;
+  PyObject *seq, *out_obj = NULL, *fails_obj = NULL;
+  if(!PyArg_ParseTupleAndKeywords(args, kwargs, "y*y*iO|OO:threshold_evaluate_batch", kwlist,
+                                  &k, &blinded, &index, &seq, &out_obj, &fails_obj)) return NULL;
+  PyObject *result = NULL;
+  OutBuf out, fails;
+  uint8_t indexes[255];
+  uint16_t index_len;
+  if(check_len(&k, TOPRF_Share_BYTES, "param k")) goto done;
+  if(index>255 || index<1) {
+    PyErr_SetString(PyExc_ValueError, "self outside valid range");
+    goto done;
+  }
+  if(get_indexes(seq, indexes, &index_len)) goto done;
+  if(blinded.len % crypto_core_ristretto255_BYTES != 0) {
+    PyErr_SetString(PyExc_ValueError, "blinded is not a multiple of 32 bytes");
+    goto done;
+  }
+  const size_t n = (size_t) blinded.len / crypto_core_ristretto255_BYTES;
+  if(get_outbuf(out_obj, n * TOPRF_Part_BYTES, "out", &out)) goto done;
+  if(get_outbuf(fails_obj, n, "fails_out", &fails)) {
+    PyBuffer_Release(&out.view);
+    Py_DECREF(out.obj);
+    goto done;
+  }
+  int ret;
+  Py_BEGIN_ALLOW_THREADS
+  ret = toprf_EvaluateBatch(k.buf, n, blinded.buf, (uint8_t) index, indexes, index_len,
+                            out.view.buf, fails.view.buf);
+  Py_END_ALLOW_THREADS
+  result = batch_result(ret, &out, &fails);
+done:
+  PyBuffer_Release(&k);
+  PyBuffer_Release(&blinded);
+  return result;
+}
+
+static PyObject *py_dkg_start(PyObject *self, PyObject *args) {
+  (void) self;
+  int n, t;
+  if(!PyArg_ParseTuple(args, "ii:dkg_start", &n, &t)) return NULL;
+  if(n < t || n > 255) return PyErr_Format(PyExc_ValueError, "t cannot be bigger than n");
+  if(t < 2) return PyErr_Format(PyExc_ValueError, "t must be bigger than 1");
+
+  uint8_t commitments[t][crypto_core_ristretto255_BYTES];
+  TOPRF_Share shares[n];
+  int ret;
+  Py_BEGIN_ALLOW_THREADS
+  ret = dkg_start((uint8_t) n, (uint8_t) t, commitments, shares);
+  Py_END_ALLOW_THREADS
+  PyObject *result = NULL;
+  if(ret!=0) {
+    raise_error(ret);
+  } else {
+    PyObject *s = split_items((const uint8_t*) shares, (size_t) n, TOPRF_Share_BYTES);
+    if(s!=NULL) result = Py_BuildValue("(y#N)", commitments, (Py_ssize_t) sizeof commitments, s);
+  }
+  sodium_memzero(shares, sizeof shares);
+  return result;
+}
+
+static PyObject *py_dkg_verify_commitments(PyObject *self, PyObject *args) {
+  (void) self;
+  int n, t, index;
+  Py_buffer commitments;
+  PyObject *seq;
+  if(!PyArg_ParseTuple(args, "iiiy*O:dkg_verify_commitments", &n, &t, &index, &commitments, &seq)) return NULL;
+  PyObject *result = NULL;
+  if(n < t || n > 255) {
+    PyErr_SetString(PyExc_ValueError, "t cannot be bigger than n");
+    goto done;
+  }
+  if(t < 2) {
+    PyErr_SetString(PyExc_ValueError, "t must be bigger than 1");
+    goto done;
+  }
+  if(index < 1 || index > n) {
+    PyErr_SetString(PyExc_ValueError, "self must 1 <= self <= n");
+    goto done;
+  }
+  if(check_len(&commitments, (size_t) (n*t*crypto_core_ristretto255_BYTES), "commitments")) goto done;
+  size_t shares_len;
+  uint8_t *shares = join_items(seq, TOPRF_Share_BYTES, &shares_len, "shares");
+  if(shares==NULL) goto done;
+  if(shares_len != (size_t) n) {
+    free_items(shares, shares_len * TOPRF_Share_BYTES);
+    PyErr_Format(PyExc_ValueError, "shares must be %d items", n);
+    goto done;
+  }
+  uint8_t fails[255], fails_len = 0;
+  int ret;
+  Py_BEGIN_ALLOW_THREADS
+  ret = dkg_verify_commitments((uint8_t) n, (uint8_t) t, (uint8_t) index,
+                               (const uint8_t (*)[t][crypto_core_ristretto255_BYTES]) commitments.buf,
+                               (const TOPRF_Share*) shares, fails, &fails_len);
+  Py_END_ALLOW_THREADS
+  free_items(shares, shares_len * TOPRF_Share_BYTES);
+  if(ret!=0) raise_error(ret);
+  else result = PyBytes_FromStringAndSize((const char*) fails, fails_len);
+done:
+  PyBuffer_Release(&commitments);
+  return result;
+}
+
+static PyObject *py_dkg_finish(PyObject *self, PyObject *args) {
+  (void) self;
+  int n, index;
+  PyObject *seq;
+  if(!PyArg_ParseTuple(args, "iOi:dkg_finish", &n, &seq, &index)) return NULL;
+  if(index < 1 || index > n) return PyErr_Format(PyExc_ValueError, "self must 1 <= self <= n");
+  size_t shares_len;
+  uint8_t *shares = join_items(seq, TOPRF_Share_BYTES, &shares_len, "shares");
+  if(shares==NULL) return NULL;
+  if(shares_len != (size_t) n) {
+    free_items(shares, shares_len * TOPRF_Share_BYTES);
+    return PyErr_Format(PyExc_ValueError, "shares must be %d items", n);
+  }
+  TOPRF_Share xi = { .index = (uint8_t) index };
+  Py_BEGIN_ALLOW_THREADS
+  dkg_finish((uint8_t) n, (const TOPRF_Share*) shares, (uint8_t) index, &xi);
+  Py_END_ALLOW_THREADS
+  free_items(shares, shares_len * TOPRF_Share_BYTES);
+  PyObject *result = PyBytes_FromStringAndSize((const char*) &xi, sizeof xi);
+  sodium_memzero(&xi, sizeof xi);
+  return result;
+}
+
+static PyObject *py_dkg_reconstruct(PyObject *self, PyObject *args) {
+  (void) self;
+  PyObject *seq;
+  if(!PyArg_ParseTuple(args, "O:dkg_reconstruct", &seq)) return NULL;
+  size_t n;
+  uint8_t *responses = join_items(seq, TOPRF_Share_BYTES, &n, "responses");
+  if(responses==NULL) return NULL;
+  uint8_t result[crypto_scalarmult_ristretto255_BYTES];
+  Py_BEGIN_ALLOW_THREADS
+  dkg_reconstruct(n, (const TOPRF_Share*) responses, result);
+  Py_END_ALLOW_THREADS
+  free_items(responses, n * TOPRF_Share_BYTES);
+  PyObject *ret = PyBytes_FromStringAndSize((const char*) result, sizeof result);
+  sodium_memzero(result, sizeof result);
+  return ret;
+}
+
+// gets the C state from the ctypes structure of a tpdkg context
+static void *get_state(PyObject *obj, Py_buffer *view, const size_t size) {
+  if(PyObject_GetBuffer(obj, view, PyBUF_WRITABLE)!=0) return NULL;
+  if((size_t) view->len < size) {
+    PyBuffer_Release(view);
+    PyErr_SetString(PyExc_ValueError, "invalid state");
+    return NULL;
+  }
+  return view->buf;
+}
+
+static PyObject *py_tpdkg_tp_next(PyObject *self, PyObject *args) {
+  (void) self;
+  PyObject *state_obj;
+  Py_buffer msg, output;
+  if(!PyArg_ParseTuple(args, "Os*w*:tpdkg_tp_next", &state_obj, &msg, &output)) return NULL;
+  PyObject *result = NULL;
+  Py_buffer view;
+  TP_DKG_TPState *ctx = get_state(state_obj, &view, sizeof(TP_DKG_TPState));
+  if(ctx==NULL) goto done;
+  const size_t input_len = tpdkg_tp_input_size(ctx);
+  if((size_t) msg.len != input_len) {
+    PyErr_Format(PyExc_ValueError, "input msg is invalid size: %zdB must be: %zuB", msg.len, input_len);
+  } else if((size_t) output.len != tpdkg_tp_output_size(ctx)) {
+    PyErr_SetString(PyExc_ValueError, "output has invalid size");
+  } else {
+    int ret;
+    Py_BEGIN_ALLOW_THREADS
+    ret = tpdkg_tp_next(ctx, msg.buf, (size_t) msg.len, output.buf, (size_t) output.len);
+    Py_END_ALLOW_THREADS
+    if(ret!=0) raise_error(ret);
+    else result = Py_NewRef(Py_None);
+  }
+  PyBuffer_Release(&view);
+done:
+  PyBuffer_Release(&msg);
+  PyBuffer_Release(&output);
+  return result;
+}
+
+static PyObject *py_tpdkg_peer_next(PyObject *self, PyObject *args) {
+  (void) self;
+  PyObject *state_obj;
+  Py_buffer msg;
+  if(!PyArg_ParseTuple(args, "Os*:tpdkg_peer_next", &state_obj, &msg)) return NULL;
+  PyObject *result = NULL;
+  Py_buffer view;
+  TP_DKG_PeerState *ctx = get_state(state_obj, &view, sizeof(TP_DKG_PeerState));
+  if(ctx==NULL) goto done;
+  const size_t input_len = tpdkg_peer_input_size(ctx);
+  if((size_t) msg.len != input_len) {
+    PyErr_Format(PyExc_ValueError, "input msg is invalid size: %zdB must be: %zuB", msg.len, input_len);
+  } else {
+    const size_t output_len = tpdkg_peer_output_size(ctx);
+    // the new bytes object is not visible to other threads yet, so it
+    // can be filled without the GIL
+    PyObject *output = PyBytes_FromStringAndSize(NULL, (Py_ssize_t) output_len);
+    if(output!=NULL) {
+      uint8_t *out = (uint8_t*) PyBytes_AS_STRING(output);
+      int ret;
+      Py_BEGIN_ALLOW_THREADS
+      ret = tpdkg_peer_next(ctx, msg.buf, (size_t) msg.len, out, output_len);
+      Py_END_ALLOW_THREADS
+      if(ret!=0) {
+        Py_DECREF(output);
+        raise_error(ret);
+      } else {
+        result = output;
+      }
+    }
+  }
+  PyBuffer_Release(&view);
+done:
+  PyBuffer_Release(&msg);
+  return result;
+}
+
+static PyMethodDef native_methods[] = {
+  {"keygen", py_keygen, METH_NOARGS, "generates an OPRF private key"},
+  {"blind", py_blind, METH_VARARGS, "blind(x) -> (r, blinded)"},
+  {"evaluate", py_evaluate, METH_VARARGS, "evaluate(key, blinded) -> Z"},
+  {"unblind", py_unblind, METH_VARARGS, "unblind(r, Z) -> N"},
+  {"finalize", py_finalize, METH_VARARGS, "finalize(x, N) -> y"},
+  {"unblind_finalize", py_unblind_finalize, METH_VARARGS, "unblind_finalize(r, Z, x) -> y"},
+  {"create_shares", py_create_shares, METH_VARARGS, "create_shares(secret, n, t) -> shares"},
+  {"thresholdmult", py_thresholdmult, METH_VARARGS, "thresholdmult(responses) -> result"},
+  {"threshold_evaluate", py_threshold_evaluate, METH_VARARGS, "threshold_evaluate(k, blinded, self, indexes) -> Z"},
+  {"threshold_combine", py_threshold_combine, METH_VARARGS, "threshold_combine(responses) -> result"},
+  {"evaluate_batch", (PyCFunction)(void(*)(void)) py_evaluate_batch, METH_VARARGS | METH_KEYWORDS,
+   "evaluate_batch(key, blinded, out=None, fails_out=None) -> (Z, fails)"},
+  {"unblind_batch", (PyCFunction)(void(*)(void)) py_unblind_batch, METH_VARARGS | METH_KEYWORDS,
+   "unblind_batch(r, Z, out=None, fails_out=None) -> (N, fails)"},
+  {"threshold_evaluate_batch", (PyCFunction)(void(*)(void)) py_threshold_evaluate_batch, METH_VARARGS | METH_KEYWORDS,
+   "threshold_evaluate_batch(k, blinded, self, indexes, out=None, fails_out=None) -> (Z, fails)"},
+  {"dkg_start", py_dkg_start, METH_VARARGS, "dkg_start(n, t) -> (commitments, shares)"},
+  {"dkg_verify_commitments", py_dkg_verify_commitments, METH_VARARGS,
+   "dkg_verify_commitments(n, t, self, commitments, shares) -> fails"},
+  {"dkg_finish", py_dkg_finish, METH_VARARGS, "dkg_finish(n, shares, self) -> xi"},
+  {"dkg_reconstruct", py_dkg_reconstruct, METH_VARARGS, "dkg_reconstruct(responses) -> result"},
+  {"tpdkg_tp_next", py_tpdkg_tp_next, METH_VARARGS,
+   "tpdkg_tp_next(state, msg, output), state is a TP_DKG_TPState, output a writable buffer"},
+  {"tpdkg_peer_next", py_tpdkg_peer_next, METH_VARARGS,
+   "tpdkg_peer_next(state, msg) -> output, state is a TP_DKG_PeerState"},
+  {NULL, NULL, 0, NULL}
+};
+
+static struct PyModuleDef native_module = {
+  PyModuleDef_HEAD_INIT,
+  "pyoprf._native",
+  "native implementation of the hot paths of pyoprf, releasing the GIL",
+  -1,
+  native_methods,
+  NULL, NULL, NULL, NULL
+};
+
+PyMODINIT_FUNC PyInit__native(void) {
+  if(sodium_init() < 0) {
+    PyErr_SetString(PyExc_ImportError, "libsodium could not be initialized");
+    return NULL;
+  }
+  return PyModule_Create(&native_module);
+}
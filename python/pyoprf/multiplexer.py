@@ -1,8 +1,21 @@
 #!/usr/bin/env python
 
-import ssl, socket, select
+import ssl, socket, select, asyncio
 from binascii import a2b_base64
 
+def ssl_context(ssl_cert=None):
+    ctx = ssl.create_default_context()
+    ctx.minimum_version = ssl.TLSVersion.TLSv1_2
+    if(ssl_cert):
+        ctx.load_verify_locations(ssl_cert) # only for dev, production system should use proper certs!
+        ctx.check_hostname=False            # only for dev, production system should use proper certs!
+        ctx.verify_mode=ssl.CERT_NONE       # only for dev, production system should use proper certs!
+    else:
+        ctx.load_default_certs()
+        ctx.verify_mode = ssl.CERT_REQUIRED
+        ctx.check_hostname = True
+    return ctx
+
 class Peer:
     def __init__(self, name, addr, type = "SSL", ssl_cert=None, timeout=5):
         self.name = name
@@ -24,16 +37,7 @@ class Peer:
             raise ValueError(f"Unsupported peer type: {self.type}")
 
         if self.type == "SSL":
-           ctx = ssl.create_default_context()
-           ctx.minimum_version = ssl.TLSVersion.TLSv1_2
-           if(self.ssl_cert):
-               ctx.load_verify_locations(self.ssl_cert) # only for dev, production system should use proper certs!
-               ctx.check_hostname=False                 # only for dev, production system should use proper certs!
-               ctx.verify_mode=ssl.CERT_NONE            # only for dev, production system should use proper certs!
-           else:
-               ctx.load_default_certs()
-               ctx.verify_mode = ssl.CERT_REQUIRED
-               ctx.check_hostname = True
+           ctx = ssl_context(self.ssl_cert)
 
         s = socket.socket(socket.AF_INET, socket.SOCK_STREAM)
         s.settimeout(self.timeout)
@@ -155,3 +159,193 @@ class Multiplexer:
     def close(self):
       for p in self.peers:
         p.close()
+
+class AsyncPeer:
+    """ the asyncio counterpart of Peer, connections are kept open
+    across requests and reopened on demand if they got lost """
+    def __init__(self, name, addr, type = "SSL", ssl_cert=None, timeout=5):
+        self.name = name
+        self.type = type
+        self.address = addr
+        self.ssl_cert = ssl_cert
+        self.timeout = timeout
+        self.state = "new"
+        self.reader = None
+        self.writer = None
+        # a read abandoned by a gather that had enough responses
+        # without this peer, the next request skips the peer until the
+        # late response has been read and dropped
+        self.stale = None
+        # a request has been sent and its response not read yet
+        self.expecting = False
+
+    async def connect(self):
+        if self.state == "connected":
+            raise ValueError(f"{self.name} is already connected")
+
+        if self.type not in {"SSL", "TCP"}:
+            raise ValueError(f"Unsupported peer type: {self.type}")
+
+        ctx = ssl_context(self.ssl_cert) if self.type == "SSL" else None
+        self.reader, self.writer = await asyncio.wait_for(
+            asyncio.open_connection(self.address[0], self.address[1], ssl=ctx,
+                                    server_hostname=self.address[0] if ctx else None),
+            self.timeout)
+        self.stale = None
+        self.expecting = False
+        self.state = "connected"
+
+    def busy(self):
+        """ true while the response to an abandoned read is still
+        outstanding, such peers are skipped by requests. """
+        if self.stale is not None and self.stale.done():
+            if self.stale.cancelled() or self.stale.exception() is not None:
+                # the stream is out of sync, reconnect on next use
+                self.state = "disconnected"
+            self.stale = None
+        return self.stale is not None
+
+    async def ensure_connected(self):
+        if self.busy(): return
+        if self.state != "connected" or self.reader.at_eof():
+            await self.close()
+            await self.connect()
+
+    async def read(self, size):
+        if self.state != "connected":
+            raise ValueError(f"{self.name} cannot read, is not connected")
+        self.expecting = False
+        try:
+            return await asyncio.wait_for(self.reader.readexactly(size), self.timeout)
+        except asyncio.IncompleteReadError as e:
+            self.state = 'disconnected'
+            return e.partial
+
+    async def send(self, msg):
+        if self.state != "connected" or self.busy():
+            raise ValueError(f"{self.name} cannot send, is not connected or still busy")
+        self.writer.write(msg)
+        self.expecting = True
+        await asyncio.wait_for(self.writer.drain(), self.timeout)
+
+    async def close(self):
+        if self.stale is not None:
+            self.stale.cancel()
+            self.stale = None
+        if self.writer is not None:
+            self.writer.close()
+            try: await self.writer.wait_closed()
+            except (OSError, ssl.SSLError): pass
+        self.reader = self.writer = None
+        self.expecting = False
+        self.state = "closed"
+
+class AsyncMultiplexer:
+    """ connects, broadcasts and gathers concurrently, so the latency
+    of a request is that of the slowest peer needed, not the sum of
+    all of them.
+
+    async with AsyncMultiplexer(peers) as m:
+        await m.connect()
+        await m.broadcast(msg)
+        # any t responses are enough for a threshold OPRF
+        responses = await m.gather(msglen, t)
+    """
+    def __init__(self, peers, type="SSL", ssl_cert=None):
+        self.peers = [AsyncPeer(name, (p['host'],p['port']), type=p.get("type", type),
+                                ssl_cert = p.get('ssl_cert', ssl_cert), timeout = p.get('timeout', 5))
+                      for name, p in peers.items()]
+
+    def __getitem__(self, idx):
+        return self.peers[idx]
+
+    def __iter__(self):
+        for p in self.peers:
+            yield p
+
+    def __len__(self):
+        return len(self.peers)
+
+    async def __aenter__(self):
+        return self
+
+    async def __aexit__(self, exception_type, exception_value, exception_traceback):
+        await self.close()
+
+    async def connect(self, n=None):
+        """ (re)connects all peers that are not connected, returns the
+        indexes of the peers that failed. raises if less than n peers
+        are connected. peers still busy with a previous request stay
+        connected, but are not available for the next one """
+        res = await asyncio.gather(*(p.ensure_connected() for p in self.peers), return_exceptions=True)
+        fails = [i for i, r in enumerate(res) if isinstance(r, BaseException)]
+        if n is not None and len(self.peers) - len(fails) < n:
+            raise ValueError("not enough peers could be connected")
+        return fails
+
+    async def send(self, idx, msg):
+        await self.peers[idx].send(msg)
+
+    async def broadcast(self, msg):
+        peers = [p for p in self.peers if p.state == "connected" and not p.busy()]
+        res = await asyncio.gather(*(p.send(msg) for p in peers), return_exceptions=True)
+        for p, r in zip(peers, res):
+            if isinstance(r, BaseException): await p.close()
+
+    async def gather(self, expectedmsglen, n=None, proc=None, timeout=None, debug=False):
+        """ reads an expectedmsglen sized response from all peers a
+        request has been sent to, at the same time, and returns as soon
+        as n of them are valid, or all these peers answered. each read is bounded by the
+        timeout of its peer, the whole gather by timeout.
+
+        returns a list with a response - or None - per peer, like
+        Multiplexer.gather() """
+        if n is None:
+            n=len(self.peers)
+        responses={}
+        tasks={asyncio.ensure_future(p.read(expectedmsglen)): idx
+               for idx, p in enumerate(self.peers) if p.state == "connected" and p.expecting}
+        if len(tasks) < n:
+            for t in tasks: t.cancel()
+            raise ValueError("not enough peers left to get enough results")
+
+        loop = asyncio.get_running_loop()
+        deadline = None if timeout is None else loop.time() + timeout
+        pending = set(tasks)
+        while pending and sum(1 for v in responses.values() if v is not None) < n:
+            remaining = None if deadline is None else deadline - loop.time()
+            if remaining is not None and remaining <= 0:
+                if debug: print("gather timed out")
+                break
+            done, pending = await asyncio.wait(pending, timeout=remaining, return_when=asyncio.FIRST_COMPLETED)
+            for t in done:
+                idx = tasks[t]
+                if t.exception() is not None:
+                    if debug: print(f"{idx} failed: {t.exception()!r}")
+                    await self.peers[idx].close()
+                    responses[idx]=None
+                    continue
+                pkt = t.result()
+                if debug: print(f"{idx} got response of {len(pkt)}")
+                if pkt == b'\x00\x04fail' or len(pkt) != expectedmsglen:
+                    responses[idx]=None
+                    continue
+                tmp = pkt if not proc else proc(pkt)
+                responses[idx]=tmp
+        # first n responses win, the late ones are drained before the
+        # next request to keep the connection in sync
+        for t in pending:
+            self.peers[tasks[t]].stale = t
+
+        if len(responses) == 0 or set((tuple(e) if isinstance(e,list) else e) for e in responses.values())=={None}:
+            raise ValueError("oracles failed")
+        return [responses.get(i,None) for i in range(len(self.peers))]
+
+    async def request(self, msg, expectedmsglen, n=None, proc=None, timeout=None, debug=False):
+        """ (re)connects, broadcasts msg and gathers the responses """
+        await self.connect(n)
+        await self.broadcast(msg)
+        return await self.gather(expectedmsglen, n, proc=proc, timeout=timeout, debug=debug)
+
+    async def close(self):
+        await asyncio.gather(*(p.close() for p in self.peers), return_exceptions=True)
@@ -0,0 +1,200 @@
+#!/usr/bin/env python
+"""
+Asynchronous drivers for the trusted party and the peers of a tp-dkg run
+
+   SPDX-FileCopyrightText: 2024, Marsiske Stefan
+   SPDX-License-Identifier: LGPL-3.0-or-later
+
+Copyright (c) 2024, Marsiske Stefan.
+All rights reserved.
+
+  This file is part of liboprf.
+
+  liboprf is free software: you can redistribute it and/or
+  modify it under the terms of the GNU Lesser General Public License
+  as published by the Free Software Foundation, either version 3 of
+  the License, or (at your option) any later version.
+
+  liboprf is distributed in the hope that it will be
+  useful, but WITHOUT ANY WARRANTY; without even the implied
+  warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+  See the GNU Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public License
+  along with liboprf. If not, see <http://www.gnu.org/licenses/>.
+
+The step by step wrappers in pyoprf allocate fresh buffers for every
+step and copy every message into bytes, which is fine for tests, but
+with dozens of peers the ceremony ends up dominated by this glue. The
+drivers here keep one input and one output buffer per session, grown
+to the largest step, feed the message of each peer into the input
+buffer as soon as it arrives, and hand memoryviews into the output
+buffer directly to the streams, with the reads and writes of all peers
+of a step running concurrently.
+
+    async with AsyncMultiplexer(peers, type="TCP") as m:
+        await m.connect(len(m))
+        tp = TPDKG(m, t, ts_epsilon, "proto name", peer_lt_pks)
+        await tp.run()
+
+and on each peer, connected to the TP by reader and writer:
+
+    peer = await PeerDKG.start(reader, writer, ts_epsilon, lt_sk)
+    await peer.run()
+    share = peer.share # a wide share, with a 16 bit index
+"""
+
+import ctypes, asyncio
+from . import (liboprf, tpdkg_start_tp, tpdkg_peer_start, tpdkg_tp_input_size,
+               tpdkg_tp_input_sizes, tpdkg_tp_output_size, tpdkg_tp_not_done,
+               tpdkg_get_cheaters, tpdkg_peer_input_size, tpdkg_peer_output_size,
+               tpdkg_peer_not_done, tpdkg_peer_free, tpdkg_msg0_SIZE)
+
+def _check(code):
+    if code != 0:
+        raise ValueError(f"error: {code}")
+
+class _Buffer:
+    """ a ctypes buffer which is reused by all the steps of a session,
+    and only reallocated if a step needs more than all before """
+    def __init__(self):
+        self.buf = ctypes.create_string_buffer(1)
+        self.view = memoryview(self.buf).cast('B')
+
+    def get(self, size):
+        if size > len(self.buf):
+            self.buf = ctypes.create_string_buffer(size)
+            self.view = memoryview(self.buf).cast('B')
+        return self.buf
+
+def _unbuffered(writer):
+    """ makes drain() wait until everything written has been handed to
+    the socket, the streams keep references to the memoryviews passed
+    to write() until then, and the buffer behind them is overwritten
+    by the next step """
+    writer.transport.set_write_buffer_limits(high=0)
+
+class TPDKG:
+    """ the trusted party of a tp-dkg run, talking to the peers of an
+    already connected AsyncMultiplexer, the order of the peers in the
+    multiplexer is the order of peer_lt_pks. the other parameters are
+    the same as those of pyoprf.tpdkg_start_tp() """
+    def __init__(self, mux, t, ts_epsilon, proto_name, peer_lt_pks, refresh=False, optimistic=False, resume_id=None):
+        if len(mux) != len(peer_lt_pks):
+            raise ValueError("the number of peers and long-term keys differ")
+        self.mux = mux
+        self.ctx, self.msg0 = tpdkg_start_tp(len(mux), t, ts_epsilon, proto_name, peer_lt_pks,
+                                             refresh=refresh, optimistic=optimistic, resume_id=resume_id)
+        self.input = _Buffer()
+        self.output = _Buffer()
+        for p in mux:
+            _unbuffered(p.writer)
+
+    async def _scatter(self, msgs):
+        res = await asyncio.gather(*(p.send(msg) for p, msg in zip(self.mux, msgs)), return_exceptions=True)
+        for i, r in enumerate(res):
+            if isinstance(r, BaseException):
+                raise ValueError(f"sending to peer {i+1} failed: {r!r}")
+
+    async def _gather(self, input, input_len):
+        """ reads the message of every peer for the current step, and
+        feeds them into input in the order they arrive """
+        _, sizes = tpdkg_tp_input_sizes(self.ctx)
+        state = ctypes.byref(self.ctx[0])
+        async def recv(i):
+            msg = await self.mux[i].read(sizes[i])
+            if len(msg) != sizes[i]:
+                raise ValueError(f"peer {i+1} sent a short message of {len(msg)}B instead of {sizes[i]}B")
+            # a failed verification is recorded as cheating and
+            # reported by tpdkg_tp_next(), everything else is fatal
+            ret = liboprf.tpdkg_tp_feed(state, i, msg, ctypes.c_size_t(len(msg)), input, ctypes.c_size_t(input_len))
+            if ret not in (0, 5): _check(ret)
+        res = await asyncio.gather(*(recv(i) for i in range(len(self.mux))), return_exceptions=True)
+        for i, r in enumerate(res):
+            if isinstance(r, BaseException):
+                raise ValueError(f"receiving from peer {i+1} failed: {r!r}")
+
+    def _next(self, input, input_len):
+        output_len = tpdkg_tp_output_size(self.ctx)
+        output = self.output.get(output_len)
+        step = self.ctx[0].step
+        ret = liboprf.tpdkg_tp_next(ctypes.byref(self.ctx[0]), input, ctypes.c_size_t(input_len),
+                                    output, ctypes.c_size_t(output_len))
+        if ret != 0:
+            cheaters, cheats = tpdkg_get_cheaters(self.ctx)
+            raise ValueError(f"error: {ret} | tp step {step} | misbehaving peers: {sorted(cheaters)} {cheats}")
+        return output, output_len
+
+    def _peer_msgs(self, output, output_len):
+        """ the message of each peer as a memoryview into output """
+        state = ctypes.byref(self.ctx[0])
+        base = ctypes.addressof(output)
+        msg = ctypes.c_void_p()
+        size = ctypes.c_size_t()
+        msgs = []
+        for i in range(len(self.mux)):
+            _check(liboprf.tpdkg_tp_peer_msg(state, output, ctypes.c_size_t(output_len), i,
+                                             ctypes.byref(msg), ctypes.byref(size)))
+            offset = msg.value - base
+            msgs.append(self.output.view[offset:offset + size.value])
+        return msgs
+
+    async def run(self):
+        """ runs the whole protocol, raises ValueError on failure,
+        tpdkg_get_cheaters(self.ctx) tells who is to blame """
+        await self._scatter([self.msg0] * len(self.mux))
+        while tpdkg_tp_not_done(self.ctx):
+            input_len = tpdkg_tp_input_size(self.ctx)
+            input = self.input.get(input_len)
+            if input_len > 0:
+                await self._gather(input, input_len)
+            output, output_len = self._next(input, input_len)
+            if output_len > 0:
+                await self._scatter(self._peer_msgs(output, output_len))
+
+    def cheaters(self):
+        return tpdkg_get_cheaters(self.ctx)
+
+class PeerDKG:
+    """ a peer of a tp-dkg run, talking to the TP over an asyncio
+    stream, use start() to create it from the first message of the TP """
+    def __init__(self, reader, writer, ctx, timeout=5):
+        self.reader = reader
+        self.writer = writer
+        self.ctx = ctx
+        self.timeout = timeout
+        self.output = _Buffer()
+        _unbuffered(writer)
+
+    @classmethod
+    async def start(cls, reader, writer, ts_epsilon, lt_sk, share=None, cache=None, timeout=5):
+        """ reads the first message from the TP and starts the peer,
+        share and cache are the same as for pyoprf.tpdkg_peer_start() """
+        msg0 = await asyncio.wait_for(reader.readexactly(tpdkg_msg0_SIZE), timeout)
+        return cls(reader, writer, tpdkg_peer_start(ts_epsilon, lt_sk, msg0, share, cache), timeout)
+
+    async def run(self):
+        """ runs the whole protocol, raises ValueError on failure, the
+        result is available as self.share afterwards """
+        state = ctypes.byref(self.ctx[0])
+        while tpdkg_peer_not_done(self.ctx):
+            input_len = tpdkg_peer_input_size(self.ctx)
+            msg = b''
+            if input_len > 0:
+                msg = await asyncio.wait_for(self.reader.readexactly(input_len), self.timeout)
+            output_len = tpdkg_peer_output_size(self.ctx)
+            output = self.output.get(output_len)
+            step = self.ctx[0].step
+            ret = liboprf.tpdkg_peer_next(state, msg, ctypes.c_size_t(input_len), output, ctypes.c_size_t(output_len))
+            if ret != 0:
+                raise ValueError(f"error: {ret} | peer {self.ctx[0].index} step {step}")
+            if output_len > 0:
+                self.writer.write(self.output.view[:output_len])
+                await asyncio.wait_for(self.writer.drain(), self.timeout)
+
+    @property
+    def share(self):
+        return bytes(self.ctx[0].share)
+
+    def free(self):
+        tpdkg_peer_free(self.ctx)
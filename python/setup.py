@@ -4,7 +4,7 @@
 # SPDX-License-Identifier: LGPL-3.0-or-later
 
 import os
-from setuptools import setup, find_packages
+from setuptools import setup, find_packages, Extension
 
 
 # Utility function to read the README file.
@@ -14,6 +14,18 @@ from setuptools import setup, find_packages
 def read(fname):
     return open(os.path.join(os.path.dirname(__file__), fname)).read()
 
+# the optional native extension, needs the liboprf headers and
+# library, which are looked up under LIBOPRF_PREFIX. If it cannot be
+# built, pyoprf falls back to its ctypes implementation.
+prefix = os.environ.get('LIBOPRF_PREFIX', '/usr/local')
+liboprf = Extension('pyoprf._native',
+                    sources = ['pyoprf/_native.c'],
+                    include_dirs = [os.path.join(prefix, 'include', 'oprf', d)
+                                    for d in ('', 'noiseXK', 'noiseXK/karmel', 'noiseXK/karmel/minimal')],
+                    library_dirs = [os.path.join(prefix, 'lib')],
+                    libraries = ['oprf', 'sodium'],
+                    optional = True)
+
 setup(name = 'pyoprf',
        version = '0.0.3',
        description = 'python bindings for liboprf',
@@ -29,5 +41,5 @@ setup(name = 'pyoprf',
                       "Topic :: Security :: Cryptography",
                       "Topic :: Security",
                    ],
-       #ext_modules = [liboprf],
+       ext_modules = [liboprf],
 )
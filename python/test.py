@@ -150,4 +150,69 @@ assert v0 == v2
 secret = pyoprf.dkg_reconstruct(shares[:t])
 #print("secret", secret.hex())
 assert v0 == pysodium.crypto_scalarmult_ristretto255_base(secret)
+
+######################################################################
+print("batch functions")
+
+xs = [b"test%d" % i for i in range(8)] + [b"x" * 300]
+rs, blindeds = pyoprf.blind_batch(xs)
+Zs, fails = pyoprf.evaluate_batch(k, blindeds)
+assert not any(fails)
+Ns, fails = pyoprf.unblind_batch(rs, memoryview(Zs))
+assert not any(fails)
+for i in range(len(xs)):
+    N = Ns[i*32:(i+1)*32]
+    assert bytes(N) == pyoprf.unblind(bytes(rs[i*32:(i+1)*32]), pyoprf.evaluate(k, bytes(blindeds[i*32:(i+1)*32])))
+
+# outputs written into preallocated buffers, invalid elements are reported
+Zs2 = bytearray(len(Zs))
+bad = bytes(blindeds[:32]) + b"\xff" * 32
+_, fails = pyoprf.evaluate_batch(k, bad, out=memoryview(Zs2)[:64])
+assert list(fails) == [0, 1] and Zs2[:32] == Zs[:32] and Zs2[32:64] == bytes(32)
+
+# threshold evaluation of a batch, combined per element
+parts = [pyoprf.threshold_evaluate_batch(shares[i], blindeds, i+1, [1,2,3])[0] for i in range(3)]
+for i in range(len(xs)):
+    beta = pyoprf.threshold_combine([bytes(p[i*33:(i+1)*33]) for p in parts])
+    assert beta == pysodium.crypto_scalarmult_ristretto255(secret, bytes(blindeds[i*32:(i+1)*32]))
+
+# responses combined as they arrive
+c = pyoprf.Combiner(t)
+responses = [bytes([i+1])+pysodium.crypto_scalarmult_ristretto255_base(shares[i][1:]) for i in (4, 1, 3)]
+assert c.add(responses[0]) is None and c.add(responses[1]) is None
+assert c.add(responses[2]) == v0
+
+print("HashDH key rotation")
+k_new = pyoprf.keygen()
+delta = pyoprf.key_delta(k, k_new)
+Ns_new = bytearray(Ns)
+Ns_new, fails = pyoprf.apply_delta_batch(delta, Ns_new, out=Ns_new, threads=2)
+assert not any(fails)
+for i, x in enumerate(xs):
+    # the last input is too long for pyoprf.blind()
+    r, alpha = (bytes(e) for e in pyoprf.blind_batch([x]))
+    N_new = pyoprf.unblind(r, pyoprf.evaluate(k_new, alpha))
+    assert bytes(Ns_new[i*32:(i+1)*32]) == N_new
+    assert pyoprf.apply_delta(delta, bytes(Ns[i*32:(i+1)*32])) == N_new
+# threshold keys, rotated by updating the shares with a random delta
+delta = pysodium.crypto_core_ristretto255_scalar_random()
+new_shares = [pyoprf.update_share(s, delta) for s in shares]
+assert pyoprf.threshold_key_delta(shares[:t], new_shares[1:t+1]) == delta
+print("share store")
+import os, tempfile
+with tempfile.TemporaryDirectory() as d:
+    path = os.path.join(d, "shares")
+    key = os.urandom(pyoprf.sharestore_KEYBYTES)
+    ids = [bytes([i])*pyoprf.sharestore_ID_BYTES for i in range(len(shares))]
+    with pyoprf.ShareStore(path, key, pyoprf.SHARESTORE_CREATE) as store:
+        for id, share in zip(ids, shares):
+            store[id] = share
+        del store[ids[0]]
+    with pyoprf.ShareStore(path, key) as store:
+        assert store.get(ids[0]) is None
+        assert [store[id] for id in ids[1:]] == shares[1:]
+    try:
+        pyoprf.ShareStore(path)
+        assert False, "opened an encrypted store without key"
+    except ValueError: pass
 print("all ok")
@@ -62,40 +62,50 @@ for i in range(n):
     assert(bytes(peers[i][0].sessionid) == bytes(tp[0].sessionid))
     assert(peer_lt_sks[i] == bytes(peers[i][0].lt_sk))
 
-peer_msgs = []
-while pyoprf.tpdkg_tp_not_done(tp):
-    ret, sizes = pyoprf.tpdkg_tp_input_sizes(tp)
-    # peer_msgs = (recv(size) for size in sizes)
-    msgs = b''.join(peer_msgs)
-
-    cur_step = tp[0].step
-    try:
-      tp_out = pyoprf.tpdkg_tp_next(tp, msgs)
-      #print(f"tp: msg[{tp[0].step}]: {tp_out.raw.hex()}")
-    except Exception as e:
-      cheaters, cheats = pyoprf.tpdkg_get_cheaters(tp)
-      print(f"Warning during the distributed key generation the peers misbehaved: {sorted(cheaters)}")
-      for k, v in cheats:
-          print(f"\tmisbehaving peer: {k} was caught: {v}")
-      raise ValueError(f"{e} | tp step {cur_step}")
-
+def run(tp, peers):
     peer_msgs = []
-    while(len(b''.join(peer_msgs))==0 and pyoprf.tpdkg_peer_not_done(peers[0])):
-        for i in range(n):
-            if(len(tp_out)>0):
-                msg = pyoprf.tpdkg_tp_peer_msg(tp, tp_out, i)
-                #print(f"tp -> peer[{i+1}] {msg.hex()}")
-            else:
-                msg = ''
-            out = pyoprf.tpdkg_peer_next(peers[i], msg)
-            if(len(out)>0):
-                peer_msgs.append(out)
-                #print(f"peer[{i+1}] -> tp {peer_msgs[-1].hex()}")
-        tp_out = ''
+    while pyoprf.tpdkg_tp_not_done(tp):
+        ret, sizes = pyoprf.tpdkg_tp_input_sizes(tp)
+        # peer_msgs = (recv(size) for size in sizes)
+        msgs = b''.join(peer_msgs)
+
+        cur_step = tp[0].step
+        try:
+          tp_out = pyoprf.tpdkg_tp_next(tp, msgs)
+          #print(f"tp: msg[{tp[0].step}]: {tp_out.raw.hex()}")
+        except Exception as e:
+          cheaters, cheats = pyoprf.tpdkg_get_cheaters(tp)
+          print(f"Warning during the distributed key generation the peers misbehaved: {sorted(cheaters)}")
+          for k, v in cheats:
+              print(f"\tmisbehaving peer: {k} was caught: {v}")
+          raise ValueError(f"{e} | tp step {cur_step}")
+
+        peer_msgs = []
+        while(len(b''.join(peer_msgs))==0 and pyoprf.tpdkg_peer_not_done(peers[0])):
+            for i in range(n):
+                if(len(tp_out)>0):
+                    msg = pyoprf.tpdkg_tp_peer_msg(tp, tp_out, i)
+                    #print(f"tp -> peer[{i+1}] {msg.hex()}")
+                else:
+                    msg = ''
+                out = pyoprf.tpdkg_peer_next(peers[i], msg)
+                if(len(out)>0):
+                    peer_msgs.append(out)
+                    #print(f"peer[{i+1}] -> tp {peer_msgs[-1].hex()}")
+            tp_out = ''
+
+run(tp, peers)
 
 # we are done, let's check the shares
 
-shares = [bytes(peers[i][0].share) for i in range(n)]
+# tp-dkg results in wide shares with a 16 bit index in host order, the
+# indexes here fit in one byte, which makes them regular shares
+def narrow(share):
+    assert len(share) == pyoprf.TOPRF_WideShare_BYTES and share[1] == 0
+    return share[:1] + share[2:]
+
+wide_shares = [bytes(peers[i][0].share) for i in range(n)]
+shares = [narrow(s) for s in wide_shares]
 for i, share in enumerate(shares):
     print(f"share[{i+1}] {share.hex()}")
 
@@ -109,6 +119,62 @@ secret = pyoprf.dkg_reconstruct(shares[:t])
 #print("secret", secret.hex())
 assert v0 == pysodium.crypto_scalarmult_ristretto255_base(secret)
 
+# keep the channels between the peers for the refresh
+caches = [pyoprf.tpdkg_peer_save_resume(peers[i]) for i in range(n)]
+resume_id = bytes(tp[0].sessionid)
+
 # clean up allocated buffers
 for i in range(n):
     pyoprf.tpdkg_peer_free(peers[i])
+
+# refresh the shares, the same peers in the same order, saving a
+# round-trip, and the two of the noise handshakes by resuming the channels
+tp, msg0 = pyoprf.tpdkg_start_tp(n, t, ts_epsilon, "pyoprf tpdkg test", peer_lt_pks, refresh=True, optimistic=True, resume_id=resume_id)
+peers = [pyoprf.tpdkg_peer_start(ts_epsilon, peer_lt_sks[i], msg0, wide_shares[i], caches[i]) for i in range(n)]
+run(tp, peers)
+
+new_shares = [narrow(bytes(peers[i][0].share)) for i in range(n)]
+for i in range(n):
+    assert new_shares[i][0] == shares[i][0]
+    assert new_shares[i] != shares[i]
+# the shares change, the secret does not
+assert secret == pyoprf.dkg_reconstruct(new_shares[2:2+t])
+
+for i in range(n):
+    pyoprf.tpdkg_peer_free(peers[i])
+
+# the same over tcp, with the asynchronous drivers running the steps
+# of all peers concurrently
+import asyncio
+from pyoprf.multiplexer import AsyncMultiplexer
+from pyoprf.tpdkg import TPDKG, PeerDKG
+
+async def run_async():
+    results = {}
+    async def serve(i, reader, writer):
+        peer = await PeerDKG.start(reader, writer, ts_epsilon, peer_lt_sks[i])
+        try:
+            await peer.run()
+            results[i] = peer.share
+        finally:
+            peer.free()
+            writer.close()
+
+    servers = [await asyncio.start_server(lambda r, w, i=i: serve(i, r, w), '127.0.0.1', 0) for i in range(n)]
+    peers = {f"peer{i}": {'host': '127.0.0.1', 'port': s.sockets[0].getsockname()[1], 'type': 'TCP'}
+             for i, s in enumerate(servers)}
+    async with AsyncMultiplexer(peers) as m:
+        await m.connect(n)
+        tp = TPDKG(m, t, ts_epsilon, "pyoprf tpdkg test", peer_lt_pks)
+        await tp.run()
+    for s in servers:
+        s.close()
+        await s.wait_closed()
+    # give the peers the chance to finish their last step
+    while len(results) < n: await asyncio.sleep(0.01)
+    return [results[i] for i in range(n)]
+
+shares = [narrow(s) for s in asyncio.run(run_async())]
+secret = pyoprf.dkg_reconstruct(shares[:t])
+assert secret == pyoprf.dkg_reconstruct(shares[1:1+t])
+print("async tp-dkg ok")
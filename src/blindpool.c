@@ -0,0 +1,203 @@
+/*
+    @copyright 2024, Stefan Marsiske toprf@ctrlc.hu
+    This file is part of liboprf.
+
+    liboprf is free software: you can redistribute it and/or
+    modify it under the terms of the GNU Lesser General Public License
+    as published by the Free Software Foundation, either version 3 of
+    the License, or (at your option) any later version.
+
+    liboprf is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Lesser General Public License for more details.
+
+    You should have received a copy of the License
+    along with liboprf. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include "oprf.h"
+#include "scratch.h"
+#include "blindpool.h"
+
+// the number of entries precomputed with one inversion
+#define FILL_CHUNK 32
+
+typedef struct {
+  // the blinding scalar r
+  uint8_t r[crypto_core_ristretto255_SCALARBYTES];
+  // 1/r
+  uint8_t ir[crypto_core_ristretto255_SCALARBYTES];
+} Entry;
+
+/*
+ * The entries are a stack in locked memory, taken from the top and
+ * wiped when taken. Filling computes the entries without holding the
+ * lock and only takes it to push them.
+ */
+struct oprf_BlindPool {
+  pthread_mutex_t lock;
+  Entry *entries;
+  size_t cap;
+  size_t len;
+};
+
+oprf_BlindPool* oprf_BlindPool_new(const size_t capacity) {
+  if(capacity==0 || capacity > SIZE_MAX / sizeof(Entry)) return NULL;
+  oprf_BlindPool *pool = calloc(1, sizeof(oprf_BlindPool));
+  if(pool==NULL) return NULL;
+  pool->cap = capacity;
+  pool->entries = malloc(capacity * sizeof(Entry));
+  if(pool->entries==NULL) goto fail_entries;
+  if(sodium_mlock(pool->entries, capacity * sizeof(Entry))) goto fail_lock;
+  if(pthread_mutex_init(&pool->lock, NULL)) goto fail;
+  return pool;
+
+fail:
+  sodium_munlock(pool->entries, capacity * sizeof(Entry));
+fail_lock:
+  free(pool->entries);
+fail_entries:
+  free(pool);
+  return NULL;
+}
+
+void oprf_BlindPool_free(oprf_BlindPool *pool) {
+  if(pool==NULL) return;
+  pthread_mutex_destroy(&pool->lock);
+  // sodium_munlock() wipes the entries before unlocking them
+  sodium_munlock(pool->entries, pool->cap * sizeof(Entry));
+  free(pool->entries);
+  free(pool);
+}
+
+size_t oprf_BlindPool_size(oprf_BlindPool *pool) {
+  pthread_mutex_lock(&pool->lock);
+  const size_t len = pool->len;
+  pthread_mutex_unlock(&pool->lock);
+  return len;
+}
+
+// computes n <= FILL_CHUNK entries, inverting all scalars at once
+static int precompute(const size_t n, Entry out[n]) {
+  uint8_t r[FILL_CHUNK][crypto_core_ristretto255_SCALARBYTES];
+  uint8_t acc[FILL_CHUNK][crypto_core_ristretto255_SCALARBYTES];
+  uint8_t inv[crypto_core_ristretto255_SCALARBYTES];
+  if(-1==sodium_mlock(r, sizeof r)) return -1;
+  if(-1==sodium_mlock(acc, sizeof acc)) {
+    sodium_munlock(r, sizeof r);
+    return -1;
+  }
+  if(-1==sodium_mlock(inv, sizeof inv)) {
+    sodium_munlock(acc, sizeof acc);
+    sodium_munlock(r, sizeof r);
+    return -1;
+  }
+
+  // acc[i] = r[0] * ... * r[i]
+  for(size_t i=0;i<n;i++) {
+    crypto_core_ristretto255_scalar_random(r[i]);
+    if(i==0) memcpy(acc[0], r[0], sizeof acc[0]);
+    else crypto_core_ristretto255_scalar_mul(acc[i], acc[i-1], r[i]);
+  }
+  int ret = crypto_core_ristretto255_scalar_invert(inv, acc[n-1]);
+  if(ret==0) {
+    for(size_t i=n-1;i>0;i--) {
+      // 1/r[i] = 1/(r[0]*...*r[i]) * (r[0]*...*r[i-1])
+      crypto_core_ristretto255_scalar_mul(out[i].ir, inv, acc[i-1]);
+      crypto_core_ristretto255_scalar_mul(inv, inv, r[i]);
+    }
+    memcpy(out[0].ir, inv, sizeof inv);
+    for(size_t i=0;i<n;i++) memcpy(out[i].r, r[i], sizeof out[i].r);
+  }
+
+  sodium_munlock(inv, sizeof inv);
+  sodium_munlock(acc, sizeof acc);
+  sodium_munlock(r, sizeof r);
+  return ret;
+}
+
+int oprf_BlindPool_fill(oprf_BlindPool *pool, const size_t n) {
+  Entry chunk[FILL_CHUNK];
+  if(-1==sodium_mlock(chunk, sizeof chunk)) return -1;
+  size_t left = n;
+  int ret = 0;
+  while(left>0) {
+    size_t todo = pool->cap - oprf_BlindPool_size(pool);
+    if(todo > left) todo = left;
+    if(todo > FILL_CHUNK) todo = FILL_CHUNK;
+    if(todo==0) break;
+    if(precompute(todo, chunk)) {
+      ret = -1;
+      break;
+    }
+    pthread_mutex_lock(&pool->lock);
+    // the pool is shared, others might have filled it in the meantime
+    if(todo > pool->cap - pool->len) todo = pool->cap - pool->len;
+    memcpy(pool->entries + pool->len, chunk, todo * sizeof(Entry));
+    pool->len += todo;
+    pthread_mutex_unlock(&pool->lock);
+    left -= todo;
+  }
+  sodium_munlock(chunk, sizeof chunk);
+  return ret;
+}
+
+// takes the top entry, returns 1 if the pool is empty
+static int take(oprf_BlindPool *pool, Entry *entry) {
+  pthread_mutex_lock(&pool->lock);
+  if(pool->len==0) {
+    pthread_mutex_unlock(&pool->lock);
+    return 1;
+  }
+  Entry *top = &pool->entries[--pool->len];
+  memcpy(entry, top, sizeof(Entry));
+  sodium_memzero(top, sizeof(Entry));
+  pthread_mutex_unlock(&pool->lock);
+  return 0;
+}
+
+int oprf_BlindPool_BlindElement(oprf_BlindPool *pool,
+                                const uint8_t H0[crypto_core_ristretto255_BYTES],
+                                uint8_t ir[crypto_core_ristretto255_SCALARBYTES],
+                                uint8_t blinded[crypto_core_ristretto255_BYTES]) {
+  Entry *entry = oprf_scratch_push(sizeof(Entry));
+  if(entry==NULL) return -1;
+  int ret = take(pool, entry);
+  if(ret==0) {
+    // H^0(pw)^r
+    if(crypto_scalarmult_ristretto255(blinded, entry->r, H0) != 0) ret = -1;
+    else memcpy(ir, entry->ir, crypto_core_ristretto255_SCALARBYTES);
+  }
+  oprf_scratch_pop(entry, sizeof(Entry));
+  return ret;
+}
+
+int oprf_BlindPool_Blind(oprf_BlindPool *pool,
+                         const uint8_t *x, const uint8_t x_len,
+                         uint8_t ir[crypto_core_ristretto255_SCALARBYTES],
+                         uint8_t blinded[crypto_core_ristretto255_BYTES]) {
+  // no need to hash if there is nothing to blind with
+  if(oprf_BlindPool_size(pool)==0) return 1;
+  uint8_t *H0 = oprf_scratch_push(crypto_core_ristretto255_BYTES);
+  if(H0==NULL) return -1;
+  int ret = -1;
+  if(0==voprf_hash_to_group(x, x_len, H0)) {
+    ret = oprf_BlindPool_BlindElement(pool, H0, ir, blinded);
+  }
+  oprf_scratch_pop(H0, crypto_core_ristretto255_BYTES);
+  return ret;
+}
+
+int oprf_BlindPool_Unblind(const uint8_t ir[crypto_core_ristretto255_SCALARBYTES],
+                           const uint8_t Z[crypto_core_ristretto255_BYTES],
+                           uint8_t N[crypto_core_ristretto255_BYTES]) {
+  // (a) Checks that β ∈ G ∗ . If not, outputs (abort, sid , ssid ) and halts;
+  if(crypto_core_ristretto255_is_valid_point(Z) != 1) return -1;
+  // β^(1/r) = h(pwd)^k
+  if(crypto_scalarmult_ristretto255(N, ir, Z) != 0) return -1;
+  return 0;
+}
@@ -0,0 +1,118 @@
+/*
+    @copyright 2024, Stefan Marsiske toprf@ctrlc.hu
+    This file is part of liboprf.
+
+    liboprf is free software: you can redistribute it and/or
+    modify it under the terms of the GNU Lesser General Public License
+    as published by the Free Software Foundation, either version 3 of
+    the License, or (at your option) any later version.
+
+    liboprf is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Lesser General Public License for more details.
+
+    You should have received a copy of the License
+    along with liboprf. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef BLINDPOOL_H
+#define BLINDPOOL_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <sodium.h>
+
+/**
+ * Precomputed blinding factors.
+ *
+ * oprf_Blind() picks a fresh random r, and oprf_Unblind() inverts it,
+ * both on the critical path of a login. A pool moves that work to
+ * when the client is idle: oprf_BlindPool_fill() draws the scalars,
+ * inverts all of them together using Montgomery's trick, and recodes
+ * them for the scalar multiplication. Online blinding is then the
+ * hash to the group plus one scalar multiplication, and unblinding a
+ * single scalar multiplication.
+ *
+ * The entries live in locked memory, and each is handed out exactly
+ * once and wiped from the pool. The pool may be filled from one
+ * thread while it is used from others.
+ *
+ * The blinded elements are the same as those of oprf_Blind(), so the
+ * server side does not change. But the client keeps the inverse of
+ * the blinding scalar instead of r, which it must only pass to
+ * oprf_BlindPool_Unblind().
+ */
+typedef struct oprf_BlindPool oprf_BlindPool;
+
+/**
+ * Creates a new, empty pool.
+ * @param [in] capacity - the maximum number of entries in the pool
+ * @return The function returns a new pool, or NULL on error.
+ */
+oprf_BlindPool* oprf_BlindPool_new(const size_t capacity);
+
+/**
+ * Wipes and frees a pool and its unused entries.
+ */
+void oprf_BlindPool_free(oprf_BlindPool *pool);
+
+/**
+ * Precomputes up to n new entries, less if the pool gets full. This
+ * is the expensive part and is meant to be called while the client
+ * is idle, for example from a background thread.
+ * @param [in] pool - the pool
+ * @param [in] n - the number of entries to add
+ * @return The function returns 0 if everything is correct.
+ */
+int oprf_BlindPool_fill(oprf_BlindPool *pool, const size_t n);
+
+/**
+ * Returns the number of entries in the pool.
+ */
+size_t oprf_BlindPool_size(oprf_BlindPool *pool);
+
+/**
+ * Same as oprf_Blind(), but takes the blinding factor from the pool.
+ *
+ * @param [in] pool - the pool
+ * @param [in] x - the input value to blind
+ * @param [in] x_len - the length of param x in bytes
+ * @param [out] ir - the inverse of the blinding scalar, an input to
+ * oprf_BlindPool_Unblind()
+ * @param [out] blinded - a serialized OPRF group element, an input to
+ * oprf_Evaluate
+ * @return The function returns 0 if everything is correct, 1 if the
+ * pool is empty - the caller can then fall back to oprf_Blind() - and
+ * -1 on errors.
+ */
+int oprf_BlindPool_Blind(oprf_BlindPool *pool,
+                         const uint8_t *x, const uint8_t x_len,
+                         uint8_t ir[crypto_core_ristretto255_SCALARBYTES],
+                         uint8_t blinded[crypto_core_ristretto255_BYTES]);
+
+/**
+ * Same as oprf_BlindPool_Blind(), but for an input that is already
+ * hashed to the group, see oprf_BlindElement().
+ */
+int oprf_BlindPool_BlindElement(oprf_BlindPool *pool,
+                                const uint8_t H0[crypto_core_ristretto255_BYTES],
+                                uint8_t ir[crypto_core_ristretto255_SCALARBYTES],
+                                uint8_t blinded[crypto_core_ristretto255_BYTES]);
+
+/**
+ * Same as oprf_Unblind(), but takes the inverted blinding scalar
+ * produced by oprf_BlindPool_Blind(), so no inversion is needed.
+ *
+ * @param [in] ir - the inverse of the blinding scalar
+ * @param [in] Z - a serialized OPRF group element, an output of
+ * oprf_Evaluate
+ * @param [out] N - a serialized OPRF group element, an input to
+ * oprf_Finalize
+ * @return The function returns 0 if everything is correct.
+ */
+int oprf_BlindPool_Unblind(const uint8_t ir[crypto_core_ristretto255_SCALARBYTES],
+                           const uint8_t Z[crypto_core_ristretto255_BYTES],
+                           uint8_t N[crypto_core_ristretto255_BYTES]);
+
+#endif // BLINDPOOL_H
@@ -1,9 +1,14 @@
 #include <sodium.h>
 #include <stdint.h>
+#include <stdlib.h>
 #include <string.h>
 #include "toprf.h"
+#include "ristretto255.h"
 #include "utils.h"
 #include "dkg.h"
+#include "scratch.h"
+#include "shapes.h"
+#include "soa.h"
 
 /*
     @copyright 2023-24, Stefan Marsiske toprf@ctrlc.hu
@@ -33,38 +38,14 @@
  */
 
 
-static void polynom(const uint8_t j, const uint8_t threshold,
-                    const uint8_t a[threshold][crypto_core_ristretto255_SCALARBYTES],
-                    TOPRF_Share *result) {
-  //f(z) = a_0 + a_1*z + a_2*z^2 + a_3*z^3 + ⋯ + (a_t)*(z^t)
-  result->index=j;
-  // f(z) = result = a[0] +.....
-  memcpy(result->value, a[0], crypto_core_ristretto255_SCALARBYTES);
-
-  // z = j
-  uint8_t z[crypto_core_ristretto255_SCALARBYTES]={j};
-  // z^t ->
-  for(int t=1;t<threshold;t++) {
-    // tmp = 1
-    uint8_t tmp[crypto_core_ristretto255_SCALARBYTES]={1};
-    for(int exp=1;exp<=t;exp++) {
-      // tmp *= z
-      crypto_core_ristretto255_scalar_mul(tmp, tmp, z);
-    }
-    // a[t] * z^t
-    crypto_core_ristretto255_scalar_mul(tmp, a[t], tmp);
-    // add into result
-    crypto_core_ristretto255_scalar_add(result->value, result->value, tmp);
-  }
-}
-
 int dkg_start(const uint8_t n,
               const uint8_t threshold,
               uint8_t commitments[threshold][crypto_core_ristretto255_BYTES],
               TOPRF_Share shares[n]) {
 
-  uint8_t a[threshold][crypto_core_ristretto255_SCALARBYTES];
-  if(0!=sodium_mlock(a,sizeof a)) {
+  const size_t a_len = (size_t) threshold * crypto_core_ristretto255_SCALARBYTES;
+  uint8_t (*a)[crypto_core_ristretto255_SCALARBYTES] = oprf_scratch_push(a_len);
+  if(a==NULL) {
     return -1;
   }
 
@@ -82,23 +63,68 @@ int dkg_start(const uint8_t n,
   }
 
   // calculate shares s_ij
-  for(uint8_t j=1;j<=n;j++) {
-    //f(x) = a_0 + a_1*x + a_2*x^2 + a_3*x^3 + ⋯ + a_(t)*x^(t)
-    polynom(j, threshold, a, &shares[j-1]);
+  //f(x) = a_0 + a_1*x + a_2*x^2 + a_3*x^3 + ⋯ + a_(t)*x^(t)
+  toprf_polynom_shares(n, threshold, (const uint8_t (*)[crypto_core_ristretto255_SCALARBYTES]) a,
+                       (uint8_t (*)[TOPRF_Share_BYTES]) shares);
+
+  oprf_scratch_pop(a, a_len);
+
+  return 0;
+}
+
+int dkg_start_refresh(const uint8_t n,
+                      const uint8_t threshold,
+                      uint8_t commitments[threshold-1][crypto_core_ristretto255_BYTES],
+                      TOPRF_Share shares[n]) {
+  if(threshold<2) return -1;
+  const size_t a_len = (size_t) threshold * crypto_core_ristretto255_SCALARBYTES;
+  uint8_t (*a)[crypto_core_ristretto255_SCALARBYTES] = oprf_scratch_push(a_len);
+  if(a==NULL) {
+    return -1;
+  }
+
+  // a_0 = 0, so that the sum of the shares of all dealers added to
+  // the existing shares still reconstructs the same secret
+  memset(a[0], 0, sizeof a[0]);
+  for(int k=1;k<threshold;k++) {
+#ifndef UNIT_TEST
+    crypto_core_ristretto255_scalar_random(a[k]);
+#else
+    debian_rng_scalar(a[k]);
+    dump(a[k],crypto_core_ristretto255_SCALARBYTES,"a[%d] ", k);
+#endif
+
+    // A_ik = g^a_ik, A_i0 is the identity and is not output
+    crypto_scalarmult_ristretto255_base(commitments[k-1], a[k]);
   }
 
-  sodium_munlock(a,sizeof a);
+  toprf_polynom_shares(n, threshold, (const uint8_t (*)[crypto_core_ristretto255_SCALARBYTES]) a,
+                       (uint8_t (*)[TOPRF_Share_BYTES]) shares);
+
+  oprf_scratch_pop(a, a_len);
 
   return 0;
 }
 
-int dkg_verify_commitment(const uint8_t n,
-                          const uint8_t threshold,
-                          const uint8_t self,
-                          const uint8_t i,
-                          const uint8_t commitments[threshold][crypto_core_ristretto255_BYTES],
-                          const TOPRF_Share share) {
-  uint8_t j[crypto_core_ristretto255_SCALARBYTES]={self};
+// the check of both the 8 bit and the wide shares
+// libsodium refuses to multiply the identity element, in which case
+// dkg_verify_commitment() fails, the batch check must fail the same way
+static int is_identity(const uint8_t p[crypto_core_ristretto255_BYTES]) {
+  uint8_t tmp[crypto_core_ristretto255_BYTES];
+  memcpy(tmp, p, sizeof tmp);
+  tmp[crypto_core_ristretto255_BYTES-1] &= 0x7f;
+  return sodium_is_zero(tmp, sizeof tmp);
+}
+
+// the number of commitments verify_commitment() multiplies at once
+#define DKG_VERIFY_CHUNK 64
+
+static int verify_commitment(const uint16_t threshold,
+                             const uint16_t self,
+                             const uint16_t i,
+                             const uint8_t commitments[threshold][crypto_core_ristretto255_BYTES],
+                             const uint8_t value[crypto_core_ristretto255_SCALARBYTES]) {
+  const uint8_t j[crypto_core_ristretto255_SCALARBYTES]={(uint8_t) self, (uint8_t) (self >> 8)};
   //dump(j,sizeof(j), "\nj        ");
 
   if(i==self) return 0;
@@ -106,26 +132,29 @@ int dkg_verify_commitment(const uint8_t n,
 
   // v0 = g*(s_ij)
   //dump((uint8_t*)&shares[i-1], sizeof(TOPRF_Share), "s(%d,%d) ", i, self);
-  // g*(s_ij)
-  crypto_scalarmult_ristretto255_base(v0, share.value);
+  // g*(s_ij), the share is secret, so this stays constant time
+  crypto_scalarmult_ristretto255_base(v0, value);
 
   // v1=sum(C_ik*j*k for k=0..t)
   uint8_t v1[crypto_core_ristretto255_BYTES];
   //dump(commitments[i-1],crypto_core_ristretto255_BYTES, "c(%d,%d)   ", i, 0);
   // v1 = C_i0*j
   memcpy(v1, &commitments[0], sizeof v1);
-  // sum
-  for(uint8_t k=1;k<threshold;k++) {
-    uint8_t tmp[crypto_core_ristretto255_SCALARBYTES];
-    memcpy(tmp, j, sizeof j); // tmp = j^1
-    for(int exp=1;exp<k;exp++) {
-      // tmp *= j
-      crypto_core_ristretto255_scalar_mul(tmp, tmp, j);
+  // sum, the commitments and the powers of j are public
+  uint8_t powers[DKG_VERIFY_CHUNK][crypto_core_ristretto255_SCALARBYTES];
+  uint8_t tmp[crypto_core_ristretto255_SCALARBYTES];
+  memcpy(tmp, j, sizeof j); // tmp = j^1
+  for(uint32_t k=1;k<threshold;k+=DKG_VERIFY_CHUNK) {
+    const size_t len = (threshold - k < DKG_VERIFY_CHUNK) ? threshold - k : DKG_VERIFY_CHUNK;
+    for(size_t l=0;l<len;l++) {
+      // like crypto_scalarmult_ristretto255() reject the identity element
+      if(is_identity(commitments[k+l])) return -1;
+      // powers[l] = j^(k+l)
+      if(k+l>1) crypto_core_ristretto255_scalar_mul(tmp, tmp, j);
+      memcpy(powers[l], tmp, sizeof tmp);
     }
     uint8_t tmP[crypto_core_ristretto255_BYTES];
-    //dump(tmp, sizeof tmp, "%d tmp", k);
-    //dump(commitments[i-1][k], crypto_core_ristretto255_BYTES, "c[%d][%d]", i-1, k);
-    if(crypto_scalarmult_ristretto255(tmP, tmp, commitments[k])) return -1;
+    if(ristretto255_msm_vartime(tmP, len, powers, &commitments[k])) return -1;
     crypto_core_ristretto255_add(v1,v1,tmP);
   }
 
@@ -139,17 +168,181 @@ int dkg_verify_commitment(const uint8_t n,
   return 0;
 }
 
-int dkg_verify_commitments(const uint8_t n,
-                           const uint8_t threshold,
-                           const uint8_t self,
-                           const uint8_t commitments[n][threshold][crypto_core_ristretto255_BYTES],
-                           const TOPRF_Share shares[n],
-                           uint8_t fails[n],
-                           uint8_t *fails_len) {
+// verify_commitment() for the thresholds in TOPRF_SHAPES, the powers
+// of the index fit into 64 bits, which also makes the multi-scalar
+// multiplication shorter
+static inline __attribute__((always_inline))
+int verify_commitment_small(const uint8_t threshold,
+                            const uint8_t self,
+                            const uint8_t i,
+                            const uint8_t commitments[threshold][crypto_core_ristretto255_BYTES],
+                            const uint8_t value[crypto_core_ristretto255_SCALARBYTES]) {
+  if(i==self) return 0;
+
+  // g*(s_ij), the share is secret, so this stays constant time
+  uint8_t v0[crypto_core_ristretto255_BYTES];
+  crypto_scalarmult_ristretto255_base(v0, value);
+
+  // v1 = C_i0 + sum(C_ik*j^k for k=1..t-1)
+  uint8_t v1[crypto_core_ristretto255_BYTES];
+  memcpy(v1, commitments[0], sizeof v1);
+  if(threshold>1) {
+    uint8_t powers[threshold-1][crypto_core_ristretto255_SCALARBYTES];
+    uint64_t power = 1;
+    for(uint8_t k=1;k<threshold;k++) {
+      // like crypto_scalarmult_ristretto255() reject the identity element
+      if(is_identity(commitments[k])) return -1;
+      power *= self;
+      toprf_shape_scalar(powers[k-1], power);
+    }
+    uint8_t tmp[crypto_core_ristretto255_BYTES];
+    if(ristretto255_msm_vartime(tmp, threshold-1, powers, &commitments[1])) return -1;
+    crypto_core_ristretto255_add(v1, v1, tmp);
+  }
+
+  if(sodium_memcmp(v0,v1,sizeof v1)!=0) {
+    if(debug) fprintf(stderr, "\e[0;31mfailed to verify proof of P_%d in stage 2\e[0m\n", i);
+    return 1;
+  }
+  return 0;
+}
+
+TOPRF_SHAPES(TOPRF_SHAPE_CHECK)
+
+#define X(N,T) \
+  static int verify_commitment_##N##_##T(const uint8_t self, const uint8_t i, \
+                                         const uint8_t commitments[T][crypto_core_ristretto255_BYTES], \
+                                         const uint8_t value[crypto_core_ristretto255_SCALARBYTES]) { \
+    return verify_commitment_small(T, self, i, commitments, value); \
+  }
+TOPRF_SHAPES(X)
+#undef X
+
+static int verify_commitment_value(const uint8_t threshold,
+                                   const uint8_t self,
+                                   const uint8_t i,
+                                   const uint8_t commitments[threshold][crypto_core_ristretto255_BYTES],
+                                   const uint8_t value[crypto_core_ristretto255_SCALARBYTES]) {
+#define X(N,T) if(threshold==T) return verify_commitment_##N##_##T(self, i, commitments, value);
+  TOPRF_SHAPES(X)
+#undef X
+  return verify_commitment(threshold, self, i, commitments, value);
+}
+
+int dkg_verify_commitment(const uint8_t n,
+                          const uint8_t threshold,
+                          const uint8_t self,
+                          const uint8_t i,
+                          const uint8_t commitments[threshold][crypto_core_ristretto255_BYTES],
+                          const TOPRF_Share share) {
+  (void) n;
+  return verify_commitment_value(threshold, self, i, commitments, share.value);
+}
+
+#define DKG_BATCH_POINTS 256
+
+// the values of the shares are in the form of soa.h, so that this
+// works for both the 8 bit and the wide shares. only the dealers
+// from..to (inclusive) are checked
+static int verify_commitments_batch(const uint16_t n,
+                                    const uint16_t threshold,
+                                    const uint16_t self,
+                                    const uint32_t from,
+                                    const uint32_t to,
+                                    const uint8_t commitments[n][threshold][crypto_core_ristretto255_BYTES],
+                                    const uint8_t values[n][crypto_core_ristretto255_SCALARBYTES]) {
+  // checks g*sum(z_i*s_ij) == sum(C_ik*z_i*j^k for all i, k=0..t)
+  // with random z_i, which holds only if all the shares are correct,
+  // except with negligible probability. The right side only involves
+  // the public commitments and the weights, which reveal nothing about
+  // the shares, so it is computed in variable time, the left side
+  // stays constant time.
+  if(threshold<1) return -1;
+  // the powers of self for wide thresholds can be too big for the stack
+  uint8_t stack_j[threshold<=255?threshold:1][crypto_core_ristretto255_SCALARBYTES];
+  uint8_t (*j)[crypto_core_ristretto255_SCALARBYTES] = stack_j;
+  if(threshold>255) {
+    j = malloc((size_t) threshold * crypto_core_ristretto255_SCALARBYTES);
+    if(j==NULL) return -1;
+  }
+  memset(j[0], 0, sizeof j[0]);
+  j[0][0]=1;
+  for(uint16_t k=1;k<threshold;k++) {
+    uint8_t x[crypto_core_ristretto255_SCALARBYTES]={(uint8_t) self, (uint8_t) (self >> 8)};
+    crypto_core_ristretto255_scalar_mul(j[k], j[k-1], x);
+  }
+
+  uint8_t scalars[DKG_BATCH_POINTS][crypto_core_ristretto255_SCALARBYTES];
+  uint8_t points[DKG_BATCH_POINTS][crypto_core_ristretto255_BYTES];
+  uint8_t tmp[crypto_core_ristretto255_SCALARBYTES];
+  uint8_t v0[crypto_core_ristretto255_BYTES], v1[crypto_core_ristretto255_BYTES]={0};
+  uint8_t sum[crypto_core_ristretto255_SCALARBYTES]={0};
+  size_t len=0;
+  int ret=1;
+
+  for(uint32_t i=from;i<=to;i++) {
+    if(i==self) continue;
+    uint8_t z[crypto_core_ristretto255_SCALARBYTES]={0};
+    randombytes_buf(z, 16);
+
+    // like crypto_scalarmult_ristretto255_base() ignore the top bit
+    memcpy(tmp, values[i-1], sizeof tmp);
+    tmp[crypto_core_ristretto255_SCALARBYTES-1] &= 0x7f;
+    crypto_core_ristretto255_scalar_mul(tmp, tmp, z);
+    crypto_core_ristretto255_scalar_add(sum, sum, tmp);
+
+    for(uint16_t k=0;k<threshold;k++) {
+      if(k>0 && is_identity(commitments[i-1][k])) goto done;
+      // the constant term of a refresh polynomial adds nothing
+      if(k==0 && is_identity(commitments[i-1][k])) continue;
+      crypto_core_ristretto255_scalar_mul(scalars[len], z, j[k]);
+      memcpy(points[len], commitments[i-1][k], crypto_core_ristretto255_BYTES);
+      if(++len < DKG_BATCH_POINTS) continue;
+      if(ristretto255_msm_vartime(tmp, len, scalars, points)) goto done;
+      crypto_core_ristretto255_add(v1, v1, tmp);
+      len=0;
+    }
+  }
+  if(len>0) {
+    if(ristretto255_msm_vartime(tmp, len, scalars, points)) goto done;
+    crypto_core_ristretto255_add(v1, v1, tmp);
+  }
+
+  crypto_scalarmult_ristretto255_base(v0, sum);
+  if(sodium_memcmp(v0,v1,sizeof v1)==0) ret=0;
+
+done:
+  if(j!=stack_j) free(j);
+  return ret;
+}
+
+int dkg_verify_commitments_batch(const uint8_t n,
+                                 const uint8_t threshold,
+                                 const uint8_t self,
+                                 const uint8_t commitments[n][threshold][crypto_core_ristretto255_BYTES],
+                                 const TOPRF_Share shares[n]) {
+  uint8_t values[n][crypto_core_ristretto255_SCALARBYTES] TOPRF_SOA_ALIGNED;
+  toprf_soa_split(n, (const uint8_t*) shares, sizeof(TOPRF_Share), NULL, values);
+  const int ret = verify_commitments_batch(n, threshold, self, 1, n, commitments,
+                                           (const uint8_t (*)[crypto_core_ristretto255_SCALARBYTES]) values);
+  sodium_memzero(values, sizeof values);
+  return ret;
+}
+
+// dkg_verify_commitments() on the values of the shares
+static int verify_commitments(const uint8_t n,
+                              const uint8_t threshold,
+                              const uint8_t self,
+                              const uint8_t commitments[n][threshold][crypto_core_ristretto255_BYTES],
+                              const uint8_t values[n][crypto_core_ristretto255_SCALARBYTES],
+                              uint8_t fails[n],
+                              uint8_t *fails_len) {
   *fails_len = 0;
+  if(0 == verify_commitments_batch(n, threshold, self, 1, n, commitments, values)) return 0;
+  // some share is wrong, find out which one
   for(uint8_t i=1;i<=n;i++) {
     if(i==self) continue;
-    int ret = dkg_verify_commitment(n, threshold, self, i, commitments[i-1], shares[i-1]);
+    int ret = verify_commitment_value(threshold, self, i, commitments[i-1], values[i-1]);
     if(-1 == ret) return ret;
     if(0 == ret) continue;
     fails[(*fails_len)++] = (uint8_t) i;
@@ -159,6 +352,93 @@ int dkg_verify_commitments(const uint8_t n,
   return 0;
 }
 
+int dkg_verify_commitments(const uint8_t n,
+                           const uint8_t threshold,
+                           const uint8_t self,
+                           const uint8_t commitments[n][threshold][crypto_core_ristretto255_BYTES],
+                           const TOPRF_Share shares[n],
+                           uint8_t fails[n],
+                           uint8_t *fails_len) {
+  uint8_t values[n][crypto_core_ristretto255_SCALARBYTES] TOPRF_SOA_ALIGNED;
+  toprf_soa_split(n, (const uint8_t*) shares, sizeof(TOPRF_Share), NULL, values);
+  const int ret = verify_commitments(n, threshold, self, commitments,
+                                     (const uint8_t (*)[crypto_core_ristretto255_SCALARBYTES]) values, fails, fails_len);
+  sodium_memzero(values, sizeof values);
+  return ret;
+}
+
+// the number of dealers verified by one job of dkg_verify_commitments_parallel()
+#define DKG_VERIFY_JOB 8
+
+typedef struct {
+  uint16_t n;
+  uint16_t threshold;
+  uint16_t self;
+  // the wide shares can not use the 8 bit shapes of verify_commitment_value()
+  int wide;
+  const uint8_t (*commitments)[][crypto_core_ristretto255_BYTES];
+  const uint8_t (*values)[crypto_core_ristretto255_SCALARBYTES];
+  int *rets;
+} Verify_Jobs;
+
+static void verify_job(void *arg, const size_t job) {
+  const Verify_Jobs *b = (const Verify_Jobs*) arg;
+  const uint8_t (*commitments)[b->threshold][crypto_core_ristretto255_BYTES] =
+    (const uint8_t (*)[b->threshold][crypto_core_ristretto255_BYTES]) b->commitments;
+  const uint32_t from = (uint32_t) job * DKG_VERIFY_JOB + 1;
+  const uint32_t to = (b->n - from < DKG_VERIFY_JOB) ? b->n : from + DKG_VERIFY_JOB - 1;
+  for(uint32_t i=from;i<=to;i++) b->rets[i-1] = 0;
+  if(0 == verify_commitments_batch(b->n, b->threshold, b->self, from, to, commitments, b->values)) return;
+  for(uint32_t i=from;i<=to;i++) {
+    if(i==b->self) continue;
+    if(b->wide) {
+      b->rets[i-1] = verify_commitment(b->threshold, b->self, (uint16_t) i, commitments[i-1], b->values[i-1]);
+    } else {
+      b->rets[i-1] = verify_commitment_value((uint8_t) b->threshold, (uint8_t) b->self, (uint8_t) i, commitments[i-1], b->values[i-1]);
+    }
+  }
+}
+
+int dkg_verify_commitments_parallel(const uint8_t n,
+                                    const uint8_t threshold,
+                                    const uint8_t self,
+                                    const uint8_t commitments[n][threshold][crypto_core_ristretto255_BYTES],
+                                    const TOPRF_Share shares[n],
+                                    uint8_t fails[n],
+                                    uint8_t *fails_len,
+                                    const oprf_parallel_fn parallel, void *pool) {
+  uint8_t values[n][crypto_core_ristretto255_SCALARBYTES] TOPRF_SOA_ALIGNED;
+  toprf_soa_split(n, (const uint8_t*) shares, sizeof(TOPRF_Share), NULL, values);
+
+  const size_t jobs = ((size_t) n + DKG_VERIFY_JOB - 1) / DKG_VERIFY_JOB;
+  int ret = 0;
+  if(parallel==NULL || jobs<2) {
+    ret = verify_commitments(n, threshold, self, commitments,
+                             (const uint8_t (*)[crypto_core_ristretto255_SCALARBYTES]) values, fails, fails_len);
+  } else {
+    int rets[n];
+    Verify_Jobs b = { .n = n, .threshold = threshold, .self = self,
+                      .commitments = (const uint8_t (*)[][crypto_core_ristretto255_BYTES]) commitments,
+                      .values = (const uint8_t (*)[crypto_core_ristretto255_SCALARBYTES]) values, .rets = rets };
+    parallel(pool, jobs, verify_job, &b);
+
+    // collected in the order dkg_verify_commitments() checks the dealers
+    *fails_len = 0;
+    for(uint8_t i=1;i<=n;i++) {
+      if(-1 == rets[i-1]) {
+        ret = -1;
+        break;
+      }
+      if(0 == rets[i-1]) continue;
+      fails[(*fails_len)++] = i;
+    }
+    if(ret==0 && *fails_len!=0) ret = 1;
+  }
+
+  sodium_memzero(values, sizeof values);
+  return ret;
+}
+
 void dkg_finish(const uint8_t n,
                 const TOPRF_Share shares[n],
                 const uint8_t self,
@@ -174,20 +454,292 @@ void dkg_finish(const uint8_t n,
   //dump(xi->value, crypto_core_ristretto255_SCALARBYTES, "x[%d]     ", self);
 }
 
-void dkg_reconstruct(const size_t response_len,
-                     const TOPRF_Share responses[response_len],
-                     uint8_t result[crypto_scalarmult_ristretto255_BYTES]) {
+int dkg_finish_refresh(const uint8_t n,
+                       const TOPRF_Share shares[n],
+                       const uint8_t self,
+                       const TOPRF_Share *old,
+                       TOPRF_Share *xi) {
+  if(old->index!=self) return 1;
+  uint8_t value[crypto_core_ristretto255_SCALARBYTES];
+  memcpy(value, old->value, sizeof value);
+  dkg_finish(n, shares, self, xi);
+  crypto_core_ristretto255_scalar_add(xi->value, xi->value, value);
+  xi->index = self;
+  sodium_memzero(value, sizeof value);
+  return 0;
+}
+
+// the public share of both the 8 bit and the wide shares
+static int public_share(const uint16_t n,
+                        const uint16_t threshold,
+                        const uint16_t index,
+                        const uint8_t commitments[n][threshold][crypto_core_ristretto255_BYTES],
+                        uint8_t pub[crypto_core_ristretto255_BYTES]) {
+  // g*x_i = sum(C_jk*i^k for all j, k=0..t), the commitments to each
+  // coefficient are summed first, so that only threshold points need
+  // to be multiplied. All inputs are public.
+  if(threshold<1) return -1;
+  uint8_t (*sums)[crypto_core_ristretto255_BYTES] = calloc(threshold, crypto_core_ristretto255_BYTES);
+  uint8_t (*powers)[crypto_core_ristretto255_SCALARBYTES] = malloc((size_t) threshold * crypto_core_ristretto255_SCALARBYTES);
+  int ret = -1;
+  if(sums==NULL || powers==NULL) goto done;
+
+  const uint8_t i[crypto_core_ristretto255_SCALARBYTES]={(uint8_t) index, (uint8_t) (index >> 8)};
+  memset(powers[0], 0, sizeof powers[0]);
+  powers[0][0]=1;
+  for(uint16_t k=1;k<threshold;k++) crypto_core_ristretto255_scalar_mul(powers[k], powers[k-1], i);
+
+  for(uint32_t j=0;j<n;j++) {
+    for(uint16_t k=0;k<threshold;k++) {
+      // the constant term of a refresh polynomial is the identity
+      if(is_identity(commitments[j][k])) continue;
+      if(crypto_core_ristretto255_is_valid_point(commitments[j][k])!=1) goto done;
+      crypto_core_ristretto255_add(sums[k], sums[k], commitments[j][k]);
+    }
+  }
+  if(ristretto255_msm_vartime(pub, threshold, powers, sums)) goto done;
+  ret = 0;
+
+done:
+  free(sums);
+  free(powers);
+  return ret;
+}
+
+int dkg_public_share(const uint8_t n,
+                     const uint8_t threshold,
+                     const uint8_t index,
+                     const uint8_t commitments[n][threshold][crypto_core_ristretto255_BYTES],
+                     uint8_t pub[crypto_core_ristretto255_BYTES]) {
+  return public_share(n, threshold, index, commitments, pub);
+}
+
+int dkg_reconstruct(const size_t response_len,
+                    const TOPRF_Share responses[response_len],
+                    uint8_t result[crypto_scalarmult_ristretto255_BYTES]) {
   uint8_t lpoly[crypto_scalarmult_ristretto255_SCALARBYTES];
   uint8_t tmp[crypto_scalarmult_ristretto255_SCALARBYTES];
   memset(result,0,crypto_scalarmult_ristretto255_BYTES);
+  if(response_len==0 || response_len>255) return 1;
 
-  uint8_t indexes[response_len];
+  // the length comes from the caller, keep it off the stack
+  uint8_t *indexes = malloc(response_len);
+  uint8_t (*lpolys)[crypto_scalarmult_ristretto255_SCALARBYTES] = malloc(response_len * crypto_scalarmult_ristretto255_SCALARBYTES);
+  int ret = 1;
+  if(indexes==NULL || lpolys==NULL) goto done;
   for(size_t i=0;i<response_len;i++) {
     indexes[i]=responses[i].index;
   }
+  const int batched = (toprf_coeffs(response_len, indexes, lpolys) == 0);
   for(size_t i=0;i<response_len;i++) {
-    coeff(responses[i].index, response_len, indexes, lpoly);
+    if(batched) memcpy(lpoly, lpolys[i], sizeof lpoly);
+    else coeff(responses[i].index, response_len, indexes, lpoly);
     crypto_core_ristretto255_scalar_mul(tmp, responses[i].value, lpoly);
     crypto_core_ristretto255_scalar_add(result, result, tmp);
   }
+  sodium_memzero(tmp, sizeof tmp);
+  ret = 0;
+
+done:
+  free(indexes);
+  free(lpolys);
+  return ret;
+}
+
+// the dealing of dkg_wide_start() and dkg_wide_start_refresh(), for a
+// refresh a_0 = 0 and its commitment is not output
+static int wide_start(const uint16_t n,
+                      const uint16_t threshold,
+                      const int refresh,
+                      uint8_t (*commitments)[crypto_core_ristretto255_BYTES],
+                      TOPRF_WideShare shares[n]) {
+  if(n==0 || threshold<1+refresh || threshold>n) return 1;
+  // the coefficients of wide thresholds can be too big for the stack
+  const size_t a_len = (size_t) threshold * crypto_core_ristretto255_SCALARBYTES;
+  uint8_t (*a)[crypto_core_ristretto255_SCALARBYTES] = malloc(a_len);
+  if(a==NULL) return -1;
+  if(0!=sodium_mlock(a,a_len)) {
+    free(a);
+    return -1;
+  }
+
+  if(refresh) memset(a[0], 0, sizeof a[0]);
+  // unlike dkg_start() this always uses the real rng, the deterministic
+  // one of the unit tests repeats after 256 coefficients
+  for(uint16_t k=(uint16_t) refresh;k<threshold;k++) {
+    crypto_core_ristretto255_scalar_random(a[k]);
+    // A_ik = g^a_ik
+    crypto_scalarmult_ristretto255_base(commitments[k-refresh], a[k]);
+  }
+
+  toprf_wide_polynom_shares(n, threshold, (const uint8_t (*)[crypto_core_ristretto255_SCALARBYTES]) a,
+                            (uint8_t (*)[TOPRF_WideShare_BYTES]) shares);
+
+  sodium_munlock(a,a_len);
+  free(a);
+  return 0;
+}
+
+int dkg_wide_start(const uint16_t n,
+                   const uint16_t threshold,
+                   uint8_t commitments[threshold][crypto_core_ristretto255_BYTES],
+                   TOPRF_WideShare shares[n]) {
+  return wide_start(n, threshold, 0, commitments, shares);
+}
+
+int dkg_wide_start_refresh(const uint16_t n,
+                           const uint16_t threshold,
+                           uint8_t commitments[threshold-1][crypto_core_ristretto255_BYTES],
+                           TOPRF_WideShare shares[n]) {
+  return wide_start(n, threshold, 1, commitments, shares);
+}
+
+int dkg_wide_verify_commitment(const uint16_t n,
+                               const uint16_t threshold,
+                               const uint16_t self,
+                               const uint16_t i,
+                               const uint8_t commitments[threshold][crypto_core_ristretto255_BYTES],
+                               const TOPRF_WideShare share) {
+  (void) n;
+  return verify_commitment(threshold, self, i, commitments, share.value);
+}
+
+int dkg_wide_verify_commitments(const uint16_t n,
+                                const uint16_t threshold,
+                                const uint16_t self,
+                                const uint8_t commitments[n][threshold][crypto_core_ristretto255_BYTES],
+                                const TOPRF_WideShare shares[n],
+                                uint16_t fails[n],
+                                uint16_t *fails_len) {
+  *fails_len = 0;
+  // too many for the stack
+  uint8_t (*values)[crypto_core_ristretto255_SCALARBYTES] = toprf_soa_alloc(n);
+  if(values==NULL) return -1;
+  toprf_soa_split_wide(n, (const uint8_t*) shares, sizeof(TOPRF_WideShare), NULL, values);
+
+  int ret = 0;
+  if(0 == verify_commitments_batch(n, threshold, self, 1, n, commitments,
+                                   (const uint8_t (*)[crypto_core_ristretto255_SCALARBYTES]) values)) goto done;
+  // some share is wrong, find out which one
+  for(uint32_t i=1;i<=n;i++) {
+    if(i==self) continue;
+    ret = verify_commitment(threshold, self, (uint16_t) i, commitments[i-1], values[i-1]);
+    if(-1 == ret) goto done;
+    if(0 == ret) continue;
+    fails[(*fails_len)++] = (uint16_t) i;
+  }
+  ret = (*fails_len!=0);
+
+done:
+  sodium_memzero(values, (size_t) n * crypto_core_ristretto255_SCALARBYTES);
+  free(values);
+  return ret;
+}
+
+int dkg_wide_verify_commitments_parallel(const uint16_t n,
+                                         const uint16_t threshold,
+                                         const uint16_t self,
+                                         const uint8_t commitments[n][threshold][crypto_core_ristretto255_BYTES],
+                                         const TOPRF_WideShare shares[n],
+                                         uint16_t fails[n],
+                                         uint16_t *fails_len,
+                                         const oprf_parallel_fn parallel, void *pool) {
+  const size_t jobs = ((size_t) n + DKG_VERIFY_JOB - 1) / DKG_VERIFY_JOB;
+  if(parallel==NULL || jobs<2) {
+    return dkg_wide_verify_commitments(n, threshold, self, commitments, shares, fails, fails_len);
+  }
+
+  *fails_len = 0;
+  uint8_t (*values)[crypto_core_ristretto255_SCALARBYTES] = toprf_soa_alloc(n);
+  int *rets = malloc((size_t) n * sizeof(int));
+  int ret = -1;
+  if(values==NULL || rets==NULL) goto done;
+  toprf_soa_split_wide(n, (const uint8_t*) shares, sizeof(TOPRF_WideShare), NULL, values);
+
+  Verify_Jobs b = { .n = n, .threshold = threshold, .self = self, .wide = 1,
+                    .commitments = (const uint8_t (*)[][crypto_core_ristretto255_BYTES]) commitments,
+                    .values = (const uint8_t (*)[crypto_core_ristretto255_SCALARBYTES]) values, .rets = rets };
+  parallel(pool, jobs, verify_job, &b);
+
+  // collected in the order dkg_wide_verify_commitments() checks the dealers
+  ret = 0;
+  for(uint32_t i=1;i<=n;i++) {
+    if(-1 == rets[i-1]) {
+      ret = -1;
+      goto done;
+    }
+    if(0 == rets[i-1]) continue;
+    fails[(*fails_len)++] = (uint16_t) i;
+  }
+  ret = (*fails_len!=0);
+
+done:
+  if(values!=NULL) sodium_memzero(values, (size_t) n * crypto_core_ristretto255_SCALARBYTES);
+  free(values);
+  free(rets);
+  return ret;
+}
+
+void dkg_wide_finish(const uint16_t n,
+                     const TOPRF_WideShare shares[n],
+                     const uint16_t self,
+                     TOPRF_WideShare *xi) {
+  memset(xi->value, 0, crypto_core_ristretto255_SCALARBYTES);
+  for(uint32_t i=0;i<n;i++) {
+    if(self!=shares[i].index) {
+      if(debug) fprintf(stderr, "\e[0;31mbad share i=%d index=%d\e[0m\n", i, shares[i].index);
+    }
+    crypto_core_ristretto255_scalar_add(xi->value, xi->value, shares[i].value);
+  }
+  xi->index = self;
+}
+
+int dkg_wide_finish_refresh(const uint16_t n,
+                            const TOPRF_WideShare shares[n],
+                            const uint16_t self,
+                            const TOPRF_WideShare *old,
+                            TOPRF_WideShare *xi) {
+  if(old->index!=self) return 1;
+  uint8_t value[crypto_core_ristretto255_SCALARBYTES];
+  memcpy(value, old->value, sizeof value);
+  dkg_wide_finish(n, shares, self, xi);
+  crypto_core_ristretto255_scalar_add(xi->value, xi->value, value);
+  sodium_memzero(value, sizeof value);
+  return 0;
+}
+
+int dkg_wide_public_share(const uint16_t n,
+                          const uint16_t threshold,
+                          const uint16_t index,
+                          const uint8_t commitments[n][threshold][crypto_core_ristretto255_BYTES],
+                          uint8_t pub[crypto_core_ristretto255_BYTES]) {
+  return public_share(n, threshold, index, commitments, pub);
+}
+
+int dkg_wide_reconstruct(const size_t response_len,
+                         const TOPRF_WideShare responses[response_len],
+                         uint8_t result[crypto_scalarmult_ristretto255_BYTES]) {
+  uint8_t tmp[crypto_scalarmult_ristretto255_SCALARBYTES];
+  memset(result,0,crypto_scalarmult_ristretto255_BYTES);
+  if(response_len==0 || response_len>toprf_wide_MAX_PEERS) return 1;
+
+  uint16_t *indexes = malloc(response_len * sizeof(uint16_t));
+  uint8_t (*lpolys)[crypto_scalarmult_ristretto255_SCALARBYTES] = malloc(response_len * crypto_scalarmult_ristretto255_SCALARBYTES);
+  int ret = 1;
+  if(indexes==NULL || lpolys==NULL) goto done;
+  for(size_t i=0;i<response_len;i++) {
+    indexes[i]=responses[i].index;
+  }
+  if(toprf_wide_coeffs(response_len, indexes, lpolys)) goto done;
+  for(size_t i=0;i<response_len;i++) {
+    crypto_core_ristretto255_scalar_mul(tmp, responses[i].value, lpolys[i]);
+    crypto_core_ristretto255_scalar_add(result, result, tmp);
+  }
+  sodium_memzero(tmp, sizeof tmp);
+  ret = 0;
+
+done:
+  free(indexes);
+  free(lpolys);
+  return ret;
 }
@@ -12,6 +12,7 @@
 
 #include <sodium.h>
 #include <stdint.h>
+#include "oprf.h"
 
 #define dkg_hash_BYTES crypto_generichash_BYTES
 #define dkg_commitment_BYTES(threshold) (threshold*crypto_core_ristretto255_BYTES)
@@ -21,6 +22,15 @@ typedef struct {
   uint8_t value[crypto_core_ristretto255_SCALARBYTES];
 } __attribute((packed)) TOPRF_Share;
 
+/*
+ * A share with a 16 bit index - in the byte order of the host - for
+ * DKGs with more than 255 peers, see the dkg_wide_* functions.
+ */
+typedef struct {
+  uint16_t index;
+  uint8_t value[crypto_core_ristretto255_SCALARBYTES];
+} __attribute((packed)) TOPRF_WideShare;
+
 #define HASH ((uint8_t) 1)
 #define COMMITMENT ((uint8_t) 2)
 
@@ -47,6 +57,29 @@ int dkg_start(const uint8_t n,
               uint8_t commitments[threshold][crypto_core_ristretto255_BYTES],
               TOPRF_Share shares[n]);
 
+/**
+ * 1st step of a share refresh, the proactive counterpart of
+ * dkg_start(): deals shares of a random polynomial with a constant
+ * term of 0. Adding the shares dealt by all peers to their existing
+ * shares re-randomizes them, while the shared secret - and thus the
+ * group key - stays the same.
+ *
+ * The commitment to the constant term is always the identity, it is
+ * not output, the verifier puts the identity in front of the
+ * threshold-1 commitments received before verifying the shares.
+ *
+ * @param [in] n - the number of peers participating in the refresh
+ * @param [in] threshold - the threshold of the existing sharing
+ * @param [out] commitments - the commitments to the coefficients 1..threshold-1
+ * @param [out] shares[n] - one share for each peer, to be sent
+ *              privately to each peer
+ * @return The function returns 0 if everything is correct.
+ */
+int dkg_start_refresh(const uint8_t n,
+                      const uint8_t threshold,
+                      uint8_t commitments[threshold-1][crypto_core_ristretto255_BYTES],
+                      TOPRF_Share shares[n]);
+
 int dkg_verify_commitment(const uint8_t n,
                           const uint8_t threshold,
                           const uint8_t self,
@@ -54,6 +87,31 @@ int dkg_verify_commitment(const uint8_t n,
                           const uint8_t commitments[threshold][crypto_core_ristretto255_BYTES],
                           const TOPRF_Share share);
 
+/**
+ * Verifies all the shares received against the commitments of their
+ * dealers at once, using a random linear combination of the checks
+ * done by dkg_verify_commitment(), which costs only one
+ * multi-scalar multiplication instead of threshold scalar
+ * multiplications for each dealer.
+ *
+ * This function does not tell which dealer sent an invalid share,
+ * dkg_verify_commitments() calls this first and only checks the
+ * dealers one by one if this fails.
+ *
+ * @param [in] n - the number of peers participating in the DKG
+ * @param [in] threshold - the threshold
+ * @param [in] self - the index of the peer verifying the shares
+ * @param [in] commitments - the commitments of all the dealers
+ * @param [in] shares - the shares received from all the dealers
+ * @return The function returns 0 if all the shares are correct, 1
+ *         if any of them is wrong.
+ */
+int dkg_verify_commitments_batch(const uint8_t n,
+                                 const uint8_t threshold,
+                                 const uint8_t self,
+                                 const uint8_t commitments[n][threshold][crypto_core_ristretto255_BYTES],
+                                 const TOPRF_Share shares[n]);
+
 int dkg_verify_commitments(const uint8_t n,
                            const uint8_t threshold,
                            const uint8_t self,
@@ -62,13 +120,183 @@ int dkg_verify_commitments(const uint8_t n,
                            uint8_t fails[n],
                            uint8_t *fails_len);
 
+/**
+ * Same as dkg_verify_commitments(), but the dealers are split into
+ * groups which are verified concurrently by parallel, each with its
+ * own batch check and, if that fails, one by one. The results are
+ * the same as those of dkg_verify_commitments(), which is used if
+ * parallel is NULL or n is too small to be worth splitting.
+ *
+ * @param [in] parallel - runs the jobs, e.g. workerpool_run()
+ * @param [in] pool - the first parameter of parallel
+ */
+int dkg_verify_commitments_parallel(const uint8_t n,
+                                    const uint8_t threshold,
+                                    const uint8_t self,
+                                    const uint8_t commitments[n][threshold][crypto_core_ristretto255_BYTES],
+                                    const TOPRF_Share shares[n],
+                                    uint8_t fails[n],
+                                    uint8_t *fails_len,
+                                    const oprf_parallel_fn parallel, void *pool);
+
 void dkg_finish(const uint8_t n,
                 const TOPRF_Share shares[n],
                 const uint8_t self,
                 TOPRF_Share *xi);
 
-void dkg_reconstruct(const size_t response_len,
-                     const TOPRF_Share responses[response_len],
-                     uint8_t result[crypto_scalarmult_ristretto255_BYTES]);
+/**
+ * Last step of a share refresh, like dkg_finish() but adds the sum of
+ * the shares received to the existing share of the peer.
+ *
+ * @param [in] n - the number of peers participating in the refresh
+ * @param [in] shares - the shares dealt by dkg_start_refresh() received from all peers
+ * @param [in] self - the index of the peer
+ * @param [in] old - the existing share of the peer
+ * @param [out] xi - the refreshed share, may be the same as old
+ * @return The function returns 0 if everything is correct, 1 if old
+ *         is not the share of self.
+ */
+int dkg_finish_refresh(const uint8_t n,
+                       const TOPRF_Share shares[n],
+                       const uint8_t self,
+                       const TOPRF_Share *old,
+                       TOPRF_Share *xi);
+
+/**
+ * Reconstructs the shared secret from the shares of at least
+ * threshold peers, for tests and for recovering a key.
+ *
+ * @param [in] response_len - the number of shares
+ * @param [in] responses - the shares
+ * @param [out] result - the secret
+ * @return The function returns 0 if everything is correct, 1 if there
+ *         are no or more than 255 shares or allocation fails.
+ */
+int dkg_reconstruct(const size_t response_len,
+                    const TOPRF_Share responses[response_len],
+                    uint8_t result[crypto_scalarmult_ristretto255_BYTES]);
+
+/**
+ * Computes the public key g*x_i of the share x_i of a peer from the
+ * commitments of all the dealers, as needed for verifying the proofs
+ * of toprf_voprf_EvaluateBatch(). Anyone holding the commitments can
+ * do this, the shares are not needed.
+ *
+ * For a refresh the result is the change of the public key, which
+ * must be added to the previous one.
+ *
+ * @param [in] n - the number of dealers
+ * @param [in] threshold - the threshold
+ * @param [in] index - the index of the peer
+ * @param [in] commitments - the commitments of all the dealers
+ * @param [out] pub - the public key of the share of index
+ * @return The function returns 0 if everything is correct, -1 if a
+ *         commitment is invalid or allocation fails.
+ */
+int dkg_public_share(const uint8_t n,
+                     const uint8_t threshold,
+                     const uint8_t index,
+                     const uint8_t commitments[n][threshold][crypto_core_ristretto255_BYTES],
+                     uint8_t pub[crypto_core_ristretto255_BYTES]);
+
+/*
+ * The wide variants of the DKG functions for up to 65535 peers. These
+ * use heap memory where the 8 bit variants use the stack, and the
+ * same batched verification of the commitments.
+ */
+
+/**
+ * Same as dkg_start(), but for up to 65535 peers.
+ *
+ * @return The function returns 0 if everything is correct, 1 if n or
+ *         threshold are out of range, -1 if allocation fails.
+ */
+int dkg_wide_start(const uint16_t n,
+                   const uint16_t threshold,
+                   uint8_t commitments[threshold][crypto_core_ristretto255_BYTES],
+                   TOPRF_WideShare shares[n]);
+
+/**
+ * Same as dkg_start_refresh(), but for up to 65535 peers.
+ *
+ * @return The function returns 0 if everything is correct, 1 if n or
+ *         threshold are out of range, -1 if allocation fails.
+ */
+int dkg_wide_start_refresh(const uint16_t n,
+                           const uint16_t threshold,
+                           uint8_t commitments[threshold-1][crypto_core_ristretto255_BYTES],
+                           TOPRF_WideShare shares[n]);
+
+/**
+ * Same as dkg_verify_commitment(), but for a wide share.
+ */
+int dkg_wide_verify_commitment(const uint16_t n,
+                               const uint16_t threshold,
+                               const uint16_t self,
+                               const uint16_t i,
+                               const uint8_t commitments[threshold][crypto_core_ristretto255_BYTES],
+                               const TOPRF_WideShare share);
+
+/**
+ * Same as dkg_verify_commitments(), but for wide shares. All the
+ * shares are verified at once with a random linear combination, only
+ * if this fails are the dealers checked one by one to fill fails.
+ */
+int dkg_wide_verify_commitments(const uint16_t n,
+                                const uint16_t threshold,
+                                const uint16_t self,
+                                const uint8_t commitments[n][threshold][crypto_core_ristretto255_BYTES],
+                                const TOPRF_WideShare shares[n],
+                                uint16_t fails[n],
+                                uint16_t *fails_len);
+
+/**
+ * Same as dkg_verify_commitments_parallel(), but for wide shares.
+ */
+int dkg_wide_verify_commitments_parallel(const uint16_t n,
+                                         const uint16_t threshold,
+                                         const uint16_t self,
+                                         const uint8_t commitments[n][threshold][crypto_core_ristretto255_BYTES],
+                                         const TOPRF_WideShare shares[n],
+                                         uint16_t fails[n],
+                                         uint16_t *fails_len,
+                                         const oprf_parallel_fn parallel, void *pool);
+
+/**
+ * Same as dkg_finish(), but for wide shares, also sets the index of
+ * xi to self.
+ */
+void dkg_wide_finish(const uint16_t n,
+                     const TOPRF_WideShare shares[n],
+                     const uint16_t self,
+                     TOPRF_WideShare *xi);
+
+/**
+ * Same as dkg_finish_refresh(), but for wide shares.
+ */
+int dkg_wide_finish_refresh(const uint16_t n,
+                            const TOPRF_WideShare shares[n],
+                            const uint16_t self,
+                            const TOPRF_WideShare *old,
+                            TOPRF_WideShare *xi);
+
+/**
+ * Same as dkg_public_share(), but for wide shares.
+ */
+int dkg_wide_public_share(const uint16_t n,
+                          const uint16_t threshold,
+                          const uint16_t index,
+                          const uint8_t commitments[n][threshold][crypto_core_ristretto255_BYTES],
+                          uint8_t pub[crypto_core_ristretto255_BYTES]);
+
+/**
+ * Same as dkg_reconstruct(), but for wide shares.
+ *
+ * @return The function returns 0 if everything is correct, 1 if the
+ *         indexes are not valid or allocation fails.
+ */
+int dkg_wide_reconstruct(const size_t response_len,
+                         const TOPRF_WideShare responses[response_len],
+                         uint8_t result[crypto_scalarmult_ristretto255_BYTES]);
 
 #endif // DKG_H
@@ -4,6 +4,7 @@
 #include <stdbool.h>
 
 #include "XK.h"
+#include "XK_index.h"
 
 #include "utils.h"
 #include <stdlib.h>
@@ -140,6 +141,8 @@ int main () {
     peer *peer_bob = Noise_XK_device_add_peer(alice_device, (uint8_t*) "Bob", bob_spub);
     if (!peer_bob) return 1;
     peer_id bob_id = Noise_XK_peer_get_id(peer_bob);
+    // indexing a device which already has peers
+    RETURN_IF_ERROR(Noise_XK_device_enable_peer_index(alice_device), "Alice peer index");
 
     /*
      * Initialize Bob's device
@@ -148,8 +151,27 @@ int main () {
     device *bob_device = Noise_XK_device_create(10, prologue, (uint8_t*) "Bob",
                                              bob_srlz_key, bob_spriv);
 
+    // Bob is going to hold many authorized keys, look them up in an index
+    RETURN_IF_ERROR(Noise_XK_device_enable_peer_index(bob_device), "Bob peer index");
     // Register Alice
     if(load_authkeys("authorized_keys",bob_device)) return 1;
+
+    // the index follows added and removed peers
+    uint8_t keys[200][DH_KEY_SIZE];
+    peer_id ids[200];
+    for(int i=0;i<200;i++) {
+        randombytes_buf(keys[i], sizeof keys[i]);
+        peer *p = Noise_XK_device_add_peer(bob_device, (uint8_t*) "extra", keys[i]);
+        RETURN_IF_ERROR(p, "add extra peer");
+        ids[i] = Noise_XK_peer_get_id(p);
+    }
+    RETURN_IF_ERROR(!Noise_XK_device_add_peer(bob_device, (uint8_t*) "dup", keys[7]), "add duplicate peer");
+    for(int i=0;i<200;i+=2) Noise_XK_device_remove_peer(bob_device, ids[i]);
+    for(int i=0;i<200;i++) {
+        peer *p = Noise_XK_device_lookup_peer_by_static(bob_device, keys[i]);
+        RETURN_IF_ERROR((p==NULL) == (i%2==0), "lookup extra peer by static");
+        RETURN_IF_ERROR(Noise_XK_device_lookup_peer_by_id(bob_device, ids[i]) == p, "lookup extra peer by id");
+    }
     //peer *peer_alice = Noise_XK_device_add_peer(bob_device, (uint8_t*) "Alice", alice_spub);
     //if (!peer_alice) return 1;
     //peer_id alice_id = Noise_XK_peer_get_id(peer_alice);
@@ -282,6 +304,25 @@ int main () {
     if (cipher_msg_len > 0) free(cipher_msg);
     if (plain_msg_len > 0) free(plain_msg);
 
+    // # Step 5: Transport messages can also be written and read in the
+    // caller's buffers, here in place.
+    uint8_t buf[12 + 16];
+    memcpy(buf, "Hello again!", 12);
+    res = Noise_XK_session_write_buffer(alice_session, 12, buf, sizeof buf, buf);
+    RETURN_IF_ERROR(Noise_XK_rcode_is_success(res), "Send message 4");
+    res = Noise_XK_session_read_buffer(bob_session, sizeof buf, buf, 12, buf);
+    RETURN_IF_ERROR(Noise_XK_rcode_is_success(res), "Receive message 4");
+    RETURN_IF_ERROR(memcmp(buf, "Hello again!", 12) == 0, "Unpack message 4");
+    // a replayed message fails, as the nonce moved on
+    res = Noise_XK_session_write_buffer(bob_session, 12, buf, sizeof buf, buf);
+    RETURN_IF_ERROR(Noise_XK_rcode_is_success(res), "Send message 5");
+    uint8_t copy[sizeof buf];
+    memcpy(copy, buf, sizeof buf);
+    res = Noise_XK_session_read_buffer(alice_session, sizeof buf, buf, 12, buf);
+    RETURN_IF_ERROR(Noise_XK_rcode_is_success(res), "Receive message 5");
+    res = Noise_XK_session_read_buffer(alice_session, sizeof copy, copy, 12, copy);
+    RETURN_IF_ERROR(!Noise_XK_rcode_is_success(res), "Replay message 5");
+
     /*
      * Cleanup
      */
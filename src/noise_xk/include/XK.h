@@ -433,6 +433,47 @@ Noise_XK_session_read(
   uint8_t *input
 );
 
+/*
+  Same as Noise_XK_session_write() in the transport phase, but without
+  any allocation: the plen bytes at plain are encrypted into the
+  caller's buffer cipher of clen = plen + 16 bytes. cipher may be equal
+  to plain, in which case the message is encrypted in place.
+
+  Transport messages always have the confidentiality level
+  NOISE_XK_CONF_STRONG_FORWARD_SECRECY. Fails with
+  Noise_XK_CIncorrect_transition if the session has not reached the
+  transport phase yet, the handshake messages must be written with
+  Noise_XK_session_write().
+*/
+Noise_XK_rcode
+Noise_XK_session_write_buffer(
+  Noise_XK_session_t *sn_p,
+  uint32_t plen,
+  uint8_t *plain,
+  uint32_t clen,
+  uint8_t *cipher
+);
+
+/*
+  Same as Noise_XK_session_read() in the transport phase, but without
+  any allocation: the clen bytes at cipher are decrypted into the
+  caller's buffer plain of plen = clen - 16 bytes. plain may be equal
+  to cipher, in which case the message is decrypted in place.
+
+  Transport messages always have the authentication level
+  NOISE_XK_AUTH_KNOWN_SENDER_NO_KCI. Fails like
+  Noise_XK_session_write_buffer() if the session is not in the
+  transport phase.
+*/
+Noise_XK_rcode
+Noise_XK_session_read_buffer(
+  Noise_XK_session_t *sn_p,
+  uint32_t clen,
+  uint8_t *cipher,
+  uint32_t plen,
+  uint8_t *plain
+);
+
 /*
   Compute the length of the next message, given a payload length.
 
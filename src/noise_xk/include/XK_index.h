@@ -0,0 +1,85 @@
+/*
+    @copyright 2024, Stefan Marsiske toprf@ctrlc.hu
+    This file is part of liboprf.
+
+    liboprf is free software: you can redistribute it and/or
+    modify it under the terms of the GNU Lesser General Public License
+    as published by the Free Software Foundation, either version 3 of
+    the License, or (at your option) any later version.
+
+    liboprf is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Lesser General Public License for more details.
+
+    You should have received a copy of the License
+    along with liboprf. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef noise_xk_index_h
+#define noise_xk_index_h
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "XK.h"
+
+/*
+ * A device keeps its peers in a linked list, which is searched for
+ * every added peer, every session created by an initiator and every
+ * handshake received by a responder. With many peers - thousands of
+ * authorized keys, or the n-1 peers of each participant of a large
+ * DKG - this becomes the dominant cost of setting up sessions.
+ *
+ * In the indexed mode a device additionally keeps a hash table on the
+ * static keys and a table of the peer ids pointing into the list.
+ * Every lookup of the verified code is started at the cell found in
+ * the index, which is then checked by the verified code itself, so a
+ * lookup finds exactly the peer a walk of the list would.
+ */
+
+/**
+   Switches a device to the indexed mode, indexing the peers already
+   added to the device. The mode can not be switched off again, the
+   index is freed by Noise_XK_device_free().
+
+   If memory for the index can not be allocated - now or when adding
+   a later peer - the device silently falls back to walking the list,
+   so this only affects the performance of the device.
+
+    @param [in] dvp: the device
+    @return The function returns true if the device is indexed.
+ */
+bool Noise_XK_device_enable_peer_index(Noise_XK_device_t *dvp);
+
+/**
+   Returns true if the device is in the indexed mode.
+ */
+bool Noise_XK_device_has_peer_index(Noise_XK_device_t *dvp);
+
+/* The following functions are used by XK.c to maintain the index. */
+
+typedef struct Noise_XK_peer_index_s Noise_XK_peer_index;
+
+Noise_XK_peer_index *Noise_XK_peer_index_new(void);
+
+void Noise_XK_peer_index_free(Noise_XK_peer_index *idx);
+
+/*
+  Adds the cell of a peer with the static key s - which must remain
+  valid while the peer is in the index - and the id to idx. On
+  failure idx is freed and NULL returned, an idx of NULL is returned
+  as it is.
+*/
+Noise_XK_peer_index *Noise_XK_peer_index_add(Noise_XK_peer_index *idx, Noise_XK_cell *cell,
+                                           const uint8_t s[32], uint32_t id);
+
+void Noise_XK_peer_index_remove(Noise_XK_peer_index *idx, const uint8_t s[32], uint32_t id);
+
+/*
+  Return the cell of the peer, or NULL if it is not in the index.
+*/
+Noise_XK_cell *Noise_XK_peer_index_find_static(const Noise_XK_peer_index *idx, const uint8_t s[32]);
+
+Noise_XK_cell *Noise_XK_peer_index_find_id(const Noise_XK_peer_index *idx, uint32_t id);
+
+#endif // noise_xk_index_h
@@ -280,6 +280,7 @@ bool Noise_XK_rcode_is_stuck(Noise_XK_rcode c)
 }
 
 #include "noise_private.h"
+#include "XK_index.h"
 
 typedef struct Noise_XK_peer_t_s
 {
@@ -303,6 +304,7 @@ typedef struct Noise_XK_device_t_s
   uint32_t dv_states_counter;
   Noise_XK_cell **dv_peers;
   uint32_t dv_peers_counter;
+  Noise_XK_peer_index *dv_index;
 }
 Noise_XK_device_t;
 
@@ -411,7 +413,7 @@ Noise_XK_device_t
           {
             .dv_info = info_, .dv_sk = sk_, .dv_spriv = spriv_, .dv_spub = spub_,
             .dv_prologue = prlg_1, .dv_states_counter = (uint32_t)1U, .dv_peers = peers,
-            .dv_peers_counter = (uint32_t)1U
+            .dv_peers_counter = (uint32_t)1U, .dv_index = NULL
           };
         KRML_CHECK_SIZE(sizeof (Noise_XK_device_t), (uint32_t)1U);
         Noise_XK_device_t *dvp = KRML_HOST_MALLOC(sizeof (Noise_XK_device_t));
@@ -565,7 +567,8 @@ Noise_XK_device_t
     dv =
       {
         .dv_info = info_, .dv_sk = sk_, .dv_spriv = spriv_, .dv_spub = spub_, .dv_prologue = prlg_1,
-        .dv_states_counter = (uint32_t)1U, .dv_peers = peers, .dv_peers_counter = (uint32_t)1U
+        .dv_states_counter = (uint32_t)1U, .dv_peers = peers, .dv_peers_counter = (uint32_t)1U,
+        .dv_index = NULL
       };
     KRML_CHECK_SIZE(sizeof (Noise_XK_device_t), (uint32_t)1U);
     Noise_XK_device_t *dvp = KRML_HOST_MALLOC(sizeof (Noise_XK_device_t));
@@ -610,6 +613,7 @@ void Noise_XK_device_free(Noise_XK_device_t *dvp)
   KRML_HOST_FREE(dv.dv_info);
   free__Impl_Noise_API_Device_raw_peer_p_or_null_raw_Impl_Noise_API_Device_raw_peer_t_raw_uint32_t_Impl_Noise_String_hstring__uint8_t____(dv.dv_peers);
   KRML_HOST_FREE(dv.dv_peers);
+  Noise_XK_peer_index_free(dv.dv_index);
   KRML_HOST_FREE(dv.dv_spriv);
   KRML_HOST_FREE(dv.dv_spub);
   if (!(dv.dv_prologue.buffer == NULL))
@@ -617,6 +621,25 @@ void Noise_XK_device_free(Noise_XK_device_t *dvp)
   KRML_HOST_FREE(dvp);
 }
 
+/*
+  Not generated: switch a device to the indexed mode, see XK_index.h.
+*/
+bool Noise_XK_device_enable_peer_index(Noise_XK_device_t *dvp)
+{
+  if (dvp->dv_index != NULL)
+    return true;
+  Noise_XK_peer_index *idx = Noise_XK_peer_index_new();
+  for (Noise_XK_cell *c = *dvp->dv_peers; c != NULL && idx != NULL; c = c->next)
+    idx = Noise_XK_peer_index_add(idx, c, c->data->p_s, c->data->p_id);
+  dvp->dv_index = idx;
+  return idx != NULL;
+}
+
+bool Noise_XK_device_has_peer_index(Noise_XK_device_t *dvp)
+{
+  return dvp->dv_index != NULL;
+}
+
 /*
   Encrypt and derialize a device's secret.
 
@@ -701,6 +724,8 @@ Noise_XK_peer_t *Noise_XK_device_add_peer(Noise_XK_device_t *dvp, uint8_t *pinfo
   bool b1 = pcounter == (uint32_t)4294967295U;
   Noise_XK_cell *llt = *dv.dv_peers;
   Noise_XK_cell *lltp = llt;
+  if (dv.dv_index != NULL)
+    lltp = Noise_XK_peer_index_find_static(dv.dv_index, rs);
   Noise_XK_cell *llt10 = lltp;
   bool b0;
   if (llt10 == NULL)
@@ -824,7 +849,8 @@ Noise_XK_peer_t *Noise_XK_device_add_peer(Noise_XK_device_t *dvp, uint8_t *pinfo
           .dv_prologue = prologue1,
           .dv_states_counter = scounter1,
           .dv_peers = peers1,
-          .dv_peers_counter = pcounter1 + (uint32_t)1U
+          .dv_peers_counter = pcounter1 + (uint32_t)1U,
+          .dv_index = Noise_XK_peer_index_add(dv.dv_index, *peers1, rs1, pcounter1)
         }
       );
     Noise_XK_peer_t *pp0 = pp;
@@ -899,6 +925,7 @@ void Noise_XK_device_remove_peer(Noise_XK_device_t *dvp, uint32_t pid)
           Noise_XK_cell c1 = *c01.next;
           llt2[0U] = ((Noise_XK_cell){ .next = c1.next, .data = c01.data });
           Noise_XK_peer_t p = c1.data[0U];
+          Noise_XK_peer_index_remove(dv.dv_index, p.p_s, p.p_id);
           uint8_t *str = p.p_info[0U];
           if (!(str == NULL))
             KRML_HOST_FREE(str);
@@ -919,6 +946,7 @@ void Noise_XK_device_remove_peer(Noise_XK_device_t *dvp, uint32_t pid)
         *elem1 =
           pop__Impl_Noise_API_Device_raw_peer_p_or_null_raw_Impl_Noise_API_Device_raw_peer_t_raw_uint32_t_Impl_Noise_String_hstring__uint8_t____(dv.dv_peers);
         Noise_XK_peer_t p = elem1[0U];
+        Noise_XK_peer_index_remove(dv.dv_index, p.p_s, p.p_id);
         uint8_t *str = p.p_info[0U];
         if (!(str == NULL))
           KRML_HOST_FREE(str);
@@ -1071,6 +1099,8 @@ Noise_XK_peer_t
       bool b1 = pcounter == (uint32_t)4294967295U;
       Noise_XK_cell *llt = *dv1.dv_peers;
       Noise_XK_cell *lltp = llt;
+      if (dv1.dv_index != NULL)
+        lltp = Noise_XK_peer_index_find_static(dv1.dv_index, p_s);
       Noise_XK_cell *llt10 = lltp;
       bool b0;
       if (llt10 == NULL)
@@ -1195,7 +1225,8 @@ Noise_XK_peer_t
               .dv_prologue = prologue1,
               .dv_states_counter = scounter1,
               .dv_peers = peers1,
-              .dv_peers_counter = pcounter1 + (uint32_t)1U
+              .dv_peers_counter = pcounter1 + (uint32_t)1U,
+              .dv_index = Noise_XK_peer_index_add(dv1.dv_index, *peers1, rs, pcounter1)
             }
           );
         Noise_XK_peer_t *pp0 = pp;
@@ -1231,6 +1262,8 @@ Noise_XK_peer_t *Noise_XK_device_lookup_peer_by_id(Noise_XK_device_t *dvp, uint3
   {
     Noise_XK_cell *llt = *dv.dv_peers;
     Noise_XK_cell *lltp = llt;
+    if (dv.dv_index != NULL)
+      lltp = Noise_XK_peer_index_find_id(dv.dv_index, id);
     Noise_XK_cell *llt10 = lltp;
     bool b0;
     if (llt10 == NULL)
@@ -1287,6 +1320,8 @@ Noise_XK_peer_t *Noise_XK_device_lookup_peer_by_static(Noise_XK_device_t *dvp, u
   Noise_XK_device_t dv = dvp[0U];
   Noise_XK_cell *llt = *dv.dv_peers;
   Noise_XK_cell *lltp = llt;
+  if (dv.dv_index != NULL)
+    lltp = Noise_XK_peer_index_find_static(dv.dv_index, s);
   Noise_XK_cell *llt10 = lltp;
   bool b0;
   if (llt10 == NULL)
@@ -1585,6 +1620,8 @@ Noise_XK_session_t *Noise_XK_session_create_initiator(Noise_XK_device_t *dvp, ui
           {
             Noise_XK_cell *llt = *dv1.dv_peers;
             Noise_XK_cell *lltp = llt;
+            if (dv1.dv_index != NULL)
+              lltp = Noise_XK_peer_index_find_id(dv1.dv_index, pid);
             Noise_XK_cell *llt10 = lltp;
             bool b0;
             if (llt10 == NULL)
@@ -1750,7 +1787,8 @@ Noise_XK_session_t *Noise_XK_session_create_initiator(Noise_XK_device_t *dvp, ui
                   .dv_prologue = dv.dv_prologue,
                   .dv_states_counter = dv.dv_states_counter + (uint32_t)1U,
                   .dv_peers = dv.dv_peers,
-                  .dv_peers_counter = dv.dv_peers_counter
+                  .dv_peers_counter = dv.dv_peers_counter,
+                  .dv_index = dv.dv_index
                 }
               );
             uint8_t *st_k = KRML_HOST_CALLOC((uint32_t)32U, sizeof (uint8_t));
@@ -1966,7 +2004,8 @@ Noise_XK_session_t *Noise_XK_session_create_responder(Noise_XK_device_t *dvp)
                 .dv_prologue = dv.dv_prologue,
                 .dv_states_counter = dv.dv_states_counter + (uint32_t)1U,
                 .dv_peers = dv.dv_peers,
-                .dv_peers_counter = dv.dv_peers_counter
+                .dv_peers_counter = dv.dv_peers_counter,
+                .dv_index = dv.dv_index
               }
             );
           uint8_t *st_k = KRML_HOST_CALLOC((uint32_t)32U, sizeof (uint8_t));
@@ -3348,6 +3387,8 @@ state_handshake_read(
               Noise_XK_cell **peers1 = dv0.dv_peers;
               Noise_XK_cell *llt = *peers1;
               Noise_XK_cell *lltp = llt;
+              if (dv0.dv_index != NULL)
+                lltp = Noise_XK_peer_index_find_static(dv0.dv_index, st_rs);
               Noise_XK_cell *llt10 = lltp;
               bool b0;
               if (llt10 == NULL)
@@ -5201,6 +5242,72 @@ Noise_XK_session_read(
   Also note that the length of the next message is always equal to:
   payload length + a value depending only on the current step.
 */
+/*
+  The caller-buffer transport functions are not part of noise-star,
+  they do what the transport branches of Noise_XK_session_write() and
+  Noise_XK_session_read() do, minus the allocations and the
+  encapsulated messages. The security levels of the transport phase
+  are constant, so there is nothing to check for them.
+*/
+static bool session_in_transport(Noise_XK_session_t *sn)
+{
+  if (sn->tag == Noise_XK_DS_Initiator)
+    return sn->val.case_DS_Initiator.state.tag == Noise_XK_IMS_Transport;
+  else if (sn->tag == Noise_XK_DS_Responder)
+    return sn->val.case_DS_Responder.state.tag == Noise_XK_IMS_Transport;
+  return false;
+}
+
+Noise_XK_rcode
+Noise_XK_session_write_buffer(
+  Noise_XK_session_t *sn_p,
+  uint32_t plen,
+  uint8_t *plain,
+  uint32_t clen,
+  uint8_t *cipher
+)
+{
+  if (!session_in_transport(sn_p))
+    return
+      (
+        (Noise_XK_rcode){
+          .tag = Noise_XK_Error,
+          .val = { .case_Error = Noise_XK_CIncorrect_transition }
+        }
+      );
+  if (!(plen <= (uint32_t)4294967279U && clen == plen + (uint32_t)16U))
+    return ((Noise_XK_rcode){ .tag = Noise_XK_Error, .val = { .case_Error = Noise_XK_CInput_size } });
+  Noise_XK_error_code res = state_transport_write(plen, plain, clen, cipher, sn_p);
+  if (res == Noise_XK_CSuccess)
+    return ((Noise_XK_rcode){ .tag = Noise_XK_Success });
+  return ((Noise_XK_rcode){ .tag = Noise_XK_Error, .val = { .case_Error = res } });
+}
+
+Noise_XK_rcode
+Noise_XK_session_read_buffer(
+  Noise_XK_session_t *sn_p,
+  uint32_t clen,
+  uint8_t *cipher,
+  uint32_t plen,
+  uint8_t *plain
+)
+{
+  if (!session_in_transport(sn_p))
+    return
+      (
+        (Noise_XK_rcode){
+          .tag = Noise_XK_Error,
+          .val = { .case_Error = Noise_XK_CIncorrect_transition }
+        }
+      );
+  if (!(clen >= (uint32_t)16U && plen == clen - (uint32_t)16U))
+    return ((Noise_XK_rcode){ .tag = Noise_XK_Error, .val = { .case_Error = Noise_XK_CInput_size } });
+  Noise_XK_error_code res = state_transport_read(plen, plain, clen, cipher, sn_p);
+  if (res == Noise_XK_CSuccess)
+    return ((Noise_XK_rcode){ .tag = Noise_XK_Success });
+  return ((Noise_XK_rcode){ .tag = Noise_XK_Error, .val = { .case_Error = res } });
+}
+
 bool
 Noise_XK_session_compute_next_message_len(
   uint32_t *out,
@@ -5802,6 +5909,8 @@ Noise_XK_session_t
     {
       Noise_XK_cell *llt = *dv1.dv_peers;
       Noise_XK_cell *lltp = llt;
+      if (dv1.dv_index != NULL)
+        lltp = Noise_XK_peer_index_find_id(dv1.dv_index, pid);
       Noise_XK_cell *llt10 = lltp;
       bool b0;
       if (llt10 == NULL)
@@ -5966,7 +6075,8 @@ Noise_XK_session_t
             .dv_prologue = dv.dv_prologue,
             .dv_states_counter = dv.dv_states_counter + (uint32_t)1U,
             .dv_peers = dv.dv_peers,
-            .dv_peers_counter = dv.dv_peers_counter
+            .dv_peers_counter = dv.dv_peers_counter,
+            .dv_index = dv.dv_index
           }
         );
       uint8_t *st_k = KRML_HOST_CALLOC((uint32_t)32U, sizeof (uint8_t));
@@ -6153,7 +6263,8 @@ Noise_XK_session_t
           .dv_prologue = dv.dv_prologue,
           .dv_states_counter = dv.dv_states_counter + (uint32_t)1U,
           .dv_peers = dv.dv_peers,
-          .dv_peers_counter = dv.dv_peers_counter
+          .dv_peers_counter = dv.dv_peers_counter,
+          .dv_index = dv.dv_index
         }
       );
     uint8_t *st_k = KRML_HOST_CALLOC((uint32_t)32U, sizeof (uint8_t));
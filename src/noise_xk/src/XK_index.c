@@ -0,0 +1,155 @@
+/*
+    @copyright 2024, Stefan Marsiske toprf@ctrlc.hu
+    This file is part of liboprf.
+
+    liboprf is free software: you can redistribute it and/or
+    modify it under the terms of the GNU Lesser General Public License
+    as published by the Free Software Foundation, either version 3 of
+    the License, or (at your option) any later version.
+
+    liboprf is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Lesser General Public License for more details.
+
+    You should have received a copy of the License
+    along with liboprf. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <stdlib.h>
+#include <string.h>
+#include <sodium.h>
+#include "XK_index.h"
+
+typedef struct {
+  const uint8_t *s;
+  Noise_XK_cell *cell;
+} Slot;
+
+struct Noise_XK_peer_index_s {
+  // open addressing with linear probing, at most half full
+  Slot *slots;
+  uint32_t mask;
+  uint32_t len;
+  // ids are handed out by the device in increasing order and never
+  // reused, ids[id] is the peer with the id or NULL if it was removed
+  Noise_XK_cell **ids;
+  uint32_t ids_len;
+  // the static keys are chosen by the peers, a keyed hash keeps them
+  // from crowding one spot of the table
+  uint8_t key[crypto_generichash_KEYBYTES];
+};
+
+static uint32_t slot_of(const Noise_XK_peer_index *idx, const uint8_t s[32]) {
+  uint8_t h[crypto_generichash_BYTES_MIN];
+  crypto_generichash(h, sizeof h, s, 32, idx->key, sizeof idx->key);
+  uint32_t r;
+  memcpy(&r, h, sizeof r);
+  return r & idx->mask;
+}
+
+Noise_XK_peer_index *Noise_XK_peer_index_new(void) {
+  Noise_XK_peer_index *idx = calloc(1, sizeof(Noise_XK_peer_index));
+  if(idx==NULL) return NULL;
+  idx->mask = 15;
+  idx->slots = calloc(idx->mask + 1, sizeof(Slot));
+  if(idx->slots==NULL) {
+    free(idx);
+    return NULL;
+  }
+  randombytes_buf(idx->key, sizeof idx->key);
+  return idx;
+}
+
+void Noise_XK_peer_index_free(Noise_XK_peer_index *idx) {
+  if(idx==NULL) return;
+  free(idx->slots);
+  free(idx->ids);
+  free(idx);
+}
+
+static void insert_slot(Noise_XK_peer_index *idx, const uint8_t *s, Noise_XK_cell *cell) {
+  uint32_t i = slot_of(idx, s);
+  while(idx->slots[i].s!=NULL) i = (i + 1) & idx->mask;
+  idx->slots[i].s = s;
+  idx->slots[i].cell = cell;
+}
+
+static int grow_slots(Noise_XK_peer_index *idx) {
+  const uint32_t old_mask = idx->mask;
+  Slot *old = idx->slots;
+  if(old_mask >= 0x7fffffffU) return 1;
+  Slot *slots = calloc((size_t) old_mask * 2 + 2, sizeof(Slot));
+  if(slots==NULL) return 1;
+  idx->slots = slots;
+  idx->mask = old_mask * 2 + 1;
+  for(uint32_t i=0;i<=old_mask;i++) {
+    if(old[i].s!=NULL) insert_slot(idx, old[i].s, old[i].cell);
+  }
+  free(old);
+  return 0;
+}
+
+static int grow_ids(Noise_XK_peer_index *idx, const uint32_t id) {
+  size_t len = idx->ids_len ? idx->ids_len : 16;
+  while(len <= id) len *= 2;
+  Noise_XK_cell **ids = realloc(idx->ids, len * sizeof(Noise_XK_cell*));
+  if(ids==NULL) return 1;
+  memset(ids + idx->ids_len, 0, (len - idx->ids_len) * sizeof(Noise_XK_cell*));
+  idx->ids = ids;
+  idx->ids_len = (uint32_t) (len > UINT32_MAX ? UINT32_MAX : len);
+  return 0;
+}
+
+Noise_XK_peer_index *Noise_XK_peer_index_add(Noise_XK_peer_index *idx, Noise_XK_cell *cell,
+                                           const uint8_t s[32], uint32_t id) {
+  if(idx==NULL) return NULL;
+  if((idx->len + 1) * 2 > idx->mask + 1 && grow_slots(idx)) goto fail;
+  if(id >= idx->ids_len && grow_ids(idx, id)) goto fail;
+  insert_slot(idx, s, cell);
+  idx->len++;
+  idx->ids[id] = cell;
+  return idx;
+
+fail:
+  Noise_XK_peer_index_free(idx);
+  return NULL;
+}
+
+void Noise_XK_peer_index_remove(Noise_XK_peer_index *idx, const uint8_t s[32], uint32_t id) {
+  if(idx==NULL) return;
+  if(id < idx->ids_len) idx->ids[id] = NULL;
+
+  uint32_t i = slot_of(idx, s);
+  while(idx->slots[i].s!=NULL && memcmp(idx->slots[i].s, s, 32)!=0) i = (i + 1) & idx->mask;
+  if(idx->slots[i].s==NULL) return;
+  idx->len--;
+  // shift back the following slots which would not be found anymore
+  // with a hole at i, so that lookups can stop at the first empty slot
+  uint32_t j = i;
+  for(;;) {
+    idx->slots[i].s = NULL;
+    for(;;) {
+      j = (j + 1) & idx->mask;
+      if(idx->slots[j].s==NULL) return;
+      const uint32_t k = slot_of(idx, idx->slots[j].s);
+      // the entry at j stays if its home k lies cyclically in (i, j]
+      if(i<=j ? (i<k && k<=j) : (i<k || k<=j)) continue;
+      break;
+    }
+    idx->slots[i] = idx->slots[j];
+    i = j;
+  }
+}
+
+Noise_XK_cell *Noise_XK_peer_index_find_static(const Noise_XK_peer_index *idx, const uint8_t s[32]) {
+  for(uint32_t i = slot_of(idx, s);idx->slots[i].s!=NULL;i = (i + 1) & idx->mask) {
+    if(memcmp(idx->slots[i].s, s, 32)==0) return idx->slots[i].cell;
+  }
+  return NULL;
+}
+
+Noise_XK_cell *Noise_XK_peer_index_find_id(const Noise_XK_peer_index *idx, uint32_t id) {
+  if(id >= idx->ids_len) return NULL;
+  return idx->ids[id];
+}
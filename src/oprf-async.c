@@ -0,0 +1,148 @@
+/*
+    @copyright 2024, Stefan Marsiske toprf@ctrlc.hu
+    This file is part of liboprf.
+
+    liboprf is free software: you can redistribute it and/or
+    modify it under the terms of the GNU Lesser General Public License
+    as published by the Free Software Foundation, either version 3 of
+    the License, or (at your option) any later version.
+
+    liboprf is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Lesser General Public License for more details.
+
+    You should have received a copy of the License
+    along with liboprf. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include "oprf.h"
+#include "oprf-async.h"
+
+/*
+ * The completions are kept in a ring buffer which grows as needed. A
+ * pipe signals the event loop: a byte is written when the ring
+ * becomes non-empty, and the pipe is drained when oprf_async_poll()
+ * empties the ring, both while holding the lock, so the pipe is
+ * readable exactly while there are completions.
+ */
+struct oprf_AsyncQueue {
+  pthread_mutex_t lock;
+  oprf_Completion *ring;
+  size_t cap;
+  size_t head;
+  size_t len;
+  int fds[2];
+};
+
+oprf_AsyncQueue* oprf_async_new(void) {
+  oprf_AsyncQueue *q = calloc(1, sizeof(oprf_AsyncQueue));
+  if(q==NULL) return NULL;
+  q->cap = 64;
+  q->ring = malloc(q->cap * sizeof(oprf_Completion));
+  if(q->ring==NULL) goto fail_ring;
+  if(pipe(q->fds)) goto fail_pipe;
+  for(int i=0;i<2;i++) {
+    const int flags = fcntl(q->fds[i], F_GETFL);
+    if(flags==-1 || fcntl(q->fds[i], F_SETFL, flags | O_NONBLOCK)==-1) goto fail;
+    fcntl(q->fds[i], F_SETFD, FD_CLOEXEC);
+  }
+  if(pthread_mutex_init(&q->lock, NULL)) goto fail;
+  return q;
+
+fail:
+  close(q->fds[0]);
+  close(q->fds[1]);
+fail_pipe:
+  free(q->ring);
+fail_ring:
+  free(q);
+  return NULL;
+}
+
+void oprf_async_free(oprf_AsyncQueue *q) {
+  if(q==NULL) return;
+  pthread_mutex_destroy(&q->lock);
+  close(q->fds[0]);
+  close(q->fds[1]);
+  sodium_memzero(q->ring, q->cap * sizeof(oprf_Completion));
+  free(q->ring);
+  free(q);
+}
+
+int oprf_async_fd(const oprf_AsyncQueue *q) {
+  return q->fds[0];
+}
+
+static int grow(oprf_AsyncQueue *q) {
+  oprf_Completion *ring = malloc(q->cap * 2 * sizeof(oprf_Completion));
+  if(ring==NULL) return -1;
+  // unwrap the ring into the start of the new one
+  const size_t first = q->cap - q->head < q->len ? q->cap - q->head : q->len;
+  memcpy(ring, q->ring + q->head, first * sizeof(oprf_Completion));
+  memcpy(ring + first, q->ring, (q->len - first) * sizeof(oprf_Completion));
+  sodium_memzero(q->ring, q->cap * sizeof(oprf_Completion));
+  free(q->ring);
+  q->ring = ring;
+  q->head = 0;
+  q->cap *= 2;
+  return 0;
+}
+
+int oprf_async_complete(oprf_AsyncQueue *q, void *user, const int status,
+                        const uint8_t Z[crypto_core_ristretto255_BYTES]) {
+  pthread_mutex_lock(&q->lock);
+  if(q->len==q->cap && grow(q)) {
+    pthread_mutex_unlock(&q->lock);
+    return -1;
+  }
+  oprf_Completion *c = &q->ring[(q->head + q->len) % q->cap];
+  c->user = user;
+  c->status = status;
+  if(status==0) memcpy(c->Z, Z, sizeof c->Z);
+  else memset(c->Z, 0, sizeof c->Z);
+  if(q->len++==0) {
+    const uint8_t one = 1;
+    // the pipe is empty, so this can not fail with EAGAIN
+    if(write(q->fds[1], &one, 1)!=1) {
+      q->len--;
+      pthread_mutex_unlock(&q->lock);
+      return -1;
+    }
+  }
+  pthread_mutex_unlock(&q->lock);
+  return 0;
+}
+
+size_t oprf_async_poll(oprf_AsyncQueue *q, const size_t max, oprf_Completion out[max]) {
+  pthread_mutex_lock(&q->lock);
+  size_t n = 0;
+  for(;n<max && q->len>0;n++) {
+    memcpy(&out[n], &q->ring[q->head], sizeof(oprf_Completion));
+    q->head = (q->head + 1) % q->cap;
+    q->len--;
+  }
+  if(n>0 && q->len==0) {
+    uint8_t buf[16];
+    while(read(q->fds[0], buf, sizeof buf)>0);
+  }
+  pthread_mutex_unlock(&q->lock);
+  return n;
+}
+
+int oprf_EvaluateAsync(const oprf_AsyncCfg *cfg,
+                       const uint8_t k[crypto_core_ristretto255_SCALARBYTES],
+                       const uint8_t blinded[crypto_core_ristretto255_BYTES],
+                       oprf_AsyncQueue *q,
+                       void *user) {
+  if(cfg && cfg->eval) return cfg->eval(cfg->arg, k, blinded, q, user);
+
+  uint8_t Z[crypto_core_ristretto255_BYTES];
+  const int status = oprf_Evaluate_cfg(NULL, k, blinded, Z);
+  return oprf_async_complete(q, user, status, Z);
+}
@@ -0,0 +1,150 @@
+/*
+    @copyright 2024, Stefan Marsiske toprf@ctrlc.hu
+    This file is part of liboprf.
+
+    liboprf is free software: you can redistribute it and/or
+    modify it under the terms of the GNU Lesser General Public License
+    as published by the Free Software Foundation, either version 3 of
+    the License, or (at your option) any later version.
+
+    liboprf is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Lesser General Public License for more details.
+
+    You should have received a copy of the License
+    along with liboprf. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef OPRF_ASYNC_H
+#define OPRF_ASYNC_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <sodium.h>
+#include "toprf.h"
+
+/**
+ * Asynchronous evaluation through a proxy.
+ *
+ * The proxies of oprf_set_evalproxy() and oprf_Evaluate_cfg() block
+ * the calling thread until the evaluation is done, which for a proxy
+ * contacting remote shareholders means one thread per evaluation in
+ * flight. An asynchronous proxy instead only submits the evaluation
+ * and returns, and reports the result later - from any thread - to a
+ * completion queue by calling oprf_async_complete(). An event loop
+ * waits for the file descriptor of the queue to become readable and
+ * collects the results with oprf_async_poll(), so a single thread can
+ * keep any number of evaluations in flight.
+ */
+typedef struct oprf_AsyncQueue oprf_AsyncQueue;
+
+/**
+ * A finished evaluation as returned by oprf_async_poll().
+ */
+typedef struct {
+  // the user pointer passed to oprf_EvaluateAsync()
+  void *user;
+  // 0 if the evaluation succeeded, the error of the proxy otherwise
+  int status;
+  // the evaluated element, zeroed if status is not 0
+  uint8_t Z[crypto_core_ristretto255_BYTES];
+} oprf_Completion;
+
+/**
+ * The signature of an asynchronous proxy. It must not block, and must
+ * call oprf_async_complete(q, user, ...) exactly once for every
+ * evaluation it accepts, either before returning or later from any
+ * thread.
+ *
+ * @param [in] arg - the arg of the oprf_AsyncCfg
+ * @param [in] k - the key passed to oprf_EvaluateAsync(), may be ignored
+ * @param [in] alpha - the blinded element to evaluate
+ * @param [in] q - the queue receiving the result
+ * @param [in] user - identifies the evaluation in the result
+ *
+ * @return The function returns 0 if it accepted the evaluation,
+ *         anything else if it did not, in which case it must not
+ *         complete it.
+ */
+typedef int (*toprf_evalasynccb)(void *arg,
+                                 const uint8_t k[crypto_core_ristretto255_SCALARBYTES],
+                                 const uint8_t alpha[crypto_core_ristretto255_BYTES],
+                                 oprf_AsyncQueue *q,
+                                 void *user);
+
+typedef struct {
+  toprf_evalasynccb eval;
+  void *arg;
+} oprf_AsyncCfg;
+
+/**
+ * Creates a new completion queue.
+ *
+ * @return The function returns a new queue, or NULL on error.
+ */
+oprf_AsyncQueue* oprf_async_new(void);
+
+/**
+ * Frees a queue, there must be no evaluations in flight.
+ */
+void oprf_async_free(oprf_AsyncQueue *q);
+
+/**
+ * Returns a file descriptor which is readable while there are
+ * completions to be collected with oprf_async_poll(), for use with
+ * poll(), epoll or any other event loop. It must not be read from or
+ * closed by the caller.
+ */
+int oprf_async_fd(const oprf_AsyncQueue *q);
+
+/**
+ * Starts an evaluation of blinded, whose result is reported to q.
+ *
+ * @param [in] cfg - the asynchronous proxy, if cfg is NULL or has no
+ *             callback, blinded is evaluated with k right away and
+ *             its completion is queued before this function returns
+ * @param [in] k - a private key - ignored by most proxies
+ * @param [in] blinded - a serialized OPRF group element, an output of
+ *             oprf_Blind
+ * @param [in] q - the queue receiving the completion
+ * @param [in] user - returned with the completion
+ *
+ * @return The function returns 0 if the evaluation was started, and
+ *         then it is completed exactly once. Otherwise it returns the
+ *         error of the proxy or -1, and there will be no completion.
+ */
+int oprf_EvaluateAsync(const oprf_AsyncCfg *cfg,
+                       const uint8_t k[crypto_core_ristretto255_SCALARBYTES],
+                       const uint8_t blinded[crypto_core_ristretto255_BYTES],
+                       oprf_AsyncQueue *q,
+                       void *user);
+
+/**
+ * Queues the result of an evaluation, called by asynchronous proxies
+ * from any thread.
+ *
+ * @param [in] q - the queue passed to the proxy
+ * @param [in] user - the user pointer passed to the proxy
+ * @param [in] status - 0 if the evaluation succeeded
+ * @param [in] Z - the evaluated element, ignored if status is not 0
+ *
+ * @return The function returns 0 if everything is correct, -1 if the
+ *         completion could not be queued.
+ */
+int oprf_async_complete(oprf_AsyncQueue *q, void *user, const int status,
+                        const uint8_t Z[crypto_core_ristretto255_BYTES]);
+
+/**
+ * Collects finished evaluations, without blocking.
+ *
+ * @param [in] q - the queue
+ * @param [in] max - the number of entries in out
+ * @param [out] out - the completions
+ *
+ * @return The function returns the number of completions written to
+ *         out, 0 if there are none.
+ */
+size_t oprf_async_poll(oprf_AsyncQueue *q, const size_t max, oprf_Completion out[max]);
+
+#endif // OPRF_ASYNC_H
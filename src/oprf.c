@@ -19,10 +19,14 @@
 #include <stdint.h>
 #include <stdio.h>
 #include <string.h>
+#include <stdlib.h>
+#include <pthread.h>
 #include <arpa/inet.h>
 #include "oprf.h"
 #include "utils.h"
 #include "toprf.h"
+#include "sha512mb.h"
+#include "scratch.h"
 
 #ifdef CFRG_TEST_VEC
 #ifdef CFRG_OPRF_TEST_VEC
@@ -34,26 +38,112 @@
 
 #define VOPRF "OPRFV1"
 
-static toprf_cfg proxy_cfg={0};
+// the number of inputs the batch functions hash at once, bounds their stack usage
+#define BATCH_CHUNK 64
+// the length of the hash-to-group DST_prime
+#define H2G_DST_PRIME_LEN 41
+
+// the proxy set by oprf_set_evalproxy() and oprf_set_evalbatchproxy().
+// it can be changed while other threads are evaluating, so readers
+// load the pointer once and only use that configuration. published
+// configurations are never modified or freed, as a reader might still
+// use one after it has been replaced, instead every distinct
+// configuration is allocated once and reused by later setters. the
+// batch callback is kept next to the public toprf_cfg, not in it, so
+// that the layout of toprf_cfg stays the same.
+typedef struct Proxy_Cfg {
+  toprf_cfg cfg;
+  toprf_evalbatchcb evalbatch;
+  struct Proxy_Cfg *next;
+} Proxy_Cfg;
+
+static const Proxy_Cfg no_proxy_cfg={0};
+static const Proxy_Cfg *proxy_cfg=&no_proxy_cfg;
+// all the configurations ever published, and the lock of the setters
+static Proxy_Cfg *proxy_cfgs=NULL;
+static pthread_mutex_t proxy_lock=PTHREAD_MUTEX_INITIALIZER;
+
+static const Proxy_Cfg *global_proxy(void) {
+  return __atomic_load_n(&proxy_cfg, __ATOMIC_ACQUIRE);
+}
+
+// publishes the configuration, must be called with proxy_lock held
+static int publish_proxy(const toprf_evalcb eval, const toprf_keygencb keygen, const toprf_evalbatchcb evalbatch) {
+  Proxy_Cfg *p;
+  for(p=proxy_cfgs;p!=NULL;p=p->next) {
+    if(p->cfg.eval==eval && p->cfg.keygen==keygen && p->evalbatch==evalbatch) break;
+  }
+  if(p==NULL) {
+    p = malloc(sizeof(Proxy_Cfg));
+    if(p==NULL) return -1;
+    p->cfg.eval = eval;
+    p->cfg.keygen = keygen;
+    p->evalbatch = evalbatch;
+    p->next = proxy_cfgs;
+    proxy_cfgs = p;
+  }
+  __atomic_store_n(&proxy_cfg, (const Proxy_Cfg*) p, __ATOMIC_RELEASE);
+  return 0;
+}
 
 /**
  * This function generates an OPRF private key.
  *
- * This is almost the KeyGen OPRF function defined in the RFC: since
- * this lib does not implement V oprf, we don't need a pubkey and so
- * we don't bother with all that is related.
+ * This is almost the KeyGen OPRF function defined in the RFC: the
+ * base mode needs no pubkey, for the verifiable mode see
+ * voprf_PublicKey() in voprf.h.
  *
  * @param [out] kU - the per-user OPRF private key
  */
 void oprf_KeyGen(uint8_t kU[crypto_core_ristretto255_SCALARBYTES]) {
+  oprf_KeyGen_cfg(&global_proxy()->cfg, kU);
+}
+
+void oprf_KeyGen_cfg(const toprf_cfg *cfg, uint8_t kU[crypto_core_ristretto255_SCALARBYTES]) {
 #if (defined CFRG_TEST_VEC && defined oprf_key_len)
+  (void) cfg;
   memcpy(kU,oprf_key,oprf_key_len);
 #else
-  if(proxy_cfg.keygen) proxy_cfg.keygen(kU);
+  if(cfg && cfg->keygen) cfg->keygen(kU);
   else crypto_core_ristretto255_scalar_random(kU);
 #endif
 }
 
+int oprf_Finalize_init(crypto_hash_sha512_state *state, const uint16_t x_len) {
+  // according to paper: hash(pwd||H0^k)
+  // acccording to voprf IRTF CFRG specification: hash(htons(len(pwd))||pwd||
+  //                                              htons(len(H0_k))||H0_k|||
+  //                                              htons(len("Finalize-"VOPRF"-\x00-ristretto255-SHA512"))||"Finalize-"VOPRF"-\x00-ristretto255-SHA512")
+  crypto_hash_sha512_init(state);
+  // pwd
+  const uint16_t size=htons(x_len);
+  crypto_hash_sha512_update(state, (const uint8_t*) &size, 2);
+  return 0;
+}
+
+int oprf_Finalize_update(crypto_hash_sha512_state *state, const uint8_t *x, const size_t x_len) {
+  return crypto_hash_sha512_update(state, x, (unsigned long long) x_len);
+}
+
+int oprf_Finalize_final(crypto_hash_sha512_state *state,
+                        const uint8_t N[crypto_core_ristretto255_BYTES],
+                        uint8_t rwdU[OPRF_BYTES]) {
+  // H0_k
+  const uint16_t size=htons(crypto_core_ristretto255_BYTES);
+  crypto_hash_sha512_update(state, (const uint8_t*) &size, 2);
+  crypto_hash_sha512_update(state, N, crypto_core_ristretto255_BYTES);
+  //const uint8_t DST[]="Finalize-"VOPRF"-\x00\x00\x01";
+  const uint8_t DST[]="Finalize";
+  const uint8_t DST_size=sizeof DST -1;
+  //size=htons(DST_size);
+  //crypto_hash_sha512_update(&state, (uint8_t*) &size, 2);
+  crypto_hash_sha512_update(state, DST, DST_size);
+
+  crypto_hash_sha512_final(state, rwdU);
+  sodium_memzero(state, sizeof *state);
+  return 0;
+}
+
 /**
  * This function computes the OPRF output using input x, N, and domain separation
  * tag info.
@@ -73,54 +163,91 @@ void oprf_KeyGen(uint8_t kU[crypto_core_ristretto255_SCALARBYTES]) {
 int oprf_Finalize(const uint8_t *x, const uint16_t x_len,
                          const uint8_t N[crypto_core_ristretto255_BYTES],
                          uint8_t rwdU[OPRF_BYTES]) {
-  // according to paper: hash(pwd||H0^k)
-  // acccording to voprf IRTF CFRG specification: hash(htons(len(pwd))||pwd||
-  //                                              htons(len(H0_k))||H0_k|||
-  //                                              htons(len("Finalize-"VOPRF"-\x00-ristretto255-SHA512"))||"Finalize-"VOPRF"-\x00-ristretto255-SHA512")
-  crypto_hash_sha512_state state;
-  if(-1==sodium_mlock(&state,sizeof state)) {
+  crypto_hash_sha512_state *state = oprf_scratch_push(sizeof *state);
+  if(state==NULL) {
     return -1;
   }
-  crypto_hash_sha512_init(&state);
-  // pwd
-  uint16_t size=htons(x_len);
-  crypto_hash_sha512_update(&state, (uint8_t*) &size, 2);
-  crypto_hash_sha512_update(&state, x, x_len);
+  oprf_Finalize_init(state, x_len);
+  oprf_Finalize_update(state, x, x_len);
 #if (defined TRACE || defined CFRG_TEST_VEC)
   dump(x,x_len,"finalize input");
 #endif
-  // H0_k
-  size=htons(crypto_core_ristretto255_BYTES);
-  crypto_hash_sha512_update(&state, (uint8_t*) &size, 2);
-  crypto_hash_sha512_update(&state, N, crypto_core_ristretto255_BYTES);
-  //const uint8_t DST[]="Finalize-"VOPRF"-\x00\x00\x01";
-  const uint8_t DST[]="Finalize";
-  const uint8_t DST_size=sizeof DST -1;
-  //size=htons(DST_size);
-  //crypto_hash_sha512_update(&state, (uint8_t*) &size, 2);
-  crypto_hash_sha512_update(&state, DST, DST_size);
+  oprf_Finalize_final(state, N, rwdU);
+  oprf_scratch_pop(state, sizeof *state);
 
-  crypto_hash_sha512_final(&state, rwdU);
-  sodium_munlock(&state, sizeof state);
+  return 0;
+}
 
+int oprf_FinalizeBatch(const size_t n,
+                       const uint8_t *const x[n], const uint16_t x_len[n],
+                       const uint8_t N[n][crypto_core_ristretto255_BYTES],
+                       uint8_t rwdU[n][OPRF_BYTES]) {
+  const uint8_t DST[]="Finalize";
+  struct {
+    // htons(len(pwd))
+    uint8_t pre[BATCH_CHUNK][2];
+    // htons(len(H0_k)) || H0_k || DST
+    uint8_t post[BATCH_CHUNK][2 + crypto_core_ristretto255_BYTES + sizeof DST - 1];
+  } tmp;
+  if(-1==sodium_mlock(&tmp,sizeof tmp)) {
+    return -1;
+  }
+  sha512mb_Msg m[BATCH_CHUNK];
+  for(size_t off=0;off<n;off+=BATCH_CHUNK) {
+    const size_t c = (n - off < BATCH_CHUNK) ? n - off : BATCH_CHUNK;
+    for(size_t i=0;i<c;i++) {
+      const uint16_t size=htons(x_len[off+i]), nsize=htons(crypto_core_ristretto255_BYTES);
+      memcpy(tmp.pre[i], &size, 2);
+      memcpy(tmp.post[i], &nsize, 2);
+      memcpy(tmp.post[i]+2, N[off+i], crypto_core_ristretto255_BYTES);
+      memcpy(tmp.post[i]+2+crypto_core_ristretto255_BYTES, DST, sizeof DST - 1);
+      m[i] = (sha512mb_Msg) { .seg = { tmp.pre[i], x[off+i], tmp.post[i] },
+                              .len = { 2, x_len[off+i], sizeof tmp.post[i] } };
+    }
+    sha512mb(c, m, NULL, &rwdU[off]);
+  }
+  sodium_munlock(&tmp,sizeof tmp);
   return 0;
 }
 
-/* expand_loop
- 10.    b_i = H(strxor(b_0, b_(i - 1)) || I2OSP(i, 1) || DST_prime)
- */
-static void expand_loop(const uint8_t *b_0, const uint8_t *b_i, const uint8_t i, const uint8_t *dst_prime, const uint8_t dst_prime_len, uint8_t *b_ii) {
-  uint8_t xored[crypto_hash_sha512_BYTES];
-  unsigned j;
-  for(j=0;j<sizeof xored;j++) xored[j]=b_0[j]^b_i[j];
-  // 8.  b_1 = H(b_0 || I2OSP(1, 1) || DST_prime)
-  crypto_hash_sha512_state state;
-  crypto_hash_sha512_init(&state);
-  crypto_hash_sha512_update(&state, xored, sizeof xored);
-  crypto_hash_sha512_update(&state,(uint8_t*) &i, 1);
-  crypto_hash_sha512_update(&state, dst_prime, dst_prime_len);
-  crypto_hash_sha512_final(&state, b_ii);
-  sodium_memzero(&state,sizeof state);
+/* the sha512 state after absorbing Z_pad = I2OSP(0, r_in_bytes), the
+ * prefix of every msg_prime in expand_message_xmd. Z_pad is exactly
+ * one block, so this is the compression of the IV with a zero block.
+ * checked against a freshly computed state in tests/test.c */
+static const crypto_hash_sha512_state z_pad_state = {
+  .state = {
+    0xcf7881d5774acbe8ULL, 0x533362e0fbc78070ULL,
+    0x0267639d87460edaULL, 0x3086cb40e85931b0ULL,
+    0x717dc95288a023a3ULL, 0x96bab2c14ce0b5e0ULL,
+    0x6fc4fe04eae33e0bULL, 0x91f4d80cbd668beeULL,
+  },
+  .count = {0, 128*8},
+  .buf = {0},
+};
+
+void expand_message_xmd_init(crypto_hash_sha512_state *state) {
+  // 4.  Z_pad = I2OSP(0, r_in_bytes)
+  memcpy(state, &z_pad_state, sizeof *state);
+}
+
+int oprf_DSTCtx_init(oprf_DSTCtx *ctx, const uint8_t *dst, const uint8_t dst_len, const uint16_t len_in_bytes) {
+  // 1.  ell = ceil(len_in_bytes / b_in_bytes)
+  const unsigned ell = ((unsigned) len_in_bytes + crypto_hash_sha512_BYTES-1) / crypto_hash_sha512_BYTES;
+  // 2.  ABORT if ell > 255
+  if(ell>255) return -1;
+  if(dst_len==255) return -1;
+  ctx->len_in_bytes = len_in_bytes;
+  ctx->ell = (uint8_t) ell;
+  ctx->dst_prime_len = (uint8_t) (dst_len + 1);
+  // 5.  l_i_b_str = I2OSP(len_in_bytes, 2)
+  const uint16_t l_i_b = htons(len_in_bytes);
+  memcpy(ctx->suffix, &l_i_b, sizeof l_i_b);
+  // I2OSP(0, 1)
+  ctx->suffix[2] = 0;
+  // 3.  DST_prime = DST || I2OSP(len(DST), 1)
+  memcpy(ctx->suffix+3, dst, dst_len);
+  ctx->suffix[3+dst_len] = dst_len;
+  return 0;
 }
 
 /*
@@ -157,94 +284,74 @@ static void expand_loop(const uint8_t *b_0, const uint8_t *b_i, const uint8_t i,
  * 11. uniform_bytes = b_1 || ... || b_ell
  * 12. return substr(uniform_bytes, 0, len_in_bytes)
  */
-int expand_message_xmd(const uint8_t *msg, const uint8_t msg_len, const uint8_t *dst, const uint8_t dst_len, const uint8_t len_in_bytes, uint8_t *uniform_bytes) {
-  // 1.  ell = ceil(len_in_bytes / b_in_bytes)
-  const unsigned ell = (len_in_bytes + crypto_hash_sha512_BYTES-1) / crypto_hash_sha512_BYTES;
-#ifdef TRACE
-  fprintf(stderr, "ell %d\n", ell);
-  dump(msg, msg_len, "msg");
-  dump(dst, dst_len, "dst");
-#endif
-
-  // 2.  ABORT if ell > 255
-  if(ell>255) return -1;
-  // 3.  DST_prime = DST || I2OSP(len(DST), 1)
-  if(dst_len==255) return -1;
-  uint8_t dst_prime[dst_len+1];
-  memcpy(dst_prime, dst, dst_len);
-  dst_prime[dst_len] = dst_len;
+int expand_message_xmd_final_ctx(crypto_hash_sha512_state *state, const oprf_DSTCtx *ctx, uint8_t *uniform_bytes) {
+  const uint8_t *dst_prime = ctx->suffix+3;
 #ifdef TRACE
-  dump(dst_prime, sizeof dst_prime, "dst_prime");
+  fprintf(stderr, "ell %d\n", ctx->ell);
+  dump(dst_prime, ctx->dst_prime_len, "dst_prime");
 #endif
-  // 4.  Z_pad = I2OSP(0, r_in_bytes)
-  //const uint8_t r_in_bytes = 128; // for sha512
-  uint8_t z_pad[128 /*r_in_bytes*/] = {0}; // supress gcc error: variable-sized object may not be initialized
-#ifdef TRACE
-  dump(z_pad, sizeof z_pad, "z_pad");
-#endif
-  // 5.  l_i_b_str = I2OSP(len_in_bytes, 2)
-  const uint16_t l_i_b = htons(len_in_bytes);
-  const uint8_t *l_i_b_str = (uint8_t*) &l_i_b;
   // 6.  msg_prime = Z_pad || msg || l_i_b_str || I2OSP(0, 1) || DST_prime
-  uint8_t msg_prime[sizeof z_pad + msg_len + sizeof l_i_b + 1 + sizeof dst_prime],
-    *ptr = msg_prime;
-  memcpy(ptr, z_pad, sizeof z_pad);
-  ptr += sizeof z_pad;
-  memcpy(ptr, msg, msg_len);
-  ptr += msg_len;
-  memcpy(ptr, l_i_b_str, sizeof l_i_b);
-  ptr += sizeof l_i_b;
-  *ptr = 0;
-  ptr++;
-  memcpy(ptr, dst_prime, sizeof dst_prime);
-#ifdef TRACE
-  dump(msg_prime, sizeof msg_prime, "msg_prime");
-#endif
+  // Z_pad and msg have already been absorbed by expand_message_xmd_init/update
+  crypto_hash_sha512_update(state, ctx->suffix, 3u + ctx->dst_prime_len);
   // 7.  b_0 = H(msg_prime)
   uint8_t b_0[crypto_hash_sha512_BYTES];
-  crypto_hash_sha512(b_0, msg_prime, sizeof msg_prime);
+  crypto_hash_sha512_final(state, b_0);
+  sodium_memzero(state, sizeof *state);
 #ifdef TRACE
   dump(b_0, sizeof b_0, "b_0");
 #endif
-  // 8.  b_1 = H(b_0 || I2OSP(1, 1) || DST_prime)
+  // H(b || I2OSP(i, 1) || DST_prime) for all b_i, DST_prime is copied
+  // only once, the hashes then go over this buffer in one go
+  uint8_t blk[crypto_hash_sha512_BYTES + 1 + 256];
+  memcpy(blk, b_0, sizeof b_0);
+  memcpy(blk + crypto_hash_sha512_BYTES + 1, dst_prime, ctx->dst_prime_len);
+  const unsigned blk_len = crypto_hash_sha512_BYTES + 1u + ctx->dst_prime_len;
+
   uint8_t b_i[crypto_hash_sha512_BYTES];
-  crypto_hash_sha512_state state;
-  crypto_hash_sha512_init(&state);
-  crypto_hash_sha512_update(&state, b_0, sizeof b_0);
-  crypto_hash_sha512_update(&state,(uint8_t*) &"\x01", 1);
-  crypto_hash_sha512_update(&state, dst_prime, (long long unsigned int) sizeof dst_prime);
-  crypto_hash_sha512_final(&state, b_i);
+  unsigned left = ctx->len_in_bytes, i, j;
+  uint8_t *out = uniform_bytes;
+  for(i=1;i<=ctx->ell;i++) {
+    // 8.  b_1 = H(b_0 || I2OSP(1, 1) || DST_prime)
+    // 9.  for i in (2, ..., ell):
+    // 10.    b_i = H(strxor(b_0, b_(i - 1)) || I2OSP(i, 1) || DST_prime)
+    if(i>1) for(j=0;j<sizeof b_i;j++) blk[j]=b_0[j]^b_i[j];
+    blk[crypto_hash_sha512_BYTES] = (uint8_t) i;
+    crypto_hash_sha512(b_i, blk, blk_len);
 #ifdef TRACE
-  dump(b_i, sizeof b_i, "b_1");
+    dump(b_i, sizeof b_i, "b_i");
 #endif
-  // 9.  for i in (2, ..., ell):
-  unsigned left = len_in_bytes;
-  uint8_t *out = uniform_bytes;
-  unsigned clen = (left>sizeof b_i)?sizeof b_i:left;
-  memcpy(out, b_i, clen);
-  out+=clen;
-  left-=clen;
-  uint8_t i;
-  uint8_t b_ii[crypto_hash_sha512_BYTES];
-  for(i=2;i<=ell;i+=2) {
     // 11. uniform_bytes = b_1 || ... || b_ell
     // 12. return substr(uniform_bytes, 0, len_in_bytes)
-    // 10.    b_i = H(strxor(b_0, b_(i - 1)) || I2OSP(i, 1) || DST_prime)
-    expand_loop(b_0, b_i, i, dst_prime, (uint8_t) (sizeof dst_prime), b_ii);
-    clen = (left>sizeof b_ii)?sizeof b_ii:left;
-    memcpy(out, b_ii, clen);
-    out+=clen;
-    left-=clen;
-    // unrolled next iteration so we don't have to swap b_i and b_ii
-    expand_loop(b_0, b_ii, i+1, dst_prime, (uint8_t) (sizeof dst_prime), b_i);
-    clen = (left>sizeof b_i)?sizeof b_i:left;
+    const unsigned clen = (left>sizeof b_i)?sizeof b_i:left;
     memcpy(out, b_i, clen);
     out+=clen;
     left-=clen;
   }
+  sodium_memzero(b_0, sizeof b_0);
+  sodium_memzero(b_i, sizeof b_i);
+  sodium_memzero(blk, sizeof blk);
   return 0;
 }
 
+int expand_message_xmd_final(crypto_hash_sha512_state *state, const uint8_t *dst, const uint8_t dst_len, const uint16_t len_in_bytes, uint8_t *uniform_bytes) {
+  oprf_DSTCtx ctx;
+  if(0!=oprf_DSTCtx_init(&ctx, dst, dst_len, len_in_bytes)) {
+    sodium_memzero(state, sizeof *state);
+    return -1;
+  }
+  return expand_message_xmd_final_ctx(state, &ctx, uniform_bytes);
+}
+
+int expand_message_xmd(const uint8_t *msg, const uint8_t msg_len, const uint8_t *dst, const uint8_t dst_len, const uint8_t len_in_bytes, uint8_t *uniform_bytes) {
+#ifdef TRACE
+  dump(msg, msg_len, "msg");
+#endif
+  crypto_hash_sha512_state state;
+  expand_message_xmd_init(&state);
+  crypto_hash_sha512_update(&state, msg, msg_len);
+  return expand_message_xmd_final(&state, dst, dst_len, len_in_bytes, uniform_bytes);
+}
+
 /* hash-to-ristretto255 - as defined by  https://github.com/cfrg/draft-irtf-cfrg-hash-to-curve/blob/master/draft-irtf-cfrg-hash-to-curve.md#hashing-to-ristretto255-appx-ristretto255
  * Steps:
  * -1. context-string = \x0 + htons(1) // contextString = I2OSP(modeBase(==0), 1) || I2OSP(suite.ID(==1), 2)
@@ -253,28 +360,106 @@ int expand_message_xmd(const uint8_t *msg, const uint8_t msg_len, const uint8_t
  * 2. P = ristretto255_map(uniform_bytes)
  * 3. return P
  */
-int voprf_hash_to_group(const uint8_t *msg, const uint8_t msg_len, uint8_t p[crypto_core_ristretto255_BYTES]) {
-  const uint8_t dst[] = "HashToGroup-"VOPRF"-\x00-ristretto255-SHA512";
-  const uint8_t dst_len = (sizeof dst) - 1;
-  uint8_t uniform_bytes[crypto_core_ristretto255_HASHBYTES]={0};
-  if(0!=sodium_mlock(uniform_bytes,sizeof uniform_bytes)) {
+void voprf_hash_to_group_init(crypto_hash_sha512_state *state) {
+  expand_message_xmd_init(state);
+}
+
+int voprf_hash_to_group_update(crypto_hash_sha512_state *state, const uint8_t *msg, const size_t msg_len) {
+  return crypto_hash_sha512_update(state, msg, (unsigned long long) msg_len);
+}
+
+/* the context of expand_message_xmd for the DST of hash-to-group:
+ * "HashToGroup-"VOPRF"-\x00-ristretto255-SHA512", which is 40 bytes,
+ * with 64 bytes of output. the same as what oprf_DSTCtx_init() would
+ * build, tests/test.c checks it against expand_message_xmd() */
+static const oprf_DSTCtx h2g_dst = {
+  .len_in_bytes = crypto_core_ristretto255_HASHBYTES,
+  .ell = 1,
+  .dst_prime_len = H2G_DST_PRIME_LEN,
+  .suffix = "\x00\x40" "\x00" "HashToGroup-"VOPRF"-\x00-ristretto255-SHA512" "\x28",
+};
+
+int voprf_hash_to_group_final(crypto_hash_sha512_state *state, uint8_t p[crypto_core_ristretto255_BYTES]) {
+  uint8_t *uniform_bytes = oprf_scratch_push(crypto_core_ristretto255_HASHBYTES);
+  if(uniform_bytes==NULL) {
+    sodium_memzero(state, sizeof *state);
     return -1;
   }
-  if(0!=expand_message_xmd(msg, msg_len, dst, dst_len, crypto_core_ristretto255_HASHBYTES, uniform_bytes)) {
-    sodium_munlock(uniform_bytes,sizeof uniform_bytes);
+  if(0!=expand_message_xmd_final_ctx(state, &h2g_dst, uniform_bytes)) {
+    oprf_scratch_pop(uniform_bytes, crypto_core_ristretto255_HASHBYTES);
     return -1;
   }
 #if (defined TRACE || defined CFRG_TEST_VEC)
-  dump(uniform_bytes, sizeof uniform_bytes, "uniform_bytes");
+  dump(uniform_bytes, crypto_core_ristretto255_HASHBYTES, "uniform_bytes");
 #endif
   crypto_core_ristretto255_from_hash(p, uniform_bytes);
-  sodium_munlock(uniform_bytes,sizeof uniform_bytes);
+  oprf_scratch_pop(uniform_bytes, crypto_core_ristretto255_HASHBYTES);
 #if (defined TRACE || defined CFRG_TEST_VEC)
   dump(p, crypto_core_ristretto255_BYTES, "hashed-to-curve");
 #endif
   return 0;
 }
 
+int voprf_hash_to_group(const uint8_t *msg, const uint8_t msg_len, uint8_t p[crypto_core_ristretto255_BYTES]) {
+  crypto_hash_sha512_state *state = oprf_scratch_push(sizeof *state);
+  if(state==NULL) {
+    return -1;
+  }
+  voprf_hash_to_group_init(state);
+  voprf_hash_to_group_update(state, msg, msg_len);
+  const int ret = voprf_hash_to_group_final(state, p);
+  oprf_scratch_pop(state, sizeof *state);
+  return ret;
+}
+
+int voprf_hash_to_group_batch(const size_t n, const uint8_t *const msg[n], const size_t msg_len[n],
+                              uint8_t p[n][crypto_core_ristretto255_BYTES]) {
+  struct {
+    uint8_t b_0[BATCH_CHUNK][crypto_hash_sha512_BYTES];
+    // b_0 || I2OSP(1, 1) || DST_prime
+    uint8_t blk[BATCH_CHUNK][crypto_hash_sha512_BYTES + 1 + H2G_DST_PRIME_LEN];
+    uint8_t uniform_bytes[BATCH_CHUNK][crypto_core_ristretto255_HASHBYTES];
+  } tmp;
+  if(0!=sodium_mlock(&tmp,sizeof tmp)) {
+    return -1;
+  }
+  sha512mb_Msg m[BATCH_CHUNK];
+  for(size_t off=0;off<n;off+=BATCH_CHUNK) {
+    const size_t c = (n - off < BATCH_CHUNK) ? n - off : BATCH_CHUNK;
+    // 6.  msg_prime = Z_pad || msg || l_i_b_str || I2OSP(0, 1) || DST_prime
+    // 7.  b_0 = H(msg_prime)
+    for(size_t i=0;i<c;i++) {
+      m[i] = (sha512mb_Msg) { .seg = { msg[off+i], h2g_dst.suffix },
+                              .len = { msg_len[off+i], 3u + h2g_dst.dst_prime_len } };
+    }
+    sha512mb(c, m, &z_pad_state, tmp.b_0);
+    // 8.  b_1 = H(b_0 || I2OSP(1, 1) || DST_prime)
+    for(size_t i=0;i<c;i++) {
+      memcpy(tmp.blk[i], tmp.b_0[i], crypto_hash_sha512_BYTES);
+      tmp.blk[i][crypto_hash_sha512_BYTES] = 1;
+      memcpy(tmp.blk[i] + crypto_hash_sha512_BYTES + 1, h2g_dst.suffix + 3, H2G_DST_PRIME_LEN);
+      m[i] = (sha512mb_Msg) { .seg = { tmp.blk[i] }, .len = { sizeof tmp.blk[i] } };
+    }
+    sha512mb(c, m, NULL, tmp.uniform_bytes);
+    for(size_t i=0;i<c;i++) {
+      crypto_core_ristretto255_from_hash(p[off+i], tmp.uniform_bytes[i]);
+    }
+  }
+  sodium_munlock(&tmp,sizeof tmp);
+  return 0;
+}
+
+static void blind_scalar(uint8_t r[crypto_core_ristretto255_SCALARBYTES]) {
+#ifdef CFRG_TEST_VEC
+  static int vecidx=0;
+  const unsigned char *rtest[2] = {blind_registration, blind_login};
+  const unsigned int rtest_len = 32;
+  memcpy(r,rtest[vecidx++ % 2],rtest_len);
+#else
+  crypto_core_ristretto255_scalar_random(r);
+#endif
+}
+
 /**
  * This function converts input x into an element of the OPRF group, randomizes it
  * by some scalar r, producing blinded, and outputs (r, blinded).
@@ -295,41 +480,85 @@ int oprf_Blind(const uint8_t *x, const uint8_t x_len,
 #if (defined TRACE || defined CFRG_TEST_VEC)
   dump(x, x_len, "input");
 #endif
-  uint8_t H0[crypto_core_ristretto255_BYTES];
-  if(0!=sodium_mlock(H0,sizeof H0)) {
+  uint8_t *H0 = oprf_scratch_push(crypto_core_ristretto255_BYTES);
+  if(H0==NULL) {
     return -1;
   }
   // sets α := (H^0(pw))^r
-  if(0!=voprf_hash_to_group(x, x_len, H0)) return -1;
+  if(0!=voprf_hash_to_group(x, x_len, H0)) {
+    oprf_scratch_pop(H0, crypto_core_ristretto255_BYTES);
+    return -1;
+  }
 #if (defined TRACE || defined CFRG_TEST_VEC)
-  dump(H0,sizeof H0, "H0");
+  dump(H0,crypto_core_ristretto255_BYTES, "H0");
 #endif
+  const int ret = oprf_BlindElement(H0, r, blinded);
+  oprf_scratch_pop(H0, crypto_core_ristretto255_BYTES);
+  return ret;
+}
 
+int oprf_BlindElement(const uint8_t H0[crypto_core_ristretto255_BYTES],
+                      uint8_t r[crypto_core_ristretto255_SCALARBYTES],
+                      uint8_t blinded[crypto_core_ristretto255_BYTES]) {
   // U picks r
-#ifdef CFRG_TEST_VEC
-  static int vecidx=0;
-  const unsigned char *rtest[2] = {blind_registration, blind_login};
-  const unsigned int rtest_len = 32;
-  memcpy(r,rtest[vecidx++ % 2],rtest_len);
-#else
-  crypto_core_ristretto255_scalar_random(r);
-#endif
+  blind_scalar(r);
 
 #ifdef TRACE
   dump(r, crypto_core_ristretto255_SCALARBYTES, "r");
 #endif
   // H^0(pw)^r
   if (crypto_scalarmult_ristretto255(blinded, r, H0) != 0) {
-    sodium_munlock(H0,sizeof H0);
     return -1;
   }
-  sodium_munlock(H0,sizeof H0);
 #if (defined TRACE || defined CFRG_TEST_VEC)
   dump(blinded, crypto_core_ristretto255_BYTES, "blinded");
 #endif
   return 0;
 }
 
+/**
+ * This function blinds an array of inputs, it is the batch version of
+ * oprf_Blind(), the outputs are the same as calling oprf_Blind() for
+ * each input.
+ *
+ * @param [in] n - the number of inputs
+ * @param [in] x - an array of n pointers to the values to blind
+ * @param [in] x_len - an array of the lengths of the values in x
+ * @param [out] r - an array of n OPRF scalars used for randomization
+ * @param [out] blinded - an array of n serialized OPRF group elements,
+ * the blinded versions of x
+ * @return The function returns 0 if everything is correct.
+ */
+int oprf_BlindBatch(const size_t n,
+                    const uint8_t *const x[n], const size_t x_len[n],
+                    uint8_t r[n][crypto_core_ristretto255_SCALARBYTES],
+                    uint8_t blinded[n][crypto_core_ristretto255_BYTES]) {
+  // in chunks, like voprf_hash_to_group_batch(), so that nothing on
+  // the stack depends on n
+  uint8_t (*H0)[crypto_core_ristretto255_BYTES] = oprf_scratch_push(BATCH_CHUNK * crypto_core_ristretto255_BYTES);
+  if(H0==NULL) return -1;
+  int ret = 0;
+  for(size_t off=0;off<n && ret==0;off+=BATCH_CHUNK) {
+    const size_t c = (n - off < BATCH_CHUNK) ? n - off : BATCH_CHUNK;
+    // sets α := (H^0(pw))^r
+    if(0!=voprf_hash_to_group_batch(c, x + off, x_len + off, H0)) {
+      ret = -1;
+      break;
+    }
+    for(size_t i=0;i<c;i++) {
+      // U picks r
+      blind_scalar(r[off+i]);
+      // H^0(pw)^r
+      if (crypto_scalarmult_ristretto255(blinded[off+i], r[off+i], H0[i]) != 0) {
+        ret = -1;
+        break;
+      }
+    }
+  }
+  oprf_scratch_pop(H0, BATCH_CHUNK * crypto_core_ristretto255_BYTES);
+  return ret;
+}
+
 /**
  * This function evaluates input element blinded using private key k, yielding output
  * element Z.
@@ -350,10 +579,192 @@ int oprf_Blind(const uint8_t *x, const uint8_t x_len,
 int oprf_Evaluate(const uint8_t k[crypto_core_ristretto255_SCALARBYTES],
                   const uint8_t blinded[crypto_core_ristretto255_BYTES],
                   uint8_t Z[crypto_core_ristretto255_BYTES]) {
-  if(proxy_cfg.eval) return proxy_cfg.eval(k, blinded, Z);
+  const toprf_evalcb eval = global_proxy()->cfg.eval;
+  if(eval) return eval(k, blinded, Z);
   return crypto_scalarmult_ristretto255(Z, k, blinded);
 }
 
+int oprf_Evaluate_cfg(const toprf_cfg *cfg,
+                      const uint8_t k[crypto_core_ristretto255_SCALARBYTES],
+                      const uint8_t blinded[crypto_core_ristretto255_BYTES],
+                      uint8_t Z[crypto_core_ristretto255_BYTES]) {
+  if(cfg && cfg->eval) return cfg->eval(k, blinded, Z);
+  return crypto_scalarmult_ristretto255(Z, k, blinded);
+}
+
+/**
+ * This function evaluates an array of blinded elements using the
+ * same private key k, yielding an array of output elements Z.
+ *
+ * This is the batch version of oprf_Evaluate(). Invalid elements do
+ * not abort the
+ * batch, they are marked in fails and their Z is zeroed.  If
+ * oprf_set_evalbatchproxy() has been used to set a batch proxy, the
+ * whole batch is passed to it, otherwise if the single element proxy
+ * is set, that is called for each element.
+ *
+ * @param [in] k - a private key - if a proxy is set, than this value
+ * will be ignored!
+ * @param [in] n - the number of elements in the batch
+ * @param [in] blinded - an array of n serialized OPRF group elements,
+ * outputs of oprf_Blind
+ * @param [out] Z - an array of n serialized OPRF group elements,
+ * inputs to oprf_Unblind
+ * @param [out] fails - an array of n flags, fails[i] is set to 1 if
+ * blinded[i] could not be evaluated, 0 otherwise
+ * @return The function returns 0 if all elements are correct, 1 if
+ * some elements failed and -1 on errors.
+ */
+int oprf_EvaluateBatch(const uint8_t k[crypto_core_ristretto255_SCALARBYTES],
+                       const size_t n,
+                       const uint8_t blinded[n][crypto_core_ristretto255_BYTES],
+                       uint8_t Z[n][crypto_core_ristretto255_BYTES],
+                       uint8_t fails[n]) {
+  const Proxy_Cfg *proxy = global_proxy();
+  if(proxy->evalbatch) return proxy->evalbatch(k, n, blinded, Z, fails);
+  return oprf_EvaluateBatch_cfg(&proxy->cfg, k, n, blinded, Z, fails);
+}
+
+int oprf_EvaluateBatch_cfg(const toprf_cfg *cfg,
+                           const uint8_t k[crypto_core_ristretto255_SCALARBYTES],
+                           const size_t n,
+                           const uint8_t blinded[n][crypto_core_ristretto255_BYTES],
+                           uint8_t Z[n][crypto_core_ristretto255_BYTES],
+                           uint8_t fails[n]) {
+  int ret = 0;
+  if(cfg && cfg->eval) {
+    for(size_t i=0;i<n;i++) {
+      fails[i] = (cfg->eval(k, blinded[i], Z[i]) != 0);
+      if(fails[i]) {
+        memset(Z[i], 0, crypto_core_ristretto255_BYTES);
+        ret = 1;
+      }
+    }
+    return ret;
+  }
+
+  for(size_t i=0;i<n;i++) {
+    fails[i] = (crypto_scalarmult_ristretto255(Z[i], k, blinded[i]) != 0);
+    if(fails[i]) {
+      memset(Z[i], 0, crypto_core_ristretto255_BYTES);
+      ret = 1;
+    }
+  }
+  return ret;
+}
+
+/**
+ * This function prepares a private key for repeated evaluations.
+ *
+ * A key with a varying point has nothing to precompute, so the
+ * context only keeps the key in locked memory. The evaluations of a
+ * share get faster when it is prepared with toprf_KeyCtx_init().
+ *
+ * @param [out] ctx - the context to initialize, its memory gets locked
+ * @param [in] kU - the OPRF private key
+ * @return The function returns 0 if everything is correct, -1 if the
+ *         memory of ctx can not be locked.
+ */
+int oprf_KeyCtx_init(oprf_KeyCtx *ctx, const uint8_t kU[crypto_core_ristretto255_SCALARBYTES]) {
+  if(-1==sodium_mlock(ctx, sizeof *ctx)) return -1;
+  ctx->index = 0;
+  ctx->set_len = 0;
+  memcpy(ctx->k, kU, crypto_core_ristretto255_SCALARBYTES);
+  return 0;
+}
+
+/**
+ * This function prepares a share of a private key for repeated
+ * evaluations with toprf_Evaluate_KeyCtx().
+ *
+ * @param [out] ctx - the context to initialize, its memory gets locked
+ * @param [in] share - the share of the OPRF private key
+ * @return The function returns 0 if everything is correct, -1 if the
+ *         memory of ctx can not be locked.
+ */
+int oprf_KeyCtx_init_share(oprf_KeyCtx *ctx, const uint8_t share[TOPRF_Share_BYTES]) {
+  if(0!=oprf_KeyCtx_init(ctx, share+1)) return -1;
+  ctx->index = share[0];
+  return 0;
+}
+
+/**
+ * This function wipes and unlocks a context initialized with
+ * oprf_KeyCtx_init() or oprf_KeyCtx_init_share().
+ *
+ * @param [in] ctx - the context to release
+ */
+void oprf_KeyCtx_free(oprf_KeyCtx *ctx) {
+  sodium_munlock(ctx, sizeof *ctx);
+}
+
+/**
+ * Same as oprf_Evaluate(), but uses a prepared key.
+ *
+ * @param [in] ctx - the prepared private key
+ * @param [in] blinded - a serialized OPRF group element, an output of
+ * oprf_Blind
+ * @param [out] Z - a serialized OPRF group element, an input to
+ * oprf_Unblind
+ * @return The function returns 0 if everything is correct.
+ */
+int oprf_Evaluate_KeyCtx(const oprf_KeyCtx *ctx,
+                         const uint8_t blinded[crypto_core_ristretto255_BYTES],
+                         uint8_t Z[crypto_core_ristretto255_BYTES]) {
+  const toprf_evalcb eval = global_proxy()->cfg.eval;
+  if(eval) return eval(ctx->k, blinded, Z);
+  return crypto_scalarmult_ristretto255(Z, ctx->k, blinded);
+}
+
+int oprf_Evaluate_KeyCtx_cfg(const toprf_cfg *cfg,
+                             const oprf_KeyCtx *ctx,
+                             const uint8_t blinded[crypto_core_ristretto255_BYTES],
+                             uint8_t Z[crypto_core_ristretto255_BYTES]) {
+  if(cfg && cfg->eval) return cfg->eval(ctx->k, blinded, Z);
+  return crypto_scalarmult_ristretto255(Z, ctx->k, blinded);
+}
+
+/**
+ * Same as oprf_EvaluateBatch(), but uses a prepared key.
+ *
+ * @param [in] ctx - the prepared private key
+ * @param [in] n - the number of elements in the batch
+ * @param [in] blinded - an array of n serialized OPRF group elements
+ * @param [out] Z - an array of n serialized OPRF group elements
+ * @param [out] fails - an array of n flags, fails[i] is set to 1 if
+ * blinded[i] could not be evaluated, 0 otherwise
+ * @return The function returns 0 if all elements are correct, 1 if
+ * some elements failed and -1 on errors.
+ */
+int oprf_EvaluateBatch_KeyCtx(const oprf_KeyCtx *ctx,
+                              const size_t n,
+                              const uint8_t blinded[n][crypto_core_ristretto255_BYTES],
+                              uint8_t Z[n][crypto_core_ristretto255_BYTES],
+                              uint8_t fails[n]) {
+  const Proxy_Cfg *proxy = global_proxy();
+  if(proxy->evalbatch) return proxy->evalbatch(ctx->k, n, blinded, Z, fails);
+  return oprf_EvaluateBatch_KeyCtx_cfg(&proxy->cfg, ctx, n, blinded, Z, fails);
+}
+
+int oprf_EvaluateBatch_KeyCtx_cfg(const toprf_cfg *cfg,
+                                  const oprf_KeyCtx *ctx,
+                                  const size_t n,
+                                  const uint8_t blinded[n][crypto_core_ristretto255_BYTES],
+                                  uint8_t Z[n][crypto_core_ristretto255_BYTES],
+                                  uint8_t fails[n]) {
+  if(cfg && cfg->eval) return oprf_EvaluateBatch_cfg(cfg, ctx->k, n, blinded, Z, fails);
+
+  int ret = 0;
+  for(size_t i=0;i<n;i++) {
+    fails[i] = (crypto_scalarmult_ristretto255(Z[i], ctx->k, blinded[i]) != 0);
+    if(fails[i]) {
+      memset(Z[i], 0, crypto_core_ristretto255_BYTES);
+      ret = 1;
+    }
+  }
+  return ret;
+}
+
 /**
  * This function removes random scalar r from Z, yielding output N.
  *
@@ -379,39 +790,188 @@ int oprf_Unblind(const uint8_t r[crypto_core_ristretto255_SCALARBYTES],
 
   // (b) Computes rw := H(pw, β^1/r );
   // invert r = 1/r
-  uint8_t ir[crypto_core_ristretto255_SCALARBYTES];
-  if(-1==sodium_mlock(ir, sizeof ir)) return -1;
+  uint8_t *ir = oprf_scratch_push(crypto_core_ristretto255_SCALARBYTES);
+  if(ir==NULL) return -1;
   if (crypto_core_ristretto255_scalar_invert(ir, r) != 0) {
-    sodium_munlock(ir, sizeof ir);
+    oprf_scratch_pop(ir, crypto_core_ristretto255_SCALARBYTES);
     return -1;
   }
 #ifdef TRACE
-  dump((uint8_t*) ir, sizeof ir, "r^-1 ");
+  dump((uint8_t*) ir, crypto_core_ristretto255_SCALARBYTES, "r^-1 ");
 #endif
 
   // H0 = β^(1/r)
   // beta^(1/r) = h(pwd)^k
   if (crypto_scalarmult_ristretto255(N, ir, Z) != 0) {
-    sodium_munlock(ir, sizeof ir);
+    oprf_scratch_pop(ir, crypto_core_ristretto255_SCALARBYTES);
     return -1;
   }
 #ifdef TRACE
   dump((uint8_t*) N, crypto_core_ristretto255_BYTES, "N ");
 #endif
 
-  sodium_munlock(ir, sizeof ir);
+  oprf_scratch_pop(ir, crypto_core_ristretto255_SCALARBYTES);
+  return 0;
+}
+
+/**
+ * This function unblinds an array of evaluated elements, it is the
+ * batch version of oprf_Unblind().
+ *
+ * All the blinding scalars are inverted together using Montgomery's
+ * trick, which costs one inversion and 3(n-1) multiplications instead
+ * of n inversions, the scalars are processed in chunks of a fixed
+ * size. Invalid elements in Z and scalars in r that can not be
+ * inverted do not abort the batch, they are marked in fails and their
+ * N is zeroed.
+ *
+ * @param [in] n - the number of elements
+ * @param [in] r - an array of n OPRF scalars used in oprf_Blind
+ * @param [in] Z - an array of n serialized OPRF group elements, outputs
+ * of oprf_Evaluate
+ * @param [out] N - an array of n serialized OPRF group elements with
+ * the random scalars removed, inputs to oprf_Finalize
+ * @param [out] fails - an array of n flags, fails[i] is set to 1 if
+ * Z[i] could not be unblinded with r[i], 0 otherwise
+ * @return The function returns 0 if all elements are correct, 1 if
+ * some elements failed and -1 on errors.
+ */
+int oprf_UnblindBatch(const size_t n,
+                      const uint8_t r[n][crypto_core_ristretto255_SCALARBYTES],
+                      const uint8_t Z[n][crypto_core_ristretto255_BYTES],
+                      uint8_t N[n][crypto_core_ristretto255_BYTES],
+                      uint8_t fails[n]) {
+  static const uint8_t one[crypto_core_ristretto255_SCALARBYTES] = { 1 };
+  // acc[i] = r[0] * ... * r[i] of a chunk, later replaced in-place by
+  // 1/r[i], and inv after them
+  const size_t scratch_len = (BATCH_CHUNK + 1) * crypto_core_ristretto255_SCALARBYTES;
+  uint8_t (*acc)[crypto_core_ristretto255_SCALARBYTES] = oprf_scratch_push(scratch_len);
+  if(acc==NULL) return -1;
+  uint8_t *inv = acc[BATCH_CHUNK];
+
+  int ret = 0;
+  for(size_t off=0;off<n;off+=BATCH_CHUNK) {
+    const size_t c = (n - off < BATCH_CHUNK) ? n - off : BATCH_CHUNK;
+    const uint8_t (*rc)[crypto_core_ristretto255_SCALARBYTES] = r + off;
+    // an r[i] of 0 mod L can not be inverted, the same as with
+    // oprf_Unblind() it fails, and 1 takes its place in the product
+    for(size_t i=0;i<c;i++) {
+      crypto_core_ristretto255_scalar_mul(inv, rc[i], one);
+      fails[off+i] = (uint8_t) sodium_is_zero(inv, crypto_core_ristretto255_SCALARBYTES);
+      const uint8_t *ri = fails[off+i] ? one : rc[i];
+      if(i==0) memcpy(acc[0], ri, crypto_core_ristretto255_SCALARBYTES);
+      else crypto_core_ristretto255_scalar_mul(acc[i], acc[i-1], ri);
+    }
+    if (crypto_core_ristretto255_scalar_invert(inv, acc[c-1]) != 0) {
+      ret = -1;
+      break;
+    }
+    for(size_t i=c-1;i>0;i--) {
+      // 1/r[i] = 1/(r[0]*...*r[i]) * (r[0]*...*r[i-1])
+      crypto_core_ristretto255_scalar_mul(acc[i], inv, acc[i-1]);
+      if(!fails[off+i]) crypto_core_ristretto255_scalar_mul(inv, inv, rc[i]);
+    }
+    memcpy(acc[0], inv, crypto_core_ristretto255_SCALARBYTES);
+
+    for(size_t i=0;i<c;i++) {
+      // (a) Checks that β ∈ G ∗ . If not, outputs (abort, sid , ssid ) and halts;
+      // H0 = β^(1/r)
+      fails[off+i] = (fails[off+i] ||
+                      crypto_core_ristretto255_is_valid_point(Z[off+i]) != 1 ||
+                      crypto_scalarmult_ristretto255(N[off+i], acc[i], Z[off+i]) != 0);
+      if(fails[off+i]) {
+        memset(N[off+i], 0, crypto_core_ristretto255_BYTES);
+        ret = 1;
+      }
+    }
+  }
+
+  oprf_scratch_pop(acc, scratch_len);
+  return ret;
+}
+
+int oprf_KeyDelta(const uint8_t k_old[crypto_core_ristretto255_SCALARBYTES],
+                  const uint8_t k_new[crypto_core_ristretto255_SCALARBYTES],
+                  uint8_t delta[crypto_core_ristretto255_SCALARBYTES]) {
+  uint8_t inv[crypto_core_ristretto255_SCALARBYTES];
+  if(-1==sodium_mlock(inv, sizeof inv)) return -1;
+  if(crypto_core_ristretto255_scalar_invert(inv, k_old)!=0) {
+    sodium_munlock(inv, sizeof inv);
+    return -1;
+  }
+  crypto_core_ristretto255_scalar_mul(delta, k_new, inv);
+  sodium_munlock(inv, sizeof inv);
+  return 0;
+}
+
+int oprf_ApplyDelta(const uint8_t delta[crypto_core_ristretto255_SCALARBYTES],
+                    const uint8_t N[crypto_core_ristretto255_BYTES],
+                    uint8_t N_new[crypto_core_ristretto255_BYTES]) {
+  if(crypto_scalarmult_ristretto255(N_new, delta, N)!=0) return -1;
+  return 0;
+}
+
+// the number of elements updated by one job of oprf_ApplyDeltaBatch()
+#define DELTA_JOB 1024
+
+typedef struct {
+  const uint8_t *delta;
+  size_t n;
+  const uint8_t (*N)[crypto_core_ristretto255_BYTES];
+  uint8_t (*N_new)[crypto_core_ristretto255_BYTES];
+  uint8_t *fails;
+} Delta_Batch;
+
+static void apply_delta_job(void *arg, const size_t job) {
+  const Delta_Batch *b = (const Delta_Batch*) arg;
+  const size_t end = (b->n - job*DELTA_JOB < DELTA_JOB) ? b->n : (job+1)*DELTA_JOB;
+  for(size_t i=job*DELTA_JOB;i<end;i++) {
+    b->fails[i] = (crypto_scalarmult_ristretto255(b->N_new[i], b->delta, b->N[i]) != 0);
+    if(b->fails[i]) memset(b->N_new[i], 0, crypto_core_ristretto255_BYTES);
+  }
+}
+
+int oprf_ApplyDeltaBatch(const uint8_t delta[crypto_core_ristretto255_SCALARBYTES],
+                         const size_t n,
+                         const uint8_t N[n][crypto_core_ristretto255_BYTES],
+                         uint8_t N_new[n][crypto_core_ristretto255_BYTES],
+                         uint8_t fails[n],
+                         const oprf_parallel_fn parallel, void *pool) {
+  if(sodium_is_zero(delta, crypto_core_ristretto255_SCALARBYTES)) return -1;
+  Delta_Batch b = { .delta = delta, .n = n, .N = N, .N_new = N_new, .fails = fails };
+
+  const size_t jobs = (n + DELTA_JOB - 1) / DELTA_JOB;
+  if(parallel!=NULL && jobs>1) {
+    parallel(pool, jobs, apply_delta_job, &b);
+  } else {
+    for(size_t i=0;i<jobs;i++) apply_delta_job(&b, i);
+  }
+
+  for(size_t i=0;i<n;i++) {
+    if(fails[i]) return 1;
+  }
   return 0;
 }
 
 int oprf_set_evalproxy(const toprf_evalcb eval, const toprf_keygencb keygen) {
   if(eval == NULL) return 1;
   if(keygen == NULL) return 1;
-  proxy_cfg.eval=eval;
-  proxy_cfg.keygen=keygen;
-  return 0;
+  pthread_mutex_lock(&proxy_lock);
+  const int ret = publish_proxy(eval, keygen, proxy_cfg->evalbatch);
+  pthread_mutex_unlock(&proxy_lock);
+  return ret;
+}
+
+int oprf_set_evalbatchproxy(const toprf_evalbatchcb evalbatch) {
+  if(evalbatch == NULL) return 1;
+  pthread_mutex_lock(&proxy_lock);
+  const int ret = publish_proxy(proxy_cfg->cfg.eval, proxy_cfg->cfg.keygen, evalbatch);
+  pthread_mutex_unlock(&proxy_lock);
+  return ret;
 }
 
 void oprf_clear_evalproxy(void) {
-  proxy_cfg.eval=0;
-  proxy_cfg.keygen=0;
+  pthread_mutex_lock(&proxy_lock);
+  __atomic_store_n(&proxy_cfg, &no_proxy_cfg, __ATOMIC_RELEASE);
+  pthread_mutex_unlock(&proxy_lock);
 }
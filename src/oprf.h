@@ -7,6 +7,27 @@
 
 #define OPRF_BYTES 64
 
+/**
+ * A private key prepared for repeated evaluations.
+ *
+ * Initialize it using oprf_KeyCtx_init(), oprf_KeyCtx_init_share() or
+ * toprf_KeyCtx_init() and release it using oprf_KeyCtx_free(). The
+ * memory of the struct is locked while it is in use. After
+ * initialization the context is only read, so it can be shared
+ * between threads.
+ *
+ * The members of this struct are internal and should not be used.
+ */
+struct oprf_KeyCtx {
+  uint8_t index;
+  uint8_t k[crypto_core_ristretto255_SCALARBYTES];
+  // set by toprf_KeyCtx_init(): k times the lagrange coefficient of
+  // index for the set_len shareholders in the bitmap set
+  uint8_t kl[crypto_core_ristretto255_SCALARBYTES];
+  uint8_t set[32];
+  uint16_t set_len;
+};
+
 /**
  * This function generates an OPRF private key.
  *
@@ -19,6 +40,20 @@
 
 void oprf_KeyGen(uint8_t kU[crypto_core_ristretto255_SCALARBYTES]);
 
+/*
+ * The functions with a _cfg suffix are the same as the ones without,
+ * except that they use the proxy configuration passed to them instead
+ * of the global one set by oprf_set_evalproxy(). A cfg of NULL - or
+ * one with no callbacks set - evaluates locally with the key. The
+ * configuration is only read, so threads can evaluate concurrently
+ * with different threshold backends without any locking, the cfg
+ * must stay valid only during the call. The batch proxy of
+ * oprf_set_evalbatchproxy() is not part of toprf_cfg, the batch _cfg
+ * functions call cfg->eval for each element.
+ */
+
+void oprf_KeyGen_cfg(const toprf_cfg *cfg, uint8_t kU[crypto_core_ristretto255_SCALARBYTES]);
+
 /**
  * This function computes the OPRF output using input x, N, and domain separation
  * tag info.
@@ -39,6 +74,67 @@ int oprf_Finalize(const uint8_t *x, const uint16_t x_len,
                   const uint8_t N[crypto_core_ristretto255_BYTES],
                   uint8_t rwdU[OPRF_BYTES]);
 
+/**
+ * Streaming version of oprf_Finalize(), for inputs that are not
+ * available in one buffer. Call oprf_Finalize_init() with the total
+ * length of the input, absorb exactly x_len bytes by calling
+ * oprf_Finalize_update() any number of times, and then call
+ * oprf_Finalize_final(). The result is the same as that of
+ * oprf_Finalize() over the concatenated input.
+ *
+ * The state holds data derived from the input, callers handling
+ * secrets should lock its memory with sodium_mlock(), it is wiped by
+ * oprf_Finalize_final().
+ *
+ * @param [out] state - the hash state to initialize
+ * @param [in] x_len - the total length of the input in bytes, the
+ * encoding of the RFC limits this to 16 bits
+ * @return The function returns 0 if everything is correct.
+ */
+int oprf_Finalize_init(crypto_hash_sha512_state *state, const uint16_t x_len);
+
+/**
+ * Absorbs the next part of the input of oprf_Finalize_init().
+ *
+ * @param [in,out] state - the hash state
+ * @param [in] x - the next part of the input
+ * @param [in] x_len - the length of param x in bytes
+ * @return The function returns 0 if everything is correct.
+ */
+int oprf_Finalize_update(crypto_hash_sha512_state *state, const uint8_t *x, const size_t x_len);
+
+/**
+ * Completes a streaming oprf_Finalize() and wipes the state.
+ *
+ * @param [in,out] state - the hash state
+ * @param [in] N - a serialized OPRF group element, an output of
+ * oprf_Unblind
+ * @param [out] rwdU - the OPRF output
+ * @return The function returns 0 if everything is correct.
+ */
+int oprf_Finalize_final(crypto_hash_sha512_state *state,
+                        const uint8_t N[crypto_core_ristretto255_BYTES],
+                        uint8_t rwdU[OPRF_BYTES]);
+
+/**
+ * This function finalizes an array of inputs, it is the batch version
+ * of oprf_Finalize(), the outputs are the same as calling
+ * oprf_Finalize() for each input. The hashes of several inputs are
+ * computed at once using SIMD instructions if the cpu supports them.
+ *
+ * @param [in] n - the number of inputs
+ * @param [in] x - an array of n pointers to the values that were blinded
+ * @param [in] x_len - an array of the lengths of the values in x
+ * @param [in] N - an array of n serialized OPRF group elements,
+ * outputs of oprf_Unblind or oprf_UnblindBatch
+ * @param [out] rwdU - an array of n OPRF outputs
+ * @return The function returns 0 if everything is correct.
+ */
+int oprf_FinalizeBatch(const size_t n,
+                       const uint8_t *const x[n], const uint16_t x_len[n],
+                       const uint8_t N[n][crypto_core_ristretto255_BYTES],
+                       uint8_t rwdU[n][OPRF_BYTES]);
+
 /**
  * This function converts input x into an element of the OPRF group, randomizes it
  * by some scalar r, producing blinded, and outputs (r, blinded).
@@ -57,6 +153,40 @@ int oprf_Blind(const uint8_t *x, const uint8_t x_len,
                uint8_t r[crypto_core_ristretto255_SCALARBYTES],
                uint8_t blinded[crypto_core_ristretto255_BYTES]);
 
+/**
+ * Same as oprf_Blind(), but for an input that is already hashed to
+ * the group, for example using the streaming
+ * voprf_hash_to_group_init()/_update()/_final() functions for inputs
+ * longer than 255 bytes.
+ *
+ * @param [in] H0 - the input hashed to the group
+ * @param [out] r - an OPRF scalar value used for randomization
+ * @param [out] blinded - a serialized OPRF group element, the blinded
+ * version of H0, an input to oprf_Evaluate
+ * @return The function returns 0 if everything is correct.
+ */
+int oprf_BlindElement(const uint8_t H0[crypto_core_ristretto255_BYTES],
+                      uint8_t r[crypto_core_ristretto255_SCALARBYTES],
+                      uint8_t blinded[crypto_core_ristretto255_BYTES]);
+
+/**
+ * This function blinds an array of inputs, it is the batch version of
+ * oprf_Blind(), the outputs are the same as calling oprf_Blind() for
+ * each input.
+ *
+ * @param [in] n - the number of inputs
+ * @param [in] x - an array of n pointers to the values to blind
+ * @param [in] x_len - an array of the lengths of the values in x
+ * @param [out] r - an array of n OPRF scalars used for randomization
+ * @param [out] blinded - an array of n serialized OPRF group elements,
+ * the blinded versions of x
+ * @return The function returns 0 if everything is correct.
+ */
+int oprf_BlindBatch(const size_t n,
+                    const uint8_t *const x[n], const size_t x_len[n],
+                    uint8_t r[n][crypto_core_ristretto255_SCALARBYTES],
+                    uint8_t blinded[n][crypto_core_ristretto255_BYTES]);
+
 /**
  * This function evaluates input element blinded using private key k, yielding output
  * element Z.
@@ -78,6 +208,124 @@ int oprf_Evaluate(const uint8_t k[crypto_core_ristretto255_SCALARBYTES],
                   const uint8_t blinded[crypto_core_ristretto255_BYTES],
                   uint8_t Z[crypto_core_ristretto255_BYTES]);
 
+int oprf_Evaluate_cfg(const toprf_cfg *cfg,
+                      const uint8_t k[crypto_core_ristretto255_SCALARBYTES],
+                      const uint8_t blinded[crypto_core_ristretto255_BYTES],
+                      uint8_t Z[crypto_core_ristretto255_BYTES]);
+
+/**
+ * This function evaluates an array of blinded elements using the
+ * same private key k, yielding an array of output elements Z.
+ *
+ * This is the batch version of oprf_Evaluate(). Invalid elements do
+ * not abort the
+ * batch, they are marked in fails and their Z is zeroed.  If
+ * oprf_set_evalbatchproxy() has been used to set a batch proxy, the
+ * whole batch is passed to it, otherwise if the single element proxy
+ * is set, that is called for each element.
+ *
+ * @param [in] k - a private key - if a proxy is set, than this value
+ * will be ignored!
+ * @param [in] n - the number of elements in the batch
+ * @param [in] blinded - an array of n serialized OPRF group elements,
+ * outputs of oprf_Blind
+ * @param [out] Z - an array of n serialized OPRF group elements,
+ * inputs to oprf_Unblind
+ * @param [out] fails - an array of n flags, fails[i] is set to 1 if
+ * blinded[i] could not be evaluated, 0 otherwise
+ * @return The function returns 0 if all elements are correct, 1 if
+ * some elements failed and -1 on errors.
+ */
+int oprf_EvaluateBatch(const uint8_t k[crypto_core_ristretto255_SCALARBYTES],
+                       const size_t n,
+                       const uint8_t blinded[n][crypto_core_ristretto255_BYTES],
+                       uint8_t Z[n][crypto_core_ristretto255_BYTES],
+                       uint8_t fails[n]);
+
+int oprf_EvaluateBatch_cfg(const toprf_cfg *cfg,
+                           const uint8_t k[crypto_core_ristretto255_SCALARBYTES],
+                           const size_t n,
+                           const uint8_t blinded[n][crypto_core_ristretto255_BYTES],
+                           uint8_t Z[n][crypto_core_ristretto255_BYTES],
+                           uint8_t fails[n]);
+
+/**
+ * This function prepares a private key for repeated evaluations.
+ *
+ * A key with a varying point has nothing to precompute, so the
+ * context only keeps the key in locked memory. The evaluations of a
+ * share get faster when it is prepared with toprf_KeyCtx_init().
+ *
+ * @param [out] ctx - the context to initialize, its memory gets locked
+ * @param [in] kU - the OPRF private key
+ * @return The function returns 0 if everything is correct, -1 if the
+ *         memory of ctx can not be locked.
+ */
+int oprf_KeyCtx_init(oprf_KeyCtx *ctx, const uint8_t kU[crypto_core_ristretto255_SCALARBYTES]);
+
+/**
+ * This function prepares a share of a private key for repeated
+ * evaluations with toprf_Evaluate_KeyCtx().
+ *
+ * @param [out] ctx - the context to initialize, its memory gets locked
+ * @param [in] share - the share of the OPRF private key
+ * @return The function returns 0 if everything is correct, -1 if the
+ *         memory of ctx can not be locked.
+ */
+int oprf_KeyCtx_init_share(oprf_KeyCtx *ctx, const uint8_t share[TOPRF_Share_BYTES]);
+
+/**
+ * This function wipes and unlocks a context initialized with
+ * oprf_KeyCtx_init() or oprf_KeyCtx_init_share().
+ *
+ * @param [in] ctx - the context to release
+ */
+void oprf_KeyCtx_free(oprf_KeyCtx *ctx);
+
+/**
+ * Same as oprf_Evaluate(), but uses a prepared key.
+ *
+ * @param [in] ctx - the prepared private key
+ * @param [in] blinded - a serialized OPRF group element, an output of
+ * oprf_Blind
+ * @param [out] Z - a serialized OPRF group element, an input to
+ * oprf_Unblind
+ * @return The function returns 0 if everything is correct.
+ */
+int oprf_Evaluate_KeyCtx(const oprf_KeyCtx *ctx,
+                         const uint8_t blinded[crypto_core_ristretto255_BYTES],
+                         uint8_t Z[crypto_core_ristretto255_BYTES]);
+
+int oprf_Evaluate_KeyCtx_cfg(const toprf_cfg *cfg,
+                             const oprf_KeyCtx *ctx,
+                             const uint8_t blinded[crypto_core_ristretto255_BYTES],
+                             uint8_t Z[crypto_core_ristretto255_BYTES]);
+
+/**
+ * Same as oprf_EvaluateBatch(), but uses a prepared key.
+ *
+ * @param [in] ctx - the prepared private key
+ * @param [in] n - the number of elements in the batch
+ * @param [in] blinded - an array of n serialized OPRF group elements
+ * @param [out] Z - an array of n serialized OPRF group elements
+ * @param [out] fails - an array of n flags, fails[i] is set to 1 if
+ * blinded[i] could not be evaluated, 0 otherwise
+ * @return The function returns 0 if all elements are correct, 1 if
+ * some elements failed and -1 on errors.
+ */
+int oprf_EvaluateBatch_KeyCtx(const oprf_KeyCtx *ctx,
+                              const size_t n,
+                              const uint8_t blinded[n][crypto_core_ristretto255_BYTES],
+                              uint8_t Z[n][crypto_core_ristretto255_BYTES],
+                              uint8_t fails[n]);
+
+int oprf_EvaluateBatch_KeyCtx_cfg(const toprf_cfg *cfg,
+                                  const oprf_KeyCtx *ctx,
+                                  const size_t n,
+                                  const uint8_t blinded[n][crypto_core_ristretto255_BYTES],
+                                  uint8_t Z[n][crypto_core_ristretto255_BYTES],
+                                  uint8_t fails[n]);
+
 /**
  * This function removes random scalar r from Z, yielding output N.
  *
@@ -94,6 +342,105 @@ int oprf_Unblind(const uint8_t r[crypto_core_ristretto255_SCALARBYTES],
                  const uint8_t Z[crypto_core_ristretto255_BYTES],
                  uint8_t N[crypto_core_ristretto255_BYTES]);
 
+/**
+ * This function unblinds an array of evaluated elements, it is the
+ * batch version of oprf_Unblind().
+ *
+ * All the blinding scalars are inverted together using Montgomery's
+ * trick, which costs one inversion and 3(n-1) multiplications instead
+ * of n inversions, the scalars are processed in chunks of a fixed
+ * size. Invalid elements in Z and scalars in r that can not be
+ * inverted do not abort the batch, they are marked in fails and their
+ * N is zeroed.
+ *
+ * @param [in] n - the number of elements
+ * @param [in] r - an array of n OPRF scalars used in oprf_Blind
+ * @param [in] Z - an array of n serialized OPRF group elements, outputs
+ * of oprf_Evaluate
+ * @param [out] N - an array of n serialized OPRF group elements with
+ * the random scalars removed, inputs to oprf_Finalize
+ * @param [out] fails - an array of n flags, fails[i] is set to 1 if
+ * Z[i] could not be unblinded with r[i], 0 otherwise
+ * @return The function returns 0 if all elements are correct, 1 if
+ * some elements failed and -1 on errors.
+ */
+int oprf_UnblindBatch(const size_t n,
+                      const uint8_t r[n][crypto_core_ristretto255_SCALARBYTES],
+                      const uint8_t Z[n][crypto_core_ristretto255_BYTES],
+                      uint8_t N[n][crypto_core_ristretto255_BYTES],
+                      uint8_t fails[n]);
+
+/*
+ * Key rotation for the HashDH variant
+ *
+ * The output of oprf_Unblind() without oprf_Finalize() is
+ * N = H0(x)^k. If the server replaces its key k with k', the public
+ * delta = k'/k turns every stored N into N^delta = H0(x)^k', the same
+ * as running the protocol again with the new key. This does not work
+ * for the outputs of oprf_Finalize().
+ */
+
+/**
+ * A function running jobs concurrently, workerpool_run() from
+ * workerpool.h can be used, its signature is the same as that of
+ * tpdkg_parallel_fn.
+ */
+typedef void (*oprf_parallel_fn)(void *pool, const size_t jobs, void (*fn)(void *arg, const size_t job), void *arg);
+
+/**
+ * This function calculates the delta for updating HashDH outputs
+ * from key k_old to k_new: delta = k_new / k_old. The delta is not
+ * sensitive and can be public.
+ *
+ * @param [in] k_old - the old OPRF private key
+ * @param [in] k_new - the new OPRF private key
+ * @param [out] delta - the update delta
+ * @return The function returns 0 if everything is correct.
+ */
+int oprf_KeyDelta(const uint8_t k_old[crypto_core_ristretto255_SCALARBYTES],
+                  const uint8_t k_new[crypto_core_ristretto255_SCALARBYTES],
+                  uint8_t delta[crypto_core_ristretto255_SCALARBYTES]);
+
+/**
+ * This function updates a HashDH output to a new key using the delta
+ * from oprf_KeyDelta() or toprf_KeyDelta().
+ *
+ * @param [in] delta - the update delta
+ * @param [in] N - an output of oprf_Unblind with the old key
+ * @param [out] N_new - the output with the new key, can be the same as N
+ * @return The function returns 0 if everything is correct.
+ */
+int oprf_ApplyDelta(const uint8_t delta[crypto_core_ristretto255_SCALARBYTES],
+                    const uint8_t N[crypto_core_ristretto255_BYTES],
+                    uint8_t N_new[crypto_core_ristretto255_BYTES]);
+
+/**
+ * This function updates an array of HashDH outputs to a new key, it
+ * is the batch version of oprf_ApplyDelta() meant for rotating the
+ * key of a whole database offline. If parallel is not NULL the
+ * elements are split into jobs that run concurrently. Invalid
+ * elements do not abort the batch, they are marked in fails and their
+ * N_new is zeroed.
+ *
+ * @param [in] delta - the update delta
+ * @param [in] n - the number of elements
+ * @param [in] N - an array of n outputs of oprf_Unblind with the old key
+ * @param [out] N_new - an array of n outputs with the new key, can be
+ * the same array as N
+ * @param [out] fails - an array of n flags, fails[i] is set to 1 if
+ * N[i] could not be updated, 0 otherwise
+ * @param [in] parallel - runs jobs concurrently, or NULL
+ * @param [in] pool - passed as the first parameter to parallel
+ * @return The function returns 0 if all elements are correct, 1 if
+ * some elements failed and -1 on errors.
+ */
+int oprf_ApplyDeltaBatch(const uint8_t delta[crypto_core_ristretto255_SCALARBYTES],
+                         const size_t n,
+                         const uint8_t N[n][crypto_core_ristretto255_BYTES],
+                         uint8_t N_new[n][crypto_core_ristretto255_BYTES],
+                         uint8_t fails[n],
+                         const oprf_parallel_fn parallel, void *pool);
+
 /**
  * Implements the hash to curve CFRG IRTF https://datatracker.ietf.org/doc/draft-irtf-cfrg-hash-to-curve/
  * function needed for the OPRF implementation
@@ -113,6 +460,104 @@ int voprf_hash_to_group(const uint8_t *msg, const uint8_t msg_len, uint8_t p[cry
  */
 int expand_message_xmd(const uint8_t *msg, const uint8_t msg_len, const uint8_t *dst, const uint8_t dst_len, const uint8_t len_in_bytes, uint8_t *uniform_bytes);
 
+/**
+ * Hashes an array of inputs to the group, it is the batch version of
+ * voprf_hash_to_group() - without its limit of 255 bytes per input.
+ * The hashes of several inputs are computed at once using SIMD
+ * instructions if the cpu supports them, which is most efficient if
+ * the inputs are of similar length.
+ *
+ * @param [in] n - the number of inputs
+ * @param [in] msg - an array of n pointers to the inputs
+ * @param [in] msg_len - an array of the lengths of the inputs
+ * @param [out] p - the n resulting ristretto255 points
+ * @return The function returns 0 if everything is correct.
+ */
+int voprf_hash_to_group_batch(const size_t n, const uint8_t *const msg[n], const size_t msg_len[n],
+                              uint8_t p[n][crypto_core_ristretto255_BYTES]);
+
+/**
+ * Streaming version of voprf_hash_to_group(), the input is absorbed
+ * into the hash state as it arrives without being copied, so it can
+ * be of any length. Call voprf_hash_to_group_init(), then
+ * voprf_hash_to_group_update() for each part of the input and finally
+ * voprf_hash_to_group_final(). For inputs up to 255 bytes the result
+ * is the same as that of voprf_hash_to_group().
+ *
+ * The initial state is a precomputed midstate which has already
+ * absorbed the Z_pad block of expand_message_xmd().
+ *
+ * @param [out] state - the hash state to initialize
+ */
+void voprf_hash_to_group_init(crypto_hash_sha512_state *state);
+
+/**
+ * Absorbs the next part of the input of voprf_hash_to_group_init().
+ *
+ * @param [in,out] state - the hash state
+ * @param [in] msg - the next part of the input
+ * @param [in] msg_len - the length of param msg in bytes
+ * @return The function returns 0 if everything is correct.
+ */
+int voprf_hash_to_group_update(crypto_hash_sha512_state *state, const uint8_t *msg, const size_t msg_len);
+
+/**
+ * Completes a streaming voprf_hash_to_group() and wipes the state.
+ *
+ * @param [in,out] state - the hash state
+ * @param [out] p - the resulting ristretto255 point
+ * @return The function returns 0 if everything is correct.
+ */
+int voprf_hash_to_group_final(crypto_hash_sha512_state *state, uint8_t p[crypto_core_ristretto255_BYTES]);
+
+/**
+ * A domain separation tag prepared for expand_message_xmd_final_ctx().
+ *
+ * Initialize it using oprf_DSTCtx_init(), it holds the constant
+ * suffixes of all the hashes of expand_message_xmd() for a DST and an
+ * output length, so they are not rebuilt on every call. After
+ * initialization the context is only read, so it can be shared
+ * between threads.
+ *
+ * The members of this struct are internal and should not be used.
+ */
+typedef struct oprf_DSTCtx {
+  uint16_t len_in_bytes;
+  uint8_t ell;
+  uint8_t dst_prime_len;
+  // l_i_b_str || I2OSP(0, 1) || DST_prime
+  uint8_t suffix[3+256];
+} oprf_DSTCtx;
+
+/**
+ * This function prepares a domain separation tag for repeated
+ * expand_message_xmd_final_ctx() calls.
+ *
+ * @param [out] ctx - the context to initialize
+ * @param [in] dst - the domain separation tag
+ * @param [in] dst_len - the length of dst, at most 254 bytes
+ * @param [in] len_in_bytes - the number of output bytes, at most 255*64
+ * @return The function returns 0 if everything is correct.
+ */
+int oprf_DSTCtx_init(oprf_DSTCtx *ctx, const uint8_t *dst, const uint8_t dst_len, const uint16_t len_in_bytes);
+
+/**
+ * Streaming version of expand_message_xmd(). expand_message_xmd_init()
+ * sets state to a precomputed midstate that has already absorbed
+ * Z_pad, the message is then absorbed using
+ * crypto_hash_sha512_update(), and expand_message_xmd_final()
+ * appends the rest of msg_prime and produces len_in_bytes of output
+ * into uniform_bytes. The state is wiped by expand_message_xmd_final().
+ */
+void expand_message_xmd_init(crypto_hash_sha512_state *state);
+int expand_message_xmd_final(crypto_hash_sha512_state *state, const uint8_t *dst, const uint8_t dst_len, const uint16_t len_in_bytes, uint8_t *uniform_bytes);
+
+/**
+ * Same as expand_message_xmd_final(), but uses a prepared domain
+ * separation tag and output length.
+ */
+int expand_message_xmd_final_ctx(crypto_hash_sha512_state *state, const oprf_DSTCtx *ctx, uint8_t *uniform_bytes);
+
 /**
  * Clears the internal variable that stores the configuration for
  * proxying to a threshold oprf.
@@ -122,6 +567,13 @@ void oprf_clear_evalproxy(void);
 /**
  * Sets the configuration of the proxy theshold evaluator
  *
+ * This configuration is global, it can be changed safely while other
+ * threads are evaluating, but then these might use the old or the new
+ * callbacks - each evaluation uses either one of the configurations
+ * in full, never a mix of the callbacks of both. For using different
+ * proxies concurrently see the _cfg variants of the evaluation
+ * functions.
+ *
  * @param [in] eval: a callback function that has the same parameters
  *                   as oprf_Evaluate. This is provided, so
  *                   implementers can provide their own means to
@@ -136,9 +588,24 @@ void oprf_clear_evalproxy(void);
  *                   element. This is provided, so implementers can
  *                   provide their own means to contact the
  *                   shareholders and communicate with them.
+ *
+ * @return 0 on success, 1 if a callback is NULL, -1 if the
+ *         configuration could not be allocated.
  */
 int oprf_set_evalproxy(const toprf_evalcb eval, const toprf_keygencb keygen);
 
+/**
+ * Sets a proxy for oprf_EvaluateBatch()
+ *
+ * @param [in] evalbatch: a callback function that has the same
+ *                   parameters as oprf_EvaluateBatch. This allows
+ *                   implementers to forward a whole batch to the
+ *                   shareholders in one go.
+ *
+ * @return the same as oprf_set_evalproxy().
+ */
+int oprf_set_evalbatchproxy(const toprf_evalbatchcb evalbatch);
+
 #ifdef __EMSCRIPTEN__
 /**
  * if compiling to webassembly, there is no sodium_m(un)?lock and thus we suppress that with the following
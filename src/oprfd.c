@@ -0,0 +1,412 @@
+/*
+    @copyright 2024, Stefan Marsiske toprf@ctrlc.hu
+    This file is part of liboprf.
+
+    liboprf is free software: you can redistribute it and/or
+    modify it under the terms of the GNU Lesser General Public License
+    as published by the Free Software Foundation, either version 3 of
+    the License, or (at your option) any later version.
+
+    liboprf is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Lesser General Public License for more details.
+
+    You should have received a copy of the License
+    along with liboprf. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/*
+ * oprfd - a reference shareholder server for threshold OPRF evaluation
+ *
+ *   oprfd [-l address] [-w workers] <port> <share-file>
+ *
+ * The share file holds a raw TOPRF_Share_BYTES share: the index of
+ * the shareholder followed by its share of the key.
+ *
+ * The protocol is the one pyoprf.multiplexer speaks: a request is a
+ * blinded element of crypto_core_ristretto255_BYTES, the response is
+ * the TOPRF_Part_BYTES part - the index of the share and the blinded
+ * element multiplied by the share - which the client combines with
+ * toprf_thresholdmult(). Requests on a connection are answered in
+ * order, so clients can pipeline any number of them. An invalid
+ * element is answered with "\x00\x04fail" and the connection closed
+ * after the response has been sent.
+ *
+ * Every worker thread - one per core by default - has its own
+ * listening socket bound with SO_REUSEPORT, so the kernel spreads the
+ * connections over the workers, and its own epoll loop. All requests
+ * that arrived during one round of the loop are evaluated with one
+ * call of oprf_EvaluateBatch_KeyCtx().
+ *
+ * The server speaks plain TCP, for the SSL peers of the multiplexer
+ * TLS has to be terminated in front of it, e.g. by stunnel.
+ */
+
+#define _GNU_SOURCE
+#include <errno.h>
+#include <netdb.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include "oprf.h"
+#include "toprf.h"
+
+#define REQ_SIZE crypto_core_ristretto255_BYTES
+#define RESP_SIZE TOPRF_Part_BYTES
+// the most requests evaluated in one batch
+#define BATCH_MAX 256
+// the most requests buffered for a connection before they are read
+#define CONN_IN_REQS 64
+// reading from a connection pauses while it has more unsent responses
+#define CONN_OUT_HIGH (RESP_SIZE * 1024)
+
+static const uint8_t fail_msg[] = "\x00\x04" "fail";
+
+typedef struct {
+  int fd;
+  // set once the connection is to be closed after sending out, the
+  // requests still to be answered are dropped
+  int closing;
+  // set once the client closed its side, the requests already read
+  // are still answered
+  int eof;
+  // the events the connection is registered for
+  uint32_t events;
+  uint8_t in[REQ_SIZE * CONN_IN_REQS];
+  size_t in_len;
+  uint8_t *out;
+  size_t out_off;
+  size_t out_len;
+  size_t out_cap;
+} Conn;
+
+typedef struct {
+  const oprf_KeyCtx *key;
+  int listen_fd;
+  int epoll_fd;
+  // the requests pending evaluation in this round of the loop
+  size_t batch_len;
+  Conn *conns[BATCH_MAX];
+  uint8_t blinded[BATCH_MAX][REQ_SIZE];
+  uint8_t Z[BATCH_MAX][REQ_SIZE];
+  uint8_t fails[BATCH_MAX];
+} Worker;
+
+static volatile sig_atomic_t stop = 0;
+
+static void on_signal(const int sig) {
+  (void) sig;
+  stop = 1;
+}
+
+static int listen_on(const char *address, const char *port) {
+  struct addrinfo hints, *res;
+  memset(&hints, 0, sizeof hints);
+  hints.ai_family = AF_UNSPEC;
+  hints.ai_socktype = SOCK_STREAM;
+  hints.ai_flags = AI_PASSIVE;
+  const int err = getaddrinfo(address, port, &hints, &res);
+  if(err!=0) {
+    fprintf(stderr, "[!] cannot resolve %s:%s: %s\n", address ? address : "*", port, gai_strerror(err));
+    return -1;
+  }
+  int fd = -1;
+  for(struct addrinfo *ai = res; ai!=NULL; ai = ai->ai_next) {
+    fd = socket(ai->ai_family, ai->ai_socktype | SOCK_NONBLOCK | SOCK_CLOEXEC, ai->ai_protocol);
+    if(fd<0) continue;
+    const int one = 1;
+    setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof one);
+    if(0==setsockopt(fd, SOL_SOCKET, SO_REUSEPORT, &one, sizeof one) &&
+       0==bind(fd, ai->ai_addr, ai->ai_addrlen) &&
+       0==listen(fd, SOMAXCONN)) break;
+    close(fd);
+    fd = -1;
+  }
+  freeaddrinfo(res);
+  if(fd<0) fprintf(stderr, "[!] cannot listen on %s:%s: %s\n", address ? address : "*", port, strerror(errno));
+  return fd;
+}
+
+static int set_events(Worker *w, Conn *c, const uint32_t events) {
+  if(c->events==events) return 0;
+  struct epoll_event ev = { .events = events, .data.ptr = c };
+  if(0!=epoll_ctl(w->epoll_fd, EPOLL_CTL_MOD, c->fd, &ev)) return 1;
+  c->events = events;
+  return 0;
+}
+
+static void conn_close(Worker *w, Conn *c) {
+  epoll_ctl(w->epoll_fd, EPOLL_CTL_DEL, c->fd, NULL);
+  close(c->fd);
+  free(c->out);
+  free(c);
+}
+
+static void accept_all(Worker *w) {
+  for(;;) {
+    const int fd = accept4(w->listen_fd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+    if(fd<0) {
+      if(errno!=EAGAIN && errno!=EWOULDBLOCK && errno!=EINTR) fprintf(stderr, "[!] accept: %s\n", strerror(errno));
+      return;
+    }
+    // responses are small and latency matters
+    const int one = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof one);
+    Conn *c = calloc(1, sizeof(Conn));
+    if(c==NULL) {
+      close(fd);
+      continue;
+    }
+    c->fd = fd;
+    c->events = EPOLLIN | EPOLLRDHUP;
+    struct epoll_event ev = { .events = c->events, .data.ptr = c };
+    if(0!=epoll_ctl(w->epoll_fd, EPOLL_CTL_ADD, fd, &ev)) {
+      close(fd);
+      free(c);
+    }
+  }
+}
+
+static int conn_queue(Conn *c, const uint8_t *msg, const size_t len) {
+  if(c->out_len + len > c->out_cap) {
+    // drop what has been sent already before growing the buffer
+    if(c->out_off>0) {
+      memmove(c->out, c->out + c->out_off, c->out_len - c->out_off);
+      c->out_len -= c->out_off;
+      c->out_off = 0;
+    }
+    if(c->out_len + len > c->out_cap) {
+      size_t cap = c->out_cap ? c->out_cap : RESP_SIZE * CONN_IN_REQS;
+      while(cap < c->out_len + len) cap *= 2;
+      uint8_t *out = realloc(c->out, cap);
+      if(out==NULL) return 1;
+      c->out = out;
+      c->out_cap = cap;
+    }
+  }
+  memcpy(c->out + c->out_len, msg, len);
+  c->out_len += len;
+  return 0;
+}
+
+// sends as much of the queued responses as the socket takes,
+// returns 1 if the connection is to be closed
+static int conn_flush(Worker *w, Conn *c) {
+  while(c->out_off < c->out_len) {
+    const ssize_t sent = send(c->fd, c->out + c->out_off, c->out_len - c->out_off, MSG_NOSIGNAL);
+    if(sent<0) {
+      if(errno==EINTR) continue;
+      if(errno==EAGAIN || errno==EWOULDBLOCK) break;
+      return 1;
+    }
+    c->out_off += (size_t) sent;
+  }
+  const size_t pending = c->out_len - c->out_off;
+  if(pending==0) {
+    c->out_off = c->out_len = 0;
+    if(c->closing || c->eof) return 1;
+  }
+  uint32_t events = 0;
+  if(pending>0) events |= EPOLLOUT;
+  if(!c->closing && !c->eof) {
+    events |= EPOLLRDHUP;
+    if(pending < CONN_OUT_HIGH) events |= EPOLLIN;
+  }
+  return set_events(w, c, events);
+}
+
+// evaluates the batch and queues the responses
+static void run_batch(Worker *w) {
+  if(w->batch_len==0) return;
+  if(0>oprf_EvaluateBatch_KeyCtx(w->key, w->batch_len, w->blinded, w->Z, w->fails)) {
+    memset(w->fails, 1, w->batch_len);
+  }
+  uint8_t part[RESP_SIZE];
+  part[0] = w->key->index;
+  for(size_t i=0;i<w->batch_len;i++) {
+    Conn *c = w->conns[i];
+    // after a failed request the rest of the connection is dropped
+    if(c->closing) continue;
+    if(w->fails[i]) {
+      c->closing = 1;
+      conn_queue(c, fail_msg, sizeof fail_msg - 1);
+      continue;
+    }
+    memcpy(part+1, w->Z[i], REQ_SIZE);
+    if(0!=conn_queue(c, part, sizeof part)) c->closing = 1;
+  }
+  sodium_memzero(w->Z, w->batch_len * REQ_SIZE);
+  sodium_memzero(part, sizeof part);
+}
+
+// moves the complete requests of c into the batch, returns 1 if the
+// batch is full and c still has requests left
+static int conn_take(Worker *w, Conn *c) {
+  size_t off = 0;
+  while(c->in_len - off >= REQ_SIZE) {
+    if(w->batch_len==BATCH_MAX) break;
+    w->conns[w->batch_len] = c;
+    memcpy(w->blinded[w->batch_len], c->in + off, REQ_SIZE);
+    w->batch_len++;
+    off += REQ_SIZE;
+  }
+  memmove(c->in, c->in + off, c->in_len - off);
+  c->in_len -= off;
+  return c->in_len >= REQ_SIZE;
+}
+
+// returns 1 if the connection failed
+static int conn_read(Conn *c) {
+  while(c->in_len < sizeof c->in) {
+    const ssize_t got = recv(c->fd, c->in + c->in_len, sizeof c->in - c->in_len, 0);
+    if(got<0) {
+      if(errno==EINTR) continue;
+      return (errno==EAGAIN || errno==EWOULDBLOCK) ? 0 : 1;
+    }
+    if(got==0) {
+      c->eof = 1;
+      break;
+    }
+    c->in_len += (size_t) got;
+  }
+  return 0;
+}
+
+static void *worker_loop(void *arg) {
+  Worker *w = (Worker*) arg;
+  struct epoll_event events[BATCH_MAX];
+  // the connections touched in this round, at most one per event
+  Conn *touched[BATCH_MAX];
+  uint8_t failed[BATCH_MAX];
+
+  while(!stop) {
+    const int ready = epoll_wait(w->epoll_fd, events, BATCH_MAX, 1000);
+    if(ready<0) {
+      if(errno==EINTR) continue;
+      fprintf(stderr, "[!] epoll_wait: %s\n", strerror(errno));
+      break;
+    }
+    size_t touched_len = 0;
+    w->batch_len = 0;
+    for(int i=0;i<ready;i++) {
+      Conn *c = events[i].data.ptr;
+      if(c==NULL) {
+        accept_all(w);
+        continue;
+      }
+      failed[touched_len] = 0;
+      if(events[i].events & EPOLLERR) failed[touched_len] = 1;
+      else if(!c->eof && (events[i].events & (EPOLLIN | EPOLLRDHUP | EPOLLHUP))) {
+        failed[touched_len] = (uint8_t) conn_read(c);
+      }
+      touched[touched_len++] = c;
+    }
+
+    // requests of connections that failed are dropped, they can not
+    // be answered anyway
+    for(size_t i=0;i<touched_len;i++) {
+      if(failed[i]) continue;
+      while(conn_take(w, touched[i])) {
+        run_batch(w);
+        w->batch_len = 0;
+      }
+    }
+    run_batch(w);
+
+    for(size_t i=0;i<touched_len;i++) {
+      Conn *c = touched[i];
+      // what is left is an incomplete request or one after a failure
+      if(c->closing || c->eof) c->in_len = 0;
+      if(failed[i] || conn_flush(w, c)) conn_close(w, c);
+    }
+  }
+  return NULL;
+}
+
+static int load_share(const char *path, uint8_t share[TOPRF_Share_BYTES]) {
+  FILE *f = fopen(path, "rb");
+  if(f==NULL) {
+    fprintf(stderr, "[!] cannot open share %s: %s\n", path, strerror(errno));
+    return 1;
+  }
+  const size_t len = fread(share, 1, TOPRF_Share_BYTES, f);
+  // there must be nothing after the share
+  const int extra = fgetc(f);
+  fclose(f);
+  if(len!=TOPRF_Share_BYTES || extra!=EOF || share[0]==0) {
+    fprintf(stderr, "[!] %s is not a share of %lu bytes\n", path, TOPRF_Share_BYTES);
+    return 1;
+  }
+  return 0;
+}
+
+static void usage(const char *self) {
+  fprintf(stderr, "usage: %s [-l address] [-w workers] <port> <share-file>\n", self);
+  exit(1);
+}
+
+int main(const int argc, char *const argv[]) {
+  const char *address = NULL;
+  long workers = sysconf(_SC_NPROCESSORS_ONLN);
+  int opt;
+  while((opt = getopt(argc, argv, "l:w:"))!=-1) {
+    switch(opt) {
+    case 'l': { address = optarg; break; }
+    case 'w': { workers = atol(optarg); break; }
+    default: usage(argv[0]);
+    }
+  }
+  if(argc - optind != 2 || workers < 1 || workers > 1024) usage(argv[0]);
+  const char *port = argv[optind], *share_path = argv[optind+1];
+
+  if(sodium_init() < 0) return 1;
+
+  uint8_t share[TOPRF_Share_BYTES];
+  if(0!=load_share(share_path, share)) return 1;
+  oprf_KeyCtx key;
+  const int ret = oprf_KeyCtx_init_share(&key, share);
+  sodium_memzero(share, sizeof share);
+  if(0!=ret) return 1;
+
+  struct sigaction sa;
+  memset(&sa, 0, sizeof sa);
+  sa.sa_handler = on_signal;
+  sigaction(SIGINT, &sa, NULL);
+  sigaction(SIGTERM, &sa, NULL);
+  signal(SIGPIPE, SIG_IGN);
+
+  Worker *w = calloc((size_t) workers, sizeof(Worker));
+  pthread_t *tids = calloc((size_t) workers, sizeof(pthread_t));
+  if(w==NULL || tids==NULL) return 1;
+  long started = 0;
+  for(;started<workers;started++) {
+    w[started].key = &key;
+    w[started].listen_fd = listen_on(address, port);
+    if(w[started].listen_fd<0) break;
+    w[started].epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    struct epoll_event ev = { .events = EPOLLIN, .data.ptr = NULL };
+    if(w[started].epoll_fd<0 || 0!=epoll_ctl(w[started].epoll_fd, EPOLL_CTL_ADD, w[started].listen_fd, &ev)) break;
+    if(0!=pthread_create(&tids[started], NULL, worker_loop, &w[started])) break;
+  }
+  if(started<workers) stop = 1;
+  else fprintf(stderr, "[+] oprfd serving share %d on port %s with %ld workers\n", key.index, port, workers);
+
+  for(long i=0;i<started;i++) pthread_join(tids[i], NULL);
+  // the open connections are dropped with the process
+  for(long i=0;i<workers;i++) {
+    if(w[i].listen_fd>0) close(w[i].listen_fd);
+    if(w[i].epoll_fd>0) close(w[i].epoll_fd);
+  }
+  free(tids);
+  free(w);
+  oprf_KeyCtx_free(&key);
+  return started<workers;
+}
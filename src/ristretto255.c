@@ -0,0 +1,1000 @@
+/*
+    @copyright 2024, Stefan Marsiske toprf@ctrlc.hu
+    This file is part of liboprf.
+
+    liboprf is free software: you can redistribute it and/or
+    modify it under the terms of the GNU Lesser General Public License
+    as published by the Free Software Foundation, either version 3 of
+    the License, or (at your option) any later version.
+
+    liboprf is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Lesser General Public License for more details.
+
+    You should have received a copy of the License
+    along with liboprf. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <stdint.h>
+#include <string.h>
+#include <sodium.h>
+#include "ristretto255.h"
+
+/*
+ * group arithmetic over ristretto255 which libsodium does not
+ * expose: multi-scalar multiplication and batched ed25519
+ * verification. single scalar multiplications are left to
+ * libsodium, which is just as fast. the implementation follows the usual ref10 design:
+ * the field is represented in radix 2^51, points in extended
+ * twisted edwards coordinates, and the ristretto255 encoding and
+ * decoding follows RFC 9496.
+ *
+ * everything in here is constant time unless the name of the
+ * function says otherwise.
+ *
+ * when the compiler has no 128 bit integer type, the functions fall
+ * back to the plain libsodium API.
+ */
+
+#ifdef __SIZEOF_INT128__
+
+typedef unsigned __int128 uint128_t;
+typedef uint64_t fe[5];
+
+typedef struct {
+  fe X, Y, Z, T;
+} ge_p3;
+
+// (Y+X, Y-X, Z, 2dT) - the representation used as second operand of an addition
+typedef struct {
+  fe YplusX, YminusX, Z, T2d;
+} ge_cached;
+
+#define MASK51 ((((uint64_t) 1) << 51) - 1)
+// a scalar recoded into signed radix-16 digits
+#define ristretto255_RECODED_BYTES 64
+
+static const fe fe_d = { 0x34dca135978a3, 0x1a8283b156ebd, 0x5e7a26001c029, 0x739c663a03cbb, 0x52036cee2b6ff };
+static const fe fe_d2 = { 0x69b9426b2f159, 0x35050762add7a, 0x3cf44c0038052, 0x6738cc7407977, 0x2406d9dc56dff };
+static const fe fe_sqrtm1 = { 0x61b274a0ea0b0, 0xd5a5fc8f189d, 0x7ef5e9cbd0c60, 0x78595a6804c9e, 0x2b8324804fc1d };
+static const fe fe_invsqrtamd = { 0xfdaa805d40ea, 0x2eb482e57d339, 0x7610274bc58, 0x6510b613dc8ff, 0x786c8905cfaff };
+
+static void fe_0(fe h) {
+  h[0]=0; h[1]=0; h[2]=0; h[3]=0; h[4]=0;
+}
+
+static void fe_1(fe h) {
+  h[0]=1; h[1]=0; h[2]=0; h[3]=0; h[4]=0;
+}
+
+static void fe_copy(fe h, const fe f) {
+  h[0]=f[0]; h[1]=f[1]; h[2]=f[2]; h[3]=f[3]; h[4]=f[4];
+}
+
+static void fe_carry(fe h) {
+  uint64_t c;
+  c = h[0] >> 51; h[0] &= MASK51; h[1] += c;
+  c = h[1] >> 51; h[1] &= MASK51; h[2] += c;
+  c = h[2] >> 51; h[2] &= MASK51; h[3] += c;
+  c = h[3] >> 51; h[3] &= MASK51; h[4] += c;
+  c = h[4] >> 51; h[4] &= MASK51; h[0] += c * 19;
+}
+
+// no carry, the limbs of the result can be up to 2^53, which is still
+// fine as input to all other fe_* functions
+static void fe_add(fe h, const fe f, const fe g) {
+  h[0] = f[0] + g[0];
+  h[1] = f[1] + g[1];
+  h[2] = f[2] + g[2];
+  h[3] = f[3] + g[3];
+  h[4] = f[4] + g[4];
+}
+
+// h = f - g, computed as f + 4p - g, so that limbs of g up to 2^53 are ok
+static void fe_sub(fe h, const fe f, const fe g) {
+  h[0] = (f[0] + 0x1fffffffffffb4) - g[0];
+  h[1] = (f[1] + 0x1ffffffffffffc) - g[1];
+  h[2] = (f[2] + 0x1ffffffffffffc) - g[2];
+  h[3] = (f[3] + 0x1ffffffffffffc) - g[3];
+  h[4] = (f[4] + 0x1ffffffffffffc) - g[4];
+  fe_carry(h);
+}
+
+static void fe_neg(fe h, const fe f) {
+  fe zero;
+  fe_0(zero);
+  fe_sub(h, zero, f);
+}
+
+static void fe_mul(fe h, const fe f, const fe g) {
+  const uint64_t f0 = f[0], f1 = f[1], f2 = f[2], f3 = f[3], f4 = f[4];
+  const uint64_t g0 = g[0], g1 = g[1], g2 = g[2], g3 = g[3], g4 = g[4];
+  const uint64_t g1_19 = 19 * g1, g2_19 = 19 * g2, g3_19 = 19 * g3, g4_19 = 19 * g4;
+  uint128_t r0, r1, r2, r3, r4;
+  uint64_t c;
+
+  r0 = (uint128_t) f0 * g0 + (uint128_t) f1 * g4_19 + (uint128_t) f2 * g3_19 + (uint128_t) f3 * g2_19 + (uint128_t) f4 * g1_19;
+  r1 = (uint128_t) f0 * g1 + (uint128_t) f1 * g0 + (uint128_t) f2 * g4_19 + (uint128_t) f3 * g3_19 + (uint128_t) f4 * g2_19;
+  r2 = (uint128_t) f0 * g2 + (uint128_t) f1 * g1 + (uint128_t) f2 * g0 + (uint128_t) f3 * g4_19 + (uint128_t) f4 * g3_19;
+  r3 = (uint128_t) f0 * g3 + (uint128_t) f1 * g2 + (uint128_t) f2 * g1 + (uint128_t) f3 * g0 + (uint128_t) f4 * g4_19;
+  r4 = (uint128_t) f0 * g4 + (uint128_t) f1 * g3 + (uint128_t) f2 * g2 + (uint128_t) f3 * g1 + (uint128_t) f4 * g0;
+
+  r1 += (uint64_t) (r0 >> 51); h[0] = (uint64_t) r0 & MASK51;
+  r2 += (uint64_t) (r1 >> 51); h[1] = (uint64_t) r1 & MASK51;
+  r3 += (uint64_t) (r2 >> 51); h[2] = (uint64_t) r2 & MASK51;
+  r4 += (uint64_t) (r3 >> 51); h[3] = (uint64_t) r3 & MASK51;
+  c = (uint64_t) (r4 >> 51); h[4] = (uint64_t) r4 & MASK51;
+  h[0] += c * 19;
+  c = h[0] >> 51; h[0] &= MASK51; h[1] += c;
+}
+
+static void fe_sq(fe h, const fe f) {
+  const uint64_t f0 = f[0], f1 = f[1], f2 = f[2], f3 = f[3], f4 = f[4];
+  const uint64_t d0 = 2 * f0, d1 = 2 * f1, d2 = 38 * f2, f3_19 = 19 * f3, f4_19 = 19 * f4, d4 = 2 * f4_19;
+  uint128_t r0, r1, r2, r3, r4;
+  uint64_t c;
+
+  r0 = (uint128_t) f0 * f0 + (uint128_t) d4 * f1 + (uint128_t) d2 * f3;
+  r1 = (uint128_t) d0 * f1 + (uint128_t) d4 * f2 + (uint128_t) f3 * f3_19;
+  r2 = (uint128_t) d0 * f2 + (uint128_t) f1 * f1 + (uint128_t) d4 * f3;
+  r3 = (uint128_t) d0 * f3 + (uint128_t) d1 * f2 + (uint128_t) f4 * f4_19;
+  r4 = (uint128_t) d0 * f4 + (uint128_t) d1 * f3 + (uint128_t) f2 * f2;
+
+  r1 += (uint64_t) (r0 >> 51); h[0] = (uint64_t) r0 & MASK51;
+  r2 += (uint64_t) (r1 >> 51); h[1] = (uint64_t) r1 & MASK51;
+  r3 += (uint64_t) (r2 >> 51); h[2] = (uint64_t) r2 & MASK51;
+  r4 += (uint64_t) (r3 >> 51); h[3] = (uint64_t) r3 & MASK51;
+  c = (uint64_t) (r4 >> 51); h[4] = (uint64_t) r4 & MASK51;
+  h[0] += c * 19;
+  c = h[0] >> 51; h[0] &= MASK51; h[1] += c;
+}
+
+static void fe_sqn(fe h, const fe f, unsigned n) {
+  fe_sq(h, f);
+  while(--n) fe_sq(h, h);
+}
+
+static uint64_t load64_le(const uint8_t *s) {
+  uint64_t r = 0;
+  for(int i=7;i>=0;i--) r = (r << 8) | s[i];
+  return r;
+}
+
+// ignores the most significant bit
+static void fe_frombytes(fe h, const uint8_t s[32]) {
+  h[0] = load64_le(s) & MASK51;
+  h[1] = (load64_le(s + 6) >> 3) & MASK51;
+  h[2] = (load64_le(s + 12) >> 6) & MASK51;
+  h[3] = (load64_le(s + 19) >> 1) & MASK51;
+  h[4] = (load64_le(s + 24) >> 12) & MASK51;
+}
+
+// canonical encoding
+static void fe_tobytes(uint8_t s[32], const fe f) {
+  fe t;
+  uint64_t c;
+  fe_copy(t, f);
+  fe_carry(t);
+  fe_carry(t);
+  // t is now in [0, 2^255 + epsilon), add 19 and carry, so that
+  // the carry out of the top limb tells us whether t >= p
+  c = (t[0] + 19) >> 51;
+  c = (t[1] + c) >> 51;
+  c = (t[2] + c) >> 51;
+  c = (t[3] + c) >> 51;
+  c = (t[4] + c) >> 51;
+  t[0] += 19 * c;
+  c = t[0] >> 51; t[0] &= MASK51; t[1] += c;
+  c = t[1] >> 51; t[1] &= MASK51; t[2] += c;
+  c = t[2] >> 51; t[2] &= MASK51; t[3] += c;
+  c = t[3] >> 51; t[3] &= MASK51; t[4] += c;
+  t[4] &= MASK51;
+
+  const uint64_t w0 = t[0] | (t[1] << 51);
+  const uint64_t w1 = (t[1] >> 13) | (t[2] << 38);
+  const uint64_t w2 = (t[2] >> 26) | (t[3] << 25);
+  const uint64_t w3 = (t[3] >> 39) | (t[4] << 12);
+  for(unsigned i=0;i<8;i++) {
+    s[i] = (uint8_t) (w0 >> (8*i));
+    s[i+8] = (uint8_t) (w1 >> (8*i));
+    s[i+16] = (uint8_t) (w2 >> (8*i));
+    s[i+24] = (uint8_t) (w3 >> (8*i));
+  }
+}
+
+static int fe_isnegative(const fe f) {
+  uint8_t s[32];
+  fe_tobytes(s, f);
+  return s[0] & 1;
+}
+
+static int fe_iszero(const fe f) {
+  uint8_t s[32], d = 0;
+  fe_tobytes(s, f);
+  for(unsigned i=0;i<32;i++) d |= s[i];
+  return (int) ((((unsigned) d - 1U) >> 8) & 1);
+}
+
+static int fe_eq(const fe f, const fe g) {
+  fe d;
+  fe_sub(d, f, g);
+  return fe_iszero(d);
+}
+
+// h = b ? g : h, b must be 0 or 1
+static void fe_cmov(fe h, const fe g, const unsigned b) {
+  const uint64_t mask = (uint64_t) 0 - (uint64_t) b;
+  for(unsigned i=0;i<5;i++) h[i] ^= mask & (h[i] ^ g[i]);
+}
+
+static void fe_cneg(fe h, const unsigned b) {
+  fe n;
+  fe_neg(n, h);
+  fe_cmov(h, n, b);
+}
+
+static void fe_abs(fe h) {
+  fe_cneg(h, (unsigned) fe_isnegative(h));
+}
+
+// h = z^(2^252 - 3)
+static void fe_pow22523(fe h, const fe z) {
+  fe t0, t1, t2;
+  fe_sq(t0, z);
+  fe_sqn(t1, t0, 2);
+  fe_mul(t1, z, t1);
+  fe_mul(t0, t0, t1);
+  fe_sq(t0, t0);
+  fe_mul(t0, t1, t0);
+  fe_sqn(t1, t0, 5);
+  fe_mul(t0, t1, t0);
+  fe_sqn(t1, t0, 10);
+  fe_mul(t1, t1, t0);
+  fe_sqn(t2, t1, 20);
+  fe_mul(t1, t2, t1);
+  fe_sqn(t1, t1, 10);
+  fe_mul(t0, t1, t0);
+  fe_sqn(t1, t0, 50);
+  fe_mul(t1, t1, t0);
+  fe_sqn(t2, t1, 100);
+  fe_mul(t1, t2, t1);
+  fe_sqn(t1, t1, 50);
+  fe_mul(t0, t1, t0);
+  fe_sqn(t0, t0, 2);
+  fe_mul(h, t0, z);
+}
+
+/* SQRT_RATIO_M1(u, v) from RFC 9496 section 4.2
+ * returns 1 if u/v was square, and sets r to the non-negative square root */
+static int fe_sqrt_ratio_m1(fe r, const fe u, const fe v) {
+  fe v3, v7, t, check, u_neg, u_neg_i, r_prime;
+
+  fe_sq(v3, v);
+  fe_mul(v3, v3, v);     // v^3
+  fe_sq(v7, v3);
+  fe_mul(v7, v7, v);     // v^7
+  fe_mul(t, u, v7);
+  fe_pow22523(t, t);     // (u*v^7)^((p-5)/8)
+  fe_mul(r, u, v3);
+  fe_mul(r, r, t);       // (u*v^3) * (u*v^7)^((p-5)/8)
+
+  fe_sq(check, r);
+  fe_mul(check, check, v);
+  fe_neg(u_neg, u);
+  fe_mul(u_neg_i, u_neg, fe_sqrtm1);
+
+  const int correct_sign = fe_eq(check, u);
+  const int flipped_sign = fe_eq(check, u_neg);
+  const int flipped_sign_i = fe_eq(check, u_neg_i);
+
+  fe_mul(r_prime, r, fe_sqrtm1);
+  fe_cmov(r, r_prime, (unsigned) (flipped_sign | flipped_sign_i));
+  fe_abs(r);
+  return correct_sign | flipped_sign;
+}
+
+static void ge_p3_0(ge_p3 *h) {
+  fe_0(h->X);
+  fe_1(h->Y);
+  fe_1(h->Z);
+  fe_0(h->T);
+}
+
+static void ge_cached_0(ge_cached *h) {
+  fe_1(h->YplusX);
+  fe_1(h->YminusX);
+  fe_1(h->Z);
+  fe_0(h->T2d);
+}
+
+static void ge_p3_to_cached(ge_cached *r, const ge_p3 *p) {
+  fe_add(r->YplusX, p->Y, p->X);
+  fe_sub(r->YminusX, p->Y, p->X);
+  fe_copy(r->Z, p->Z);
+  fe_mul(r->T2d, p->T, fe_d2);
+}
+
+static void ge_cached_cmov(ge_cached *h, const ge_cached *g, const unsigned b) {
+  fe_cmov(h->YplusX, g->YplusX, b);
+  fe_cmov(h->YminusX, g->YminusX, b);
+  fe_cmov(h->Z, g->Z, b);
+  fe_cmov(h->T2d, g->T2d, b);
+}
+
+static void ge_cached_cneg(ge_cached *h, const unsigned b) {
+  ge_cached n;
+  fe_copy(n.YplusX, h->YminusX);
+  fe_copy(n.YminusX, h->YplusX);
+  fe_copy(n.Z, h->Z);
+  fe_neg(n.T2d, h->T2d);
+  ge_cached_cmov(h, &n, b);
+}
+
+// r = p + q, add-2008-hwcd-3
+static void ge_add(ge_p3 *r, const ge_p3 *p, const ge_cached *q) {
+  fe a, b, c, d, e, f, g, h;
+  fe_sub(a, p->Y, p->X);
+  fe_mul(a, a, q->YminusX);
+  fe_add(b, p->Y, p->X);
+  fe_mul(b, b, q->YplusX);
+  fe_mul(c, p->T, q->T2d);
+  fe_mul(d, p->Z, q->Z);
+  fe_add(d, d, d);
+  fe_sub(e, b, a);
+  fe_sub(f, d, c);
+  fe_add(g, d, c);
+  fe_add(h, b, a);
+  fe_mul(r->X, e, f);
+  fe_mul(r->Y, g, h);
+  fe_mul(r->T, e, h);
+  fe_mul(r->Z, f, g);
+}
+
+/* r = 2p, dbl-2008-hwcd. if with_t is 0 the T coordinate is not
+ * computed, this is fine as long as r is only doubled again */
+static void ge_dbl(ge_p3 *r, const ge_p3 *p, const int with_t) {
+  fe a, b, c, e, f, g, h;
+  fe_sq(a, p->X);
+  fe_sq(b, p->Y);
+  fe_sq(c, p->Z);
+  fe_add(c, c, c);
+  fe_add(e, p->X, p->Y);
+  fe_sq(e, e);
+  fe_sub(e, e, a);
+  fe_sub(e, e, b);
+  fe_sub(g, b, a);
+  fe_sub(f, g, c);
+  fe_add(h, a, b);
+  fe_neg(h, h);
+  fe_mul(r->X, e, f);
+  fe_mul(r->Y, g, h);
+  fe_mul(r->Z, f, g);
+  if(with_t) fe_mul(r->T, e, h);
+}
+
+// RFC 9496 section 4.3.1
+static int ristretto255_decode(ge_p3 *h, const uint8_t s[32]) {
+  fe s_, ss, u1, u2, u2_sqr, v, t, invsqrt, den_x, den_y, one;
+  uint8_t check[32];
+
+  fe_frombytes(s_, s);
+  fe_tobytes(check, s_);
+  // reject non-canonical and negative encodings. like libsodium the
+  // most significant bit is ignored, so that both accept the same
+  // encodings.
+  check[31] |= s[31] & 0x80;
+  if(sodium_memcmp(check, s, 32) != 0 || (s[0] & 1) != 0) return -1;
+
+  fe_1(one);
+  fe_sq(ss, s_);
+  fe_sub(u1, one, ss);
+  fe_add(u2, one, ss);
+  fe_sq(u2_sqr, u2);
+  fe_sq(v, u1);
+  fe_mul(v, v, fe_d);
+  fe_neg(v, v);
+  fe_sub(v, v, u2_sqr);   // v = -(D * u1^2) - u2_sqr
+
+  fe_mul(t, v, u2_sqr);
+  const int was_square = fe_sqrt_ratio_m1(invsqrt, one, t);
+
+  fe_mul(den_x, invsqrt, u2);
+  fe_mul(den_y, invsqrt, den_x);
+  fe_mul(den_y, den_y, v);
+
+  fe_mul(h->X, s_, den_x);
+  fe_add(h->X, h->X, h->X);
+  fe_abs(h->X);
+  fe_mul(h->Y, u1, den_y);
+  fe_1(h->Z);
+  fe_mul(h->T, h->X, h->Y);
+
+  if((was_square == 0) | fe_isnegative(h->T) | fe_iszero(h->Y)) return -1;
+  return 0;
+}
+
+// RFC 9496 section 4.3.2
+static void ristretto255_encode(uint8_t s[32], const ge_p3 *h) {
+  fe u1, u2, t, invsqrt, den1, den2, z_inv, ix0, iy0, enchanted, x, y, den_inv, one;
+
+  fe_add(u1, h->Z, h->Y);
+  fe_sub(t, h->Z, h->Y);
+  fe_mul(u1, u1, t);
+  fe_mul(u2, h->X, h->Y);
+
+  fe_1(one);
+  fe_sq(t, u2);
+  fe_mul(t, t, u1);
+  fe_sqrt_ratio_m1(invsqrt, one, t);
+
+  fe_mul(den1, invsqrt, u1);
+  fe_mul(den2, invsqrt, u2);
+  fe_mul(z_inv, den1, den2);
+  fe_mul(z_inv, z_inv, h->T);
+
+  fe_mul(ix0, h->X, fe_sqrtm1);
+  fe_mul(iy0, h->Y, fe_sqrtm1);
+  fe_mul(enchanted, den1, fe_invsqrtamd);
+
+  fe_mul(t, h->T, z_inv);
+  const unsigned rotate = (unsigned) fe_isnegative(t);
+
+  fe_copy(x, h->X);
+  fe_copy(y, h->Y);
+  fe_copy(den_inv, den2);
+  fe_cmov(x, iy0, rotate);
+  fe_cmov(y, ix0, rotate);
+  fe_cmov(den_inv, enchanted, rotate);
+
+  fe_mul(t, x, z_inv);
+  fe_cneg(y, (unsigned) fe_isnegative(t));
+
+  fe_sub(t, h->Z, y);
+  fe_mul(t, den_inv, t);
+  fe_abs(t);
+  fe_tobytes(s, t);
+}
+
+// returns 1 if a == b, 0 otherwise
+static unsigned equal(const int8_t a, const int8_t b) {
+  const uint32_t x = (uint32_t) (uint8_t) (a ^ b);
+  return (unsigned) ((x - 1) >> 31);
+}
+
+// constant time selection of |b| * P from table[0..7] = { 1P .. 8P }, negated if b < 0
+static void ge_select(ge_cached *t, const ge_cached table[8], const int8_t b) {
+  const unsigned bnegative = (unsigned) ((uint8_t) b >> 7);
+  const int8_t babs = (int8_t) (b - (int8_t) ((-(int) bnegative & b) * 2));
+
+  ge_cached_0(t);
+  for(int8_t i=0;i<8;i++) {
+    ge_cached_cmov(t, &table[i], equal(babs, (int8_t) (i + 1)));
+  }
+  ge_cached_cneg(t, bnegative);
+}
+
+static void ge_table(ge_cached table[8], const ge_p3 *p) {
+  ge_p3 t;
+  ge_p3_to_cached(&table[0], p);
+  ge_dbl(&t, p, 1);
+  ge_p3_to_cached(&table[1], &t);
+  for(unsigned i=2;i<8;i++) {
+    ge_add(&t, &t, &table[0]);
+    ge_p3_to_cached(&table[i], &t);
+  }
+}
+
+/* recodes a scalar into 64 signed radix-16 digits between -8 and 8,
+ * like crypto_scalarmult_ristretto255() the top bit is ignored. */
+static void ristretto255_recode(const uint8_t n[crypto_core_ristretto255_SCALARBYTES],
+                                int8_t e[ristretto255_RECODED_BYTES]) {
+  for(unsigned i=0;i<32;i++) {
+    const uint8_t b = (i==31) ? (uint8_t) (n[i] & 127) : n[i];
+    e[2 * i + 0] = (int8_t) (b & 15);
+    e[2 * i + 1] = (int8_t) ((b >> 4) & 15);
+  }
+  // each e[i] is between 0 and 15, e[63] is between 0 and 7
+  int8_t carry = 0;
+  for(unsigned i=0;i<63;i++) {
+    e[i] = (int8_t) (e[i] + carry);
+    carry = (int8_t) ((e[i] + 8) >> 4);
+    e[i] = (int8_t) (e[i] - carry * 16);
+  }
+  e[63] = (int8_t) (e[63] + carry);
+  // each e[i] is between -8 and 8
+}
+
+// h = sum(e_i * table_i) for points already expanded by ge_table()
+static void ge_msm_tables(ge_p3 *h, const size_t n,
+                          const int8_t e[n][ristretto255_RECODED_BYTES],
+                          const ge_cached table[n][8]) {
+  ge_cached t;
+  ge_p3_0(h);
+  for(int i=63;i>=0;i--) {
+    if(i<63) {
+      ge_dbl(h, h, 0);
+      ge_dbl(h, h, 0);
+      ge_dbl(h, h, 0);
+      ge_dbl(h, h, 1);
+    }
+    for(size_t j=0;j<n;j++) {
+      ge_select(&t, table[j], e[j][i]);
+      ge_add(h, h, &t);
+    }
+  }
+  sodium_memzero(&t, sizeof t);
+}
+
+// h = sum(e_i * p_i) for up to ristretto255_MSM_CHUNK points, Straus' method
+static void ge_msm_chunk(ge_p3 *h, const size_t n,
+                         const int8_t e[n][ristretto255_RECODED_BYTES],
+                         const ge_p3 p[n]) {
+  ge_cached table[n][8];
+  for(size_t j=0;j<n;j++) ge_table(table[j], &p[j]);
+  ge_msm_tables(h, n, e, (const ge_cached (*)[8]) table);
+  sodium_memzero(table, sizeof table);
+}
+
+// same as ge_msm_chunk() but only for public inputs: skips zero digits
+// and looks the multiples up directly
+static void ge_msm_chunk_vartime(ge_p3 *h, const size_t n,
+                                 const int8_t e[n][ristretto255_RECODED_BYTES],
+                                 const ge_p3 p[n]) {
+  ge_cached table[n][8], t;
+  for(size_t j=0;j<n;j++) ge_table(table[j], &p[j]);
+
+  ge_p3_0(h);
+  for(int i=63;i>=0;i--) {
+    if(i<63) {
+      ge_dbl(h, h, 0);
+      ge_dbl(h, h, 0);
+      ge_dbl(h, h, 0);
+      ge_dbl(h, h, 1);
+    }
+    for(size_t j=0;j<n;j++) {
+      const int8_t b = e[j][i];
+      if(b==0) continue;
+      if(b>0) {
+        ge_add(h, h, &table[j][b-1]);
+      } else {
+        t = table[j][-b-1];
+        ge_cached_cneg(&t, 1);
+        ge_add(h, h, &t);
+      }
+    }
+  }
+}
+
+/* sliding window recoding of a public scalar, as slide() in ref10:
+ * afterwards each r[i] is 0 or odd and between -15 and 15, and of any
+ * 5 consecutive digits at most one is non-zero. Like
+ * crypto_scalarmult_ristretto255() the top bit of a is ignored. */
+static void slide_vartime(int8_t r[256], const uint8_t a[32]) {
+  for(int i=0;i<256;i++) {
+    r[i] = (int8_t) (1 & (((i>>3)==31 ? (a[31] & 127) : a[i >> 3]) >> (i & 7)));
+  }
+  for(int i=0;i<256;i++) {
+    if(!r[i]) continue;
+    for(int b=1;b<=6 && i+b<256;b++) {
+      if(!r[i+b]) continue;
+      if(r[i] + (r[i+b] << b) <= 15) {
+        r[i] = (int8_t) (r[i] + (r[i+b] << b));
+        r[i+b] = 0;
+      } else if(r[i] - (r[i+b] << b) >= -15) {
+        r[i] = (int8_t) (r[i] - (r[i+b] << b));
+        for(int k=i+b;k<256;k++) {
+          if(!r[k]) {
+            r[k] = 1;
+            break;
+          }
+          r[k] = 0;
+        }
+      } else {
+        break;
+      }
+    }
+  }
+}
+
+// table[0..7] = { 1P, 3P, 5P, .. 15P }
+static void ge_table_odd(ge_cached table[8], const ge_p3 *p) {
+  ge_p3 t, p2;
+  ge_cached c2;
+  ge_p3_to_cached(&table[0], p);
+  ge_dbl(&p2, p, 1);
+  ge_p3_to_cached(&c2, &p2);
+  t = *p;
+  for(unsigned i=1;i<8;i++) {
+    ge_add(&t, &t, &c2);
+    ge_p3_to_cached(&table[i], &t);
+  }
+}
+
+// h = sum(s_i * p_i) for up to ristretto255_MSM_CHUNK points with
+// public scalars, Straus' method over sliding windows: the doublings
+// before the highest non-zero digit of all scalars are skipped, and
+// there are on average 256/6 additions per point instead of 64.
+static void ge_msm_chunk_wnaf_vartime(ge_p3 *h, const size_t n,
+                                      const int8_t naf[n][256],
+                                      const ge_p3 p[n]) {
+  ge_cached table[n][8], t;
+  for(size_t j=0;j<n;j++) ge_table_odd(table[j], &p[j]);
+
+  // whether any scalar has a non-zero digit at i
+  uint8_t any[256] = {0};
+  int top = -1;
+  for(int i=255;i>=0;i--) {
+    for(size_t j=0;j<n && !any[i];j++) any[i] = (naf[j][i]!=0);
+    if(any[i] && top<0) top = i;
+  }
+
+  ge_p3_0(h);
+  for(int i=top;i>=0;i--) {
+    // T is only needed for the next addition and in the result
+    if(i<top) ge_dbl(h, h, any[i] || i==0);
+    if(!any[i]) continue;
+    for(size_t j=0;j<n;j++) {
+      const int8_t b = naf[j][i];
+      if(b>0) {
+        ge_add(h, h, &table[j][b/2]);
+      } else if(b<0) {
+        t = table[j][(-b)/2];
+        ge_cached_cneg(&t, 1);
+        ge_add(h, h, &t);
+      }
+    }
+  }
+}
+
+// the edwards25519 base point
+static const uint8_t ed25519_B[32] = {
+  0x58, 0x66, 0x66, 0x66, 0x66, 0x66, 0x66, 0x66, 0x66, 0x66, 0x66, 0x66, 0x66, 0x66, 0x66, 0x66,
+  0x66, 0x66, 0x66, 0x66, 0x66, 0x66, 0x66, 0x66, 0x66, 0x66, 0x66, 0x66, 0x66, 0x66, 0x66, 0x66 };
+
+static int ge_is_identity(const ge_p3 *p) {
+  return fe_iszero(p->X) & fe_eq(p->Y, p->Z);
+}
+
+/* decodes a compressed edwards25519 point, rejects non-canonical
+ * encodings and points of small order, just like
+ * crypto_sign_verify_detached() does for R and the public key. */
+static int ed25519_decode_vartime(ge_p3 *h, const uint8_t s[32]) {
+  uint8_t check[32];
+  fe u, v, y2;
+  ge_p3 t;
+
+  fe_frombytes(h->Y, s);
+  fe_tobytes(check, h->Y);
+  check[31] |= (uint8_t) (s[31] & 0x80);
+  if(memcmp(check, s, 32) != 0) return -1;
+
+  fe_1(h->Z);
+  fe_sq(y2, h->Y);
+  fe_sub(u, y2, h->Z);     // u = y^2 - 1
+  fe_mul(v, y2, fe_d);
+  fe_add(v, v, h->Z);      // v = d*y^2 + 1
+  if(!fe_sqrt_ratio_m1(h->X, u, v)) return -1;
+  const int sign = s[31] >> 7;
+  if(fe_iszero(h->X) && sign) return -1;
+  fe_cneg(h->X, (unsigned) sign);
+  fe_mul(h->T, h->X, h->Y);
+
+  ge_dbl(&t, h, 0);
+  ge_dbl(&t, &t, 0);
+  ge_dbl(&t, &t, 1);
+  if(ge_is_identity(&t)) return -1;
+  return 0;
+}
+
+#endif // __SIZEOF_INT128__
+
+// the group order L of edwards25519
+static const uint8_t ed25519_L[32] = {
+  0xed, 0xd3, 0xf5, 0x5c, 0x1a, 0x63, 0x12, 0x58, 0xd6, 0x9c, 0xf7, 0xa2, 0xde, 0xf9, 0xde, 0x14,
+  0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x10 };
+
+// s < L, all inputs are public
+static int sc_is_canonical_vartime(const uint8_t s[32]) {
+  for(int i=31;i>=0;i--) {
+    if(s[i] < ed25519_L[i]) return 1;
+    if(s[i] > ed25519_L[i]) return 0;
+  }
+  return 0;
+}
+
+int ristretto255_msm(uint8_t q[crypto_core_ristretto255_BYTES],
+                     const size_t n,
+                     const uint8_t scalars[n][crypto_core_ristretto255_SCALARBYTES],
+                     const uint8_t points[n][crypto_core_ristretto255_BYTES]) {
+#ifdef __SIZEOF_INT128__
+  ge_p3 acc, h, p[ristretto255_MSM_CHUNK];
+  ge_cached c;
+  int8_t e[ristretto255_MSM_CHUNK][ristretto255_RECODED_BYTES];
+  int ret = 0;
+
+  ge_p3_0(&acc);
+  for(size_t i=0;i<n;i+=ristretto255_MSM_CHUNK) {
+    const size_t len = (n - i < ristretto255_MSM_CHUNK) ? n - i : ristretto255_MSM_CHUNK;
+    for(size_t j=0;j<len;j++) {
+      if(ristretto255_decode(&p[j], points[i+j]) != 0) {
+        ret = -1;
+        goto done;
+      }
+      ristretto255_recode(scalars[i+j], e[j]);
+    }
+    ge_msm_chunk(&h, len, e, p);
+    ge_p3_to_cached(&c, &h);
+    ge_add(&acc, &acc, &c);
+  }
+  ristretto255_encode(q, &acc);
+
+done:
+  sodium_memzero(e, sizeof e);
+  sodium_memzero(&h, sizeof h);
+  sodium_memzero(&c, sizeof c);
+  sodium_memzero(&acc, sizeof acc);
+  return ret;
+#else
+  uint8_t tmp[crypto_core_ristretto255_BYTES];
+  memset(q, 0, crypto_core_ristretto255_BYTES);
+  for(size_t i=0;i<n;i++) {
+    if(crypto_core_ristretto255_is_valid_point(points[i]) != 1) return -1;
+    // fails only if the product is the identity, which adds nothing
+    if(crypto_scalarmult_ristretto255(tmp, scalars[i], points[i]) != 0) continue;
+    crypto_core_ristretto255_add(q, q, tmp);
+  }
+  sodium_memzero(tmp, sizeof tmp);
+  return 0;
+#endif
+}
+
+int ristretto255_msm_vartime(uint8_t q[crypto_core_ristretto255_BYTES],
+                             const size_t n,
+                             const uint8_t scalars[n][crypto_core_ristretto255_SCALARBYTES],
+                             const uint8_t points[n][crypto_core_ristretto255_BYTES]) {
+#ifdef __SIZEOF_INT128__
+  ge_p3 acc, h, p[ristretto255_MSM_CHUNK];
+  ge_cached c;
+  int8_t naf[ristretto255_MSM_CHUNK][256];
+
+  ge_p3_0(&acc);
+  for(size_t i=0;i<n;i+=ristretto255_MSM_CHUNK) {
+    const size_t len = (n - i < ristretto255_MSM_CHUNK) ? n - i : ristretto255_MSM_CHUNK;
+    for(size_t j=0;j<len;j++) {
+      if(ristretto255_decode(&p[j], points[i+j]) != 0) return -1;
+      slide_vartime(naf[j], scalars[i+j]);
+    }
+    ge_msm_chunk_wnaf_vartime(&h, len, (const int8_t (*)[256]) naf, p);
+    ge_p3_to_cached(&c, &h);
+    ge_add(&acc, &acc, &c);
+  }
+  ristretto255_encode(q, &acc);
+  return 0;
+#else
+  return ristretto255_msm(q, n, scalars, points);
+#endif
+}
+
+#ifdef __SIZEOF_INT128__
+_Static_assert(sizeof(ristretto255_table) == sizeof(ge_cached[8]), "ristretto255_table must hold 8 ge_cached");
+#endif
+
+int ristretto255_table_init(ristretto255_table *t, const uint8_t p[crypto_core_ristretto255_BYTES]) {
+#ifdef __SIZEOF_INT128__
+  ge_p3 P;
+  if(ristretto255_decode(&P, p) != 0) return -1;
+  ge_table((ge_cached*) t->opaque, &P);
+  return 0;
+#else
+  // without a table only the encoding is kept
+  if(crypto_core_ristretto255_is_valid_point(p) != 1) return -1;
+  memcpy(t->opaque, p, crypto_core_ristretto255_BYTES);
+  return 0;
+#endif
+}
+
+int ristretto255_msm_tables(uint8_t q[crypto_core_ristretto255_BYTES],
+                            const size_t n,
+                            const uint8_t scalars[n][crypto_core_ristretto255_SCALARBYTES],
+                            const ristretto255_table tables[n]) {
+#ifdef __SIZEOF_INT128__
+  ge_p3 acc, h;
+  ge_cached c;
+  int8_t e[ristretto255_MSM_CHUNK][ristretto255_RECODED_BYTES];
+
+  ge_p3_0(&acc);
+  for(size_t i=0;i<n;i+=ristretto255_MSM_CHUNK) {
+    const size_t len = (n - i < ristretto255_MSM_CHUNK) ? n - i : ristretto255_MSM_CHUNK;
+    for(size_t j=0;j<len;j++) ristretto255_recode(scalars[i+j], e[j]);
+    ge_msm_tables(&h, len, e, (const ge_cached (*)[8]) &tables[i]);
+    ge_p3_to_cached(&c, &h);
+    ge_add(&acc, &acc, &c);
+  }
+  ristretto255_encode(q, &acc);
+
+  sodium_memzero(e, sizeof e);
+  sodium_memzero(&h, sizeof h);
+  sodium_memzero(&c, sizeof c);
+  sodium_memzero(&acc, sizeof acc);
+  return 0;
+#else
+  uint8_t tmp[crypto_core_ristretto255_BYTES];
+  memset(q, 0, crypto_core_ristretto255_BYTES);
+  for(size_t i=0;i<n;i++) {
+    // fails only if the product is the identity, which adds nothing
+    if(crypto_scalarmult_ristretto255(tmp, scalars[i], (const uint8_t*) tables[i].opaque) != 0) continue;
+    crypto_core_ristretto255_add(q, q, tmp);
+  }
+  sodium_memzero(tmp, sizeof tmp);
+  return 0;
+#endif
+}
+
+void ed25519_hram_init(crypto_hash_sha512_state *state,
+                       const uint8_t sig[crypto_sign_BYTES],
+                       const uint8_t pk[crypto_sign_PUBLICKEYBYTES]) {
+  crypto_hash_sha512_init(state);
+  crypto_hash_sha512_update(state, sig, 32);
+  crypto_hash_sha512_update(state, pk, 32);
+}
+
+void ed25519_hram_final(crypto_hash_sha512_state *state,
+                        uint8_t k[crypto_core_ristretto255_SCALARBYTES]) {
+  uint8_t hram[crypto_hash_sha512_BYTES];
+  crypto_hash_sha512_final(state, hram);
+  crypto_core_ristretto255_scalar_reduce(k, hram);
+}
+
+#ifndef __SIZEOF_INT128__
+static const uint8_t ed25519_identity[32] = { 1 };
+
+/* rejects non-canonical encodings and points of small order, like
+ * ed25519_decode_vartime(), and sets p8 to [8]p, which is in the
+ * prime order subgroup and can be used with the libsodium API */
+static int ed25519_times8_vartime(uint8_t p8[32], const uint8_t p[32]) {
+  // y < 2^255 - 19
+  if((p[31] & 0x7f) == 0x7f) {
+    unsigned i;
+    for(i=30;i>0 && p[i]==0xff;i--);
+    if(i==0 && p[0] >= 0xed) return -1;
+  }
+  if(crypto_core_ed25519_add(p8, p, p) != 0) return -1;
+  if(crypto_core_ed25519_add(p8, p8, p8) != 0) return -1;
+  if(crypto_core_ed25519_add(p8, p8, p8) != 0) return -1;
+  if(memcmp(p8, ed25519_identity, 32) == 0) return -1;
+  return 0;
+}
+
+// the cofactored equation of a single signature: [8]S*B == [8]R + k*[8]A
+static int verify_one(const uint8_t sig[crypto_sign_BYTES],
+                      const uint8_t k[crypto_core_ristretto255_SCALARBYTES],
+                      const uint8_t pk[crypto_sign_PUBLICKEYBYTES]) {
+  static const uint8_t eight[crypto_core_ed25519_SCALARBYTES] = { 8 };
+  uint8_t R8[32], A8[32], s8[crypto_core_ed25519_SCALARBYTES], lhs[32], rhs[32];
+  if(!sc_is_canonical_vartime(sig + 32)) return -1;
+  if(ed25519_times8_vartime(R8, sig) != 0) return -1;
+  if(ed25519_times8_vartime(A8, pk) != 0) return -1;
+  crypto_core_ed25519_scalar_mul(s8, eight, sig + 32);
+  // both fail only if the product is the identity
+  if(crypto_scalarmult_ed25519_base_noclamp(lhs, s8) != 0) memcpy(lhs, ed25519_identity, 32);
+  if(crypto_scalarmult_ed25519_noclamp(rhs, k, A8) != 0) memcpy(rhs, ed25519_identity, 32);
+  if(crypto_core_ed25519_add(rhs, rhs, R8) != 0) return -1;
+  return (memcmp(lhs, rhs, 32) == 0) ? 0 : -1;
+}
+#endif // !__SIZEOF_INT128__
+
+// the k_i are either given in hrams, or computed from the messages
+static int verify_batch(const size_t n,
+                        const uint8_t *const msgs[n],
+                        const size_t msg_lens[n],
+                        const uint8_t hrams[n][crypto_core_ristretto255_SCALARBYTES],
+                        const uint8_t *const sigs[n],
+                        const uint8_t *const pks[n]) {
+#ifdef __SIZEOF_INT128__
+  // every signature contributes two points: R_i and A_i
+  const size_t per_chunk = ristretto255_MSM_CHUNK / 2;
+  ge_p3 acc, h, p[ristretto255_MSM_CHUNK];
+  ge_cached c;
+  int8_t e[ristretto255_MSM_CHUNK][ristretto255_RECODED_BYTES];
+  uint8_t sum[crypto_core_ristretto255_SCALARBYTES] = {0};
+  uint8_t z[crypto_core_ristretto255_SCALARBYTES] = {0};
+  uint8_t k[crypto_core_ristretto255_SCALARBYTES];
+  uint8_t t[crypto_core_ristretto255_SCALARBYTES];
+  crypto_hash_sha512_state hs;
+
+  // all inputs are public, so this can be variable time
+
+  /* with random 128 bit z_i all signatures are valid if
+   *   [8](sum(z_i*S_i)*B - sum(z_i*R_i) - sum(z_i*k_i*A_i)) == 0
+   * where k_i = H(R_i || A_i || M_i) */
+  ge_p3_0(&acc);
+  for(size_t i=0;i<n;i+=per_chunk) {
+    const size_t len = (n - i < per_chunk) ? n - i : per_chunk;
+    for(size_t j=0;j<len;j++) {
+      const uint8_t *sig = sigs[i+j];
+      if(!sc_is_canonical_vartime(sig + 32)) return -1;
+      if(ed25519_decode_vartime(&p[2*j], sig) != 0) return -1;
+      if(ed25519_decode_vartime(&p[2*j+1], pks[i+j]) != 0) return -1;
+
+      if(hrams!=NULL) {
+        memcpy(k, hrams[i+j], sizeof k);
+      } else {
+        ed25519_hram_init(&hs, sig, pks[i+j]);
+        crypto_hash_sha512_update(&hs, msgs[i+j], msg_lens[i+j]);
+        ed25519_hram_final(&hs, k);
+      }
+
+      // negating R_i and A_i instead of the scalars keeps z_i short
+      fe_neg(p[2*j].X, p[2*j].X);
+      fe_neg(p[2*j].T, p[2*j].T);
+      fe_neg(p[2*j+1].X, p[2*j+1].X);
+      fe_neg(p[2*j+1].T, p[2*j+1].T);
+
+      randombytes_buf(z, 16);
+      crypto_core_ristretto255_scalar_mul(t, z, sig + 32);
+      crypto_core_ristretto255_scalar_add(sum, sum, t);
+      ristretto255_recode(z, e[2*j]);
+      crypto_core_ristretto255_scalar_mul(k, k, z);
+      ristretto255_recode(k, e[2*j+1]);
+    }
+    ge_msm_chunk_vartime(&h, 2*len, e, p);
+    ge_p3_to_cached(&c, &h);
+    ge_add(&acc, &acc, &c);
+  }
+
+  if(ed25519_decode_vartime(&p[0], ed25519_B) != 0) return -1;
+  ristretto255_recode(sum, e[0]);
+  ge_msm_chunk_vartime(&h, 1, e, p);
+  ge_p3_to_cached(&c, &h);
+  ge_add(&acc, &acc, &c);
+
+  // clear the cofactor
+  ge_dbl(&acc, &acc, 0);
+  ge_dbl(&acc, &acc, 0);
+  ge_dbl(&acc, &acc, 1);
+  return ge_is_identity(&acc) ? 0 : -1;
+#else
+  // one by one, but with the same cofactored equation as the batch
+  uint8_t k[crypto_core_ristretto255_SCALARBYTES];
+  crypto_hash_sha512_state hs;
+  for(size_t i=0;i<n;i++) {
+    if(hrams!=NULL) {
+      memcpy(k, hrams[i], sizeof k);
+    } else {
+      ed25519_hram_init(&hs, sigs[i], pks[i]);
+      crypto_hash_sha512_update(&hs, msgs[i], msg_lens[i]);
+      ed25519_hram_final(&hs, k);
+    }
+    if(verify_one(sigs[i], k, pks[i]) != 0) return -1;
+  }
+  return 0;
+#endif
+}
+
+int ed25519_verify(const uint8_t sig[crypto_sign_BYTES],
+                   const uint8_t *msg,
+                   const size_t msg_len,
+                   const uint8_t pk[crypto_sign_PUBLICKEYBYTES]) {
+  uint8_t k[1][crypto_core_ristretto255_SCALARBYTES];
+  crypto_hash_sha512_state hs;
+  ed25519_hram_init(&hs, sig, pk);
+  crypto_hash_sha512_update(&hs, msg, msg_len);
+  ed25519_hram_final(&hs, k[0]);
+  return verify_batch(1, &msg, &msg_len, (const uint8_t (*)[crypto_core_ristretto255_SCALARBYTES]) k, &sig, &pk);
+}
+
+int ed25519_verify_batch(const size_t n,
+                         const uint8_t *const msgs[n],
+                         const size_t msg_lens[n],
+                         const uint8_t *const sigs[n],
+                         const uint8_t *const pks[n]) {
+  return verify_batch(n, msgs, msg_lens, NULL, sigs, pks);
+}
+
+int ed25519_verify_batch_hram(const size_t n,
+                              const uint8_t hrams[n][crypto_core_ristretto255_SCALARBYTES],
+                              const uint8_t *const sigs[n],
+                              const uint8_t *const pks[n]) {
+  return verify_batch(n, NULL, NULL, hrams, sigs, pks);
+}
@@ -0,0 +1,211 @@
+/*
+    @copyright 2024, Stefan Marsiske toprf@ctrlc.hu
+    This file is part of liboprf.
+
+    liboprf is free software: you can redistribute it and/or
+    modify it under the terms of the GNU Lesser General Public License
+    as published by the Free Software Foundation, either version 3 of
+    the License, or (at your option) any later version.
+
+    liboprf is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Lesser General Public License for more details.
+
+    You should have received a copy of the License
+    along with liboprf. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef RISTRETTO255_H
+#define RISTRETTO255_H
+
+#include <sodium.h>
+#include <stdint.h>
+
+/*
+ * ristretto255 group operations that libsodium does not provide.
+ */
+
+// the number of points ristretto255_msm() processes in one pass
+#define ristretto255_MSM_CHUNK 32
+
+/**
+ * Constant time multi-scalar multiplication, computes
+ * q = scalars[0]*points[0] + ... + scalars[n-1]*points[n-1]
+ *
+ * This is a lot cheaper than n calls to
+ * crypto_scalarmult_ristretto255() and adding the results, since the
+ * doublings are shared among ristretto255_MSM_CHUNK points.
+ *
+ * Like with crypto_scalarmult_ristretto255() the top bit of the
+ * scalars is ignored. Unlike crypto_scalarmult_ristretto255() the
+ * identity element is a valid result and also a valid input point.
+ *
+ * @param [out] q - the resulting point
+ * @param [in] n - the number of scalars and points
+ * @param [in] scalars - the array of scalars
+ * @param [in] points - the array of points
+ * @return The function returns 0 if everything is correct, -1 if any
+ *         of the points is invalid.
+ */
+int ristretto255_msm(uint8_t q[crypto_core_ristretto255_BYTES],
+                     const size_t n,
+                     const uint8_t scalars[n][crypto_core_ristretto255_SCALARBYTES],
+                     const uint8_t points[n][crypto_core_ristretto255_BYTES]);
+
+/**
+ * Variable time multi-scalar multiplication, the result is the same
+ * as from ristretto255_msm().
+ *
+ * This must only be used if all the scalars and points are public,
+ * like the commitments of a DKG and the powers of the public index of
+ * a peer, or the values of a proof being verified: the running time
+ * and the memory accesses depend on the scalars. In exchange the
+ * scalars are recoded into sliding windows, which have about half as
+ * many non-zero digits, and short scalars need fewer doublings.
+ *
+ * @param [out] q - the resulting point
+ * @param [in] n - the number of scalars and points
+ * @param [in] scalars - the array of public scalars
+ * @param [in] points - the array of public points
+ * @return The function returns 0 if everything is correct, -1 if any
+ *         of the points is invalid.
+ */
+int ristretto255_msm_vartime(uint8_t q[crypto_core_ristretto255_BYTES],
+                             const size_t n,
+                             const uint8_t scalars[n][crypto_core_ristretto255_SCALARBYTES],
+                             const uint8_t points[n][crypto_core_ristretto255_BYTES]);
+
+/**
+ * A point together with the multiples ristretto255_msm() needs. A
+ * point that arrives before the scalar it will be multiplied with is
+ * known can be decoded and prepared ahead with
+ * ristretto255_table_init(), and the multi-scalar multiplication
+ * done later by ristretto255_msm_tables() costs only the additions
+ * and doublings.
+ */
+typedef struct {
+  uint64_t opaque[160];
+} ristretto255_table;
+
+/**
+ * Prepares a point for ristretto255_msm_tables().
+ *
+ * @param [out] t - the prepared point
+ * @param [in] p - the point to prepare
+ * @return The function returns 0 if everything is correct, -1 if p is
+ *         not a valid point.
+ */
+int ristretto255_table_init(ristretto255_table *t, const uint8_t p[crypto_core_ristretto255_BYTES]);
+
+/**
+ * Same as ristretto255_msm() but with points prepared by
+ * ristretto255_table_init().
+ *
+ * @param [out] q - the resulting point
+ * @param [in] n - the number of scalars and points
+ * @param [in] scalars - the array of scalars
+ * @param [in] tables - the prepared points
+ * @return The function returns 0 if everything is correct.
+ */
+int ristretto255_msm_tables(uint8_t q[crypto_core_ristretto255_BYTES],
+                            const size_t n,
+                            const uint8_t scalars[n][crypto_core_ristretto255_SCALARBYTES],
+                            const ristretto255_table tables[n]);
+
+/**
+ * Verifies n Ed25519 signatures at once, the message msgs[i] of
+ * length msg_lens[i] must carry the signature sigs[i] made by the
+ * public key pks[i].
+ *
+ * The signatures are combined with random 128 bit weights and checked
+ * with a single multi-scalar multiplication, which is a few times
+ * cheaper than n calls to crypto_sign_verify_detached(). Since all
+ * inputs are public, this function runs in variable time. The batch
+ * equation is cofactored, so unlike crypto_sign_verify_detached() it
+ * also accepts signatures where R or the public key has a torsion
+ * component, this can only be crafted by the owner of the signing
+ * key. Non-canonical encodings and points of small order are rejected
+ * just like by libsodium. Builds without 128 bit integers check the
+ * signatures one by one, with the same cofactored equation.
+ *
+ * A failed batch does not tell which signature is invalid, the caller
+ * needs to check them one by one with ed25519_verify() to find the
+ * culprit. Mixing this with crypto_sign_verify_detached() would
+ * accept a signature with a torsion component in one place and
+ * reject it in another.
+ *
+ * @param [in] n - the number of signatures
+ * @param [in] msgs - the signed messages
+ * @param [in] msg_lens - the lengths of the signed messages
+ * @param [in] sigs - the 64 byte signatures
+ * @param [in] pks - the 32 byte public keys
+ * @return The function returns 0 if all signatures are valid, -1
+ *         otherwise.
+ */
+int ed25519_verify_batch(const size_t n,
+                         const uint8_t *const msgs[n],
+                         const size_t msg_lens[n],
+                         const uint8_t *const sigs[n],
+                         const uint8_t *const pks[n]);
+
+/**
+ * Verifies a single Ed25519 signature with the same rules as
+ * ed25519_verify_batch(), use this instead of
+ * crypto_sign_verify_detached() wherever the same signatures might
+ * also be checked in a batch.
+ *
+ * @param [in] sig - the 64 byte signature
+ * @param [in] msg - the signed message
+ * @param [in] msg_len - the length of the signed message
+ * @param [in] pk - the 32 byte public key
+ * @return The function returns 0 if the signature is valid, -1
+ *         otherwise.
+ */
+int ed25519_verify(const uint8_t sig[crypto_sign_BYTES],
+                   const uint8_t *msg,
+                   const size_t msg_len,
+                   const uint8_t pk[crypto_sign_PUBLICKEYBYTES]);
+
+/**
+ * Starts computing k = H(R || A || M) of an Ed25519 signature for
+ * ed25519_verify_batch_hram(), the message is then fed with
+ * crypto_hash_sha512_update() in as many pieces as convenient. This
+ * allows hashing a message at the same time as doing other work on
+ * it, for example extracting or hashing parts of it.
+ *
+ * @param [out] state - the hash state
+ * @param [in] sig - the signature, the first half of which is R
+ * @param [in] pk - the public key A
+ */
+void ed25519_hram_init(crypto_hash_sha512_state *state,
+                       const uint8_t sig[crypto_sign_BYTES],
+                       const uint8_t pk[crypto_sign_PUBLICKEYBYTES]);
+
+/**
+ * Finishes the hash started with ed25519_hram_init().
+ *
+ * @param [in] state - the hash state
+ * @param [out] k - the reduced hash
+ */
+void ed25519_hram_final(crypto_hash_sha512_state *state,
+                        uint8_t k[crypto_core_ristretto255_SCALARBYTES]);
+
+/**
+ * Same as ed25519_verify_batch(), but instead of the messages takes
+ * their hashes computed with ed25519_hram_init() and
+ * ed25519_hram_final().
+ *
+ * @param [in] n - the number of signatures
+ * @param [in] hrams - the hashes of the signed messages
+ * @param [in] sigs - the 64 byte signatures
+ * @param [in] pks - the 32 byte public keys
+ * @return The function returns 0 if all signatures are valid, -1
+ *         otherwise.
+ */
+int ed25519_verify_batch_hram(const size_t n,
+                              const uint8_t hrams[n][crypto_core_ristretto255_SCALARBYTES],
+                              const uint8_t *const sigs[n],
+                              const uint8_t *const pks[n]);
+
+#endif // RISTRETTO255_H
@@ -0,0 +1,147 @@
+/*
+    @copyright 2024, Stefan Marsiske toprf@ctrlc.hu
+    This file is part of liboprf.
+
+    liboprf is free software: you can redistribute it and/or
+    modify it under the terms of the GNU Lesser General Public License
+    as published by the Free Software Foundation, either version 3 of
+    the License, or (at your option) any later version.
+
+    liboprf is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Lesser General Public License for more details.
+
+    You should have received a copy of the License
+    along with liboprf. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sodium.h>
+#include "scratch.h"
+
+// the alignment of the buffers handed out
+#define SCRATCH_ALIGN 16
+
+// webassembly has neither guard pages nor memory locking, see oprf.h
+#ifdef __EMSCRIPTEN__
+#define OPRF_NO_SCRATCH
+#endif
+
+#ifndef OPRF_NO_SCRATCH
+
+typedef struct {
+  // the whole mapping, including the guard pages
+  uint8_t *map;
+  size_t map_len;
+  // the locked pages between the guard pages
+  uint8_t *base;
+  size_t top;
+} Arena;
+
+static __thread Arena *arena = NULL;
+// set if the arena of this thread could not be set up, so that it is
+// not retried on every call
+static __thread int arena_failed = 0;
+static pthread_key_t arena_key;
+static pthread_once_t arena_once = PTHREAD_ONCE_INIT;
+static int arena_key_ok = 0;
+
+static void arena_free(void *arg) {
+  Arena *a = arg;
+  sodium_memzero(a->base, OPRF_SCRATCH_BYTES);
+  munlock(a->base, OPRF_SCRATCH_BYTES);
+  munmap(a->map, a->map_len);
+  free(a);
+}
+
+static void arena_key_init(void) {
+  arena_key_ok = (pthread_key_create(&arena_key, arena_free) == 0);
+}
+
+static Arena *arena_new(void) {
+  pthread_once(&arena_once, arena_key_init);
+  if(!arena_key_ok) return NULL;
+
+  const long page = sysconf(_SC_PAGESIZE);
+  if(page <= 0) return NULL;
+  const size_t page_len = (size_t) page;
+  const size_t len = (OPRF_SCRATCH_BYTES + page_len - 1) / page_len * page_len;
+
+  Arena *a = malloc(sizeof(Arena));
+  if(a==NULL) return NULL;
+  a->map_len = len + 2 * page_len;
+  a->map = mmap(NULL, a->map_len, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if(a->map==MAP_FAILED) goto fail_map;
+  a->base = a->map + page_len;
+  a->top = 0;
+  if(mprotect(a->base, len, PROT_READ | PROT_WRITE)) goto fail;
+  if(mlock(a->base, len)) goto fail;
+#ifdef MADV_DONTDUMP
+  madvise(a->base, len, MADV_DONTDUMP);
+#endif
+  if(pthread_setspecific(arena_key, a)) {
+    munlock(a->base, len);
+    goto fail;
+  }
+  return a;
+
+fail:
+  munmap(a->map, a->map_len);
+fail_map:
+  free(a);
+  return NULL;
+}
+
+static int in_arena(const Arena *a, const uint8_t *p) {
+  return a!=NULL && p >= a->base && p < a->base + OPRF_SCRATCH_BYTES;
+}
+
+#endif // OPRF_NO_SCRATCH
+
+void *oprf_scratch_push(const size_t len) {
+#ifndef OPRF_NO_SCRATCH
+  if(arena==NULL && !arena_failed) {
+    arena = arena_new();
+    arena_failed = (arena==NULL);
+  }
+  const size_t aligned = (len + SCRATCH_ALIGN - 1) & ~((size_t) SCRATCH_ALIGN - 1);
+  if(arena!=NULL && aligned >= len && aligned <= OPRF_SCRATCH_BYTES - arena->top) {
+    void *p = arena->base + arena->top;
+    arena->top += aligned;
+    return p;
+  }
+#endif
+  // the behaviour without the arena, a heap buffer locked on its own
+  void *p = malloc(len ? len : 1);
+  if(p==NULL) return NULL;
+#ifndef __EMSCRIPTEN__
+  if(sodium_mlock(p, len)!=0) {
+    free(p);
+    return NULL;
+  }
+#endif
+  return p;
+}
+
+void oprf_scratch_pop(void *p, const size_t len) {
+  if(p==NULL) return;
+#ifndef OPRF_NO_SCRATCH
+  if(in_arena(arena, p)) {
+    sodium_memzero(p, len);
+    arena->top = (size_t) ((uint8_t*) p - arena->base);
+    return;
+  }
+#endif
+  // sodium_munlock() wipes the buffer before unlocking it
+#ifdef __EMSCRIPTEN__
+  sodium_memzero(p, len);
+#else
+  sodium_munlock(p, len);
+#endif
+  free(p);
+}
@@ -0,0 +1,58 @@
+/*
+    @copyright 2024, Stefan Marsiske toprf@ctrlc.hu
+    This file is part of liboprf.
+
+    liboprf is free software: you can redistribute it and/or
+    modify it under the terms of the GNU Lesser General Public License
+    as published by the Free Software Foundation, either version 3 of
+    the License, or (at your option) any later version.
+
+    liboprf is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Lesser General Public License for more details.
+
+    You should have received a copy of the License
+    along with liboprf. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef SCRATCH_H
+#define SCRATCH_H
+
+#include <stddef.h>
+
+/*
+ * Locked scratch memory for the sensitive temporaries of the
+ * primitives.
+ *
+ * Locking a stack buffer with sodium_mlock() and unlocking it again
+ * costs two syscalls per call, more than the hashing most of the
+ * primitives do. Instead every thread gets an arena on its first use,
+ * which is locked once, surrounded by guard pages and excluded from
+ * core dumps, and buffers are handed out from it like from a stack:
+ * they must be released in the reverse order of their allocation.
+ * Released buffers are wiped, the arena itself is wiped and unmapped
+ * when the thread exits.
+ *
+ * If the arena can not be set up - for example because of
+ * RLIMIT_MEMLOCK - or a buffer does not fit, the buffer is allocated
+ * on the heap and locked with sodium_mlock(), as is every buffer when
+ * compiled with -DOPRF_NO_SCRATCH (make NO_SCRATCH=1).
+ */
+
+// the usable size of the arena of each thread
+#define OPRF_SCRATCH_BYTES 16384
+
+/*
+ * Returns len bytes of locked memory for the calling thread, or NULL
+ * if none can be allocated. The memory is not initialized.
+ */
+void *oprf_scratch_push(const size_t len);
+
+/*
+ * Wipes and releases the buffer p of len bytes returned by the last
+ * not yet released oprf_scratch_push() of the calling thread.
+ */
+void oprf_scratch_pop(void *p, const size_t len);
+
+#endif // SCRATCH_H
@@ -0,0 +1,102 @@
+/*
+    @copyright 2024, Stefan Marsiske toprf@ctrlc.hu
+    This file is part of liboprf.
+
+    liboprf is free software: you can redistribute it and/or
+    modify it under the terms of the GNU Lesser General Public License
+    as published by the Free Software Foundation, either version 3 of
+    the License, or (at your option) any later version.
+
+    liboprf is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Lesser General Public License for more details.
+
+    You should have received a copy of the License
+    along with liboprf. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/*
+ * The SHA-512 compression function over LANES independent lanes,
+ * included by sha512mb.c once for each backend with these defined:
+ *
+ *  LANES  - the number of 64 bit words in a vector
+ *  KERNEL - the name of the function to define
+ *  TARGET - the function attributes selecting the instruction set
+ *
+ * Each lane is one uint64_t element of a gcc vector, so the compiler
+ * emits the SIMD instructions for the target on its own.
+ */
+
+#define KERNEL_CAT_(a,b) a##b
+#define KERNEL_CAT(a,b) KERNEL_CAT_(a,b)
+#define KERNEL_V KERNEL_CAT(KERNEL,_v)
+typedef uint64_t KERNEL_V __attribute__ ((vector_size (LANES*8)));
+
+#define ROTR(x,n) (((x) >> (n)) | ((x) << (64-(n))))
+#define S0(x) (ROTR((x),28) ^ ROTR((x),34) ^ ROTR((x),39))
+#define S1(x) (ROTR((x),14) ^ ROTR((x),18) ^ ROTR((x),41))
+#define s0(x) (ROTR((x),1) ^ ROTR((x),8) ^ ((x) >> 7))
+#define s1(x) (ROTR((x),19) ^ ROTR((x),61) ^ ((x) >> 6))
+#define CH(x,y,z) (((x) & ((y) ^ (z))) ^ (z))
+#define MAJ(x,y,z) (((x) & ((y) | (z))) | ((y) & (z)))
+
+TARGET static void KERNEL(Lane *const lanes[], const unsigned count) {
+  KERNEL_V h[8], w[16];
+  unsigned i, l, t;
+  for(i=0;i<8;i++) {
+    for(l=0;l<LANES;l++) h[i][l] = (l<count) ? lanes[l]->h[i] : 0;
+  }
+
+  for(;;) {
+    const uint8_t *blk[LANES];
+    KERNEL_V mask;
+    int active = 0;
+    for(l=0;l<LANES;l++) {
+      blk[l] = (l<count) ? lane_next(lanes[l]) : NULL;
+      if(blk[l]!=NULL) {
+        mask[l] = ~(uint64_t)0;
+        active = 1;
+      } else {
+        // finished lanes hash zeros and keep their state
+        mask[l] = 0;
+        blk[l] = zero_block;
+      }
+    }
+    if(!active) break;
+
+    for(t=0;t<16;t++) {
+      for(l=0;l<LANES;l++) w[t][l] = load64_be(blk[l] + 8*t);
+    }
+
+    KERNEL_V a=h[0], b=h[1], c=h[2], d=h[3], e=h[4], f=h[5], g=h[6], hh=h[7];
+    for(t=0;t<80;t++) {
+      if(t>=16) {
+        w[t&15] += s1(w[(t-2)&15]) + w[(t-7)&15] + s0(w[(t-15)&15]);
+      }
+      const KERNEL_V t1 = hh + S1(e) + CH(e,f,g) + K[t] + w[t&15];
+      const KERNEL_V t2 = S0(a) + MAJ(a,b,c);
+      hh = g; g = f; f = e; e = d + t1;
+      d = c; c = b; b = a; a = t1 + t2;
+    }
+    h[0] += a & mask; h[1] += b & mask; h[2] += c & mask; h[3] += d & mask;
+    h[4] += e & mask; h[5] += f & mask; h[6] += g & mask; h[7] += hh & mask;
+  }
+
+  for(i=0;i<8;i++) {
+    for(l=0;l<count;l++) lanes[l]->h[i] = h[i][l];
+  }
+  sodium_memzero(h, sizeof h);
+  sodium_memzero(w, sizeof w);
+}
+
+#undef KERNEL_CAT_
+#undef KERNEL_CAT
+#undef KERNEL_V
+#undef ROTR
+#undef S0
+#undef S1
+#undef s0
+#undef s1
+#undef CH
+#undef MAJ
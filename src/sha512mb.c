@@ -0,0 +1,249 @@
+/*
+    @copyright 2024, Stefan Marsiske toprf@ctrlc.hu
+    This file is part of liboprf.
+
+    liboprf is free software: you can redistribute it and/or
+    modify it under the terms of the GNU Lesser General Public License
+    as published by the Free Software Foundation, either version 3 of
+    the License, or (at your option) any later version.
+
+    liboprf is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Lesser General Public License for more details.
+
+    You should have received a copy of the License
+    along with liboprf. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <stdint.h>
+#include <string.h>
+#include <sodium.h>
+#include "sha512mb.h"
+
+static const uint64_t K[80] = {
+  0x428a2f98d728ae22ULL, 0x7137449123ef65cdULL, 0xb5c0fbcfec4d3b2fULL, 0xe9b5dba58189dbbcULL,
+  0x3956c25bf348b538ULL, 0x59f111f1b605d019ULL, 0x923f82a4af194f9bULL, 0xab1c5ed5da6d8118ULL,
+  0xd807aa98a3030242ULL, 0x12835b0145706fbeULL, 0x243185be4ee4b28cULL, 0x550c7dc3d5ffb4e2ULL,
+  0x72be5d74f27b896fULL, 0x80deb1fe3b1696b1ULL, 0x9bdc06a725c71235ULL, 0xc19bf174cf692694ULL,
+  0xe49b69c19ef14ad2ULL, 0xefbe4786384f25e3ULL, 0x0fc19dc68b8cd5b5ULL, 0x240ca1cc77ac9c65ULL,
+  0x2de92c6f592b0275ULL, 0x4a7484aa6ea6e483ULL, 0x5cb0a9dcbd41fbd4ULL, 0x76f988da831153b5ULL,
+  0x983e5152ee66dfabULL, 0xa831c66d2db43210ULL, 0xb00327c898fb213fULL, 0xbf597fc7beef0ee4ULL,
+  0xc6e00bf33da88fc2ULL, 0xd5a79147930aa725ULL, 0x06ca6351e003826fULL, 0x142929670a0e6e70ULL,
+  0x27b70a8546d22ffcULL, 0x2e1b21385c26c926ULL, 0x4d2c6dfc5ac42aedULL, 0x53380d139d95b3dfULL,
+  0x650a73548baf63deULL, 0x766a0abb3c77b2a8ULL, 0x81c2c92e47edaee6ULL, 0x92722c851482353bULL,
+  0xa2bfe8a14cf10364ULL, 0xa81a664bbc423001ULL, 0xc24b8b70d0f89791ULL, 0xc76c51a30654be30ULL,
+  0xd192e819d6ef5218ULL, 0xd69906245565a910ULL, 0xf40e35855771202aULL, 0x106aa07032bbd1b8ULL,
+  0x19a4c116b8d2d0c8ULL, 0x1e376c085141ab53ULL, 0x2748774cdf8eeb99ULL, 0x34b0bcb5e19b48a8ULL,
+  0x391c0cb3c5c95a63ULL, 0x4ed8aa4ae3418acbULL, 0x5b9cca4f7763e373ULL, 0x682e6ff3d6b2b8a3ULL,
+  0x748f82ee5defb2fcULL, 0x78a5636f43172f60ULL, 0x84c87814a1f0ab72ULL, 0x8cc702081a6439ecULL,
+  0x90befffa23631e28ULL, 0xa4506cebde82bde9ULL, 0xbef9a3f7b2c67915ULL, 0xc67178f2e372532bULL,
+  0xca273eceea26619cULL, 0xd186b8c721c0c207ULL, 0xeada7dd6cde0eb1eULL, 0xf57d4f7fee6ed178ULL,
+  0x06f067aa72176fbaULL, 0x0a637dc5a2c898a6ULL, 0x113f9804bef90daeULL, 0x1b710b35131c471bULL,
+  0x28db77f523047d84ULL, 0x32caab7b40c72493ULL, 0x3c9ebe0a15c9bebcULL, 0x431d67c49c100d4cULL,
+  0x4cc5d4becb3e42b6ULL, 0x597f299cfc657e2aULL, 0x5fcb6fab3ad6faecULL, 0x6c44198c4a475817ULL
+};
+
+static const uint64_t IV[8] = {
+  0x6a09e667f3bcc908ULL, 0xbb67ae8584caa73bULL, 0x3c6ef372fe94f82bULL, 0xa54ff53a5f1d36f1ULL,
+  0x510e527fade682d1ULL, 0x9b05688c2b3e6c1fULL, 0x1f83d9abfb41bd6bULL, 0x5be0cd19137e2179ULL
+};
+
+static const uint8_t zero_block[128] = {0};
+
+static inline uint64_t load64_be(const uint8_t *p) {
+  return ((uint64_t) p[0] << 56) | ((uint64_t) p[1] << 48) | ((uint64_t) p[2] << 40) | ((uint64_t) p[3] << 32) |
+         ((uint64_t) p[4] << 24) | ((uint64_t) p[5] << 16) | ((uint64_t) p[6] << 8) | (uint64_t) p[7];
+}
+
+static inline void store64_be(uint8_t *p, const uint64_t x) {
+  for(int i=0;i<8;i++) p[i] = (uint8_t) (x >> (56 - 8*i));
+}
+
+// one message being hashed, hands out its padded blocks one by one
+typedef struct {
+  uint64_t h[8];
+  const sha512mb_Msg *msg;
+  unsigned seg;
+  size_t off;
+  // the total length of the message in bits, including the prefix absorbed by init
+  uint64_t bits;
+  // 1 once the 0x80 terminator has been written
+  int padded;
+  int done;
+  uint8_t buf[128];
+} Lane;
+
+static void lane_start(Lane *l, const sha512mb_Msg *msg, const crypto_hash_sha512_state *init) {
+  l->msg = msg;
+  l->seg = 0;
+  l->off = 0;
+  l->padded = 0;
+  l->done = 0;
+  uint64_t bits = 0;
+  if(init!=NULL) {
+    memcpy(l->h, init->state, sizeof l->h);
+    bits = init->count[1];
+  } else {
+    memcpy(l->h, IV, sizeof l->h);
+  }
+  for(unsigned i=0;i<sha512mb_SEGMENTS;i++) bits += (uint64_t) msg->len[i] << 3;
+  l->bits = bits;
+}
+
+// returns the next block of the padded message, or NULL if all have been returned
+static const uint8_t* lane_next(Lane *l) {
+  if(l->done) return NULL;
+  const sha512mb_Msg *m = l->msg;
+  while(l->seg<sha512mb_SEGMENTS && l->off==m->len[l->seg]) {
+    l->seg++;
+    l->off = 0;
+  }
+  // full blocks are hashed in place
+  if(l->seg<sha512mb_SEGMENTS && m->len[l->seg] - l->off >= 128) {
+    const uint8_t *p = m->seg[l->seg] + l->off;
+    l->off += 128;
+    return p;
+  }
+  size_t fill = 0;
+  if(!l->padded) {
+    // the rest of this segment and the start of the following ones
+    while(fill<128 && l->seg<sha512mb_SEGMENTS) {
+      size_t take = m->len[l->seg] - l->off;
+      if(take > 128 - fill) take = 128 - fill;
+      memcpy(l->buf + fill, m->seg[l->seg] + l->off, take);
+      fill += take;
+      l->off += take;
+      if(l->off==m->len[l->seg]) {
+        l->seg++;
+        l->off = 0;
+      }
+    }
+    if(fill==128) return l->buf;
+    l->buf[fill++] = 0x80;
+    l->padded = 1;
+  }
+  memset(l->buf + fill, 0, 128 - fill);
+  if(fill<=112) {
+    // the upper 64 bits of the 128 bit length are always 0 here
+    store64_be(l->buf + 120, l->bits);
+    l->done = 1;
+  }
+  return l->buf;
+}
+
+typedef void (*kernel_fn)(Lane *const lanes[], const unsigned count);
+
+#if (defined __GNUC__ && (defined __x86_64__ || defined __aarch64__)) || defined __wasm_simd128__
+
+#if defined __x86_64__
+#define LANES 4
+#define KERNEL kernel_avx2
+#define TARGET __attribute__ ((target ("avx2")))
+#include "sha512mb-kernel.h"
+#undef LANES
+#undef KERNEL
+#undef TARGET
+
+#define LANES 8
+#define KERNEL kernel_avx512
+#define TARGET __attribute__ ((target ("avx512f")))
+#include "sha512mb-kernel.h"
+#undef LANES
+#undef KERNEL
+#undef TARGET
+#elif defined __aarch64__ // neon is always available
+#define LANES 2
+#define KERNEL kernel_neon
+#define TARGET
+#include "sha512mb-kernel.h"
+#undef LANES
+#undef KERNEL
+#undef TARGET
+#else // __wasm_simd128__, built with -msimd128, see make wasm
+#define LANES 2
+#define KERNEL kernel_simd128
+#define TARGET
+#include "sha512mb-kernel.h"
+#undef LANES
+#undef KERNEL
+#undef TARGET
+#endif
+
+#endif
+
+static struct {
+  unsigned lanes;
+  kernel_fn fn;
+} backend = {0, NULL};
+
+unsigned sha512mb_set_lanes(const unsigned max_lanes) {
+  const unsigned max = (max_lanes==0) ? ~0u : max_lanes;
+  backend.lanes = 1;
+  backend.fn = NULL;
+#if (defined __GNUC__ && defined __x86_64__)
+  __builtin_cpu_init();
+  if(max>=8 && __builtin_cpu_supports("avx512f")) {
+    backend.lanes = 8;
+    backend.fn = kernel_avx512;
+  } else if(max>=4 && __builtin_cpu_supports("avx2")) {
+    backend.lanes = 4;
+    backend.fn = kernel_avx2;
+  }
+#elif (defined __GNUC__ && defined __aarch64__)
+  if(max>=2) {
+    backend.lanes = 2;
+    backend.fn = kernel_neon;
+  }
+#elif defined __wasm_simd128__
+  if(max>=2) {
+    backend.lanes = 2;
+    backend.fn = kernel_simd128;
+  }
+#else
+  (void) max;
+#endif
+  return backend.lanes;
+}
+
+unsigned sha512mb_lanes(void) {
+  if(backend.lanes==0) sha512mb_set_lanes(0);
+  return backend.lanes;
+}
+
+static void sha512_one(const sha512mb_Msg *msg, const crypto_hash_sha512_state *init,
+                       uint8_t out[crypto_hash_sha512_BYTES]) {
+  crypto_hash_sha512_state state;
+  if(init!=NULL) memcpy(&state, init, sizeof state);
+  else crypto_hash_sha512_init(&state);
+  for(unsigned i=0;i<sha512mb_SEGMENTS;i++) {
+    if(msg->len[i]>0) crypto_hash_sha512_update(&state, msg->seg[i], (unsigned long long) msg->len[i]);
+  }
+  crypto_hash_sha512_final(&state, out);
+  sodium_memzero(&state, sizeof state);
+}
+
+void sha512mb(const size_t n, const sha512mb_Msg msgs[n],
+              const crypto_hash_sha512_state *init,
+              uint8_t out[n][crypto_hash_sha512_BYTES]) {
+  const unsigned lanes = sha512mb_lanes();
+  size_t i = 0;
+  // the kernels can only continue from states without buffered input
+  if(backend.fn!=NULL && (init==NULL || (init->count[0]==0 && (init->count[1] & 1023)==0))) {
+    Lane lane[8], *lp[8];
+    for(;i + 1 < n;i += lanes) {
+      unsigned count = (n - i < lanes) ? (unsigned) (n - i) : lanes;
+      for(unsigned l=0;l<count;l++) {
+        lane_start(&lane[l], &msgs[i+l], init);
+        lp[l] = &lane[l];
+      }
+      backend.fn(lp, count);
+      for(unsigned l=0;l<count;l++) {
+        for(unsigned j=0;j<8;j++) store64_be(out[i+l] + 8*j, lane[l].h[j]);
+      }
+    }
+    sodium_memzero(lane, sizeof lane);
+  }
+  // a single message is not worth the transposition
+  for(;i<n;i++) sha512_one(&msgs[i], init, out[i]);
+}
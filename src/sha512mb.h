@@ -0,0 +1,84 @@
+/*
+    @copyright 2024, Stefan Marsiske toprf@ctrlc.hu
+    This file is part of liboprf.
+
+    liboprf is free software: you can redistribute it and/or
+    modify it under the terms of the GNU Lesser General Public License
+    as published by the Free Software Foundation, either version 3 of
+    the License, or (at your option) any later version.
+
+    liboprf is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Lesser General Public License for more details.
+
+    You should have received a copy of the License
+    along with liboprf. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef SHA512MB_H
+#define SHA512MB_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <sodium.h>
+
+/*
+ * Multi-buffer SHA-512: hashes many independent messages at once, 4
+ * per AVX2 or 8 per AVX-512 instruction stream on x86_64, 2 per NEON
+ * register on arm64. The backend is selected at runtime, without SIMD
+ * support every message is hashed by libsodium.
+ *
+ * This is used internally by the batch hash-to-group and finalize
+ * functions of oprf.h, the results are always the same as those of
+ * crypto_hash_sha512().
+ */
+
+#define sha512mb_SEGMENTS 3
+
+/**
+ * A message to hash, the concatenation of up to sha512mb_SEGMENTS
+ * buffers, so that prefixes and suffixes need not be copied next to
+ * the data. Unused segments must have a length of 0.
+ */
+typedef struct {
+  const uint8_t *seg[sha512mb_SEGMENTS];
+  size_t len[sha512mb_SEGMENTS];
+} sha512mb_Msg;
+
+/**
+ * Hashes n messages.
+ *
+ * Messages are processed in groups of as many as the backend has
+ * lanes, a group takes as long as its longest message, so batches of
+ * similarly sized messages are the most efficient.
+ *
+ * @param [in] n - the number of messages
+ * @param [in] msgs - the messages
+ * @param [in] init - if not NULL, all messages continue from this
+ *        state, which must have absorbed a multiple of 128 bytes, as
+ *        for example the Z_pad midstate of expand_message_xmd()
+ * @param [out] out - the n digests
+ */
+void sha512mb(const size_t n, const sha512mb_Msg msgs[n],
+              const crypto_hash_sha512_state *init,
+              uint8_t out[n][crypto_hash_sha512_BYTES]);
+
+/**
+ * Returns the number of lanes of the selected backend, 1 if the
+ * libsodium fallback is used.
+ */
+unsigned sha512mb_lanes(void);
+
+/**
+ * Selects the widest backend supported by the cpu with at most
+ * max_lanes lanes, 0 restores the automatic selection. Meant for
+ * tests and benchmarks, not thread-safe.
+ *
+ * @param [in] max_lanes - the maximum number of lanes, 1 forces the
+ *        libsodium fallback
+ * @return The function returns the number of lanes of the selected backend.
+ */
+unsigned sha512mb_set_lanes(const unsigned max_lanes);
+
+#endif // SHA512MB_H
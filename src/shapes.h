@@ -0,0 +1,66 @@
+/*
+    @copyright 2024, Stefan Marsiske toprf@ctrlc.hu
+    This file is part of liboprf.
+
+    liboprf is free software: you can redistribute it and/or
+    modify it under the terms of the GNU Lesser General Public License
+    as published by the Free Software Foundation, either version 3 of
+    the License, or (at your option) any later version.
+
+    liboprf is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Lesser General Public License for more details.
+
+    You should have received a copy of the License
+    along with liboprf. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+#ifndef SHAPES_H
+#define SHAPES_H
+
+#include <stdint.h>
+
+/*
+ * The (n, threshold) configurations that get their own specialized
+ * kernels, as X(n, threshold) entries.
+ *
+ * For each entry toprf.c and dkg.c instantiate the generic code of
+ * share creation, the lagrange coefficients, the combination of
+ * parts and the verification of commitments with constant sizes, so
+ * that the compiler unrolls the loops and every buffer has a fixed
+ * size on the stack. The public functions dispatch to these when
+ * their arguments match an entry, everything else takes the generic
+ * path. The coefficients and the combination only depend on the
+ * threshold, so they are picked by the threshold alone.
+ *
+ * Because the threshold is small the products of the indexes and of
+ * their differences - and the powers of an index - fit into 64 bits,
+ * which the specialized kernels use instead of scalar
+ * multiplications. This is why the threshold of an entry can be at
+ * most TOPRF_SHAPE_MAX_T.
+ *
+ * The default covers 2-of-3, 3-of-5 and 7-of-11, other sets can be
+ * configured with make SHAPES="X(4,3) X(9,5)", and none with make
+ * SHAPES=none.
+ */
+#ifndef TOPRF_SHAPES
+#define TOPRF_SHAPES(X) X(3,2) X(5,3) X(11,7)
+#endif
+
+// 255^7 < 2^64, the largest product of 7 indexes or differences
+#define TOPRF_SHAPE_MAX_T 8
+
+#define TOPRF_SHAPE_CHECK(N,T) \
+  _Static_assert((T)>=1 && (T)<=TOPRF_SHAPE_MAX_T && (N)>=(T) && (N)<=255, "invalid entry in TOPRF_SHAPES");
+
+// stores a 64 bit value as a little endian scalar
+static inline void toprf_shape_scalar(uint8_t s[32], uint64_t v) {
+  for(int i=0;i<32;i++) {
+    s[i] = (uint8_t) v;
+    v >>= 8;
+  }
+}
+
+#endif // SHAPES_H
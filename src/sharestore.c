@@ -0,0 +1,417 @@
+/*
+    @copyright 2024, Stefan Marsiske toprf@ctrlc.hu
+    This file is part of liboprf.
+
+    liboprf is free software: you can redistribute it and/or
+    modify it under the terms of the GNU Lesser General Public License
+    as published by the Free Software Foundation, either version 3 of
+    the License, or (at your option) any later version.
+
+    liboprf is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Lesser General Public License for more details.
+
+    You should have received a copy of the License
+    along with liboprf. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "sharestore.h"
+#include "scratch.h"
+
+/*
+ * The file is a header followed by a hash table of capacity records,
+ * capacity is a power of two. Records are placed by a keyed hash of
+ * their key id and found by linear probing, deleted records stay as
+ * tombstones until the table is grown.
+ *
+ * Every record carries a sequence number, which is one more than
+ * that of the record it replaces. A record only becomes visible when
+ * its state is set after all the rest of it has been written, and the
+ * record it replaces is deleted only after that. If a crash happens
+ * in between, two records of the same key id are live, and the one
+ * with the higher sequence number is the current one.
+ *
+ * Deleted records are wiped, only their state remains. In encrypted
+ * stores the key id, the sequence number and the slot of a record
+ * are its associated data, so a record copied to another slot or
+ * back over a newer one does not decrypt. When the store grows the
+ * records are moved and therefore encrypted again.
+ */
+
+#define STORE_VERSION 2
+#define STORE_ENCRYPTED 1
+#define STORE_MIN_CAPACITY 64
+
+#define EMPTY 0
+#define LIVE 1
+#define DELETED 2
+
+#define NONE UINT64_MAX
+
+static const uint8_t magic[8] = "liboprfS";
+
+typedef struct {
+  uint8_t magic[8];
+  uint32_t version;
+  uint32_t record_size;
+  uint64_t capacity;
+  uint8_t flags;
+  uint8_t pad[7];
+  uint8_t slot_key[16];
+  // for encrypted stores a mac of the fields above with the key, so
+  // that a wrong key is noticed when opening the store
+  uint8_t check[crypto_generichash_BYTES];
+  // the number of records that are live or deleted, it is updated
+  // after the records and may be less than that after a crash
+  uint64_t used;
+  uint8_t reserved[40];
+} __attribute((packed)) Header;
+
+typedef struct {
+  uint8_t state;
+  uint8_t pad[7];
+  uint64_t seq;
+  uint8_t id[sharestore_ID_BYTES];
+  uint8_t nonce[crypto_aead_xchacha20poly1305_ietf_NPUBBYTES];
+  // the share, or the share encrypted with the id, seq and slot as
+  // associated data
+  uint8_t data[TOPRF_Share_BYTES+crypto_aead_xchacha20poly1305_ietf_ABYTES];
+  uint8_t reserved[7];
+} __attribute((packed)) Record;
+
+struct ShareStore {
+  char *path;
+  int fd;
+  int flags;
+  int encrypted;
+  uint8_t *map;
+  size_t map_len;
+  uint8_t key[sharestore_KEYBYTES];
+};
+
+static Header* header(const ShareStore *s) {
+  return (Header*) s->map;
+}
+
+static Record* record(const ShareStore *s, const uint64_t i) {
+  return (Record*) (s->map + sizeof(Header) + i * sizeof(Record));
+}
+
+static size_t file_size(const uint64_t capacity) {
+  return sizeof(Header) + capacity * sizeof(Record);
+}
+
+static uint64_t slot_of(const ShareStore *s, const uint8_t id[sharestore_ID_BYTES]) {
+  const Header *h = header(s);
+  uint8_t hash[crypto_generichash_BYTES_MIN];
+  crypto_generichash(hash, sizeof hash, id, sharestore_ID_BYTES, h->slot_key, sizeof h->slot_key);
+  uint64_t r;
+  memcpy(&r, hash, sizeof r);
+  return r & (h->capacity - 1);
+}
+
+static void header_check(const Header *h, const uint8_t key[sharestore_KEYBYTES],
+                         uint8_t check[crypto_generichash_BYTES]) {
+  crypto_generichash(check, crypto_generichash_BYTES, (const uint8_t*) h, offsetof(Header, check),
+                     key, sharestore_KEYBYTES);
+}
+
+static int sync_range(const ShareStore *s, const void *p, const size_t len) {
+  if(s->flags & SHARESTORE_NOSYNC) return 0;
+  const uintptr_t page = (uintptr_t) sysconf(_SC_PAGESIZE);
+  const uintptr_t start = (uintptr_t) p & ~(page - 1);
+  return msync((void*) start, (uintptr_t) p + len - start, MS_SYNC);
+}
+
+// finds the newest live record of id, and the first free slot in its
+// probe sequence
+static void find(const ShareStore *s, const uint8_t id[sharestore_ID_BYTES],
+                 uint64_t *live, uint64_t *free_slot) {
+  const Header *h = header(s);
+  *live = NONE;
+  if(free_slot) *free_slot = NONE;
+  uint64_t i = slot_of(s, id);
+  for(uint64_t n=0;n<h->capacity;n++, i=(i+1) & (h->capacity - 1)) {
+    const Record *r = record(s, i);
+    if(r->state!=LIVE) {
+      if(free_slot && *free_slot==NONE) *free_slot = i;
+      if(r->state==EMPTY) return;
+      continue;
+    }
+    if(memcmp(r->id, id, sharestore_ID_BYTES)!=0) continue;
+    if(*live==NONE || r->seq > record(s, *live)->seq) *live = i;
+  }
+}
+
+// the associated data of the record r at slot
+static void record_ad(const Record *r, const uint64_t slot, uint8_t ad[sharestore_ID_BYTES+16]) {
+  memcpy(ad, r->id, sharestore_ID_BYTES);
+  memcpy(ad+sharestore_ID_BYTES, &r->seq, sizeof r->seq);
+  memcpy(ad+sharestore_ID_BYTES+8, &slot, sizeof slot);
+}
+
+// encrypts share into the record r at slot, whose id and seq are set
+static void seal(const ShareStore *s, Record *r, const uint64_t slot, const uint8_t share[TOPRF_Share_BYTES]) {
+  uint8_t ad[sharestore_ID_BYTES+16];
+  record_ad(r, slot, ad);
+  randombytes_buf(r->nonce, sizeof r->nonce);
+  crypto_aead_xchacha20poly1305_ietf_encrypt(r->data, NULL, share, TOPRF_Share_BYTES,
+                                             ad, sizeof ad, NULL, r->nonce, s->key);
+}
+
+static int unseal(const ShareStore *s, const Record *r, const uint64_t slot, uint8_t share[TOPRF_Share_BYTES]) {
+  uint8_t ad[sharestore_ID_BYTES+16];
+  record_ad(r, slot, ad);
+  return crypto_aead_xchacha20poly1305_ietf_decrypt(share, NULL, NULL, r->data, sizeof r->data,
+                                                    ad, sizeof ad, r->nonce, s->key);
+}
+
+// deletes all live records of id, except the one at keep
+static int delete_others(ShareStore *s, const uint8_t id[sharestore_ID_BYTES], const uint64_t keep) {
+  const Header *h = header(s);
+  uint64_t i = slot_of(s, id);
+  int deleted = 0;
+  for(uint64_t n=0;n<h->capacity;n++, i=(i+1) & (h->capacity - 1)) {
+    Record *r = record(s, i);
+    if(r->state==EMPTY) break;
+    if(r->state!=LIVE || i==keep || memcmp(r->id, id, sharestore_ID_BYTES)!=0) continue;
+    r->state = DELETED;
+    r->seq = 0;
+    sodium_memzero(r->id, sizeof r->id);
+    sodium_memzero(r->nonce, sizeof r->nonce);
+    sodium_memzero(r->data, sizeof r->data);
+    if(sync_range(s, r, sizeof *r)) return -1;
+    deleted = 1;
+  }
+  return deleted;
+}
+
+static int map_store(ShareStore *s) {
+  struct stat st;
+  if(fstat(s->fd, &st) || (size_t) st.st_size < sizeof(Header)) return -1;
+  s->map_len = (size_t) st.st_size;
+  s->map = mmap(NULL, s->map_len, PROT_READ | PROT_WRITE, MAP_SHARED, s->fd, 0);
+  if(s->map==MAP_FAILED) {
+    s->map = NULL;
+    return -1;
+  }
+  const Header *h = header(s);
+  if(memcmp(h->magic, magic, sizeof magic)!=0 ||
+     h->version!=STORE_VERSION ||
+     h->record_size!=sizeof(Record) ||
+     h->capacity < STORE_MIN_CAPACITY ||
+     (h->capacity & (h->capacity - 1))!=0 ||
+     h->capacity > (SIZE_MAX - sizeof(Header)) / sizeof(Record) ||
+     file_size(h->capacity)!=s->map_len) return -1;
+  return 0;
+}
+
+// writes an empty store with capacity slots to fd
+static int init_store(const int fd, const uint64_t capacity, const Header *tmpl,
+                      const uint8_t key[sharestore_KEYBYTES]) {
+  Header h;
+  memcpy(&h, tmpl, sizeof h);
+  h.capacity = capacity;
+  h.used = 0;
+  if(h.flags & STORE_ENCRYPTED) header_check(&h, key, h.check);
+  if(ftruncate(fd, (off_t) file_size(capacity))) return -1;
+  if(pwrite(fd, &h, sizeof h, 0)!=(ssize_t) sizeof h) return -1;
+  return fsync(fd);
+}
+
+static int sync_dir(const char *path) {
+  const char *slash = strrchr(path, '/');
+  char dir[slash ? (size_t) (slash - path) + 2 : 2];
+  if(slash) {
+    memcpy(dir, path, (size_t) (slash - path) + 1);
+    dir[slash - path + 1] = 0;
+  } else {
+    strcpy(dir, ".");
+  }
+  const int fd = open(dir, O_RDONLY);
+  if(fd < 0) return -1;
+  const int ret = fsync(fd);
+  close(fd);
+  return ret;
+}
+
+// rewrites the store into a file of twice the capacity, which then
+// replaces the store
+static int grow(ShareStore *s) {
+  const Header *h = header(s);
+  if(h->capacity > (SIZE_MAX - sizeof(Header)) / sizeof(Record) / 2) return -1;
+  const size_t tmp_len = strlen(s->path) + 5;
+  char tmp_path[tmp_len];
+  memcpy(tmp_path, s->path, tmp_len - 5);
+  memcpy(tmp_path + tmp_len - 5, ".tmp", 5);
+
+  // everything but the key, which stays only in the locked s->key
+  ShareStore n = { .path = s->path, .flags = s->flags | SHARESTORE_NOSYNC, .encrypted = s->encrypted };
+  n.fd = open(tmp_path, O_RDWR | O_CREAT | O_TRUNC, 0600);
+  if(n.fd < 0) return -1;
+  if(init_store(n.fd, h->capacity * 2, h, s->key) || map_store(&n)) goto fail;
+
+  Header *nh = header(&n);
+  uint8_t *share = oprf_scratch_push(TOPRF_Share_BYTES);
+  if(share==NULL) goto fail;
+  for(uint64_t i=0;i<h->capacity;i++) {
+    const Record *r = record(s, i);
+    if(r->state!=LIVE) continue;
+    uint64_t live, slot;
+    find(&n, r->id, &live, &slot);
+    // left over records of a crash during a replace
+    if(live!=NONE) {
+      if(record(&n, live)->seq >= r->seq) continue;
+      slot = live;
+    } else {
+      nh->used++;
+    }
+    Record *nr = record(&n, slot);
+    memcpy(nr, r, sizeof *r);
+    // a record which does not decrypt is copied as it is, and fails
+    // to decrypt in its new slot just the same
+    if(s->encrypted && unseal(s, r, i, share)==0) seal(s, nr, slot, share);
+  }
+  oprf_scratch_pop(share, TOPRF_Share_BYTES);
+  if(msync(n.map, n.map_len, MS_SYNC) || fsync(n.fd)) goto fail;
+  if(rename(tmp_path, s->path)) goto fail;
+  sync_dir(s->path);
+
+  munmap(s->map, s->map_len);
+  close(s->fd);
+  s->fd = n.fd;
+  s->map = n.map;
+  s->map_len = n.map_len;
+  return 0;
+
+fail:
+  if(n.map) munmap(n.map, n.map_len);
+  close(n.fd);
+  unlink(tmp_path);
+  return -1;
+}
+
+ShareStore* sharestore_open(const char *path, const uint8_t key[sharestore_KEYBYTES], const int flags) {
+  ShareStore *s = calloc(1, sizeof(ShareStore));
+  if(s==NULL) return NULL;
+  s->fd = -1;
+  s->flags = flags;
+  s->encrypted = (key!=NULL);
+  if(0!=sodium_mlock(s->key, sizeof s->key)) {
+    free(s);
+    return NULL;
+  }
+  if(key) memcpy(s->key, key, sizeof s->key);
+  s->path = strdup(path);
+  if(s->path==NULL) goto fail;
+
+  s->fd = open(path, O_RDWR | ((flags & SHARESTORE_CREATE) ? O_CREAT : 0), 0600);
+  if(s->fd < 0) goto fail;
+  struct stat st;
+  if(fstat(s->fd, &st)) goto fail;
+  if(st.st_size==0) {
+    if(!(flags & SHARESTORE_CREATE)) goto fail;
+    Header h = {0};
+    memcpy(h.magic, magic, sizeof magic);
+    h.version = STORE_VERSION;
+    h.record_size = sizeof(Record);
+    h.flags = s->encrypted ? STORE_ENCRYPTED : 0;
+    randombytes_buf(h.slot_key, sizeof h.slot_key);
+    if(init_store(s->fd, STORE_MIN_CAPACITY, &h, s->key)) goto fail;
+  }
+  if(map_store(s)) goto fail;
+
+  const Header *h = header(s);
+  if(!!(h->flags & STORE_ENCRYPTED) != s->encrypted) goto fail;
+  if(s->encrypted) {
+    uint8_t check[crypto_generichash_BYTES];
+    header_check(h, s->key, check);
+    if(sodium_memcmp(check, h->check, sizeof check)!=0) goto fail;
+  }
+  return s;
+
+fail:
+  if(s->map) munmap(s->map, s->map_len);
+  if(s->fd >= 0) close(s->fd);
+  sodium_munlock(s->key, sizeof s->key);
+  free(s->path);
+  free(s);
+  return NULL;
+}
+
+int sharestore_get(const ShareStore *s,
+                   const uint8_t id[sharestore_ID_BYTES],
+                   uint8_t share[TOPRF_Share_BYTES]) {
+  uint64_t live;
+  find(s, id, &live, NULL);
+  if(live==NONE) return 1;
+  const Record *r = record(s, live);
+  if(!s->encrypted) {
+    memcpy(share, r->data, TOPRF_Share_BYTES);
+    return 0;
+  }
+  if(unseal(s, r, live, share)) return -1;
+  return 0;
+}
+
+int sharestore_put(ShareStore *s,
+                   const uint8_t id[sharestore_ID_BYTES],
+                   const uint8_t share[TOPRF_Share_BYTES]) {
+  if((header(s)->used + 1) * 2 > header(s)->capacity && grow(s)) return -1;
+
+  uint64_t live, free_slot;
+  find(s, id, &live, &free_slot);
+  if(free_slot==NONE) return -1;
+
+  Record *r = record(s, free_slot);
+  const int reused = (r->state==DELETED);
+  // everything but the state, which makes the record visible
+  r->seq = (live==NONE) ? 1 : record(s, live)->seq + 1;
+  memcpy(r->id, id, sharestore_ID_BYTES);
+  if(s->encrypted) {
+    seal(s, r, free_slot, share);
+  } else {
+    memset(r->nonce, 0, sizeof r->nonce);
+    memset(r->data, 0, sizeof r->data);
+    memcpy(r->data, share, TOPRF_Share_BYTES);
+  }
+  if(sync_range(s, r, sizeof *r)) return -1;
+  __atomic_store_n(&r->state, LIVE, __ATOMIC_RELEASE);
+  if(sync_range(s, r, sizeof *r)) return -1;
+
+  if(delete_others(s, id, free_slot) < 0) return -1;
+  if(!reused) {
+    header(s)->used++;
+    if(sync_range(s, header(s), sizeof(Header))) return -1;
+  }
+  return 0;
+}
+
+int sharestore_del(ShareStore *s, const uint8_t id[sharestore_ID_BYTES]) {
+  const int ret = delete_others(s, id, NONE);
+  if(ret < 0) return -1;
+  return ret ? 0 : 1;
+}
+
+int sharestore_sync(ShareStore *s) {
+  if(msync(s->map, s->map_len, MS_SYNC)) return -1;
+  return fsync(s->fd);
+}
+
+void sharestore_close(ShareStore *s) {
+  if(s==NULL) return;
+  sharestore_sync(s);
+  munmap(s->map, s->map_len);
+  close(s->fd);
+  sodium_munlock(s->key, sizeof s->key);
+  free(s->path);
+  free(s);
+}
@@ -0,0 +1,118 @@
+/*
+    @copyright 2024, Stefan Marsiske toprf@ctrlc.hu
+    This file is part of liboprf.
+
+    liboprf is free software: you can redistribute it and/or
+    modify it under the terms of the GNU Lesser General Public License
+    as published by the Free Software Foundation, either version 3 of
+    the License, or (at your option) any later version.
+
+    liboprf is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Lesser General Public License for more details.
+
+    You should have received a copy of the License
+    along with liboprf. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef SHARESTORE_H
+#define SHARESTORE_H
+
+#include <stdint.h>
+#include <sodium.h>
+#include "toprf.h"
+
+/**
+ * A persistent store for the shares of a shareholder, one share per
+ * key id - for example one per tenant key.
+ *
+ * The store is a single file made of fixed size records, which is
+ * memory mapped: opening it does not read or parse the records, and
+ * a lookup is a hash of the key id and - usually - a single record.
+ * The records can optionally be encrypted at rest with a key given
+ * when opening the store, each bound to its key id, its version and
+ * its place in the file. Deleted and replaced records are wiped.
+ *
+ * Adding or replacing a share never overwrites the record currently
+ * holding the share, the new record is written to a free slot first
+ * and only then the old one is deleted. After a crash a lookup
+ * returns either the old or the new share, never a mix of them. When
+ * the store grows it is rewritten to a temporary file which is
+ * renamed over the old one.
+ *
+ * The file is in the byte order of the host. Only one process may
+ * write a store at a time, and the functions of a store are not
+ * thread-safe.
+ */
+typedef struct ShareStore ShareStore;
+
+#define sharestore_ID_BYTES 32
+#define sharestore_KEYBYTES crypto_aead_xchacha20poly1305_ietf_KEYBYTES
+
+// create the store if it does not exist
+#define SHARESTORE_CREATE 1
+// do not msync() every change, call sharestore_sync() instead, useful
+// when importing many shares at once
+#define SHARESTORE_NOSYNC 2
+
+/**
+ * Opens a store.
+ *
+ * @param [in] path - the file holding the store
+ * @param [in] key - the key for encrypting the shares, or NULL if
+ *             they are stored in plaintext. A store created with a
+ *             key can only be opened with the same key, a store
+ *             created without can only be opened without.
+ * @param [in] flags - SHARESTORE_CREATE and/or SHARESTORE_NOSYNC
+ *
+ * @return The function returns a new store, or NULL on error.
+ */
+ShareStore* sharestore_open(const char *path, const uint8_t key[sharestore_KEYBYTES], const int flags);
+
+/**
+ * Looks up the share for a key id.
+ *
+ * @param [in] store - the store
+ * @param [in] id - the key id
+ * @param [out] share - the share, this should be in locked memory -
+ *              see sodium_mlock() - if the store is encrypted
+ *
+ * @return The function returns 0 if the share is found, 1 if it is
+ *         not, -1 if it can not be decrypted.
+ */
+int sharestore_get(const ShareStore *store,
+                   const uint8_t id[sharestore_ID_BYTES],
+                   uint8_t share[TOPRF_Share_BYTES]);
+
+/**
+ * Adds the share for a key id, replacing any previous one.
+ *
+ * @return The function returns 0 if everything is correct, -1 if the
+ *         store can not be grown or written.
+ */
+int sharestore_put(ShareStore *store,
+                   const uint8_t id[sharestore_ID_BYTES],
+                   const uint8_t share[TOPRF_Share_BYTES]);
+
+/**
+ * Deletes the share for a key id.
+ *
+ * @return The function returns 0 if the share was deleted, 1 if
+ *         there was none, -1 if the store can not be written.
+ */
+int sharestore_del(ShareStore *store, const uint8_t id[sharestore_ID_BYTES]);
+
+/**
+ * Writes all changes to disk, only needed with SHARESTORE_NOSYNC.
+ *
+ * @return The function returns 0 if everything is correct.
+ */
+int sharestore_sync(ShareStore *store);
+
+/**
+ * Syncs and closes the store, and wipes the key from memory.
+ */
+void sharestore_close(ShareStore *store);
+
+#endif // SHARESTORE_H
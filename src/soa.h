@@ -0,0 +1,76 @@
+/*
+    @copyright 2024, Stefan Marsiske toprf@ctrlc.hu
+    This file is part of liboprf.
+
+    liboprf is free software: you can redistribute it and/or
+    modify it under the terms of the GNU Lesser General Public License
+    as published by the Free Software Foundation, either version 3 of
+    the License, or (at your option) any later version.
+
+    liboprf is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Lesser General Public License for more details.
+
+    You should have received a copy of the License
+    along with liboprf. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef SOA_H
+#define SOA_H
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+/*
+ * The structure-of-arrays form of shares and parts used internally.
+ *
+ * On the wire and in the public API a TOPRF_Share or TOPRF_Part is a
+ * packed index followed by its 32 byte value, which puts every value
+ * at an odd offset and interleaves the indexes with the data the
+ * kernels sweep. The batch verification, the multi-scalar
+ * multiplications and the combination of parts instead take the
+ * indexes and the values as separate arrays, the values contiguous
+ * and aligned to TOPRF_SOA_ALIGN - like the commitments already are.
+ * The public functions split their arguments once with
+ * toprf_soa_split() and run the kernels on the result.
+ */
+
+#define TOPRF_SOA_ALIGN 64
+#define TOPRF_SOA_ALIGNED __attribute__((aligned(TOPRF_SOA_ALIGN)))
+
+/*
+ * Splits n packed items of stride bytes - an 8 bit index followed by
+ * a 32 byte value - into indexes (unless NULL) and values.
+ */
+static inline void toprf_soa_split(const size_t n, const uint8_t *items, const size_t stride,
+                                   uint8_t *indexes, uint8_t values[n][32]) {
+  for(size_t i=0;i<n;i++) {
+    if(indexes!=NULL) indexes[i] = items[i * stride];
+    memcpy(values[i], items + i * stride + 1, 32);
+  }
+}
+
+/*
+ * Same as toprf_soa_split(), for the items with a 16 bit index in the
+ * byte order of the host.
+ */
+static inline void toprf_soa_split_wide(const size_t n, const uint8_t *items, const size_t stride,
+                                        uint16_t *indexes, uint8_t values[n][32]) {
+  for(size_t i=0;i<n;i++) {
+    if(indexes!=NULL) memcpy(&indexes[i], items + i * stride, sizeof(uint16_t));
+    memcpy(values[i], items + i * stride + sizeof(uint16_t), 32);
+  }
+}
+
+/*
+ * Allocates an aligned array of n values, for those that do not fit
+ * on the stack, to be released with free(). Returns NULL on failure.
+ */
+static inline void *toprf_soa_alloc(const size_t n) {
+  const size_t len = (n * 32 + TOPRF_SOA_ALIGN - 1) & ~((size_t) TOPRF_SOA_ALIGN - 1);
+  return aligned_alloc(TOPRF_SOA_ALIGN, len ? len : TOPRF_SOA_ALIGN);
+}
+
+#endif // SOA_H
@@ -0,0 +1,93 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <sodium.h>
+#include "toprf.h"
+#include "ristretto255.h"
+
+// compares ristretto255_msm() against doing one
+// crypto_scalarmult_ristretto255() per response, like
+// toprf_thresholdmult() did before ristretto255_msm() existed.
+// the vartime column is ristretto255_msm_vartime() on the same
+// inputs, the last column is toprf_thresholdmult() including the
+// calculation of the lagrange coefficients.
+
+static double now(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (double) ts.tv_sec + (double) ts.tv_nsec / 1e9;
+}
+
+static int naive(const size_t len,
+                 const uint8_t scalars[len][crypto_core_ristretto255_SCALARBYTES],
+                 const uint8_t points[len][crypto_core_ristretto255_BYTES],
+                 uint8_t result[crypto_core_ristretto255_BYTES]) {
+  uint8_t tmp[crypto_core_ristretto255_BYTES];
+  memset(result, 0, crypto_core_ristretto255_BYTES);
+  for(size_t i=0;i<len;i++) {
+    if(crypto_scalarmult_ristretto255(tmp, scalars[i], points[i])) return 1;
+    crypto_core_ristretto255_add(result, result, tmp);
+  }
+  return 0;
+}
+
+int main(int argc, char **argv) {
+  if(sodium_init() < 0) return 1;
+  unsigned iterations = 100;
+  if(argc>1) iterations = (unsigned) atoi(argv[1]);
+
+  const size_t ts[] = {2, 3, 4, 5, 7, 11, 16, 24, 32, 48, 64};
+  uint8_t secret[crypto_core_ristretto255_SCALARBYTES], P[crypto_core_ristretto255_BYTES];
+  uint8_t r0[crypto_core_ristretto255_BYTES], r1[crypto_core_ristretto255_BYTES];
+
+  printf("%4s %14s %14s %8s %14s %20s\n", "t", "naive (us)", "msm (us)", "speedup", "vartime (us)", "thresholdmult (us)");
+  for(unsigned k=0;k<sizeof ts / sizeof ts[0];k++) {
+    const size_t t = ts[k];
+    uint8_t shares[t][TOPRF_Share_BYTES], responses[t][TOPRF_Part_BYTES];
+    uint8_t indexes[t], lpoly[t][crypto_core_ristretto255_SCALARBYTES], values[t][crypto_core_ristretto255_BYTES];
+    crypto_core_ristretto255_scalar_random(secret);
+    crypto_core_ristretto255_random(P);
+    toprf_create_shares(secret, (uint8_t) t, (uint8_t) t, shares);
+    for(size_t i=0;i<t;i++) {
+      responses[i][0]=shares[i][0];
+      indexes[i]=shares[i][0];
+      if(crypto_scalarmult_ristretto255(responses[i]+1, shares[i]+1, P)) return 1;
+      memcpy(values[i], responses[i]+1, crypto_core_ristretto255_BYTES);
+    }
+    for(size_t i=0;i<t;i++) coeff(indexes[i], t, indexes, lpoly[i]);
+
+    double start = now();
+    for(unsigned i=0;i<iterations;i++) if(naive(t, lpoly, values, r0)) return 1;
+    const double tn = (now() - start) / iterations * 1e6;
+
+    start = now();
+    for(unsigned i=0;i<iterations;i++) if(ristretto255_msm(r1, t, lpoly, values)) return 1;
+    const double tm = (now() - start) / iterations * 1e6;
+
+    if(memcmp(r0, r1, sizeof r0)!=0) {
+      fprintf(stderr, "results differ for t=%zu\n", t);
+      return 1;
+    }
+
+    start = now();
+    for(unsigned i=0;i<iterations;i++) if(ristretto255_msm_vartime(r1, t, lpoly, values)) return 1;
+    const double tv = (now() - start) / iterations * 1e6;
+
+    if(memcmp(r0, r1, sizeof r0)!=0) {
+      fprintf(stderr, "vartime results differ for t=%zu\n", t);
+      return 1;
+    }
+
+    start = now();
+    for(unsigned i=0;i<iterations;i++) if(toprf_thresholdmult(t, responses, r1)) return 1;
+    const double tt = (now() - start) / iterations * 1e6;
+
+    if(memcmp(r0, r1, sizeof r0)!=0) {
+      fprintf(stderr, "toprf_thresholdmult differs for t=%zu\n", t);
+      return 1;
+    }
+    printf("%4zu %14.1f %14.1f %7.2fx %14.1f %20.1f\n", t, tn, tm, tn/tm, tv, tt);
+  }
+  return 0;
+}
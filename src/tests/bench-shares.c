@@ -0,0 +1,66 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <sodium.h>
+#include "toprf.h"
+
+// compares share generation with Horner's method (toprf_polynom_shares)
+// against calculating every power x^j with repeated multiplications,
+// like toprf_create_shares() did before.
+
+static double now(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (double) ts.tv_sec + (double) ts.tv_nsec / 1e9;
+}
+
+static void naive(const uint8_t n, const uint8_t threshold,
+                  const uint8_t a[threshold][crypto_core_ristretto255_SCALARBYTES],
+                  uint8_t shares[n][TOPRF_Share_BYTES]) {
+  for(uint8_t i=1;i<=n;i++) {
+    shares[i-1][0]=i;
+    uint8_t x[crypto_core_ristretto255_SCALARBYTES]={0};
+    x[0]=i;
+    memcpy(shares[i-1]+1, a[0], crypto_core_ristretto255_SCALARBYTES);
+    for(int j=1;j<threshold;j++) {
+      uint8_t tmp[crypto_core_ristretto255_SCALARBYTES];
+      crypto_core_ristretto255_scalar_mul(tmp, a[j], x);
+      for(int exp=1;exp<j;exp++) {
+        crypto_core_ristretto255_scalar_mul(tmp, tmp, x);
+      }
+      crypto_core_ristretto255_scalar_add(shares[i-1]+1, shares[i-1]+1, tmp);
+    }
+  }
+}
+
+int main(int argc, char **argv) {
+  if(sodium_init() < 0) return 1;
+  unsigned iterations = 20;
+  if(argc>1) iterations = (unsigned) atoi(argv[1]);
+
+  const uint8_t ts[] = {2, 3, 5, 8, 16, 32, 64, 96, 126};
+
+  printf("%4s %4s %14s %14s %8s\n", "t", "n", "naive (us)", "horner (us)", "speedup");
+  for(unsigned k=0;k<sizeof ts / sizeof ts[0];k++) {
+    const uint8_t t = ts[k], n = (uint8_t) (t + 1);
+    uint8_t a[t][crypto_core_ristretto255_SCALARBYTES];
+    uint8_t s0[n][TOPRF_Share_BYTES], s1[n][TOPRF_Share_BYTES];
+    for(unsigned i=0;i<t;i++) crypto_core_ristretto255_scalar_random(a[i]);
+
+    double start = now();
+    for(unsigned i=0;i<iterations;i++) naive(n, t, a, s0);
+    const double tn = (now() - start) / iterations * 1e6;
+
+    start = now();
+    for(unsigned i=0;i<iterations;i++) toprf_polynom_shares(n, t, a, s1);
+    const double th = (now() - start) / iterations * 1e6;
+
+    if(memcmp(s0, s1, sizeof s0)!=0) {
+      fprintf(stderr, "results differ for t=%u\n", t);
+      return 1;
+    }
+    printf("%4u %4u %14.1f %14.1f %7.2fx\n", t, n, tn, th, tn/th);
+  }
+  return 0;
+}
@@ -0,0 +1,427 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sodium.h>
+#include "oprf.h"
+#include "toprf.h"
+#include "dkg.h"
+#include "tp-dkg.h"
+
+// benchmarks all the public primitives of liboprf, the output is
+// either json or csv, so that results can be compared across
+// releases and builds.
+//
+// run as: % ./benchmark [-n peers] [-t threshold] [-l input_len]
+//                       [-j threads] [-i iterations] [-f json|csv]
+//                       [-b filter]
+//
+// each benchmark runs its iterations in every thread at the same
+// time, the reported ops/s is the combined throughput of all threads.
+
+#define DST "benchmark"
+#define DST_LEN (sizeof(DST) - 1)
+
+typedef struct {
+  uint8_t n, t;
+  uint8_t input_len;
+  unsigned threads;
+  unsigned iterations;
+} Params;
+
+// all the inputs of the benchmarks, prepared before they are timed
+typedef struct {
+  const Params *p;
+  uint8_t input[255];
+  uint8_t k[crypto_core_ristretto255_SCALARBYTES];
+  uint8_t r[crypto_core_ristretto255_SCALARBYTES];
+  uint8_t blinded[crypto_core_ristretto255_BYTES];
+  uint8_t Z[crypto_core_ristretto255_BYTES];
+  uint8_t N[crypto_core_ristretto255_BYTES];
+  uint8_t *shares;      // [n][TOPRF_Share_BYTES]
+  uint8_t *indexes;     // [t]
+  uint8_t *parts;       // [t][TOPRF_Part_BYTES]
+  uint8_t *commitments; // [n][t][crypto_core_ristretto255_BYTES]
+  TOPRF_Share *dkg_shares;   // [n][n]
+  TOPRF_Share *received;     // [n]
+  oprf_KeyCtx keyctx;        // shares[0] prepared for indexes
+} State;
+
+typedef struct {
+  const char *name;
+  // benchmarks that are much slower than the rest run fewer iterations
+  unsigned divisor;
+  int (*run)(State *s);
+} Bench;
+
+typedef struct {
+  const Bench *bench;
+  State state;
+  unsigned iterations;
+  pthread_barrier_t *barrier;
+  double start, end;
+  int ret;
+} Worker;
+
+static double now(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (double) ts.tv_sec + (double) ts.tv_nsec / 1e9;
+}
+
+static int state_init(State *s, const Params *p) {
+  const uint8_t n = p->n, t = p->t;
+  memset(s, 0, sizeof *s);
+  s->p = p;
+  randombytes_buf(s->input, sizeof s->input);
+  oprf_KeyGen(s->k);
+  s->shares = malloc((size_t) n * TOPRF_Share_BYTES);
+  s->indexes = malloc(t);
+  s->parts = malloc((size_t) t * TOPRF_Part_BYTES);
+  s->commitments = malloc((size_t) n * t * crypto_core_ristretto255_BYTES);
+  s->dkg_shares = malloc((size_t) n * n * sizeof(TOPRF_Share));
+  s->received = malloc((size_t) n * sizeof(TOPRF_Share));
+  if(!s->shares || !s->indexes || !s->parts || !s->commitments || !s->dkg_shares || !s->received) return 1;
+
+  if(oprf_Blind(s->input, p->input_len, s->r, s->blinded)) return 1;
+  if(oprf_Evaluate(s->k, s->blinded, s->Z)) return 1;
+  if(oprf_Unblind(s->r, s->Z, s->N)) return 1;
+
+  toprf_create_shares(s->k, n, t, (uint8_t (*)[TOPRF_Share_BYTES]) s->shares);
+  for(uint8_t i=0;i<t;i++) {
+    uint8_t *share = s->shares + i * TOPRF_Share_BYTES;
+    uint8_t *part = s->parts + i * TOPRF_Part_BYTES;
+    s->indexes[i] = share[0];
+    part[0] = share[0];
+    if(oprf_Evaluate(share+1, s->blinded, part+1)) return 1;
+  }
+  if(toprf_KeyCtx_init(&s->keyctx, s->shares, s->indexes, t)) return 1;
+
+  // every dealer has run dkg_start(), received holds what peer 1 got
+  for(uint8_t i=0;i<n;i++) {
+    if(dkg_start(n, t,
+                 (uint8_t (*)[crypto_core_ristretto255_BYTES]) (s->commitments + (size_t) i * t * crypto_core_ristretto255_BYTES),
+                 s->dkg_shares + (size_t) i * n)) return 1;
+    s->received[i] = s->dkg_shares[(size_t) i * n];
+  }
+  return 0;
+}
+
+static void state_free(State *s) {
+  free(s->shares);
+  free(s->indexes);
+  free(s->parts);
+  free(s->commitments);
+  free(s->dkg_shares);
+  free(s->received);
+  oprf_KeyCtx_free(&s->keyctx);
+}
+
+static int b_blind(State *s) {
+  return oprf_Blind(s->input, s->p->input_len, s->r, s->blinded);
+}
+
+static int b_evaluate(State *s) {
+  return oprf_Evaluate(s->k, s->blinded, s->Z);
+}
+
+static int b_unblind(State *s) {
+  return oprf_Unblind(s->r, s->Z, s->N);
+}
+
+static int b_finalize(State *s) {
+  uint8_t y[OPRF_BYTES];
+  return oprf_Finalize(s->input, s->p->input_len, s->N, y);
+}
+
+static int b_expand_message_xmd(State *s) {
+  uint8_t out[64];
+  return expand_message_xmd(s->input, s->p->input_len, (const uint8_t*) DST, DST_LEN, sizeof out, out);
+}
+
+static int b_toprf_evaluate(State *s) {
+  uint8_t part[TOPRF_Part_BYTES];
+  return toprf_Evaluate(s->shares, s->blinded, s->shares[0], s->indexes, s->p->t, part);
+}
+
+static int b_toprf_evaluate_keyctx(State *s) {
+  uint8_t part[TOPRF_Part_BYTES];
+  return toprf_Evaluate_KeyCtx(&s->keyctx, s->blinded, s->indexes, s->p->t, part);
+}
+
+static int b_toprf_thresholdmult(State *s) {
+  uint8_t result[crypto_core_ristretto255_BYTES];
+  return toprf_thresholdmult(s->p->t, (const uint8_t (*)[TOPRF_Part_BYTES]) s->parts, result);
+}
+
+static int b_toprf_thresholdcombine(State *s) {
+  uint8_t result[crypto_core_ristretto255_BYTES];
+  toprf_thresholdcombine(s->p->t, (const uint8_t (*)[TOPRF_Part_BYTES]) s->parts, result);
+  return 0;
+}
+
+static int b_dkg_start(State *s) {
+  uint8_t commitments[s->p->t][crypto_core_ristretto255_BYTES];
+  TOPRF_Share shares[s->p->n];
+  return dkg_start(s->p->n, s->p->t, commitments, shares);
+}
+
+static int b_dkg_verify_commitments(State *s) {
+  uint8_t fails[s->p->n], fails_len=0;
+  return dkg_verify_commitments(s->p->n, s->p->t, 1,
+                                (const uint8_t (*)[s->p->t][crypto_core_ristretto255_BYTES]) s->commitments,
+                                s->received, fails, &fails_len);
+}
+
+// a growable buffer simulating the network between the TP and a peer
+typedef struct {
+  uint8_t *buf;
+  size_t len, cap;
+} Net;
+
+static int net_send(Net *net, const uint8_t *msg, const size_t msg_len) {
+  if(msg_len==0 || msg==NULL) return 0;
+  if(net->len + msg_len > net->cap) {
+    size_t cap = net->cap ? net->cap : 4096;
+    while(cap < net->len + msg_len) cap *= 2;
+    uint8_t *buf = realloc(net->buf, cap);
+    if(buf==NULL) return 1;
+    net->buf = buf;
+    net->cap = cap;
+  }
+  memcpy(net->buf + net->len, msg, msg_len);
+  net->len += msg_len;
+  return 0;
+}
+
+static void net_recv(Net *net, uint8_t *buf, const size_t msg_len) {
+  if(net->len < msg_len || msg_len == 0) return;
+  memcpy(buf, net->buf, msg_len);
+  memmove(net->buf, net->buf + msg_len, net->len - msg_len);
+  net->len -= msg_len;
+}
+
+// a complete tp-dkg run with the TP and all peers in this thread
+static int b_tpdkg(State *s) {
+  const uint8_t n = s->p->n, t = s->p->t;
+  int ret = 1;
+
+  uint8_t peer_lt_pks[n][crypto_sign_PUBLICKEYBYTES];
+  uint8_t peer_lt_sks[n][crypto_sign_SECRETKEYBYTES];
+  for(uint8_t i=0;i<n;i++) crypto_sign_keypair(peer_lt_pks[i], peer_lt_sks[i]);
+
+  TP_DKG_TPState tp;
+  uint8_t msg0[tpdkg_msg0_SIZE];
+  if(tpdkg_start_tp(&tp, 120000, n, t, DST, DST_LEN, sizeof msg0, (TP_DKG_Message*) msg0)) return 1;
+
+  // the TP and each peer keep their buffers in one arena
+  const size_t tp_arena_len = tpdkg_tp_arena_size(n, t);
+  const size_t peer_arena_len = tpdkg_peer_arena_size(n, t);
+  uint8_t *tp_arena = malloc(tp_arena_len);
+  uint8_t *peer_arenas = malloc(peer_arena_len * n);
+  TP_DKG_PeerState peers[n];
+
+  Net net[n+1];
+  memset(net, 0, sizeof net);
+  uint8_t started = 0;
+
+  if(!tp_arena || !peer_arenas) goto out;
+  if(tpdkg_tp_set_arena(&tp, tp_arena, tp_arena_len, (const uint8_t (*)[][crypto_sign_PUBLICKEYBYTES]) &peer_lt_pks, 0)) goto out;
+
+  for(uint8_t i=0;i<n;i++) {
+    if(tpdkg_start_peer(&peers[i], 120000, peer_lt_sks[i], (TP_DKG_Message*) msg0)) goto out;
+    if(tpdkg_peer_set_arena(&peers[i], peer_arenas + peer_arena_len * i, peer_arena_len, 0)) goto out;
+    started++;
+  }
+
+  while(tpdkg_tp_not_done(&tp)) {
+    const size_t tp_out_size = tpdkg_tp_output_size(&tp);
+    const size_t tp_in_size = tpdkg_tp_input_size(&tp);
+    uint8_t *tp_out = tp_out_size ? malloc(tp_out_size) : NULL;
+    uint8_t *tp_in = tp_in_size ? malloc(tp_in_size) : NULL;
+    if((tp_out_size && !tp_out) || (tp_in_size && !tp_in)) {
+      free(tp_out); free(tp_in);
+      goto out;
+    }
+    net_recv(&net[0], tp_in, tp_in_size);
+    int err = tpdkg_tp_next(&tp, tp_in, tp_in_size, tp_out, tp_out_size);
+    for(uint8_t i=0;i<n && !err;i++) {
+      const uint8_t *msg;
+      size_t len;
+      err = tpdkg_tp_peer_msg(&tp, tp_out, tp_out_size, i, &msg, &len) || net_send(&net[i+1], msg, len);
+    }
+    free(tp_out);
+    free(tp_in);
+    if(err) goto out;
+
+    while(net[0].len==0 && tpdkg_peer_not_done(&peers[1])) {
+      for(uint8_t i=0;i<n;i++) {
+        const size_t peer_out_size = tpdkg_peer_output_size(&peers[i]);
+        const size_t peer_in_size = tpdkg_peer_input_size(&peers[i]);
+        uint8_t *peer_out = peer_out_size ? malloc(peer_out_size) : NULL;
+        uint8_t *peer_in = peer_in_size ? malloc(peer_in_size) : NULL;
+        if((peer_out_size && !peer_out) || (peer_in_size && !peer_in)) {
+          free(peer_out); free(peer_in);
+          goto out;
+        }
+        net_recv(&net[i+1], peer_in, peer_in_size);
+        err = tpdkg_peer_next(&peers[i], peer_in, peer_in_size, peer_out, peer_out_size) ||
+              net_send(&net[0], peer_out, peer_out_size);
+        free(peer_out);
+        free(peer_in);
+        if(err) goto out;
+      }
+    }
+  }
+  ret = tp.cheater_len != 0;
+
+out:
+  for(uint8_t i=0;i<started;i++) tpdkg_peer_free(&peers[i]);
+  for(unsigned i=0;i<=n;i++) free(net[i].buf);
+  free(tp_arena);
+  free(peer_arenas);
+  return ret;
+}
+
+static const Bench benches[] = {
+  {"oprf_Blind", 1, b_blind},
+  {"oprf_Evaluate", 1, b_evaluate},
+  {"oprf_Unblind", 1, b_unblind},
+  {"oprf_Finalize", 1, b_finalize},
+  {"expand_message_xmd", 1, b_expand_message_xmd},
+  {"toprf_Evaluate", 1, b_toprf_evaluate},
+  {"toprf_Evaluate_KeyCtx", 1, b_toprf_evaluate_keyctx},
+  {"toprf_thresholdmult", 1, b_toprf_thresholdmult},
+  {"toprf_thresholdcombine", 1, b_toprf_thresholdcombine},
+  {"dkg_start", 1, b_dkg_start},
+  {"dkg_verify_commitments", 10, b_dkg_verify_commitments},
+  {"tpdkg", 100, b_tpdkg},
+};
+
+static void *worker(void *arg) {
+  Worker *w = (Worker*) arg;
+  pthread_barrier_wait(w->barrier);
+  w->start = now();
+  for(unsigned i=0;i<w->iterations;i++) {
+    if(w->bench->run(&w->state)) {
+      w->ret = 1;
+      break;
+    }
+  }
+  w->end = now();
+  return NULL;
+}
+
+static int run(const Bench *bench, const Params *p, double *elapsed, unsigned *iterations) {
+  const unsigned threads = p->threads;
+  Worker workers[threads];
+  pthread_t tids[threads];
+  pthread_barrier_t barrier;
+  pthread_attr_t attr;
+  int ret = 0;
+
+  *iterations = p->iterations / bench->divisor;
+  if(*iterations == 0) *iterations = 1;
+
+  for(unsigned i=0;i<threads;i++) {
+    workers[i].bench = bench;
+    workers[i].iterations = *iterations;
+    workers[i].barrier = &barrier;
+    workers[i].ret = 0;
+    if(state_init(&workers[i].state, p)) {
+      for(unsigned j=0;j<=i;j++) state_free(&workers[j].state);
+      return 1;
+    }
+  }
+
+  // the tp-dkg run needs big stack frames
+  pthread_attr_init(&attr);
+  pthread_attr_setstacksize(&attr, 64*1024*1024);
+  pthread_barrier_init(&barrier, NULL, threads);
+  unsigned started;
+  for(started=0;started<threads;started++) {
+    if(pthread_create(&tids[started], &attr, worker, &workers[started])) break;
+  }
+  if(started < threads) {
+    // cannot continue, the barrier will never be reached
+    fprintf(stderr, "failed to start threads\n");
+    exit(1);
+  }
+
+  // the time from the first thread starting to the last one finishing
+  double start = 0, end = 0;
+  for(unsigned i=0;i<threads;i++) {
+    pthread_join(tids[i], NULL);
+    ret |= workers[i].ret;
+    if(i==0 || workers[i].start < start) start = workers[i].start;
+    if(i==0 || workers[i].end > end) end = workers[i].end;
+    state_free(&workers[i].state);
+  }
+  *elapsed = end - start;
+  pthread_barrier_destroy(&barrier);
+  pthread_attr_destroy(&attr);
+  return ret;
+}
+
+static void usage(const char *self) {
+  fprintf(stderr, "usage: %s [-n peers] [-t threshold] [-l input_len] [-j threads] [-i iterations] [-f json|csv] [-b filter]\n", self);
+  exit(1);
+}
+
+int main(int argc, char **argv) {
+  Params p = {.n = 5, .t = 3, .input_len = 32, .threads = 1, .iterations = 1000};
+  const char *format = "json", *filter = NULL;
+  int opt;
+  while((opt = getopt(argc, argv, "n:t:l:j:i:f:b:h")) != -1) {
+    switch(opt) {
+    case 'n': p.n = (uint8_t) atoi(optarg); break;
+    case 't': p.t = (uint8_t) atoi(optarg); break;
+    case 'l': p.input_len = (uint8_t) atoi(optarg); break;
+    case 'j': p.threads = (unsigned) atoi(optarg); break;
+    case 'i': p.iterations = (unsigned) atoi(optarg); break;
+    case 'f': format = optarg; break;
+    case 'b': filter = optarg; break;
+    default: usage(argv[0]);
+    }
+  }
+  if(p.n < 2 || p.t < 2 || p.t > p.n || p.n > 127 || p.threads < 1 || p.iterations < 1) usage(argv[0]);
+  const int json = strcmp(format, "json") == 0;
+  if(!json && strcmp(format, "csv") != 0) usage(argv[0]);
+
+  if(sodium_init() < 0) return 1;
+
+  if(json) {
+    printf("{\"compiler\": \"%s\", \"libsodium\": \"%s\", \"n\": %u, \"t\": %u, \"input_len\": %u, \"threads\": %u,\n \"results\": [",
+           __VERSION__, sodium_version_string(), p.n, p.t, p.input_len, p.threads);
+  } else {
+    printf("name,n,t,input_len,threads,iterations,seconds,ns_per_op,ops_per_s\n");
+  }
+
+  int ret = 0;
+  const char *sep = "\n";
+  for(unsigned i=0;i<sizeof benches / sizeof benches[0];i++) {
+    const Bench *b = &benches[i];
+    if(filter && strstr(b->name, filter) == NULL) continue;
+    double elapsed;
+    unsigned iterations;
+    if(run(b, &p, &elapsed, &iterations)) {
+      fprintf(stderr, "%s failed\n", b->name);
+      ret = 1;
+      continue;
+    }
+    const double ops = (double) iterations * p.threads;
+    if(json) {
+      printf("%s  {\"name\": \"%s\", \"iterations\": %u, \"seconds\": %.6f, \"ns_per_op\": %.1f, \"ops_per_s\": %.1f}",
+             sep, b->name, iterations, elapsed, elapsed / iterations * 1e9, ops / elapsed);
+      sep = ",\n";
+    } else {
+      printf("%s,%u,%u,%u,%u,%u,%.6f,%.1f,%.1f\n", b->name, p.n, p.t, p.input_len, p.threads,
+             iterations, elapsed, elapsed / iterations * 1e9, ops / elapsed);
+    }
+    fflush(stdout);
+  }
+  if(json) printf("\n]}\n");
+  return ret;
+}
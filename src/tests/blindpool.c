@@ -0,0 +1,76 @@
+#include <stdio.h>
+#include <string.h>
+#include <pthread.h>
+#include "oprf.h"
+#include "blindpool.h"
+
+// the same as the plain Blind/Unblind
+static int test_equal(oprf_BlindPool *pool) {
+  uint8_t k[crypto_core_ristretto255_SCALARBYTES];
+  oprf_KeyGen(k);
+  for(unsigned i=0;i<100;i++) {
+    uint8_t r[crypto_core_ristretto255_SCALARBYTES], ir[crypto_core_ristretto255_SCALARBYTES];
+    uint8_t alpha[crypto_core_ristretto255_BYTES], beta[crypto_core_ristretto255_BYTES];
+    uint8_t N[crypto_core_ristretto255_BYTES], N2[crypto_core_ristretto255_BYTES];
+    if(oprf_Blind((const uint8_t*) &i, sizeof i, r, alpha)) return 1;
+    if(oprf_Evaluate(k, alpha, beta)) return 1;
+    if(oprf_Unblind(r, beta, N)) return 1;
+
+    if(oprf_BlindPool_Blind(pool, (const uint8_t*) &i, sizeof i, ir, alpha)) return 1;
+    if(oprf_Evaluate(k, alpha, beta)) return 1;
+    if(oprf_BlindPool_Unblind(ir, beta, N2)) return 1;
+    if(memcmp(N, N2, sizeof N)!=0) return 1;
+  }
+  return 0;
+}
+
+static void *consume(void *arg) {
+  oprf_BlindPool *pool = arg;
+  uint8_t ir[crypto_core_ristretto255_SCALARBYTES], alpha[crypto_core_ristretto255_BYTES];
+  const uint8_t x[] = "password";
+  for(int i=0;i<100;) {
+    const int ret = oprf_BlindPool_Blind(pool, x, sizeof x, ir, alpha);
+    if(ret==-1) return (void*) 1;
+    if(ret==0) i++;
+  }
+  return NULL;
+}
+
+int main(void) {
+  oprf_BlindPool *pool = oprf_BlindPool_new(1000);
+  if(pool==NULL) return 1;
+
+  // an empty pool tells the caller to fall back to oprf_Blind()
+  uint8_t ir[crypto_core_ristretto255_SCALARBYTES], alpha[crypto_core_ristretto255_BYTES];
+  if(oprf_BlindPool_Blind(pool, (const uint8_t*) "x", 1, ir, alpha)!=1) return 1;
+
+  // filling stops at the capacity
+  if(oprf_BlindPool_fill(pool, 900) || oprf_BlindPool_size(pool)!=900) return 1;
+  if(oprf_BlindPool_fill(pool, 900) || oprf_BlindPool_size(pool)!=1000) return 1;
+
+  // every entry is used only once
+  if(test_equal(pool)) {
+    fprintf(stderr, "\e[0;31mpooled blinding differs from oprf_Blind()\e[0m\n");
+    return 1;
+  }
+  if(oprf_BlindPool_size(pool)!=900) return 1;
+  uint8_t blinded[2][crypto_core_ristretto255_BYTES];
+  for(int i=0;i<2;i++) {
+    if(oprf_BlindPool_Blind(pool, (const uint8_t*) "x", 1, ir, blinded[i])) return 1;
+  }
+  if(memcmp(blinded[0], blinded[1], sizeof blinded[0])==0) return 1;
+
+  // the pool is refilled while other threads use it up
+  pthread_t t[4];
+  for(int i=0;i<4;i++) if(pthread_create(&t[i], NULL, consume, pool)) return 1;
+  for(int i=0;i<10;i++) if(oprf_BlindPool_fill(pool, 100)) return 1;
+  for(int i=0;i<4;i++) {
+    void *ret;
+    pthread_join(t[i], &ret);
+    if(ret!=NULL) return 1;
+  }
+  oprf_BlindPool_free(pool);
+
+  fprintf(stderr, "\e[0;32meverything correct!\e[0m\n");
+  return 0;
+}
@@ -1,7 +1,10 @@
+#include <stdlib.h>
 #include <string.h>
 #include "dkg.h"
+#include "oprf.h"
 #include "toprf.h"
 #include "utils.h"
+#include "workerpool.h"
 
 extern int debug;
 
@@ -70,6 +73,459 @@ static int test_dkg_finish(const uint8_t n, const TOPRF_Share shares[n]) {
   return 0;
 }
 
+static int test_keyctx(const uint8_t x[crypto_core_ristretto255_SCALARBYTES],
+                       const TOPRF_Share shares[3]) {
+  uint8_t indexes[3] = {shares[0].index, shares[1].index, shares[2].index};
+  uint8_t P[crypto_core_ristretto255_BYTES], v[crypto_core_ristretto255_BYTES], r[crypto_core_ristretto255_BYTES];
+  uint8_t parts[3][TOPRF_Part_BYTES], parts2[3][TOPRF_Part_BYTES];
+  crypto_core_ristretto255_random(P);
+
+  for(int i=0;i<3;i++) {
+    oprf_KeyCtx ctx;
+    if(oprf_KeyCtx_init_share(&ctx, (const uint8_t*) &shares[i])) return 1;
+    if(toprf_Evaluate_KeyCtx(&ctx, P, indexes, 3, parts[i])) return 1;
+    oprf_KeyCtx_free(&ctx);
+    parts2[i][0]=shares[i].index;
+    if(toprf_Evaluate((const uint8_t*) &shares[i], P, shares[i].index, indexes, 3, parts2[i])) return 1;
+    if(memcmp(parts[i], parts2[i], TOPRF_Part_BYTES)!=0) {
+      fprintf(stderr,"\e[0;31mtoprf_Evaluate_KeyCtx differs from toprf_Evaluate!\e[0m\n");
+      return 1;
+    }
+
+    // prepared for the same set in another order, and used for another set
+    const uint8_t reversed[3] = {indexes[2], indexes[1], indexes[0]};
+    uint8_t part[TOPRF_Part_BYTES], part2[TOPRF_Part_BYTES];
+    if(toprf_KeyCtx_init(&ctx, (const uint8_t*) &shares[i], reversed, 3)) return 1;
+    int ret = toprf_Evaluate_KeyCtx(&ctx, P, indexes, 3, part);
+    if(ret==0 && memcmp(part, parts2[i], TOPRF_Part_BYTES)!=0) ret = 1;
+    if(ret==0 && i<2) {
+      if(toprf_Evaluate_KeyCtx(&ctx, P, indexes, 2, part) ||
+         toprf_Evaluate((const uint8_t*) &shares[i], P, shares[i].index, indexes, 2, part2) ||
+         memcmp(part+1, part2+1, crypto_core_ristretto255_BYTES)!=0) ret = 1;
+    }
+    oprf_KeyCtx_free(&ctx);
+    if(ret) {
+      fprintf(stderr,"\e[0;31mtoprf_KeyCtx_init differs from toprf_Evaluate!\e[0m\n");
+      return 1;
+    }
+  }
+  oprf_KeyCtx ctx;
+  if(toprf_KeyCtx_init(&ctx, (const uint8_t*) &shares[0], indexes+1, 2)!=1) return 1;
+  toprf_thresholdcombine(3, parts, r);
+  if(crypto_scalarmult_ristretto255(v, x, P)) return 1;
+  if(memcmp(v,r,sizeof v)!=0) {
+    fprintf(stderr,"\e[0;31mtoprf_Evaluate_KeyCtx failed to evaluate!\e[0m\n");
+    return 1;
+  }
+  return 0;
+}
+
+// the shares the proxy of test_evalproxy() evaluates with
+static const TOPRF_Share *proxy_shares;
+
+static int threshold_eval(const uint8_t k[crypto_core_ristretto255_SCALARBYTES],
+                          const uint8_t alpha[crypto_core_ristretto255_BYTES],
+                          uint8_t beta[crypto_core_ristretto255_BYTES]) {
+  (void) k;
+  uint8_t indexes[3] = {proxy_shares[0].index, proxy_shares[1].index, proxy_shares[2].index};
+  uint8_t parts[3][TOPRF_Part_BYTES];
+  for(int i=0;i<3;i++) {
+    if(toprf_Evaluate((const uint8_t*) &proxy_shares[i], alpha, proxy_shares[i].index, indexes, 3, parts[i])) return 1;
+  }
+  toprf_thresholdcombine(3, parts, beta);
+  return 0;
+}
+
+// the number of batches the batch proxy got
+static int proxy_batches;
+
+static int threshold_evalbatch(const uint8_t k[crypto_core_ristretto255_SCALARBYTES],
+                               const size_t n,
+                               const uint8_t alpha[n][crypto_core_ristretto255_BYTES],
+                               uint8_t beta[n][crypto_core_ristretto255_BYTES],
+                               uint8_t fails[n]) {
+  proxy_batches++;
+  for(size_t i=0;i<n;i++) fails[i] = (threshold_eval(k, alpha[i], beta[i]) != 0);
+  return 0;
+}
+
+static int test_evalproxy(const uint8_t x[crypto_core_ristretto255_SCALARBYTES],
+                          const TOPRF_Share shares[3]) {
+  const toprf_cfg cfg = { .eval = threshold_eval };
+  uint8_t P[crypto_core_ristretto255_BYTES], v[crypto_core_ristretto255_BYTES], r[crypto_core_ristretto255_BYTES];
+  uint8_t k[crypto_core_ristretto255_SCALARBYTES], Ps[2][crypto_core_ristretto255_BYTES], Zs[2][crypto_core_ristretto255_BYTES], fails[2];
+  crypto_core_ristretto255_random(P);
+  crypto_core_ristretto255_scalar_random(k);
+  proxy_shares = shares;
+
+  // the key is ignored by the proxy, and used without one
+  if(oprf_Evaluate_cfg(&cfg, k, P, r)) return 1;
+  if(crypto_scalarmult_ristretto255(v, x, P)) return 1;
+  if(memcmp(v,r,sizeof v)!=0) {
+    fprintf(stderr,"\e[0;31moprf_Evaluate_cfg failed to use the proxy!\e[0m\n");
+    return 1;
+  }
+  if(oprf_Evaluate_cfg(NULL, k, P, r)) return 1;
+  if(crypto_scalarmult_ristretto255(v, k, P)) return 1;
+  if(memcmp(v,r,sizeof v)!=0) {
+    fprintf(stderr,"\e[0;31moprf_Evaluate_cfg failed without a proxy!\e[0m\n");
+    return 1;
+  }
+
+  // batches fall back to the single element proxy
+  memcpy(Ps[0], P, sizeof P);
+  crypto_core_ristretto255_random(Ps[1]);
+  if(oprf_EvaluateBatch_cfg(&cfg, k, 2, Ps, Zs, fails)) return 1;
+  for(int i=0;i<2;i++) {
+    if(crypto_scalarmult_ristretto255(v, x, Ps[i])) return 1;
+    if(memcmp(v,Zs[i],sizeof v)!=0) {
+      fprintf(stderr,"\e[0;31moprf_EvaluateBatch_cfg failed to use the proxy!\e[0m\n");
+      return 1;
+    }
+  }
+
+  // the global batch proxy gets the whole batch at once
+  if(oprf_set_evalbatchproxy(threshold_evalbatch)) return 1;
+  proxy_batches = 0;
+  const int ret = oprf_EvaluateBatch(k, 2, Ps, Zs, fails);
+  oprf_clear_evalproxy();
+  if(ret || proxy_batches!=1) return 1;
+  for(int i=0;i<2;i++) {
+    if(crypto_scalarmult_ristretto255(v, x, Ps[i])) return 1;
+    if(memcmp(v,Zs[i],sizeof v)!=0) {
+      fprintf(stderr,"\e[0;31moprf_EvaluateBatch failed to use the batch proxy!\e[0m\n");
+      return 1;
+    }
+  }
+  return 0;
+}
+
+static int test_coeffs(const uint8_t x[crypto_core_ristretto255_SCALARBYTES],
+                       const TOPRF_Share shares[3]) {
+  // responders in a different order than the shares
+  uint8_t indexes[3] = {shares[2].index, shares[0].index, shares[1].index};
+  uint8_t coeffs[3][crypto_core_ristretto255_SCALARBYTES], c[crypto_core_ristretto255_SCALARBYTES];
+  if(toprf_coeffs(3, indexes, coeffs)) return 1;
+  for(int i=0;i<3;i++) {
+    coeff(indexes[i], 3, indexes, c);
+    if(memcmp(c, coeffs[i], sizeof c)!=0) {
+      fprintf(stderr,"\e[0;31mtoprf_coeffs differs from coeff!\e[0m\n");
+      return 1;
+    }
+  }
+
+  uint8_t P[crypto_core_ristretto255_BYTES], v[crypto_core_ristretto255_BYTES], r[crypto_core_ristretto255_BYTES];
+  uint8_t parts[3][TOPRF_Part_BYTES];
+  crypto_core_ristretto255_random(P);
+  for(int i=0;i<3;i++) {
+    if(toprf_Evaluate_coeffs((const uint8_t*) &shares[i], P, shares[i].index, indexes, 3, coeffs, parts[i])) return 1;
+  }
+  toprf_thresholdcombine(3, parts, r);
+  if(crypto_scalarmult_ristretto255(v, x, P)) return 1;
+  if(memcmp(v,r,sizeof v)!=0) {
+    fprintf(stderr,"\e[0;31mtoprf_Evaluate_coeffs failed to evaluate!\e[0m\n");
+    return 1;
+  }
+
+  uint8_t duplicates[3] = {indexes[0], indexes[1], indexes[0]};
+  if(toprf_coeffs(3, duplicates, coeffs)==0) {
+    fprintf(stderr,"\e[0;31mtoprf_coeffs accepted duplicate indexes!\e[0m\n");
+    return 1;
+  }
+  return 0;
+}
+
+static int test_combiner(const uint8_t x[crypto_core_ristretto255_SCALARBYTES],
+                         const uint8_t n, const TOPRF_Share shares[n]) {
+  const uint8_t threshold = 3;
+  uint8_t P[crypto_core_ristretto255_BYTES], v[crypto_core_ristretto255_BYTES], r[crypto_core_ristretto255_BYTES];
+  uint8_t parts[n][TOPRF_Part_BYTES];
+  crypto_core_ristretto255_random(P);
+  for(int i=0;i<n;i++) {
+    parts[i][0] = shares[i].index;
+    if(crypto_scalarmult_ristretto255(parts[i]+1, shares[i].value, P)) return 1;
+  }
+  if(crypto_scalarmult_ristretto255(v, x, P)) return 1;
+
+  ristretto255_table tables[threshold];
+  TOPRF_Combiner c;
+  toprf_combiner_init(&c, threshold, tables);
+
+  uint8_t invalid[TOPRF_Part_BYTES];
+  memcpy(invalid, parts[0], sizeof invalid);
+  invalid[0] = 0;
+  if(toprf_combiner_add(&c, invalid, r)!=-1) return 1;
+  invalid[0] = 1;
+  memset(invalid+1, 0xff, crypto_core_ristretto255_BYTES);
+  if(toprf_combiner_add(&c, invalid, r)!=-1) return 1;
+
+  // responses arrive in any order, duplicates are rejected
+  if(toprf_combiner_add(&c, parts[4], r)!=0) return 1;
+  if(toprf_combiner_add(&c, parts[4], r)!=-1) return 1;
+  if(toprf_combiner_add(&c, parts[1], r)!=0) return 1;
+  if(toprf_combiner_add(&c, parts[2], r)!=1) return 1;
+  if(toprf_combiner_add(&c, parts[0], r)!=-2) return 1;
+
+  if(memcmp(v,r,sizeof v)!=0) {
+    fprintf(stderr,"\e[0;31mtoprf_combiner failed to combine!\e[0m\n");
+    return 1;
+  }
+  return 0;
+}
+
+static int test_cheater(const uint8_t n, const uint8_t threshold,
+                        const uint8_t commitments[n][threshold][crypto_core_ristretto255_BYTES],
+                        const TOPRF_Share shares[n][n]) {
+  // P_1 verifies the shares it got, one of which is corrupted
+  TOPRF_Share sent_shares[n];
+  for(int j=0;j<n;j++) {
+    memcpy(&sent_shares[j], &shares[j][0], sizeof(TOPRF_Share));
+  }
+  if(dkg_verify_commitments_batch(n, threshold, 1, commitments, sent_shares)) {
+    fprintf(stderr,"\e[0;31mbatch verification of correct shares failed!\e[0m\n");
+    return 1;
+  }
+  sent_shares[3].value[0]^=1;
+  uint8_t fails[n], fails_len=0;
+  if(dkg_verify_commitments_batch(n, threshold, 1, commitments, sent_shares)==0 ||
+     dkg_verify_commitments(n, threshold, 1, commitments, sent_shares, fails, &fails_len)!=1 ||
+     fails_len!=1 || fails[0]!=4) {
+    fprintf(stderr,"\e[0;31mfailed to detect corrupted share!\e[0m\n");
+    return 1;
+  }
+  return 0;
+}
+
+static int test_verify_parallel(void) {
+  // enough dealers for several jobs, the results must be those of the serial version
+  const uint8_t n=20, threshold=5, self=10;
+  uint8_t commitments[n][threshold][crypto_core_ristretto255_BYTES];
+  TOPRF_Share shares[n][n], received[n];
+  for(int i=0;i<n;i++) {
+    if(dkg_start(n, threshold, commitments[i], shares[i])) return 1;
+    memcpy(&received[i], &shares[i][self-1], sizeof(TOPRF_Share));
+  }
+  WorkerPool *pool = workerpool_new(3);
+  if(pool==NULL) return 1;
+  uint8_t fails[n], fails_len=0xff, pfails[n], pfails_len=0xff;
+  int ret = 0;
+  if(dkg_verify_commitments_parallel(n, threshold, self, commitments, received, pfails, &pfails_len, workerpool_run, pool)!=0 ||
+     pfails_len!=0) ret = 1;
+  // the share of self is not checked
+  received[2].value[0]^=1;
+  received[16].value[5]^=1;
+  received[self-1].value[0]^=1;
+  if(dkg_verify_commitments(n, threshold, self, commitments, received, fails, &fails_len)!=1 ||
+     dkg_verify_commitments_parallel(n, threshold, self, commitments, received, pfails, &pfails_len, workerpool_run, pool)!=1 ||
+     fails_len!=2 || pfails_len!=fails_len || memcmp(fails, pfails, fails_len)!=0 || pfails[0]!=3 || pfails[1]!=17) ret = 1;
+  workerpool_free(pool);
+  if(ret) fprintf(stderr,"\e[0;31mparallel verification of commitments differs!\e[0m\n");
+  return ret;
+}
+
+static int test_key_delta(const uint8_t x[crypto_core_ristretto255_SCALARBYTES],
+                          const uint8_t n, const TOPRF_Share shares[n]) {
+  // rotating to a new key from a new sharing
+  uint8_t k_new[crypto_core_ristretto255_SCALARBYTES], delta[crypto_core_ristretto255_SCALARBYTES];
+  uint8_t delta2[crypto_core_ristretto255_SCALARBYTES];
+  uint8_t new_shares[n][TOPRF_Share_BYTES];
+  crypto_core_ristretto255_scalar_random(k_new);
+  toprf_create_shares(k_new, n, 3, new_shares);
+  if(oprf_KeyDelta(x, k_new, delta)) return 1;
+  if(toprf_KeyDelta(3, (const uint8_t (*)[TOPRF_Share_BYTES]) shares, 4, new_shares+1, delta2) ||
+     memcmp(delta, delta2, sizeof delta)!=0) {
+    fprintf(stderr,"\e[0;31mtoprf_KeyDelta differs from oprf_KeyDelta!\e[0m\n");
+    return 1;
+  }
+
+  // updating a batch of HashDH outputs in place, in several jobs on a pool
+  enum { N_LEN = 2500 };
+  static uint8_t P[N_LEN][crypto_core_ristretto255_BYTES], N[N_LEN][crypto_core_ristretto255_BYTES];
+  static uint8_t fails[N_LEN];
+  uint8_t v[crypto_core_ristretto255_BYTES];
+  for(int i=0;i<N_LEN;i++) {
+    crypto_core_ristretto255_random(P[i]);
+    if(crypto_scalarmult_ristretto255(N[i], x, P[i])) return 1;
+  }
+  memset(N[7], 0xff, sizeof N[7]);
+  WorkerPool *pool = workerpool_new(2);
+  if(pool==NULL) return 1;
+  const int ret = oprf_ApplyDeltaBatch(delta, N_LEN, N, N, fails, workerpool_run, pool);
+  workerpool_free(pool);
+  if(ret!=1 || fails[7]!=1) {
+    fprintf(stderr,"\e[0;31moprf_ApplyDeltaBatch failed to reject invalid element!\e[0m\n");
+    return 1;
+  }
+  for(int i=0;i<N_LEN;i++) {
+    if(i==7) continue;
+    if(crypto_scalarmult_ristretto255(v, k_new, P[i]) || fails[i] || memcmp(v, N[i], sizeof v)!=0) {
+      fprintf(stderr,"\e[0;31moprf_ApplyDeltaBatch failed to update!\e[0m\n");
+      return 1;
+    }
+  }
+
+  // rotating the shares with a random public delta
+  uint8_t parts[3][TOPRF_Part_BYTES], old[crypto_core_ristretto255_BYTES], r[crypto_core_ristretto255_BYTES];
+  uint8_t updated[TOPRF_Share_BYTES];
+  crypto_core_ristretto255_scalar_random(delta);
+  for(int i=0;i<3;i++) {
+    if(toprf_UpdateShare((const uint8_t*) &shares[i+1], delta, updated)) return 1;
+    parts[i][0] = updated[0];
+    if(crypto_scalarmult_ristretto255(parts[i]+1, updated+1, P[0])) return 1;
+  }
+  if(toprf_thresholdmult(3, parts, r)) return 1;
+  if(crypto_scalarmult_ristretto255(old, x, P[0]) || oprf_ApplyDelta(delta, old, v) ||
+     memcmp(v, r, sizeof v)!=0) {
+    fprintf(stderr,"\e[0;31mtoprf_UpdateShare failed to rotate the key!\e[0m\n");
+    return 1;
+  }
+  return 0;
+}
+
+static int test_wide(void) {
+  // a DKG with more peers than fit into the 8 bit indexes
+  enum { n=300, threshold=3 };
+  uint8_t (*commitments)[threshold][crypto_core_ristretto255_BYTES] = malloc(n * sizeof *commitments);
+  TOPRF_WideShare (*shares)[n] = malloc(n * sizeof *shares);
+  TOPRF_WideShare *sent_shares = malloc(n * sizeof(TOPRF_WideShare));
+  TOPRF_WideShare *final_shares = malloc(n * sizeof(TOPRF_WideShare));
+  uint16_t *fails = malloc(n * sizeof(uint16_t));
+  uint16_t fails_len;
+  int ret = 1;
+  if(!commitments || !shares || !sent_shares || !final_shares || !fails) goto done;
+
+  for(int i=0;i<n;i++) {
+    if(dkg_wide_start(n, threshold, commitments[i], shares[i])) goto done;
+  }
+
+  for(int i=0;i<n;i++) {
+    for(int j=0;j<n;j++) {
+      memcpy(&sent_shares[j], &shares[j][i], sizeof(TOPRF_WideShare));
+    }
+    // verifying is the expensive part, only some of the peers do it
+    if(i==0 || i==255 || i==n-1) {
+      if(dkg_wide_verify_commitments(n, threshold, (uint16_t) (i+1), commitments, sent_shares, fails, &fails_len)) {
+        fprintf(stderr,"\e[0;31m[%d] failed to verify wide commitments!\e[0m\n", i+1);
+        goto done;
+      }
+    }
+    if(i==n-1) {
+      sent_shares[279].value[0]^=1;
+      if(dkg_wide_verify_commitments(n, threshold, (uint16_t) (i+1), commitments, sent_shares, fails, &fails_len)!=1 ||
+         fails_len!=1 || fails[0]!=280) {
+        fprintf(stderr,"\e[0;31mfailed to detect corrupted wide share!\e[0m\n");
+        goto done;
+      }
+      if(dkg_wide_verify_commitment(n, threshold, (uint16_t) (i+1), 280, commitments[279], sent_shares[279])==0) {
+        fprintf(stderr,"\e[0;31mfailed to detect corrupted wide share!\e[0m\n");
+        goto done;
+      }
+      sent_shares[279].value[0]^=1;
+      if(dkg_wide_verify_commitment(n, threshold, (uint16_t) (i+1), 280, commitments[279], sent_shares[279])) {
+        fprintf(stderr,"\e[0;31mfailed to verify wide commitment!\e[0m\n");
+        goto done;
+      }
+    }
+    dkg_wide_finish(n, sent_shares, (uint16_t) (i+1), &final_shares[i]);
+  }
+
+  // any threshold of the shares reconstructs the same secret
+  uint8_t x[crypto_core_ristretto255_SCALARBYTES], y[crypto_core_ristretto255_SCALARBYTES];
+  TOPRF_WideShare subset[3] = {final_shares[n-1], final_shares[255], final_shares[1]};
+  if(dkg_wide_reconstruct(threshold, final_shares, x)) goto done;
+  if(dkg_wide_reconstruct(threshold, subset, y)) goto done;
+  if(memcmp(x, y, sizeof x)!=0) {
+    fprintf(stderr,"\e[0;31mwide reconstructions differ!\e[0m\n");
+    goto done;
+  }
+
+  // a refresh keeps the secret, the identity stands in for the
+  // commitment to the constant term
+  memset(commitments, 0, n * sizeof *commitments);
+  for(int i=0;i<n;i++) {
+    if(dkg_wide_start_refresh(n, threshold, &commitments[i][1], shares[i])) goto done;
+  }
+  for(int i=0;i<n;i++) {
+    for(int j=0;j<n;j++) {
+      memcpy(&sent_shares[j], &shares[j][i], sizeof(TOPRF_WideShare));
+    }
+    if(i==n-1) {
+      WorkerPool *pool = workerpool_new(3);
+      if(pool==NULL) goto done;
+      sent_shares[99].value[0]^=1;
+      const int vret = dkg_wide_verify_commitments_parallel(n, threshold, (uint16_t) (i+1), commitments, sent_shares,
+                                                            fails, &fails_len, workerpool_run, pool);
+      sent_shares[99].value[0]^=1;
+      if(vret!=1 || fails_len!=1 || fails[0]!=100 ||
+         dkg_wide_verify_commitments_parallel(n, threshold, (uint16_t) (i+1), commitments, sent_shares,
+                                              fails, &fails_len, workerpool_run, pool)!=0) {
+        workerpool_free(pool);
+        fprintf(stderr,"\e[0;31mfailed to verify wide refresh commitments!\e[0m\n");
+        goto done;
+      }
+      workerpool_free(pool);
+    }
+    if(dkg_wide_finish_refresh(n, sent_shares, (uint16_t) (i+1), &final_shares[i], &final_shares[i])) goto done;
+  }
+  if(dkg_wide_reconstruct(threshold, &final_shares[n-threshold], y) || memcmp(x, y, sizeof x)!=0) {
+    fprintf(stderr,"\e[0;31mwide refresh changed the secret!\e[0m\n");
+    goto done;
+  }
+  subset[0] = final_shares[n-1];
+  subset[1] = final_shares[255];
+  subset[2] = final_shares[1];
+
+  // as do dense sets of more than threshold shares, skipping some
+  memmove(&final_shares[10], &final_shares[13], (n-13) * sizeof(TOPRF_WideShare));
+  if(dkg_wide_reconstruct(n-3, final_shares, y) || memcmp(x, y, sizeof x)!=0) {
+    fprintf(stderr,"\e[0;31mfailed to reconstruct from a dense set of wide shares!\e[0m\n");
+    goto done;
+  }
+
+  // and in the exponent
+  uint8_t parts[threshold][TOPRF_WidePart_BYTES];
+  uint8_t g[crypto_core_ristretto255_BYTES], r[crypto_core_ristretto255_BYTES], v[crypto_core_ristretto255_BYTES];
+  uint8_t one[crypto_core_ristretto255_SCALARBYTES]={1};
+  crypto_scalarmult_ristretto255_base(g, one);
+  for(int i=0;i<threshold;i++) {
+    if(toprf_wide_Evaluate((const uint8_t*) &subset[i], g, parts[i])) goto done;
+  }
+  if(toprf_wide_thresholdmult(threshold, parts, r)) goto done;
+  crypto_scalarmult_ristretto255_base(v, x);
+  if(memcmp(v, r, sizeof v)!=0) {
+    fprintf(stderr,"\e[0;31mwide thresholdmult failed!\e[0m\n");
+    goto done;
+  }
+
+  // duplicate indexes are rejected
+  memcpy(parts[1], parts[0], TOPRF_WidePart_BYTES);
+  if(toprf_wide_thresholdmult(threshold, parts, r)==0) {
+    fprintf(stderr,"\e[0;31mwide thresholdmult accepted duplicate indexes!\e[0m\n");
+    goto done;
+  }
+
+  // dealer shares of a plain threshold sharing
+  uint8_t (*dealt)[TOPRF_WideShare_BYTES] = (uint8_t (*)[TOPRF_WideShare_BYTES]) shares[0];
+  if(toprf_wide_create_shares(x, n, 5, dealt)) goto done;
+  TOPRF_WideShare picked[5];
+  for(int i=0;i<5;i++) memcpy(&picked[i], dealt[n-1-i*11], sizeof(TOPRF_WideShare));
+  if(dkg_wide_reconstruct(5, picked, y) || memcmp(x, y, sizeof x)!=0) {
+    fprintf(stderr,"\e[0;31mfailed to reconstruct wide dealer shares!\e[0m\n");
+    goto done;
+  }
+
+  fprintf(stderr, "\e[0;32mwide dkg correct!\e[0m\n");
+  ret = 0;
+
+done:
+  free(commitments);
+  free(shares);
+  free(sent_shares);
+  free(final_shares);
+  free(fails);
+  return ret;
+}
+
 int main(void) {
   debug = 1;
   uint8_t n=5, threshold=3;
@@ -93,6 +549,9 @@ int main(void) {
   TOPRF_Share sent_shares[n];
   TOPRF_Share final_shares[n];
 
+  if(test_cheater(n, threshold, commitments, shares)) return 1;
+  if(test_verify_parallel()) return 1;
+
   for(int i=0;i<n;i++) {
     for(int j=0;j<n;j++) {
       memcpy(&sent_shares[j], &shares[j][i], sizeof(TOPRF_Share));
@@ -131,16 +590,22 @@ int main(void) {
   // x = sum(a[0]) == 0x28 if debian_rng_scalar is used
   uint8_t x[crypto_core_ristretto255_BYTES]={0x28};
   if(test_dkg_start(n, x, final_shares)) return 1;
+  if(test_keyctx(x, final_shares)) return 1;
+  if(test_coeffs(x, final_shares)) return 1;
+  if(test_evalproxy(x, final_shares)) return 1;
+  if(test_combiner(x, n, final_shares)) return 1;
+  if(test_key_delta(x, n, final_shares)) return 1;
 
   uint8_t v[crypto_core_ristretto255_BYTES];
-  dkg_reconstruct(threshold, final_shares, v);
-  if(memcmp(v,x,sizeof v)!=0) {
+  if(dkg_reconstruct(threshold, final_shares, v) || memcmp(v,x,sizeof v)!=0) {
     fprintf(stderr,"\e[0;31mfailed to verify reconstruction of generated x from final shares!\e[0m\n");
     dump(x,sizeof x, "x ");
     dump(v,sizeof v, "v ");
     return 1;
   }
 
+  if(test_wide()) return 1;
+
   fprintf(stderr, "\e[0;32meverything correct!\e[0m\n");
   return 0;
 }
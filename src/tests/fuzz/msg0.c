@@ -9,7 +9,7 @@
 #define tpdkg_freshness_TIMEOUT 10
 
 int main(void) {
-  uint8_t n=3, t=2;
+  uint16_t n=3, t=2;
   uint8_t peer_lt_pks[crypto_sign_PUBLICKEYBYTES];
   // only known by corresponding peer
   uint8_t peer_lt_sks[crypto_sign_SECRETKEYBYTES];
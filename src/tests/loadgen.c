@@ -0,0 +1,344 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <errno.h>
+#include <poll.h>
+#include <netdb.h>
+#include <pthread.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sodium.h>
+#include "oprf.h"
+#include "toprf.h"
+
+// drives concurrent clients through a threshold OPRF against real
+// shareholder servers - like ../oprfd - speaking the wire format of
+// pyoprf.multiplexer, and reports the throughput and the latency
+// percentiles end-to-end, of the client side computations, and of
+// each shareholder, so that a slowdown can be pinned on the client
+// combine, or the network and evaluation of a shareholder.
+//
+// run as: % ./loadgen [-c clients] [-r requests] [-t threshold]
+//                     [-l input_len] [-w timeout_ms] [-f json|csv]
+//                     host:port host:port ...
+//
+// each client sends its blinded element to all shareholders, combines
+// the first t responses with toprf_thresholdmult() and reads the rest
+// of the responses before its next request. the latency of a
+// shareholder is the time from sending the request to its response.
+
+#define REQ_SIZE crypto_core_ristretto255_BYTES
+#define RESP_SIZE TOPRF_Part_BYTES
+
+static const uint8_t fail_msg[] = "\x00\x04" "fail";
+
+typedef struct {
+  unsigned clients;
+  unsigned requests;
+  uint8_t n, t;
+  uint8_t input_len;
+  int timeout_ms;
+  char **servers;
+} Params;
+
+typedef struct {
+  const Params *p;
+  pthread_barrier_t *barrier;
+  int fds[128];
+  // the latencies of the completed requests in ns
+  uint64_t *e2e;        // [requests]
+  uint64_t *client;     // [requests]
+  uint64_t *rtt;        // [n][requests]
+  size_t *rtt_len;      // [n]
+  size_t done;
+  size_t errors;
+  double start, end;
+} Client;
+
+typedef struct {
+  size_t count;
+  double mean, p50, p99, p999, max;
+} Stats;
+
+static uint64_t now_ns(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t) ts.tv_sec * 1000000000ULL + (uint64_t) ts.tv_nsec;
+}
+
+static int connect_to(const char *server) {
+  char host[256];
+  const char *colon = strrchr(server, ':');
+  if(colon==NULL || (size_t) (colon - server) >= sizeof host) return -1;
+  memcpy(host, server, (size_t) (colon - server));
+  host[colon - server] = 0;
+
+  struct addrinfo hints, *res;
+  memset(&hints, 0, sizeof hints);
+  hints.ai_family = AF_UNSPEC;
+  hints.ai_socktype = SOCK_STREAM;
+  if(0!=getaddrinfo(host, colon+1, &hints, &res)) return -1;
+  int fd = -1;
+  for(struct addrinfo *ai = res; ai!=NULL; ai = ai->ai_next) {
+    fd = socket(ai->ai_family, ai->ai_socktype, ai->ai_protocol);
+    if(fd<0) continue;
+    if(0==connect(fd, ai->ai_addr, ai->ai_addrlen)) break;
+    close(fd);
+    fd = -1;
+  }
+  freeaddrinfo(res);
+  if(fd>=0) {
+    const int one = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof one);
+  }
+  return fd;
+}
+
+static int send_all(const int fd, const uint8_t *buf, size_t len) {
+  while(len>0) {
+    const ssize_t sent = send(fd, buf, len, MSG_NOSIGNAL);
+    if(sent<0) {
+      if(errno==EINTR) continue;
+      return 1;
+    }
+    buf += sent;
+    len -= (size_t) sent;
+  }
+  return 0;
+}
+
+// runs one request, returns 0 on success
+static int request(Client *c, const uint8_t *input) {
+  const Params *p = c->p;
+  const uint8_t n = p->n, t = p->t;
+  uint8_t r[crypto_core_ristretto255_SCALARBYTES], alpha[REQ_SIZE];
+  uint8_t resp[n][RESP_SIZE], parts[t][TOPRF_Part_BYTES];
+  size_t got[n];
+  uint8_t valid = 0, answered = 0;
+  memset(got, 0, sizeof got);
+
+  const uint64_t t0 = now_ns();
+  if(oprf_Blind(input, p->input_len, r, alpha)) return 1;
+  const uint64_t t1 = now_ns();
+  for(uint8_t i=0;i<n;i++) {
+    if(send_all(c->fds[i], alpha, sizeof alpha)) return 1;
+  }
+
+  uint64_t client_ns = t1 - t0, t_end = 0;
+  struct pollfd pfds[n];
+  while(answered < n) {
+    nfds_t len = 0;
+    uint8_t idx[n];
+    for(uint8_t i=0;i<n;i++) {
+      if(got[i]==RESP_SIZE) continue;
+      pfds[len] = (struct pollfd) { .fd = c->fds[i], .events = POLLIN };
+      idx[len++] = i;
+    }
+    const int ready = poll(pfds, len, p->timeout_ms);
+    if(ready<0 && errno==EINTR) continue;
+    if(ready<=0) return 1;
+    for(nfds_t j=0;j<len;j++) {
+      if(pfds[j].revents==0) continue;
+      const uint8_t i = idx[j];
+      const ssize_t rd = recv(c->fds[i], resp[i] + got[i], RESP_SIZE - got[i], 0);
+      if(rd<0 && errno==EINTR) continue;
+      if(rd<=0) {
+        // a closed connection after a fail message is a failed evaluation
+        if(got[i]==sizeof fail_msg - 1 && memcmp(resp[i], fail_msg, got[i])==0) return 2;
+        return 1;
+      }
+      got[i] += (size_t) rd;
+      if(got[i] < RESP_SIZE) continue;
+      c->rtt[(size_t) i * p->requests + c->rtt_len[i]++] = now_ns() - t1;
+      answered++;
+      if(valid==t) continue;
+      memcpy(parts[valid++], resp[i], TOPRF_Part_BYTES);
+      if(valid<t) continue;
+      // the first t responses are enough to finish the oprf
+      const uint64_t tc = now_ns();
+      uint8_t beta[crypto_core_ristretto255_BYTES], N[crypto_core_ristretto255_BYTES], rwd[OPRF_BYTES];
+      if(toprf_thresholdmult(t, parts, beta)) return 1;
+      if(oprf_Unblind(r, beta, N)) return 1;
+      if(oprf_Finalize(input, p->input_len, N, rwd)) return 1;
+      t_end = now_ns();
+      client_ns += t_end - tc;
+    }
+  }
+  c->e2e[c->done] = t_end - t0;
+  c->client[c->done] = client_ns;
+  c->done++;
+  return 0;
+}
+
+static void *client_loop(void *arg) {
+  Client *c = (Client*) arg;
+  const Params *p = c->p;
+  uint8_t input[255];
+  int ok = 1;
+  for(uint8_t i=0;i<p->n;i++) {
+    c->fds[i] = connect_to(p->servers[i]);
+    if(c->fds[i]<0) {
+      fprintf(stderr, "cannot connect to %s\n", p->servers[i]);
+      ok = 0;
+    }
+  }
+  pthread_barrier_wait(c->barrier);
+  c->start = (double) now_ns() / 1e9;
+  for(unsigned i=0;ok && i<p->requests;i++) {
+    randombytes_buf(input, p->input_len);
+    const int ret = request(c, input);
+    if(ret==0) continue;
+    c->errors++;
+    // the streams are out of sync after an error
+    fprintf(stderr, "%s, client stops\n", ret==2 ? "a shareholder failed to evaluate" : "request failed");
+    ok = 0;
+  }
+  c->end = (double) now_ns() / 1e9;
+  for(uint8_t i=0;i<p->n;i++) {
+    if(c->fds[i]>=0) close(c->fds[i]);
+  }
+  return NULL;
+}
+
+static int cmp_u64(const void *a, const void *b) {
+  const uint64_t x = *(const uint64_t*) a, y = *(const uint64_t*) b;
+  return (x > y) - (x < y);
+}
+
+// lat is sorted in place, the results are in us
+static Stats stats(uint64_t *lat, const size_t len) {
+  Stats s = { .count = len };
+  if(len==0) return s;
+  qsort(lat, len, sizeof lat[0], cmp_u64);
+  double sum = 0;
+  for(size_t i=0;i<len;i++) sum += (double) lat[i];
+  s.mean = sum / (double) len / 1e3;
+  s.p50 = (double) lat[(len - 1) * 50 / 100] / 1e3;
+  s.p99 = (double) lat[(len - 1) * 99 / 100] / 1e3;
+  s.p999 = (double) lat[(len - 1) * 999 / 1000] / 1e3;
+  s.max = (double) lat[len - 1] / 1e3;
+  return s;
+}
+
+static void report(const int json, const char **sep, const char *name, const Stats *s) {
+  if(json) {
+    printf("%s  {\"name\": \"%s\", \"count\": %zu, \"mean_us\": %.1f, \"p50_us\": %.1f, \"p99_us\": %.1f, \"p999_us\": %.1f, \"max_us\": %.1f}",
+           *sep, name, s->count, s->mean, s->p50, s->p99, s->p999, s->max);
+    *sep = ",\n";
+  } else {
+    printf("%s,%zu,%.1f,%.1f,%.1f,%.1f,%.1f\n", name, s->count, s->mean, s->p50, s->p99, s->p999, s->max);
+  }
+}
+
+static void usage(const char *self) {
+  fprintf(stderr, "usage: %s [-c clients] [-r requests] [-t threshold] [-l input_len] [-w timeout_ms] [-f json|csv] host:port...\n", self);
+  exit(1);
+}
+
+int main(int argc, char **argv) {
+  Params p = {.clients = 1, .requests = 1000, .t = 2, .input_len = 32, .timeout_ms = 5000};
+  const char *format = "json";
+  int opt;
+  while((opt = getopt(argc, argv, "c:r:t:l:w:f:h")) != -1) {
+    switch(opt) {
+    case 'c': p.clients = (unsigned) atoi(optarg); break;
+    case 'r': p.requests = (unsigned) atoi(optarg); break;
+    case 't': p.t = (uint8_t) atoi(optarg); break;
+    case 'l': p.input_len = (uint8_t) atoi(optarg); break;
+    case 'w': p.timeout_ms = atoi(optarg); break;
+    case 'f': format = optarg; break;
+    default: usage(argv[0]);
+    }
+  }
+  const int servers = argc - optind;
+  if(servers < 1 || servers > 127 || p.t < 1 || p.t > servers || p.clients < 1 || p.requests < 1 || p.input_len < 1) usage(argv[0]);
+  p.n = (uint8_t) servers;
+  p.servers = argv + optind;
+  const int json = strcmp(format, "json") == 0;
+  if(!json && strcmp(format, "csv") != 0) usage(argv[0]);
+
+  if(sodium_init() < 0) return 1;
+
+  const size_t reqs = p.requests;
+  Client *clients = calloc(p.clients, sizeof(Client));
+  pthread_t *tids = calloc(p.clients, sizeof(pthread_t));
+  if(clients==NULL || tids==NULL) return 1;
+  pthread_barrier_t barrier;
+  pthread_barrier_init(&barrier, NULL, p.clients);
+  for(unsigned i=0;i<p.clients;i++) {
+    Client *c = &clients[i];
+    c->p = &p;
+    c->barrier = &barrier;
+    c->e2e = malloc(reqs * sizeof(uint64_t));
+    c->client = malloc(reqs * sizeof(uint64_t));
+    c->rtt = malloc(p.n * reqs * sizeof(uint64_t));
+    c->rtt_len = calloc(p.n, sizeof(size_t));
+    if(c->e2e==NULL || c->client==NULL || c->rtt==NULL || c->rtt_len==NULL) return 1;
+  }
+  for(unsigned i=0;i<p.clients;i++) {
+    if(pthread_create(&tids[i], NULL, client_loop, &clients[i])) {
+      // cannot continue, the barrier will never be reached
+      fprintf(stderr, "failed to start threads\n");
+      exit(1);
+    }
+  }
+
+  // the time from the first client starting to the last one finishing
+  double start = 0, end = 0;
+  size_t done = 0, errors = 0;
+  for(unsigned i=0;i<p.clients;i++) {
+    pthread_join(tids[i], NULL);
+    if(i==0 || clients[i].start < start) start = clients[i].start;
+    if(i==0 || clients[i].end > end) end = clients[i].end;
+    done += clients[i].done;
+    errors += clients[i].errors;
+  }
+  pthread_barrier_destroy(&barrier);
+  const double elapsed = end - start;
+
+  // merges the latencies of all clients
+  uint64_t *all = malloc(p.clients * reqs * sizeof(uint64_t));
+  if(all==NULL) return 1;
+  const char *sep = "\n";
+  if(json) {
+    printf("{\"clients\": %u, \"n\": %u, \"t\": %u, \"input_len\": %u, \"completed\": %zu, \"errors\": %zu, \"seconds\": %.6f, \"ops_per_s\": %.1f,\n \"results\": [",
+           p.clients, p.n, p.t, p.input_len, done, errors, elapsed, (double) done / elapsed);
+  } else {
+    printf("# completed %zu, errors %zu, seconds %.6f, ops_per_s %.1f\n", done, errors, elapsed, (double) done / elapsed);
+    printf("name,count,mean_us,p50_us,p99_us,p999_us,max_us\n");
+  }
+  for(int which=0;which<2+p.n;which++) {
+    size_t len = 0;
+    for(unsigned i=0;i<p.clients;i++) {
+      const Client *c = &clients[i];
+      if(which==0) {
+        memcpy(all + len, c->e2e, c->done * sizeof(uint64_t));
+        len += c->done;
+      } else if(which==1) {
+        memcpy(all + len, c->client, c->done * sizeof(uint64_t));
+        len += c->done;
+      } else {
+        const size_t s = (size_t) (which - 2);
+        memcpy(all + len, c->rtt + s * reqs, c->rtt_len[s] * sizeof(uint64_t));
+        len += c->rtt_len[s];
+      }
+    }
+    const Stats s = stats(all, len);
+    report(json, &sep, which==0 ? "end-to-end" : which==1 ? "client" : p.servers[which-2], &s);
+  }
+  if(json) printf("\n]}\n");
+
+  for(unsigned i=0;i<p.clients;i++) {
+    free(clients[i].e2e);
+    free(clients[i].client);
+    free(clients[i].rtt);
+    free(clients[i].rtt_len);
+  }
+  free(all);
+  free(clients);
+  free(tids);
+  return errors>0;
+}
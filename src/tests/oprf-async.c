@@ -0,0 +1,110 @@
+#include <stdio.h>
+#include <string.h>
+#include <poll.h>
+#include <pthread.h>
+#include "oprf.h"
+#include "oprf-async.h"
+
+#define N 1000
+
+// a proxy handing the evaluations to a thread, like one talking to
+// remote shareholders would
+typedef struct {
+  pthread_mutex_t lock;
+  pthread_cond_t cond;
+  uint8_t key[crypto_core_ristretto255_SCALARBYTES];
+  uint8_t alpha[N][crypto_core_ristretto255_BYTES];
+  void *user[N];
+  oprf_AsyncQueue *q;
+  size_t submitted, done;
+} Backend;
+
+static int submit(void *arg, const uint8_t k[crypto_core_ristretto255_SCALARBYTES],
+                  const uint8_t alpha[crypto_core_ristretto255_BYTES],
+                  oprf_AsyncQueue *q, void *user) {
+  (void) k;
+  Backend *b = arg;
+  pthread_mutex_lock(&b->lock);
+  if(b->submitted==N) {
+    pthread_mutex_unlock(&b->lock);
+    return 1;
+  }
+  memcpy(b->alpha[b->submitted], alpha, crypto_core_ristretto255_BYTES);
+  b->user[b->submitted++] = user;
+  b->q = q;
+  pthread_cond_signal(&b->cond);
+  pthread_mutex_unlock(&b->lock);
+  return 0;
+}
+
+static void *backend(void *arg) {
+  Backend *b = arg;
+  pthread_mutex_lock(&b->lock);
+  while(b->done < N) {
+    while(b->done == b->submitted) pthread_cond_wait(&b->cond, &b->lock);
+    const size_t i = b->done++;
+    pthread_mutex_unlock(&b->lock);
+    uint8_t Z[crypto_core_ristretto255_BYTES];
+    const int status = crypto_scalarmult_ristretto255(Z, b->key, b->alpha[i]);
+    if(oprf_async_complete(b->q, b->user[i], status, Z)) return NULL;
+    pthread_mutex_lock(&b->lock);
+  }
+  pthread_mutex_unlock(&b->lock);
+  return NULL;
+}
+
+int main(void) {
+  static Backend b;
+  static uint8_t alpha[N][crypto_core_ristretto255_BYTES], expected[N][crypto_core_ristretto255_BYTES];
+  static int seen[N];
+  pthread_mutex_init(&b.lock, NULL);
+  pthread_cond_init(&b.cond, NULL);
+  crypto_core_ristretto255_scalar_random(b.key);
+
+  oprf_AsyncQueue *q = oprf_async_new();
+  if(q==NULL) return 1;
+  pthread_t thread;
+  if(pthread_create(&thread, NULL, backend, &b)) return 1;
+
+  const oprf_AsyncCfg cfg = { .eval = submit, .arg = &b };
+  uint8_t k[crypto_core_ristretto255_SCALARBYTES]={0};
+  for(size_t i=0;i<N;i++) {
+    crypto_core_ristretto255_random(alpha[i]);
+    if(crypto_scalarmult_ristretto255(expected[i], b.key, alpha[i])) return 1;
+    if(oprf_EvaluateAsync(&cfg, k, alpha[i], q, expected[i])) return 1;
+  }
+  // the backend refuses more, so this is not completed
+  if(oprf_EvaluateAsync(&cfg, k, alpha[0], q, NULL)==0) return 1;
+
+  size_t done = 0;
+  oprf_Completion c[64];
+  while(done < N) {
+    struct pollfd pfd = { .fd = oprf_async_fd(q), .events = POLLIN };
+    if(poll(&pfd, 1, 5000)!=1) {
+      fprintf(stderr, "\e[0;31mtimeout waiting for completions\e[0m\n");
+      return 1;
+    }
+    const size_t n = oprf_async_poll(q, 64, c);
+    for(size_t i=0;i<n;i++) {
+      const size_t j = (size_t) ((uint8_t (*)[crypto_core_ristretto255_BYTES]) c[i].user - expected);
+      if(j>=N || seen[j]++ || c[i].status!=0 || memcmp(c[i].Z, expected[j], sizeof c[i].Z)!=0) {
+        fprintf(stderr, "\e[0;31mwrong completion\e[0m\n");
+        return 1;
+      }
+    }
+    done += n;
+  }
+  pthread_join(thread, NULL);
+
+  // without a proxy the evaluation completes right away
+  if(oprf_EvaluateAsync(NULL, b.key, alpha[0], q, expected[0])) return 1;
+  if(oprf_async_poll(q, 64, c)!=1 || c[0].user!=expected[0] ||
+     memcmp(c[0].Z, expected[0], sizeof c[0].Z)!=0) return 1;
+  // and the queue is empty again
+  struct pollfd pfd = { .fd = oprf_async_fd(q), .events = POLLIN };
+  if(poll(&pfd, 1, 0)!=0 || oprf_async_poll(q, 64, c)!=0) return 1;
+
+  oprf_async_free(q);
+  fprintf(stderr, "\e[0;32meverything correct!\e[0m\n");
+  return 0;
+}
@@ -0,0 +1,272 @@
+#include <stdio.h>
+#include <string.h>
+#include <sodium.h>
+#include "ristretto255.h"
+#include "utils.h"
+
+// compares ristretto255.c against libsodium for the same inputs
+
+static int check_scalarmult(const uint8_t n[crypto_core_ristretto255_SCALARBYTES],
+                            const uint8_t p[crypto_core_ristretto255_BYTES]) {
+  uint8_t q0[crypto_core_ristretto255_BYTES]={0}, q1[crypto_core_ristretto255_BYTES]={0};
+
+  // a single point msm fails only for invalid points, and yields the
+  // identity where crypto_scalarmult_ristretto255() fails on it
+  const int valid = crypto_core_ristretto255_is_valid_point(p);
+  const int r0 = crypto_scalarmult_ristretto255(q0, n, p);
+  const int r1 = ristretto255_msm(q1, 1, (const uint8_t (*)[crypto_core_ristretto255_SCALARBYTES]) n,
+                                  (const uint8_t (*)[crypto_core_ristretto255_BYTES]) p);
+  if(r1!=(valid ? 0 : -1) || (valid && memcmp(q0,q1,sizeof q0)!=0)) {
+    fail("ristretto255_msm of one point differs from libsodium (%d, %d)", r0, r1);
+    dump(n, crypto_core_ristretto255_SCALARBYTES, "n ");
+    dump(p, crypto_core_ristretto255_BYTES, "p ");
+    dump(q0, sizeof q0, "libsodium ");
+    dump(q1, sizeof q1, "liboprf   ");
+    return 1;
+  }
+  return 0;
+}
+
+static int check_msm(const size_t n) {
+  uint8_t scalars[n][crypto_core_ristretto255_SCALARBYTES];
+  uint8_t points[n][crypto_core_ristretto255_BYTES];
+  uint8_t q0[crypto_core_ristretto255_BYTES]={0}, q1[crypto_core_ristretto255_BYTES], tmp[crypto_core_ristretto255_BYTES];
+
+  for(size_t i=0;i<n;i++) {
+    crypto_core_ristretto255_scalar_random(scalars[i]);
+    crypto_core_ristretto255_random(points[i]);
+    if(crypto_scalarmult_ristretto255(tmp, scalars[i], points[i])) return 1;
+    crypto_core_ristretto255_add(q0, q0, tmp);
+  }
+  if(ristretto255_msm(q1, n, scalars, points) || memcmp(q0,q1,sizeof q0)!=0) {
+    fail("ristretto255_msm differs from libsodium for n=%zu", n);
+    return 1;
+  }
+  // the identity element as a point does not change the result
+  memset(points[n-1], 0, sizeof points[n-1]);
+  memset(q0, 0, sizeof q0);
+  for(size_t i=0;i<n-1;i++) {
+    if(crypto_scalarmult_ristretto255(tmp, scalars[i], points[i])) return 1;
+    crypto_core_ristretto255_add(q0, q0, tmp);
+  }
+  if(ristretto255_msm(q1, n, scalars, points) || memcmp(q0,q1,sizeof q0)!=0) {
+    fail("ristretto255_msm fails with the identity as input for n=%zu", n);
+    return 1;
+  }
+  // invalid points must be rejected
+  memset(points[n/2], 0xff, sizeof points[n/2]);
+  if(ristretto255_msm(q1, n, scalars, points)==0) {
+    fail("ristretto255_msm accepted an invalid point for n=%zu", n);
+    return 1;
+  }
+  return 0;
+}
+
+// ristretto255_msm_vartime() must agree with ristretto255_msm()
+static int check_msm_vartime(const size_t n) {
+  uint8_t scalars[n][crypto_core_ristretto255_SCALARBYTES];
+  uint8_t points[n][crypto_core_ristretto255_BYTES];
+  uint8_t q0[crypto_core_ristretto255_BYTES], q1[crypto_core_ristretto255_BYTES];
+
+  for(unsigned kind=0;kind<4;kind++) {
+    for(size_t i=0;i<n;i++) {
+      memset(scalars[i], 0, sizeof scalars[i]);
+      switch(kind) {
+      case 0: crypto_core_ristretto255_scalar_random(scalars[i]); break;
+      // unreduced, the top bit is ignored
+      case 1: randombytes_buf(scalars[i], sizeof scalars[i]); break;
+      // short, like the powers of a small index
+      case 2: scalars[i][0] = (uint8_t) i; scalars[i][1] = (uint8_t) (i & 1); break;
+      // all ones, the carries of the windows run up to the last digit
+      case 3: memset(scalars[i], 0xff, sizeof scalars[i]); break;
+      }
+      crypto_core_ristretto255_random(points[i]);
+    }
+    // the identity element as a point
+    if(n>1) memset(points[1], 0, sizeof points[1]);
+    if(ristretto255_msm(q0, n, scalars, points) ||
+       ristretto255_msm_vartime(q1, n, scalars, points) ||
+       memcmp(q0,q1,sizeof q0)!=0) {
+      fail("ristretto255_msm_vartime differs from ristretto255_msm for n=%zu, kind %u", n, kind);
+      return 1;
+    }
+  }
+  memset(points[n/2], 0xff, sizeof points[n/2]);
+  if(ristretto255_msm_vartime(q1, n, scalars, points)==0) {
+    fail("ristretto255_msm_vartime accepted an invalid point for n=%zu", n);
+    return 1;
+  }
+  return 0;
+}
+
+static int check_verify_batch(const size_t n) {
+  uint8_t pks[n][crypto_sign_PUBLICKEYBYTES], sk[crypto_sign_SECRETKEYBYTES];
+  uint8_t sigs[n][crypto_sign_BYTES], msgs[n][64];
+  const uint8_t *msg_ptrs[n], *sig_ptrs[n], *pk_ptrs[n];
+  size_t msg_lens[n];
+
+  for(size_t i=0;i<n;i++) {
+    crypto_sign_keypair(pks[i], sk);
+    msg_lens[i] = i % sizeof msgs[i];
+    randombytes_buf(msgs[i], msg_lens[i]);
+    crypto_sign_detached(sigs[i], NULL, msgs[i], msg_lens[i], sk);
+    msg_ptrs[i] = msgs[i];
+    sig_ptrs[i] = sigs[i];
+    pk_ptrs[i] = pks[i];
+  }
+  if(ed25519_verify_batch(n, msg_ptrs, msg_lens, sig_ptrs, pk_ptrs)!=0) {
+    fail("ed25519_verify_batch rejected valid signatures for n=%zu", n);
+    return 1;
+  }
+
+  // the same with the messages hashed in two pieces
+  uint8_t hrams[n][crypto_core_ristretto255_SCALARBYTES];
+  for(size_t i=0;i<n;i++) {
+    crypto_hash_sha512_state hs;
+    ed25519_hram_init(&hs, sigs[i], pks[i]);
+    crypto_hash_sha512_update(&hs, msgs[i], msg_lens[i]/2);
+    crypto_hash_sha512_update(&hs, msgs[i] + msg_lens[i]/2, msg_lens[i] - msg_lens[i]/2);
+    ed25519_hram_final(&hs, hrams[i]);
+  }
+  if(ed25519_verify_batch_hram(n, hrams, sig_ptrs, pk_ptrs)!=0) {
+    fail("ed25519_verify_batch_hram rejected valid signatures for n=%zu", n);
+    return 1;
+  }
+  hrams[n/2][0] ^= 1;
+  if(ed25519_verify_batch_hram(n, hrams, sig_ptrs, pk_ptrs)==0) {
+    fail("ed25519_verify_batch_hram accepted a wrong hash for n=%zu", n);
+    return 1;
+  }
+
+  // a corrupted signature, message or public key must fail the batch
+  const size_t c = n/2;
+  sigs[c][3] ^= 1;
+  if(crypto_sign_verify_detached(sigs[c], msgs[c], msg_lens[c], pks[c])==0 ||
+     ed25519_verify_batch(n, msg_ptrs, msg_lens, sig_ptrs, pk_ptrs)==0) {
+    fail("ed25519_verify_batch accepted a corrupted R for n=%zu", n);
+    return 1;
+  }
+  sigs[c][3] ^= 1;
+  sigs[c][40] ^= 1;
+  if(ed25519_verify_batch(n, msg_ptrs, msg_lens, sig_ptrs, pk_ptrs)==0) {
+    fail("ed25519_verify_batch accepted a corrupted S for n=%zu", n);
+    return 1;
+  }
+  sigs[c][40] ^= 1;
+  msg_lens[c]++;
+  if(ed25519_verify_batch(n, msg_ptrs, msg_lens, sig_ptrs, pk_ptrs)==0) {
+    fail("ed25519_verify_batch accepted a corrupted message for n=%zu", n);
+    return 1;
+  }
+  msg_lens[c]--;
+  // the identity as public key is of small order
+  memset(pks[c], 0, sizeof pks[c]);
+  pks[c][0] = 1;
+  if(ed25519_verify_batch(n, msg_ptrs, msg_lens, sig_ptrs, pk_ptrs)==0) {
+    fail("ed25519_verify_batch accepted a small order public key for n=%zu", n);
+    return 1;
+  }
+  return 0;
+}
+
+/* a signature whose R has a torsion component: valid under the
+ * cofactored equation of the batch, but rejected by
+ * crypto_sign_verify_detached(). ed25519_verify() and the batch must
+ * agree on it. */
+static int check_verify_torsion(void) {
+  // the point (0, -1) of order 2
+  static const uint8_t T[32] = {
+    0xec, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+    0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0x7f };
+  uint8_t pk[crypto_sign_PUBLICKEYBYTES], sk[crypto_sign_SECRETKEYBYTES], sig[crypto_sign_BYTES];
+  uint8_t az[crypto_hash_sha512_BYTES], r[crypto_core_ed25519_SCALARBYTES], k[crypto_core_ed25519_SCALARBYTES];
+  uint8_t hram[crypto_hash_sha512_BYTES];
+  const uint8_t msg[] = "torsion";
+  crypto_hash_sha512_state hs;
+
+  crypto_sign_keypair(pk, sk);
+  crypto_hash_sha512(az, sk, 32);
+  az[0] &= 248;
+  az[31] &= 127;
+  az[31] |= 64;
+  crypto_core_ed25519_scalar_random(r);
+  // R = r*B + T, S = r + H(R || A || M)*a
+  if(crypto_scalarmult_ed25519_base_noclamp(sig, r) != 0) return 1;
+  if(crypto_core_ed25519_add(sig, sig, T) != 0) return 1;
+  crypto_hash_sha512_init(&hs);
+  crypto_hash_sha512_update(&hs, sig, 32);
+  crypto_hash_sha512_update(&hs, pk, sizeof pk);
+  crypto_hash_sha512_update(&hs, msg, sizeof msg);
+  crypto_hash_sha512_final(&hs, hram);
+  crypto_core_ed25519_scalar_reduce(k, hram);
+  // a is the clamped first half, the second half is the nonce key
+  memset(az + 32, 0, 32);
+  crypto_core_ed25519_scalar_reduce(az, az);
+  crypto_core_ed25519_scalar_mul(k, k, az);
+  crypto_core_ed25519_scalar_add(sig + 32, r, k);
+
+  const uint8_t *msg_ptr = msg, *sig_ptr = sig, *pk_ptr = pk;
+  const size_t msg_len = sizeof msg;
+  if(crypto_sign_verify_detached(sig, msg, sizeof msg, pk) == 0) {
+    fail("crypto_sign_verify_detached accepted a signature with a torsion component");
+    return 1;
+  }
+  if(ed25519_verify(sig, msg, sizeof msg, pk) != 0 ||
+     ed25519_verify_batch(1, &msg_ptr, &msg_len, &sig_ptr, &pk_ptr) != 0) {
+    fail("ed25519_verify and ed25519_verify_batch disagree with the cofactored equation");
+    return 1;
+  }
+  return 0;
+}
+
+int main(void) {
+  debug = 1;
+  if(sodium_init() < 0) return 1;
+
+  uint8_t n[crypto_core_ristretto255_SCALARBYTES];
+  uint8_t p[crypto_core_ristretto255_BYTES];
+
+  for(unsigned i=0;i<1000;i++) {
+    crypto_core_ristretto255_random(p);
+    crypto_core_ristretto255_scalar_random(n);
+    if(check_scalarmult(n, p)) return 1;
+    // unreduced scalars, with and without the top bit set
+    randombytes_buf(n, sizeof n);
+    if(check_scalarmult(n, p)) return 1;
+    // random bytes, mostly invalid encodings
+    randombytes_buf(p, sizeof p);
+    if(check_scalarmult(n, p)) return 1;
+  }
+
+  // small scalars
+  crypto_core_ristretto255_random(p);
+  for(unsigned i=0;i<20;i++) {
+    memset(n, 0, sizeof n);
+    n[0]=(uint8_t) i;
+    if(check_scalarmult(n, p)) return 1;
+  }
+
+  // the identity element and a non-canonical encoding
+  memset(p, 0, sizeof p);
+  crypto_core_ristretto255_scalar_random(n);
+  if(check_scalarmult(n, p)) return 1;
+  memset(p, 0xff, sizeof p);
+  p[31]=0x7f;
+  p[0]=0xec;
+  if(check_scalarmult(n, p)) return 1;
+
+  const size_t msm_sizes[] = {1, 2, 3, 7, ristretto255_MSM_CHUNK-1, ristretto255_MSM_CHUNK, ristretto255_MSM_CHUNK+1, 100};
+  for(unsigned i=0;i<sizeof msm_sizes / sizeof msm_sizes[0];i++) {
+    if(check_msm(msm_sizes[i])) return 1;
+    if(check_msm_vartime(msm_sizes[i])) return 1;
+  }
+
+  const size_t batch_sizes[] = {1, 2, ristretto255_MSM_CHUNK/2, ristretto255_MSM_CHUNK/2+1, 100};
+  for(unsigned i=0;i<sizeof batch_sizes / sizeof batch_sizes[0];i++) {
+    if(check_verify_batch(batch_sizes[i])) return 1;
+  }
+  if(check_verify_torsion()) return 1;
+
+  printf("all ok\n");
+  return 0;
+}
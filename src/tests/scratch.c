@@ -0,0 +1,92 @@
+#include <stdio.h>
+#include <string.h>
+#include <pthread.h>
+#include <sodium.h>
+#include "scratch.h"
+#include "oprf.h"
+
+static int test_nesting(void) {
+  uint8_t *a = oprf_scratch_push(32);
+  uint8_t *b = oprf_scratch_push(1);
+  uint8_t *c = oprf_scratch_push(100);
+  if(a==NULL || b==NULL || c==NULL) return 1;
+  // the buffers do not overlap and are aligned
+  if(b < a + 32 || c < b + 1 || ((uintptr_t) c % 16)!=0) return 1;
+  memset(a, 0xaa, 32);
+  memset(b, 0xbb, 1);
+  memset(c, 0xcc, 100);
+  oprf_scratch_pop(c, 100);
+  // released buffers are wiped, and reused by the next push
+  if(!sodium_is_zero(c, 100)) return 1;
+  uint8_t *d = oprf_scratch_push(100);
+  if(d!=c || b[0]!=0xbb) return 1;
+  oprf_scratch_pop(d, 100);
+  oprf_scratch_pop(b, 1);
+  oprf_scratch_pop(a, 32);
+  return 0;
+}
+
+static int test_overflow(void) {
+  // what does not fit is allocated on the heap, and still usable
+  uint8_t *a = oprf_scratch_push(OPRF_SCRATCH_BYTES - 64);
+  uint8_t *b = oprf_scratch_push(128);
+  if(a==NULL || b==NULL) return 1;
+  memset(b, 0xbb, 128);
+  oprf_scratch_pop(b, 128);
+  // the arena is not affected by the heap buffer
+  uint8_t *c = oprf_scratch_push(64);
+  if(c==NULL) return 1;
+  oprf_scratch_pop(c, 64);
+  oprf_scratch_pop(a, OPRF_SCRATCH_BYTES - 64);
+  return 0;
+}
+
+static int test_oprf(void) {
+  // a round trip through the primitives using the arena
+  uint8_t k[crypto_core_ristretto255_SCALARBYTES], r[crypto_core_ristretto255_SCALARBYTES];
+  uint8_t alpha[crypto_core_ristretto255_BYTES], beta[crypto_core_ristretto255_BYTES];
+  uint8_t N[crypto_core_ristretto255_BYTES], H0[crypto_core_ristretto255_BYTES];
+  uint8_t y[OPRF_BYTES], y2[OPRF_BYTES];
+  const uint8_t x[] = "password";
+  oprf_KeyGen(k);
+  for(int i=0;i<1000;i++) {
+    if(oprf_Blind(x, sizeof x, r, alpha)) return 1;
+    if(oprf_Evaluate(k, alpha, beta)) return 1;
+    if(oprf_Unblind(r, beta, N)) return 1;
+    if(oprf_Finalize(x, sizeof x, N, y)) return 1;
+    if(i>0 && memcmp(y, y2, sizeof y)!=0) return 1;
+    memcpy(y2, y, sizeof y);
+  }
+  // the arena is empty again: a full sized buffer fits
+  uint8_t *a = oprf_scratch_push(OPRF_SCRATCH_BYTES);
+  if(a==NULL) return 1;
+  oprf_scratch_pop(a, OPRF_SCRATCH_BYTES);
+  if(voprf_hash_to_group(x, sizeof x, H0)) return 1;
+  return 0;
+}
+
+static void *thread(void *arg) {
+  (void) arg;
+  long ret = test_nesting() || test_oprf();
+  return (void*) ret;
+}
+
+int main(void) {
+  if(test_nesting() || test_overflow() || test_oprf()) {
+    fprintf(stderr, "\e[0;31mscratch arena failed\e[0m\n");
+    return 1;
+  }
+  // every thread has its own arena, freed when the thread exits
+  pthread_t t[4];
+  for(int i=0;i<4;i++) if(pthread_create(&t[i], NULL, thread, NULL)) return 1;
+  for(int i=0;i<4;i++) {
+    void *ret;
+    pthread_join(t[i], &ret);
+    if(ret!=NULL) {
+      fprintf(stderr, "\e[0;31mscratch arena failed in a thread\e[0m\n");
+      return 1;
+    }
+  }
+  fprintf(stderr, "\e[0;32meverything correct!\e[0m\n");
+  return 0;
+}
@@ -0,0 +1,115 @@
+#include <stdio.h>
+#include <string.h>
+#include <sodium.h>
+#include "toprf.h"
+#include "dkg.h"
+
+// the specialized kernels of the default TOPRF_SHAPES must give the
+// same results as the generic code behind the wide functions
+
+static int test_shares(const uint8_t n, const uint8_t t) {
+  uint8_t a[t][crypto_core_ristretto255_SCALARBYTES];
+  for(int i=0;i<t;i++) crypto_core_ristretto255_scalar_random(a[i]);
+  uint8_t shares[n][TOPRF_Share_BYTES];
+  uint8_t wide[n][TOPRF_WideShare_BYTES];
+  toprf_polynom_shares(n, t, (const uint8_t (*)[crypto_core_ristretto255_SCALARBYTES]) a, shares);
+  toprf_wide_polynom_shares(n, t, (const uint8_t (*)[crypto_core_ristretto255_SCALARBYTES]) a, wide);
+  for(int i=0;i<n;i++) {
+    if(shares[i][0]!=i+1) return 1;
+    if(memcmp(shares[i]+1, wide[i]+2, crypto_core_ristretto255_SCALARBYTES)!=0) return 1;
+  }
+  return 0;
+}
+
+static int test_coeffs(const uint8_t t) {
+  for(int r=0;r<100;r++) {
+    uint8_t peers[t];
+    uint16_t wide[t];
+    for(int i=0;i<t;i++) {
+      int dup;
+      do {
+        peers[i] = (uint8_t) (1 + randombytes_uniform(255));
+        dup = 0;
+        for(int j=0;j<i;j++) dup |= peers[j]==peers[i];
+      } while(dup);
+      wide[i] = peers[i];
+    }
+    uint8_t c0[t][crypto_scalarmult_ristretto255_SCALARBYTES], c1[t][crypto_scalarmult_ristretto255_SCALARBYTES];
+    if(toprf_coeffs(t, peers, c0) || toprf_wide_coeffs(t, wide, c1)) return 1;
+    if(memcmp(c0, c1, sizeof c0)!=0) return 1;
+  }
+  // zero and duplicate indexes are refused like by the generic code
+  uint8_t peers[t], c[t][crypto_scalarmult_ristretto255_SCALARBYTES];
+  for(int i=0;i<t;i++) peers[i] = (uint8_t) (i+1);
+  peers[t-1] = 0;
+  if(toprf_coeffs(t, peers, c)!=1) return 1;
+  if(t>1) {
+    peers[t-1] = peers[0];
+    if(toprf_coeffs(t, peers, c)!=1) return 1;
+  }
+  return 0;
+}
+
+static int test_combine(const uint8_t n, const uint8_t t) {
+  uint8_t secret[crypto_core_ristretto255_SCALARBYTES], shares[n][TOPRF_Share_BYTES];
+  crypto_core_ristretto255_scalar_random(secret);
+  toprf_create_shares(secret, n, t, shares);
+
+  uint8_t P[crypto_core_ristretto255_BYTES], expected[crypto_core_ristretto255_BYTES];
+  crypto_core_ristretto255_random(P);
+  if(crypto_scalarmult_ristretto255(expected, secret, P)) return 1;
+
+  // the last t shareholders answer, in reverse order
+  uint8_t parts[t][TOPRF_Part_BYTES], result[crypto_scalarmult_ristretto255_BYTES];
+  for(int i=0;i<t;i++) {
+    const uint8_t *share = shares[n-1-i];
+    parts[i][0] = share[0];
+    if(crypto_scalarmult_ristretto255(parts[i]+1, share+1, P)) return 1;
+  }
+  if(toprf_thresholdmult(t, (const uint8_t (*)[TOPRF_Part_BYTES]) parts, result)) return 1;
+  if(memcmp(result, expected, sizeof result)!=0) return 1;
+
+  // the identity element is refused
+  memset(parts[0]+1, 0, crypto_scalarmult_ristretto255_BYTES);
+  if(toprf_thresholdmult(t, (const uint8_t (*)[TOPRF_Part_BYTES]) parts, result)!=1) return 1;
+  return 0;
+}
+
+static int test_commitments(const uint8_t n, const uint8_t t) {
+  uint8_t commitments[n][t][crypto_core_ristretto255_BYTES];
+  TOPRF_Share dealt[n][n];
+  for(int i=0;i<n;i++) {
+    if(dkg_start(n, t, commitments[i], dealt[i])) return 1;
+  }
+  for(uint8_t self=1;self<=n;self++) {
+    for(uint8_t i=1;i<=n;i++) {
+      if(dkg_verify_commitment(n, t, self, i, commitments[i-1], dealt[i-1][self-1])) return 1;
+    }
+  }
+  // a wrong share is detected
+  TOPRF_Share bad = dealt[0][1];
+  bad.value[0] ^= 1;
+  if(dkg_verify_commitment(n, t, 2, 1, commitments[0], bad)!=1) return 1;
+  // so is a share for another peer
+  if(dkg_verify_commitment(n, t, 2, 1, commitments[0], dealt[0][2])!=1) return 1;
+  if(t>1) {
+    memset(commitments[0][t-1], 0, crypto_core_ristretto255_BYTES);
+    if(dkg_verify_commitment(n, t, 2, 1, commitments[0], dealt[0][1])!=-1) return 1;
+  }
+  return 0;
+}
+
+int main(void) {
+  if(sodium_init() < 0) return 1;
+  // the default shapes, and some which take the generic path
+  const uint8_t shapes[][2] = {{3,2}, {5,3}, {11,7}, {4,3}, {9,5}, {20,12}};
+  for(unsigned i=0;i<sizeof shapes / sizeof shapes[0];i++) {
+    const uint8_t n = shapes[i][0], t = shapes[i][1];
+    if(test_shares(n, t) || test_coeffs(t) || test_combine(n, t) || test_commitments(n, t)) {
+      fprintf(stderr, "\e[0;31m%d-of-%d failed\e[0m\n", t, n);
+      return 1;
+    }
+  }
+  fprintf(stderr, "\e[0;32meverything correct!\e[0m\n");
+  return 0;
+}
@@ -0,0 +1,132 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "sharestore.h"
+
+static void make_id(uint8_t id[sharestore_ID_BYTES], const uint32_t i) {
+  crypto_generichash(id, sharestore_ID_BYTES, (const uint8_t*) &i, sizeof i, NULL, 0);
+}
+
+static void make_share(uint8_t share[TOPRF_Share_BYTES], const uint32_t i, const uint32_t version) {
+  memset(share, 0, TOPRF_Share_BYTES);
+  share[0] = (uint8_t) (i % 255 + 1);
+  memcpy(share+1, &i, sizeof i);
+  memcpy(share+5, &version, sizeof version);
+}
+
+static int check(const ShareStore *store, const uint32_t n, const uint32_t replaced, const uint32_t deleted) {
+  uint8_t id[sharestore_ID_BYTES], share[TOPRF_Share_BYTES], expected[TOPRF_Share_BYTES];
+  for(uint32_t i=0;i<n;i++) {
+    make_id(id, i);
+    const int ret = sharestore_get(store, id, share);
+    if(i < deleted) {
+      if(ret!=1) {
+        fprintf(stderr, "\e[0;31mdeleted share %d found\e[0m\n", i);
+        return 1;
+      }
+      continue;
+    }
+    make_share(expected, i, i < replaced ? 2 : 1);
+    if(ret!=0 || memcmp(share, expected, sizeof share)!=0) {
+      fprintf(stderr, "\e[0;31mshare %d is wrong\e[0m\n", i);
+      return 1;
+    }
+  }
+  return 0;
+}
+
+// whether the file at path still contains the share version of i
+static int leaks(const char *path, const uint32_t i, const uint32_t version) {
+  uint8_t share[TOPRF_Share_BYTES];
+  make_share(share, i, version);
+  FILE *f = fopen(path, "rb");
+  if(f==NULL) return 1;
+  fseek(f, 0, SEEK_END);
+  const long len = ftell(f);
+  rewind(f);
+  uint8_t *buf = malloc((size_t) len);
+  int found = (buf==NULL || fread(buf, 1, (size_t) len, f)!=(size_t) len);
+  fclose(f);
+  if(!found) found = (memmem(buf, (size_t) len, share, sizeof share)!=NULL);
+  free(buf);
+  return found;
+}
+
+static int test_store(const char *path, const uint8_t *key) {
+  const uint32_t n = 1000;
+  uint8_t id[sharestore_ID_BYTES], share[TOPRF_Share_BYTES];
+  unlink(path);
+
+  ShareStore *store = sharestore_open(path, key, SHARESTORE_CREATE | SHARESTORE_NOSYNC);
+  if(store==NULL) return 1;
+  for(uint32_t i=0;i<n;i++) {
+    make_id(id, i);
+    make_share(share, i, 1);
+    if(sharestore_put(store, id, share)) return 1;
+  }
+  if(check(store, n, 0, 0)) return 1;
+  sharestore_close(store);
+
+  // reopened, with syncing
+  store = sharestore_open(path, key, 0);
+  if(store==NULL || check(store, n, 0, 0)) return 1;
+  for(uint32_t i=0;i<100;i++) {
+    make_id(id, i);
+    make_share(share, i, 2);
+    if(sharestore_put(store, id, share)) return 1;
+  }
+  for(uint32_t i=0;i<10;i++) {
+    make_id(id, i);
+    if(sharestore_del(store, id)) return 1;
+  }
+  make_id(id, 0);
+  if(sharestore_del(store, id)!=1) return 1;
+  if(check(store, n, 100, 10)) return 1;
+  sharestore_close(store);
+
+  store = sharestore_open(path, key, 0);
+  if(store==NULL || check(store, n, 100, 10)) return 1;
+  sharestore_close(store);
+
+  // nothing of the replaced and deleted shares is left in the file
+  if(key==NULL) {
+    for(uint32_t i=0;i<100;i++) {
+      if(leaks(path, i, 1) || (i < 10 && leaks(path, i, 2))) {
+        fprintf(stderr, "\e[0;31mshare %d left in the store\e[0m\n", i);
+        return 1;
+      }
+    }
+  }
+  return 0;
+}
+
+int main(void) {
+  char path[] = "/tmp/liboprf-sharestore-XXXXXX";
+  const int fd = mkstemp(path);
+  if(fd<0) return 1;
+  close(fd);
+
+  if(test_store(path, NULL)) {
+    fprintf(stderr, "\e[0;31mplaintext store failed\e[0m\n");
+    return 1;
+  }
+  // a plaintext store can not be opened with a key
+  uint8_t key[sharestore_KEYBYTES];
+  randombytes_buf(key, sizeof key);
+  if(sharestore_open(path, key, 0)!=NULL) return 1;
+
+  if(test_store(path, key)) {
+    fprintf(stderr, "\e[0;31mencrypted store failed\e[0m\n");
+    return 1;
+  }
+  // nor an encrypted one without or with the wrong key
+  if(sharestore_open(path, NULL, 0)!=NULL) return 1;
+  key[0]^=1;
+  if(sharestore_open(path, key, 0)!=NULL) return 1;
+
+  unlink(path);
+  fprintf(stderr, "\e[0;32meverything correct!\e[0m\n");
+  return 0;
+}
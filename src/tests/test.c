@@ -4,6 +4,7 @@
 #include "cfrg_oprf_test_vectors.h"
 #include "../oprf.h"
 #include "../utils.h"
+#include "../sha512mb.h"
 
 extern int debug;
 
@@ -36,12 +37,102 @@ int main(void) {
     return 1;
   }
 
+  uint8_t batch[2][crypto_core_ristretto255_BYTES], Zs[2][crypto_core_ristretto255_BYTES];
+  uint8_t fails[2];
+  memcpy(batch[0], blinded, sizeof blinded);
+  memset(batch[1], 0xff, sizeof batch[1]); // not a valid point
+  res = oprf_EvaluateBatch(sks, 2, batch, Zs, fails);
+  if(res!=1 || fails[0]!=0 || fails[1]!=1 || memcmp(Zs[0], Z, sizeof Z)!=0) {
+    fail("oprf_EvaluateBatch failed");
+    return 1;
+  }
+
+  oprf_KeyCtx ctx;
+  if(oprf_KeyCtx_init(&ctx, sks)) return 1;
+  res = oprf_Evaluate_KeyCtx(&ctx, blinded, Zs[1]);
+  oprf_KeyCtx_free(&ctx);
+  if(res || memcmp(Zs[1], Z, sizeof Z)!=0) {
+    fail("oprf_Evaluate_KeyCtx failed");
+    return 1;
+  }
+
   uint8_t N[crypto_core_ristretto255_BYTES];
   res = oprf_Unblind(r, Z, N);
   if(res) {
     fprintf(stderr,"oprf_Unblind returned error\n");
     return 1;
   }
+  // the batch versions must be the same as the single ones
+  const uint8_t *inputs[2] = {input, input};
+  const size_t input_lens[2] = {input_len, input_len};
+  uint8_t rs[2][crypto_core_ristretto255_SCALARBYTES], Ns[2][crypto_core_ristretto255_BYTES];
+  if(oprf_BlindBatch(2, inputs, input_lens, rs, batch)) return 1;
+  memcpy(Zs[0], Z, sizeof Z);
+  memcpy(Zs[1], Z, sizeof Z);
+  if(memcmp(batch[0], blinded, sizeof blinded)!=0 || memcmp(batch[1], blinded, sizeof blinded)!=0 ||
+     oprf_UnblindBatch(2, rs, Zs, Ns, fails) ||
+     memcmp(Ns[0], N, sizeof N)!=0 || memcmp(Ns[1], N, sizeof N)!=0) {
+    fail("oprf_BlindBatch/oprf_UnblindBatch failed");
+    return 1;
+  }
+  memset(Zs[1], 0xff, sizeof Zs[1]);
+  if(oprf_UnblindBatch(2, rs, Zs, Ns, fails)!=1 || fails[0]!=0 || fails[1]!=1 ||
+     memcmp(Ns[0], N, sizeof N)!=0) {
+    fail("oprf_UnblindBatch failed to reject invalid element");
+    return 1;
+  }
+
+  // more than one chunk, with scalars that can not be inverted: 0 and L
+  static const uint8_t L[crypto_core_ristretto255_SCALARBYTES] = {
+    0xed, 0xd3, 0xf5, 0x5c, 0x1a, 0x63, 0x12, 0x58, 0xd6, 0x9c, 0xf7, 0xa2, 0xde, 0xf9, 0xde, 0x14,
+    0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x10 };
+  uint8_t rr[150][crypto_core_ristretto255_SCALARBYTES], ZZ[150][crypto_core_ristretto255_BYTES];
+  uint8_t NN[150][crypto_core_ristretto255_BYTES], NN1[crypto_core_ristretto255_BYTES], ffails[150];
+  for(int i=0;i<150;i++) {
+    crypto_core_ristretto255_scalar_random(rr[i]);
+    crypto_core_ristretto255_random(ZZ[i]);
+  }
+  memset(rr[3], 0, sizeof rr[3]);
+  memcpy(rr[100], L, sizeof L);
+  if(oprf_UnblindBatch(150, rr, ZZ, NN, ffails)!=1) return 1;
+  for(int i=0;i<150;i++) {
+    const int bad = (i==3 || i==100);
+    if(ffails[i]!=bad || (bad && oprf_Unblind(rr[i], ZZ[i], NN1)==0) ||
+       (!bad && (oprf_Unblind(rr[i], ZZ[i], NN1) || memcmp(NN1, NN[i], sizeof NN1)!=0))) {
+      fail("oprf_UnblindBatch differs from oprf_Unblind");
+      return 1;
+    }
+  }
+
+  // blinding more than one chunk
+  const uint8_t *bxs[150];
+  size_t bx_lens[150];
+  for(int i=0;i<150;i++) {
+    bxs[i] = ZZ[i];
+    bx_lens[i] = (size_t) (i % 32 + 1);
+  }
+  if(oprf_BlindBatch(150, bxs, bx_lens, rr, NN)) return 1;
+  for(int i=0;i<150;i++) {
+    uint8_t H0[crypto_core_ristretto255_BYTES];
+    if(voprf_hash_to_group(bxs[i], bx_lens[i], H0) ||
+       oprf_Unblind(rr[i], NN[i], NN1) || memcmp(NN1, H0, sizeof H0)!=0) {
+      fail("oprf_BlindBatch differs from oprf_Blind");
+      return 1;
+    }
+  }
+  // and inputs longer than 255 bytes
+  uint8_t long_x[300];
+  randombytes_buf(long_x, sizeof long_x);
+  const uint8_t *long_xs[1] = {long_x};
+  const size_t long_len[1] = {sizeof long_x};
+  uint8_t long_H0[1][crypto_core_ristretto255_BYTES];
+  if(oprf_BlindBatch(1, long_xs, long_len, rr, NN) ||
+     voprf_hash_to_group_batch(1, long_xs, long_len, long_H0) ||
+     oprf_Unblind(rr[0], NN[0], NN1) || memcmp(NN1, long_H0[0], sizeof NN1)!=0) {
+    fail("oprf_BlindBatch of a long input failed");
+    return 1;
+  }
+
   uint8_t rwd[OPRF_BYTES];
   res = oprf_Finalize(input, input_len, N, rwd);
   if(res) {
@@ -55,6 +146,114 @@ int main(void) {
     return 1;
   }
 
+  // the streaming versions must be the same as the one-shot ones
+  crypto_hash_sha512_state st, zst;
+  uint8_t zp[128]={0}, H0[crypto_core_ristretto255_BYTES], H0s[crypto_core_ristretto255_BYTES];
+  expand_message_xmd_init(&st);
+  crypto_hash_sha512_init(&zst);
+  crypto_hash_sha512_update(&zst, zp, sizeof zp);
+  if(memcmp(st.state, zst.state, sizeof st.state)!=0 || memcmp(st.count, zst.count, sizeof st.count)!=0) {
+    fail("precomputed Z_pad midstate is wrong");
+    return 1;
+  }
+  if(voprf_hash_to_group(input, input_len, H0)) return 1;
+  voprf_hash_to_group_init(&st);
+  voprf_hash_to_group_update(&st, input, input_len/2);
+  voprf_hash_to_group_update(&st, input+input_len/2, input_len-input_len/2);
+  if(voprf_hash_to_group_final(&st, H0s) || memcmp(H0, H0s, sizeof H0)!=0) {
+    fail("streaming voprf_hash_to_group differs");
+    return 1;
+  }
+  // the prepared hash-to-group DST must match a freshly built one
+  const uint8_t h2g_dst[] = "HashToGroup-OPRFV1-\x00-ristretto255-SHA512";
+  uint8_t ub[crypto_core_ristretto255_HASHBYTES];
+  oprf_DSTCtx dctx;
+  if(expand_message_xmd(input, input_len, h2g_dst, sizeof h2g_dst - 1, sizeof ub, ub)) return 1;
+  crypto_core_ristretto255_from_hash(H0s, ub);
+  if(memcmp(H0, H0s, sizeof H0)!=0) {
+    fail("expand_message_xmd differs from voprf_hash_to_group");
+    return 1;
+  }
+  // longer outputs run the b_i loop
+  uint8_t ul[200], ul2[200];
+  if(oprf_DSTCtx_init(&dctx, h2g_dst, sizeof h2g_dst - 1, sizeof ul)) return 1;
+  expand_message_xmd_init(&st);
+  crypto_hash_sha512_update(&st, input, input_len);
+  if(expand_message_xmd_final_ctx(&st, &dctx, ul) ||
+     expand_message_xmd(input, input_len, h2g_dst, sizeof h2g_dst - 1, sizeof ul2, ul2) ||
+     memcmp(ul, ul2, sizeof ul)!=0 || memcmp(ul, ub, sizeof ub)==0) {
+    fail("expand_message_xmd_final_ctx differs");
+    return 1;
+  }
+  if(oprf_BlindElement(H0s, rs[0], batch[0]) || memcmp(batch[0], blinded, sizeof blinded)!=0) {
+    fail("oprf_BlindElement differs from oprf_Blind");
+    return 1;
+  }
+  oprf_Finalize_init(&st, input_len);
+  oprf_Finalize_update(&st, input, 1);
+  oprf_Finalize_update(&st, input+1, input_len-1u);
+  uint8_t rwd2[OPRF_BYTES];
+  if(oprf_Finalize_final(&st, N, rwd2) || memcmp(rwd2, rwd, sizeof rwd)!=0) {
+    fail("streaming oprf_Finalize differs");
+    return 1;
+  }
+
+  // the multi-buffer sha512 backends must match libsodium, for all
+  // lengths around the padding boundaries and split into segments
+  uint8_t big[700], digests[23][crypto_hash_sha512_BYTES], digest[crypto_hash_sha512_BYTES];
+  const uint8_t *bigs[23];
+  size_t big_lens[23];
+  sha512mb_Msg msgs[23];
+  uint8_t pts[23][crypto_core_ristretto255_BYTES], pt[crypto_core_ristretto255_BYTES];
+  randombytes_buf(big, sizeof big);
+  const unsigned lanes[] = {1, 2, 4, 8, 0};
+  for(unsigned b=0;b<sizeof lanes / sizeof lanes[0];b++) {
+    sha512mb_set_lanes(lanes[b]);
+    for(size_t len=0;len<=sizeof big - 22 - 100;len+=23) {
+      for(size_t i=0;i<23;i++) {
+        const size_t l = len + i, s1 = l / 3, s2 = (i&1) ? 0 : l / 2;
+        msgs[i] = (sha512mb_Msg) { .seg = { big, big + s1, big + s1 + s2 },
+                                   .len = { s1, s2, l - s1 - s2 } };
+        bigs[i] = big + i;
+        big_lens[i] = l / 2 + 40 * (i%3);
+      }
+      sha512mb(23, msgs, NULL, digests);
+      for(size_t i=0;i<23;i++) {
+        crypto_hash_sha512(digest, big, len + i);
+        if(memcmp(digest, digests[i], sizeof digest)!=0) {
+          fprintf(stderr, "lanes %u, len %zu\n", sha512mb_lanes(), len + i);
+          fail("sha512mb differs from crypto_hash_sha512");
+          return 1;
+        }
+      }
+      if(voprf_hash_to_group_batch(23, bigs, big_lens, pts)) return 1;
+      for(size_t i=0;i<23;i++) {
+        voprf_hash_to_group_init(&st);
+        voprf_hash_to_group_update(&st, bigs[i], big_lens[i]);
+        if(voprf_hash_to_group_final(&st, pt) || memcmp(pt, pts[i], sizeof pt)!=0) {
+          fail("voprf_hash_to_group_batch differs from voprf_hash_to_group");
+          return 1;
+        }
+      }
+    }
+  }
+  const uint8_t *xs[3] = {input, big, big + 1};
+  const uint16_t x_lens[3] = {input_len, 0, 600};
+  uint8_t Nf[3][crypto_core_ristretto255_BYTES], rwds[3][OPRF_BYTES];
+  memcpy(Nf[0], N, sizeof N);
+  crypto_core_ristretto255_random(Nf[1]);
+  crypto_core_ristretto255_random(Nf[2]);
+  if(oprf_FinalizeBatch(3, xs, x_lens, Nf, rwds) || memcmp(rwds[0], rwd, sizeof rwd)!=0) {
+    fail("oprf_FinalizeBatch differs from oprf_Finalize");
+    return 1;
+  }
+  for(int i=1;i<3;i++) {
+    if(oprf_Finalize(xs[i], x_lens[i], Nf[i], rwd2) || memcmp(rwds[i], rwd2, sizeof rwd2)!=0) {
+      fail("oprf_FinalizeBatch differs from oprf_Finalize");
+      return 1;
+    }
+  }
+
   printf("all ok\n");
   return 0;
 }
@@ -0,0 +1,271 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sodium.h>
+#include "toprf.h"
+#include "tp-dkg.h"
+#include "tp-dkg-manager.h"
+#include "workerpool.h"
+
+// runs a few concurrent tp-dkg sessions through one TPDKG_Manager,
+// then refreshes the resulting shares the same way, every second
+// session runs in optimistic mode, and most of the refreshes resume
+// the channels of the previous run of their session
+
+#define SESSIONS 5
+#define N 3
+#define T 2
+
+typedef struct {
+  uint8_t *buf;
+  size_t len;
+} Inbox;
+
+typedef struct {
+  TP_DKG_TPState tp;
+  uint8_t *tp_arena;
+  size_t tp_arena_len;
+  TP_DKG_PeerState peers[N];
+  uint8_t *peer_arenas[N];
+  size_t peer_arena_len;
+  Inbox inbox[N];
+  int failed;
+  uint8_t peer_lt_pks[N][crypto_sign_PUBLICKEYBYTES];
+  uint8_t peer_lt_sks[N][crypto_sign_SECRETKEYBYTES];
+  // the shares and the group key of the dkg, kept for the refresh
+  TOPRF_WideShare shares[N];
+  uint8_t pk[crypto_core_ristretto255_BYTES];
+  // the channels of the previous run, and its sessionid
+  uint8_t caches[N][tpdkg_resume_SIZE(N)];
+  uint8_t resume_id[tpdkg_sessionid_SIZE];
+  int resumed;
+} Session;
+
+static Session sessions[SESSIONS];
+
+static void on_output(void *arg, TP_DKG_TPState *tp, const int ret, const uint8_t *output, const size_t output_len) {
+  (void) arg;
+  Session *s = NULL;
+  for(unsigned i=0;i<SESSIONS;i++) if(&sessions[i].tp == tp) s = &sessions[i];
+  if(s==NULL || ret!=0) {
+    fprintf(stderr, "tp step failed: %d\n", ret);
+    if(s!=NULL) s->failed = 1;
+    return;
+  }
+  for(uint16_t i=0;i<tp->n;i++) {
+    const uint8_t *msg;
+    size_t len;
+    if(0!=tpdkg_tp_peer_msg(tp, output, output_len, i, &msg, &len)) {
+      s->failed = 1;
+      return;
+    }
+    free(s->inbox[i].buf);
+    s->inbox[i].buf = NULL;
+    s->inbox[i].len = len;
+    if(len==0) continue;
+    s->inbox[i].buf = malloc(len);
+    if(s->inbox[i].buf==NULL) {
+      s->failed = 1;
+      return;
+    }
+    memcpy(s->inbox[i].buf, msg, len);
+  }
+}
+
+// runs all the steps a peer can do with what it has received
+static int run_peer(TPDKG_Manager *m, Session *s, const uint16_t i) {
+  TP_DKG_PeerState *peer = &s->peers[i];
+  Inbox *inbox = &s->inbox[i];
+  while(tpdkg_peer_not_done(peer)) {
+    const size_t in_size = tpdkg_peer_input_size(peer);
+    if(in_size>0 && (inbox->buf==NULL || inbox->len!=in_size)) break;
+    const size_t out_size = tpdkg_peer_output_size(peer);
+    uint8_t *out = out_size ? malloc(out_size) : NULL;
+    if(out_size && out==NULL) return 1;
+
+    int ret = tpdkg_peer_next(peer, in_size ? inbox->buf : NULL, in_size, out, out_size);
+    if(in_size>0) {
+      free(inbox->buf);
+      inbox->buf = NULL;
+      inbox->len = 0;
+    }
+    if(ret==0 && out_size>0) ret = 100 + tpdkg_manager_recv(m, out, out_size);
+    if(ret==100) ret = 0;
+    free(out);
+    if(ret!=0) {
+      fprintf(stderr, "peer %d failed: %d\n", i+1, ret);
+      return 1;
+    }
+  }
+  return 0;
+}
+
+static int check_shares(const Session *s, uint8_t pk[crypto_core_ristretto255_BYTES]) {
+  uint8_t responses[2][T][TOPRF_WidePart_BYTES], r0[crypto_core_ristretto255_BYTES], r1[crypto_core_ristretto255_BYTES];
+  for(uint8_t k=0;k<2;k++) {
+    for(uint16_t i=0;i<T;i++) {
+      const TOPRF_WideShare *share = &s->peers[i+k].share;
+      memcpy(responses[k][i], &share->index, sizeof share->index);
+      crypto_scalarmult_ristretto255_base(responses[k][i]+2, share->value);
+    }
+  }
+  if(toprf_wide_thresholdmult(T, responses[0], r0) || toprf_wide_thresholdmult(T, responses[1], r1)) return 1;
+  memcpy(pk, r0, sizeof r0);
+  return memcmp(r0, r1, sizeof r0)!=0;
+}
+
+static int start_session(TPDKG_Manager *m, Session *s, const int refresh, const int resume) {
+  uint8_t msg0[tpdkg_msg0_SIZE];
+  s->failed = 0;
+  s->resumed = resume;
+  const uint8_t flags = (uint8_t) ((refresh ? tpdkg_REFRESH : 0) | ((s - sessions) % 2 ? tpdkg_OPTIMISTIC : 0));
+  if(resume) {
+    if(tpdkg_start_tp_resume(&s->tp, 10, N, T, "manager test", 12, flags, s->resume_id, sizeof msg0, (TP_DKG_Message*) msg0)) return 1;
+  } else {
+    if(tpdkg_start_tp_flags(&s->tp, 10, N, T, "manager test", 12, flags, sizeof msg0, (TP_DKG_Message*) msg0)) return 1;
+  }
+  s->tp_arena_len = tpdkg_tp_arena_size(N, T);
+  s->tp_arena = malloc(s->tp_arena_len);
+  if(s->tp_arena==NULL) return 1;
+  if(tpdkg_tp_set_arena(&s->tp, s->tp_arena, s->tp_arena_len, (const uint8_t (*)[][crypto_sign_PUBLICKEYBYTES]) &s->peer_lt_pks, 0)) return 1;
+
+  s->peer_arena_len = tpdkg_peer_arena_size(N, T);
+  for(uint16_t i=0;i<N;i++) {
+    if(resume) {
+      if(tpdkg_start_peer_resume(&s->peers[i], 10, s->peer_lt_sks[i], (TP_DKG_Message*) msg0,
+                                 refresh ? &s->shares[i] : NULL, s->caches[i], sizeof s->caches[i])) return 1;
+    } else if(refresh) {
+      if(tpdkg_start_peer_refresh(&s->peers[i], 10, s->peer_lt_sks[i], (TP_DKG_Message*) msg0, &s->shares[i])) return 1;
+    } else {
+      if(tpdkg_start_peer(&s->peers[i], 10, s->peer_lt_sks[i], (TP_DKG_Message*) msg0)) return 1;
+    }
+    s->peer_arenas[i] = malloc(s->peer_arena_len);
+    if(s->peer_arenas[i]==NULL) return 1;
+    if(tpdkg_peer_set_arena(&s->peers[i], s->peer_arenas[i], s->peer_arena_len, 0)) return 1;
+  }
+  return tpdkg_manager_add(m, &s->tp);
+}
+
+static int run_sessions(TPDKG_Manager *m, WorkerPool *pool) {
+  for(unsigned round=0;round<100;round++) {
+    const size_t steps = tpdkg_manager_run(m, workerpool_run, pool, on_output, NULL);
+    for(unsigned k=0;k<SESSIONS;k++) {
+      if(sessions[k].failed) return 1;
+      for(uint16_t i=0;i<N;i++) {
+        if(run_peer(m, &sessions[k], i)) return 1;
+      }
+    }
+    if(steps==0) break;
+  }
+  return 0;
+}
+
+static int finish_session(TPDKG_Manager *m, Session *s, const unsigned k) {
+  if(tpdkg_tp_not_done(&s->tp) || s->tp.cheater_len>0) {
+    fprintf(stderr, "session %d did not finish\n", k);
+    return 1;
+  }
+  uint8_t pk[crypto_core_ristretto255_BYTES];
+  if(check_shares(s, pk)) {
+    fprintf(stderr, "session %d produced inconsistent shares\n", k);
+    return 1;
+  }
+  if(s->tp.refresh) {
+    // a refresh changes all the shares but not the group key
+    if(memcmp(pk, s->pk, sizeof pk)!=0) {
+      fprintf(stderr, "refresh of session %d changed the group key\n", k);
+      return 1;
+    }
+    for(uint16_t i=0;i<N;i++) {
+      if(s->peers[i].share.index!=s->shares[i].index) return 1;
+      if(sodium_memcmp(s->peers[i].share.value, s->shares[i].value, crypto_core_ristretto255_SCALARBYTES)==0) return 1;
+    }
+  }
+  memcpy(s->pk, pk, sizeof pk);
+  for(uint16_t i=0;i<N;i++) memcpy(&s->shares[i], &s->peers[i].share, sizeof(TOPRF_WideShare));
+
+  // keep the channels for the next run, a resumed run uses one up
+  const uint8_t uses = s->resumed ? (uint8_t) (s->caches[0][tpdkg_sessionid_SIZE+4] - 1) : tpdkg_resume_USES;
+  for(uint16_t i=0;i<N;i++) {
+    if(tpdkg_peer_save_resume(&s->peers[i], s->caches[i], sizeof s->caches[i])) {
+      fprintf(stderr, "session %d could not save the channels of peer %d\n", k, i+1);
+      return 1;
+    }
+    if(s->caches[i][tpdkg_sessionid_SIZE+4]!=uses) return 1;
+  }
+  memcpy(s->resume_id, s->tp.sessionid, sizeof s->resume_id);
+
+  if(tpdkg_manager_remove(m, s->tp.sessionid)) return 1;
+  if(tpdkg_manager_get(m, s->tp.sessionid)!=NULL) return 1;
+  for(uint16_t i=0;i<N;i++) {
+    tpdkg_peer_free(&s->peers[i]);
+    tpdkg_arena_wipe(s->peer_arenas[i], s->peer_arena_len, 0);
+    free(s->peer_arenas[i]);
+    free(s->inbox[i].buf);
+    s->inbox[i].buf = NULL;
+    s->inbox[i].len = 0;
+  }
+  tpdkg_arena_wipe(s->tp_arena, s->tp_arena_len, 0);
+  free(s->tp_arena);
+  return 0;
+}
+
+int main(void) {
+  if(sodium_init() < 0) return 1;
+
+  TPDKG_Manager *m = tpdkg_manager_new(SESSIONS);
+  WorkerPool *pool = workerpool_new(2);
+  if(m==NULL || pool==NULL) return 1;
+
+  for(unsigned k=0;k<SESSIONS;k++) {
+    Session *s = &sessions[k];
+    for(uint16_t i=0;i<N;i++) crypto_sign_keypair(s->peer_lt_pks[i], s->peer_lt_sks[i]);
+    if(start_session(m, s, 0, 0)) return 1;
+  }
+  if(tpdkg_manager_add(m, &sessions[0].tp)!=1) {
+    fprintf(stderr, "manager accepted more sessions than its maximum\n");
+    return 1;
+  }
+
+  // messages for unknown sessions are rejected
+  uint8_t bogus[sizeof(TP_DKG_Message)] = {0};
+  if(tpdkg_manager_recv(m, bogus, sizeof bogus)!=2) return 1;
+
+  TP_DKG_TPState *ready[SESSIONS];
+  if(tpdkg_manager_ready(m, ready, SESSIONS)!=SESSIONS) return 1;
+
+  if(run_sessions(m, pool)) return 1;
+  for(unsigned k=0;k<SESSIONS;k++) {
+    // every session has its own secret
+    if(k>0 && sodium_memcmp(sessions[k].peers[0].share.value, sessions[0].peers[0].share.value, crypto_core_ristretto255_SCALARBYTES)==0) return 1;
+    if(finish_session(m, &sessions[k], k)) return 1;
+  }
+
+  // resuming needs the id of the run to resume
+  TP_DKG_TPState tp;
+  uint8_t msg0[tpdkg_msg0_SIZE];
+  if(tpdkg_start_tp_flags(&tp, 10, N, T, "manager test", 12, tpdkg_RESUME, sizeof msg0, (TP_DKG_Message*) msg0)!=6) return 1;
+  // and the peers only resume the channels of the run they are cached for
+  const uint8_t no_id[tpdkg_sessionid_SIZE] = {0};
+  if(tpdkg_start_tp_resume(&tp, 10, N, T, "manager test", 12, tpdkg_REFRESH, no_id, sizeof msg0, (TP_DKG_Message*) msg0)) return 1;
+  TP_DKG_PeerState peer;
+  if(tpdkg_start_peer_resume(&peer, 10, sessions[0].peer_lt_sks[0], (TP_DKG_Message*) msg0, &sessions[0].shares[0],
+                             sessions[0].caches[0], sizeof sessions[0].caches[0])!=8) return 1;
+
+  // refresh the shares of all sessions, twice, resuming the channels of
+  // the previous run except for one session in each round
+  for(unsigned r=0;r<2;r++) {
+    for(unsigned k=0;k<SESSIONS;k++) {
+      if(start_session(m, &sessions[k], 1, k!=r)) return 1;
+    }
+    if(run_sessions(m, pool)) return 1;
+    for(unsigned k=0;k<SESSIONS;k++) {
+      if(finish_session(m, &sessions[k], k)) return 1;
+    }
+  }
+
+  workerpool_free(pool);
+  tpdkg_manager_free(m);
+  printf("all ok\n");
+  return 0;
+}
@@ -0,0 +1,505 @@
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <time.h>
+#include <arpa/inet.h>
+#include <sodium.h>
+#include "utils.h"
+#include "tp-dkg.h"
+
+// records a complete TP-DKG run in-process to a file, and replays one
+// role of it - the tp or a single peer - without any of the others:
+//
+//   tp-dkg-replay record <n> <t> <file> [<optimistic>]
+//   tp-dkg-replay replay <file> <role> [<iterations>]
+//
+// where role 0 is the tp and 1..n the peers. The replay feeds the
+// recorded inputs to the state machine of the role, checks that it
+// produces the same outputs and prints the time spent in each step.
+//
+// To make this possible every role draws its randomness from its own
+// deterministic stream derived from a seed in the recording, and the
+// clock of tp-dkg.c is set to the recorded time of each call, see
+// tpdkg_set_clock(). All the signatures, timestamps and proofs are
+// still checked during the replay.
+//
+// The file is a header followed by one event for every call of
+// tpdkg_start_*() and tpdkg_*_next(), in host byte order.
+
+#define tpdkg_freshness_TIMEOUT 120000
+#define PROTO_NAME "proto test"
+
+extern FILE* log_file;
+extern int debug;
+
+typedef struct {
+  uint8_t magic[8];
+  uint8_t n, t, flags;
+  uint8_t seed[32];
+} __attribute((packed)) RecHeader;
+
+#define REC_MAGIC "TPDKGREC"
+
+enum { EV_START = 0, EV_NEXT = 1 };
+
+typedef struct {
+  // 0 for the tp, the index of the peer otherwise
+  uint8_t role;
+  uint8_t kind;
+  // the step of the role before the call
+  uint8_t step;
+  uint64_t ts;
+  // followed by the input and the output
+  uint32_t in_len, out_len;
+} __attribute((packed)) RecEvent;
+
+// the stream of the long-term keys
+#define ROLE_SETUP 0xff
+
+static uint8_t rng_seeds[256][32];
+static uint8_t rng_role = ROLE_SETUP;
+
+static void rng_buf(void * const buf, const size_t size) {
+  randombytes_buf_deterministic(buf, size, rng_seeds[rng_role]);
+  crypto_generichash(rng_seeds[rng_role], sizeof rng_seeds[0], rng_seeds[rng_role], sizeof rng_seeds[0], NULL, 0);
+}
+
+static uint32_t rng_random(void) {
+  uint32_t r;
+  rng_buf(&r, sizeof r);
+  return r;
+}
+
+static const char *rng_name(void) {
+  return "tp-dkg-replay";
+}
+
+static randombytes_implementation rng = {rng_name, rng_random, NULL, NULL, rng_buf, NULL};
+
+static void rng_init(const uint8_t seed[32]) {
+  for(unsigned i=0;i<256;i++) {
+    crypto_kdf_derive_from_key(rng_seeds[i], sizeof rng_seeds[0], i, "tpdkgrec", seed);
+  }
+  rng_role = ROLE_SETUP;
+}
+
+static uint64_t clock_ts;
+
+static uint64_t rec_clock(void) {
+  return clock_ts;
+}
+
+static double now(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (double) ts.tv_sec + (double) ts.tv_nsec / 1e9;
+}
+
+// zero sized buffers are passed as NULL to the state machines
+static uint8_t *buf_new(const size_t len) {
+  if(len==0) return NULL;
+  uint8_t *buf = malloc(len);
+  if(buf==NULL) {
+    fprintf(stderr, "out of memory\n");
+    exit(1);
+  }
+  return buf;
+}
+
+// a growing queue of messages, instead of the fixed network buffers of
+// tp-dkg.c, which do not fit for a large n
+typedef struct {
+  uint8_t *buf;
+  size_t start, len, cap;
+} Queue;
+
+static void q_send(Queue *q, const uint8_t *msg, const size_t len) {
+  if(len==0 || msg==NULL) return;
+  if(q->start + q->len + len > q->cap) {
+    memmove(q->buf, q->buf + q->start, q->len);
+    q->start = 0;
+    if(q->len + len > q->cap) {
+      q->cap = (q->len + len) * 2;
+      q->buf = realloc(q->buf, q->cap);
+      if(q->buf==NULL) {
+        fprintf(stderr, "out of memory\n");
+        exit(1);
+      }
+    }
+  }
+  memcpy(q->buf + q->start + q->len, msg, len);
+  q->len += len;
+}
+
+static void q_recv(Queue *q, uint8_t *buf, const size_t len) {
+  if(len==0 || q->len < len) return;
+  memcpy(buf, q->buf + q->start, len);
+  q->start += len;
+  q->len -= len;
+}
+
+static void rec_write(FILE *f, const uint8_t role, const uint8_t kind, const int step,
+                      const uint8_t *in, const size_t in_len, const uint8_t *out, const size_t out_len) {
+  const RecEvent ev = {role, kind, (uint8_t) step, clock_ts, (uint32_t) in_len, (uint32_t) out_len};
+  if(fwrite(&ev, sizeof ev, 1, f)!=1 ||
+     (in_len>0 && fwrite(in, in_len, 1, f)!=1) ||
+     (out_len>0 && fwrite(out, out_len, 1, f)!=1)) {
+    fprintf(stderr, "failed to write the recording\n");
+    exit(1);
+  }
+}
+
+// the long-term keys of the peers, the same in the recording and the replays
+static void lt_keys(const uint8_t n, uint8_t pks[n][crypto_sign_PUBLICKEYBYTES], uint8_t sks[n][crypto_sign_SECRETKEYBYTES]) {
+  rng_role = ROLE_SETUP;
+  for(uint8_t i=0;i<n;i++) crypto_sign_keypair(pks[i], sks[i]);
+}
+
+// the buffers tpdkg_peer_set_bufs() needs
+typedef struct {
+  uint8_t (*sig_pks)[][crypto_sign_PUBLICKEYBYTES];
+  uint8_t (*noise_pks)[][crypto_scalarmult_BYTES];
+  Noise_XK_session_t *(*noise_outs)[];
+  Noise_XK_session_t *(*noise_ins)[];
+  TOPRF_WideShare (*ishares)[];
+  TOPRF_WideShare (*xshares)[];
+  uint8_t (*commitments)[][crypto_core_ristretto255_BYTES];
+  uint32_t *complaints;
+  uint16_t *my_complaints;
+  uint64_t *last_ts;
+} PeerBufs;
+
+static void peer_bufs(TP_DKG_PeerState *peer, PeerBufs *b) {
+  const size_t n = peer->n, t = peer->t;
+  b->sig_pks = calloc(n, crypto_sign_PUBLICKEYBYTES);
+  b->noise_pks = calloc(n, crypto_scalarmult_BYTES);
+  b->noise_outs = calloc(n, sizeof(Noise_XK_session_t*));
+  b->noise_ins = calloc(n, sizeof(Noise_XK_session_t*));
+  b->ishares = calloc(n, sizeof(TOPRF_WideShare));
+  b->xshares = calloc(n, sizeof(TOPRF_WideShare));
+  b->commitments = calloc(n * t, crypto_core_ristretto255_BYTES);
+  b->complaints = calloc(n * n, sizeof(uint32_t));
+  b->my_complaints = calloc(n, sizeof(uint16_t));
+  b->last_ts = calloc(n, sizeof(uint64_t));
+  if(b->sig_pks==NULL || b->noise_pks==NULL || b->noise_outs==NULL || b->noise_ins==NULL ||
+     b->ishares==NULL || b->xshares==NULL || b->commitments==NULL || b->complaints==NULL ||
+     b->my_complaints==NULL || b->last_ts==NULL) {
+    fprintf(stderr, "out of memory\n");
+    exit(1);
+  }
+  tpdkg_peer_set_bufs(peer, b->sig_pks, b->noise_pks, b->noise_outs, b->noise_ins,
+                      b->ishares, b->xshares, b->commitments,
+                      b->complaints, b->my_complaints, b->last_ts);
+}
+
+static void peer_bufs_free(PeerBufs *b) {
+  free(b->sig_pks); free(b->noise_pks); free(b->noise_outs); free(b->noise_ins);
+  free(b->ishares); free(b->xshares); free(b->commitments);
+  free(b->complaints); free(b->my_complaints); free(b->last_ts);
+}
+
+// verifies the message of each peer in place, like tests/tp-dkg.c
+static int tp_feed(TP_DKG_TPState *tp, uint8_t *tp_in, const size_t tp_in_size) {
+  if(tp_in_size==0) return 0;
+  size_t sizes[tp->n], offset=0;
+  tpdkg_tp_input_sizes(tp, sizes);
+  for(uint16_t i=0;i<tp->n;offset+=sizes[i],i++) {
+    if(sizes[i]==0) continue;
+    const int ret = tpdkg_tp_feed(tp, i, tp_in+offset, sizes[i], tp_in, tp_in_size);
+    if(ret!=0 && ret!=5) return ret;
+  }
+  return 0;
+}
+
+static int record(const uint8_t n, const uint8_t t, const uint8_t flags, const char *path) {
+  FILE *f = fopen(path, "wb");
+  if(f==NULL) {
+    perror(path);
+    return 1;
+  }
+  RecHeader hdr;
+  memcpy(hdr.magic, REC_MAGIC, sizeof hdr.magic);
+  hdr.n = n;
+  hdr.t = t;
+  hdr.flags = flags;
+  randombytes_buf(hdr.seed, sizeof hdr.seed);
+  if(fwrite(&hdr, sizeof hdr, 1, f)!=1) return 1;
+  rng_init(hdr.seed);
+  randombytes_set_implementation(&rng);
+  tpdkg_set_clock(rec_clock);
+
+  uint8_t (*lt_pks)[crypto_sign_PUBLICKEYBYTES] = (void*) buf_new(n * crypto_sign_PUBLICKEYBYTES);
+  uint8_t (*lt_sks)[crypto_sign_SECRETKEYBYTES] = (void*) buf_new(n * crypto_sign_SECRETKEYBYTES);
+  lt_keys(n, lt_pks, lt_sks);
+
+  TP_DKG_TPState tp;
+  uint8_t msg0[tpdkg_msg0_SIZE];
+  rng_role = 0;
+  clock_ts = (uint64_t) time(NULL);
+  int ret = tpdkg_start_tp_flags(&tp, tpdkg_freshness_TIMEOUT, n, t, PROTO_NAME, sizeof PROTO_NAME - 1, flags, sizeof msg0, (TP_DKG_Message*) msg0);
+  if(ret) return ret;
+  const size_t tp_arena_len = tpdkg_tp_arena_size(n, t);
+  uint8_t *tp_arena = buf_new(tp_arena_len);
+  ret = tpdkg_tp_set_arena(&tp, tp_arena, tp_arena_len, (const uint8_t (*)[][crypto_sign_PUBLICKEYBYTES]) lt_pks, 0);
+  if(ret) return ret;
+  rec_write(f, 0, EV_START, 0, NULL, 0, msg0, sizeof msg0);
+
+  TP_DKG_PeerState *peers = calloc(n, sizeof(TP_DKG_PeerState));
+  PeerBufs *bufs = calloc(n, sizeof(PeerBufs));
+  Queue *queues = calloc(n + 1, sizeof(Queue));
+  if(peers==NULL || bufs==NULL || queues==NULL) return 1;
+  for(uint8_t i=0;i<n;i++) {
+    rng_role = (uint8_t) (i+1);
+    ret = tpdkg_start_peer(&peers[i], tpdkg_freshness_TIMEOUT, lt_sks[i], (TP_DKG_Message*) msg0);
+    if(ret) return ret;
+    peer_bufs(&peers[i], &bufs[i]);
+    rec_write(f, (uint8_t) (i+1), EV_START, 0, msg0, sizeof msg0, NULL, 0);
+  }
+
+  while(tpdkg_tp_not_done(&tp)) {
+    const size_t tp_out_size = tpdkg_tp_routes(&tp) ? 0 : tpdkg_tp_output_size(&tp);
+    const size_t tp_in_size = tpdkg_tp_input_size(&tp);
+    uint8_t *tp_out = buf_new(tp_out_size), *tp_in = buf_new(tp_in_size);
+    q_recv(&queues[0], tp_in, tp_in_size);
+
+    rng_role = 0;
+    clock_ts = (uint64_t) time(NULL);
+    const int step = tp.step;
+    ret = tp_feed(&tp, tp_in, tp_in_size);
+    if(ret==0) ret = tpdkg_tp_next(&tp, tp_in, tp_in_size, tp_out, tp_out_size);
+    if(ret) {
+      fprintf(stderr, "tp failed in step %d: %d\n", step, ret);
+      return ret;
+    }
+    rec_write(f, 0, EV_NEXT, step, tp_in, tp_in_size, tp_out, tp_out_size);
+
+    for(uint8_t i=0;i<n;i++) {
+      uint8_t frame[tpdkg_frame_SIZE];
+      struct iovec iov[n+1];
+      size_t iovcnt;
+      if(tpdkg_tp_peer_iov(&tp, tp_out, tp_out_size, tp_in, tp_in_size, i, frame, iov, n+1u, &iovcnt)) return 1;
+      for(size_t j=1;j<iovcnt;j++) q_send(&queues[i+1], iov[j].iov_base, iov[j].iov_len);
+    }
+    free(tp_out);
+    free(tp_in);
+
+    int active = 1;
+    while(queues[0].len==0 && active) {
+      active = 0;
+      for(uint8_t i=0;i<n;i++) {
+        if(!tpdkg_peer_not_done(&peers[i])) continue;
+        active = 1;
+        const size_t out_size = tpdkg_peer_output_size(&peers[i]);
+        const size_t in_size = tpdkg_peer_input_size(&peers[i]);
+        uint8_t *out = buf_new(out_size), *in = buf_new(in_size);
+        q_recv(&queues[i+1], in, in_size);
+
+        rng_role = (uint8_t) (i+1);
+        clock_ts = (uint64_t) time(NULL);
+        const int pstep = peers[i].step;
+        ret = tpdkg_peer_next(&peers[i], in, in_size, out, out_size);
+        if(ret) {
+          fprintf(stderr, "peer %d failed in step %d: %d\n", i+1, pstep, ret);
+          return ret;
+        }
+        rec_write(f, (uint8_t) (i+1), EV_NEXT, pstep, in, in_size, out, out_size);
+        q_send(&queues[0], out, out_size);
+        free(out);
+        free(in);
+      }
+    }
+  }
+  if(tp.cheater_len!=0) {
+    fprintf(stderr, "the recorded run has cheaters\n");
+    return 1;
+  }
+  const long size = ftell(f);
+  if(fclose(f)) return 1;
+  fprintf(stderr, "recorded %d-of-%d to %s, %ld bytes\n", t, n, path, size);
+
+  for(uint8_t i=0;i<n;i++) {
+    tpdkg_peer_free(&peers[i]);
+    peer_bufs_free(&bufs[i]);
+    free(queues[i+1].buf);
+  }
+  free(queues[0].buf);
+  free(queues);
+  free(bufs);
+  free(peers);
+  tpdkg_arena_wipe(tp_arena, tp_arena_len, 0);
+  free(tp_arena);
+  free(lt_pks);
+  free(lt_sks);
+  randombytes_set_implementation(NULL);
+  tpdkg_set_clock(NULL);
+  return 0;
+}
+
+typedef struct {
+  unsigned calls;
+  double time;
+} StepTime;
+
+// the next event of role in the recording, NULL at the end
+static const RecEvent *next_event(const uint8_t *rec, const size_t rec_len, size_t *pos, const uint8_t role,
+                                  const uint8_t **in, const uint8_t **out) {
+  while(*pos + sizeof(RecEvent) <= rec_len) {
+    const RecEvent *ev = (const RecEvent*) (rec + *pos);
+    const size_t len = sizeof(RecEvent) + ev->in_len + ev->out_len;
+    if(*pos + len > rec_len) break;
+    *in = rec + *pos + sizeof(RecEvent);
+    *out = *in + ev->in_len;
+    *pos += len;
+    if(ev->role==role) return ev;
+  }
+  return NULL;
+}
+
+static int check_output(const RecEvent *ev, const uint8_t *expected, const uint8_t *out, const size_t out_len) {
+  if(out_len!=ev->out_len || (out_len>0 && memcmp(out, expected, out_len)!=0)) {
+    fprintf(stderr, "\e[0;31mthe output of role %d in step %d differs from the recording\e[0m\n", ev->role, ev->step);
+    return 1;
+  }
+  return 0;
+}
+
+static int replay_once(const RecHeader *hdr, const uint8_t *rec, const size_t rec_len, const uint8_t role,
+                       StepTime steps[256]) {
+  const uint8_t n = hdr->n, t = hdr->t;
+  rng_init(hdr->seed);
+  uint8_t (*lt_pks)[crypto_sign_PUBLICKEYBYTES] = (void*) buf_new(n * crypto_sign_PUBLICKEYBYTES);
+  uint8_t (*lt_sks)[crypto_sign_SECRETKEYBYTES] = (void*) buf_new(n * crypto_sign_SECRETKEYBYTES);
+  lt_keys(n, lt_pks, lt_sks);
+  rng_role = role;
+
+  size_t pos = sizeof(RecHeader);
+  const uint8_t *in, *out;
+  const RecEvent *ev = next_event(rec, rec_len, &pos, role, &in, &out);
+  if(ev==NULL || ev->kind!=EV_START) return 1;
+  clock_ts = ev->ts;
+
+  int ret = 0;
+  if(role==0) {
+    TP_DKG_TPState tp;
+    uint8_t msg0[tpdkg_msg0_SIZE];
+    ret = tpdkg_start_tp_flags(&tp, tpdkg_freshness_TIMEOUT, n, t, PROTO_NAME, sizeof PROTO_NAME - 1, hdr->flags, sizeof msg0, (TP_DKG_Message*) msg0);
+    if(ret) return ret;
+    if(check_output(ev, out, msg0, sizeof msg0)) return 1;
+    const size_t tp_arena_len = tpdkg_tp_arena_size(n, t);
+    uint8_t *tp_arena = buf_new(tp_arena_len);
+    ret = tpdkg_tp_set_arena(&tp, tp_arena, tp_arena_len, (const uint8_t (*)[][crypto_sign_PUBLICKEYBYTES]) lt_pks, 0);
+    while(ret==0 && (ev = next_event(rec, rec_len, &pos, role, &in, &out))!=NULL) {
+      if(ev->kind!=EV_NEXT || ev->step!=tp.step || ev->in_len!=tpdkg_tp_input_size(&tp)) {
+        ret = 1;
+        break;
+      }
+      const size_t out_len = tpdkg_tp_routes(&tp) ? 0 : tpdkg_tp_output_size(&tp);
+      // tpdkg_tp_feed() verifies in place, so the input needs a copy
+      uint8_t *tp_in = buf_new(ev->in_len), *tp_out = buf_new(out_len);
+      if(ev->in_len>0) memcpy(tp_in, in, ev->in_len);
+      clock_ts = ev->ts;
+      const double start = now();
+      ret = tp_feed(&tp, tp_in, ev->in_len);
+      if(ret==0) ret = tpdkg_tp_next(&tp, tp_in, ev->in_len, tp_out, out_len);
+      steps[ev->step].time += now() - start;
+      steps[ev->step].calls++;
+      if(ret==0) ret = check_output(ev, out, tp_out, out_len);
+      free(tp_in);
+      free(tp_out);
+    }
+    if(ret==0 && tpdkg_tp_not_done(&tp)) ret = 1;
+    tpdkg_arena_wipe(tp_arena, tp_arena_len, 0);
+    free(tp_arena);
+  } else {
+    TP_DKG_PeerState peer;
+    PeerBufs bufs;
+    if(ev->in_len!=tpdkg_msg0_SIZE) return 1;
+    ret = tpdkg_start_peer(&peer, tpdkg_freshness_TIMEOUT, lt_sks[role-1], (const TP_DKG_Message*) in);
+    if(ret) return ret;
+    peer_bufs(&peer, &bufs);
+    while(ret==0 && (ev = next_event(rec, rec_len, &pos, role, &in, &out))!=NULL) {
+      if(ev->kind!=EV_NEXT || ev->step!=peer.step || ev->in_len!=tpdkg_peer_input_size(&peer)) {
+        ret = 1;
+        break;
+      }
+      const size_t out_len = tpdkg_peer_output_size(&peer);
+      uint8_t *peer_out = buf_new(out_len);
+      clock_ts = ev->ts;
+      const double start = now();
+      ret = tpdkg_peer_next(&peer, ev->in_len ? in : NULL, ev->in_len, peer_out, out_len);
+      steps[ev->step].time += now() - start;
+      steps[ev->step].calls++;
+      if(ret==0) ret = check_output(ev, out, peer_out, out_len);
+      free(peer_out);
+    }
+    if(ret==0 && tpdkg_peer_not_done(&peer)) ret = 1;
+    tpdkg_peer_free(&peer);
+    peer_bufs_free(&bufs);
+  }
+  free(lt_pks);
+  free(lt_sks);
+  return ret;
+}
+
+static int replay(const char *path, const uint8_t role, const unsigned iterations) {
+  FILE *f = fopen(path, "rb");
+  if(f==NULL) {
+    perror(path);
+    return 1;
+  }
+  if(fseek(f, 0, SEEK_END)) return 1;
+  const long size = ftell(f);
+  if(size < (long) sizeof(RecHeader) || fseek(f, 0, SEEK_SET)) return 1;
+  uint8_t *rec = buf_new((size_t) size);
+  if(fread(rec, (size_t) size, 1, f)!=1) return 1;
+  fclose(f);
+
+  const RecHeader *hdr = (const RecHeader*) rec;
+  if(memcmp(hdr->magic, REC_MAGIC, sizeof hdr->magic)!=0 || role > hdr->n) {
+    fprintf(stderr, "not a recording of a run with role %d\n", role);
+    return 1;
+  }
+  randombytes_set_implementation(&rng);
+  tpdkg_set_clock(rec_clock);
+
+  StepTime steps[256];
+  memset(steps, 0, sizeof steps);
+  for(unsigned i=0;i<iterations;i++) {
+    const int ret = replay_once(hdr, rec, (size_t) size, role, steps);
+    if(ret) {
+      fprintf(stderr, "\e[0;31mreplay of role %d failed: %d\e[0m\n", role, ret);
+      return 1;
+    }
+  }
+  randombytes_set_implementation(NULL);
+  tpdkg_set_clock(NULL);
+
+  double total = 0;
+  printf("%s of %d-of-%d, %u iterations\n", role==0 ? "tp" : "peer", hdr->t, hdr->n, iterations);
+  printf("%4s %6s %12s\n", "step", "calls", "time (us)");
+  for(int i=0;i<256;i++) {
+    if(steps[i].calls==0) continue;
+    printf("%4d %6u %12.1f\n", i, steps[i].calls / iterations, steps[i].time / iterations * 1e6);
+    total += steps[i].time;
+  }
+  printf("%4s %6s %12.1f\n", "all", "", total / iterations * 1e6);
+  free(rec);
+  return 0;
+}
+
+int main(const int argc, const char **argv) {
+  log_file = getenv("TPDKG_LOG") ? stderr : NULL;
+  debug = log_file!=NULL;
+  if(sodium_init() < 0) return 1;
+  if(argc>=5 && strcmp(argv[1], "record")==0) {
+    const uint8_t flags = (argc>5 && atoi(argv[5])) ? tpdkg_OPTIMISTIC : 0;
+    return record((uint8_t) atoi(argv[2]), (uint8_t) atoi(argv[3]), flags, argv[4]);
+  }
+  if(argc>=4 && strcmp(argv[1], "replay")==0) {
+    const unsigned iterations = argc>4 ? (unsigned) atoi(argv[4]) : 1;
+    return replay(argv[2], (uint8_t) atoi(argv[3]), iterations ? iterations : 1);
+  }
+  fprintf(stderr, "run as: %% %s record <n> <t> <file> [<optimistic>]\n"
+                  "     or: %% %s replay <file> <role> [<iterations>]\n", argv[0], argv[0]);
+  return 1;
+}
@@ -4,6 +4,8 @@
 #include "utils.h"
 #include "toprf.h"
 #include "tp-dkg.h"
+#include "workerpool.h"
+#include <arpa/inet.h>
 #ifdef FUZZING_BUILD_MODE_UNSAFE_FOR_PRODUCTION
 #include <unistd.h>
 #endif
@@ -18,16 +20,16 @@ __AFL_FUZZ_INIT();
 #endif
 
 typedef struct {
-  uint8_t index;
+  uint16_t index;
   uint8_t value[crypto_core_ristretto255_BYTES];
-} __attribute((packed)) TOPRF_Part;
+} __attribute((packed)) TOPRF_WidePart;
 
-static void topart(TOPRF_Part *r, const TOPRF_Share *s) {
+static void topart(TOPRF_WidePart *r, const TOPRF_WideShare *s) {
   r->index=s->index;
   crypto_scalarmult_ristretto255_base(r->value, s->value);
 }
 
-static void shuffle(uint8_t *array, const size_t n) {
+static void shuffle(uint16_t *array, const size_t n) {
   if (n < 2) return;
   srand(time(NULL));
   for(int i=0; i<n-1; i++) {
@@ -38,21 +40,21 @@ static void shuffle(uint8_t *array, const size_t n) {
   }
 }
 
-static int verify_shares(const uint8_t n, const TOPRF_Share shares[n], const uint8_t t) {
-  uint8_t responses[t][sizeof(TOPRF_Part)];
+static int verify_shares(const uint16_t n, const TOPRF_WideShare shares[n], const uint16_t t) {
+  uint8_t responses[t][TOPRF_WidePart_BYTES];
   uint8_t v0[crypto_scalarmult_ristretto255_BYTES]={0};
 
-  uint8_t indexes[n];
-  for(int i=0;i<n;i++) indexes[i]=i;
+  uint16_t indexes[n];
+  for(uint16_t i=0;i<n;i++) indexes[i]=i;
   if(log_file!=NULL) {
     fprintf(stderr, "order: ");
     for(int i=0;i<t;i++) fprintf(stderr, "%2d, ",indexes[i]);
   }
 
   for(int i=0;i<t;i++) {
-    topart((TOPRF_Part *) responses[i], &shares[indexes[i]]);
+    topart((TOPRF_WidePart *) responses[i], &shares[indexes[i]]);
   }
-  if(toprf_thresholdmult(t, responses, v0)) return 1;
+  if(toprf_wide_thresholdmult(t, responses, v0)) return 1;
   dump(v0,sizeof v0, "v0\t");
 
   for(int k=0;k<t-1;k++) {
@@ -64,10 +66,10 @@ static int verify_shares(const uint8_t n, const TOPRF_Share shares[n], const uin
     }
 
     for(int i=0;i<t;i++) {
-        topart((TOPRF_Part *) responses[i], &shares[indexes[i]]);
+        topart((TOPRF_WidePart *) responses[i], &shares[indexes[i]]);
     }
 
-    if(toprf_thresholdmult(t, responses, v1)) return 1;
+    if(toprf_wide_thresholdmult(t, responses, v1)) return 1;
     dump(v1,sizeof v1, "v%d\t", k+1);
 
     if(memcmp(v0,v1,sizeof v1)!=0) {
@@ -150,13 +152,13 @@ static int fuzz_loop(const uint8_t step, TP_DKG_TPState *tp, TP_DKG_PeerState *p
     int ret = tpdkg_tp_next(tp, buf, len, tp_out, tp_out_size);
     if(0!=ret) {
       // clean up peers
-      for(uint8_t i=0;i<tp->n;i++) tpdkg_peer_free(&peers[i]);
+      for(uint16_t i=0;i<tp->n;i++) tpdkg_peer_free(&peers[i]);
       if(tp->cheater_len > 0) return 125;
       return ret;
     }
 
     while(tpdkg_tp_not_done(tp)) {
-      for(uint8_t i=0;i<tp->n;i++) {
+      for(uint16_t i=0;i<tp->n;i++) {
         const uint8_t *msg;
         size_t len;
         if(0!=tpdkg_tp_peer_msg(tp, tp_out, tp_out_size, i, &msg, &len)) {
@@ -166,7 +168,7 @@ static int fuzz_loop(const uint8_t step, TP_DKG_TPState *tp, TP_DKG_PeerState *p
       }
 
       while(pkt_len[0]==0 && tpdkg_peer_not_done(&peers[1])) {
-        for(uint8_t i=0;i<tp->n;i++) {
+        for(uint16_t i=0;i<tp->n;i++) {
           // 0sized vla meh
           const size_t peer_out_size = tpdkg_peer_output_size(&peers[i]);
           uint8_t peers_out_buf[peer_out_size==0?1:peer_out_size], *peers_out;
@@ -186,7 +188,7 @@ static int fuzz_loop(const uint8_t step, TP_DKG_TPState *tp, TP_DKG_PeerState *p
 
           if(0!=ret) {
             // clean up peers
-            for(uint8_t i=0;i<tp->n;i++) tpdkg_peer_free(&peers[i]);
+            for(uint16_t i=0;i<tp->n;i++) tpdkg_peer_free(&peers[i]);
             return ret;
           }
 
@@ -211,7 +213,7 @@ static int fuzz_loop(const uint8_t step, TP_DKG_TPState *tp, TP_DKG_PeerState *p
       ret = tpdkg_tp_next(tp, tp_in, tp_in_size, tp_out, tp_out_size);
       if(0!=ret) {
         // clean up peers
-        for(uint8_t i=0;i<tp->n;i++) tpdkg_peer_free(&peers[i]);
+        for(uint16_t i=0;i<tp->n;i++) tpdkg_peer_free(&peers[i]);
         if(tp->cheater_len > 0) return 55;
         return ret;
       }
@@ -252,12 +254,12 @@ static int fuzz_loop(const uint8_t step, TP_DKG_TPState *tp, TP_DKG_PeerState *p
 
     ret = tpdkg_peer_next(&peers[0], buf, len, peer_out, peer_out_size);
     if(ret!=0) {
-      //for(uint8_t i=0;i<tp->n;i++) tpdkg_peer_free(&peers[i]);
+      //for(uint16_t i=0;i<tp->n;i++) tpdkg_peer_free(&peers[i]);
       return ret;
     }
     _send(network_buf[0], &pkt_len[0], peer_out, peer_out_size);
 
-    for(uint8_t i=1;i<tp->n;i++) {
+    for(uint16_t i=1;i<tp->n;i++) {
       // 0sized vla meh
       const size_t peer_out_size = tpdkg_peer_output_size(&peers[i]);
       uint8_t peers_out_buf[peer_out_size==0?1:peer_out_size], *peers_out;
@@ -277,7 +279,7 @@ static int fuzz_loop(const uint8_t step, TP_DKG_TPState *tp, TP_DKG_PeerState *p
 
       if(0!=ret) {
         // clean up peers
-        //for(uint8_t i=0;i<tp->n;i++) tpdkg_peer_free(&peers[i]);
+        //for(uint16_t i=0;i<tp->n;i++) tpdkg_peer_free(&peers[i]);
         return ret;
       }
       _send(network_buf[0], &pkt_len[0], peers_out, peer_out_size);
@@ -285,7 +287,7 @@ static int fuzz_loop(const uint8_t step, TP_DKG_TPState *tp, TP_DKG_PeerState *p
 
     while(tpdkg_tp_not_done(tp)) {
       while(pkt_len[0]==0 && tpdkg_peer_not_done(&peers[1])) {
-        for(uint8_t i=0;i<tp->n;i++) {
+        for(uint16_t i=0;i<tp->n;i++) {
           // 0sized vla meh
           const size_t peer_out_size = tpdkg_peer_output_size(&peers[i]);
           uint8_t peers_out_buf[peer_out_size==0?1:peer_out_size], *peers_out;
@@ -305,7 +307,7 @@ static int fuzz_loop(const uint8_t step, TP_DKG_TPState *tp, TP_DKG_PeerState *p
 
           if(0!=ret) {
             // clean up peers
-            //for(uint8_t i=0;i<tp->n;i++) tpdkg_peer_free(&peers[i]);
+            //for(uint16_t i=0;i<tp->n;i++) tpdkg_peer_free(&peers[i]);
             return ret;
           }
 
@@ -330,12 +332,12 @@ static int fuzz_loop(const uint8_t step, TP_DKG_TPState *tp, TP_DKG_PeerState *p
       ret = tpdkg_tp_next(tp, tp_in, tp_in_size, tp_out, tp_out_size);
       if(0!=ret) {
         // clean up peers
-        for(uint8_t i=0;i<tp->n;i++) tpdkg_peer_free(&peers[i]);
+        for(uint16_t i=0;i<tp->n;i++) tpdkg_peer_free(&peers[i]);
         if(tp->cheater_len > 0) return 55;
         return ret;
       }
 
-      for(uint8_t i=0;i<tp->n;i++) {
+      for(uint16_t i=0;i<tp->n;i++) {
         const uint8_t *msg;
         size_t len;
         if(0!=tpdkg_tp_peer_msg(tp, tp_out, tp_out_size, i, &msg, &len)) {
@@ -354,6 +356,37 @@ static int fuzz_loop(const uint8_t step, TP_DKG_TPState *tp, TP_DKG_PeerState *p
 #endif
 #endif
 
+#ifdef TPDKG_METRICS
+static void dump_metrics(const char *who, const TP_DKG_Metrics *m) {
+  for(int i=0;i<tpdkg_metrics_STEPS;i++) {
+    const TP_DKG_StepMetrics *s = &m->steps[i];
+    if(s->calls==0) continue;
+    fprintf(stderr, "%s step %2d: calls %3u, %8luus, in %7lu, out %7lu, sign %4u, verify %4u, noise %4u, cheaters %u\n",
+            who, i, s->calls, s->time_ns / 1000, s->bytes_in, s->bytes_out, s->sig_sign, s->sig_verify, s->noise_ops, s->cheaters);
+  }
+}
+
+// checks a few counters that are fixed by the protocol
+static int check_metrics(const uint16_t n, const uint8_t flags, const TP_DKG_Metrics *tp, const TP_DKG_Metrics *peers) {
+  dump_metrics("tp  ", tp);
+  dump_metrics("peer", peers);
+  // the tp signs one msg1 for every peer
+  if(tp->steps[0].calls!=1 || tp->steps[0].sig_sign!=n) return 1;
+  // and verifies the long-term and the session signature of every msg2
+  if(tp->steps[1].sig_verify!=2u*n) return 1;
+  // every peer verifies msg1, and signs msg2 with both keys
+  if(peers->steps[0].calls!=n || peers->steps[0].sig_verify!=n || peers->steps[0].sig_sign!=2u*n) return 1;
+  // every peer starts a noise handshake with every peer
+  if(peers->steps[1].noise_ops!=(unsigned) n*n) return 1;
+  // the optimistic mode skips the transcript round of steps 19-21
+  if((flags & tpdkg_OPTIMISTIC) && (tp->steps[8].calls!=0 || peers->steps[9].calls!=0)) return 1;
+  for(int i=0;i<tpdkg_metrics_STEPS;i++) {
+    if(tp->steps[i].cheaters!=0) return 1;
+  }
+  return 0;
+}
+#endif // TPDKG_METRICS
+
 int main(const int argc, const char **argv) {
   int ret;
   // enable logging
@@ -368,7 +401,19 @@ int main(const int argc, const char **argv) {
 #endif // defined(FUZZING_BUILD_MODE_UNSAFE_FOR_PRODUCTION) || defined(FUZZ_DUMP)
     exit(1);
   }
-  uint8_t n=atoi(argv[1]),t=atoi(argv[2]);
+  uint16_t n=(uint16_t) atoi(argv[1]),t=(uint16_t) atoi(argv[2]);
+#if !defined(FUZZING_BUILD_MODE_UNSAFE_FOR_PRODUCTION) && !defined(FUZZ_DUMP)
+  // optionally verify the messages in the TP and run the noise sessions
+  // of the peers using a pool of threads
+  const unsigned workers = argc>3 ? (unsigned) atoi(argv[3]) : 0;
+  // and optionally run the optimistic variant of the protocol
+  const uint8_t flags = (argc>4 && atoi(argv[4])) ? tpdkg_OPTIMISTIC : 0;
+  // and optionally change the message of peer 2 after it has been fed
+  // in this step, which tpdkg_tp_next() must not accept
+  const int tamper = argc>5 ? atoi(argv[5]) : 0;
+#else
+  const uint8_t flags = 0;
+#endif
 #if defined(FUZZING_BUILD_MODE_UNSAFE_FOR_PRODUCTION) || defined(FUZZ_DUMP)
   uint8_t step=atoi(argv[3]);
 #ifdef FUZZ_PEER
@@ -386,41 +431,52 @@ int main(const int argc, const char **argv) {
   uint8_t peer_lt_pks[n][crypto_sign_PUBLICKEYBYTES];
   // only known by corresponding peer
   uint8_t peer_lt_sks[n][crypto_sign_SECRETKEYBYTES];
-  for(uint8_t i=0;i<n;i++) {
+  for(uint16_t i=0;i<n;i++) {
       crypto_sign_keypair(peer_lt_pks[i], peer_lt_sks[i]);
   }
 
   TP_DKG_TPState tp;
   uint8_t msg0[tpdkg_msg0_SIZE];
-  ret = tpdkg_start_tp(&tp, tpdkg_freshness_TIMEOUT, n, t, "proto test", 10, sizeof msg0, (TP_DKG_Message*) msg0);
+  ret = tpdkg_start_tp_flags(&tp, tpdkg_freshness_TIMEOUT, n, t, "proto test", 10, flags, sizeof msg0, (TP_DKG_Message*) msg0);
   if(0!=ret) return ret;
+#if !defined(FUZZING_BUILD_MODE_UNSAFE_FOR_PRODUCTION) && !defined(FUZZ_DUMP)
+  WorkerPool *pool = NULL;
+  if(workers>0) {
+    pool = workerpool_new(workers);
+    if(pool==NULL) return 1;
+    tpdkg_tp_set_workers(&tp, workerpool_run, pool);
+  }
+#endif
+#ifdef TPDKG_METRICS
+  TP_DKG_Metrics tp_metrics, peer_metrics;
+  memset(&tp_metrics, 0, sizeof tp_metrics);
+  memset(&peer_metrics, 0, sizeof peer_metrics);
+  if(0!=tpdkg_tp_set_metrics(&tp, &tp_metrics)) return 1;
+#endif
 
-  // set bufs
-  // we need to store these outside of the ctx, since they are
-  // variable size, and the struct can only handle one variable size
-  // entry...
-  uint8_t tp_peers_sig_pks[n][crypto_sign_PUBLICKEYBYTES];
-  memset(tp_peers_sig_pks,0,sizeof(tp_peers_sig_pks));
-  // tp needs to store the commitments
-  uint8_t tp_commitments[n*t][crypto_core_ristretto255_BYTES];
-  memset(tp_commitments,0,sizeof(tp_commitments));
-  // tp needs to store the complaints, with max n==128 this takes max 16KB of ram.
-  uint16_t tp_complaints[n*n];
-  memset(tp_complaints,0,sizeof(tp_complaints));
-  uint8_t noisy_shares[n*n][tpdkg_msg8_SIZE];
-  memset(noisy_shares,0,sizeof(noisy_shares));
-  TP_DKG_Cheater cheaters[t*t - 1];
-  memset(cheaters,0,sizeof(cheaters));
-  uint64_t last_ts[n];
-  tpdkg_tp_set_bufs(&tp, &tp_commitments, &tp_complaints, &noisy_shares, &cheaters, sizeof(cheaters) / sizeof(TP_DKG_Cheater), &tp_peers_sig_pks, &peer_lt_pks, last_ts);
+  // the tp keeps all its variable sized buffers in one arena, see
+  // below for the peers which use separate buffers.
+  const size_t tp_arena_len = tpdkg_tp_arena_size(n, t);
+  uint8_t *tp_arena = malloc(tp_arena_len);
+  if(tp_arena==NULL) return 1;
+  ret = tpdkg_tp_set_arena(&tp, tp_arena, tp_arena_len, (const uint8_t (*)[][crypto_sign_PUBLICKEYBYTES]) &peer_lt_pks, 1);
+  if(0!=ret) return ret;
 
   // only tp_out can survive for the peers in local scope of the "main protocol loop"
   // and thus we simulate a network with this buffer
 
   TP_DKG_PeerState peers[n];
-  for(uint8_t i=0;i<n;i++) {
+  for(uint16_t i=0;i<n;i++) {
     ret = tpdkg_start_peer(&peers[i], tpdkg_freshness_TIMEOUT, peer_lt_sks[i], (TP_DKG_Message*) msg0);
     if(0!=ret) return ret;
+#ifdef TPDKG_METRICS
+    // the counters of all peers are accumulated
+    if(0!=tpdkg_peer_set_metrics(&peers[i], &peer_metrics)) return 1;
+#endif
+#if !defined(FUZZING_BUILD_MODE_UNSAFE_FOR_PRODUCTION) && !defined(FUZZ_DUMP)
+    // the peers run one after the other here, so they can share the pool of the tp
+    if(pool!=NULL) tpdkg_peer_set_workers(&peers[i], workerpool_run, pool);
+#endif
   }
 
   // now that the peer(s) know the value of N, we can allocate buffers
@@ -432,20 +488,20 @@ int main(const int argc, const char **argv) {
   memset(noise_outs, 0, sizeof noise_outs);
   Noise_XK_session_t *noise_ins[n][n];
   memset(noise_ins, 0, sizeof noise_ins);
-  TOPRF_Share ishares[peers[1].n][peers[1].n];
+  TOPRF_WideShare ishares[peers[1].n][peers[1].n];
   memset(ishares, 0, sizeof ishares);
-  TOPRF_Share xshares[peers[1].n][peers[1].n];
+  TOPRF_WideShare xshares[peers[1].n][peers[1].n];
   memset(xshares, 0, sizeof xshares);
   uint8_t commitments[peers[1].n][peers[1].n *peers[1].t][crypto_core_ristretto255_BYTES];
   memset(commitments, 0, sizeof commitments);
-  uint16_t peer_complaints[peers[1].n][peers[1].n*peers[1].n];
+  uint32_t peer_complaints[peers[1].n][peers[1].n*peers[1].n];
   memset(peer_complaints, 0, sizeof peer_complaints);
-  uint8_t peer_my_complaints[peers[1].n][peers[1].n];
+  uint16_t peer_my_complaints[peers[1].n][peers[1].n];
   memset(peer_my_complaints, 0, sizeof peer_my_complaints);
   uint64_t peer_last_ts[n][n];
   memset(peer_last_ts, 0, sizeof peer_last_ts);
 
-  for(uint8_t i=0;i<n;i++) {
+  for(uint16_t i=0;i<n;i++) {
     // in a real deployment peers do not share the same pks buffers
     tpdkg_peer_set_bufs(&peers[i], &peers_sig_pks, &peers_noise_pks,
                         &noise_outs[i], &noise_ins[i],
@@ -466,8 +522,9 @@ int main(const int argc, const char **argv) {
   // end condition for peers is tpdkg_peer_not_done(&peer)
   while(tpdkg_tp_not_done(&tp)) {
 
-    // doing vla - but avoiding 0 sized ones is ugly
-    const size_t tp_out_size = tpdkg_tp_output_size(&tp);
+    // doing vla - but avoiding 0 sized ones is ugly. the routed
+    // messages are sent straight from tp_in, see tpdkg_tp_peer_iov()
+    const size_t tp_out_size = tpdkg_tp_routes(&tp) ? 0 : tpdkg_tp_output_size(&tp);
     uint8_t tp_out_buf[tp_out_size==0?1:tp_out_size], *tp_out;
     if(tp_out_size==0) tp_out = NULL;
     else tp_out = tp_out_buf;
@@ -480,6 +537,21 @@ int main(const int argc, const char **argv) {
 
     _recv(network_buf[0], &pkt_len[0], tp_in, tp_in_size);
 
+#if !defined(FUZZING_BUILD_MODE_UNSAFE_FOR_PRODUCTION)
+    // verify the message of each peer in place, as if it just arrived
+    if(tp_in_size>0) {
+      size_t tp_in_sizes[n], offset=0;
+      tpdkg_tp_input_sizes(&tp, tp_in_sizes);
+      for(uint16_t i=0;i<n;offset+=tp_in_sizes[i],i++) {
+        if(tp_in_sizes[i]==0) continue;
+        ret = tpdkg_tp_feed(&tp, i, tp_in+offset, tp_in_sizes[i], tp_in, tp_in_size);
+        if(ret==5) fprintf(stderr, "\e[0;31m[!] message of peer %d failed verification\e[0m\n", i+1);
+        else if(ret!=0) return ret;
+        if(i==1 && tp.step==tamper) tp_in[offset] ^= 1;
+      }
+    }
+#endif
+
 #if defined(FUZZING_BUILD_MODE_UNSAFE_FOR_PRODUCTION) && !defined(FUZZ_PEER)
     ret = fuzz_loop(step, &tp, peers, network_buf, pkt_len);
     if(0!=ret) return ret;
@@ -491,22 +563,32 @@ int main(const int argc, const char **argv) {
     ret = tpdkg_tp_next(&tp, tp_in, tp_in_size, tp_out, tp_out_size);
     if(0!=ret) {
       // clean up peers
-      for(uint8_t i=0;i<n;i++) tpdkg_peer_free(&peers[i]);
+      for(uint16_t i=0;i<n;i++) tpdkg_peer_free(&peers[i]);
       if(tp.cheater_len > 0) break;
       return ret;
     }
 
-    for(uint8_t i=0;i<tp.n;i++) {
-      const uint8_t *msg;
-      size_t len;
-      if(0!=tpdkg_tp_peer_msg(&tp, tp_out, tp_out_size, i, &msg, &len)) {
+    for(uint16_t i=0;i<tp.n;i++) {
+      uint8_t frame[tpdkg_frame_SIZE];
+      struct iovec iov[n+1];
+      size_t iovcnt;
+      if(0!=tpdkg_tp_peer_iov(&tp, tp_out, tp_out_size, tp_in, tp_in_size, i, frame, iov, n+1, &iovcnt)) {
         return 1;
       }
-      _send(network_buf[i+1], &pkt_len[i+1], msg, len);
+      if(iovcnt==0) continue;
+      // the frame holds the length of the rest, which the peer expects
+      uint32_t frame_len;
+      memcpy(&frame_len, frame, sizeof frame_len);
+      size_t len = 0;
+      for(size_t j=1;j<iovcnt;j++) {
+        _send(network_buf[i+1], &pkt_len[i+1], iov[j].iov_base, iov[j].iov_len);
+        len += iov[j].iov_len;
+      }
+      if(ntohl(frame_len)!=len) return 1;
     }
 
     while(pkt_len[0]==0 && tpdkg_peer_not_done(&peers[1])) {
-      for(uint8_t i=0;i<n;i++) {
+      for(uint16_t i=0;i<n;i++) {
         // 0sized vla meh
         const size_t peer_out_size = tpdkg_peer_output_size(&peers[i]);
         uint8_t peers_out_buf[peer_out_size==0?1:peer_out_size], *peers_out;
@@ -534,7 +616,7 @@ int main(const int argc, const char **argv) {
 
         if(0!=ret) {
           // clean up peers
-          for(uint8_t i=0;i<n;i++) tpdkg_peer_free(&peers[i]);
+          for(uint16_t i=0;i<n;i++) tpdkg_peer_free(&peers[i]);
           return ret;
         }
 
@@ -544,24 +626,30 @@ int main(const int argc, const char **argv) {
   }
 
   // we are done. let's check the shares...
-  TOPRF_Share shares[n];
+  TOPRF_WideShare shares[n];
   if(tp.cheater_len == 0) {
-    for(uint8_t i=0;i<n;i++) {
-      memcpy(&shares[i], (uint8_t*) &peers[i].share, sizeof(TOPRF_Share));
-      dump((uint8_t*) &shares[i], sizeof(TOPRF_Share), "share[%d]", i+1);
+    for(uint16_t i=0;i<n;i++) {
+      memcpy(&shares[i], (uint8_t*) &peers[i].share, sizeof(TOPRF_WideShare));
+      dump((uint8_t*) &shares[i], sizeof(TOPRF_WideShare), "share[%d]", i+1);
     }
 
     if(0!=verify_shares(n, shares, t)) {
         fprintf(stderr, "verify_shares failed\n");
         return 1;
     }
+#ifdef TPDKG_METRICS
+    if(0!=check_metrics(n, flags, &tp_metrics, &peer_metrics)) {
+        fprintf(stderr, "unexpected metrics\n");
+        return 1;
+    }
+#endif
   } else {
     int total_cheaters=0;
     uint8_t tmp[n+1];
     memset(tmp,0,n+1);
     for(int i=0;i<tp.cheater_len;i++) {
       char err[tpdkg_max_err_SIZE];
-      uint8_t p = tpdkg_cheater_msg(&(*tp.cheaters)[i], err, sizeof(err));
+      uint16_t p = tpdkg_cheater_msg(&(*tp.cheaters)[i], err, sizeof(err));
       fprintf(stderr,"\e[0;31m%s\e[0m\n", err);
       if(p > n) return 1;
       if(tmp[p]==0) total_cheaters++;
@@ -577,7 +665,12 @@ int main(const int argc, const char **argv) {
   }
 
   // clean up peers
-  for(uint8_t i=0;i<n;i++) tpdkg_peer_free(&peers[i]);
+  for(uint16_t i=0;i<n;i++) tpdkg_peer_free(&peers[i]);
+#if !defined(FUZZING_BUILD_MODE_UNSAFE_FOR_PRODUCTION) && !defined(FUZZ_DUMP)
+  workerpool_free(pool);
+#endif
+  tpdkg_arena_wipe(tp_arena, tp_arena_len, 1);
+  free(tp_arena);
 
   fprintf(stderr, "\e[0;32meverything correct!\e[0m\n");
   return 0;
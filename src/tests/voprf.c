@@ -0,0 +1,198 @@
+#include <stdio.h>
+#include <string.h>
+#include "oprf.h"
+#include "toprf.h"
+#include "dkg.h"
+#include "voprf.h"
+
+extern const uint8_t *voprf_test_proof_r;
+
+// RFC 9497 appendix A.1.2, VOPRF mode, test vector 1
+static const uint8_t tv_sk[32] = {
+  0xe6, 0xf7, 0x3f, 0x34, 0x4b, 0x79, 0xb3, 0x79, 0xf1, 0xa0, 0xdd, 0x37, 0xe0, 0x7f, 0xf6, 0x2e,
+  0x38, 0xd9, 0xf7, 0x13, 0x45, 0xce, 0x62, 0xae, 0x3a, 0x9b, 0xc6, 0x0b, 0x04, 0xcc, 0xd9, 0x09};
+static const uint8_t tv_pk[32] = {
+  0xc8, 0x03, 0xe2, 0xcc, 0x6b, 0x05, 0xfc, 0x15, 0x06, 0x45, 0x49, 0xb5, 0x92, 0x06, 0x59, 0xca,
+  0x4a, 0x77, 0xb2, 0xcc, 0xa6, 0xf0, 0x4f, 0x6b, 0x35, 0x70, 0x09, 0x33, 0x54, 0x76, 0xad, 0x4e};
+static const uint8_t tv_blinded[1][32] = {{
+  0x86, 0x3f, 0x33, 0x0c, 0xc1, 0xa1, 0x25, 0x9e, 0xd5, 0xa5, 0x99, 0x8a, 0x23, 0xac, 0xfd, 0x37,
+  0xfb, 0x43, 0x51, 0xa7, 0x93, 0xa5, 0xb3, 0xc0, 0x90, 0xb6, 0x42, 0xdd, 0xc4, 0x39, 0xb9, 0x45}};
+static const uint8_t tv_evaluated[32] = {
+  0xaa, 0x8f, 0xa0, 0x48, 0x76, 0x4d, 0x56, 0x23, 0x86, 0x86, 0x79, 0x40, 0x2f, 0xf6, 0x10, 0x8d,
+  0x25, 0x21, 0x88, 0x4f, 0xa1, 0x38, 0xcd, 0x7f, 0x9c, 0x76, 0x69, 0xa9, 0xa0, 0x14, 0x26, 0x7e};
+static const uint8_t tv_r[32] = {
+  0x22, 0x2a, 0x5e, 0x89, 0x7c, 0xf5, 0x9d, 0xb8, 0x14, 0x5d, 0xb8, 0xd1, 0x6e, 0x59, 0x7e, 0x8f,
+  0xac, 0xb8, 0x0a, 0xe7, 0xd4, 0xe2, 0x6d, 0x98, 0x81, 0xaa, 0x6f, 0x61, 0xd6, 0x45, 0xfc, 0x0e};
+static const uint8_t tv_proof[VOPRF_PROOF_BYTES] = {
+  0xdd, 0xef, 0x93, 0x77, 0x26, 0x92, 0xe5, 0x35, 0xd1, 0xa5, 0x39, 0x03, 0xdb, 0x24, 0x36, 0x73,
+  0x55, 0xcc, 0x2c, 0xc7, 0x8d, 0xe9, 0x3b, 0x3b, 0xe5, 0xa8, 0xff, 0xcc, 0x69, 0x85, 0xdd, 0x06,
+  0x6d, 0x43, 0x46, 0x42, 0x1d, 0x17, 0xbf, 0x51, 0x17, 0xa2, 0xa1, 0xff, 0x0f, 0xcb, 0x2a, 0x75,
+  0x9f, 0x58, 0xa5, 0x39, 0xdf, 0xbe, 0x85, 0x7a, 0x40, 0xbc, 0xe4, 0xcf, 0x49, 0xec, 0x60, 0x0d};
+
+static int test_vector(void) {
+  uint8_t pk[32], Z[1][32], proof[VOPRF_PROOF_BYTES];
+  if(voprf_PublicKey(tv_sk, pk) || memcmp(pk, tv_pk, sizeof pk)!=0) return 1;
+  voprf_test_proof_r = tv_r;
+  const int ret = voprf_EvaluateBatch(tv_sk, 1, tv_blinded, Z, proof);
+  voprf_test_proof_r = NULL;
+  if(ret) return 1;
+  if(memcmp(Z[0], tv_evaluated, sizeof tv_evaluated)!=0) return 1;
+  if(memcmp(proof, tv_proof, sizeof proof)!=0) return 1;
+  if(voprf_VerifyProof(tv_pk, 1, tv_blinded, (const uint8_t (*)[32]) Z, tv_proof)!=0) return 1;
+  return 0;
+}
+
+static int test_batch(void) {
+  enum { n=100 };
+  uint8_t k[32], pk[32], r[32], blinded[n][32], Z[n][32], proof[VOPRF_PROOF_BYTES];
+  oprf_KeyGen(k);
+  if(voprf_PublicKey(k, pk)) return 1;
+  for(unsigned i=0;i<n;i++) {
+    if(oprf_Blind((const uint8_t*) &i, sizeof i, r, blinded[i])) return 1;
+  }
+  if(voprf_EvaluateBatch(k, n, (const uint8_t (*)[32]) blinded, Z, proof)) return 1;
+  if(voprf_VerifyProof(pk, n, (const uint8_t (*)[32]) blinded, (const uint8_t (*)[32]) Z, proof)!=0) return 1;
+
+  // a single wrong evaluation fails the whole batch
+  uint8_t saved[32];
+  memcpy(saved, Z[n/2], sizeof saved);
+  memcpy(Z[n/2], Z[0], sizeof saved);
+  if(voprf_VerifyProof(pk, n, (const uint8_t (*)[32]) blinded, (const uint8_t (*)[32]) Z, proof)!=1) return 1;
+  memcpy(Z[n/2], saved, sizeof saved);
+
+  // so does another key
+  uint8_t other[32];
+  oprf_KeyGen(other);
+  if(voprf_PublicKey(other, other)) return 1;
+  if(voprf_VerifyProof(other, n, (const uint8_t (*)[32]) blinded, (const uint8_t (*)[32]) Z, proof)!=1) return 1;
+
+  // and a non-canonical scalar in the proof
+  proof[VOPRF_PROOF_BYTES-1] |= 0x80;
+  if(voprf_VerifyProof(pk, n, (const uint8_t (*)[32]) blinded, (const uint8_t (*)[32]) Z, proof)!=1) return 1;
+  return 0;
+}
+
+static int test_threshold(void) {
+  enum { n=5, threshold=3, batch=16 };
+  uint8_t commitments[n][threshold][crypto_core_ristretto255_BYTES];
+  TOPRF_Share dealt[n][n], received[n], shares[n];
+  for(int i=0;i<n;i++) {
+    if(dkg_start(n, threshold, commitments[i], dealt[i])) return 1;
+  }
+  for(int i=0;i<n;i++) {
+    for(int j=0;j<n;j++) memcpy(&received[j], &dealt[j][i], sizeof(TOPRF_Share));
+    shares[i].index = (uint8_t) (i+1);
+    dkg_finish(n, received, (uint8_t) (i+1), &shares[i]);
+  }
+
+  // the public shares follow from the commitments alone
+  uint8_t pks[n][crypto_core_ristretto255_BYTES];
+  for(int i=0;i<n;i++) {
+    uint8_t expected[crypto_core_ristretto255_BYTES];
+    if(dkg_public_share(n, threshold, (uint8_t) (i+1), commitments, pks[i])) return 1;
+    if(voprf_PublicKey(shares[i].value, expected)) return 1;
+    if(memcmp(expected, pks[i], sizeof expected)!=0) {
+      fprintf(stderr, "\e[0;31mpublic share %d does not match the share\e[0m\n", i+1);
+      return 1;
+    }
+  }
+
+  uint8_t r[batch][32], blinded[batch][32];
+  for(unsigned i=0;i<batch;i++) {
+    if(oprf_Blind((const uint8_t*) &i, sizeof i, r[i], blinded[i])) return 1;
+  }
+
+  uint8_t parts[n][batch][TOPRF_Part_BYTES], proofs[n][VOPRF_PROOF_BYTES];
+  for(int i=0;i<n;i++) {
+    if(toprf_voprf_EvaluateBatch((const uint8_t*) &shares[i], batch, (const uint8_t (*)[32]) blinded,
+                                 parts[i], proofs[i])) return 1;
+  }
+  // the second shareholder answers with the parts of the first element only
+  for(int j=1;j<batch;j++) memcpy(parts[1][j]+1, parts[1][0]+1, crypto_core_ristretto255_BYTES);
+
+  // the client keeps the first threshold correct answers
+  uint8_t ok[threshold][batch][TOPRF_Part_BYTES];
+  int good=0;
+  for(int i=0;i<n && good<threshold;i++) {
+    const int ret = toprf_voprf_VerifyBatch(pks[i], (uint8_t) (i+1), batch, (const uint8_t (*)[32]) blinded,
+                                            (const uint8_t (*)[TOPRF_Part_BYTES]) parts[i], proofs[i]);
+    if(ret==-1) return 1;
+    if((ret==0) != (i!=1)) {
+      fprintf(stderr, "\e[0;31mverification of shareholder %d returned %d\e[0m\n", i+1, ret);
+      return 1;
+    }
+    if(ret==0) memcpy(ok[good++], parts[i], sizeof ok[0]);
+  }
+  if(good!=threshold) return 1;
+
+  uint8_t x[crypto_core_ristretto255_SCALARBYTES];
+  dkg_reconstruct(n, shares, x);
+  uint8_t expected[batch][32];
+  for(int j=0;j<batch;j++) {
+    uint8_t responses[threshold][TOPRF_Part_BYTES], Z[32];
+    for(int i=0;i<threshold;i++) memcpy(responses[i], ok[i][j], TOPRF_Part_BYTES);
+    if(toprf_thresholdmult(threshold, (const uint8_t (*)[TOPRF_Part_BYTES]) responses, Z)) return 1;
+    if(oprf_Evaluate(x, blinded[j], expected[j])) return 1;
+    if(memcmp(Z, expected[j], sizeof Z)!=0) {
+      fprintf(stderr, "\e[0;31mcombined parts of element %d are wrong\e[0m\n", j);
+      return 1;
+    }
+  }
+
+  // the robust combine does the same in one call
+  const uint8_t indexes[n]={1,2,3,4,5};
+  uint8_t result[batch][32], bad[n];
+  if(toprf_voprf_thresholdmult(n, threshold, batch, (const uint8_t (*)[32]) blinded,
+                               (const uint8_t (*)[32]) pks, indexes, (const uint8_t (*)[batch][TOPRF_Part_BYTES]) parts,
+                               (const uint8_t (*)[VOPRF_PROOF_BYTES]) proofs, result, bad)) return 1;
+  if(memcmp(result, expected, sizeof result)!=0) return 1;
+  const uint8_t expected_bad[n]={0,1,0,0,0};
+  if(memcmp(bad, expected_bad, sizeof bad)!=0) return 1;
+
+  // a shareholder claiming the index of another one with a valid
+  // proof for its own key is caught, and so is a repeated shareholder
+  uint8_t claimed[n][batch][TOPRF_Part_BYTES], claimed_pks[n][32], claimed_proofs[n][VOPRF_PROOF_BYTES];
+  const uint8_t order[n]={0,2,0,3,4}, claimed_indexes[n]={1,3,1,4,5};
+  for(int i=0;i<n;i++) {
+    memcpy(claimed[i], parts[order[i]], sizeof claimed[i]);
+    memcpy(claimed_pks[i], pks[order[i]], sizeof claimed_pks[i]);
+    memcpy(claimed_proofs[i], proofs[order[i]], sizeof claimed_proofs[i]);
+  }
+  for(int j=0;j<batch;j++) claimed[1][j][0]=5;
+  if(toprf_voprf_thresholdmult(n, threshold, batch, (const uint8_t (*)[32]) blinded,
+                               (const uint8_t (*)[32]) claimed_pks, claimed_indexes,
+                               (const uint8_t (*)[batch][TOPRF_Part_BYTES]) claimed,
+                               (const uint8_t (*)[VOPRF_PROOF_BYTES]) claimed_proofs, result, bad)) return 1;
+  if(memcmp(result, expected, sizeof result)!=0) return 1;
+  const uint8_t expected_bad1[n]={0,1,1,0,0};
+  if(memcmp(bad, expected_bad1, sizeof bad)!=0) return 1;
+
+  // and fails if less than threshold shareholders are correct
+  uint8_t tmp[VOPRF_PROOF_BYTES];
+  memcpy(tmp, proofs[2], sizeof tmp);
+  memcpy(proofs[2], proofs[3], sizeof tmp);
+  memcpy(proofs[3], tmp, sizeof tmp);
+  if(toprf_voprf_thresholdmult(n, threshold, batch, (const uint8_t (*)[32]) blinded,
+                               (const uint8_t (*)[32]) pks, indexes, (const uint8_t (*)[batch][TOPRF_Part_BYTES]) parts,
+                               (const uint8_t (*)[VOPRF_PROOF_BYTES]) proofs, result, bad)!=1) return 1;
+  const uint8_t expected_bad2[n]={0,1,1,1,0};
+  if(memcmp(bad, expected_bad2, sizeof bad)!=0) return 1;
+  return 0;
+}
+
+int main(void) {
+  if(test_vector()) {
+    fprintf(stderr, "\e[0;31mRFC 9497 test vector failed\e[0m\n");
+    return 1;
+  }
+  if(test_batch()) {
+    fprintf(stderr, "\e[0;31mbatch proofs failed\e[0m\n");
+    return 1;
+  }
+  if(test_threshold()) {
+    fprintf(stderr, "\e[0;31mthreshold proofs failed\e[0m\n");
+    return 1;
+  }
+  fprintf(stderr, "\e[0;32meverything correct!\e[0m\n");
+  return 0;
+}
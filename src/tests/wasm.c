@@ -0,0 +1,82 @@
+#include <stdio.h>
+#include <string.h>
+#include "oprf.h"
+#include "toprf.h"
+#include "wasm.h"
+
+// the flat batch functions of liboprf.js give the same results as the
+// functions they wrap, more than OPRF_WASM_CHUNK elements are split
+enum { n = OPRF_WASM_CHUNK + 7 };
+
+static int test_oprf(void) {
+  uint8_t x[n * 40];
+  uint16_t x_len[n];
+  const uint8_t *xs[n];
+  size_t off = 0;
+  for(unsigned i=0;i<n;i++) {
+    x_len[i] = (uint16_t) (i % 40);
+    xs[i] = x + off;
+    randombytes_buf(x + off, x_len[i]);
+    off += x_len[i];
+  }
+  uint8_t k[crypto_core_ristretto255_SCALARBYTES];
+  oprf_KeyGen(k);
+
+  uint8_t r[n][crypto_core_ristretto255_SCALARBYTES], blinded[n][crypto_core_ristretto255_BYTES];
+  if(oprf_wasm_BlindBatch(n, x, x_len, r, blinded)) return 1;
+  uint8_t Z[n][crypto_core_ristretto255_BYTES], N[n][crypto_core_ristretto255_BYTES], fails[n];
+  for(unsigned i=0;i<n;i++) {
+    if(oprf_Evaluate(k, blinded[i], Z[i])) return 1;
+  }
+  if(oprf_UnblindBatch(n, (const uint8_t (*)[32]) r, (const uint8_t (*)[32]) Z, N, fails)) return 1;
+  uint8_t rwd[n][OPRF_BYTES];
+  if(oprf_wasm_FinalizeBatch(n, x, x_len, (const uint8_t (*)[32]) N, rwd)) return 1;
+
+  for(unsigned i=0;i<n;i++) {
+    uint8_t r2[crypto_core_ristretto255_SCALARBYTES], alpha[crypto_core_ristretto255_BYTES];
+    uint8_t beta[crypto_core_ristretto255_BYTES], N2[crypto_core_ristretto255_BYTES], y[OPRF_BYTES];
+    if(oprf_Blind(xs[i], (uint8_t) x_len[i], r2, alpha)) return 1;
+    if(oprf_Evaluate(k, alpha, beta)) return 1;
+    if(oprf_Unblind(r2, beta, N2)) return 1;
+    if(oprf_Finalize(xs[i], x_len[i], N2, y)) return 1;
+    if(memcmp(y, rwd[i], sizeof y)!=0) return 1;
+  }
+  return 0;
+}
+
+static int test_combine(void) {
+  enum { peers=5, threshold=3 };
+  uint8_t k[crypto_core_ristretto255_SCALARBYTES], shares[peers][TOPRF_Share_BYTES];
+  oprf_KeyGen(k);
+  toprf_create_shares(k, peers, threshold, shares);
+
+  uint8_t P[n][crypto_core_ristretto255_BYTES], expected[n][crypto_core_ristretto255_BYTES];
+  uint8_t parts[threshold][n][TOPRF_Part_BYTES];
+  for(unsigned j=0;j<n;j++) {
+    crypto_core_ristretto255_random(P[j]);
+    if(oprf_Evaluate(k, P[j], expected[j])) return 1;
+    // the shareholders 2, 4 and 5 answer
+    const int answering[threshold] = {1, 3, 4};
+    for(int i=0;i<threshold;i++) {
+      parts[i][j][0] = shares[answering[i]][0];
+      if(crypto_scalarmult_ristretto255(parts[i][j]+1, shares[answering[i]]+1, P[j])) return 1;
+    }
+  }
+  uint8_t result[n][crypto_scalarmult_ristretto255_BYTES];
+  if(toprf_wasm_thresholdmult_batch(n, threshold, (const uint8_t (*)[n][TOPRF_Part_BYTES]) parts, result)) return 1;
+  if(memcmp(result, expected, sizeof result)!=0) return 1;
+
+  // all parts of a shareholder must have the same index
+  parts[1][n-1][0] = 1;
+  if(toprf_wasm_thresholdmult_batch(n, threshold, (const uint8_t (*)[n][TOPRF_Part_BYTES]) parts, result)!=1) return 1;
+  return 0;
+}
+
+int main(void) {
+  if(test_oprf() || test_combine()) {
+    fprintf(stderr, "\e[0;31mthe wasm batch functions failed\e[0m\n");
+    return 1;
+  }
+  fprintf(stderr, "\e[0;32meverything correct!\e[0m\n");
+  return 0;
+}
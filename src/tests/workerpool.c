@@ -0,0 +1,66 @@
+#include <stdio.h>
+#include <string.h>
+#include <pthread.h>
+#include "workerpool.h"
+
+#define JOBS 64
+#define CALLERS 4
+
+typedef struct {
+  WorkerPool *pool;
+  unsigned char done[JOBS];
+  int nested;
+} Batch;
+
+static void inner_job(void *arg, const size_t job) {
+  Batch *b = (Batch*) arg;
+  b->done[job]++;
+}
+
+static void outer_job(void *arg, const size_t job) {
+  Batch *b = (Batch*) arg;
+  b->done[job]++;
+  // a run on the same pool from within one of its jobs
+  if(b->nested && job==0) {
+    Batch inner = { .pool = b->pool };
+    workerpool_run(b->pool, JOBS, inner_job, &inner);
+    for(size_t i=0;i<JOBS;i++) {
+      if(inner.done[i]!=1) b->done[0] = 0xff;
+    }
+  }
+}
+
+static void *caller(void *arg) {
+  Batch *b = (Batch*) arg;
+  for(int i=0;i<100;i++) workerpool_run(b->pool, JOBS, outer_job, b);
+  return NULL;
+}
+
+int main(void) {
+  WorkerPool *pool = workerpool_new(3);
+  if(pool==NULL) return 1;
+
+  // batches of concurrent callers on one pool must not mix, every job
+  // runs exactly once per batch
+  Batch batches[CALLERS];
+  pthread_t tids[CALLERS];
+  for(int i=0;i<CALLERS;i++) {
+    memset(&batches[i], 0, sizeof batches[i]);
+    batches[i].pool = pool;
+    batches[i].nested = (i==0);
+    if(pthread_create(&tids[i], NULL, caller, &batches[i])) return 1;
+  }
+  for(int i=0;i<CALLERS;i++) pthread_join(tids[i], NULL);
+  for(int i=0;i<CALLERS;i++) {
+    for(size_t j=0;j<JOBS;j++) {
+      if(batches[i].done[j]!=100) {
+        fprintf(stderr, "\e[0;31mjob %zu of caller %d ran %d times\e[0m\n", j, i, batches[i].done[j]);
+        return 1;
+      }
+    }
+  }
+  workerpool_free(pool);
+
+  fprintf(stderr, "\e[0;32meverything correct!\e[0m\n");
+  return 0;
+}
@@ -1,6 +1,10 @@
+#include <stdlib.h>
 #include <string.h>
 #include "oprf.h"
 #include "toprf.h"
+#include "ristretto255.h"
+#include "shapes.h"
+#include "soa.h"
 
 /*
     @copyright 2023, Stefan Marsiske toprf@ctrlc.hu
@@ -52,6 +56,16 @@ typedef struct {
   uint8_t value[crypto_core_ristretto255_BYTES];
 } __attribute((packed)) TOPRF_Part;
 
+typedef struct {
+  uint16_t index;
+  uint8_t value[crypto_core_ristretto255_SCALARBYTES];
+} __attribute((packed)) TOPRF_WideShare;
+
+typedef struct {
+  uint16_t index;
+  uint8_t value[crypto_core_ristretto255_BYTES];
+} __attribute((packed)) TOPRF_WidePart;
+
 void coeff(const uint8_t index, const size_t peers_len, const uint8_t peers[peers_len], uint8_t result[crypto_scalarmult_ristretto255_SCALARBYTES]) {
 
   uint8_t iscalar[crypto_scalarmult_ristretto255_SCALARBYTES]={0};
@@ -77,81 +91,539 @@ void coeff(const uint8_t index, const size_t peers_len, const uint8_t peers[peer
   crypto_core_ristretto255_scalar_mul(result, divisor, divident);
 }
 
-void toprf_create_shares(const uint8_t secret[crypto_core_ristretto255_SCALARBYTES],
+static void small_scalar(uint8_t s[crypto_scalarmult_ristretto255_SCALARBYTES], uint64_t v) {
+  memset(s, 0, crypto_scalarmult_ristretto255_SCALARBYTES);
+  for(unsigned i=0;i<8;i++) {
+    s[i] = (uint8_t) (v >> (8*i));
+  }
+}
+
+// prod *= x, where x are small integers collected in a uint64_t
+// before being multiplied as a scalar, this saves most of the scalar
+// multiplications.
+typedef struct {
+  uint8_t prod[crypto_scalarmult_ristretto255_SCALARBYTES];
+  uint64_t acc;
+} smallprod;
+
+static void smallprod_init(smallprod *p) {
+  small_scalar(p->prod, 1);
+  p->acc = 1;
+}
+
+static void smallprod_mul(smallprod *p, const uint16_t x) {
+  // 8 bit factors fit into acc until it has more than 56 bits, wide 16 bit ones until 48
+  if(p->acc >> (x > 0xff ? 48 : 56)) {
+    uint8_t tmp[crypto_scalarmult_ristretto255_SCALARBYTES];
+    small_scalar(tmp, p->acc);
+    crypto_core_ristretto255_scalar_mul(p->prod, p->prod, tmp);
+    p->acc = 1;
+  }
+  p->acc *= x;
+}
+
+static void smallprod_final(smallprod *p) {
+  uint8_t tmp[crypto_scalarmult_ristretto255_SCALARBYTES];
+  small_scalar(tmp, p->acc);
+  crypto_core_ristretto255_scalar_mul(p->prod, p->prod, tmp);
+  p->acc = 1;
+}
+
+// coeffs[i] *= prod(peers[j], j!=i), the products of all peers except
+// one are prefix[i] * suffix[i+1], the suffix products are kept in tmp
+static void mul_numerators(const size_t peers_len, const uint16_t peers[peers_len],
+                           uint8_t coeffs[peers_len][crypto_scalarmult_ristretto255_SCALARBYTES],
+                           uint8_t tmp[peers_len][crypto_scalarmult_ristretto255_SCALARBYTES]) {
+  uint8_t t[crypto_scalarmult_ristretto255_SCALARBYTES];
+  smallprod suffix;
+  smallprod_init(&suffix);
+  small_scalar(tmp[peers_len-1], 1);
+  for(size_t i=peers_len-1;i>0;i--) {
+    smallprod_mul(&suffix, peers[i]);
+    smallprod_final(&suffix);
+    memcpy(tmp[i-1], suffix.prod, sizeof suffix.prod);
+  }
+  smallprod prefix;
+  smallprod_init(&prefix);
+  for(size_t i=0;i<peers_len;i++) {
+    smallprod_final(&prefix);
+    crypto_core_ristretto255_scalar_mul(t, prefix.prod, tmp[i]);
+    crypto_core_ristretto255_scalar_mul(coeffs[i], coeffs[i], t);
+    smallprod_mul(&prefix, peers[i]);
+  }
+}
+
+// the lagrange coefficients of sets which cover most of the indexes
+// lo..hi, in O(hi-lo + peers_len*missing) instead of O(peers_len^2):
+//
+//   prod(peers[j]-peers[i], j!=i) = prod(k-peers[i], k=lo..hi, k!=peers[i]) / prod(k-peers[i], k missing)
+//
+// and the first product is (-1)^(peers[i]-lo) * (peers[i]-lo)! * (hi-peers[i])!,
+// so only the factorials lo..hi need to be inverted, which takes a
+// single inversion. returns -1 if the scratch space can not be allocated.
+static int coeffs_range(const size_t peers_len, const uint16_t peers[peers_len],
+                        const uint16_t lo, const uint16_t hi, const uint8_t seen[8192],
+                        uint8_t coeffs[peers_len][crypto_scalarmult_ristretto255_SCALARBYTES]) {
+  const size_t range = (size_t) (hi - lo) + 1, missing_len = range - peers_len;
+  uint8_t (*inv_fact)[crypto_scalarmult_ristretto255_SCALARBYTES] = malloc(range * crypto_scalarmult_ristretto255_SCALARBYTES);
+  uint16_t *missing = malloc((missing_len + 1) * sizeof(uint16_t));
+  if(inv_fact==NULL || missing==NULL) {
+    free(inv_fact);
+    free(missing);
+    return -1;
+  }
+  size_t m = 0;
+  for(uint32_t k=lo;k<=hi;k++) {
+    if(!(seen[k >> 3] & (1 << (k & 7)))) missing[m++] = (uint16_t) k;
+  }
+
+  // inv_fact[k] = 1/k! for k=0..range-1
+  smallprod fact;
+  smallprod_init(&fact);
+  for(uint32_t k=2;k<range;k++) smallprod_mul(&fact, (uint16_t) k);
+  smallprod_final(&fact);
+  uint8_t inv[crypto_scalarmult_ristretto255_SCALARBYTES], k_s[crypto_scalarmult_ristretto255_SCALARBYTES];
+  int ret = 1;
+  if(crypto_core_ristretto255_scalar_invert(inv, fact.prod)) goto done;
+  for(size_t k=range-1;k>0;k--) {
+    memcpy(inv_fact[k], inv, sizeof inv);
+    small_scalar(k_s, k);
+    crypto_core_ristretto255_scalar_mul(inv, inv, k_s);
+  }
+  memcpy(inv_fact[0], inv, sizeof inv);
+
+  for(size_t i=0;i<peers_len;i++) {
+    // the product over the missing indexes
+    smallprod div;
+    smallprod_init(&div);
+    int negative = (peers[i] - lo) & 1;
+    for(size_t j=0;j<missing_len;j++) {
+      if(missing[j] > peers[i]) {
+        smallprod_mul(&div, (uint16_t) (missing[j] - peers[i]));
+      } else {
+        smallprod_mul(&div, (uint16_t) (peers[i] - missing[j]));
+        negative ^= 1;
+      }
+    }
+    smallprod_final(&div);
+    crypto_core_ristretto255_scalar_mul(coeffs[i], inv_fact[peers[i] - lo], inv_fact[hi - peers[i]]);
+    crypto_core_ristretto255_scalar_mul(coeffs[i], coeffs[i], div.prod);
+    if(negative) crypto_core_ristretto255_scalar_negate(coeffs[i], coeffs[i]);
+  }
+
+  mul_numerators(peers_len, peers, coeffs, inv_fact);
+  ret = 0;
+
+done:
+  free(inv_fact);
+  free(missing);
+  return ret;
+}
+
+// the lagrange coefficients for both the 8 bit and the wide indexes
+static int coeffs16(const size_t peers_len, const uint16_t peers[peers_len],
+                    uint8_t coeffs[peers_len][crypto_scalarmult_ristretto255_SCALARBYTES]) {
+  if(peers_len==0 || peers_len>toprf_wide_MAX_PEERS) return 1;
+  uint8_t seen[8192];
+  memset(seen, 0, sizeof seen);
+  uint16_t lo = 0xffff, hi = 0;
+  for(size_t i=0;i<peers_len;i++) {
+    if(peers[i]==0) return 1;
+    if(seen[peers[i] >> 3] & (1 << (peers[i] & 7))) return 1;
+    seen[peers[i] >> 3] |= (uint8_t) (1 << (peers[i] & 7));
+    if(peers[i] < lo) lo = peers[i];
+    if(peers[i] > hi) hi = peers[i];
+  }
+
+  // dense sets, like all the shares of a backup, have a cheaper way
+  const size_t missing_len = (size_t) (hi - lo) + 1 - peers_len;
+  if(2 * ((size_t) (hi - lo) + 1) + missing_len * peers_len < peers_len * peers_len) {
+    const int ret = coeffs_range(peers_len, peers, lo, hi, seen, coeffs);
+    if(ret!=-1) return ret;
+  }
+
+  // coeff_i = prod(peers[j], j!=i) / prod(peers[j]-peers[i], j!=i)
+  // the divisors of wide sets can be too big for the stack
+  uint8_t stack_divisors[peers_len<=255?peers_len:1][crypto_scalarmult_ristretto255_SCALARBYTES];
+  uint8_t (*divisors)[crypto_scalarmult_ristretto255_SCALARBYTES] = stack_divisors;
+  if(peers_len>255) {
+    divisors = malloc(peers_len * crypto_scalarmult_ristretto255_SCALARBYTES);
+    if(divisors==NULL) return 1;
+  }
+  for(size_t i=0;i<peers_len;i++) {
+    smallprod div;
+    smallprod_init(&div);
+    int negative = 0;
+    for(size_t j=0;j<peers_len;j++) {
+      if(j==i) continue;
+      if(peers[j] > peers[i]) {
+        smallprod_mul(&div, (uint16_t) (peers[j] - peers[i]));
+      } else {
+        smallprod_mul(&div, (uint16_t) (peers[i] - peers[j]));
+        negative ^= 1;
+      }
+    }
+    smallprod_final(&div);
+    if(negative) crypto_core_ristretto255_scalar_negate(divisors[i], div.prod);
+    else memcpy(divisors[i], div.prod, sizeof div.prod);
+  }
+
+  // invert all divisors with one inversion, coeffs[i] = divisors[0]*..*divisors[i]
+  uint8_t inv[crypto_scalarmult_ristretto255_SCALARBYTES];
+  memcpy(coeffs[0], divisors[0], sizeof inv);
+  for(size_t i=1;i<peers_len;i++) {
+    crypto_core_ristretto255_scalar_mul(coeffs[i], coeffs[i-1], divisors[i]);
+  }
+  if(crypto_core_ristretto255_scalar_invert(inv, coeffs[peers_len-1])) {
+    if(divisors!=stack_divisors) free(divisors);
+    return 1;
+  }
+  for(size_t i=peers_len-1;i>0;i--) {
+    crypto_core_ristretto255_scalar_mul(coeffs[i], inv, coeffs[i-1]);
+    crypto_core_ristretto255_scalar_mul(inv, inv, divisors[i]);
+  }
+  memcpy(coeffs[0], inv, sizeof inv);
+
+  mul_numerators(peers_len, peers, coeffs, divisors);
+  if(divisors!=stack_divisors) free(divisors);
+  return 0;
+}
+
+// the lagrange coefficients of at most TOPRF_SHAPE_MAX_T peers, the
+// products of the indexes and of their differences fit into 64 bits
+// and need no scalar multiplications, see shapes.h
+static inline __attribute__((always_inline))
+int coeffs_small(const size_t peers_len, const uint8_t peers[peers_len],
+                 uint8_t coeffs[peers_len][crypto_scalarmult_ristretto255_SCALARBYTES]) {
+  uint8_t divisors[peers_len][crypto_scalarmult_ristretto255_SCALARBYTES];
+  uint64_t numerators[peers_len];
+  for(size_t i=0;i<peers_len;i++) {
+    if(peers[i]==0) return 1;
+    uint64_t num = 1, div = 1;
+    int negative = 0;
+    for(size_t j=0;j<peers_len;j++) {
+      if(j==i) continue;
+      if(peers[j]==peers[i]) return 1;
+      num *= peers[j];
+      if(peers[j] > peers[i]) {
+        div *= (uint64_t) (peers[j] - peers[i]);
+      } else {
+        div *= (uint64_t) (peers[i] - peers[j]);
+        negative ^= 1;
+      }
+    }
+    numerators[i] = num;
+    toprf_shape_scalar(divisors[i], div);
+    if(negative) crypto_core_ristretto255_scalar_negate(divisors[i], divisors[i]);
+  }
+
+  // invert all divisors with one inversion, like coeffs16()
+  uint8_t inv[crypto_scalarmult_ristretto255_SCALARBYTES];
+  memcpy(coeffs[0], divisors[0], sizeof inv);
+  for(size_t i=1;i<peers_len;i++) {
+    crypto_core_ristretto255_scalar_mul(coeffs[i], coeffs[i-1], divisors[i]);
+  }
+  if(crypto_core_ristretto255_scalar_invert(inv, coeffs[peers_len-1])) return 1;
+  for(size_t i=peers_len-1;i>0;i--) {
+    crypto_core_ristretto255_scalar_mul(coeffs[i], inv, coeffs[i-1]);
+    crypto_core_ristretto255_scalar_mul(inv, inv, divisors[i]);
+  }
+  memcpy(coeffs[0], inv, sizeof inv);
+
+  for(size_t i=0;i<peers_len;i++) {
+    uint8_t num[crypto_scalarmult_ristretto255_SCALARBYTES];
+    toprf_shape_scalar(num, numerators[i]);
+    crypto_core_ristretto255_scalar_mul(coeffs[i], coeffs[i], num);
+  }
+  return 0;
+}
+
+TOPRF_SHAPES(TOPRF_SHAPE_CHECK)
+
+#define X(N,T) \
+  static int coeffs_##N##_##T(const uint8_t peers[T], uint8_t coeffs[T][crypto_scalarmult_ristretto255_SCALARBYTES]) { \
+    return coeffs_small(T, peers, coeffs); \
+  }
+TOPRF_SHAPES(X)
+#undef X
+
+int toprf_coeffs(const size_t peers_len, const uint8_t peers[peers_len],
+                 uint8_t coeffs[peers_len][crypto_scalarmult_ristretto255_SCALARBYTES]) {
+#define X(N,T) if(peers_len==T) return coeffs_##N##_##T(peers, coeffs);
+  TOPRF_SHAPES(X)
+#undef X
+  if(peers_len==0 || peers_len>255) return 1;
+  uint16_t wide[peers_len];
+  for(size_t i=0;i<peers_len;i++) wide[i] = peers[i];
+  return coeffs16(peers_len, wide, coeffs);
+}
+
+int toprf_wide_coeffs(const size_t peers_len, const uint16_t peers[peers_len],
+                      uint8_t coeffs[peers_len][crypto_scalarmult_ristretto255_SCALARBYTES]) {
+  return coeffs16(peers_len, peers, coeffs);
+}
+
+//f(x) = a_0 + x*(a_1 + x*(a_2 + ⋯ + x*a_(t-1)))
+static inline __attribute__((always_inline))
+void polynom_eval(const uint16_t threshold,
+                         const uint8_t a[threshold][crypto_core_ristretto255_SCALARBYTES],
+                         const uint16_t i,
+                         uint8_t value[crypto_core_ristretto255_SCALARBYTES]) {
+  uint8_t x[crypto_core_ristretto255_SCALARBYTES]={0};
+  x[0]=(uint8_t) i;
+  x[1]=(uint8_t) (i >> 8);
+  memcpy(value, a[threshold-1], crypto_core_ristretto255_SCALARBYTES);
+  for(int j=threshold-2;j>=0;j--) {
+    crypto_core_ristretto255_scalar_mul(value, value, x);
+    crypto_core_ristretto255_scalar_add(value, value, a[j]);
+  }
+}
+
+static inline __attribute__((always_inline))
+void polynom_shares(const uint8_t n,
+                    const uint8_t threshold,
+                    const uint8_t a[threshold][crypto_core_ristretto255_SCALARBYTES],
+                    uint8_t _shares[n][TOPRF_Share_BYTES]) {
+  TOPRF_Share *shares= (TOPRF_Share*)_shares;
+  for(uint8_t i=1;i<=n;i++) {
+    shares[i-1].index=i;
+    polynom_eval(threshold, a, i, shares[i-1].value);
+  }
+}
+
+#define X(N,T) \
+  static void polynom_shares_##N##_##T(const uint8_t a[T][crypto_core_ristretto255_SCALARBYTES], \
+                                       uint8_t shares[N][TOPRF_Share_BYTES]) { \
+    polynom_shares(N, T, a, shares); \
+  }
+TOPRF_SHAPES(X)
+#undef X
+
+void toprf_polynom_shares(const uint8_t n,
+                          const uint8_t threshold,
+                          const uint8_t a[threshold][crypto_core_ristretto255_SCALARBYTES],
+                          uint8_t shares[n][TOPRF_Share_BYTES]) {
+#define X(N,T) if(n==N && threshold==T) { polynom_shares_##N##_##T(a, shares); return; }
+  TOPRF_SHAPES(X)
+#undef X
+  polynom_shares(n, threshold, a, shares);
+}
+
+void toprf_wide_polynom_shares(const uint16_t n,
+                               const uint16_t threshold,
+                               const uint8_t a[threshold][crypto_core_ristretto255_SCALARBYTES],
+                               uint8_t _shares[n][TOPRF_WideShare_BYTES]) {
+  TOPRF_WideShare *shares= (TOPRF_WideShare*)_shares;
+  for(uint32_t i=1;i<=n;i++) {
+    shares[i-1].index=(uint16_t) i;
+    polynom_eval(threshold, a, (uint16_t) i, shares[i-1].value);
+  }
+}
+
+static inline __attribute__((always_inline))
+void create_shares(const uint8_t secret[crypto_core_ristretto255_SCALARBYTES],
                    const uint8_t n,
                    const uint8_t threshold,
                    uint8_t _shares[n][TOPRF_Share_BYTES]) {
-  TOPRF_Share *shares= (TOPRF_Share*)_shares;
+  uint8_t a[threshold][crypto_core_ristretto255_SCALARBYTES];
+  memcpy(a[0], secret, crypto_core_ristretto255_SCALARBYTES);
+  for(uint8_t i=1;i<threshold;i++) {
+    crypto_core_ristretto255_scalar_random(a[i]);
+  }
+  polynom_shares(n, threshold, (const uint8_t (*)[crypto_core_ristretto255_SCALARBYTES]) a, _shares);
+  sodium_memzero(a, sizeof a);
+}
+
+#define X(N,T) \
+  static void create_shares_##N##_##T(const uint8_t secret[crypto_core_ristretto255_SCALARBYTES], \
+                                      uint8_t shares[N][TOPRF_Share_BYTES]) { \
+    create_shares(secret, N, T, shares); \
+  }
+TOPRF_SHAPES(X)
+#undef X
+
+void toprf_create_shares(const uint8_t secret[crypto_core_ristretto255_SCALARBYTES],
+                   const uint8_t n,
+                   const uint8_t threshold,
+                   uint8_t shares[n][TOPRF_Share_BYTES]) {
+#define X(N,T) if(n==N && threshold==T) { create_shares_##N##_##T(secret, shares); return; }
+  TOPRF_SHAPES(X)
+#undef X
+  create_shares(secret, n, threshold, shares);
+}
 
-  uint8_t a[threshold-1][crypto_core_ristretto255_SCALARBYTES];
-  uint8_t i;
-  for(i=0;i<threshold-1;i++) {
+int toprf_wide_create_shares(const uint8_t secret[crypto_core_ristretto255_SCALARBYTES],
+                             const uint16_t n,
+                             const uint16_t threshold,
+                             uint8_t shares[n][TOPRF_WideShare_BYTES]) {
+  if(n==0 || n>toprf_wide_MAX_PEERS || threshold==0 || threshold>n) return 1;
+  const size_t a_len = (size_t) threshold * crypto_core_ristretto255_SCALARBYTES;
+  uint8_t (*a)[crypto_core_ristretto255_SCALARBYTES] = malloc(a_len);
+  if(a==NULL) return 1;
+  if(0!=sodium_mlock(a,a_len)) {
+    free(a);
+    return 1;
+  }
+  memcpy(a[0], secret, crypto_core_ristretto255_SCALARBYTES);
+  for(uint16_t i=1;i<threshold;i++) {
     crypto_core_ristretto255_scalar_random(a[i]);
   }
-  for(i=1;i<=n;i++) {
-    //f(x) = a_0 + a_1*x + a_2*x^2 + a_3*x^3 + ⋯ + a_(k−1)*x^(k−1)
-    shares[i-1].index=i;
-    uint8_t x[crypto_core_ristretto255_SCALARBYTES]={0};
-    x[0]=i;
-    memcpy(shares[i-1].value, secret, crypto_core_ristretto255_SCALARBYTES);
-    for(int j=0;j<threshold-1;j++) {
-      // a_j^j
-      uint8_t tmp[crypto_core_ristretto255_SCALARBYTES];
-      crypto_core_ristretto255_scalar_mul(tmp, a[j], x);
-      for(int exp=0;exp<j;exp++) {
-        crypto_core_ristretto255_scalar_mul(tmp, tmp, x);
-      }
-      crypto_core_ristretto255_scalar_add(shares[i-1].value, shares[i-1].value, tmp);
-    }
+  toprf_wide_polynom_shares(n, threshold, (const uint8_t (*)[crypto_core_ristretto255_SCALARBYTES]) a, shares);
+  sodium_munlock(a,a_len);
+  free(a);
+  return 0;
+}
+
+// k = sum(coeff_i * share_i)
+static int reconstruct(const size_t len, const uint8_t shares[len][TOPRF_Share_BYTES],
+                       uint8_t k[crypto_core_ristretto255_SCALARBYTES]) {
+  if(len==0 || len>255) return 1;
+  uint8_t peers[len];
+  uint8_t coeffs[len][crypto_scalarmult_ristretto255_SCALARBYTES];
+  for(size_t i=0;i<len;i++) peers[i] = shares[i][0];
+  if(toprf_coeffs(len, peers, coeffs)) return 1;
+
+  uint8_t tmp[crypto_core_ristretto255_SCALARBYTES];
+  if(-1==sodium_mlock(tmp, sizeof tmp)) return 1;
+  memset(k, 0, crypto_core_ristretto255_SCALARBYTES);
+  for(size_t i=0;i<len;i++) {
+    crypto_core_ristretto255_scalar_mul(tmp, coeffs[i], shares[i]+1);
+    crypto_core_ristretto255_scalar_add(k, k, tmp);
   }
+  sodium_munlock(tmp, sizeof tmp);
+  return 0;
 }
 
-static void sort_parts(const int n, const TOPRF_Part parts[n], uint8_t indexes[n]) {
-  uint8_t arr[n];
-  for(uint8_t i=0;i<n;i++) {
-    arr[i]=parts[i].index;
-    indexes[i]=i;
+int toprf_KeyDelta(const size_t old_len, const uint8_t old_shares[old_len][TOPRF_Share_BYTES],
+                   const size_t new_len, const uint8_t new_shares[new_len][TOPRF_Share_BYTES],
+                   uint8_t delta[crypto_core_ristretto255_SCALARBYTES]) {
+  uint8_t keys[2][crypto_core_ristretto255_SCALARBYTES];
+  if(-1==sodium_mlock(keys, sizeof keys)) return 1;
+  int ret = 1;
+  if(0==reconstruct(old_len, old_shares, keys[0]) &&
+     0==reconstruct(new_len, new_shares, keys[1]) &&
+     0==oprf_KeyDelta(keys[0], keys[1], delta)) {
+    ret = 0;
   }
+  sodium_munlock(keys, sizeof keys);
+  return ret;
+}
+
+int toprf_UpdateShare(const uint8_t share[TOPRF_Share_BYTES],
+                      const uint8_t delta[crypto_core_ristretto255_SCALARBYTES],
+                      uint8_t updated[TOPRF_Share_BYTES]) {
+  if(sodium_is_zero(delta, crypto_core_ristretto255_SCALARBYTES)) return 1;
+  updated[0] = share[0];
+  crypto_core_ristretto255_scalar_mul(updated+1, share+1, delta);
+  return 0;
+}
 
-  for (uint8_t c = 1 ; c <= n - 1; c++) {
-    uint8_t d = c, t, t1;
-    while(d > 0 && arr[d] < arr[d-1]) {
-      t = arr[d];
-      t1 = indexes[d];
-      arr[d] = arr[d-1];
-      indexes[d] = indexes[d-1];
-      arr[d-1] = t;
-      indexes[d-1] = t1;
-      d--;
+// small is set by the specializations of TOPRF_SHAPES, the parts are
+// in the form of soa.h, lpoly is room for the coefficients
+static inline __attribute__((always_inline))
+int thresholdmult(const size_t response_len,
+                  const uint8_t indexes[response_len],
+                  const uint8_t values[response_len][crypto_scalarmult_ristretto255_BYTES],
+                  uint8_t lpoly[response_len][crypto_scalarmult_ristretto255_SCALARBYTES],
+                  uint8_t result[crypto_scalarmult_ristretto255_BYTES],
+                  const int small) {
+  for(size_t i=0;i<response_len;i++) {
+    // like crypto_scalarmult_ristretto255() we do not accept the identity element
+    if(sodium_is_zero(values[i], crypto_scalarmult_ristretto255_BYTES)) return 1;
+  }
+  if(small ? coeffs_small(response_len, indexes, lpoly) : toprf_coeffs(response_len, indexes, lpoly)) {
+    // duplicate or zero indexes, fall back to calculating them one by one
+    for(size_t i=0;i<response_len;i++) {
+      coeff(indexes[i], response_len, indexes, lpoly[i]);
     }
   }
+
+  // result = sum(g^{k_i}^{lpoly_i})
+  if(ristretto255_msm(result, response_len, (const uint8_t (*)[crypto_scalarmult_ristretto255_SCALARBYTES]) lpoly, values)) {
+    memset(result,0,crypto_scalarmult_ristretto255_BYTES);
+    return 1;
+  }
+  return 0;
 }
 
+// the shapes are small and of a fixed size, so they stay on the stack
+#define X(N,T) \
+  static int thresholdmult_##N##_##T(const uint8_t responses[T][TOPRF_Part_BYTES], \
+                                     uint8_t result[crypto_scalarmult_ristretto255_BYTES]) { \
+    uint8_t indexes[T]; \
+    uint8_t values[T][crypto_scalarmult_ristretto255_BYTES] TOPRF_SOA_ALIGNED; \
+    uint8_t lpoly[T][crypto_scalarmult_ristretto255_SCALARBYTES] TOPRF_SOA_ALIGNED; \
+    toprf_soa_split(T, responses[0], TOPRF_Part_BYTES, indexes, values); \
+    return thresholdmult(T, indexes, (const uint8_t (*)[crypto_scalarmult_ristretto255_BYTES]) values, lpoly, result, 1); \
+  }
+TOPRF_SHAPES(X)
+#undef X
+
 int toprf_thresholdmult(const size_t response_len,
-                        const uint8_t _responses[response_len][TOPRF_Part_BYTES],
+                        const uint8_t responses[response_len][TOPRF_Part_BYTES],
                         uint8_t result[crypto_scalarmult_ristretto255_BYTES]) {
-  const TOPRF_Part *responses=(TOPRF_Part*) _responses;
-  uint8_t lpoly[crypto_scalarmult_ristretto255_SCALARBYTES];
-  uint8_t gki[crypto_scalarmult_ristretto255_BYTES];
   memset(result,0,crypto_scalarmult_ristretto255_BYTES);
+  if(response_len==0 || response_len>255) return 1;
+#define X(N,T) if(response_len==T) return thresholdmult_##N##_##T(responses, result);
+  TOPRF_SHAPES(X)
+#undef X
 
-  uint8_t indexed_indexes[response_len];
-  if(response_len>255) return 1;
-  sort_parts((uint8_t) response_len, (TOPRF_Part*) responses, indexed_indexes);
+  // the length comes from the caller, keep it off the stack
+  uint8_t *indexes = malloc(response_len);
+  uint8_t (*values)[crypto_scalarmult_ristretto255_BYTES] = toprf_soa_alloc(response_len);
+  uint8_t (*lpoly)[crypto_scalarmult_ristretto255_SCALARBYTES] = toprf_soa_alloc(response_len);
+  int ret = 1;
+  if(indexes!=NULL && values!=NULL && lpoly!=NULL) {
+    toprf_soa_split(response_len, responses[0], TOPRF_Part_BYTES, indexes, values);
+    ret = thresholdmult(response_len, indexes, (const uint8_t (*)[crypto_scalarmult_ristretto255_BYTES]) values, lpoly, result, 0);
+  }
+  free(indexes);
+  free(values);
+  free(lpoly);
+  return ret;
+}
+
+int toprf_wide_thresholdmult(const size_t response_len,
+                             const uint8_t _responses[response_len][TOPRF_WidePart_BYTES],
+                             uint8_t result[crypto_scalarmult_ristretto255_BYTES]) {
+  memset(result,0,crypto_scalarmult_ristretto255_BYTES);
+  if(response_len==0 || response_len>toprf_wide_MAX_PEERS) return 1;
 
-  uint8_t indexes[response_len];
+  // large sets do not fit on the stack
+  uint16_t *indexes = malloc(response_len * sizeof(uint16_t));
+  uint8_t (*lpoly)[crypto_scalarmult_ristretto255_SCALARBYTES] = malloc(response_len * crypto_scalarmult_ristretto255_SCALARBYTES);
+  uint8_t (*values)[crypto_scalarmult_ristretto255_BYTES] = toprf_soa_alloc(response_len);
+  int ret = 1;
+  if(indexes==NULL || lpoly==NULL || values==NULL) goto done;
+  toprf_soa_split_wide(response_len, _responses[0], TOPRF_WidePart_BYTES, indexes, values);
   for(size_t i=0;i<response_len;i++) {
-    indexes[indexed_indexes[i]]=responses[indexed_indexes[i]].index;
+    // like crypto_scalarmult_ristretto255() we do not accept the identity element
+    if(sodium_is_zero(values[i], crypto_scalarmult_ristretto255_BYTES)) goto done;
   }
-  for(size_t i=0;i<response_len;i++) {
-    coeff(responses[indexed_indexes[i]].index, response_len, indexes, lpoly);
+  if(coeffs16(response_len, indexes, lpoly)) goto done;
 
-    // betaki = g^{k_i}^{lpoly}
-    if(crypto_scalarmult_ristretto255(gki, lpoly, responses[indexed_indexes[i]].value)) {
-      return 1;
-    }
-    crypto_core_ristretto255_add(result,result,gki);
+  // result = sum(g^{k_i}^{lpoly_i})
+  if(ristretto255_msm(result, response_len, (const uint8_t (*)[crypto_scalarmult_ristretto255_SCALARBYTES]) lpoly,
+                      (const uint8_t (*)[crypto_scalarmult_ristretto255_BYTES]) values)) {
+    memset(result,0,crypto_scalarmult_ristretto255_BYTES);
+    goto done;
   }
+  ret = 0;
+
+done:
+  free(indexes);
+  free(lpoly);
+  free(values);
+  return ret;
+}
+
+int toprf_wide_Evaluate(const uint8_t _k[TOPRF_WideShare_BYTES],
+                        const uint8_t blinded[crypto_core_ristretto255_BYTES],
+                        uint8_t _Z[TOPRF_WidePart_BYTES]) {
+  const TOPRF_WideShare *k=(const TOPRF_WideShare*) _k;
+  TOPRF_WidePart *Z=(TOPRF_WidePart*) _Z;
+  Z->index=k->index;
+  if(oprf_Evaluate(k->value, blinded, Z->value)) return 1;
   return 0;
 }
 
@@ -173,18 +645,178 @@ int toprf_Evaluate(const uint8_t _k[TOPRF_Share_BYTES],
   return 0;
 }
 
+int toprf_thresholdmult_coeffs(const size_t response_len,
+                               const uint8_t _responses[response_len][TOPRF_Part_BYTES],
+                               const uint8_t peers[response_len],
+                               const uint8_t coeffs[response_len][crypto_scalarmult_ristretto255_SCALARBYTES],
+                               uint8_t result[crypto_scalarmult_ristretto255_BYTES]) {
+  const TOPRF_Part *responses=(TOPRF_Part*) _responses;
+  memset(result,0,crypto_scalarmult_ristretto255_BYTES);
+  if(response_len>255) return 1;
+
+  // position of each index in the peers table
+  uint8_t pos[256];
+  memset(pos, 0xff, sizeof pos);
+  for(size_t i=0;i<response_len;i++) pos[peers[i]]=(uint8_t) i;
+
+  uint8_t lpoly[response_len][crypto_scalarmult_ristretto255_SCALARBYTES] TOPRF_SOA_ALIGNED;
+  uint8_t values[response_len][crypto_scalarmult_ristretto255_BYTES] TOPRF_SOA_ALIGNED;
+  for(size_t i=0;i<response_len;i++) {
+    if(pos[responses[i].index]==0xff) return 1;
+    if(sodium_is_zero(responses[i].value, crypto_scalarmult_ristretto255_BYTES)) return 1;
+    memcpy(lpoly[i], coeffs[pos[responses[i].index]], crypto_scalarmult_ristretto255_SCALARBYTES);
+    memcpy(values[i], responses[i].value, crypto_scalarmult_ristretto255_BYTES);
+  }
+
+  if(ristretto255_msm(result, response_len, lpoly, values)) {
+    memset(result,0,crypto_scalarmult_ristretto255_BYTES);
+    return 1;
+  }
+  return 0;
+}
+
+int toprf_Evaluate_coeffs(const uint8_t _k[TOPRF_Share_BYTES],
+                          const uint8_t blinded[crypto_core_ristretto255_BYTES],
+                          const uint8_t self, const uint8_t *indexes, const uint16_t index_len,
+                          const uint8_t coeffs[index_len][crypto_scalarmult_ristretto255_SCALARBYTES],
+                          uint8_t _Z[TOPRF_Part_BYTES]) {
+  uint16_t i;
+  for(i=0;i<index_len && indexes[i]!=self;i++);
+  if(i==index_len) return 1;
+
+  uint8_t kl[crypto_core_ristretto255_SCALARBYTES];
+  const TOPRF_Share *k=(TOPRF_Share*) _k;
+  if(-1==sodium_mlock(kl, sizeof kl)) return 1;
+  // kl = k * lpoly
+  crypto_core_ristretto255_scalar_mul(kl, k->value, coeffs[i]);
+
+  TOPRF_Part *Z=(TOPRF_Part*) _Z;
+  Z->index=self;
+  const int ret = oprf_Evaluate(kl, blinded, Z->value);
+  sodium_munlock(kl, sizeof kl);
+  return ret ? 1 : 0;
+}
+
+// the indexes as a bitmap
+static void index_set(const uint8_t *indexes, const uint16_t index_len, uint8_t set[32]) {
+  memset(set, 0, 32);
+  for(uint16_t i=0;i<index_len;i++) set[indexes[i] >> 3] |= (uint8_t) (1 << (indexes[i] & 7));
+}
+
+int toprf_KeyCtx_init(oprf_KeyCtx *ctx, const uint8_t share[TOPRF_Share_BYTES],
+                      const uint8_t *indexes, const uint16_t index_len) {
+  uint16_t i;
+  for(i=0;i<index_len && indexes[i]!=share[0];i++);
+  if(i==index_len) return 1;
+
+  if(0!=oprf_KeyCtx_init_share(ctx, share)) return -1;
+  uint8_t lpoly[crypto_scalarmult_ristretto255_SCALARBYTES];
+  coeff(ctx->index, index_len, indexes, lpoly);
+  // kl = k * lpoly
+  crypto_core_ristretto255_scalar_mul(ctx->kl, ctx->k, lpoly);
+  index_set(indexes, index_len, ctx->set);
+  ctx->set_len = index_len;
+  return 0;
+}
+
+int toprf_Evaluate_KeyCtx(const oprf_KeyCtx *ctx,
+                          const uint8_t blinded[crypto_core_ristretto255_BYTES],
+                          const uint8_t *indexes, const uint16_t index_len,
+                          uint8_t _Z[TOPRF_Part_BYTES]) {
+  TOPRF_Part *Z=(TOPRF_Part*) _Z;
+  Z->index=ctx->index;
+
+  if(ctx->set_len!=0 && ctx->set_len==index_len) {
+    uint8_t set[32];
+    index_set(indexes, index_len, set);
+    if(memcmp(set, ctx->set, sizeof set)==0) {
+      return oprf_Evaluate(ctx->kl, blinded, Z->value) ? 1 : 0;
+    }
+  }
+
+  uint8_t lpoly[crypto_scalarmult_ristretto255_SCALARBYTES];
+  coeff(ctx->index, index_len, indexes, lpoly);
+
+  // kl = k * lpoly
+  oprf_KeyCtx kl;
+  if(-1==sodium_mlock(&kl, sizeof kl)) return 1;
+  crypto_core_ristretto255_scalar_mul(kl.k, ctx->k, lpoly);
+  kl.index = ctx->index;
+
+  int ret = oprf_Evaluate_KeyCtx(&kl, blinded, Z->value);
+  sodium_munlock(&kl, sizeof kl);
+  return ret ? 1 : 0;
+}
+
+int toprf_EvaluateBatch(const uint8_t _k[TOPRF_Share_BYTES],
+                        const size_t n,
+                        const uint8_t blinded[n][crypto_core_ristretto255_BYTES],
+                        const uint8_t self, const uint8_t *indexes, const uint16_t index_len,
+                        uint8_t _Z[n][TOPRF_Part_BYTES],
+                        uint8_t fails[n]) {
+  uint8_t lpoly[crypto_scalarmult_ristretto255_SCALARBYTES];
+  coeff(self, index_len, indexes, lpoly);
+
+  // kl = k * lpoly, once for the whole batch
+  const TOPRF_Share *k=(TOPRF_Share*) _k;
+  oprf_KeyCtx kl;
+  if(-1==sodium_mlock(&kl, sizeof kl)) return -1;
+  crypto_core_ristretto255_scalar_mul(kl.k, k->value, lpoly);
+  kl.index = self;
+
+  int ret = 0;
+  TOPRF_Part *Z=(TOPRF_Part*) _Z;
+  for(size_t i=0;i<n;i++) {
+    Z[i].index=self;
+    fails[i] = (oprf_Evaluate_KeyCtx(&kl, blinded[i], Z[i].value) != 0);
+    if(fails[i]) {
+      memset(Z[i].value, 0, crypto_core_ristretto255_BYTES);
+      ret = 1;
+    }
+  }
+  sodium_munlock(&kl, sizeof kl);
+  return ret;
+}
+
 void toprf_thresholdcombine(const size_t response_len,
                             const uint8_t _responses[response_len][TOPRF_Part_BYTES],
                             uint8_t result[crypto_scalarmult_ristretto255_BYTES]) {
 
-  const TOPRF_Part *responses=(TOPRF_Part*) _responses;
+  const TOPRF_Part *responses=(const TOPRF_Part*) _responses;
   memset(result,0,crypto_scalarmult_ristretto255_BYTES);
 
-  uint8_t indexed_indexes[response_len];
-  //if(response_len>255) return 1;
-  sort_parts((uint8_t) response_len, (TOPRF_Part*) responses, indexed_indexes);
-
+  // the group is commutative, the sum does not depend on the order of
+  // the responses, so there is nothing to sort
   for(size_t i=0;i<response_len;i++) {
-    crypto_core_ristretto255_add(result,result,responses[indexed_indexes[i]].value);
+    crypto_core_ristretto255_add(result,result,responses[i].value);
   }
 }
+
+void toprf_combiner_init(TOPRF_Combiner *c, const uint8_t threshold, ristretto255_table tables[threshold]) {
+  c->threshold = threshold;
+  c->len = 0;
+  c->tables = tables;
+}
+
+int toprf_combiner_add(TOPRF_Combiner *c,
+                       const uint8_t _response[TOPRF_Part_BYTES],
+                       uint8_t result[crypto_scalarmult_ristretto255_BYTES]) {
+  const TOPRF_Part *response=(const TOPRF_Part*) _response;
+  if(c->len >= c->threshold) return -2;
+  if(response->index == 0) return -1;
+  for(uint8_t i=0;i<c->len;i++) {
+    if(c->indexes[i] == response->index) return -1;
+  }
+  // like toprf_thresholdmult() we do not accept the identity element
+  if(sodium_is_zero(response->value, crypto_scalarmult_ristretto255_BYTES)) return -1;
+  if(ristretto255_table_init(&c->tables[c->len], response->value)) return -1;
+  c->indexes[c->len++] = response->index;
+  if(c->len < c->threshold) return 0;
+
+  uint8_t lpoly[c->len][crypto_scalarmult_ristretto255_SCALARBYTES];
+  // the indexes are distinct and not zero
+  if(toprf_coeffs(c->len, c->indexes, lpoly)) return -1;
+  // result = sum(g^{k_i}^{lpoly_i})
+  if(ristretto255_msm_tables(result, c->len, (const uint8_t (*)[crypto_scalarmult_ristretto255_SCALARBYTES]) lpoly, c->tables)) return -1;
+  return 1;
+}
@@ -21,10 +21,20 @@
 
 #include <sodium.h>
 #include <stdint.h>
+#include "ristretto255.h"
 
 #define TOPRF_Share_BYTES (crypto_core_ristretto255_SCALARBYTES+1UL)
 #define TOPRF_Part_BYTES (crypto_core_ristretto255_BYTES+1UL)
 
+/*
+ * The wide variants of shares and parts carry a 16 bit index - in the
+ * byte order of the host - instead of a single byte, supporting up to
+ * toprf_wide_MAX_PEERS shareholders.
+ */
+#define TOPRF_WideShare_BYTES (crypto_core_ristretto255_SCALARBYTES+2UL)
+#define TOPRF_WidePart_BYTES (crypto_core_ristretto255_BYTES+2UL)
+#define toprf_wide_MAX_PEERS 65535
+
 /**
  * This function calculates a lagrange coefficient based on the index
  * and the indexes of the other contributing shareholders.
@@ -40,6 +50,58 @@
  */
 void coeff(const uint8_t index, const size_t peers_len, const uint8_t peers[peers_len], uint8_t result[crypto_scalarmult_ristretto255_SCALARBYTES]);
 
+/**
+ * This function calculates the lagrange coefficients of all the
+ * shareholders in peers at once.
+ *
+ * It needs only one scalar inversion for the whole set, instead of
+ * one per coefficient like coeff(). The coefficients only depend on
+ * the set of shareholders, so callers that often see the same set
+ * can calculate them once and use them with
+ * toprf_thresholdmult_coeffs() and toprf_Evaluate_coeffs().
+ *
+ * @param [in] peers_len - the number of shares in peers
+ *
+ * @param [in] peers - the indexes of the shares that contribute to
+ *             the reconstruction
+ *
+ * @param [out] coeffs - the lagrange coefficient for each entry in peers
+ *
+ * @return The function returns 0 if everything is correct, 1 if peers
+ *         contains duplicate or zero indexes.
+ */
+int toprf_coeffs(const size_t peers_len, const uint8_t peers[peers_len],
+                 uint8_t coeffs[peers_len][crypto_scalarmult_ristretto255_SCALARBYTES]);
+
+/**
+ * Same as toprf_coeffs() but for wide indexes, peers_len can be at
+ * most toprf_wide_MAX_PEERS.
+ */
+int toprf_wide_coeffs(const size_t peers_len, const uint16_t peers[peers_len],
+                      uint8_t coeffs[peers_len][crypto_scalarmult_ristretto255_SCALARBYTES]);
+
+/**
+ * This function evaluates the polynomial with the coefficients a at
+ * the points 1..n, this is the share generation step of both
+ * toprf_create_shares() and dkg_start().
+ *
+ * The polynomial is evaluated using Horner's method, which needs only
+ * threshold-1 scalar multiplications per share.
+ *
+ * @param [in] n - the number of shares to generate
+ *
+ * @param [in] threshold - the number of coefficients, must be at least 1
+ *
+ * @param [in] a - the coefficients of the polynomial, a[0] is the
+ *             secret being shared
+ *
+ * @param [out] shares - f(1)..f(n) together with their indexes
+ */
+void toprf_polynom_shares(const uint8_t n,
+                          const uint8_t threshold,
+                          const uint8_t a[threshold][crypto_core_ristretto255_SCALARBYTES],
+                          uint8_t shares[n][TOPRF_Share_BYTES]);
+
 /**
  * This function creates shares of secret in a (threshold, n) scheme
  * over the curve ristretto255
@@ -59,6 +121,63 @@ void toprf_create_shares(const uint8_t secret[crypto_core_ristretto255_SCALARBYT
                    const uint8_t threshold,
                    uint8_t shares[n][TOPRF_Share_BYTES]);
 
+/**
+ * Same as toprf_polynom_shares() but producing wide shares.
+ */
+void toprf_wide_polynom_shares(const uint16_t n,
+                               const uint16_t threshold,
+                               const uint8_t a[threshold][crypto_core_ristretto255_SCALARBYTES],
+                               uint8_t shares[n][TOPRF_WideShare_BYTES]);
+
+/**
+ * Same as toprf_create_shares() but producing n wide shares, the
+ * coefficients of the polynomial are kept in locked heap memory.
+ *
+ * @return The function returns 0 if everything is correct, 1 if n or
+ *         threshold are out of range or allocation fails.
+ */
+int toprf_wide_create_shares(const uint8_t secret[crypto_core_ristretto255_SCALARBYTES],
+                             const uint16_t n,
+                             const uint16_t threshold,
+                             uint8_t shares[n][TOPRF_WideShare_BYTES]);
+
+/**
+ * This function calculates the delta for updating HashDH outputs -
+ * see oprf_KeyDelta() - between two threshold-shared keys, for example
+ * when the new key is the result of a new DKG. Both keys are
+ * reconstructed in locked memory, so whoever runs this learns them;
+ * if that is not acceptable, use toprf_UpdateShare() instead.
+ *
+ * @param [in] old_len - the number of shares of the old key, at least
+ *             the threshold of that key
+ * @param [in] old_shares - shares of the old key
+ * @param [in] new_len - the number of shares of the new key, at least
+ *             the threshold of that key
+ * @param [in] new_shares - shares of the new key
+ * @param [out] delta - the update delta
+ * @return The function returns 0 if everything is correct.
+ */
+int toprf_KeyDelta(const size_t old_len, const uint8_t old_shares[old_len][TOPRF_Share_BYTES],
+                   const size_t new_len, const uint8_t new_shares[new_len][TOPRF_Share_BYTES],
+                   uint8_t delta[crypto_core_ristretto255_SCALARBYTES]);
+
+/**
+ * This function rotates a threshold-shared key without anyone
+ * learning it: a random delta is chosen and published, for example
+ * using crypto_core_ristretto255_scalar_random(), and every
+ * shareholder updates its own share with it. The new shares are
+ * shares of delta * k, and the stored HashDH outputs can be updated
+ * with the same delta using oprf_ApplyDelta() or oprf_ApplyDeltaBatch().
+ *
+ * @param [in] share - the share of the old key
+ * @param [in] delta - the update delta, must not be zero
+ * @param [out] updated - the share of the new key, can be the same as share
+ * @return The function returns 0 if everything is correct.
+ */
+int toprf_UpdateShare(const uint8_t share[TOPRF_Share_BYTES],
+                      const uint8_t delta[crypto_core_ristretto255_SCALARBYTES],
+                      uint8_t updated[TOPRF_Share_BYTES]);
+
 /**
  * This function recovers the secret in the exponent using lagrange interpolation
  * over the curve ristretto255
@@ -74,12 +193,53 @@ void toprf_create_shares(const uint8_t secret[crypto_core_ristretto255_SCALARBYT
  *
  * @param [out] result - the reconstructed value of P multipled by k
  *
- * @return The function returns 0 if everything is correct.
+ * @return The function returns 0 if everything is correct, 1 if there
+ *         are no or more than 255 responses, a response is invalid
+ *         or allocation fails.
  */
 int toprf_thresholdmult(const size_t response_len,
                         const uint8_t responses[response_len][TOPRF_Part_BYTES],
                         uint8_t result[crypto_scalarmult_ristretto255_BYTES]);
 
+/**
+ * Same as toprf_thresholdmult() but for parts with wide indexes.
+ *
+ * The parts are combined with a single multi-scalar multiplication
+ * instead of one scalar multiplication per part, the buffers needed
+ * are allocated on the heap.
+ *
+ * @return The function returns 0 if everything is correct, 1 if the
+ *         indexes are not valid, a part is the identity element or
+ *         allocation fails.
+ */
+int toprf_wide_thresholdmult(const size_t response_len,
+                             const uint8_t responses[response_len][TOPRF_WidePart_BYTES],
+                             uint8_t result[crypto_scalarmult_ristretto255_BYTES]);
+
+/**
+ * Same as toprf_thresholdmult() but uses lagrange coefficients
+ * precomputed by toprf_coeffs().
+ *
+ * @param [in] responses - is an array of shares (k_i) multiplied by a
+ *        point (P) on the r255 curve
+ *
+ * @param [in] responses_len - the number of elements in the response array
+ *
+ * @param [in] peers - the indexes passed to toprf_coeffs(), the
+ *        responses can be in any order, but must have the same indexes
+ *
+ * @param [in] coeffs - the output of toprf_coeffs()
+ *
+ * @param [out] result - the reconstructed value of P multipled by k
+ *
+ * @return The function returns 0 if everything is correct.
+ */
+int toprf_thresholdmult_coeffs(const size_t response_len,
+                               const uint8_t responses[response_len][TOPRF_Part_BYTES],
+                               const uint8_t peers[response_len],
+                               const uint8_t coeffs[response_len][crypto_scalarmult_ristretto255_SCALARBYTES],
+                               uint8_t result[crypto_scalarmult_ristretto255_BYTES]);
+
 /**
  * This function is the efficient threshold version of oprf_Evaluate.
  *
@@ -111,10 +271,138 @@ int toprf_Evaluate(const uint8_t k[TOPRF_Share_BYTES],
                    const uint8_t self, const uint8_t *indexes, const uint16_t index_len,
                    uint8_t Z[TOPRF_Part_BYTES]);
 
+/**
+ * Same as toprf_Evaluate() but uses lagrange coefficients precomputed
+ * by toprf_coeffs(), which saves the scalar inversion. Unlike
+ * toprf_Evaluate() this also sets the index of the share in Z.
+ *
+ * Servers that always answer for the same set of shareholders can go
+ * one step further and prepare their share with toprf_KeyCtx_init(),
+ * which multiplies it with the coefficient only once.
+ *
+ * @param [in] k - a share of the private key
+ *
+ * @param [in] blinded - a serialized OPRF group element, an output of
+ *         oprf_Blind
+ *
+ * @param [in] self - the index of the current shareholder
+ *
+ * @param [in] indexes - the indexes passed to toprf_coeffs()
+ *
+ * @param [in] index_len - the length of the indexes array,
+ *
+ * @param [in] coeffs - the output of toprf_coeffs()
+ *
+ * @param [out] Z - a serialized OPRF group element, a byte array of fixed length,
+ *        an input to oprf_Unblind
+ *
+ * @return The function returns 0 if everything is correct.
+ */
+int toprf_Evaluate_coeffs(const uint8_t k[TOPRF_Share_BYTES],
+                          const uint8_t blinded[crypto_core_ristretto255_BYTES],
+                          const uint8_t self, const uint8_t *indexes, const uint16_t index_len,
+                          const uint8_t coeffs[index_len][crypto_scalarmult_ristretto255_SCALARBYTES],
+                          uint8_t Z[TOPRF_Part_BYTES]);
+
+/**
+ * This function is the batch version of toprf_Evaluate(), it
+ * evaluates n blinded elements for the same set of shareholders. The
+ * lagrange coefficient and its product with the share are calculated
+ * only once for the whole batch. Like toprf_Evaluate_coeffs() this
+ * also sets the index of the share in each Z.
+ *
+ * @param [in] k - a share of the private key
+ *
+ * @param [in] n - the number of elements in the batch
+ *
+ * @param [in] blinded - an array of n serialized OPRF group elements,
+ *         outputs of oprf_Blind
+ *
+ * @param [in] self - the index of the current shareholder
+ *
+ * @param [in] indexes - the indexes of the all the shareholders
+ *        contributing to this oprf evaluation,
+ *
+ * @param [in] index_len - the length of the indexes array,
+ *
+ * @param [out] Z - an array of n parts, inputs to toprf_thresholdcombine()
+ *
+ * @param [out] fails - an array of n flags, fails[i] is set to 1 if
+ *        blinded[i] could not be evaluated, 0 otherwise
+ *
+ * @return The function returns 0 if all elements are correct, 1 if
+ *         some elements failed and -1 on errors.
+ */
+int toprf_EvaluateBatch(const uint8_t k[TOPRF_Share_BYTES],
+                        const size_t n,
+                        const uint8_t blinded[n][crypto_core_ristretto255_BYTES],
+                        const uint8_t self, const uint8_t *indexes, const uint16_t index_len,
+                        uint8_t Z[n][TOPRF_Part_BYTES],
+                        uint8_t fails[n]);
+
+typedef struct oprf_KeyCtx oprf_KeyCtx;
+
+/**
+ * This function prepares a share of a private key for repeated
+ * evaluations with toprf_Evaluate_KeyCtx() for the same set of
+ * shareholders. The share is multiplied with its lagrange coefficient
+ * for indexes once, so that each evaluation for this set is a single
+ * scalar multiplication.
+ *
+ * @param [out] ctx - the context to initialize, its memory gets
+ *        locked, release it with oprf_KeyCtx_free()
+ *
+ * @param [in] share - the share of the private key
+ *
+ * @param [in] indexes - the indexes of the all the shareholders
+ *        contributing to the evaluations, including the index of share
+ *
+ * @param [in] index_len - the length of the indexes array,
+ *
+ * @return The function returns 0 if everything is correct, 1 if the
+ *         index of share is not in indexes and -1 if the memory of
+ *         ctx can not be locked.
+ */
+int toprf_KeyCtx_init(oprf_KeyCtx *ctx, const uint8_t share[TOPRF_Share_BYTES],
+                      const uint8_t *indexes, const uint16_t index_len);
+
+/**
+ * Same as toprf_Evaluate(), but uses a share prepared with
+ * oprf_KeyCtx_init_share() or toprf_KeyCtx_init(). Unlike
+ * toprf_Evaluate() this also sets the index of the share in Z.
+ *
+ * If ctx has been prepared by toprf_KeyCtx_init() for the same set of
+ * indexes - in any order - the evaluation is a single scalar
+ * multiplication, otherwise the lagrange coefficient is calculated
+ * for each call.
+ *
+ * @param [in] ctx - the prepared share of the private key
+ *
+ * @param [in] blinded - a serialized OPRF group element, an output of
+ *         oprf_Blind
+ *
+ * @param [in] indexes - the indexes of the all the shareholders
+ *        contributing to this oprf evaluation,
+ *
+ * @param [in] index_len - the length of the indexes array,
+ *
+ * @param [out] Z - a serialized OPRF group element, a byte array of fixed length,
+ *        an input to oprf_Unblind
+ *
+ * @return The function returns 0 if everything is correct.
+ */
+int toprf_Evaluate_KeyCtx(const oprf_KeyCtx *ctx,
+                          const uint8_t blinded[crypto_core_ristretto255_BYTES],
+                          const uint8_t *indexes, const uint16_t index_len,
+                          uint8_t Z[TOPRF_Part_BYTES]);
+
 /**
  * This function is combines the results of the toprf_Evaluate()
  * function to recover the shared secret in the exponent.
  *
+ * The responses can be in any order, they are neither sorted nor
+ * copied, and there is no limit on their number.
+ *
  * @param [in] responses - is an array of shares (k_i) multiplied by a point (P) on the r255 curve
  *
  * @param [in] responses_len - the number of elements in the response array
@@ -127,6 +415,84 @@ void toprf_thresholdcombine(const size_t response_len,
                             const uint8_t _responses[response_len][TOPRF_Part_BYTES],
                             uint8_t result[crypto_scalarmult_ristretto255_BYTES]);
 
+/**
+ * A combiner for the responses of the shareholders in a threshold
+ * OPRF, which accepts the responses one by one as they arrive and
+ * combines them as soon as threshold valid ones are in, like
+ * toprf_thresholdmult() would. The client does not need to know in
+ * advance which shareholders will answer, and the decoding of each
+ * response is done when it arrives, while waiting for the others.
+ *
+ * @code
+ * ristretto255_table tables[threshold];
+ * TOPRF_Combiner c;
+ * toprf_combiner_init(&c, threshold, tables);
+ * // for each response as it arrives
+ * if(toprf_combiner_add(&c, response, result) == 1) {
+ *   // result is ready, the other responses are not needed
+ * }
+ * @endcode
+ */
+typedef struct {
+  uint8_t threshold;
+  uint8_t len;
+  uint8_t indexes[255];
+  ristretto255_table *tables;
+} TOPRF_Combiner;
+
+/**
+ * This function initializes a combiner.
+ *
+ * @param [out] c - the combiner
+ *
+ * @param [in] threshold - the number of responses to combine, must be
+ *        at least 1
+ *
+ * @param [in] tables - a buffer for threshold points, used by the
+ *        combiner until it is done or abandoned
+ */
+void toprf_combiner_init(TOPRF_Combiner *c, const uint8_t threshold, ristretto255_table tables[threshold]);
+
+/**
+ * This function adds a response to the combiner, and if it is the
+ * threshold-th valid one, it combines all of them into result.
+ *
+ * @param [in] c - the combiner
+ *
+ * @param [in] response - a share (k_i) multiplied by a point (P) on
+ *        the r255 curve, together with the index of the share
+ *
+ * @param [out] result - the reconstructed value of P multipled by k,
+ *        only written when the function returns 1
+ *
+ * @return The function returns 0 if the response has been accepted
+ *         but more are needed, 1 if result is ready, -1 if the
+ *         response is invalid - it has index 0, the same index as a
+ *         response already accepted, or it is not a valid point - and
+ *         -2 if the combiner is already done.
+ */
+int toprf_combiner_add(TOPRF_Combiner *c,
+                       const uint8_t response[TOPRF_Part_BYTES],
+                       uint8_t result[crypto_scalarmult_ristretto255_BYTES]);
+
+/**
+ * This function is the wide variant of toprf_Evaluate() used with
+ * toprf_wide_thresholdmult(), it returns the index of the share and
+ * the blinded element multiplied by the share.
+ *
+ * @param [in] k - a wide share of the server's secret key
+ *
+ * @param [in] blinded - the blinded element received from the client
+ *
+ * @param [out] Z - the index of the share and the blinded element
+ *        multiplied by it
+ *
+ * @return The function returns 0 if everything is correct.
+ */
+int toprf_wide_Evaluate(const uint8_t k[TOPRF_WideShare_BYTES],
+                        const uint8_t blinded[crypto_core_ristretto255_BYTES],
+                        uint8_t Z[TOPRF_WidePart_BYTES]);
+
 /**
  * This struct type is used as a parameter to toprf_evalproxy()
  *
@@ -144,6 +510,12 @@ typedef int (*toprf_evalcb)(const uint8_t k[crypto_core_ristretto255_SCALARBYTES
 
 typedef int (*toprf_keygencb)(uint8_t k[crypto_core_ristretto255_SCALARBYTES]);
 
+typedef int (*toprf_evalbatchcb)(const uint8_t k[crypto_core_ristretto255_SCALARBYTES],
+                                 const size_t n,
+                                 const uint8_t alpha[n][crypto_core_ristretto255_BYTES],
+                                 uint8_t beta[n][crypto_core_ristretto255_BYTES],
+                                 uint8_t fails[n]);
+
 typedef struct {
   toprf_evalcb eval;
   toprf_keygencb keygen;
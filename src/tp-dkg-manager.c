@@ -0,0 +1,274 @@
+/*
+    @copyright 2024, Stefan Marsiske toprf@ctrlc.hu
+    This file is part of liboprf.
+
+    liboprf is free software: you can redistribute it and/or
+    modify it under the terms of the GNU Lesser General Public License
+    as published by the Free Software Foundation, either version 3 of
+    the License, or (at your option) any later version.
+
+    liboprf is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Lesser General Public License for more details.
+
+    You should have received a copy of the License
+    along with liboprf. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <stdlib.h>
+#include <string.h>
+#include <arpa/inet.h> //ntohs
+#include "tp-dkg-manager.h"
+
+// the input of one peer for the next step
+typedef struct {
+  size_t size;
+  uint8_t received;
+} Peer_Input;
+
+typedef struct {
+  TP_DKG_TPState *tp;
+  // 1 while the inputs for the next step are being collected
+  int waiting;
+  uint8_t *input;
+  size_t input_len;
+  // tp->n entries
+  Peer_Input *peers;
+  uint16_t missing;
+  // the result of the step, while running it
+  uint8_t *output;
+  size_t output_len;
+  int ret;
+} Session;
+
+struct TPDKG_Manager {
+  size_t max;
+  Session *sessions;
+  // free slots in sessions
+  size_t *free;
+  size_t free_len;
+  // open addressing hash table, each item is a slot in sessions + 1, or 0 if empty
+  size_t *table;
+  size_t mask;
+};
+
+// the session ids are random, so their first bytes are a good hash
+static size_t sid_hash(const uint8_t sessionid[tpdkg_sessionid_SIZE]) {
+  size_t h;
+  memcpy(&h, sessionid, sizeof h);
+  return h;
+}
+
+// returns the position of sessionid in the hash table, or of the empty bucket where it belongs
+static size_t lookup(const TPDKG_Manager *m, const uint8_t sessionid[tpdkg_sessionid_SIZE]) {
+  size_t i = sid_hash(sessionid) & m->mask;
+  while(m->table[i]!=0) {
+    const Session *s = &m->sessions[m->table[i]-1];
+    if(memcmp(s->tp->sessionid, sessionid, tpdkg_sessionid_SIZE)==0) break;
+    i = (i+1) & m->mask;
+  }
+  return i;
+}
+
+// sets up collecting the inputs for the next step of s
+static int arm(Session *s) {
+  free(s->input);
+  s->input = NULL;
+  s->input_len = 0;
+  s->missing = 0;
+  s->waiting = 0;
+  if(!tpdkg_tp_not_done(s->tp)) return 0;
+
+  size_t sizes[s->tp->n];
+  tpdkg_tp_input_sizes(s->tp, sizes);
+  size_t total = 0;
+  for(uint16_t i=0;i<s->tp->n;i++) {
+    s->peers[i].size = sizes[i];
+    s->peers[i].received = 0;
+    total += sizes[i];
+    if(sizes[i]>0) s->missing++;
+  }
+  if(total>0) {
+    s->input = malloc(total);
+    if(s->input==NULL) return 1;
+  }
+  s->input_len = total;
+  s->waiting = 1;
+  return 0;
+}
+
+TPDKG_Manager* tpdkg_manager_new(const size_t max_sessions) {
+  if(max_sessions==0) return NULL;
+  TPDKG_Manager *m = calloc(1, sizeof(TPDKG_Manager));
+  if(m==NULL) return NULL;
+
+  size_t buckets = 1;
+  while(buckets < max_sessions * 2) buckets <<= 1;
+
+  m->max = max_sessions;
+  m->mask = buckets - 1;
+  m->sessions = calloc(max_sessions, sizeof(Session));
+  m->free = calloc(max_sessions, sizeof(size_t));
+  m->table = calloc(buckets, sizeof(size_t));
+  if(m->sessions==NULL || m->free==NULL || m->table==NULL) {
+    tpdkg_manager_free(m);
+    return NULL;
+  }
+  for(size_t i=0;i<max_sessions;i++) m->free[i] = max_sessions - 1 - i;
+  m->free_len = max_sessions;
+  return m;
+}
+
+void tpdkg_manager_free(TPDKG_Manager *m) {
+  if(m==NULL) return;
+  if(m->sessions!=NULL) {
+    for(size_t i=0;i<m->max;i++) {
+      free(m->sessions[i].input);
+      free(m->sessions[i].peers);
+    }
+  }
+  free(m->sessions);
+  free(m->free);
+  free(m->table);
+  free(m);
+}
+
+int tpdkg_manager_add(TPDKG_Manager *m, TP_DKG_TPState *tp) {
+  if(m->free_len==0) return 1;
+  const size_t pos = lookup(m, tp->sessionid);
+  if(m->table[pos]!=0) return 2;
+
+  const size_t slot = m->free[m->free_len-1];
+  Session *s = &m->sessions[slot];
+  memset(s, 0, sizeof(Session));
+  s->tp = tp;
+  s->peers = calloc(tp->n, sizeof(Peer_Input));
+  if(s->peers==NULL || 0!=arm(s)) {
+    free(s->peers);
+    memset(s, 0, sizeof(Session));
+    return 3;
+  }
+  m->free_len--;
+  m->table[pos] = slot + 1;
+  return 0;
+}
+
+int tpdkg_manager_remove(TPDKG_Manager *m, const uint8_t sessionid[tpdkg_sessionid_SIZE]) {
+  size_t i = lookup(m, sessionid);
+  if(m->table[i]==0) return 1;
+
+  const size_t slot = m->table[i] - 1;
+  free(m->sessions[slot].input);
+  free(m->sessions[slot].peers);
+  memset(&m->sessions[slot], 0, sizeof(Session));
+  m->free[m->free_len++] = slot;
+
+  // backward shift deletion, keeps the probe sequences intact without tombstones
+  m->table[i] = 0;
+  for(size_t j = (i+1) & m->mask; m->table[j]!=0; j = (j+1) & m->mask) {
+    const size_t home = sid_hash(m->sessions[m->table[j]-1].tp->sessionid) & m->mask;
+    // move the item at j into the hole at i if its home is not in (i, j]
+    if(((j - home) & m->mask) >= ((j - i) & m->mask)) {
+      m->table[i] = m->table[j];
+      m->table[j] = 0;
+      i = j;
+    }
+  }
+  return 0;
+}
+
+TP_DKG_TPState* tpdkg_manager_get(const TPDKG_Manager *m, const uint8_t sessionid[tpdkg_sessionid_SIZE]) {
+  const size_t i = lookup(m, sessionid);
+  if(m->table[i]==0) return NULL;
+  return m->sessions[m->table[i]-1].tp;
+}
+
+int tpdkg_manager_recv(TPDKG_Manager *m, const uint8_t *msg, const size_t msg_len) {
+  if(msg==NULL || msg_len < sizeof(TP_DKG_Message)) return 1;
+  const TP_DKG_Message *hdr = (const TP_DKG_Message*) msg;
+  const size_t i = lookup(m, hdr->sessionid);
+  if(m->table[i]==0) return 2;
+
+  Session *s = &m->sessions[m->table[i]-1];
+  if(!s->waiting) return 6;
+  const uint16_t from = ntohs(hdr->from);
+  if(from < 1 || from > s->tp->n) return 3;
+  const uint16_t peer = (uint16_t) (from - 1);
+  if(s->peers[peer].size != msg_len) return 4;
+  if(s->peers[peer].received) return 5;
+
+  // verifies the message now, while the other peers are still sending
+  const int ret = tpdkg_tp_feed(s->tp, peer, msg, msg_len, s->input, s->input_len);
+  if(ret!=0 && ret!=5) return 4;
+  s->peers[peer].received = 1;
+  s->missing--;
+  return ret==5 ? 7 : 0;
+}
+
+static int is_ready(const Session *s) {
+  return s->tp!=NULL && s->waiting && s->missing==0;
+}
+
+size_t tpdkg_manager_ready(const TPDKG_Manager *m, TP_DKG_TPState **ready, const size_t max) {
+  size_t ret = 0;
+  for(size_t i=0;i<m->max;i++) {
+    if(!is_ready(&m->sessions[i])) continue;
+    if(ret < max) ready[ret] = m->sessions[i].tp;
+    ret++;
+  }
+  return ret;
+}
+
+typedef struct {
+  Session **sessions;
+} Step_Batch;
+
+static void run_step(void *arg, const size_t job) {
+  Step_Batch *batch = (Step_Batch*) arg;
+  Session *s = batch->sessions[job];
+  s->ret = tpdkg_tp_next(s->tp, s->input, s->input_len, s->output, s->output_len);
+}
+
+size_t tpdkg_manager_run(TPDKG_Manager *m, const tpdkg_parallel_fn parallel, void *pool,
+                         const tpdkg_manager_output_fn cb, void *arg) {
+  Session **ready = malloc(m->max * sizeof(Session*));
+  if(ready==NULL) return 0;
+
+  size_t len = 0;
+  for(size_t i=0;i<m->max;i++) {
+    Session *s = &m->sessions[i];
+    if(!is_ready(s)) continue;
+    s->output_len = tpdkg_tp_output_size(s->tp);
+    s->output = NULL;
+    if(s->output_len > 0) {
+      s->output = malloc(s->output_len);
+      // try again on the next run
+      if(s->output==NULL) continue;
+    }
+    ready[len++] = s;
+  }
+
+  Step_Batch batch = { .sessions = ready };
+  if(parallel!=NULL && len>1) {
+    parallel(pool, len, run_step, &batch);
+  } else {
+    for(size_t i=0;i<len;i++) run_step(&batch, i);
+  }
+
+  for(size_t i=0;i<len;i++) {
+    Session *s = ready[i];
+    cb(arg, s->tp, s->ret, s->output, s->output_len);
+    free(s->output);
+    s->output = NULL;
+    if(s->ret==0) {
+      if(0!=arm(s)) s->waiting = 0;
+    } else {
+      free(s->input);
+      s->input = NULL;
+      s->waiting = 0;
+    }
+  }
+  free(ready);
+  return len;
+}
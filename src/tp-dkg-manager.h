@@ -0,0 +1,174 @@
+/*
+    @copyright 2024, Stefan Marsiske toprf@ctrlc.hu
+    This file is part of liboprf.
+
+    liboprf is free software: you can redistribute it and/or
+    modify it under the terms of the GNU Lesser General Public License
+    as published by the Free Software Foundation, either version 3 of
+    the License, or (at your option) any later version.
+
+    liboprf is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Lesser General Public License for more details.
+
+    You should have received a copy of the License
+    along with liboprf. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef TP_DKG_MANAGER_H
+#define TP_DKG_MANAGER_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include "tp-dkg.h"
+
+/**
+ * A session manager for a TP running many independent DKGs at the
+ * same time. It routes the messages of the peers to the TP state
+ * with the matching session id, collects them until a session has
+ * all the inputs for its next step, and then runs the steps of all
+ * ready sessions at once - possibly on a pool of threads.
+ *
+ * The manager itself is not thread-safe, all functions must be
+ * called from the same thread, only the steps run in parallel.
+ *
+ * A typical main loop looks like this:
+ *
+ * @code
+ * TPDKG_Manager *m = tpdkg_manager_new(512);
+ * WorkerPool *pool = workerpool_new(8);
+ * // for each new DKG: tpdkg_start_tp(), tpdkg_tp_set_arena(), then
+ * tpdkg_manager_add(m, tp);
+ *
+ * while(running) {
+ *   // for each message received from any peer of any session
+ *   tpdkg_manager_recv(m, msg, msg_len);
+ *   // runs the next step of all sessions that have all their inputs,
+ *   // on_output sends the results to the peers via tpdkg_tp_peer_msg()
+ *   tpdkg_manager_run(m, workerpool_run, pool, on_output, ctx);
+ * }
+ * @endcode
+ */
+typedef struct TPDKG_Manager TPDKG_Manager;
+
+/**
+ * Called by tpdkg_manager_run() for every session that has run a step.
+ *
+ * @param [in] arg - the arg passed to tpdkg_manager_run()
+ * @param [in] tp - the TP state of the session, already advanced to the next step
+ * @param [in] ret - the return value of tpdkg_tp_next()
+ * @param [in] output - the output of the step, to be dispatched to
+ *             the peers with tpdkg_tp_peer_msg(), only valid during
+ *             this call
+ * @param [in] output_len - the size of output
+ */
+typedef void (*tpdkg_manager_output_fn)(void *arg, TP_DKG_TPState *tp, const int ret,
+                                        const uint8_t *output, const size_t output_len);
+
+/**
+ * Creates a new session manager.
+ *
+ * @param [in] max_sessions - the maximum number of sessions managed
+ *             at the same time
+ * @return The function returns the new manager, or NULL on error.
+ */
+TPDKG_Manager* tpdkg_manager_new(const size_t max_sessions);
+
+/**
+ * Frees the manager and all messages that are still buffered, the
+ * TP states themselves belong to the caller.
+ */
+void tpdkg_manager_free(TPDKG_Manager *m);
+
+/**
+ * Adds a TP state to the manager, the state must have been started
+ * with tpdkg_start_tp() and have its buffers set. The manager keeps
+ * a pointer to tp until it is removed, and uses its session id as
+ * the key of the session.
+ *
+ * @param [in] m - the manager
+ * @param [in] tp - the TP state
+ * @return The function returns 0 if everything is correct, 1 if the
+ *         maximum number of sessions is reached, 2 if a session with
+ *         the same id is already managed, 3 if memory for the inputs
+ *         of tp cannot be allocated.
+ */
+int tpdkg_manager_add(TPDKG_Manager *m, TP_DKG_TPState *tp);
+
+/**
+ * Removes a session, for example after it finished or failed.
+ *
+ * @param [in] m - the manager
+ * @param [in] sessionid - the id of the session
+ * @return The function returns 0 if everything is correct, 1 if
+ *         there is no session with this id.
+ */
+int tpdkg_manager_remove(TPDKG_Manager *m, const uint8_t sessionid[tpdkg_sessionid_SIZE]);
+
+/**
+ * Looks up the TP state of a session.
+ *
+ * @return The function returns the TP state, or NULL if there is no
+ *         session with this id.
+ */
+TP_DKG_TPState* tpdkg_manager_get(const TPDKG_Manager *m, const uint8_t sessionid[tpdkg_sessionid_SIZE]);
+
+/**
+ * Routes the output of one peer to its session. The header of the
+ * first envelope in msg decides to which session and from which peer
+ * the message is. The message is verified and copied into the input
+ * of the next step of the session with tpdkg_tp_feed(), so the
+ * verification overlaps with waiting for the other peers.
+ *
+ * @param [in] m - the manager
+ * @param [in] msg - the complete output of a peer for the current step
+ * @param [in] msg_len - the size of msg
+ * @return The function returns 0 if everything is correct, 1 if msg
+ *         is too short, 2 if the session is unknown, 3 if the sender
+ *         is not a valid peer, 4 if msg has not the size expected
+ *         from this peer, 5 if a message from this peer has already
+ *         been received, 6 if the session does not expect any
+ *         messages, because it is finished or failed, 7 if msg failed
+ *         verification - it still counts as received, and the sender
+ *         is recorded as a cheater when the step runs.
+ */
+int tpdkg_manager_recv(TPDKG_Manager *m, const uint8_t *msg, const size_t msg_len);
+
+/**
+ * Lists the sessions which have received all the inputs for their
+ * next step.
+ *
+ * @param [in] m - the manager
+ * @param [out] ready - receives up to max TP states
+ * @param [in] max - the size of ready
+ * @return The function returns the number of ready sessions, which
+ *         can be more than max.
+ */
+size_t tpdkg_manager_ready(const TPDKG_Manager *m, TP_DKG_TPState **ready, const size_t max);
+
+/**
+ * Runs the next step of all ready sessions and calls cb for each of
+ * them with the result. The order is that of the slots of the
+ * sessions in the manager, which is not the order in which they were
+ * added once sessions have been removed and their slots reused. After
+ * a successful step the session starts collecting the inputs for the
+ * following step, after a failed one it does not accept any more
+ * messages.
+ *
+ * If parallel is not NULL the steps run in parallel via parallel and
+ * pool - workerpool_run() and a WorkerPool can be used. Do not use
+ * the same pool for tpdkg_tp_set_workers() of the managed sessions,
+ * nested runs on one pool run serially.
+ *
+ * @param [in] m - the manager
+ * @param [in] parallel - runs jobs in parallel, or NULL
+ * @param [in] pool - passed as the first parameter to parallel
+ * @param [in] cb - called with the output of each step
+ * @param [in] arg - passed as the first parameter to cb
+ * @return The function returns the number of sessions that ran a step.
+ */
+size_t tpdkg_manager_run(TPDKG_Manager *m, const tpdkg_parallel_fn parallel, void *pool,
+                         const tpdkg_manager_output_fn cb, void *arg);
+
+#endif // TP_DKG_MANAGER_H
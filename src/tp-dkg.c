@@ -10,8 +10,10 @@
 
 #include "XK.h"
 #include "dkg.h"
+#include "ristretto255.h"
 #include "tp-dkg.h"
 #include "noise_private.h"
+#include "XK_index.h"
 
 /*
     @copyright 2024, Stefan Marsiske toprf@ctrlc.hu
@@ -55,13 +57,30 @@ FILE* log_file=NULL;
 #define tpdkg_msg4_SIZE (sizeof(TP_DKG_Message) + noise_xk_handshake1_SIZE)
 #define noise_xk_handshake2_SIZE 48UL
 #define tpdkg_msg5_SIZE (sizeof(TP_DKG_Message) + noise_xk_handshake2_SIZE)
-#define tpdkg_msg6_SIZE(ctx) (sizeof(TP_DKG_Message) + (size_t)(crypto_core_ristretto255_BYTES * ctx->t) )
-#define tpdkg_msg9_SIZE(ctx) (sizeof(TP_DKG_Message) + (size_t)(ctx->n + 1) )
+// a refresh does not send the commitment to the constant term, which is the identity
+#define tpdkg_sent_commitments(ctx) ((size_t) (ctx->t - ctx->refresh))
+#define tpdkg_msg6_SIZE(ctx) (sizeof(TP_DKG_Message) + crypto_core_ristretto255_BYTES * tpdkg_sent_commitments(ctx) )
+// the number of complaints and the indexes of the accused peers, all 16 bits
+#define tpdkg_complaints_SIZE(ctx) (2 * ((size_t) ctx->n + 1))
+// in optimistic mode the complaints come with the transcript of the peer
+#define tpdkg_msg9_SIZE(ctx) (sizeof(TP_DKG_Message) + tpdkg_complaints_SIZE(ctx) + (ctx->optimistic ? crypto_generichash_BYTES : 0U) )
 #define tpdkg_msg10_SIZE(ctx) (sizeof(TP_DKG_Message) + (size_t)(ctx->n * tpdkg_msg9_SIZE(ctx)) )
 #define tpdkg_msg19_SIZE (sizeof(TP_DKG_Message) + crypto_generichash_BYTES)
 #define tpdkg_msg20_SIZE (sizeof(TP_DKG_Message) + 2)
 #define tpdkg_msg21_SIZE (sizeof(TP_DKG_Message) + 2)
 #define tpdkg_noise_key_SIZE (32UL)
+// a revealed key of msg11: the index of the complainer and the key
+#define tpdkg_key_reveal_SIZE (2 + tpdkg_noise_key_SIZE)
+
+// the 16 bit values in the message bodies are big-endian, and not aligned
+static uint16_t get16(const uint8_t *p) {
+  return (uint16_t) ((p[0] << 8) | p[1]);
+}
+
+static void put16(uint8_t *p, const uint16_t v) {
+  p[0] = (uint8_t) (v >> 8);
+  p[1] = (uint8_t) v;
+}
 
 static void dump(const uint8_t *p, const size_t len, const char* msg, ...) {
   if(log_file==NULL) return;
@@ -75,6 +94,48 @@ static void dump(const uint8_t *p, const size_t len, const char* msg, ...) {
   fprintf(log_file,"\n");
 }
 
+#ifdef TPDKG_METRICS
+// the counters of the step running on this thread, set by
+// METRICS_BEGIN() and by tp_for() on the worker threads
+static _Thread_local TP_DKG_StepMetrics *metrics_cur = NULL;
+
+#define METRIC_ADD(field, v) do { \
+    if(metrics_cur!=NULL) __atomic_fetch_add(&metrics_cur->field, (v), __ATOMIC_RELAXED); \
+  } while(0)
+
+typedef struct {
+  TP_DKG_StepMetrics *m;
+  TP_DKG_StepMetrics *saved;
+  struct timespec start;
+} Metrics_Scope;
+
+static void metrics_begin(Metrics_Scope *scope, TP_DKG_Metrics *metrics, const int step) {
+  scope->saved = metrics_cur;
+  scope->m = (metrics!=NULL && step>=0 && step<tpdkg_metrics_STEPS) ? &metrics->steps[step] : NULL;
+  metrics_cur = scope->m;
+  if(scope->m!=NULL) timespec_get(&scope->start, TIME_UTC);
+}
+
+static void metrics_end(Metrics_Scope *scope, const size_t in, const size_t out, const uint32_t calls) {
+  if(scope->m!=NULL) {
+    struct timespec now;
+    timespec_get(&now, TIME_UTC);
+    scope->m->time_ns += (uint64_t) ((now.tv_sec - scope->start.tv_sec) * 1000000000L + (now.tv_nsec - scope->start.tv_nsec));
+    scope->m->bytes_in += in;
+    scope->m->bytes_out += out;
+    scope->m->calls += calls;
+  }
+  metrics_cur = scope->saved;
+}
+
+#define METRICS_BEGIN(metrics, step) Metrics_Scope metrics_scope; metrics_begin(&metrics_scope, (metrics), (step))
+#define METRICS_END(in, out, calls) metrics_end(&metrics_scope, (in), (out), (calls))
+#else
+#define METRIC_ADD(field, v)
+#define METRICS_BEGIN(metrics, step)
+#define METRICS_END(in, out, calls)
+#endif // TPDKG_METRICS
+
 #ifndef htonll
 static uint64_t htonll(uint64_t n) {
 #if __BYTE_ORDER == __BIG_ENDIAN
@@ -95,9 +156,21 @@ static uint64_t ntohll(uint64_t n) {
 }
 #endif // ntohll
 
+static tpdkg_clock_fn clock_fn = NULL;
+
+void tpdkg_set_clock(const tpdkg_clock_fn clock) {
+  clock_fn = clock;
+}
+
+// the current time in seconds, from tpdkg_set_clock() if set
+static uint64_t now_ts(void) {
+  if(clock_fn!=NULL) return clock_fn();
+  return (uint64_t)time(NULL);
+}
+
 static int check_ts(const uint64_t ts_epsilon, uint64_t *last_ts, const uint64_t ts) {
   if(*last_ts == 0) {
-    uint64_t now = (uint64_t)time(NULL);
+    uint64_t now = now_ts();
     if(ts < now - ts_epsilon) return 3;
     if(ts > now + ts_epsilon) return 4;
   } else {
@@ -108,27 +181,31 @@ static int check_ts(const uint64_t ts_epsilon, uint64_t *last_ts, const uint64_t
   return 0;
 }
 
-static int send_msg(uint8_t* msg_buf, const size_t msg_buf_len, const uint8_t msgno, const uint8_t from, const uint8_t to, const uint8_t *sig_sk, const uint8_t sessionid[tpdkg_sessionid_SIZE]) {
+static int send_msg(uint8_t* msg_buf, const size_t msg_buf_len, const uint8_t msgno, const uint16_t from, const uint16_t to, const uint8_t *sig_sk, const uint8_t sessionid[tpdkg_sessionid_SIZE]) {
   if(msg_buf==NULL) return 1;
   TP_DKG_Message* msg = (TP_DKG_Message*) msg_buf;
   msg->len = htonl((uint32_t)msg_buf_len);
   msg->msgno = msgno;
-  msg->from = from;
-  msg->to = to;
-  msg->ts = htonll((uint64_t)time(NULL));
+  msg->from = htons(from);
+  msg->to = htons(to);
+  msg->ts = htonll(now_ts());
   memcpy(msg->sessionid, sessionid, tpdkg_sessionid_SIZE);
 
-  crypto_sign_detached(msg->sig, NULL, &msg->msgno, sizeof(TP_DKG_Message) - crypto_sign_BYTES, sig_sk);
+  // sign the header and the data in place, the header already contains the sessionid
+  crypto_sign_detached(msg->sig, NULL, &msg->msgno, msg_buf_len - crypto_sign_BYTES, sig_sk);
+  METRIC_ADD(sig_sign, 1);
   return 0;
 }
 
-static int recv_msg(const uint8_t *msg_buf, const size_t msg_buf_len, const uint8_t msgno, const uint8_t from, const uint8_t to, const uint8_t *sig_pk, const uint8_t sessionid[tpdkg_sessionid_SIZE], const uint64_t ts_epsilon, uint64_t *last_ts ) {
+// checks everything in the envelope header except for the signature
+static int check_envelope(const uint8_t *msg_buf, const size_t msg_buf_len, const uint8_t msgno, const uint16_t from, const uint16_t to, const uint8_t sessionid[tpdkg_sessionid_SIZE], const uint64_t ts_epsilon, uint64_t *last_ts) {
   if(msg_buf==NULL) return 7;
+  if(msg_buf_len < sizeof(TP_DKG_Message)) return 1;
   TP_DKG_Message* msg = (TP_DKG_Message*) msg_buf;
   if(ntohl(msg->len) != msg_buf_len) return 1;
   if(msg->msgno != msgno) return 2;
-  if(msg->from != from) return 3;
-  if(msg->to != to) return 4;
+  if(ntohs(msg->from) != from) return 3;
+  if(ntohs(msg->to) != to) return 4;
   if(sodium_memcmp(msg->sessionid, sessionid, tpdkg_sessionid_SIZE)!=0) return 7;
 
 #if !defined(FUZZING_BUILD_MODE_UNSAFE_FOR_PRODUCTION)
@@ -140,25 +217,153 @@ static int recv_msg(const uint8_t *msg_buf, const size_t msg_buf_len, const uint
     return 5;
   }
 #endif
+  return 0;
+}
+
+static int recv_msg(const uint8_t *msg_buf, const size_t msg_buf_len, const uint8_t msgno, const uint16_t from, const uint16_t to, const uint8_t *sig_pk, const uint8_t sessionid[tpdkg_sessionid_SIZE], const uint64_t ts_epsilon, uint64_t *last_ts ) {
+  int ret = check_envelope(msg_buf, msg_buf_len, msgno, from, to, sessionid, ts_epsilon, last_ts);
+  if(0!=ret) return ret;
+  TP_DKG_Message* msg = (TP_DKG_Message*) msg_buf;
+
+#if !defined(FUZZING_BUILD_MODE_UNSAFE_FOR_PRODUCTION)
+  // the sessionid is part of the header, so it is also covered by the signature
+  METRIC_ADD(sig_verify, 1);
+  if(0!=ed25519_verify(msg->sig, &msg->msgno, msg_buf_len - crypto_sign_BYTES, sig_pk)) return 6;
+#endif
+
+  return 0;
+}
+
+/* receives the n envelopes of equal size msg_len in msgs, the i-th
+ * coming from peer i+1. if sig_pks is NULL, each message is signed by
+ * the key at the start of its own payload. the signatures are checked
+ * in one batch, only if that fails are they checked one by one to
+ * find the offender. returns the same error codes as recv_msg() and
+ * sets failed to the index of the first message that was rejected. */
+static int recv_msgs(const uint8_t *msgs, const size_t msg_len, const uint16_t n, const uint8_t msgno, const uint16_t to, const uint8_t (*sig_pks)[crypto_sign_PUBLICKEYBYTES], const uint8_t sessionid[tpdkg_sessionid_SIZE], const uint64_t ts_epsilon, uint64_t *last_ts, uint16_t *failed) {
+  const uint8_t *signed_bufs[n], *sigs[n], *pks[n];
+  size_t signed_lens[n];
+  int ret = 0;
+  uint16_t i;
+  for(i=0;i<n;i++) {
+    const uint8_t *ptr = msgs + i * msg_len;
+    ret = check_envelope(ptr, msg_len, msgno, (uint16_t) (i+1), to, sessionid, ts_epsilon, &last_ts[i]);
+    if(0!=ret) break;
+    const TP_DKG_Message* msg = (const TP_DKG_Message*) ptr;
+    signed_bufs[i] = &msg->msgno;
+    signed_lens[i] = msg_len - crypto_sign_BYTES;
+    sigs[i] = msg->sig;
+    pks[i] = (sig_pks == NULL) ? msg->data : sig_pks[i];
+  }
+  *failed = i;
+
+#if !defined(FUZZING_BUILD_MODE_UNSAFE_FOR_PRODUCTION)
+  METRIC_ADD(sig_verify, i);
+  if(i>0 && 0!=ed25519_verify_batch(i, signed_bufs, signed_lens, sigs, pks)) {
+    for(uint16_t j=0;j<i;j++) {
+      METRIC_ADD(sig_verify, 1);
+      if(0!=ed25519_verify(sigs[j], signed_bufs[j], signed_lens[j], pks[j])) {
+        *failed = j;
+        return 6;
+      }
+    }
+  }
+#endif
 
-  const size_t unsigned_buf_len = msg_buf_len - crypto_sign_BYTES;
+  return ret;
+}
 
-  uint8_t with_sessionid[unsigned_buf_len + tpdkg_sessionid_SIZE];
-  memcpy(with_sessionid, msg_buf + crypto_sign_BYTES, unsigned_buf_len);
-  memcpy(with_sessionid + unsigned_buf_len, sessionid, tpdkg_sessionid_SIZE);
+/* receives a broadcast of the TP to the peers: an envelope signed by
+ * the TP around the n envelopes of inner_len bytes it collected from
+ * the peers, which are checked like by recv_msgs(). The broadcast is
+ * also added to the transcript, the same as by update_transcript(),
+ * but only if everything is correct.
+ *
+ * For large broadcasts reading the memory is the bottleneck, and the
+ * straightforward way reads it once for the signature of the TP, once
+ * for the transcript and once more for the signatures of the peers.
+ * Here every inner envelope is fed to all three hashes while it is in
+ * the cache, and the signatures are checked together in one batch.
+ *
+ * returns the same error codes as recv_msg(), inner is set to 1 if the
+ * error is with one of the inner envelopes. */
+static int peer_recv_broadcast(TP_DKG_PeerState *ctx,
+                               const uint8_t *input, const size_t input_len,
+                               const uint8_t msgno, const uint8_t inner_msgno, const size_t inner_len,
+                               const uint8_t (*sig_pks)[crypto_sign_PUBLICKEYBYTES],
+                               uint8_t *inner) {
+  *inner = 0;
+  int ret = check_envelope(input, input_len, msgno, 0, tpdkg_BROADCAST, ctx->sessionid, ctx->ts_epsilon, &ctx->tp_last_ts);
+  if(0!=ret) return ret;
+  if(input_len != sizeof(TP_DKG_Message) + ctx->n * inner_len) return 1;
+  const TP_DKG_Message* msg = (const TP_DKG_Message*) input;
+
+  // the signature of the TP comes first, those of the peers follow
+  uint8_t hrams[ctx->n + 1][crypto_core_ristretto255_SCALARBYTES];
+  const uint8_t *sigs[ctx->n + 1], *pks[ctx->n + 1];
+  crypto_hash_sha512_state outer, hs;
+  crypto_generichash_state transcript;
+  memcpy(&transcript, &ctx->transcript, sizeof transcript);
+  const uint32_t msg_size_32b = htonl((uint32_t)input_len);
+  crypto_generichash_update(&transcript, (const uint8_t*) &msg_size_32b, sizeof(msg_size_32b));
+  crypto_generichash_update(&transcript, input, sizeof(TP_DKG_Message));
+  ed25519_hram_init(&outer, msg->sig, ctx->tp_sig_pk);
+  crypto_hash_sha512_update(&outer, &msg->msgno, sizeof(TP_DKG_Message) - crypto_sign_BYTES);
+  sigs[0] = msg->sig;
+  pks[0] = ctx->tp_sig_pk;
+
+  uint16_t i;
+  for(i=0;i<ctx->n;i++) {
+    const uint8_t *ptr = msg->data + i * inner_len;
+    crypto_hash_sha512_update(&outer, ptr, inner_len);
+    crypto_generichash_update(&transcript, ptr, inner_len);
+    ret = check_envelope(ptr, inner_len, inner_msgno, (uint16_t) (i+1), tpdkg_BROADCAST, ctx->sessionid, ctx->ts_epsilon, &ctx->last_ts[i]);
+    if(0!=ret) {
+      // the TP signed all of it
+      crypto_hash_sha512_update(&outer, ptr + inner_len, (ctx->n - i - 1U) * inner_len);
+      break;
+    }
+    const TP_DKG_Message* m = (const TP_DKG_Message*) ptr;
+    sigs[i+1] = m->sig;
+    pks[i+1] = (sig_pks == NULL) ? m->data : sig_pks[i];
+    ed25519_hram_init(&hs, m->sig, pks[i+1]);
+    crypto_hash_sha512_update(&hs, &m->msgno, inner_len - crypto_sign_BYTES);
+    ed25519_hram_final(&hs, hrams[i+1]);
+  }
+  ed25519_hram_final(&outer, hrams[0]);
 
 #if !defined(FUZZING_BUILD_MODE_UNSAFE_FOR_PRODUCTION)
-  if(0!=crypto_sign_verify_detached(msg->sig, &msg->msgno, sizeof(TP_DKG_Message) - crypto_sign_BYTES, sig_pk)) return 6;
+  METRIC_ADD(sig_verify, 1U + i);
+  if(0!=ed25519_verify_batch_hram(i + 1U, (const uint8_t (*)[crypto_core_ristretto255_SCALARBYTES]) hrams, sigs, pks)) {
+    // find the offender, the TP first
+    METRIC_ADD(sig_verify, 1);
+    if(0!=ed25519_verify(msg->sig, &msg->msgno, input_len - crypto_sign_BYTES, ctx->tp_sig_pk)) return 6;
+    for(uint16_t j=0;j<i;j++) {
+      const TP_DKG_Message* m = (const TP_DKG_Message*) (msg->data + j * inner_len);
+      METRIC_ADD(sig_verify, 1);
+      if(0!=ed25519_verify(m->sig, &m->msgno, inner_len - crypto_sign_BYTES, pks[j+1])) {
+        *inner = 1;
+        return 6;
+      }
+    }
+  }
 #endif
 
+  if(0!=ret) {
+    *inner = 1;
+    return ret;
+  }
+  memcpy(&ctx->transcript, &transcript, sizeof transcript);
+  sodium_memzero(&transcript, sizeof transcript);
   return 0;
 }
 
-static int tpdkg_init_noise_handshake(TP_DKG_PeerState *ctx,
-                                      uint8_t rpk[crypto_scalarmult_BYTES],
-                                      uint8_t *rname,
-                                      Noise_XK_session_t** session,
-                                      uint8_t msg[noise_xk_handshake1_SIZE]) {
+// adds the peer to the noise device and creates the session to it,
+// as this modifies the device it must not run concurrently
+static int tpdkg_create_noise_initiator(TP_DKG_PeerState *ctx,
+                                        uint8_t rpk[crypto_scalarmult_BYTES],
+                                        uint8_t *rname,
+                                        Noise_XK_session_t** session) {
   if(log_file != NULL) fprintf(log_file, "[%d] creating noise session -> %s\n", ctx->index, rname);
   // fixme: damnit this allocates stuff on the heap...
   Noise_XK_peer_t *peer = Noise_XK_device_add_peer(ctx->dev, rname, rpk);
@@ -167,7 +372,12 @@ static int tpdkg_init_noise_handshake(TP_DKG_PeerState *ctx,
   uint32_t peer_id = Noise_XK_peer_get_id(peer);
   *session = Noise_XK_session_create_initiator(ctx->dev, peer_id);
   if(!*session) return 2;
+  return 0;
+}
 
+static int tpdkg_init_noise_handshake(Noise_XK_session_t** session,
+                                      uint8_t msg[noise_xk_handshake1_SIZE]) {
+  METRIC_ADD(noise_ops, 1);
   Noise_XK_encap_message_t *encap_msg = Noise_XK_pack_message_with_conf_level(NOISE_XK_CONF_ZERO, 0, NULL);
   uint32_t cipher_msg_len;
   uint8_t *cipher_msg;
@@ -175,11 +385,13 @@ static int tpdkg_init_noise_handshake(TP_DKG_PeerState *ctx,
   Noise_XK_encap_message_p_free(encap_msg);
   if(!Noise_XK_rcode_is_success(ret)) {
     Noise_XK_session_free(*session);
+    *session = NULL;
     return 3;
   }
 
   if(cipher_msg_len!=noise_xk_handshake1_SIZE) {
     Noise_XK_session_free(*session);
+    *session = NULL;
     free(cipher_msg);
     return 4;
   }
@@ -190,22 +402,27 @@ static int tpdkg_init_noise_handshake(TP_DKG_PeerState *ctx,
   return 0;
 }
 
-static int tpdkg_respond_noise_handshake(TP_DKG_PeerState *ctx,
-                                         uint8_t rpk[crypto_scalarmult_BYTES],
-                                         uint8_t *rname,
-                                         Noise_XK_session_t** session,
-                                         uint8_t inmsg[noise_xk_handshake1_SIZE],
-                                         uint8_t outmsg[noise_xk_handshake2_SIZE]) {
+// creating a session modifies the noise device, it must not run concurrently
+static int tpdkg_create_noise_responder(TP_DKG_PeerState *ctx,
+                                        uint8_t *rname,
+                                        Noise_XK_session_t** session) {
   if(log_file != NULL) fprintf(log_file, "[%d] responding noise session -> %s\n", ctx->index, rname);
   // fixme: damnit this allocates stuff on the heap...
-
   *session = Noise_XK_session_create_responder(ctx->dev);
   if(!*session) return 1;
+  return 0;
+}
 
+static int tpdkg_respond_noise_handshake(Noise_XK_session_t** session,
+                                         uint8_t inmsg[noise_xk_handshake1_SIZE],
+                                         uint8_t outmsg[noise_xk_handshake2_SIZE]) {
+  METRIC_ADD(noise_ops, 1);
+  // only looks up the initiator in the device, which is not modified meanwhile
   Noise_XK_encap_message_t *encap_msg;
   Noise_XK_rcode ret = Noise_XK_session_read(&encap_msg, *session, noise_xk_handshake1_SIZE, inmsg);
   if(!Noise_XK_rcode_is_success(ret)) {
     Noise_XK_session_free(*session);
+    *session = NULL;
     return 2;
   }
 
@@ -213,6 +430,7 @@ static int tpdkg_respond_noise_handshake(TP_DKG_PeerState *ctx,
   uint8_t *plain_msg;
   if(!Noise_XK_unpack_message_with_auth_level(&plain_msg_len, &plain_msg, NOISE_XK_AUTH_ZERO, encap_msg)) {
     Noise_XK_session_free(*session);
+    *session = NULL;
     return 3;
   }
   Noise_XK_encap_message_p_free(encap_msg);
@@ -224,11 +442,13 @@ static int tpdkg_respond_noise_handshake(TP_DKG_PeerState *ctx,
   Noise_XK_encap_message_p_free(encap_msg);
   if(!Noise_XK_rcode_is_success(ret)) {
     Noise_XK_session_free(*session);
+    *session = NULL;
     return 4;
   }
 
   if(cipher_msg_len!=noise_xk_handshake2_SIZE) {
     Noise_XK_session_free(*session);
+    *session = NULL;
     free(cipher_msg);
     return 4;
   }
@@ -238,36 +458,32 @@ static int tpdkg_respond_noise_handshake(TP_DKG_PeerState *ctx,
   return 0;
 }
 
-static int tpdkg_finish_noise_handshake(TP_DKG_PeerState *ctx,
-                                        Noise_XK_session_t** session,
+static void tpdkg_log_noise_session(TP_DKG_PeerState *ctx, Noise_XK_session_t *session) {
+  if(log_file==NULL || session==NULL) return;
+  // get peer name
+  uint32_t peer_id = Noise_XK_session_get_peer_id(session);
+  Noise_XK_peer_t *peer = Noise_XK_device_lookup_peer_by_id(ctx->dev, peer_id);
+  if(peer==NULL) return;
+  uint8_t *pinfo;
+  Noise_XK_peer_get_info((Noise_XK_noise_string*) &pinfo, peer);
+  if(pinfo==NULL) return;
+  fprintf(log_file, "[%d] finishing noise session -> %s\n", ctx->index, pinfo);
+  free(pinfo);
+}
+
+static int tpdkg_finish_noise_handshake(Noise_XK_session_t** session,
                                         uint8_t msg[noise_xk_handshake2_SIZE]) {
   if(!*session) {
     return 1;
   }
-
-  if(log_file!=NULL) {
-    // get peer name
-    uint32_t peer_id = Noise_XK_session_get_peer_id(*session);
-    Noise_XK_peer_t *peer = Noise_XK_device_lookup_peer_by_id(ctx->dev, peer_id);
-    if(peer==NULL) {
-      Noise_XK_session_free(*session);
-      return 2;
-    }
-    uint8_t *pinfo;
-    Noise_XK_peer_get_info((Noise_XK_noise_string*) &pinfo, peer);
-    if(pinfo==NULL) {
-      Noise_XK_session_free(*session);
-      return 3;
-    }
-    fprintf(log_file, "[%d] finishing noise session -> %s\n", ctx->index, pinfo);
-    free(pinfo);
-  }
+  METRIC_ADD(noise_ops, 1);
 
   Noise_XK_encap_message_t *encap_msg;
   Noise_XK_rcode ret = Noise_XK_session_read(&encap_msg, *session, noise_xk_handshake2_SIZE, msg);
   if(!Noise_XK_rcode_is_success(ret)) {
     if(log_file!=NULL) fprintf(log_file, "session read fail: %d\n", ret.val.case_Error);
     Noise_XK_session_free(*session);
+    *session = NULL;
     return 4;
   }
 
@@ -275,6 +491,7 @@ static int tpdkg_finish_noise_handshake(TP_DKG_PeerState *ctx,
   uint8_t *plain_msg;
   if(!Noise_XK_unpack_message_with_auth_level(&plain_msg_len, &plain_msg, NOISE_XK_AUTH_ZERO, encap_msg)) {
     Noise_XK_session_free(*session);
+    *session = NULL;
     return 5;
   }
   Noise_XK_encap_message_p_free(encap_msg);
@@ -293,6 +510,16 @@ static int tpdkg_noise_encrypt(uint8_t *input,
   if(input_len > 1024) {
     return 2;
   }
+  METRIC_ADD(noise_ops, 1);
+
+  // transport messages are encrypted straight into output
+  if(Noise_XK_session_get_status(*session)==Noise_XK_Transport) {
+    if(output == NULL) return 5;
+    if(input_len + crypto_secretbox_xchacha20poly1305_MACBYTES != output_len) return 4;
+    Noise_XK_rcode ret = Noise_XK_session_write_buffer(*session, (uint32_t) input_len, input, (uint32_t) output_len, output);
+    if(!Noise_XK_rcode_is_success(ret)) return 3;
+    return 0;
+  }
 
   Noise_XK_encap_message_t *encap_msg = Noise_XK_pack_message_with_conf_level(NOISE_XK_CONF_STRONG_FORWARD_SECRECY, (uint32_t) input_len, input);
   uint32_t cipher_msg_len;
@@ -324,6 +551,20 @@ static int tpdkg_noise_decrypt(uint8_t *input,
   if(input_len > 1024) {
     return 2;
   }
+  METRIC_ADD(noise_ops, 1);
+
+  // transport messages are decrypted straight into output
+  if(Noise_XK_session_get_status(*session)==Noise_XK_Transport) {
+    if(output_len + crypto_secretbox_xchacha20poly1305_MACBYTES != input_len) return 5;
+    if(output == NULL && output_len > 0) return 6;
+    Noise_XK_rcode ret = Noise_XK_session_read_buffer(*session, (uint32_t) input_len, input, (uint32_t) output_len, output);
+    if(!Noise_XK_rcode_is_success(ret)) {
+      if(log_file!=NULL) fprintf(log_file, "session read fail: %d\n", ret.val.case_Error);
+      return 3;
+    }
+    return 0;
+  }
+
   Noise_XK_encap_message_t *encap_msg;
   Noise_XK_rcode ret = Noise_XK_session_read(&encap_msg, *session, (uint32_t) input_len, input);
   if(!Noise_XK_rcode_is_success(ret)) {
@@ -364,22 +605,119 @@ static uint8_t* Noise_XK_session_get_key(Noise_XK_session_t *sn) {
   return NULL;
 }
 
-static TP_DKG_Cheater* add_cheater(TP_DKG_TPState *ctx, const int step, const int error, const uint8_t peer, const uint8_t other_peer) {
+static TP_DKG_Cheater* add_cheater(TP_DKG_TPState *ctx, const int step, const int error, const uint16_t peer, const uint16_t other_peer) {
   if(ctx->cheater_len >= ctx->cheater_max) return NULL;
   TP_DKG_Cheater *cheater = &(*ctx->cheaters)[ctx->cheater_len++];
   cheater->step = step;
   cheater->error = error;
   cheater->peer = peer;
   cheater->other_peer=other_peer;
+  METRIC_ADD(cheaters, 1);
   return cheater;
 }
 
+// the hash of the transcript so far, leaving the transcript as it is
+static void peek_transcript(const crypto_generichash_state *transcript, uint8_t hash[crypto_generichash_BYTES]) {
+  crypto_generichash_state copy;
+  memcpy(&copy, transcript, sizeof copy);
+  crypto_generichash_final(&copy, hash, crypto_generichash_BYTES);
+  sodium_memzero(&copy, sizeof copy);
+}
+
 static void update_transcript(crypto_generichash_state *transcript, const uint8_t *msg, const size_t msg_len) {
   uint32_t msg_size_32b = htonl((uint32_t)msg_len);
   crypto_generichash_update(transcript, (uint8_t*) &msg_size_32b, sizeof(msg_size_32b));
   crypto_generichash_update(transcript, (uint8_t*) msg, msg_len);
 }
 
+// a message from a peer to be verified by the TP
+typedef struct {
+  const uint8_t *msg;
+  size_t len;
+  uint8_t msgno;
+  uint16_t to;
+  int ret;
+} TP_Recv;
+
+// messages grouped by sender, each group holds per_peer messages
+// which are verified in order, as they all update the same last_ts
+typedef struct {
+  TP_DKG_TPState *ctx;
+  TP_Recv *msgs;
+  size_t per_peer;
+} TP_RecvBatch;
+
+#ifdef TPDKG_METRICS
+// runs a job on a worker thread counting into the metrics of the step
+typedef struct {
+  void (*fn)(void *arg, const size_t job);
+  void *arg;
+  TP_DKG_StepMetrics *m;
+} Metrics_Job;
+
+static void metrics_job(void *arg, const size_t job) {
+  Metrics_Job *j = (Metrics_Job*) arg;
+  TP_DKG_StepMetrics *saved = metrics_cur;
+  metrics_cur = j->m;
+  j->fn(j->arg, job);
+  metrics_cur = saved;
+}
+#endif // TPDKG_METRICS
+
+static void parallel_for(const tpdkg_parallel_fn parallel, void *pool, const size_t jobs, void (*fn)(void *arg, const size_t job), void *arg) {
+  if(parallel!=NULL) {
+#ifdef TPDKG_METRICS
+    if(metrics_cur!=NULL) {
+      Metrics_Job j = { .fn = fn, .arg = arg, .m = metrics_cur };
+      parallel(pool, jobs, metrics_job, &j);
+      return;
+    }
+#endif
+    parallel(pool, jobs, fn, arg);
+    return;
+  }
+  for(size_t i=0;i<jobs;i++) fn(arg, i);
+}
+
+static void tp_for(TP_DKG_TPState *ctx, const size_t jobs, void (*fn)(void *arg, const size_t job), void *arg) {
+  parallel_for(ctx->parallel, ctx->pool, jobs, fn, arg);
+}
+
+static void peer_for(TP_DKG_PeerState *ctx, const size_t jobs, void (*fn)(void *arg, const size_t job), void *arg) {
+  parallel_for(ctx->parallel, ctx->pool, jobs, fn, arg);
+}
+
+// the work of a peer step on the sessions with each of the other
+// peers, a job only uses the session of its peer
+typedef struct {
+  TP_DKG_PeerState *ctx;
+  const uint8_t *input;
+  uint8_t *output;
+  const TOPRF_WideShare *shares;
+  int *rets;
+} Peer_Jobs;
+
+static void tp_recv_peer(void *arg, const size_t peer) {
+  TP_RecvBatch *batch = (TP_RecvBatch*) arg;
+  TP_DKG_TPState *ctx = batch->ctx;
+  for(size_t k=0;k<batch->per_peer;k++) {
+    TP_Recv *m = &batch->msgs[peer * batch->per_peer + k];
+    if(m->msg==NULL) continue;
+    // already verified by tpdkg_tp_feed()
+    if(ctx->fed[peer].state==1) {
+      m->ret = 0;
+      continue;
+    }
+    m->ret = recv_msg(m->msg, m->len, m->msgno, (uint16_t) (peer+1), m->to, (*ctx->peer_sig_pks)[peer], ctx->sessionid, ctx->ts_epsilon, &ctx->last_ts[peer]);
+  }
+}
+
+// verifies msgs[n][per_peer], msgs[i][k] must be sent by peer i+1
+static void tp_recv_msgs(TP_DKG_TPState *ctx, TP_Recv *msgs, const size_t per_peer) {
+  TP_RecvBatch batch = { .ctx = ctx, .msgs = msgs, .per_peer = per_peer };
+  tp_for(ctx, ctx->n, tp_recv_peer, &batch);
+}
+
 size_t tpdkg_tp_input_size(const TP_DKG_TPState *ctx) {
   size_t sizes[ctx->n];
   //memset(sizes,0,sizeof sizes);
@@ -403,12 +741,12 @@ int tpdkg_tp_input_sizes(const TP_DKG_TPState *ctx, size_t *sizes) {
   case 5: { item=ctx->n * tpdkg_msg8_SIZE; break; }
   case 6: { item=tpdkg_msg9_SIZE(ctx); break; }
   case 7: {
-    uint8_t ctr[ctx->n];
-    memset(ctr,0,ctx->n);
-    for(int i=0;i<ctx->complaints_len;i++) ctr[((*ctx->complaints)[i] & 0xff) - 1]++;
+    uint16_t ctr[ctx->n];
+    memset(ctr,0,sizeof ctr);
+    for(uint32_t i=0;i<ctx->complaints_len;i++) ctr[((*ctx->complaints)[i] & 0xffff) - 1]++;
     for(int i=0;i<ctx->n;i++) {
       if(ctr[i]>0) {
-        sizes[i]=sizeof(TP_DKG_Message) + (1+tpdkg_noise_key_SIZE) * ctr[i];
+        sizes[i]=sizeof(TP_DKG_Message) + tpdkg_key_reveal_SIZE * ctr[i];
       } else {
         sizes[i]=0;
       }
@@ -422,7 +760,7 @@ int tpdkg_tp_input_sizes(const TP_DKG_TPState *ctx, size_t *sizes) {
   }
   }
 
-  for(uint8_t i=0;i<ctx->n;i++) {
+  for(uint16_t i=0;i<ctx->n;i++) {
     sizes[i] = item;
   }
   return 1;
@@ -445,8 +783,8 @@ size_t tpdkg_tp_output_size(const TP_DKG_TPState *ctx) {
   return 0;
 }
 
-int tpdkg_tp_peer_msg(const TP_DKG_TPState *ctx, const uint8_t *base, const size_t base_size, const uint8_t peer, const uint8_t **msg, size_t *len) {
-  if(peer>=ctx->n || peer < 0) return -1;
+int tpdkg_tp_peer_msg(const TP_DKG_TPState *ctx, const uint8_t *base, const size_t base_size, const uint16_t peer, const uint8_t **msg, size_t *len) {
+  if(peer>=ctx->n) return -1;
 
   switch(ctx->prev) {
   case 0: {
@@ -513,6 +851,59 @@ int tpdkg_tp_peer_msg(const TP_DKG_TPState *ctx, const uint8_t *base, const size
   return 0;
 }
 
+int tpdkg_tp_routes(const TP_DKG_TPState *ctx) {
+  return ctx->step==2 || ctx->step==3 || ctx->step==5;
+}
+
+int tpdkg_tp_peer_iov(const TP_DKG_TPState *ctx, const uint8_t *base, const size_t base_size,
+                      const uint8_t *input, const size_t input_len, const uint16_t peer,
+                      uint8_t frame[tpdkg_frame_SIZE], struct iovec *iov, const size_t iov_len,
+                      size_t *iovcnt) {
+  if(peer>=ctx->n) return -1;
+  *iovcnt = 0;
+  const size_t first = (frame!=NULL) ? 1 : 0;
+  size_t len = 0;
+
+  if(base!=NULL) {
+    const uint8_t *msg;
+    const int ret = tpdkg_tp_peer_msg(ctx, base, base_size, peer, &msg, &len);
+    if(0!=ret) return ret;
+    if(len==0) return 0;
+    if(iov_len < first + 1) return 5;
+    iov[first] = (struct iovec) { .iov_base = (void*) msg, .iov_len = len };
+  } else {
+    size_t item;
+    switch(ctx->prev) {
+    case 2: { item = tpdkg_msg4_SIZE; break; }
+    case 3: { item = tpdkg_msg5_SIZE; break; }
+    case 5: { item = tpdkg_msg8_SIZE; break; }
+    // these steps have no output
+    case 7:
+    case 9: return 0;
+    default: {
+      if(log_file!=NULL) fprintf(log_file, "[!] tpdkg_tp_peer_iov without output after a step not routing messages\n");
+      return 3;
+    }
+    }
+    if(input==NULL || input_len != item * ctx->n * ctx->n) return 4;
+    if(iov_len < first + ctx->n) return 5;
+    // the input holds the messages of each peer to all the peers, the
+    // message for this peer from the jth peer is the peer-th item of the jth row
+    for(uint16_t j=0;j<ctx->n;j++) {
+      iov[first + j] = (struct iovec) { .iov_base = (void*) (input + ((size_t) j * ctx->n + peer) * item), .iov_len = item };
+    }
+    len = item * ctx->n;
+  }
+
+  if(frame!=NULL) {
+    const uint32_t flen = htonl((uint32_t) len);
+    memcpy(frame, &flen, sizeof flen);
+    iov[0] = (struct iovec) { .iov_base = frame, .iov_len = tpdkg_frame_SIZE };
+  }
+  *iovcnt = first + ((base!=NULL) ? 1 : ctx->n);
+  return 0;
+}
+
 size_t tpdkg_peer_input_size(const TP_DKG_PeerState *ctx) {
   switch(ctx->step) {
   case 0: return tpdkg_msg1_SIZE;
@@ -536,7 +927,7 @@ size_t tpdkg_peer_input_size(const TP_DKG_PeerState *ctx) {
 size_t tpdkg_peer_output_size(const TP_DKG_PeerState *ctx) {
   switch(ctx->step) {
   case 0: return tpdkg_msg2_SIZE+crypto_sign_BYTES;
-  case 1: return tpdkg_msg4_SIZE * ctx->n;
+  case 1: return ctx->resume ? tpdkg_msg6_SIZE(ctx) : tpdkg_msg4_SIZE * ctx->n;
   case 2: return tpdkg_msg5_SIZE * ctx->n;
   case 3: return tpdkg_msg6_SIZE(ctx);
   case 4: return ctx->n * tpdkg_msg8_SIZE;
@@ -545,13 +936,13 @@ size_t tpdkg_peer_output_size(const TP_DKG_PeerState *ctx) {
   case 7: {
     if(ctx->complaints_len > 0) {
       if(ctx->my_complaints_len > 0) {
-        return sizeof(TP_DKG_Message) + ctx->my_complaints_len * (1+tpdkg_noise_key_SIZE);
+        return sizeof(TP_DKG_Message) + ctx->my_complaints_len * tpdkg_key_reveal_SIZE;
       }
       return 0;
     }
-    return tpdkg_msg19_SIZE;
+    return ctx->optimistic ? tpdkg_msg21_SIZE : tpdkg_msg19_SIZE;
   }
-  case 8: return tpdkg_msg19_SIZE;
+  case 8: return ctx->optimistic ? tpdkg_msg21_SIZE : tpdkg_msg19_SIZE;
   case 9: return tpdkg_msg21_SIZE;
   case 10: return 0;
   default: {
@@ -566,11 +957,11 @@ void tpdkg_peer_set_bufs(TP_DKG_PeerState *ctx,
                          uint8_t (*peers_noise_pks)[][crypto_scalarmult_BYTES],
                          Noise_XK_session_t *(*noise_outs)[],
                          Noise_XK_session_t *(*noise_ins)[],
-                         TOPRF_Share (*shares)[],
-                         TOPRF_Share (*xshares)[],
+                         TOPRF_WideShare (*shares)[],
+                         TOPRF_WideShare (*xshares)[],
                          uint8_t (*commitments)[][crypto_core_ristretto255_BYTES],
-                         uint16_t *complaints,
-                         uint8_t *my_complaints,
+                         uint32_t *complaints,
+                         uint16_t *my_complaints,
                          uint64_t *last_ts) {
   ctx->peer_sig_pks = peers_sig_pks;
   ctx->peer_noise_pks = peers_noise_pks;
@@ -582,7 +973,73 @@ void tpdkg_peer_set_bufs(TP_DKG_PeerState *ctx,
   ctx->complaints = complaints;
   ctx->my_complaints = my_complaints;
   ctx->last_ts = last_ts;
-  for(uint8_t i=0;i<ctx->n;i++) ctx->last_ts[i]=0;
+  for(uint16_t i=0;i<ctx->n;i++) ctx->last_ts[i]=0;
+}
+
+// reserves len bytes at *offset in an arena, keeping the next reservation aligned
+static size_t arena_take(size_t *offset, const size_t len) {
+  const size_t ret = *offset;
+  *offset += (len + tpdkg_arena_ALIGN - 1) & ~((size_t) tpdkg_arena_ALIGN - 1);
+  return ret;
+}
+
+// the offset of the first aligned byte in arena
+static size_t arena_pad(const uint8_t *arena) {
+  return (tpdkg_arena_ALIGN - ((uintptr_t) arena % tpdkg_arena_ALIGN)) % tpdkg_arena_ALIGN;
+}
+
+typedef struct {
+  size_t peer_sig_pks, peer_noise_pks, noise_outs, noise_ins, shares, xshares;
+  size_t commitments, complaints, my_complaints, last_ts, size;
+} Peer_Arena;
+
+static void peer_arena_layout(const uint16_t n, const uint16_t t, Peer_Arena *a) {
+  size_t o = 0;
+  a->peer_sig_pks = arena_take(&o, n * (size_t) crypto_sign_PUBLICKEYBYTES);
+  a->peer_noise_pks = arena_take(&o, n * (size_t) crypto_scalarmult_BYTES);
+  a->noise_outs = arena_take(&o, n * sizeof(Noise_XK_session_t*));
+  a->noise_ins = arena_take(&o, n * sizeof(Noise_XK_session_t*));
+  a->shares = arena_take(&o, n * sizeof(TOPRF_WideShare));
+  a->xshares = arena_take(&o, n * sizeof(TOPRF_WideShare));
+  a->commitments = arena_take(&o, (size_t) n * t * crypto_core_ristretto255_BYTES);
+  a->complaints = arena_take(&o, (size_t) n * n * sizeof(uint32_t));
+  a->my_complaints = arena_take(&o, n * sizeof(uint16_t));
+  a->last_ts = arena_take(&o, n * sizeof(uint64_t));
+  a->size = o;
+}
+
+size_t tpdkg_peer_arena_size(const uint16_t n, const uint16_t t) {
+  Peer_Arena a;
+  peer_arena_layout(n, t, &a);
+  return a.size + tpdkg_arena_ALIGN - 1;
+}
+
+int tpdkg_peer_set_arena(TP_DKG_PeerState *ctx, uint8_t *arena, const size_t arena_len, const int lock) {
+  Peer_Arena a;
+  peer_arena_layout(ctx->n, ctx->t, &a);
+  const size_t pad = arena_pad(arena);
+  if(arena_len < pad + a.size) return 1;
+  if(lock && 0!=sodium_mlock(arena, arena_len)) return 2;
+  memset(arena, 0, arena_len);
+
+  uint8_t *base = arena + pad;
+  tpdkg_peer_set_bufs(ctx,
+                      (uint8_t (*)[][crypto_sign_PUBLICKEYBYTES]) (base + a.peer_sig_pks),
+                      (uint8_t (*)[][crypto_scalarmult_BYTES]) (base + a.peer_noise_pks),
+                      (Noise_XK_session_t *(*)[]) (base + a.noise_outs),
+                      (Noise_XK_session_t *(*)[]) (base + a.noise_ins),
+                      (TOPRF_WideShare (*)[]) (base + a.shares),
+                      (TOPRF_WideShare (*)[]) (base + a.xshares),
+                      (uint8_t (*)[][crypto_core_ristretto255_BYTES]) (base + a.commitments),
+                      (uint32_t*) (base + a.complaints),
+                      (uint16_t*) (base + a.my_complaints),
+                      (uint64_t*) (base + a.last_ts));
+  return 0;
+}
+
+void tpdkg_arena_wipe(uint8_t *arena, const size_t arena_len, const int locked) {
+  if(locked) sodium_munlock(arena, arena_len); // also zeroes the memory
+  else sodium_memzero(arena, arena_len);
 }
 
 int tpdkg_tp_not_done(const TP_DKG_TPState *tp) {
@@ -599,16 +1056,104 @@ void tpdkg_peer_free(TP_DKG_PeerState *ctx) {
     if((*ctx->noise_outs)[i]!=NULL) Noise_XK_session_free((*ctx->noise_outs)[i]);
   }
   if(ctx->dev!=NULL) Noise_XK_device_free(ctx->dev);
+  sodium_memzero(&ctx->old_share, sizeof ctx->old_share);
+}
+
+// the offsets of n, the index and the uses left in a channel cache,
+// the keys follow, see tpdkg_resume_SIZE()
+#define tpdkg_resume_N tpdkg_sessionid_SIZE
+#define tpdkg_resume_INDEX (tpdkg_sessionid_SIZE + 2)
+#define tpdkg_resume_LEFT (tpdkg_sessionid_SIZE + 4)
+#define tpdkg_resume_KEYS (tpdkg_sessionid_SIZE + 5)
+
+// the cached key of the channel to (in=0) or from (in=1) peer i+1
+static const uint8_t* resume_cached(const TP_DKG_PeerState *ctx, const int in, const uint16_t i) {
+  return ctx->resume_cache + tpdkg_resume_KEYS + ((size_t) (in ? ctx->n : 0) + i) * tpdkg_resume_KEY_SIZE;
+}
+
+// the key of a resumed channel for this run, which is revealed to
+// the TP in step 17a instead of the key of a noise session
+static void resume_key(const TP_DKG_PeerState *ctx, const uint8_t cached[tpdkg_resume_KEY_SIZE], uint8_t key[tpdkg_noise_key_SIZE]) {
+  crypto_generichash_state state;
+  crypto_generichash_init(&state, cached, tpdkg_resume_KEY_SIZE, tpdkg_noise_key_SIZE);
+  crypto_generichash_update(&state, (const uint8_t*) "tp dkg resume key", 17);
+  crypto_generichash_update(&state, ctx->sessionid, sizeof ctx->sessionid);
+  crypto_generichash_final(&state, key, tpdkg_noise_key_SIZE);
+  sodium_memzero(&state, sizeof state);
+}
+
+// derives a cached key from the key of a noise session or the
+// cached key of the previous run, so that neither can be recovered from it
+static void resume_derive(const uint8_t *key, const char *label, const uint8_t sessionid[tpdkg_sessionid_SIZE], uint8_t out[tpdkg_resume_KEY_SIZE]) {
+  crypto_generichash_state state;
+  crypto_generichash_init(&state, key, tpdkg_resume_KEY_SIZE, tpdkg_resume_KEY_SIZE);
+  crypto_generichash_update(&state, (const uint8_t*) label, strlen(label));
+  crypto_generichash_update(&state, sessionid, tpdkg_sessionid_SIZE);
+  crypto_generichash_final(&state, out, tpdkg_resume_KEY_SIZE);
+  sodium_memzero(&state, sizeof state);
+}
+
+int tpdkg_peer_save_resume(const TP_DKG_PeerState *ctx, uint8_t *cache, const size_t cache_len) {
+  // the share is final once the peer sent its final ack
+  if(ctx->step != 10 && ctx->step != 11) return 1;
+  if(cache_len != tpdkg_resume_SIZE(ctx->n)) return 2;
+  // revealed keys must not be reused
+  if(ctx->complaints_len > 0) return 3;
+  uint8_t uses = tpdkg_resume_USES;
+  if(ctx->resume) {
+    uses = (uint8_t) (ctx->resume_cache[tpdkg_resume_LEFT] - 1);
+    if(uses==0) return 4;
+  } else {
+    for(uint16_t i=0;i<ctx->n;i++) {
+      if((*ctx->noise_outs)[i]==NULL || (*ctx->noise_ins)[i]==NULL) return 5;
+    }
+  }
+
+  uint8_t *keys = cache + tpdkg_resume_KEYS;
+  for(uint8_t in=0;in<2;in++) {
+    for(uint16_t i=0;i<ctx->n;i++) {
+      uint8_t key[tpdkg_resume_KEY_SIZE];
+      if(ctx->resume) {
+        // ratchet forward, cache may be the one this run resumed
+        resume_derive(resume_cached(ctx, in, i), "tp dkg resume next", ctx->sessionid, key);
+      } else {
+        // the responder receives with the key the initiator sends with
+        Noise_XK_session_t *session = in ? (*ctx->noise_ins)[i] : (*ctx->noise_outs)[i];
+        const uint8_t *skey = Noise_XK_session_get_key(session);
+        if(skey==NULL) return 5;
+        resume_derive(skey, "tp dkg resume", ctx->sessionid, key);
+      }
+      memcpy(keys + ((size_t) (in ? ctx->n : 0) + i) * tpdkg_resume_KEY_SIZE, key, sizeof key);
+      sodium_memzero(key, sizeof key);
+    }
+  }
+  memcpy(cache, ctx->sessionid, tpdkg_sessionid_SIZE);
+  put16(cache + tpdkg_resume_N, ctx->n);
+  put16(cache + tpdkg_resume_INDEX, ctx->index);
+  cache[tpdkg_resume_LEFT] = uses;
+  return 0;
+}
+
+int tpdkg_peer_set_metrics(TP_DKG_PeerState *ctx, TP_DKG_Metrics *metrics) {
+#ifdef TPDKG_METRICS
+  ctx->metrics = metrics;
+  return 0;
+#else
+  (void) ctx;
+  (void) metrics;
+  return 1;
+#endif
 }
 
 void tpdkg_tp_set_bufs(TP_DKG_TPState *ctx,
                        uint8_t (*commitments)[][crypto_core_ristretto255_BYTES],
-                       uint16_t (*complaints)[],
-                       uint8_t (*encrypted_shares)[][tpdkg_msg8_SIZE],
+                       uint32_t (*complaints)[],
+                       uint8_t (*encrypted_shares)[][tpdkg_encrypted_share_SIZE],
                        TP_DKG_Cheater (*cheaters)[], const size_t cheater_max,
                        uint8_t (*tp_peers_sig_pks)[][crypto_sign_PUBLICKEYBYTES],
                        uint8_t (*peer_lt_pks)[][crypto_sign_PUBLICKEYBYTES],
-                       uint64_t *last_ts) {
+                       uint64_t *last_ts,
+                       TP_DKG_Fed *fed) {
   ctx->commitments = (uint8_t (*)[][crypto_core_ristretto255_BYTES]) commitments;
   ctx->complaints = complaints;
   ctx->encrypted_shares = encrypted_shares;
@@ -618,19 +1163,103 @@ void tpdkg_tp_set_bufs(TP_DKG_TPState *ctx,
   ctx->peer_sig_pks = tp_peers_sig_pks;
   ctx->peer_lt_pks = peer_lt_pks;
   ctx->last_ts = last_ts;
-  uint64_t now = (uint64_t)time(NULL);
-  for(uint8_t i=0;i<ctx->n;i++) ctx->last_ts[i]=now;
+  uint64_t now = now_ts();
+  for(uint16_t i=0;i<ctx->n;i++) ctx->last_ts[i]=now;
+  ctx->fed = fed;
+  memset(ctx->fed, 0, ctx->n * sizeof(TP_DKG_Fed));
 }
 
-int tpdkg_start_tp(TP_DKG_TPState *ctx, const uint64_t ts_epsilon,
-             const uint8_t n, const uint8_t t,
-             const char *proto_name, const size_t proto_name_len,
-             const size_t msg0_len, TP_DKG_Message *msg0) {
-  if(log_file!=NULL) fprintf(log_file, "\e[0;33m[!] step 0. start protocol\e[0m\n");
-  if(2>n || t>=n || n>128) return 1;
+typedef struct {
+  size_t commitments, complaints, encrypted_shares, cheaters;
+  size_t peer_sig_pks, peer_lt_pks, last_ts, fed, size;
+} TP_Arena;
+
+static size_t tp_arena_cheater_max(const uint16_t t) {
+  return (t==0) ? 0 : (size_t) t * t - 1;
+}
+
+static void tp_arena_layout(const uint16_t n, const uint16_t t, TP_Arena *a) {
+  size_t o = 0;
+  a->commitments = arena_take(&o, (size_t) n * t * crypto_core_ristretto255_BYTES);
+  a->complaints = arena_take(&o, (size_t) n * n * sizeof(uint32_t));
+  a->encrypted_shares = arena_take(&o, (size_t) n * (n - 1U) * tpdkg_encrypted_share_SIZE);
+  a->cheaters = arena_take(&o, tp_arena_cheater_max(t) * sizeof(TP_DKG_Cheater));
+  a->peer_sig_pks = arena_take(&o, n * (size_t) crypto_sign_PUBLICKEYBYTES);
+  a->peer_lt_pks = arena_take(&o, n * (size_t) crypto_sign_PUBLICKEYBYTES);
+  a->last_ts = arena_take(&o, n * sizeof(uint64_t));
+  a->fed = arena_take(&o, n * sizeof(TP_DKG_Fed));
+  a->size = o;
+}
+
+size_t tpdkg_tp_arena_size(const uint16_t n, const uint16_t t) {
+  TP_Arena a;
+  tp_arena_layout(n, t, &a);
+  return a.size + tpdkg_arena_ALIGN - 1;
+}
+
+int tpdkg_tp_set_arena(TP_DKG_TPState *ctx, uint8_t *arena, const size_t arena_len,
+                       const uint8_t (*peer_lt_pks)[][crypto_sign_PUBLICKEYBYTES],
+                       const int lock) {
+  TP_Arena a;
+  tp_arena_layout(ctx->n, ctx->t, &a);
+  const size_t pad = arena_pad(arena);
+  if(arena_len < pad + a.size) return 1;
+  if(lock && 0!=sodium_mlock(arena, arena_len)) return 2;
+  memset(arena, 0, arena_len);
+
+  uint8_t *base = arena + pad;
+  memcpy(base + a.peer_lt_pks, *peer_lt_pks, ctx->n * (size_t) crypto_sign_PUBLICKEYBYTES);
+  tpdkg_tp_set_bufs(ctx,
+                    (uint8_t (*)[][crypto_core_ristretto255_BYTES]) (base + a.commitments),
+                    (uint32_t (*)[]) (base + a.complaints),
+                    (uint8_t (*)[][tpdkg_encrypted_share_SIZE]) (base + a.encrypted_shares),
+                    (TP_DKG_Cheater (*)[]) (base + a.cheaters), tp_arena_cheater_max(ctx->t),
+                    (uint8_t (*)[][crypto_sign_PUBLICKEYBYTES]) (base + a.peer_sig_pks),
+                    (uint8_t (*)[][crypto_sign_PUBLICKEYBYTES]) (base + a.peer_lt_pks),
+                    (uint64_t*) (base + a.last_ts),
+                    (TP_DKG_Fed*) (base + a.fed));
+  return 0;
+}
+
+void tpdkg_peer_set_workers(TP_DKG_PeerState *ctx, const tpdkg_parallel_fn parallel, void *pool) {
+  ctx->parallel = parallel;
+  ctx->pool = pool;
+}
+
+void tpdkg_tp_set_workers(TP_DKG_TPState *ctx, const tpdkg_parallel_fn parallel, void *pool) {
+  ctx->parallel = parallel;
+  ctx->pool = pool;
+}
+
+int tpdkg_tp_set_metrics(TP_DKG_TPState *ctx, TP_DKG_Metrics *metrics) {
+#ifdef TPDKG_METRICS
+  ctx->metrics = metrics;
+  return 0;
+#else
+  (void) ctx;
+  (void) metrics;
+  return 1;
+#endif
+}
+
+// the transcripts of a dkg and a refresh never match
+static const char *transcript_label(const uint8_t refresh) {
+  return refresh ? "tp dkg refresh transcript" : "tp dkg session transcript";
+}
+
+static int start_tp(TP_DKG_TPState *ctx, const uint64_t ts_epsilon,
+                    const uint16_t n, const uint16_t t,
+                    const char *proto_name, const size_t proto_name_len,
+                    const uint8_t flags,
+                    const uint8_t resume_id[tpdkg_sessionid_SIZE],
+                    const size_t msg0_len, TP_DKG_Message *msg0) {
+  const uint8_t refresh = (flags & tpdkg_REFRESH) != 0;
+  if(log_file!=NULL) fprintf(log_file, "\e[0;33m[!] step 0. start %s\e[0m\n", refresh ? "refresh" : "protocol");
+  if(2>n || t>=n || n>tpdkg_MAX_PEERS) return 1;
   if(proto_name_len<1) return 2;
   if(proto_name_len>1024) return 3;
   if(msg0_len != tpdkg_msg0_SIZE) return 4;
+  if(flags & ~(tpdkg_OPTIMISTIC | tpdkg_REFRESH | tpdkg_RESUME)) return 6;
 
   ctx->ts_epsilon = ts_epsilon;
   ctx->step = 0;
@@ -638,6 +1267,14 @@ int tpdkg_start_tp(TP_DKG_TPState *ctx, const uint64_t ts_epsilon,
   ctx->t = t;
   ctx->complaints_len = 0;
   ctx->cheater_len = 0;
+  ctx->parallel = NULL;
+  ctx->pool = NULL;
+  // set by tpdkg_tp_set_bufs()
+  ctx->fed = NULL;
+  ctx->metrics = NULL;
+  ctx->refresh = refresh;
+  ctx->optimistic = (flags & tpdkg_OPTIMISTIC) != 0;
+  ctx->resume = (flags & tpdkg_RESUME) != 0;
 
   // dst hash(len(protoname) | "DKG for protocol " | protoname)
   crypto_generichash_state dst_state;
@@ -655,45 +1292,91 @@ int tpdkg_start_tp(TP_DKG_TPState *ctx, const uint64_t ts_epsilon,
   // generate signing key for this session
   crypto_sign_keypair(ctx->sig_pk, ctx->sig_sk);
 
-  // data = {tp_sign_pk, dst, sessionid, n, t}
+  // data = {tp_sign_pk, dst, version, n, t, flags, resume_id}, n and t are 16 bits
   uint8_t *ptr = msg0->data;
   memcpy(ptr, ctx->sig_pk, sizeof ctx->sig_pk);
   ptr+=sizeof ctx->sig_pk;
   memcpy(ptr, dst, sizeof dst);
   ptr+=sizeof dst;
-  *ptr++ = n;
-  *ptr++ = t;
+  *ptr++ = tpdkg_VERSION;
+  put16(ptr, n);
+  ptr+=2;
+  put16(ptr, t);
+  ptr+=2;
+  *ptr++ = flags;
+  if(resume_id!=NULL) memcpy(ptr, resume_id, tpdkg_sessionid_SIZE);
+  else memset(ptr, 0, tpdkg_sessionid_SIZE);
 
-  if(0!=send_msg((uint8_t*) msg0, tpdkg_msg0_SIZE, 0, 0, 0xff, ctx->sig_sk, ctx->sessionid)) return 5;
+  if(0!=send_msg((uint8_t*) msg0, tpdkg_msg0_SIZE, 0, 0, tpdkg_BROADCAST, ctx->sig_sk, ctx->sessionid)) return 5;
 
   // init transcript
   crypto_generichash_init(&ctx->transcript, NULL, 0, crypto_generichash_BYTES);
-  crypto_generichash_update(&ctx->transcript, (uint8_t*) "tp dkg session transcript", 25);
+  crypto_generichash_update(&ctx->transcript, (const uint8_t*) transcript_label(refresh), 25);
   // feed msg0 into transcript
   update_transcript(&ctx->transcript, (uint8_t*) msg0, msg0_len);
 
   if(log_file!=NULL) {
-    fprintf(log_file,"[!] msgno: %d, from: %d to: 0x%x ", msg0->msgno, msg0->from, msg0->to);
+    fprintf(log_file,"[!] msgno: %d, from: %d to: 0x%x ", msg0->msgno, ntohs(msg0->from), ntohs(msg0->to));
     dump((uint8_t*) msg0, tpdkg_msg0_SIZE, "msg");
   }
 
   return 0;
 }
 
-int tpdkg_start_peer(TP_DKG_PeerState *ctx, const uint64_t ts_epsilon,
-               const uint8_t peer_lt_sk[crypto_sign_SECRETKEYBYTES],
-               const TP_DKG_Message *msg0) {
+int tpdkg_start_tp_flags(TP_DKG_TPState *ctx, const uint64_t ts_epsilon,
+                         const uint16_t n, const uint16_t t,
+                         const char *proto_name, const size_t proto_name_len,
+                         const uint8_t flags,
+                         const size_t msg0_len, TP_DKG_Message *msg0) {
+  // resuming needs the id of the run to resume
+  if(flags & tpdkg_RESUME) return 6;
+  return start_tp(ctx, ts_epsilon, n, t, proto_name, proto_name_len, flags, NULL, msg0_len, msg0);
+}
+
+int tpdkg_start_tp_resume(TP_DKG_TPState *ctx, const uint64_t ts_epsilon,
+                          const uint16_t n, const uint16_t t,
+                          const char *proto_name, const size_t proto_name_len,
+                          const uint8_t flags,
+                          const uint8_t resume_id[tpdkg_sessionid_SIZE],
+                          const size_t msg0_len, TP_DKG_Message *msg0) {
+  if(resume_id==NULL) return 6;
+  return start_tp(ctx, ts_epsilon, n, t, proto_name, proto_name_len, flags | tpdkg_RESUME, resume_id, msg0_len, msg0);
+}
+
+int tpdkg_start_tp(TP_DKG_TPState *ctx, const uint64_t ts_epsilon,
+             const uint16_t n, const uint16_t t,
+             const char *proto_name, const size_t proto_name_len,
+             const size_t msg0_len, TP_DKG_Message *msg0) {
+  return tpdkg_start_tp_flags(ctx, ts_epsilon, n, t, proto_name, proto_name_len, 0, msg0_len, msg0);
+}
+
+int tpdkg_start_tp_refresh(TP_DKG_TPState *ctx, const uint64_t ts_epsilon,
+                           const uint16_t n, const uint16_t t,
+                           const char *proto_name, const size_t proto_name_len,
+                           const size_t msg0_len, TP_DKG_Message *msg0) {
+  return tpdkg_start_tp_flags(ctx, ts_epsilon, n, t, proto_name, proto_name_len, tpdkg_REFRESH, msg0_len, msg0);
+}
+
+static int start_peer(TP_DKG_PeerState *ctx, const uint64_t ts_epsilon,
+                      const uint8_t peer_lt_sk[crypto_sign_SECRETKEYBYTES],
+                      const TP_DKG_Message *msg0,
+                      const TOPRF_WideShare *share,
+                      const uint8_t *cache, const size_t cache_len) {
   if(log_file!=NULL) fprintf(log_file, "\e[0;33m[?] step 0.5 start peer\e[0m\n");
 
   if(log_file!=NULL) {
-    fprintf(log_file,"[?] msgno: %d, from: %d to: 0x%x ", msg0->msgno, msg0->from, msg0->to);
+    fprintf(log_file,"[?] msgno: %d, from: %d to: 0x%x ", msg0->msgno, ntohs(msg0->from), ntohs(msg0->to));
     dump((uint8_t*) msg0, tpdkg_msg0_SIZE, "msg");
   }
 
   ctx->ts_epsilon = ts_epsilon;
   ctx->tp_last_ts = 0;
+  ctx->metrics = NULL;
+  ctx->parallel = NULL;
+  ctx->pool = NULL;
+  ctx->resume_cache = NULL;
 
-  int ret = recv_msg((uint8_t*) msg0, tpdkg_msg0_SIZE, 0, 0, 0xff, msg0->data, msg0->sessionid, ts_epsilon, &ctx->tp_last_ts);
+  int ret = recv_msg((uint8_t*) msg0, tpdkg_msg0_SIZE, 0, 0, tpdkg_BROADCAST, msg0->data, msg0->sessionid, ts_epsilon, &ctx->tp_last_ts);
   if(0!=ret) return 64 + ret;
 
   // extract data from message
@@ -702,19 +1385,42 @@ int tpdkg_start_peer(TP_DKG_PeerState *ctx, const uint64_t ts_epsilon,
   const uint8_t *ptr=msg0->data;
   memcpy(ctx->tp_sig_pk,ptr,sizeof ctx->tp_sig_pk);
   ptr+=sizeof ctx->tp_sig_pk + crypto_generichash_BYTES; // also skip DST
-  ctx->n = *ptr++;
-  ctx->t = *ptr++;
+  // the n and t of a msg0 without a version are at the place of the
+  // version, and are never 1, so old TPs and peers reject each other
+  if(*ptr++ != tpdkg_VERSION) return 9;
+  ctx->n = get16(ptr);
+  ptr+=2;
+  ctx->t = get16(ptr);
+  ptr+=2;
+  const uint8_t flags = *ptr++;
 
   if(ctx->t < 2) return 1;
   if(ctx->t >= ctx->n) return 2;
-  if(ctx->n > 128) return 3;
+  if(ctx->n > tpdkg_MAX_PEERS) return 3;
+  if(flags & ~(tpdkg_OPTIMISTIC | tpdkg_REFRESH | tpdkg_RESUME)) return 7;
+  ctx->optimistic = (flags & tpdkg_OPTIMISTIC) != 0;
+  ctx->refresh = (flags & tpdkg_REFRESH) != 0;
+  ctx->resume = (flags & tpdkg_RESUME) != 0;
+  // a refresh needs the existing share, a dkg has none
+  if(ctx->refresh != (share!=NULL)) return 6;
+  if(share!=NULL) {
+    if(share->index < 1 || share->index > ctx->n) return 4;
+    memcpy(&ctx->old_share, share, sizeof ctx->old_share);
+  }
+  if(ctx->resume) {
+    // the cache must be saved in the run the tp resumes, the index is checked in step 3
+    if(cache==NULL || cache_len != tpdkg_resume_SIZE(ctx->n)) return 8;
+    if(sodium_memcmp(cache, ptr, tpdkg_sessionid_SIZE)!=0) return 8;
+    if(get16(cache + tpdkg_resume_N) != ctx->n || cache[tpdkg_resume_LEFT] == 0) return 8;
+    ctx->resume_cache = cache;
+  }
 
   ctx->complaints_len = 0;
   ctx->my_complaints_len = 0;
   memcpy(ctx->lt_sk, peer_lt_sk, crypto_sign_SECRETKEYBYTES);
 
   crypto_generichash_init(&ctx->transcript, NULL, 0, crypto_generichash_BYTES);
-  crypto_generichash_update(&ctx->transcript, (uint8_t*) "tp dkg session transcript", 25);
+  crypto_generichash_update(&ctx->transcript, (const uint8_t*) transcript_label(ctx->refresh), 25);
   // feed msg0 into transcript
   update_transcript(&ctx->transcript, (uint8_t*) msg0, tpdkg_msg0_SIZE);
 
@@ -724,17 +1430,39 @@ int tpdkg_start_peer(TP_DKG_PeerState *ctx, const uint64_t ts_epsilon,
   return 0;
 }
 
+int tpdkg_start_peer(TP_DKG_PeerState *ctx, const uint64_t ts_epsilon,
+               const uint8_t peer_lt_sk[crypto_sign_SECRETKEYBYTES],
+               const TP_DKG_Message *msg0) {
+  return start_peer(ctx, ts_epsilon, peer_lt_sk, msg0, NULL, NULL, 0);
+}
+
+int tpdkg_start_peer_refresh(TP_DKG_PeerState *ctx, const uint64_t ts_epsilon,
+                             const uint8_t peer_lt_sk[crypto_sign_SECRETKEYBYTES],
+                             const TP_DKG_Message *msg0,
+                             const TOPRF_WideShare *share) {
+  if(share==NULL) return 5;
+  return start_peer(ctx, ts_epsilon, peer_lt_sk, msg0, share, NULL, 0);
+}
+
+int tpdkg_start_peer_resume(TP_DKG_PeerState *ctx, const uint64_t ts_epsilon,
+                            const uint8_t peer_lt_sk[crypto_sign_SECRETKEYBYTES],
+                            const TP_DKG_Message *msg0,
+                            const TOPRF_WideShare *share,
+                            const uint8_t *cache, const size_t cache_len) {
+  return start_peer(ctx, ts_epsilon, peer_lt_sk, msg0, share, cache, cache_len);
+}
+
 static int tp_step1_handler(TP_DKG_TPState *ctx, const uint8_t *input, const size_t input_len, uint8_t *output, const size_t output_len) {
   if(log_file!=NULL) fprintf(log_file, "\e[0;33m[!] step 1. assign peer indices\e[0m\n");
   if(input_len!=0) return 1;
   if(output_len!=ctx->n * tpdkg_msg1_SIZE) return 2;
 
   uint8_t* ptr = output;
-  for(uint8_t i=1;i<=ctx->n;i++,ptr+=tpdkg_msg1_SIZE) {
+  for(uint16_t i=1;i<=ctx->n;i++,ptr+=tpdkg_msg1_SIZE) {
     if(0!=send_msg(ptr, sizeof(TP_DKG_Message), 1, 0, i, ctx->sig_sk, ctx->sessionid)) return 3;
     if(log_file!=NULL) {
       TP_DKG_Message *msg1 = (TP_DKG_Message*) ptr;
-      fprintf(log_file,"[!] msgno: %d, len: %d, from: %d to: %x ", msg1->msgno, htonl(msg1->len), msg1->from, msg1->to);
+      fprintf(log_file,"[!] msgno: %d, len: %d, from: %d to: %x ", msg1->msgno, htonl(msg1->len), ntohs(msg1->from), ntohs(msg1->to));
       dump(ptr, tpdkg_msg1_SIZE, "msg");
     }
   }
@@ -750,13 +1478,18 @@ static int peer_step23_handler(TP_DKG_PeerState *ctx, const uint8_t *input, cons
 
   TP_DKG_Message *msg1=(TP_DKG_Message*) input;
   if(log_file!=NULL) {
-    fprintf(log_file,"[?] msgno: %d, len: %d, from: %d to: %x ", msg1->msgno, ntohl(msg1->len), msg1->from, msg1->to);
+    fprintf(log_file,"[?] msgno: %d, len: %d, from: %d to: %x ", msg1->msgno, ntohl(msg1->len), ntohs(msg1->from), ntohs(msg1->to));
     dump(input, tpdkg_msg1_SIZE, "msg");
   }
-  int ret = recv_msg(input, tpdkg_msg1_SIZE, 1, 0, msg1->to, ctx->tp_sig_pk, ctx->sessionid, ctx->ts_epsilon, &ctx->tp_last_ts);
+  const uint16_t to = ntohs(msg1->to);
+  int ret = recv_msg(input, tpdkg_msg1_SIZE, 1, 0, to, ctx->tp_sig_pk, ctx->sessionid, ctx->ts_epsilon, &ctx->tp_last_ts);
   if(0!=ret) return 4 + ret;
-  if(msg1->to > 128 || msg1->to < 1) return 3;
-  ctx->index=msg1->to;
+  if(to > ctx->n || to < 1) return 3;
+  // a refresh keeps the indexes of the existing shares
+  if(ctx->refresh && to != ctx->old_share.index) return 3;
+  // and resuming the channels
+  if(ctx->resume && to != get16(ctx->resume_cache + tpdkg_resume_INDEX)) return 3;
+  ctx->index=to;
 
   if(log_file!=NULL) fprintf(log_file, "\e[0;33m[%d] step 3. send msg2 containing ephemeral pubkey\e[0m\n", ctx->index);
 
@@ -769,40 +1502,67 @@ static int peer_step23_handler(TP_DKG_PeerState *ctx, const uint8_t *input, cons
   memcpy(wptr, ctx->sig_pk, sizeof ctx->sig_pk);
   wptr+=sizeof ctx->sig_pk;
   memcpy(wptr, ctx->noise_pk, sizeof ctx->noise_pk);
-  if(0!=send_msg(output, tpdkg_msg2_SIZE, 2, ctx->index, 0xff, ctx->sig_sk, ctx->sessionid)) return 4;
+  if(0!=send_msg(output, tpdkg_msg2_SIZE, 2, ctx->index, tpdkg_BROADCAST, ctx->sig_sk, ctx->sessionid)) return 4;
   // sign message with long-term key
   crypto_sign_detached(output+tpdkg_msg2_SIZE,NULL,output,tpdkg_msg2_SIZE,ctx->lt_sk);
+  METRIC_ADD(sig_sign, 1);
   sodium_memzero(ctx->lt_sk,crypto_sign_SECRETKEYBYTES);
 
   if(log_file!=NULL) {
     TP_DKG_Message *msg2 = (TP_DKG_Message *) output;
-    fprintf(log_file,"[%d] msgno: %d, len: %d, from: %d to: %x ", ctx->index, msg2->msgno, ntohl(msg2->len), msg2->from, msg2->to);
+    fprintf(log_file,"[%d] msgno: %d, len: %d, from: %d to: %x ", ctx->index, msg2->msgno, ntohl(msg2->len), ntohs(msg2->from), ntohs(msg2->to));
     dump(output, tpdkg_msg2_SIZE+crypto_sign_BYTES, "msg");
   }
 
   return 0;
 }
 
+typedef struct {
+  TP_DKG_TPState *ctx;
+  const uint8_t *msg2s;
+  // n items each
+  int *lt_ret;
+  int *ret;
+} TP_Step4Batch;
+
+static void tp_step4_verify(void *arg, const size_t i) {
+  TP_Step4Batch *batch = (TP_Step4Batch*) arg;
+  TP_DKG_TPState *ctx = batch->ctx;
+  const uint8_t *ptr = batch->msg2s + i * (tpdkg_msg2_SIZE+crypto_sign_BYTES);
+  const TP_DKG_Message* msg = (const TP_DKG_Message*) ptr;
+  batch->lt_ret[i] = 0;
+  batch->ret[i] = 0;
+  if(ctx->fed[i].state==1) return;
+#if !defined(FUZZING_BUILD_MODE_UNSAFE_FOR_PRODUCTION)
+  METRIC_ADD(sig_verify, 1);
+  batch->lt_ret[i] = ed25519_verify(ptr+tpdkg_msg2_SIZE,ptr,tpdkg_msg2_SIZE,(*ctx->peer_lt_pks)[i]);
+  if(0!=batch->lt_ret[i]) return;
+#endif
+  batch->ret[i] = recv_msg(ptr, tpdkg_msg2_SIZE, 2, (uint16_t) (i+1), tpdkg_BROADCAST, msg->data, ctx->sessionid, ctx->ts_epsilon, &ctx->last_ts[i]);
+}
+
 static int tp_step4_handler(TP_DKG_TPState *ctx, const uint8_t *msg2s, const size_t msg2s_len, uint8_t *msg3_buf, const size_t msg3_buf_len) {
   if(log_file!=NULL) fprintf(log_file, "\e[0;33m[!] step 4. broadcast msg2 containing ephemeral pubkeys of peers\e[0m\n");
   if(((tpdkg_msg2_SIZE + crypto_sign_BYTES) * ctx->n) != msg2s_len) return 1;
   if(msg3_buf_len != (tpdkg_msg2_SIZE * ctx->n) + sizeof(TP_DKG_Message)) return 2;
 
+  int lt_rets[ctx->n], rets[ctx->n];
+  TP_Step4Batch batch = { .ctx = ctx, .msg2s = msg2s, .lt_ret = lt_rets, .ret = rets };
+  tp_for(ctx, ctx->n, tp_step4_verify, &batch);
+
   const uint8_t *ptr = msg2s;
   uint8_t *wptr = ((TP_DKG_Message *) msg3_buf)->data;
-  for(uint8_t i=0;i<ctx->n;i++,ptr+=tpdkg_msg2_SIZE+crypto_sign_BYTES) {
+  for(uint16_t i=0;i<ctx->n;i++,ptr+=tpdkg_msg2_SIZE+crypto_sign_BYTES) {
     const TP_DKG_Message* msg = (const TP_DKG_Message*) ptr;
     // verify long-term pk sig on initial message
     if(log_file!=NULL) {
-      fprintf(log_file,"[!] msgno: %d, from: %d to: %x ", msg->msgno, msg->from, msg->to);
+      fprintf(log_file,"[!] msgno: %d, from: %d to: %x ", msg->msgno, ntohs(msg->from), ntohs(msg->to));
       dump(ptr, tpdkg_msg2_SIZE, "msg");
     }
-#if !defined(FUZZING_BUILD_MODE_UNSAFE_FOR_PRODUCTION)
-    if(0!=crypto_sign_verify_detached(ptr+tpdkg_msg2_SIZE,ptr,tpdkg_msg2_SIZE,(*ctx->peer_lt_pks)[i])) return 3;
-#endif
-    int ret = recv_msg(ptr, tpdkg_msg2_SIZE, 2, i+1, 0xff, msg->data, ctx->sessionid, ctx->ts_epsilon, &ctx->last_ts[i]);
+    if(0!=batch.lt_ret[i]) return 3;
+    int ret = batch.ret[i];
     if(0!=ret) {
-      if(add_cheater(ctx, 4, 64+ret, i+1,0xff) == NULL) return 7;
+      if(add_cheater(ctx, 4, 64+ret, i+1,0xfffe) == NULL) return 7;
       continue;
     }
 
@@ -814,52 +1574,105 @@ static int tp_step4_handler(TP_DKG_TPState *ctx, const uint8_t *msg2s, const siz
   }
   if(ctx->cheater_len>0) return 6;
 
-  if(0!=send_msg(msg3_buf, msg3_buf_len, 3, 0, 0xff, ctx->sig_sk, ctx->sessionid)) return 5;
+  if(0!=send_msg(msg3_buf, msg3_buf_len, 3, 0, tpdkg_BROADCAST, ctx->sig_sk, ctx->sessionid)) return 5;
   update_transcript(&ctx->transcript, (uint8_t*) msg3_buf, msg3_buf_len);
 
   return 0;
 }
 
+// deals the shares and broadcasts the commitments in msg6
+static int peer_send_commitments(TP_DKG_PeerState *ctx, uint8_t *output) {
+  TP_DKG_Message* msg6 = (TP_DKG_Message*) output;
+  if(ctx->refresh) {
+    if(0!=dkg_wide_start_refresh(ctx->n, ctx->t, (uint8_t (*)[32]) msg6->data, *ctx->shares)) return 4;
+  } else {
+    if(0!=dkg_wide_start(ctx->n, ctx->t, (uint8_t (*)[32]) msg6->data, *ctx->shares)) return 4;
+  }
+  if(0!=send_msg(output, tpdkg_msg6_SIZE(ctx), 6, ctx->index, tpdkg_BROADCAST, ctx->sig_sk, ctx->sessionid)) return 4;
+  if(log_file!=NULL) {
+    fprintf(log_file,"[%d] msgno: %d, from: %d to: 0x%x ", ctx->index, msg6->msgno, ntohs(msg6->from), ntohs(msg6->to));
+    dump(output, tpdkg_msg6_SIZE(ctx), "msg");
+    dump(msg6->data, tpdkg_sent_commitments(ctx)*crypto_core_ristretto255_BYTES, "[%d] commitments", ctx->index);
+  }
+
+  return 0;
+}
+
+static void peer_step5_job(void *arg, const size_t i) {
+  Peer_Jobs *jobs = (Peer_Jobs*) arg;
+  TP_DKG_PeerState *ctx = jobs->ctx;
+  uint8_t *wptr = jobs->output + i * tpdkg_msg4_SIZE;
+  TP_DKG_Message *msg4 = (TP_DKG_Message *) wptr;
+  if(jobs->rets[i]==0) tpdkg_init_noise_handshake(&(*ctx->noise_outs)[i], msg4->data);
+  jobs->rets[i] = send_msg(wptr, tpdkg_msg4_SIZE, 4, ctx->index, (uint16_t) (i+1), ctx->sig_sk, ctx->sessionid);
+}
+
 static int peer_step5_handler(TP_DKG_PeerState *ctx, const uint8_t *input, const size_t input_len, uint8_t *output, const size_t output_len) {
   if(log_file!=NULL) fprintf(log_file, "\e[0;33m[%d] step 5. receive peers ephemeral pubkeys, start noise sessions\e[0m\n", ctx->index);
   if(input_len != tpdkg_msg2_SIZE * ctx->n + sizeof(TP_DKG_Message)) return 1;
-  if(output_len != tpdkg_msg4_SIZE * ctx->n) return 2;
-
-  int ret = recv_msg(input, input_len, 3, 0, 0xff, ctx->tp_sig_pk, ctx->sessionid, ctx->ts_epsilon, &ctx->tp_last_ts);
-  if(0!=ret) return 32+ret;
+  if(output_len != tpdkg_peer_output_size(ctx)) return 2;
 
-  update_transcript(&ctx->transcript, input, input_len);
+  // the peers sign the msg2 with the key it carries
+  uint8_t inner;
+  int ret = peer_recv_broadcast(ctx, input, input_len, 3, 2, tpdkg_msg2_SIZE, NULL, &inner);
+  if(0!=ret) return (inner ? 64 : 32)+ret;
+
+  if(ctx->resume) {
+    if(log_file!=NULL) fprintf(log_file, "\e[0;33m[%d] step 5. resume channels, broadcast commitments\e[0m\n", ctx->index);
+    TP_DKG_Message* msg3 = (TP_DKG_Message*) input;
+    const uint8_t *ptr = msg3->data;
+    for(uint16_t i=0;i<ctx->n;i++,ptr+=tpdkg_msg2_SIZE) {
+      const TP_DKG_Message* msg2 = (const TP_DKG_Message*) ptr;
+      // the noise keys are not used, the channels are authenticated by the cached keys
+      memcpy((*ctx->peer_sig_pks)[i], msg2->data, crypto_sign_PUBLICKEYBYTES);
+      (*ctx->noise_outs)[i] = NULL;
+      (*ctx->noise_ins)[i] = NULL;
+    }
+    ret = peer_send_commitments(ctx, output);
+    if(0!=ret) return ret;
+    ctx->step = 3; // we skip over to step 13
+    return 0;
+  }
 
   // create noise device
   uint8_t iname[13];
-  snprintf((char*) iname, sizeof iname, "dkg peer %02x", ctx->index);
+  // at most tpdkg_MAX_PEERS, so the index has at most 3 hex digits
+  snprintf((char*) iname, sizeof iname, "dkg peer %02x", ctx->index & 0xfff);
   uint8_t dummy[32]={0}; // the following function needs a deserialization key, which we never use.
 
   ctx->dev = Noise_XK_device_create(13, (uint8_t*) "dpkg p2p v0.1", iname, dummy, ctx->noise_sk);
+  // each peer adds all others, index them, the device works the same without
+  if(ctx->dev!=NULL) Noise_XK_device_enable_peer_index(ctx->dev);
 
   TP_DKG_Message* msg3 = (TP_DKG_Message*) input;
   const uint8_t *ptr = msg3->data;
-  uint8_t *wptr = output;
-  for(uint8_t i=0;i<ctx->n;i++) {
+  int rets[ctx->n];
+  for(uint16_t i=0;i<ctx->n;i++) {
     TP_DKG_Message* msg2 = (TP_DKG_Message*) ptr;
     if(log_file!=NULL) {
-      fprintf(log_file,"[%d] msgno: %d, from: %d to: %x ", ctx->index, msg2->msgno, msg2->from, msg2->to);
+      fprintf(log_file,"[%d] msgno: %d, from: %d to: %x ", ctx->index, msg2->msgno, ntohs(msg2->from), ntohs(msg2->to));
       dump(ptr, tpdkg_msg2_SIZE, "msg");
     }
-    ret = recv_msg(ptr, tpdkg_msg2_SIZE, 2, i+1, 0xff, msg2->data, ctx->sessionid, ctx->ts_epsilon, &ctx->last_ts[i]);
-    if(0!=ret) return 64+ret;
     // extract peer sig and noise pk
     memcpy((*ctx->peer_sig_pks)[i], msg2->data, crypto_sign_PUBLICKEYBYTES);
     memcpy((*ctx->peer_noise_pks)[i], msg2->data + crypto_sign_PUBLICKEYBYTES, crypto_scalarmult_BYTES);
     ptr+=tpdkg_msg2_SIZE;
 
-    TP_DKG_Message *msg4 = (TP_DKG_Message *) wptr;
     uint8_t rname[13];
-    snprintf((char*) rname, sizeof rname, "dkg peer %02x", i+1);
-    tpdkg_init_noise_handshake(ctx, (*ctx->peer_noise_pks)[i], rname, &(*ctx->noise_outs)[i], msg4->data);
-    if(0!=send_msg(wptr, tpdkg_msg4_SIZE, 4, ctx->index, i+1, ctx->sig_sk, ctx->sessionid)) return 5;
+    snprintf((char*) rname, sizeof rname, "dkg peer %02x", (i+1) & 0xfff);
+    rets[i] = tpdkg_create_noise_initiator(ctx, (*ctx->peer_noise_pks)[i], rname, &(*ctx->noise_outs)[i]);
+  }
+
+  // the handshakes and signatures only touch their own session and message
+  Peer_Jobs jobs = { .ctx = ctx, .output = output, .rets = rets };
+  peer_for(ctx, ctx->n, peer_step5_job, &jobs);
+
+  uint8_t *wptr = output;
+  for(uint16_t i=0;i<ctx->n;i++) {
+    if(0!=rets[i]) return 5;
+    TP_DKG_Message *msg4 = (TP_DKG_Message *) wptr;
     if(log_file!=NULL) {
-      fprintf(log_file,"[%d] msgno: %d, from: %d to: %d ", ctx->index, msg4->msgno, msg4->from, msg4->to);
+      fprintf(log_file,"[%d] msgno: %d, from: %d to: %d ", ctx->index, msg4->msgno, ntohs(msg4->from), ntohs(msg4->to));
       dump(wptr, tpdkg_msg4_SIZE, "msg");
     }
     wptr+=tpdkg_msg4_SIZE;
@@ -871,31 +1684,62 @@ static int peer_step5_handler(TP_DKG_PeerState *ctx, const uint8_t *input, const
 static int tp_step68_handler(TP_DKG_TPState *ctx, const uint8_t *msg4s, const size_t msg4s_len, uint8_t *output, const size_t output_len) {
   if(log_file!=NULL) fprintf(log_file, "\e[0;33m[!] step %d. route p2p noise handshakes to peers\e[0m\n", 6 + (ctx->step - 1) * 2);
   if(msg4s_len != tpdkg_msg4_SIZE * ctx->n * ctx->n) return 1;
-  if(msg4s_len != output_len) return 2;
+  // without an output the messages are sent from the input, see tpdkg_tp_peer_iov()
+  if(output!=NULL && msg4s_len != output_len) return 2;
+  if(output==NULL && output_len!=0) return 2;
 
   uint8_t (*inputs)[ctx->n][ctx->n][tpdkg_msg4_SIZE] = (uint8_t (*)[ctx->n][ctx->n][tpdkg_msg4_SIZE]) msg4s;
+  if(tpdkg_msg4_SIZE != tpdkg_msg5_SIZE) {
+    if(log_file!=NULL) fprintf(log_file, "tpdkg_msg4_SIZE must be equal tpdkg_msg5_SIZE for the check to be correct in tp_step68_handler\n");
+    return 3;
+  }
+  // n*n messages are too many for the stack
+  TP_Recv (*msgs)[ctx->n] = malloc(sizeof(TP_Recv[ctx->n]) * ctx->n);
+  if(msgs==NULL) return 8;
+  for(uint16_t j=0;j<ctx->n;j++) {
+    for(uint16_t i=0;i<ctx->n;i++) {
+      msgs[j][i] = (TP_Recv) { .msg = (*inputs)[j][i], .len = tpdkg_msg4_SIZE, .msgno = (uint8_t) (2+ctx->step), .to = (uint16_t) (i+1) };
+    }
+  }
+  tp_recv_msgs(ctx, &msgs[0][0], ctx->n);
+
+  int result = 0;
   uint8_t *wptr = output;
-  for(uint8_t i=0;i<ctx->n;i++) {
-    for(uint8_t j=0;j<ctx->n;j++) {
-      if(tpdkg_msg4_SIZE != tpdkg_msg5_SIZE) {
-        if(log_file!=NULL) fprintf(log_file, "tpdkg_msg4_SIZE must be equal tpdkg_msg5_SIZE for the check to be correct in tp_step68_handler\n");
-        return 3;
-      } 
-      int ret = recv_msg((*inputs)[j][i], tpdkg_msg4_SIZE, (uint8_t) (2+ctx->step), j+1, i+1, (*ctx->peer_sig_pks)[j], ctx->sessionid, ctx->ts_epsilon, &ctx->last_ts[j]);
+  for(uint16_t i=0;i<ctx->n;i++) {
+    for(uint16_t j=0;j<ctx->n;j++) {
+      int ret = msgs[j][i].ret;
       if(0!=ret) {
-        if(add_cheater(ctx, 6 + (ctx->step - 1) * 2, 64+ret, j+1, i+1) == NULL) return 7;
+        if(add_cheater(ctx, 6 + (ctx->step - 1) * 2, 64+ret, j+1, i+1) == NULL) {
+          result = 7;
+          goto done;
+        }
         TP_DKG_Message *msg = (TP_DKG_Message*) (*inputs)[j][i];
-        fprintf(log_file,"[x] msgno: %d, from: %d to: %d ", msg->msgno, msg->from, msg->to);
-        dump((*inputs)[j][i], tpdkg_msg4_SIZE, "msg");
+        if(log_file!=NULL) {
+          fprintf(log_file,"[x] msgno: %d, from: %d to: %d ", msg->msgno, ntohs(msg->from), ntohs(msg->to));
+          dump((*inputs)[j][i], tpdkg_msg4_SIZE, "msg");
+        }
         continue;
       }
+      if(output==NULL) continue;
       memcpy(wptr, (*inputs)[j][i], tpdkg_msg4_SIZE);
       wptr+=tpdkg_msg4_SIZE;
     }
   }
-  if(ctx->cheater_len>0) return 6;
+  if(ctx->cheater_len>0) result = 6;
 
-  return 0;
+done:
+  free(msgs);
+  return result;
+}
+
+static void peer_step7_job(void *arg, const size_t i) {
+  Peer_Jobs *jobs = (Peer_Jobs*) arg;
+  TP_DKG_PeerState *ctx = jobs->ctx;
+  TP_DKG_Message* msg4 = (TP_DKG_Message*) (jobs->input + i * tpdkg_msg4_SIZE);
+  uint8_t *wptr = jobs->output + i * tpdkg_msg5_SIZE;
+  TP_DKG_Message *msg5 = (TP_DKG_Message *) wptr;
+  if(jobs->rets[i]==0) tpdkg_respond_noise_handshake(&(*ctx->noise_ins)[i], msg4->data, msg5->data);
+  jobs->rets[i] = send_msg(wptr, tpdkg_msg5_SIZE, 5, ctx->index, (uint16_t) (i+1), ctx->sig_sk, ctx->sessionid);
 }
 
 static int peer_step7_handler(TP_DKG_PeerState *ctx, const uint8_t *input, const size_t input_len, uint8_t *output, const size_t output_len) {
@@ -903,26 +1747,35 @@ static int peer_step7_handler(TP_DKG_PeerState *ctx, const uint8_t *input, const
   if(input_len != tpdkg_msg4_SIZE * ctx->n) return 1;
   if(output_len != tpdkg_msg5_SIZE * ctx->n) return 2;
 
+  uint16_t failed;
+  int ret = recv_msgs(input, tpdkg_msg4_SIZE, ctx->n, 4, ctx->index, *ctx->peer_sig_pks, ctx->sessionid, ctx->ts_epsilon, ctx->last_ts, &failed);
+  if(0!=ret) return 64+ret;
+
   const uint8_t *ptr = input;
-  uint8_t *wptr = output;
-  for(uint8_t i=0;i<ctx->n;i++) {
+  int rets[ctx->n];
+  for(uint16_t i=0;i<ctx->n;i++) {
     TP_DKG_Message* msg4 = (TP_DKG_Message*) ptr;
     if(log_file!=NULL) {
-      fprintf(log_file,"[%d] msgno: %d, from: %d to: %d ", ctx->index, msg4->msgno, msg4->from, msg4->to);
+      fprintf(log_file,"[%d] msgno: %d, from: %d to: %d ", ctx->index, msg4->msgno, ntohs(msg4->from), ntohs(msg4->to));
       dump(ptr, tpdkg_msg4_SIZE, "msg");
     }
-    int ret = recv_msg(ptr, tpdkg_msg4_SIZE, 4, i+1, ctx->index, (*ctx->peer_sig_pks)[i], ctx->sessionid, ctx->ts_epsilon, &ctx->last_ts[i]);
-    if(0!=ret) return 64+ret;
     ptr+=tpdkg_msg4_SIZE;
 
-    // respond to noise handshake request
-    TP_DKG_Message *msg5 = (TP_DKG_Message *) wptr;
     uint8_t rname[13];
-    snprintf((char*) rname, sizeof rname, "dkg peer %02x", i+1);
-    tpdkg_respond_noise_handshake(ctx, (*ctx->peer_noise_pks)[i], rname, &(*ctx->noise_ins)[i], msg4->data, msg5->data);
-    if(0!=send_msg(wptr, tpdkg_msg5_SIZE, 5, ctx->index, i+1, ctx->sig_sk, ctx->sessionid)) return 4;
+    snprintf((char*) rname, sizeof rname, "dkg peer %02x", (i+1) & 0xfff);
+    rets[i] = tpdkg_create_noise_responder(ctx, rname, &(*ctx->noise_ins)[i]);
+  }
+
+  // respond to the noise handshake requests
+  Peer_Jobs jobs = { .ctx = ctx, .input = input, .output = output, .rets = rets };
+  peer_for(ctx, ctx->n, peer_step7_job, &jobs);
+
+  uint8_t *wptr = output;
+  for(uint16_t i=0;i<ctx->n;i++) {
+    if(0!=rets[i]) return 4;
+    TP_DKG_Message *msg5 = (TP_DKG_Message *) wptr;
     if(log_file!=NULL) {
-      fprintf(log_file,"[%d] msgno: %d, from: %d to: %d ", ctx->index, msg5->msgno, msg5->from, msg5->to);
+      fprintf(log_file,"[%d] msgno: %d, from: %d to: %d ", ctx->index, msg5->msgno, ntohs(msg5->from), ntohs(msg5->to));
       dump(wptr, tpdkg_msg5_SIZE, "msg");
     }
     wptr+=tpdkg_msg5_SIZE;
@@ -931,35 +1784,37 @@ static int peer_step7_handler(TP_DKG_PeerState *ctx, const uint8_t *input, const
   return 0;
 }
 
+static void peer_step911_job(void *arg, const size_t i) {
+  Peer_Jobs *jobs = (Peer_Jobs*) arg;
+  TP_DKG_PeerState *ctx = jobs->ctx;
+  TP_DKG_Message* msg5 = (TP_DKG_Message*) (jobs->input + i * tpdkg_msg5_SIZE);
+  tpdkg_finish_noise_handshake(&(*ctx->noise_outs)[i], msg5->data);
+}
+
 static int peer_step911_handler(TP_DKG_PeerState *ctx, const uint8_t *input, const size_t input_len, uint8_t *output, const size_t output_len) {
   if(log_file!=NULL) fprintf(log_file, "\e[0;33m[%d] step 9-11 finish session handshake, broadcast commitments\e[0m\n", ctx->index);
   if(input_len != tpdkg_msg5_SIZE * ctx->n) return 1;
   if(output_len != tpdkg_msg6_SIZE(ctx)) return 2;
 
+  uint16_t failed;
+  int ret = recv_msgs(input, tpdkg_msg5_SIZE, ctx->n, 5, ctx->index, *ctx->peer_sig_pks, ctx->sessionid, ctx->ts_epsilon, ctx->last_ts, &failed);
+  if(0!=ret) return 64+ret;
+
   const uint8_t *ptr = input;
-  for(uint8_t i=0;i<ctx->n;i++) {
+  for(uint16_t i=0;i<ctx->n;i++) {
     TP_DKG_Message* msg5 = (TP_DKG_Message*) ptr;
     if(log_file!=NULL) {
-      fprintf(log_file,"[%d] msgno: %d, from: %d to: %d ", ctx->index, msg5->msgno, msg5->from, msg5->to);
+      fprintf(log_file,"[%d] msgno: %d, from: %d to: %d ", ctx->index, msg5->msgno, ntohs(msg5->from), ntohs(msg5->to));
       dump(ptr, tpdkg_msg5_SIZE, "msg");
     }
-    int ret = recv_msg(ptr, tpdkg_msg5_SIZE, 5, i+1, ctx->index, (*ctx->peer_sig_pks)[i], ctx->sessionid, ctx->ts_epsilon, &ctx->last_ts[i]);
-    if(0!=ret) return 64+ret;
     ptr+=tpdkg_msg5_SIZE;
-    // process final step of noise handshake
-    tpdkg_finish_noise_handshake(ctx, &(*ctx->noise_outs)[i], msg5->data);
+    tpdkg_log_noise_session(ctx, (*ctx->noise_outs)[i]);
   }
+  // process final step of noise handshakes
+  Peer_Jobs jobs = { .ctx = ctx, .input = input };
+  peer_for(ctx, ctx->n, peer_step911_job, &jobs);
 
-  TP_DKG_Message* msg6 = (TP_DKG_Message*) output;
-  if(0!=dkg_start(ctx->n, ctx->t, (uint8_t (*)[32]) msg6->data, *ctx->shares)) return 4;
-  if(0!=send_msg(output, tpdkg_msg6_SIZE(ctx), 6, ctx->index, 0xff, ctx->sig_sk, ctx->sessionid)) return 4;
-  if(log_file!=NULL) {
-    fprintf(log_file,"[%d] msgno: %d, from: %d to: 0x%x ", ctx->index, msg6->msgno, msg6->from, msg6->to);
-    dump(output, tpdkg_msg6_SIZE(ctx), "msg");
-    dump(msg6->data, ctx->t*crypto_core_ristretto255_BYTES, "[%d] commitments", ctx->index);
-  }
-
-  return 0;
+  return peer_send_commitments(ctx, output);
 }
 
 static int tp_step12_handler(TP_DKG_TPState *ctx, const uint8_t *msg6s, const size_t msg6s_len, uint8_t *msg7_buf, const size_t msg7_buf_len) {
@@ -967,21 +1822,29 @@ static int tp_step12_handler(TP_DKG_TPState *ctx, const uint8_t *msg6s, const si
 
   if((tpdkg_msg6_SIZE(ctx) * ctx->n) != msg6s_len) return 1;
   if(msg7_buf_len != sizeof(TP_DKG_Message) + msg6s_len) return 2;
+  TP_Recv msgs[ctx->n];
+  for(uint16_t i=0;i<ctx->n;i++) {
+    msgs[i] = (TP_Recv) { .msg = msg6s + i * tpdkg_msg6_SIZE(ctx), .len = tpdkg_msg6_SIZE(ctx), .msgno = 6, .to = tpdkg_BROADCAST };
+  }
+  tp_recv_msgs(ctx, msgs, 1);
+
   const uint8_t *ptr = msg6s;
   uint8_t *wptr = ((TP_DKG_Message *) msg7_buf)->data;
-  for(uint8_t i=0;i<ctx->n;i++,ptr+=tpdkg_msg6_SIZE(ctx)) {
+  for(uint16_t i=0;i<ctx->n;i++,ptr+=tpdkg_msg6_SIZE(ctx)) {
     const TP_DKG_Message* msg = (const TP_DKG_Message*) ptr;
     if(log_file!=NULL) {
-      fprintf(log_file,"[!] msgno: %d, from: %d to: 0x%x ", msg->msgno, msg->from, msg->to);
+      fprintf(log_file,"[!] msgno: %d, from: %d to: 0x%x ", msg->msgno, ntohs(msg->from), ntohs(msg->to));
       dump(ptr, tpdkg_msg6_SIZE(ctx), "msg");
     }
-    int ret = recv_msg(ptr, tpdkg_msg6_SIZE(ctx), 6, i+1, 0xff, (*ctx->peer_sig_pks)[i], ctx->sessionid, ctx->ts_epsilon, &ctx->last_ts[i]);
+    int ret = msgs[i].ret;
     if(0!=ret) {
-      if(add_cheater(ctx, 12, 64+ret, i+1,0xff) == NULL) return 7;
+      if(add_cheater(ctx, 12, 64+ret, i+1,0xfffe) == NULL) return 7;
       continue;
     }
 
-    memcpy((*ctx->commitments)[i*ctx->t], msg->data, crypto_core_ristretto255_BYTES * ctx->t);
+    // the identity stands in for the commitment a refresh does not send
+    if(ctx->refresh) memset((*ctx->commitments)[i*ctx->t], 0, crypto_core_ristretto255_BYTES);
+    memcpy((*ctx->commitments)[i*ctx->t + ctx->refresh], msg->data, crypto_core_ristretto255_BYTES * tpdkg_sent_commitments(ctx));
     if(log_file!=NULL) {
       dump((*ctx->commitments)[i*ctx->t], crypto_core_ristretto255_BYTES * ctx->t, "[!] commitments[%d]", i+1);
     }
@@ -991,10 +1854,10 @@ static int tp_step12_handler(TP_DKG_TPState *ctx, const uint8_t *msg6s, const si
   }
   if(ctx->cheater_len>0) return 6;
 
-  if(0!=send_msg(msg7_buf, msg7_buf_len, 7, 0, 0xff, ctx->sig_sk, ctx->sessionid)) return 4;
+  if(0!=send_msg(msg7_buf, msg7_buf_len, 7, 0, tpdkg_BROADCAST, ctx->sig_sk, ctx->sessionid)) return 4;
   TP_DKG_Message* msg7 = (TP_DKG_Message*) msg7_buf;
   if(log_file!=NULL) {
-    fprintf(log_file,"[!] msgno: %d, from: %d to: %x ", msg7->msgno, msg7->from, msg7->to);
+    fprintf(log_file,"[!] msgno: %d, from: %d to: %x ", msg7->msgno, ntohs(msg7->from), ntohs(msg7->to));
     dump(msg7_buf, msg7_buf_len, "msg");
   }
 
@@ -1004,6 +1867,55 @@ static int tp_step12_handler(TP_DKG_TPState *ctx, const uint8_t *msg6s, const si
   return 0;
 }
 
+static void peer_step13_job(void *arg, const size_t i) {
+  Peer_Jobs *jobs = (Peer_Jobs*) arg;
+  TP_DKG_PeerState *ctx = jobs->ctx;
+  uint8_t *wptr = jobs->output + i * tpdkg_msg8_SIZE;
+  TP_DKG_Message *msg8 = (TP_DKG_Message *) wptr;
+
+  if(ctx->resume) {
+    // no handshake to finish, the share is wrapped the same way as by
+    // the first noise transport message, so the TP can check it in step 18
+    uint8_t key[tpdkg_noise_key_SIZE];
+    resume_key(ctx, resume_cached(ctx, 0, (uint16_t) i), key);
+    METRIC_ADD(noise_ops, 1);
+    memset(msg8->data, 0, noise_xk_handshake3_SIZE);
+    Noise_XK_aead_encrypt(key, 0, 0, NULL, sizeof(TOPRF_WideShare), (uint8_t*) &jobs->shares[i], msg8->data + noise_xk_handshake3_SIZE);
+    crypto_auth(msg8->data + noise_xk_handshake3_SIZE + sizeof(TOPRF_WideShare) + crypto_secretbox_xchacha20poly1305_MACBYTES,
+                msg8->data + noise_xk_handshake3_SIZE,
+                sizeof(TOPRF_WideShare) + crypto_secretbox_xchacha20poly1305_MACBYTES,
+                key);
+    sodium_memzero(key, sizeof key);
+    jobs->rets[i] = (0!=send_msg(wptr, tpdkg_msg8_SIZE, 8, ctx->index, (uint16_t) (i+1), ctx->sig_sk, ctx->sessionid)) ? 7 : 0;
+    return;
+  }
+
+  // we need to send an empty packet, so that the handshake completes
+  // and we have a final symetric key, the key during the handshake changes, only
+  // when the handshake completes does the key become static.
+  // this is important, so that when there are complaints, we can disclose the key.
+  uint8_t empty[0];
+  if(0!=tpdkg_noise_encrypt(empty, 0, msg8->data, noise_xk_handshake3_SIZE, &(*ctx->noise_outs)[i])) {
+    jobs->rets[i] = 5;
+    return;
+  }
+
+  if(0!=tpdkg_noise_encrypt((uint8_t*) &jobs->shares[i], sizeof(TOPRF_WideShare),
+                            msg8->data + noise_xk_handshake3_SIZE, sizeof(TOPRF_WideShare) + crypto_secretbox_xchacha20poly1305_MACBYTES,
+                            &(*ctx->noise_outs)[i])) {
+    jobs->rets[i] = 6;
+    return;
+  }
+
+  // we also need to use a key-commiting mac over the encrypted share, since poly1305 is not...
+  crypto_auth(msg8->data + noise_xk_handshake3_SIZE + sizeof(TOPRF_WideShare) + crypto_secretbox_xchacha20poly1305_MACBYTES,
+              msg8->data + noise_xk_handshake3_SIZE,
+              sizeof(TOPRF_WideShare) + crypto_secretbox_xchacha20poly1305_MACBYTES,
+              Noise_XK_session_get_key((*ctx->noise_outs)[i]));
+
+  jobs->rets[i] = (0!=send_msg(wptr, tpdkg_msg8_SIZE, 8, ctx->index, (uint16_t) (i+1), ctx->sig_sk, ctx->sessionid)) ? 7 : 0;
+}
+
 static int peer_step13_handler(TP_DKG_PeerState *ctx, const uint8_t *input, const size_t input_len, uint8_t *output, const size_t output_len) {
   if(log_file!=NULL) fprintf(log_file, "\e[0;33m[%d] step 13. receive commitments, distribute shares via noise chans\e[0m\n", ctx->index);
   if(input_len != sizeof(TP_DKG_Message) + (tpdkg_msg6_SIZE(ctx) * ctx->n)) return 1;
@@ -1012,62 +1924,54 @@ static int peer_step13_handler(TP_DKG_PeerState *ctx, const uint8_t *input, cons
   // verify TP message envelope
   TP_DKG_Message* msg7 = (TP_DKG_Message*) input;
   if(log_file!=NULL) {
-    fprintf(log_file,"[%d] msgno: %d, from: %d to: %x ", ctx->index, msg7->msgno, msg7->from, msg7->to);
+    fprintf(log_file,"[%d] msgno: %d, from: %d to: %x ", ctx->index, msg7->msgno, ntohs(msg7->from), ntohs(msg7->to));
     dump(input, input_len, "msg");
   }
-  int ret = recv_msg(input, input_len, 7, 0, 0xff, ctx->tp_sig_pk, ctx->sessionid, ctx->ts_epsilon, &ctx->tp_last_ts);
-  if(0!=ret) return 32+ret;
-
-  // add broadcast msg to transcript
-  update_transcript(&ctx->transcript, input, input_len);
+  // verify the envelopes and add the broadcast msg to the transcript
+  uint8_t inner;
+  int ret = peer_recv_broadcast(ctx, input, input_len, 7, 6, tpdkg_msg6_SIZE(ctx), *ctx->peer_sig_pks, &inner);
+  if(0!=ret) return (inner ? 64 : 32)+ret;
 
   const uint8_t *ptr = msg7->data;
-  uint8_t *wptr = output;
-  for(uint8_t i=0;i<ctx->n;i++, wptr+=tpdkg_msg8_SIZE,ptr+=tpdkg_msg6_SIZE(ctx)) {
+  for(uint16_t i=0;i<ctx->n;i++,ptr+=tpdkg_msg6_SIZE(ctx)) {
     TP_DKG_Message* msg6 = (TP_DKG_Message*) ptr;
     if(log_file!=NULL) {
-      fprintf(log_file,"[%d] msgno: %d, from: %d to: 0x%x ", ctx->index, msg6->msgno, msg6->from, msg6->to);
+      fprintf(log_file,"[%d] msgno: %d, from: %d to: 0x%x ", ctx->index, msg6->msgno, ntohs(msg6->from), ntohs(msg6->to));
       dump(ptr, tpdkg_msg6_SIZE(ctx), "msg");
     }
-    if(0!=recv_msg(ptr, tpdkg_msg6_SIZE(ctx), 6, i+1, 0xff, (*ctx->peer_sig_pks)[i], ctx->sessionid, ctx->ts_epsilon, &ctx->last_ts[i])) return 64+ret;
-    // extract peer commitments
-    memcpy((*ctx->commitments)[i*ctx->t], msg6->data, crypto_core_ristretto255_BYTES * ctx->t);
-
-    TP_DKG_Message *msg8 = (TP_DKG_Message *) wptr;
-
-    // we need to send an empty packet, so that the handshake completes
-    // and we have a final symetric key, the key during the handshake changes, only
-    // when the handshake completes does the key become static.
-    // this is important, so that when there are complaints, we can disclose the key.
-    uint8_t empty[0];
-    if(0!=tpdkg_noise_encrypt(empty, 0, msg8->data, noise_xk_handshake3_SIZE, &(*ctx->noise_outs)[i])) return 5;
+    // extract peer commitments, the identity stands in for the one a refresh does not send
+    if(ctx->refresh) memset((*ctx->commitments)[i*ctx->t], 0, crypto_core_ristretto255_BYTES);
+    memcpy((*ctx->commitments)[i*ctx->t + ctx->refresh], msg6->data, crypto_core_ristretto255_BYTES * tpdkg_sent_commitments(ctx));
+  }
 
+  int rets[ctx->n];
+  Peer_Jobs jobs = { .ctx = ctx, .output = output, .shares = *ctx->shares, .rets = rets };
 #ifdef UNITTEST_CORRUPT
-    // corrupt all shares
-    static int corrupted_shares = 0;
-    uint8_t corrupted_share[sizeof(TOPRF_Share)];
-    memcpy(corrupted_share, &(*ctx->shares)[i], sizeof(TOPRF_Share));
+  // corrupt all shares
+  static int corrupted_shares = 0;
+  TOPRF_WideShare corrupted[ctx->n];
+  memcpy(corrupted, *ctx->shares, sizeof corrupted);
+  for(uint16_t i=0;i<ctx->n;i++) {
+    uint8_t *corrupted_share = (uint8_t*) &corrupted[i];
     if(i+1 != ctx->index && corrupted_shares++ < ctx->t-1) {
-      dump(corrupted_share, sizeof(TOPRF_Share), "[%d] corrupting share_%d", ctx->index, i+1);
+      dump(corrupted_share, sizeof(TOPRF_WideShare), "[%d] corrupting share_%d", ctx->index, i+1);
       corrupted_share[2]^=0xff; // flip some bits
-      dump(corrupted_share, sizeof(TOPRF_Share), "[%d] corrupted share_%d ", ctx->index, i+1);
+      dump(corrupted_share, sizeof(TOPRF_WideShare), "[%d] corrupted share_%d ", ctx->index, i+1);
     }
-    if(0!=tpdkg_noise_encrypt((uint8_t*) corrupted_share, sizeof(TOPRF_Share),
-#else
-    if(0!=tpdkg_noise_encrypt((uint8_t*) &(*ctx->shares)[i], sizeof(TOPRF_Share),
+  }
+  jobs.shares = corrupted;
+#endif // UNITTEST_CORRUPT
+  peer_for(ctx, ctx->n, peer_step13_job, &jobs);
+#ifdef UNITTEST_CORRUPT
+  sodium_memzero(corrupted, sizeof corrupted);
 #endif // UNITTEST_CORRUPT
-                              msg8->data + noise_xk_handshake3_SIZE, sizeof(TOPRF_Share) + crypto_secretbox_xchacha20poly1305_MACBYTES,
-                              &(*ctx->noise_outs)[i])) return 6;
-
-    // we also need to use a key-commiting mac over the encrypted share, since poly1305 is not...
-    crypto_auth(msg8->data + noise_xk_handshake3_SIZE + sizeof(TOPRF_Share) + crypto_secretbox_xchacha20poly1305_MACBYTES,
-                msg8->data + noise_xk_handshake3_SIZE,
-                sizeof(TOPRF_Share) + crypto_secretbox_xchacha20poly1305_MACBYTES,
-                Noise_XK_session_get_key((*ctx->noise_outs)[i]));
 
-    if(0!=send_msg(wptr, tpdkg_msg8_SIZE, 8, ctx->index, i+1, ctx->sig_sk, ctx->sessionid)) return 7;
+  uint8_t *wptr = output;
+  for(uint16_t i=0;i<ctx->n;i++, wptr+=tpdkg_msg8_SIZE) {
+    if(0!=rets[i]) return rets[i];
+    TP_DKG_Message *msg8 = (TP_DKG_Message *) wptr;
     if(log_file!=NULL) {
-      fprintf(log_file,"[%d] msgno: %d, from: %d to: %d ", ctx->index, msg8->msgno, msg8->from, msg8->to);
+      fprintf(log_file,"[%d] msgno: %d, from: %d to: %d ", ctx->index, msg8->msgno, ntohs(msg8->from), ntohs(msg8->to));
       dump(wptr, tpdkg_msg8_SIZE, "msg");
     }
   }
@@ -1075,36 +1979,116 @@ static int peer_step13_handler(TP_DKG_PeerState *ctx, const uint8_t *input, cons
   return 0;
 }
 
+// the encrypted share sent by peer sender+1 to peer recipient+1, which must differ
+static uint8_t* encrypted_share(const TP_DKG_TPState *ctx, const uint16_t sender, const uint16_t recipient) {
+  const size_t idx = (size_t) sender * (size_t) (ctx->n - 1) + (recipient < sender ? recipient : recipient - 1U);
+  return (*ctx->encrypted_shares)[idx];
+}
+
 static int tp_step14_handler(TP_DKG_TPState *ctx, const uint8_t *input, const size_t input_len, uint8_t *output, const size_t output_len) {
   if(log_file!=NULL) fprintf(log_file, "\e[0;33m[!] step 14. route shares from all peers to all peers\e[0m\n");
   if(input_len != tpdkg_msg8_SIZE * ctx->n * ctx->n) return 1;
-  if(input_len != output_len) return 2;
+  if(output!=NULL && input_len != output_len) return 2;
+  if(output==NULL && output_len!=0) return 2;
 
   uint8_t (*inputs)[ctx->n][ctx->n][tpdkg_msg8_SIZE] = (uint8_t (*)[ctx->n][ctx->n][tpdkg_msg8_SIZE]) input;
+  // n*n messages are too many for the stack
+  TP_Recv (*msgs)[ctx->n] = malloc(sizeof(TP_Recv[ctx->n]) * ctx->n);
+  if(msgs==NULL) return 8;
+  for(uint16_t j=0;j<ctx->n;j++) {
+    for(uint16_t i=0;i<ctx->n;i++) {
+      msgs[j][i] = (TP_Recv) { .msg = (*inputs)[j][i], .len = tpdkg_msg8_SIZE, .msgno = 8, .to = (uint16_t) (i+1) };
+    }
+  }
+  tp_recv_msgs(ctx, &msgs[0][0], ctx->n);
+
+  int result = 0;
   uint8_t *wptr = output;
-  for(uint8_t i=0;i<ctx->n;i++) {
-    for(uint8_t j=0;j<ctx->n;j++) {
+  for(uint16_t i=0;i<ctx->n;i++) {
+    for(uint16_t j=0;j<ctx->n;j++) {
       TP_DKG_Message *msg8 = (TP_DKG_Message *) (*inputs)[j][i];
       if(log_file!=NULL) {
-        fprintf(log_file,"[!] msgno: %d, from: %d to: %d ", msg8->msgno, msg8->from, msg8->to);
+        fprintf(log_file,"[!] msgno: %d, from: %d to: %d ", msg8->msgno, ntohs(msg8->from), ntohs(msg8->to));
         dump((*inputs)[j][i], tpdkg_msg8_SIZE, "msg");
       }
-      int ret = recv_msg((*inputs)[j][i], tpdkg_msg8_SIZE, 8, j+1, i+1, (*ctx->peer_sig_pks)[j], ctx->sessionid, ctx->ts_epsilon, &ctx->last_ts[j]);
+      int ret = msgs[j][i].ret;
       if(0!=ret) {
-        if(add_cheater(ctx, 14, 64+ret, j+1, i+1) == NULL) return 7;
+        if(add_cheater(ctx, 14, 64+ret, j+1, i+1) == NULL) {
+          result = 7;
+          goto done;
+        }
         continue;
       }
 
+      if(output==NULL) continue;
       memcpy(wptr, (*inputs)[j][i], tpdkg_msg8_SIZE);
       wptr+=tpdkg_msg8_SIZE;
     }
   }
-  if(ctx->cheater_len>0) return 6;
+  if(ctx->cheater_len>0) {
+    result = 6;
+    goto done;
+  }
+
+  // keep a copy of the encrypted shares for complaint resolution,
+  // the signatures have been verified above.
+  for(uint16_t j=0;j<ctx->n;j++) {
+    for(uint16_t i=0;i<ctx->n;i++) {
+      if(i==j) continue;
+      const TP_DKG_Message *msg8 = (const TP_DKG_Message *) (*inputs)[j][i];
+      memcpy(encrypted_share(ctx, j, i), msg8->data + noise_xk_handshake3_SIZE, tpdkg_encrypted_share_SIZE);
+    }
+  }
 
-  // keep a copy for complaint resolution.
-  memcpy((*ctx->encrypted_shares), input, input_len);
+done:
+  free(msgs);
+  return result;
+}
 
-  return 0;
+static void peer_step15_job(void *arg, const size_t i) {
+  Peer_Jobs *jobs = (Peer_Jobs*) arg;
+  TP_DKG_PeerState *ctx = jobs->ctx;
+  TP_DKG_Message* msg8 = (TP_DKG_Message*) (jobs->input + i * tpdkg_msg8_SIZE);
+
+  if(ctx->resume) {
+    uint8_t key[tpdkg_noise_key_SIZE];
+    resume_key(ctx, resume_cached(ctx, 1, (uint16_t) i), key);
+    METRIC_ADD(noise_ops, 1);
+    jobs->rets[i] = 0;
+    if(0!=crypto_auth_verify(msg8->data + noise_xk_handshake3_SIZE + sizeof(TOPRF_WideShare) + crypto_secretbox_xchacha20poly1305_MACBYTES,
+                             msg8->data + noise_xk_handshake3_SIZE,
+                             sizeof(TOPRF_WideShare) + crypto_secretbox_xchacha20poly1305_MACBYTES,
+                             key)) {
+      jobs->rets[i] = 5;
+    } else if(Noise_XK_CSuccess != Noise_XK_aead_decrypt(key, 0, 0, NULL, sizeof(TOPRF_WideShare), (uint8_t*) &(*ctx->xshares)[i],
+                                                         (uint8_t*) msg8->data + noise_xk_handshake3_SIZE)) {
+      jobs->rets[i] = 6;
+    }
+    sodium_memzero(key, sizeof key);
+    return;
+  }
+
+  // decrypt final empty handshake packet
+  if(0!=tpdkg_noise_decrypt(msg8->data, noise_xk_handshake3_SIZE, NULL, 0, &(*ctx->noise_ins)[i])) {
+    jobs->rets[i] = 4;
+    return;
+  }
+
+  if(0!=crypto_auth_verify(msg8->data + noise_xk_handshake3_SIZE + sizeof(TOPRF_WideShare) + crypto_secretbox_xchacha20poly1305_MACBYTES,
+                           msg8->data + noise_xk_handshake3_SIZE,
+                           sizeof(TOPRF_WideShare) + crypto_secretbox_xchacha20poly1305_MACBYTES,
+                           Noise_XK_session_get_key((*ctx->noise_ins)[i]))) {
+    jobs->rets[i] = 5;
+    return;
+  }
+
+  if(0!=tpdkg_noise_decrypt(msg8->data + noise_xk_handshake3_SIZE, sizeof(TOPRF_WideShare) + crypto_secretbox_xchacha20poly1305_MACBYTES,
+                            (uint8_t*) &(*ctx->xshares)[i], sizeof(TOPRF_WideShare),
+                            &(*ctx->noise_ins)[i])) {
+    jobs->rets[i] = 6;
+    return;
+  }
+  jobs->rets[i] = 0;
 }
 
 static int peer_step15_handler(TP_DKG_PeerState *ctx, const uint8_t *input, const size_t input_len, uint8_t *output, const size_t output_len) {
@@ -1112,63 +2096,63 @@ static int peer_step15_handler(TP_DKG_PeerState *ctx, const uint8_t *input, cons
   if(input_len != ctx->n * tpdkg_msg8_SIZE) return 1;
   if(output_len != tpdkg_msg9_SIZE(ctx)) return 2;
 
+  uint16_t failed;
+  int ret = recv_msgs(input, tpdkg_msg8_SIZE, ctx->n, 8, ctx->index, *ctx->peer_sig_pks, ctx->sessionid, ctx->ts_epsilon, ctx->last_ts, &failed);
+  if(0!=ret) return 64+ret;
+
   const uint8_t *ptr = input;
-  for(uint8_t i=0;i<ctx->n;i++) {
+  for(uint16_t i=0;i<ctx->n;i++) {
     TP_DKG_Message* msg8 = (TP_DKG_Message*) ptr;
     if(log_file!=NULL) {
-      fprintf(log_file,"[%d] msgno: %d, from: %d to: %d ", ctx->index, msg8->msgno, msg8->from, msg8->to);
+      fprintf(log_file,"[%d] msgno: %d, from: %d to: %d ", ctx->index, msg8->msgno, ntohs(msg8->from), ntohs(msg8->to));
       dump(ptr, tpdkg_msg8_SIZE, "msg");
     }
-    int ret = recv_msg(ptr, tpdkg_msg8_SIZE, 8, i+1, ctx->index, (*ctx->peer_sig_pks)[i], ctx->sessionid, ctx->ts_epsilon, &ctx->last_ts[i]);
-    if(0!=ret) return 64+ret;
-
-    // decrypt final empty handshake packet
-    if(0!=tpdkg_noise_decrypt(msg8->data, noise_xk_handshake3_SIZE, NULL, 0, &(*ctx->noise_ins)[i])) return 4;
-
-    if(0!=crypto_auth_verify(msg8->data + noise_xk_handshake3_SIZE + sizeof(TOPRF_Share) + crypto_secretbox_xchacha20poly1305_MACBYTES,
-                             msg8->data + noise_xk_handshake3_SIZE,
-                             sizeof(TOPRF_Share) + crypto_secretbox_xchacha20poly1305_MACBYTES,
-                             Noise_XK_session_get_key((*ctx->noise_ins)[i]))) {
-      return 5;
-    }
-
-    if(0!=tpdkg_noise_decrypt(msg8->data + noise_xk_handshake3_SIZE, sizeof(TOPRF_Share) + crypto_secretbox_xchacha20poly1305_MACBYTES,
-                              (uint8_t*) &(*ctx->xshares)[i], sizeof(TOPRF_Share),
-                              &(*ctx->noise_ins)[i])) return 6;
-
     ptr+=tpdkg_msg8_SIZE;
   }
 
-  TP_DKG_Message* msg9 = (TP_DKG_Message*) output;
-  uint8_t *fails_len = msg9->data;
-  uint8_t *fails = msg9->data+1;
-  memset(fails, 0, ctx->n);
-  dkg_verify_commitments(ctx->n, ctx->t, ctx->index, ctx->commitments, *ctx->xshares, fails, fails_len);
+  int rets[ctx->n];
+  Peer_Jobs jobs = { .ctx = ctx, .input = input, .rets = rets };
+  peer_for(ctx, ctx->n, peer_step15_job, &jobs);
+  for(uint16_t i=0;i<ctx->n;i++) {
+    if(0!=rets[i]) return rets[i];
+  }
+
+  uint16_t fails[ctx->n], fails_len = 0;
+  dkg_wide_verify_commitments_parallel(ctx->n, ctx->t, ctx->index, ctx->commitments, *ctx->xshares, fails, &fails_len, ctx->parallel, ctx->pool);
 
 #ifdef UNITTEST_CORRUPT
   static int totalfails = 0;
-  for(uint8_t i=1;i<=ctx->n;i++) {
-    if(totalfails < ctx->t - ctx->index && *fails_len < ctx->t-1 && i != ctx->index) {
+  for(uint16_t i=1;i<=ctx->n;i++) {
+    if(totalfails < ctx->t - ctx->index && fails_len < ctx->t-1 && i != ctx->index) {
       // avoid duplicates
       int j;
-      for(j=1;j<=msg9->data[0];j++) if(msg9->data[j]==i) break;
-      if(j<=msg9->data[0]) continue;
+      for(j=0;j<fails_len;j++) if(fails[j]==i) break;
+      if(j<fails_len) continue;
 
-      fails[msg9->data[0]++]=i;
+      fails[fails_len++]=i;
       totalfails++;
     }
   }
 #endif //UNITTEST_CORRUPT
 
   if(log_file!=NULL) {
-    for(int j=0;j<*fails_len;j++) {
+    for(int j=0;j<fails_len;j++) {
       fprintf(log_file,"\e[0;31m[%d] failed to verify commitments from %d!\e[0m\n", ctx->index, fails[j]);
     }
   }
 
-  if(0!=send_msg(output, tpdkg_msg9_SIZE(ctx), 9, ctx->index, 0xff, ctx->sig_sk, ctx->sessionid)) return 7;
+  // the number of complaints and the n slots for the accused, all big-endian
+  TP_DKG_Message* msg9 = (TP_DKG_Message*) output;
+  memset(msg9->data, 0, tpdkg_complaints_SIZE(ctx));
+  put16(msg9->data, fails_len);
+  for(uint16_t j=0;j<fails_len;j++) put16(msg9->data + 2 + 2*j, fails[j]);
+
+  // send the transcript along, if there are no complaints this saves the round of step 19
+  if(ctx->optimistic) peek_transcript(&ctx->transcript, msg9->data + tpdkg_complaints_SIZE(ctx));
+
+  if(0!=send_msg(output, tpdkg_msg9_SIZE(ctx), 9, ctx->index, tpdkg_BROADCAST, ctx->sig_sk, ctx->sessionid)) return 7;
   if(log_file!=NULL) {
-    fprintf(log_file,"[%d] msgno: %d, from: %d to: %x ", ctx->index, msg9->msgno, msg9->from, msg9->to);
+    fprintf(log_file,"[%d] msgno: %d, from: %d to: %x ", ctx->index, msg9->msgno, ntohs(msg9->from), ntohs(msg9->to));
     dump(output, tpdkg_msg9_SIZE(ctx), "msg");
   }
 
@@ -1183,63 +2167,91 @@ static int tp_step16_handler(TP_DKG_TPState *ctx, const uint8_t *input, const si
 
   ctx->complaints_len = 0;
 
+  TP_Recv msgs[ctx->n];
+  for(uint16_t i=0;i<ctx->n;i++) {
+    msgs[i] = (TP_Recv) { .msg = input + i * tpdkg_msg9_SIZE(ctx), .len = tpdkg_msg9_SIZE(ctx), .msgno = 9, .to = tpdkg_BROADCAST };
+  }
+  tp_recv_msgs(ctx, msgs, 1);
+
   const uint8_t *ptr = input;
   uint8_t *wptr = ((TP_DKG_Message *) output)->data;
-  for(uint8_t i=0;i<ctx->n;i++, ptr+=tpdkg_msg9_SIZE(ctx)) {
+  for(uint16_t i=0;i<ctx->n;i++, ptr+=tpdkg_msg9_SIZE(ctx)) {
     const TP_DKG_Message* msg = (const TP_DKG_Message*) ptr;
     if(log_file!=NULL) {
-      fprintf(log_file,"[!] msgno: %d, from: %d to: 0x%x ", msg->msgno, msg->from, msg->to);
+      fprintf(log_file,"[!] msgno: %d, from: %d to: 0x%x ", msg->msgno, ntohs(msg->from), ntohs(msg->to));
       dump(ptr, tpdkg_msg9_SIZE(ctx), "msg");
     }
-    int ret = recv_msg(ptr, tpdkg_msg9_SIZE(ctx), 9, i+1, 0xff, (*ctx->peer_sig_pks)[i], ctx->sessionid, ctx->ts_epsilon, &ctx->last_ts[i]);
+    int ret = msgs[i].ret;
     if(0!=ret) {
-      if(add_cheater(ctx, 16, 64+ret, i+1, 0xff) == NULL) return 6;
+      if(add_cheater(ctx, 16, 64+ret, i+1, 0xfffe) == NULL) return 6;
       continue;
     }
-    if(msg->len - sizeof(TP_DKG_Message) < msg->data[0]) return 4;
-
-    // keep a copy all complaint pairs (complainer, complained)
-    for(int k=0;k<msg->data[0] && (k+1)<msg->len-sizeof(TP_DKG_Message);k++) {
-      if(msg->data[k+1] > ctx->n || msg->data[k+1] < 1) {
-        if(add_cheater(ctx, 16, 7, i+1, msg->data[k+1]) == NULL) return 6;
+    // the size of msg9 is fixed, it has room for n complaints
+    const uint16_t count = get16(msg->data);
+    if(count > ctx->n) return 4;
+
+    // keep a copy all complaint pairs (complainer, complained), a
+    // complaint can only be a duplicate of one of the same complainer
+    uint8_t seen[ctx->n];
+    memset(seen, 0, sizeof seen);
+    for(uint16_t k=0;k<count;k++) {
+      const uint16_t accused = get16(msg->data + 2 + 2*k);
+      if(accused > ctx->n || accused < 1 || accused == i+1) {
+        if(add_cheater(ctx, 16, 7, i+1, accused) == NULL) return 6;
         continue;
       }
-      uint16_t pair=(uint16_t) (((i+1)<<8) | msg->data[k+1]);
-      int j=0;
-      for(j=0;j<ctx->complaints_len;j++) if((*ctx->complaints)[j]==pair) break;
-      if(j<ctx->complaints_len) {
-        if(add_cheater(ctx, 16, 8, i+1, msg->data[k+1]) == NULL) return 6;
+      if(seen[accused-1]) {
+        if(add_cheater(ctx, 16, 8, i+1, accused) == NULL) return 6;
         continue;
       }
-      (*ctx->complaints)[ctx->complaints_len++] = pair;
+      seen[accused-1] = 1;
+      (*ctx->complaints)[ctx->complaints_len++] = ((uint32_t) (i+1) << 16) | accused;
       if(log_file!=NULL) {
-        fprintf(log_file,"\e[0;31m[!] peer %d failed to verify commitments from peer %d!\e[0m\n", i+1, msg->data[1+k]);
+        fprintf(log_file,"\e[0;31m[!] peer %d failed to verify commitments from peer %d!\e[0m\n", i+1, accused);
       }
     }
 
     memcpy(wptr, ptr, tpdkg_msg9_SIZE(ctx));
     wptr+=tpdkg_msg9_SIZE(ctx);
   }
-  dump((uint8_t*) (*ctx->complaints), ctx->complaints_len*sizeof(uint16_t), "[!] complaints");
+  dump((uint8_t*) (*ctx->complaints), ctx->complaints_len*sizeof(uint32_t), "[!] complaints");
 
   // if more than t^2 complaints are received the protocol also fails
   if(ctx->complaints_len >= ctx->t * ctx->t) {
-    if(add_cheater(ctx, 16, 6, 0xfe, 0xfe) == NULL) return 6;
+    if(add_cheater(ctx, 16, 6, 0xfffe, 0xfffe) == NULL) return 6;
     return 5;
   }
 
   if(ctx->cheater_len>0) return 5;
 
-  if(0!=send_msg(output, output_len, 10, 0, 0xff, ctx->sig_sk, ctx->sessionid)) return 7;
+  if(0!=send_msg(output, output_len, 10, 0, tpdkg_BROADCAST, ctx->sig_sk, ctx->sessionid)) return 7;
   TP_DKG_Message* msg10 = (TP_DKG_Message*) output;
   if(log_file!=NULL) {
-    fprintf(log_file,"[!] msgno: %d, from: %d to: %x ", msg10->msgno, msg10->from, msg10->to);
+    fprintf(log_file,"[!] msgno: %d, from: %d to: %x ", msg10->msgno, ntohs(msg10->from), ntohs(msg10->to));
     dump(output, output_len, "msg");
   }
 
+  // without complaints, the transcripts sent along in optimistic mode
+  // are checked here instead of in step 20, the peers check them too
+  if(ctx->optimistic && ctx->complaints_len == 0) {
+    uint8_t transcript_hash[crypto_generichash_BYTES];
+    peek_transcript(&ctx->transcript, transcript_hash);
+    ptr = input;
+    for(uint16_t i=0;i<ctx->n;i++, ptr+=tpdkg_msg9_SIZE(ctx)) {
+      const TP_DKG_Message* msg = (const TP_DKG_Message*) ptr;
+      if(sodium_memcmp(transcript_hash, msg->data + tpdkg_complaints_SIZE(ctx), sizeof(transcript_hash))!=0) {
+        if(log_file!=NULL) {
+          fprintf(log_file,"\e[0;31m[!] failed to verify transcript from %d!\e[0m\n", i);
+        }
+        if(add_cheater(ctx, 20, 1, i+1, 0) == NULL) return 6;
+      }
+    }
+  }
+
   // add broadcast msg to transcript
   update_transcript(&ctx->transcript, (uint8_t*) output, output_len);
 
+  if(ctx->cheater_len > 0) return 3;
   return 0;
 }
 
@@ -1251,38 +2263,42 @@ static int peer_step17_handler(TP_DKG_PeerState *ctx, const uint8_t *input, cons
   // verify TP message envelope
   TP_DKG_Message* msg10 = (TP_DKG_Message*) input;
   if(log_file!=NULL) {
-    fprintf(log_file,"[%d] msgno: %d, from: %d to: %x ", ctx->index, msg10->msgno, msg10->from, msg10->to);
+    fprintf(log_file,"[%d] msgno: %d, from: %d to: %x ", ctx->index, msg10->msgno, ntohs(msg10->from), ntohs(msg10->to));
     dump(input, input_len, "msg");
   }
 
-  int ret = recv_msg(input, input_len, 10, 0, 0xff, ctx->tp_sig_pk, ctx->sessionid, ctx->ts_epsilon, &ctx->tp_last_ts);
-  if(0!=ret) return 16+ret;
+  // the transcript the peers sent along with their complaints in optimistic mode
+  uint8_t transcript_hash[crypto_generichash_BYTES];
+  if(ctx->optimistic) peek_transcript(&ctx->transcript, transcript_hash);
 
-  // add broadcast msg to transcript
-  update_transcript(&ctx->transcript, input, input_len);
+  // verify the envelopes and add the broadcast msg to the transcript
+  uint8_t inner;
+  int ret = peer_recv_broadcast(ctx, input, input_len, 10, 9, tpdkg_msg9_SIZE(ctx), *ctx->peer_sig_pks, &inner);
+  if(0!=ret) return (inner ? 32 : 16)+ret;
 
   const uint8_t *ptr = msg10->data;
-  for(uint8_t i=0;i<ctx->n;i++) {
+  for(uint16_t i=0;i<ctx->n;i++) {
     TP_DKG_Message* msg9 = (TP_DKG_Message*) ptr;
     if(log_file!=NULL) {
-      fprintf(log_file,"[%d] msgno: %d, from: %d to: 0x%x ", ctx->index, msg9->msgno, msg9->from, msg9->to);
+      fprintf(log_file,"[%d] msgno: %d, from: %d to: 0x%x ", ctx->index, msg9->msgno, ntohs(msg9->from), ntohs(msg9->to));
       dump(ptr, tpdkg_msg9_SIZE(ctx), "msg");
     }
-    ret = recv_msg(ptr, tpdkg_msg9_SIZE(ctx), 9, i+1, 0xff, (*ctx->peer_sig_pks)[i], ctx->sessionid, ctx->ts_epsilon, &ctx->last_ts[i]);
-    if(0!=ret) return 32+ret;
-    if(msg9->len - sizeof(TP_DKG_Message) < msg9->data[0]) return 5;
+    const uint16_t count = get16(msg9->data);
+    if(count > ctx->n) return 5;
 
     // keep a copy all complaint pairs (complainer, complained)
-    for(int k=0;k<msg9->data[0] && (k+1)<msg9->len-sizeof(TP_DKG_Message);k++) {
-      uint16_t pair=(uint16_t) (((i+1)<<8) | msg9->data[k+1]);
-      int j=0;
-      for(j=0;j<ctx->complaints_len;j++) if(ctx->complaints[j]==pair) break;
-      if(j<ctx->complaints_len) continue;
-      ctx->complaints[ctx->complaints_len++] = pair;
-
-      if(msg9->data[k+1] == ctx->index) {
-        ctx->my_complaints[ctx->my_complaints_len++] = i+1;
-        if(log_file!=NULL) fprintf(log_file,"\e[0;31m[%d] peer %d failed to verify commitments from peer %d!\e[0m\n", ctx->index, i+1, msg9->data[1+k]);
+    uint8_t seen[ctx->n];
+    memset(seen, 0, sizeof seen);
+    for(uint16_t k=0;k<count;k++) {
+      const uint16_t accused = get16(msg9->data + 2 + 2*k);
+      if(accused > ctx->n || accused < 1) return 5;
+      if(seen[accused-1]) continue;
+      seen[accused-1] = 1;
+      ctx->complaints[ctx->complaints_len++] = ((uint32_t) (i+1) << 16) | accused;
+
+      if(accused == ctx->index) {
+        ctx->my_complaints[ctx->my_complaints_len++] = (uint16_t) (i+1);
+        if(log_file!=NULL) fprintf(log_file,"\e[0;31m[%d] peer %d failed to verify commitments from peer %d!\e[0m\n", ctx->index, i+1, accused);
       }
     }
 
@@ -1290,8 +2306,19 @@ static int peer_step17_handler(TP_DKG_PeerState *ctx, const uint8_t *input, cons
   }
 
   if(ctx->complaints_len == 0) {
+    if(ctx->optimistic) {
+      // all peers must have seen the same, otherwise the TP also fails in step 16
+      ptr = msg10->data;
+      for(uint16_t i=0;i<ctx->n;i++, ptr+=tpdkg_msg9_SIZE(ctx)) {
+        const TP_DKG_Message* msg9 = (const TP_DKG_Message*) ptr;
+        if(sodium_memcmp(transcript_hash, msg9->data + tpdkg_complaints_SIZE(ctx), sizeof transcript_hash)!=0) {
+          if(log_file!=NULL) fprintf(log_file,"\e[0;31m[%d] failed to verify transcript from %d!\e[0m\n", ctx->index, i+1);
+          return 6;
+        }
+      }
+    }
     ctx->prev = ctx->step;
-    ctx->step+=1; // skip to step 19
+    ctx->step+=1; // skip to step 19, or in optimistic mode to the final ack
   }
 
   return 0;
@@ -1314,15 +2341,17 @@ static int peer_step17a_handler(TP_DKG_PeerState *ctx, const uint8_t *input, con
   for(int i=0;i<ctx->my_complaints_len;i++) {
     if(log_file!=NULL) fprintf(log_file, "\e[0;36m[%d] defending against complaint from %d\e[0m\n", ctx->index, ctx->my_complaints[i]);
 
-    *wptr++ = ctx->my_complaints[i];
+    put16(wptr, ctx->my_complaints[i]);
+    wptr+=2;
     // reveal key for noise wrapped share sent previously
-    memcpy(wptr, Noise_XK_session_get_key((*ctx->noise_outs)[ctx->my_complaints[i]-1]), tpdkg_noise_key_SIZE);
+    if(ctx->resume) resume_key(ctx, resume_cached(ctx, 0, (uint16_t) (ctx->my_complaints[i]-1)), wptr);
+    else memcpy(wptr, Noise_XK_session_get_key((*ctx->noise_outs)[ctx->my_complaints[i]-1]), tpdkg_noise_key_SIZE);
     wptr+=tpdkg_noise_key_SIZE;
   }
 
   if(0!=send_msg(output, tpdkg_peer_output_size(ctx), 11, ctx->index, 0x0, ctx->sig_sk, ctx->sessionid)) return 3;
   if(log_file!=NULL) {
-    fprintf(log_file,"[%d] msgno: %d, from: %d to: %x ", ctx->index, msg11->msgno, msg11->from, msg11->to);
+    fprintf(log_file,"[%d] msgno: %d, from: %d to: %x ", ctx->index, msg11->msgno, ntohs(msg11->from), ntohs(msg11->to));
     dump(output, tpdkg_peer_output_size(ctx), "msg");
   }
 
@@ -1332,139 +2361,200 @@ static int peer_step17a_handler(TP_DKG_PeerState *ctx, const uint8_t *input, con
   return 0;
 }
 
+// the outcome of verifying one revealed key in step 18
+typedef struct {
+  uint16_t complainer;
+  // the error code of the cheater entry for this key
+  int error;
+  TOPRF_WideShare share;
+} TP_Step18Key;
+
+typedef struct {
+  TP_DKG_TPState *ctx;
+  // all of the following have n entries
+  const uint8_t **msgs;
+  size_t *msg_lens;
+  unsigned int *ctr;
+  int *ret;
+  // keys[offsets[i]..offsets[i]+ctr[i]] are revealed by peer i+1
+  size_t *offsets;
+  TP_Step18Key *keys;
+} TP_Step18Batch;
+
+static int is_complaint(const TP_DKG_TPState *ctx, const uint16_t complainer, const uint16_t accused) {
+  const uint32_t pair = ((uint32_t) complainer << 16) | accused;
+  for(int j=0;j<ctx->complaints_len;j++) {
+    if((*ctx->complaints)[j] == pair) return 1;
+  }
+  return 0;
+}
+
+static void tp_step18_verify(void *arg, const size_t i) {
+  TP_Step18Batch *batch = (TP_Step18Batch*) arg;
+  TP_DKG_TPState *ctx = batch->ctx;
+  if(batch->ctr[i]==0) return;
+
+  if(ctx->fed[i].state!=1) {
+    batch->ret[i] = recv_msg(batch->msgs[i], batch->msg_lens[i], 11, (uint16_t) (i+1), 0, (*ctx->peer_sig_pks)[i], ctx->sessionid, ctx->ts_epsilon, &ctx->last_ts[i]);
+    if(0!=batch->ret[i]) return;
+  }
+
+  const TP_DKG_Message* msg = (const TP_DKG_Message*) batch->msgs[i];
+  const uint8_t *keyptr = msg->data;
+  for(unsigned int k=0;k<batch->ctr[i];k++,keyptr+=tpdkg_noise_key_SIZE) {
+    TP_Step18Key *key = &batch->keys[batch->offsets[i]+k];
+    const uint16_t complainer = get16(keyptr);
+    keyptr+=2;
+    const uint16_t accused = ntohs(msg->from);
+    key->complainer = complainer;
+    // keys that have not been complained about are reported when
+    // collecting the results, and must not be used to index the
+    // encrypted shares. complaints are never about the complainer itself.
+    if(!is_complaint(ctx, complainer, accused)) continue;
+
+    // the msg8 carrying this share has already been verified in step 14
+    const uint8_t *eshare = encrypted_share(ctx, (uint16_t) (accused-1), (uint16_t) (complainer-1));
+    if(log_file!=NULL) {
+      dump(eshare, tpdkg_encrypted_share_SIZE, "[!] encrypted share_%d,%d", accused, complainer);
+    }
+#ifdef UNITTEST
+    dump(keyptr, tpdkg_noise_key_SIZE, "[!] key_%d,%d", accused, complainer);
+#endif //UNITTEST
+
+    // verify key committing hmac first!
+#if !defined(FUZZING_BUILD_MODE_UNSAFE_FOR_PRODUCTION)
+    if(0!=crypto_auth_verify(eshare + sizeof(TOPRF_WideShare) + crypto_secretbox_xchacha20poly1305_MACBYTES,
+                             eshare,
+                             sizeof(TOPRF_WideShare) + crypto_secretbox_xchacha20poly1305_MACBYTES,
+                             keyptr)) {
+      // failed to verify KC MAC on message
+      key->error = 3;
+      continue;
+    }
+#endif
+
+    Noise_XK_error_code
+      res0 = Noise_XK_aead_decrypt((uint8_t*)keyptr, 0, (uint32_t)0U, NULL, sizeof(key->share), (uint8_t*) &key->share, (uint8_t*) eshare);
+    if (!(res0 == Noise_XK_CSuccess)) {
+      // share decryption failure
+      key->error = 4;
+      continue;
+    }
+
+    if(key->share.index != complainer) {
+      // invalid share index
+      key->error = 5;
+      continue;
+    }
+
+    if(log_file!=NULL) {
+      fprintf(log_file, "[!] checking proof of peer %d for complaint by peer %d\n", accused, key->share.index);
+      dump((void*) &key->share, sizeof(TOPRF_WideShare), "[!] share_%d,%d", accused, key->share.index);
+      dump((*ctx->commitments)[(accused-1) * ctx->t], ctx->t * crypto_core_ristretto255_BYTES, "[!] commitments_%d", accused);
+    }
+    const int ret = dkg_wide_verify_commitment(ctx->n, ctx->t,
+                                               key->share.index,
+                                               accused,
+                                               (const uint8_t (*)[crypto_core_ristretto255_BYTES]) (*ctx->commitments)[(accused-1) * ctx->t],
+                                               key->share);
+    key->error = 128+ret;
+  }
+}
+
 static int tp_step18_handler(TP_DKG_TPState *ctx, const uint8_t *input, const size_t input_len, uint8_t *output, const size_t output_len) {
   if(log_file!=NULL) fprintf(log_file, "\e[0;33m[!] step 18. collect keys of contested shares and verify the commitments\e[0m\n");
   if(input_len != tpdkg_tp_input_size(ctx)) return 1;
   if(output_len != 0) return 2;
 
+  // there can be up to n*(n-1) complaints, too many for the stack
+  TP_Step18Key *keys = calloc(ctx->complaints_len, sizeof(TP_Step18Key));
+  uint32_t *complaints = malloc(ctx->complaints_len * sizeof(uint32_t));
+  if(keys == NULL || complaints == NULL) {
+    free(keys);
+    free(complaints);
+    return 5;
+  }
+  const uint8_t *msgs[ctx->n];
+  size_t msg_lens[ctx->n], offsets[ctx->n];
   unsigned int ctr[ctx->n];
-  uint16_t complaints[ctx->complaints_len];
-  memset(ctr,0,sizeof(ctr));
+  int rets[ctx->n];
+  memset(ctr, 0, sizeof ctr);
+  memset(rets, 0, sizeof rets);
+  TP_Step18Batch batch = { .ctx = ctx, .msgs = msgs, .msg_lens = msg_lens, .ctr = ctr, .ret = rets, .offsets = offsets, .keys = keys };
   for(int i=0;i<ctx->complaints_len;i++) {
-    ctr[((*ctx->complaints)[i] & 0xff)-1]++;
+    batch.ctr[((*ctx->complaints)[i] & 0xffff)-1]++;
     complaints[i] = (*ctx->complaints)[i];
   }
 
-  uint8_t (*noisy_shares)[ctx->n][ctx->n][tpdkg_msg8_SIZE] = (uint8_t (*)[ctx->n][ctx->n][tpdkg_msg8_SIZE]) ctx->encrypted_shares;
-
   const uint8_t *ptr = input;
-  size_t msg_len;
-  for(uint8_t i=0;i<ctx->n;i++,ptr += msg_len) {
-    if(ctr[i]==0) {
-      msg_len = 0;
-      continue; // no complaints against this peer
-    }
-    msg_len = sizeof(TP_DKG_Message) + (1+tpdkg_noise_key_SIZE) * ctr[i];
+  size_t offset = 0;
+  for(uint16_t i=0;i<ctx->n;i++) {
+    batch.msgs[i] = ptr;
+    batch.msg_lens[i] = 0;
+    batch.offsets[i] = offset;
+    if(batch.ctr[i]==0) continue; // no complaints against this peer
+    batch.msg_lens[i] = sizeof(TP_DKG_Message) + tpdkg_key_reveal_SIZE * batch.ctr[i];
+    ptr += batch.msg_lens[i];
+    offset += batch.ctr[i];
+  }
 
-    const TP_DKG_Message* msg = (const TP_DKG_Message*) ptr;
+  // verify all proofs, the results are collected in order below
+  tp_for(ctx, ctx->n, tp_step18_verify, &batch);
+
+  int result = 3;
+  for(uint16_t i=0;i<ctx->n;i++) {
+    if(batch.ctr[i]==0) continue;
+
+    const TP_DKG_Message* msg = (const TP_DKG_Message*) batch.msgs[i];
     if(log_file!=NULL) {
-      fprintf(log_file,"[!] msgno: %d, from: %d to: 0x%x ", msg->msgno, msg->from, msg->to);
-      dump(ptr, msg_len, "msg");
+      fprintf(log_file,"[!] msgno: %d, from: %d to: 0x%x ", msg->msgno, ntohs(msg->from), ntohs(msg->to));
+      dump(batch.msgs[i], batch.msg_lens[i], "msg");
     }
-    int ret = recv_msg(ptr, msg_len, 11, i+1, 0, (*ctx->peer_sig_pks)[i], ctx->sessionid, ctx->ts_epsilon, &ctx->last_ts[i]);
-    if(0!=ret) {
-      if(add_cheater(ctx, 18, 32+ret, i+1, 0xfe) == NULL) return 4;
+    if(0!=batch.ret[i]) {
+      if(add_cheater(ctx, 18, 32+batch.ret[i], i+1, 0xfffe) == NULL) { result = 4; goto done; }
       continue;
     }
 
-    // verify proofs
-    const uint8_t *keyptr = msg->data;
-    for(int k=0;k<ctr[i];k++,keyptr+=tpdkg_noise_key_SIZE) {
-      TOPRF_Share share;
-
-      const uint8_t complainer = *keyptr++;
-      const uint8_t accused = msg->from;
+    for(unsigned int k=0;k<batch.ctr[i];k++) {
+      const TP_Step18Key *key = &keys[batch.offsets[i]+k];
+      const uint16_t complainer = key->complainer;
+      const uint16_t accused = ntohs(msg->from);
+      const uint32_t pair = ((uint32_t) complainer << 16) | accused;
 
       int j;
       for(j=0;j<ctx->complaints_len;j++) {
-        if(complaints[j] == (((complainer)<<8) | accused)) {
-          complaints[j]=0xffff;
+        if(complaints[j] == pair) {
+          complaints[j]=0xffffffff;
           break;
         }
       }
       if(j==ctx->complaints_len) {
         // accused revealed a key that was not complained about
-        if(add_cheater(ctx, 18, 6, accused, complainer) == NULL) return 4;
+        if(add_cheater(ctx, 18, 6, accused, complainer) == NULL) { result = 4; goto done; }
         continue;
       }
 
-      uint8_t *msg8_ptr = (*noisy_shares)[accused-1][complainer-1];
-      const TP_DKG_Message *msg8 = (const TP_DKG_Message *) msg8_ptr;
-      if(log_file!=NULL) {
-        fprintf(log_file,"[!] msgno: %d, from: %d to: %d ", msg8->msgno, msg8->from, msg8->to);
-        dump(msg8_ptr, tpdkg_msg8_SIZE, "msg");
-      }
-      uint64_t last_ts = ntohll(msg8->ts);
-      ret = recv_msg(msg8_ptr, tpdkg_msg8_SIZE, 8,
-                     accused, complainer,
-                     (*ctx->peer_sig_pks)[accused-1], ctx->sessionid,
-                     ctx->ts_epsilon, &last_ts);
-      if(0!=ret) {
-        // key reveal msg_recv failure
-        if(add_cheater(ctx, 18, 16+ret, accused, complainer) == NULL) return 4;
+      TP_DKG_Cheater *cheater = add_cheater(ctx, 18, key->error, accused, complainer);
+      if(cheater == NULL) { result = 4; goto done; }
+      if(key->error == 5) {
+        cheater->invalid_index = key->share.index;
         continue;
       }
-#ifdef UNITTEST
-      dump(keyptr, tpdkg_noise_key_SIZE, "[!] key_%d,%d", accused, complainer);
-#endif //UNITTEST
 
-      // verify key committing hmac first!
-#if !defined(FUZZING_BUILD_MODE_UNSAFE_FOR_PRODUCTION)
-      if(0!=crypto_auth_verify(msg8->data + noise_xk_handshake3_SIZE + sizeof(TOPRF_Share) + crypto_secretbox_xchacha20poly1305_MACBYTES,
-                               msg8->data + noise_xk_handshake3_SIZE,
-                               sizeof(TOPRF_Share) + crypto_secretbox_xchacha20poly1305_MACBYTES,
-                               keyptr)) {
-        // failed to verify KC MAC on message
-        if(add_cheater(ctx, 18, 3, accused, complainer) == NULL) return 4;
-        continue;
-      }
-#endif
-
-      Noise_XK_error_code
-        res0 = Noise_XK_aead_decrypt((uint8_t*)keyptr, 0, (uint32_t)0U, NULL, sizeof(share), (uint8_t*) &share, (uint8_t*) msg8->data + noise_xk_handshake3_SIZE);
-      if (!(res0 == Noise_XK_CSuccess)) {
-        // share decryption failure
-        if(add_cheater(ctx, 18, 4, accused, complainer) == NULL) return 4;
-        continue;
-      }
-
-      if(share.index != complainer) {
-        // invalid share index
-        TP_DKG_Cheater *cheater = add_cheater(ctx, 18, 5, accused, complainer);
-        if(cheater == NULL) return 4;
-        cheater->invalid_index = share.index;
-        continue;
-      }
-
-      if(log_file!=NULL) {
-        fprintf(log_file, "[!] checking proof of peer %d for complaint by peer %d\n", msg->from, share.index);
-        dump((void*) &share, sizeof(TOPRF_Share), "[!] share_%d,%d", msg->from, share.index);
-        dump((*ctx->commitments)[(msg->from-1) * ctx->t], ctx->t * crypto_core_ristretto255_BYTES, "[!] commitments_%d", msg->from);
-      }
-      ret = dkg_verify_commitment(ctx->n, ctx->t,
-                                  share.index,
-                                  msg->from,
-                                  (const uint8_t (*)[crypto_core_ristretto255_BYTES]) (*ctx->commitments)[(msg->from-1) * ctx->t],
-                                  share);
-      switch(ret) {
-      case 0: {
+      switch(key->error) {
+      case 128: {
         // verified correctly
-        if(log_file!=NULL) fprintf(log_file, "\e[0;32m[!] complaint against %d by %d invalid, proof correct\e[0m\n", msg->from, share.index);
-
-        if(add_cheater(ctx, 18, 128+ret, accused, complainer) == NULL) return 4;
+        if(log_file!=NULL) fprintf(log_file, "\e[0;32m[!] complaint against %d by %d invalid, proof correct\e[0m\n", accused, key->share.index);
         break;
       }
-      case 1: {
+      case 129: {
         // confirmed corrupt
-        if(log_file!=NULL) fprintf(log_file, "\e[0;31m[!] complaint against %d by %d valid, proof incorrect\e[0m\n", msg->from, share.index);
-        if(add_cheater(ctx, 18, 128+ret, accused, complainer) == NULL) return 4;
+        if(log_file!=NULL) fprintf(log_file, "\e[0;31m[!] complaint against %d by %d valid, proof incorrect\e[0m\n", accused, key->share.index);
         break;
       }
-      case -1: {
+      case 127: {
         // invalid input
-        if(log_file!=NULL) fprintf(log_file, "\e[0;31m[!] complaint against %d by %d, cannot be verified, invalid input\e[0m\n", msg->from, share.index);
-
-        if(add_cheater(ctx, 18, 128+ret, accused, complainer) == NULL) return 4;
+        if(log_file!=NULL) fprintf(log_file, "\e[0;31m[!] complaint against %d by %d, cannot be verified, invalid input\e[0m\n", accused, key->share.index);
         break;
       }
       }
@@ -1472,17 +2562,49 @@ static int tp_step18_handler(TP_DKG_TPState *ctx, const uint8_t *input, const si
   }
 
   for(int i=0;i<ctx->complaints_len;i++) {
-    if(complaints[i] != 0xffff) {
-      if(add_cheater(ctx, 18, 7, (uint8_t) (complaints[i] >> 8), (uint8_t) (complaints[i] & 0xff)) == NULL) return 4;
+    if(complaints[i] != 0xffffffff) {
+      if(add_cheater(ctx, 18, 7, (uint16_t) (complaints[i] >> 16), (uint16_t) (complaints[i] & 0xffff)) == NULL) { result = 4; goto done; }
     }
   }
 
   ctx->step=99; // we skip to the end
 
-  return 3;
+done:
+  sodium_memzero(keys, ctx->complaints_len * sizeof(TP_Step18Key));
+  free(keys);
+  free(complaints);
+  return result;
+}
+
+// calculates the final share and acknowledges it to the TP
+static int peer_finish(TP_DKG_PeerState *ctx, uint8_t *output) {
+  ctx->share.index=ctx->index;
+  if(ctx->refresh) {
+    if(0!=dkg_wide_finish_refresh(ctx->n,*ctx->xshares,ctx->index,&ctx->old_share,&ctx->share)) return 4;
+    sodium_memzero(&ctx->old_share, sizeof ctx->old_share);
+  } else {
+    dkg_wide_finish(ctx->n,*ctx->xshares,ctx->index,&ctx->share);
+  }
+
+  TP_DKG_Message* msg22 = (TP_DKG_Message*) output;
+  memcpy(msg22->data, "OK", 2);
+  if(0!=send_msg(output, tpdkg_msg21_SIZE, 22, ctx->index, 0, ctx->sig_sk, ctx->sessionid)) return 3;
+  if(log_file!=NULL) {
+      fprintf(log_file,"[%d] msgno: %d, from: %d to: %d ", ctx->index, msg22->msgno, ntohs(msg22->from), ntohs(msg22->to));
+      dump(output, tpdkg_msg21_SIZE, "msg");
+  }
+  return 0;
 }
 
 static int peer_step19_handler(TP_DKG_PeerState *ctx, const uint8_t *input, const size_t input_len, uint8_t *output, const size_t output_len) {
+  if(ctx->optimistic) {
+    // the transcripts have been checked in step 17, skip steps 19-21
+    if(log_file!=NULL) fprintf(log_file, "\e[0;33m[%d] step 19. send final ack\e[0m\n", ctx->index);
+    if(input_len != 0) return 1;
+    if(output_len != tpdkg_msg21_SIZE) return 2;
+    ctx->step = 9; // the end
+    return peer_finish(ctx, output);
+  }
   if(log_file!=NULL) fprintf(log_file, "\e[0;33m[%d] step 19. send final transcript\e[0m\n", ctx->index);
   if(input_len != 0) return 1;
   if(output_len != tpdkg_msg19_SIZE) return 2;
@@ -1491,7 +2613,7 @@ static int peer_step19_handler(TP_DKG_PeerState *ctx, const uint8_t *input, cons
   crypto_generichash_final(&ctx->transcript, msg20->data, crypto_generichash_BYTES);
   if(0!=send_msg(output, tpdkg_msg19_SIZE, 20, ctx->index, 0, ctx->sig_sk, ctx->sessionid)) return 3;
   if(log_file!=NULL) {
-    fprintf(log_file,"[%d] msgno: %d, from: %d to: %d ", ctx->index, msg20->msgno, msg20->from, msg20->to);
+    fprintf(log_file,"[%d] msgno: %d, from: %d to: %d ", ctx->index, msg20->msgno, ntohs(msg20->from), ntohs(msg20->to));
     dump(output, tpdkg_msg19_SIZE, "msg");
   }
 
@@ -1509,14 +2631,20 @@ static int tp_step20_handler(TP_DKG_TPState *ctx, const uint8_t *input, const si
 
   uint8_t *wptr = ((TP_DKG_Message *) output)->data;
   memcpy(wptr, "OK", 2);
+  TP_Recv msgs[ctx->n];
+  for(uint16_t i=0;i<ctx->n;i++) {
+    msgs[i] = (TP_Recv) { .msg = input + i * tpdkg_msg19_SIZE, .len = tpdkg_msg19_SIZE, .msgno = 20, .to = 0 };
+  }
+  tp_recv_msgs(ctx, msgs, 1);
+
   const uint8_t *ptr = input;
-  for(uint8_t i=0;i<ctx->n;i++, ptr+=tpdkg_msg19_SIZE) {
+  for(uint16_t i=0;i<ctx->n;i++, ptr+=tpdkg_msg19_SIZE) {
     const TP_DKG_Message* msg = (const TP_DKG_Message*) ptr;
     if(log_file!=NULL) {
-      fprintf(log_file,"[!] msgno: %d, from: %d to: %d ", msg->msgno, msg->from, msg->to);
+      fprintf(log_file,"[!] msgno: %d, from: %d to: %d ", msg->msgno, ntohs(msg->from), ntohs(msg->to));
       dump(ptr, tpdkg_msg19_SIZE, "msg");
     }
-    int ret = recv_msg(ptr, tpdkg_msg19_SIZE, 20, i+1, 0, (*ctx->peer_sig_pks)[i], ctx->sessionid, ctx->ts_epsilon, &ctx->last_ts[i]);
+    int ret = msgs[i].ret;
     if(0!=ret) {
       if(add_cheater(ctx, 20, 1+ret, i+1, 0) == NULL) return 4;
 
@@ -1533,10 +2661,10 @@ static int tp_step20_handler(TP_DKG_TPState *ctx, const uint8_t *input, const si
     }
   }
 
-  if(0!=send_msg(output, output_len, 21, 0, 0xff, ctx->sig_sk, ctx->sessionid)) return 5;
+  if(0!=send_msg(output, output_len, 21, 0, tpdkg_BROADCAST, ctx->sig_sk, ctx->sessionid)) return 5;
   TP_DKG_Message* msg21 = (TP_DKG_Message*) output;
   if(log_file!=NULL) {
-    fprintf(log_file,"[!] msgno: %d, from: %d to: %x ", msg21->msgno, msg21->from, msg21->to);
+    fprintf(log_file,"[!] msgno: %d, from: %d to: %x ", msg21->msgno, ntohs(msg21->from), ntohs(msg21->to));
     dump(output, output_len, "msg");
   }
   if(ctx->cheater_len == 0) return 0;
@@ -1553,26 +2681,14 @@ static int peer_step21_handler(TP_DKG_PeerState *ctx, const uint8_t *input, cons
   // verify TP message envelope
   TP_DKG_Message* msg21 = (TP_DKG_Message*) input;
   if(log_file!=NULL) {
-    fprintf(log_file,"[%d] msgno: %d, from: %d to: 0x%x ", ctx->index, msg21->msgno, msg21->from, msg21->to);
+    fprintf(log_file,"[%d] msgno: %d, from: %d to: 0x%x ", ctx->index, msg21->msgno, ntohs(msg21->from), ntohs(msg21->to));
     dump(input, input_len, "msg");
   }
-  int ret = recv_msg(input, input_len, 21, 0, 0xff, ctx->tp_sig_pk, ctx->sessionid, ctx->ts_epsilon, &ctx->tp_last_ts);
+  int ret = recv_msg(input, input_len, 21, 0, tpdkg_BROADCAST, ctx->tp_sig_pk, ctx->sessionid, ctx->ts_epsilon, &ctx->tp_last_ts);
   if(0!=ret) return 4+ret;
 
   int fail = (memcmp(msg21->data, "OK", 2) != 0);
-  if(!fail) {
-    ctx->share.index=ctx->index;
-    dkg_finish(ctx->n,*ctx->xshares,ctx->index,&ctx->share);
-
-    TP_DKG_Message* msg22 = (TP_DKG_Message*) output;
-    memcpy(msg22->data, msg21->data, 2);
-    if(0!=send_msg(output, tpdkg_msg21_SIZE, 22, ctx->index, 0, ctx->sig_sk, ctx->sessionid)) return 3;
-    if(log_file!=NULL) {
-        fprintf(log_file,"[%d] msgno: %d, from: %d to: %d ", ctx->index, msg22->msgno, msg22->from, msg22->to);
-        dump(output, tpdkg_msg21_SIZE, "msg");
-    }
-    return 0;
-  }
+  if(!fail) return peer_finish(ctx, output);
   return 4;
 }
 
@@ -1582,14 +2698,20 @@ static int tp_step22_handler(TP_DKG_TPState *ctx, const uint8_t *input, const si
   if((tpdkg_msg21_SIZE * ctx->n) != input_len) return 1;
   if(output_len != 0) return 2;
 
+  TP_Recv msgs[ctx->n];
+  for(uint16_t i=0;i<ctx->n;i++) {
+    msgs[i] = (TP_Recv) { .msg = input + i * tpdkg_msg21_SIZE, .len = tpdkg_msg21_SIZE, .msgno = 22, .to = 0 };
+  }
+  tp_recv_msgs(ctx, msgs, 1);
+
   const uint8_t *ptr = input;
-  for(uint8_t i=0;i<ctx->n;i++, ptr+=tpdkg_msg21_SIZE) {
+  for(uint16_t i=0;i<ctx->n;i++, ptr+=tpdkg_msg21_SIZE) {
     const TP_DKG_Message* msg = (const TP_DKG_Message*) ptr;
     if(log_file!=NULL) {
-      fprintf(log_file,"[!] msgno: %d, from: %d to: %d ", msg->msgno, msg->from, msg->to);
+      fprintf(log_file,"[!] msgno: %d, from: %d to: %d ", msg->msgno, ntohs(msg->from), ntohs(msg->to));
       dump(ptr, tpdkg_msg21_SIZE, "msg");
     }
-    int ret = recv_msg(ptr, tpdkg_msg21_SIZE, 22, i+1, 0, (*ctx->peer_sig_pks)[i], ctx->sessionid, ctx->ts_epsilon, &ctx->last_ts[i]);
+    int ret = msgs[i].ret;
     if(0!=ret) {
       if(add_cheater(ctx, 22, 64+ret, i+1, 0) == NULL) return 6;
       continue;
@@ -1606,21 +2728,129 @@ static int tp_step22_handler(TP_DKG_TPState *ctx, const uint8_t *input, const si
   return 0;
 }
 
-int tpdkg_tp_next(TP_DKG_TPState *ctx, const uint8_t *input, const size_t input_len, uint8_t *output, const size_t output_len) {
+// verifies the part of the input of the current step sent by peer,
+// the same checks the step handlers do for unfed peers
+static int tp_verify_peer(TP_DKG_TPState *ctx, const uint16_t peer, const uint8_t *msg, const size_t msg_len) {
+  const uint16_t from = (uint16_t) (peer+1);
+  uint64_t *last_ts = &ctx->last_ts[peer];
+  size_t per_peer=1, item=msg_len;
+  uint8_t msgno=0;
+  uint16_t to=0;
+  switch(ctx->step) {
+  case 1: {
+#if !defined(FUZZING_BUILD_MODE_UNSAFE_FOR_PRODUCTION)
+    METRIC_ADD(sig_verify, 1);
+    if(0!=ed25519_verify(msg+tpdkg_msg2_SIZE,msg,tpdkg_msg2_SIZE,(*ctx->peer_lt_pks)[peer])) return 1;
+#endif
+    return recv_msg(msg, tpdkg_msg2_SIZE, 2, from, tpdkg_BROADCAST, ((const TP_DKG_Message*) msg)->data, ctx->sessionid, ctx->ts_epsilon, last_ts);
+  }
+  case 2:
+  case 3: { per_peer=ctx->n; item=tpdkg_msg4_SIZE; msgno=(uint8_t) (2+ctx->step); to=0; break; }
+  case 4: { msgno=6; to=tpdkg_BROADCAST; break; }
+  case 5: { per_peer=ctx->n; item=tpdkg_msg8_SIZE; msgno=8; to=0; break; }
+  case 6: { msgno=9; to=tpdkg_BROADCAST; break; }
+  case 7: { msgno=11; to=0; break; }
+  case 8: { msgno=20; to=0; break; }
+  case 9: { msgno=22; to=0; break; }
+  default: return 1;
+  }
+  for(size_t k=0;k<per_peer;k++) {
+    // messages routed via the TP go to peer k+1
+    const uint16_t dst = per_peer>1 ? (uint16_t) (k+1) : to;
+    const int ret = recv_msg(msg + k*item, item, msgno, from, dst, (*ctx->peer_sig_pks)[peer], ctx->sessionid, ctx->ts_epsilon, last_ts);
+    if(0!=ret) return ret;
+  }
+  return 0;
+}
+
+static int tp_feed(TP_DKG_TPState *ctx, const uint16_t peer, const uint8_t *msg, const size_t msg_len, uint8_t *input, const size_t input_len) {
+  if(peer>=ctx->n || ctx->step<1 || ctx->step>9) return 1;
+  if(input_len != tpdkg_tp_input_size(ctx)) return 2;
+
+  size_t sizes[ctx->n];
+  tpdkg_tp_input_sizes(ctx, sizes);
+  size_t offset=0;
+  for(uint16_t i=0;i<peer;i++) offset+=sizes[i];
+  if(msg==NULL || msg_len==0 || msg_len!=sizes[peer]) return 3;
+  if(ctx->fed[peer].state!=0) return 4;
+
+  uint8_t *dst = input + offset;
+  if(dst!=msg) memcpy(dst, msg, msg_len);
+
+  // on failure the step handler verifies this message again, and it
+  // must see the same last_ts the failed verification started with
+  const uint64_t last_ts = ctx->last_ts[peer];
+  if(0!=tp_verify_peer(ctx, peer, dst, msg_len)) {
+    ctx->last_ts[peer] = last_ts;
+    ctx->fed[peer].state = 2;
+    return 5;
+  }
+  ctx->fed[peer].state = 1;
+  ctx->fed[peer].ts = last_ts;
+  crypto_generichash(ctx->fed[peer].hash, crypto_generichash_BYTES, dst, msg_len, NULL, 0);
+  return 0;
+}
+
+// the step handlers trust the messages verified by tp_feed(), which
+// only holds if input still contains them. those which differ are
+// marked as unfed, so that the handler verifies them like any other
+static void tp_check_fed(TP_DKG_TPState *ctx, const uint8_t *input, const size_t input_len) {
+  if(ctx->step<1 || ctx->step>9) return;
+  if(input==NULL || input_len != tpdkg_tp_input_size(ctx)) return;
+  size_t sizes[ctx->n];
+  tpdkg_tp_input_sizes(ctx, sizes);
+  size_t offset=0;
+  for(uint16_t i=0;i<ctx->n;offset+=sizes[i++]) {
+    if(ctx->fed[i].state!=1) continue;
+    uint8_t hash[crypto_generichash_BYTES];
+    crypto_generichash(hash, sizeof hash, input + offset, sizes[i], NULL, 0);
+    if(sodium_memcmp(hash, ctx->fed[i].hash, sizeof hash)==0) continue;
+    if(log_file!=NULL) fprintf(log_file, "\e[0;31m[!] input of peer %d differs from what was fed, verifying it again\e[0m\n", i+1);
+    ctx->fed[i].state = 0;
+    ctx->last_ts[i] = ctx->fed[i].ts;
+  }
+}
+
+int tpdkg_tp_feed(TP_DKG_TPState *ctx, const uint16_t peer, const uint8_t *msg, const size_t msg_len, uint8_t *input, const size_t input_len) {
+  METRICS_BEGIN(ctx->metrics, ctx->step);
+  const int ret = tp_feed(ctx, peer, msg, msg_len, input, input_len);
+  METRICS_END(0, 0, 0);
+  return ret;
+}
+
+static int tp_next(TP_DKG_TPState *ctx, const uint8_t *input, const size_t input_len, uint8_t *output, const size_t output_len) {
   int ret = 0;
+  tp_check_fed(ctx, input, input_len);
   switch(ctx->step) {
   case 0: {ret = tp_step1_handler(ctx, input, input_len, output, output_len); break;}
-  case 1: {ret = tp_step4_handler(ctx, input, input_len, output, output_len); break;}
+  case 1: {
+    ret = tp_step4_handler(ctx, input, input_len, output, output_len);
+    memset(ctx->fed, 0, ctx->n * sizeof(TP_DKG_Fed));
+    ctx->prev = ctx->step;
+    if(ret!=0) {
+      ctx->step=99; // so that not_done reports done
+      return ret;
+    }
+    // resumed channels need no handshakes, we skip over to step 12
+    ctx->step += ctx->resume ? 3 : 1;
+    return ret;
+  }
   case 2: {ret = tp_step68_handler(ctx, input, input_len, output, output_len); break;}
   case 3: {ret = tp_step68_handler(ctx, input, input_len, output, output_len); break;}
   case 4: {ret = tp_step12_handler(ctx, input, input_len, output, output_len); break;}
   case 5: {ret = tp_step14_handler(ctx, input, input_len, output, output_len); break;}
   case 6: {
     ret = tp_step16_handler(ctx, input, input_len, output, output_len);
+    memset(ctx->fed, 0, ctx->n * sizeof(TP_DKG_Fed));
     ctx->prev = ctx->step;
+    if(ret!=0) {
+      ctx->step=99; // so that not_done reports done
+      return ret;
+    }
     if(ctx->complaints_len == 0) {
-      // we skip over to step 21
-      ctx->step++;
+      // we skip over to step 20, in optimistic mode the transcripts
+      // have been checked in step 16 and we skip over to step 22
+      ctx->step += ctx->optimistic ? 2 : 1;
     }
     ctx->step++;
     return ret;
@@ -1633,12 +2863,20 @@ int tpdkg_tp_next(TP_DKG_TPState *ctx, const uint8_t *input, const size_t input_
     return 99;
   }
   }
+  memset(ctx->fed, 0, ctx->n * sizeof(TP_DKG_Fed));
   ctx->prev=ctx->step++;
   if(ret!=0) ctx->step=99; // so that not_done reports done
   return ret;
 }
 
-int tpdkg_peer_next(TP_DKG_PeerState *ctx, const uint8_t *input, const size_t input_len, uint8_t *output, const size_t output_len) {
+int tpdkg_tp_next(TP_DKG_TPState *ctx, const uint8_t *input, const size_t input_len, uint8_t *output, const size_t output_len) {
+  METRICS_BEGIN(ctx->metrics, ctx->step);
+  const int ret = tp_next(ctx, input, input_len, output, output_len);
+  METRICS_END(input_len, output_len, 1);
+  return ret;
+}
+
+static int peer_next(TP_DKG_PeerState *ctx, const uint8_t *input, const size_t input_len, uint8_t *output, const size_t output_len) {
   int ret=0;
   switch(ctx->step) {
   case 0: {ret = peer_step23_handler(ctx, input, input_len, output, output_len); break;}
@@ -1666,6 +2904,13 @@ int tpdkg_peer_next(TP_DKG_PeerState *ctx, const uint8_t *input, const size_t in
   return ret;
 }
 
+int tpdkg_peer_next(TP_DKG_PeerState *ctx, const uint8_t *input, const size_t input_len, uint8_t *output, const size_t output_len) {
+  METRICS_BEGIN(ctx->metrics, ctx->step);
+  const int ret = peer_next(ctx, input, input_len, output, output_len);
+  METRICS_END(input_len, output_len, 1);
+  return ret;
+}
+
 char* tpdkg_recv_err(const int code) {
   switch(code) {
   case 0: return "no error";
@@ -1680,7 +2925,7 @@ char* tpdkg_recv_err(const int code) {
   return "invalid recv_msg error code";
 }
 
-uint8_t tpdkg_cheater_msg(const TP_DKG_Cheater *c, char *out, const size_t outlen) {
+uint16_t tpdkg_cheater_msg(const TP_DKG_Cheater *c, char *out, const size_t outlen) {
   if(c->error>65 && c->error<=70) {
       snprintf(out, outlen, "step %d message from peer %d for peer %d could not be validated: %s",
                c->step, c->peer, c->other_peer, tpdkg_recv_err(c->error & 0x3f));
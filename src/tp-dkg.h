@@ -58,23 +58,60 @@
  */
 
 #include <stdint.h>
+#include <sys/uio.h>
 #include <sodium.h>
 #include "XK.h"
 #include "dkg.h"
 
 #define tpdkg_sessionid_SIZE 32
+// the version of the wire format announced in msg0, peers refuse
+// any other version, see "Number of peers" in docs/tp-dkg.txt
+#define tpdkg_VERSION 1
+// the largest number of peers of a run. The wire format addresses the
+// peers with 16 bits, the shares are the wide shares of dkg.h, and
+// the per-peer state is sized by n, this bounds the n*n buffers
+#define tpdkg_MAX_PEERS 1024
+// the recipient of broadcast messages, see TP_DKG_Message::to
+#define tpdkg_BROADCAST 0xffff
 #define tpdkg_msg0_SIZE ( sizeof(TP_DKG_Message)                                         \
                         + crypto_generichash_BYTES/*dst*/                                \
-                        + 2 /*n,t*/                                                      \
+                        + 6 /*version,n,t,flags*/                                        \
+                        + tpdkg_sessionid_SIZE /* resume id */                           \
                         + crypto_sign_PUBLICKEYBYTES /* tp_sign_pk */                    )
 #define noise_xk_handshake3_SIZE 64UL
 #define tpdkg_msg8_SIZE (sizeof(TP_DKG_Message) /* header */                             \
                          + noise_xk_handshake3_SIZE /* 4th&final noise handshake */      \
-                         + sizeof(TOPRF_Share) /* msg: the noise_xk wrapped share */     \
+                         + sizeof(TOPRF_WideShare) /* msg: the noise_xk wrapped share */ \
                          + crypto_secretbox_xchacha20poly1305_MACBYTES /* mac of msg */  \
                          + crypto_auth_hmacsha256_BYTES /* key-committing mac over msg*/ )
+// what the TP keeps of each msg8 for resolving complaints: the
+// noise_xk wrapped share, its mac and the key-committing mac over both
+#define tpdkg_encrypted_share_SIZE (sizeof(TOPRF_WideShare)                              \
+                                    + crypto_secretbox_xchacha20poly1305_MACBYTES       \
+                                    + crypto_auth_hmacsha256_BYTES                      )
 #define tpdkg_max_err_SIZE 128
 
+// the flags of tpdkg_start_tp_flags(), announced to the peers in msg0
+// send the transcripts with the complaints, see tpdkg_start_tp_flags()
+#define tpdkg_OPTIMISTIC 1
+// refresh the shares of an earlier DKG, see tpdkg_start_tp_refresh()
+#define tpdkg_REFRESH 2
+// reuse the channels of an earlier run, see tpdkg_start_tp_resume()
+#define tpdkg_RESUME 4
+// the number of runs that can resume the channels set up by one run
+// with noise handshakes, see tpdkg_peer_save_resume()
+#define tpdkg_resume_USES 16
+#define tpdkg_resume_KEY_SIZE 32
+// the size of the channel cache of a peer for n peers: the sessionid
+// of the run it resumes, n and the index of the peer as 16 bits each,
+// the number of uses left, and the keys of the channels to and from
+// each peer
+#define tpdkg_resume_SIZE(n) (tpdkg_sessionid_SIZE + 5 + (size_t) (n) * 2 * tpdkg_resume_KEY_SIZE)
+// the alignment of the buffers laid out by tpdkg_{tp|peer}_set_arena()
+#define tpdkg_arena_ALIGN 64
+// the size of the big-endian length prefixed by tpdkg_tp_peer_iov()
+#define tpdkg_frame_SIZE 4
+
 /** @struct TP_DKG_Message
     This is the header for each message sent in this protocol.
 
@@ -90,12 +127,13 @@
          complete message including the header.
 
     @var TP_DKG_Message::from This field contains the id of the
-         sender, the TP is 0, otherwise its the index of the peer.
+         sender in network byte order, the TP is 0, otherwise its the
+         index of the peer.
 
     @var TP_DKG_Message::to This field contains the recipient of the
-         message, value 0 represents the TP, value 0xff represents a
-         broadcast message, all other values (<=N) are the indexes of
-         the peers.
+         message in network byte order, value 0 represents the TP,
+         value tpdkg_BROADCAST (0xffff) represents a broadcast
+         message, all other values (<=N) are the indexes of the peers.
 
     @var TP_DKG_Message::ts This field contains a timestamp proving
          the freshness of the message, the timestamp is a 64 bit value
@@ -109,13 +147,92 @@ typedef struct {
   uint8_t sig[crypto_sign_BYTES];
   uint8_t msgno;
   uint32_t len;
-  uint8_t from;
-  uint8_t to;
+  uint16_t from;
+  uint16_t to;
   uint64_t ts;
   uint8_t sessionid[tpdkg_sessionid_SIZE];
   uint8_t data[];
 } __attribute((packed)) TP_DKG_Message;
 
+/** @struct TP_DKG_StepMetrics
+
+    The work done by one step of the protocol, accumulated over all
+    calls of this step. Only counted if liboprf is compiled with
+    -DTPDKG_METRICS, see tpdkg_tp_set_metrics().
+
+    @var TP_DKG_StepMetrics::time_ns The wall time spent in
+         tpdkg_{tp|peer}_next() and tpdkg_tp_feed() in nanoseconds.
+
+    @var TP_DKG_StepMetrics::bytes_in The size of the inputs.
+
+    @var TP_DKG_StepMetrics::bytes_out The size of the outputs.
+
+    @var TP_DKG_StepMetrics::sig_sign The number of signatures created.
+
+    @var TP_DKG_StepMetrics::sig_verify The number of signatures
+         verified, including the ones verified in batches.
+
+    @var TP_DKG_StepMetrics::noise_ops The number of noise handshake
+         and transport operations.
+
+    @var TP_DKG_StepMetrics::cheaters The number of cheaters recorded.
+
+    @var TP_DKG_StepMetrics::calls The number of times the step ran.
+ */
+typedef struct {
+  uint64_t time_ns;
+  uint64_t bytes_in;
+  uint64_t bytes_out;
+  uint32_t sig_sign;
+  uint32_t sig_verify;
+  uint32_t noise_ops;
+  uint32_t cheaters;
+  uint32_t calls;
+} TP_DKG_StepMetrics;
+
+#define tpdkg_metrics_STEPS 11
+
+/** @struct TP_DKG_Metrics
+
+    The metrics of all steps of a TP or a peer, indexed by the step
+    field of their state when the step runs. For the TP these are:
+    0: step 1, 1: step 4, 2: step 6, 3: step 8, 4: step 12, 5: step
+    14, 6: step 16, 7: step 18, 8: step 20, 9: step 22. For a peer:
+    0: steps 2-3, 1: step 5, 2: step 7, 3: steps 9-11, 4: step 13, 5:
+    step 15, 6: step 17, 7: step 17a, 8: step 19, 9: step 21.
+ */
+typedef struct {
+  TP_DKG_StepMetrics steps[tpdkg_metrics_STEPS];
+} TP_DKG_Metrics;
+
+/**
+   The signature of a function running jobs in parallel, it must call
+   fn(arg, 0) .. fn(arg, jobs-1) - in any order and possibly
+   concurrently - and only return when all of them are finished.
+   workerpool_run() from workerpool.h is such a function.
+ */
+typedef void (*tpdkg_parallel_fn)(void *pool, const size_t jobs, void (*fn)(void *arg, const size_t job), void *arg);
+
+/**
+   The signature of a function returning the current time in seconds
+   since the epoch, see tpdkg_set_clock().
+ */
+typedef uint64_t (*tpdkg_clock_fn)(void);
+
+/**
+   Sets the clock used for the timestamps of all messages sent and for
+   checking the freshness of received ones, for the whole process.
+   NULL restores time(NULL).
+
+   This is meant for replaying recorded runs, which can then present
+   the time of the recording: all the checks of the timestamps and
+   signatures stay in place, but the messages do not need to be fresh.
+   See tests/tp-dkg-replay.c. A deployment should never set this.
+
+   @param [in] clock: the function returning the current time, or NULL
+ */
+void tpdkg_set_clock(const tpdkg_clock_fn clock);
+
 /** @struct TP_DKG_PeerState
 
     This struct contains the state of a peer during the execution of
@@ -137,17 +254,26 @@ typedef struct {
          peer, it is a value between 1 and and N inclusive.
 
     @var TP_DKG_PeerState:share This field contains the resulting
-         share at the end of the DKG and should most probably be
+         wide share at the end of the DKG and should most probably be
          persisted for later usage. This is the output of the DKG for
          a peer.
+
+    @var TP_DKG_PeerState:refresh This field is 1 if the peer has
+         been started by tpdkg_start_peer_refresh().
+
+    @var TP_DKG_PeerState:optimistic This field is 1 if the TP
+         started the protocol in optimistic mode.
+
+    @var TP_DKG_PeerState:resume This field is 1 if the channels of
+         an earlier run are resumed, see tpdkg_start_peer_resume().
  */
 typedef struct {
   int step;
   int prev;
   uint8_t sessionid[tpdkg_sessionid_SIZE];
-  uint8_t n;
-  uint8_t t;
-  uint8_t index;
+  uint16_t n;
+  uint16_t t;
+  uint16_t index;
   uint8_t lt_sk[crypto_sign_SECRETKEYBYTES];
   uint8_t sig_pk[crypto_sign_PUBLICKEYBYTES];
   uint8_t sig_sk[crypto_sign_SECRETKEYBYTES];
@@ -163,14 +289,24 @@ typedef struct {
   Noise_XK_session_t *(*noise_outs)[];
   Noise_XK_session_t *(*noise_ins)[];
   uint8_t (*commitments)[][crypto_core_ristretto255_BYTES];
-  TOPRF_Share (*shares)[];
-  TOPRF_Share (*xshares)[];
-  uint16_t complaints_len;
-  uint16_t *complaints;
-  uint8_t my_complaints_len;
-  uint8_t *my_complaints;
+  TOPRF_WideShare (*shares)[];
+  TOPRF_WideShare (*xshares)[];
+  // the complaints are the complainer and the accused packed as
+  // (complainer<<16)|accused
+  uint32_t complaints_len;
+  uint32_t *complaints;
+  uint16_t my_complaints_len;
+  uint16_t *my_complaints;
   crypto_generichash_state transcript;
-  TOPRF_Share share;
+  TOPRF_WideShare share;
+  TP_DKG_Metrics *metrics;
+  uint8_t refresh;
+  TOPRF_WideShare old_share;
+  uint8_t optimistic;
+  tpdkg_parallel_fn parallel;
+  void *pool;
+  uint8_t resume;
+  const uint8_t *resume_cache;
 } TP_DKG_PeerState;
 
 /** @struct TP_DKG_Cheater
@@ -184,13 +320,13 @@ typedef struct {
     @var TP_DKG_Cheater::peer This specifies which peer caused the violation.
 
     @var TP_DKG_Cheater::other_peer This optionally specifies which
-         peer reported the violation, set to 0xfe if unused.
+         peer reported the violation, set to 0xfffe if unused.
  */
 typedef struct {
   int step;
   int error;
-  uint8_t peer;
-  uint8_t other_peer;
+  uint16_t peer;
+  uint16_t other_peer;
   int invalid_index;
 } TP_DKG_Cheater;
 
@@ -215,6 +351,27 @@ typedef struct {
 // 5 expired
 // 6 signature fail
 
+/** @struct TP_DKG_Fed
+
+    The per peer state of tpdkg_tp_feed(), see tpdkg_tp_set_bufs().
+
+    @var TP_DKG_Fed::state 0 nothing fed yet for the current step, 1
+         fed and verified by tpdkg_tp_feed(), 2 fed but failed
+         verification.
+
+    @var TP_DKG_Fed::ts The last_ts of the peer before its message was
+         fed.
+
+    @var TP_DKG_Fed::hash The hash of the verified message,
+         tpdkg_tp_next() verifies the messages again which differ from
+         what was fed.
+ */
+typedef struct {
+  uint8_t state;
+  uint64_t ts;
+  uint8_t hash[crypto_generichash_BYTES];
+} TP_DKG_Fed;
+
 /** @struct TP_DKG_TPState
 
     This struct contains the state of the TP during the execution of
@@ -241,8 +398,8 @@ typedef struct {
   int step;
   int prev;
   uint8_t sessionid[tpdkg_sessionid_SIZE];
-  uint8_t n;
-  uint8_t t;
+  uint16_t n;
+  uint16_t t;
   uint8_t sig_pk[crypto_sign_PUBLICKEYBYTES];
   uint8_t sig_sk[crypto_sign_SECRETKEYBYTES];
   uint64_t *last_ts;
@@ -250,15 +407,25 @@ typedef struct {
   uint8_t (*peer_sig_pks)[][crypto_sign_PUBLICKEYBYTES];
   uint8_t (*peer_lt_pks)[][crypto_sign_PUBLICKEYBYTES];
   uint8_t (*commitments)[][crypto_core_ristretto255_BYTES];
-  // note this could be optimized by only storing the encrypted share and the hmac
-  // and also dropping all items where i==j
-  uint8_t (*encrypted_shares)[][tpdkg_msg8_SIZE];
-  uint16_t complaints_len;
-  uint16_t (*complaints)[];
+  // the encrypted shares sent from peer i to peer j, without the
+  // msg8 header and handshake, and without the shares peers send to
+  // themselves: n*(n-1) items, indexed [i][j < i ? j : j-1]
+  uint8_t (*encrypted_shares)[][tpdkg_encrypted_share_SIZE];
+  // (complainer<<16)|accused, like the complaints of the peers
+  uint32_t complaints_len;
+  uint32_t (*complaints)[];
   size_t cheater_len;
   TP_DKG_Cheater (*cheaters)[];
   size_t cheater_max;
   crypto_generichash_state transcript;
+  tpdkg_parallel_fn parallel;
+  void *pool;
+  // n items, see tpdkg_tp_feed()
+  TP_DKG_Fed *fed;
+  TP_DKG_Metrics *metrics;
+  uint8_t refresh;
+  uint8_t optimistic;
+  uint8_t resume;
 } TP_DKG_TPState;
 
 /*
@@ -280,7 +447,8 @@ typedef struct {
                 as few as 2-3 seconds, big deployments with
                 126-out-of-127 might need up to a few hours...
 
-    @param [in] n: the number of peers participating in this execution.
+    @param [in] n: the number of peers participating in this execution,
+           at most tpdkg_MAX_PEERS.
 
     @param [in] t: the threshold necessary to use the results of this DKG.
 
@@ -297,10 +465,121 @@ typedef struct {
     @return 0 if no errors.
  **/
 int tpdkg_start_tp(TP_DKG_TPState *ctx, const uint64_t ts_epsilon,
-             const uint8_t n, const uint8_t t,
+             const uint16_t n, const uint16_t t,
              const char *proto_name, const size_t proto_name_len,
              const size_t msg0_len, TP_DKG_Message *msg0);
 
+/** Starts a new execution of a TP DKG protocol with flags.
+
+    Like tpdkg_start_tp(), except for the additional flags parameter,
+    which is announced to the peers in msg0, and a combination of:
+
+    tpdkg_OPTIMISTIC: the peers send the hash of their transcript
+    together with their complaints in step 15, if nobody complains
+    the TP verifies them right away in step 16, and the peers verify
+    them when they receive the complaints in step 17. Peers then
+    acknowledge their final share directly, skipping the transcript
+    round of steps 19-21, which saves one round-trip. The steps 17-18
+    resolving complaints are the same as without this flag, as are
+    all the cheater reports, a wrong transcript is still reported for
+    step 20.
+
+    tpdkg_REFRESH: refresh the shares of an earlier DKG, see
+    tpdkg_start_tp_refresh().
+
+    tpdkg_RESUME is only valid with tpdkg_start_tp_resume().
+
+    @return 0 if no errors, 6 if flags is invalid.
+ **/
+int tpdkg_start_tp_flags(TP_DKG_TPState *ctx, const uint64_t ts_epsilon,
+                         const uint16_t n, const uint16_t t,
+                         const char *proto_name, const size_t proto_name_len,
+                         const uint8_t flags,
+                         const size_t msg0_len, TP_DKG_Message *msg0);
+
+/** Starts a new execution of a share refresh.
+
+    A refresh re-randomizes the shares of an earlier DKG without
+    changing the shared secret: every peer deals shares of a random
+    polynomial with a constant term of 0 - see dkg_start_refresh() -
+    and adds the sum of the shares it receives to its existing share.
+    Shares of different refreshes cannot be combined, old shares
+    leaked to an attacker become useless once all peers have
+    refreshed and deleted them.
+
+    The refresh runs the same steps as the DKG, driven by
+    tpdkg_tp_next() and tpdkg_peer_next(), all the peers must be
+    started with tpdkg_start_peer_refresh(). Since the group key stays
+    fixed there is no commitment to the constant term, it is neither
+    computed, sent nor verified, the peers only broadcast t-1
+    commitments each.
+
+    The parameters are the same as for tpdkg_start_tp(), n and t
+    must be the same as those of the DKG the shares come from, and
+    the peers must be in the same order as in that DKG, as the TP
+    assigns the peers their indexes in the order of the
+    long-term keys passed to tpdkg_tp_set_bufs().
+
+    @return 0 if no errors.
+ **/
+int tpdkg_start_tp_refresh(TP_DKG_TPState *ctx, const uint64_t ts_epsilon,
+                           const uint16_t n, const uint16_t t,
+                           const char *proto_name, const size_t proto_name_len,
+                           const size_t msg0_len, TP_DKG_Message *msg0);
+
+/** Starts a new execution of a TP DKG protocol reusing the channels
+    between the peers set up by an earlier run.
+
+    Every run normally sets up a noise session between each pair of
+    peers, which takes the two round-trips of steps 5-11 and n*n
+    handshakes on each peer. If the same peers run the protocol again
+    - typically to refresh their shares - they can instead encrypt the
+    shares with keys derived from the sessions of the earlier run,
+    which each peer keeps in a cache saved by
+    tpdkg_peer_save_resume(). A resumed run goes from step 4 right
+    to the commitments of step 12, with the same messages as a full
+    run otherwise, including the resolution of complaints in steps
+    17-18.
+
+    All peers must have saved their cache in the run with the
+    sessionid resume_id - the sessionid field of the TP state of that
+    run - and the TP must assign them the same indexes as in that run,
+    otherwise the peers refuse to start, or fail in step 3.
+
+    The security bounds of resumed channels are:
+
+    - the peers are authenticated to each other only by holding the
+      keys of the earlier run, which were set up by handshakes of the
+      noise keys signed with their long-term keys. There is no fresh
+      handshake, so an attacker who steals a cache can impersonate the
+      peer to all others - and decrypt the shares sent to it - until
+      the peers run the protocol without resuming. This is bounded
+      by tpdkg_resume_USES runs resuming from one full run.
+
+    - the keys for each run are derived from the cached keys and the
+      sessionid of the run, and the cache is ratcheted forward after
+      every run, so a stolen cache reveals no shares of earlier runs,
+      given the old caches have been overwritten.
+
+    - a run with complaints reveals the keys of some channels to the
+      TP, its caches can not be saved, the next run must be a full run.
+
+    The parameters are the same as for tpdkg_start_tp_flags(),
+    flags can be a combination of tpdkg_OPTIMISTIC and tpdkg_REFRESH,
+    tpdkg_RESUME is implied.
+
+    @param [in] resume_id: the sessionid of the run the peers saved
+           their caches in.
+
+    @return 0 if no errors, 6 if flags is invalid or resume_id is NULL.
+ **/
+int tpdkg_start_tp_resume(TP_DKG_TPState *ctx, const uint64_t ts_epsilon,
+                          const uint16_t n, const uint16_t t,
+                          const char *proto_name, const size_t proto_name_len,
+                          const uint8_t flags,
+                          const uint8_t resume_id[tpdkg_sessionid_SIZE],
+                          const size_t msg0_len, TP_DKG_Message *msg0);
+
 /**
    This function sets all the variable sized buffers in the TP_DKG_PeerState structure.
 
@@ -313,15 +592,22 @@ int tpdkg_start_tp(TP_DKG_TPState *ctx, const uint64_t ts_epsilon,
 
    @code
    uint8_t tp_commitments[n*t][crypto_core_ristretto255_BYTES];
-   uint16_t tp_complaints[n*n];
-   uint8_t encrypted_shares[n*n][tpdkg_msg8_SIZE];
+   uint32_t tp_complaints[n*n];
+   uint8_t encrypted_shares[n*(n-1)][tpdkg_encrypted_share_SIZE];
    TP_DKG_Cheater cheaters[t*t - 1];
    uint8_t tp_peers_sig_pks[n][crypto_sign_PUBLICKEYBYTES];
    uint8_t peer_lt_pks[n][crypto_sign_PUBLICKEYBYTES];
+   uint64_t last_ts[n];
+   TP_DKG_Fed fed[n];
 
    tpdkg_tp_set_bufs(&tp, &tp_commitments, &tp_complaints, &encrypted_shares,
                      &cheaters, sizeof(cheaters) / sizeof(TP_DKG_Cheater),
-                     &tp_peers_sig_pks, &peer_lt_pks);
+                     &tp_peers_sig_pks, &peer_lt_pks, last_ts, fed);
+   @endcode
+
+   For hundreds of peers the n*n buffers are too big for the stack,
+   and should rather be allocated on the heap, or with
+   tpdkg_tp_set_arena().
    @endcode
 
    Important to note that peer_lt_pks should contain the long-term
@@ -330,12 +616,97 @@ int tpdkg_start_tp(TP_DKG_TPState *ctx, const uint64_t ts_epsilon,
  */
 void tpdkg_tp_set_bufs(TP_DKG_TPState *ctx,
                        uint8_t (*commitments)[][crypto_core_ristretto255_BYTES],
-                       uint16_t (*complaints)[],
-                       uint8_t (*encrypted_shares)[][tpdkg_msg8_SIZE],
+                       uint32_t (*complaints)[],
+                       uint8_t (*encrypted_shares)[][tpdkg_encrypted_share_SIZE],
                        TP_DKG_Cheater (*cheaters)[], const size_t cheater_max,
                        uint8_t (*tp_peers_sig_pks)[][crypto_sign_PUBLICKEYBYTES],
                        uint8_t (*peer_lt_pks)[][crypto_sign_PUBLICKEYBYTES],
-                       uint64_t *last_ts);
+                       uint64_t *last_ts,
+                       TP_DKG_Fed *fed);
+
+/**
+   This function returns the size of the arena needed by
+   tpdkg_tp_set_arena() for a DKG with n peers and threshold t.
+ */
+size_t tpdkg_tp_arena_size(const uint16_t n, const uint16_t t);
+
+/**
+   This function is an alternative to tpdkg_tp_set_bufs(), it lays
+   out all the variable sized buffers of the TP state in one
+   caller-provided arena, each buffer aligned to tpdkg_arena_ALIGN
+   bytes. The arena can be anywhere, for example:
+
+   @code
+   const size_t arena_len = tpdkg_tp_arena_size(n, t);
+   uint8_t *arena = malloc(arena_len);
+   tpdkg_tp_set_arena(&tp, arena, arena_len, &peer_lt_pks, 1);
+   // run the protocol
+   tpdkg_arena_wipe(arena, arena_len, 1);
+   free(arena);
+   @endcode
+
+   The arena is zeroed, and there is space for t*t-1 cheaters. This
+   function must be called after tpdkg_start_tp().
+
+   @param [in] ctx: the TP state initialized by tpdkg_start_tp()
+   @param [in] arena: a buffer of at least tpdkg_tp_arena_size() bytes
+   @param [in] arena_len: the size of arena
+   @param [in] peer_lt_pks: the long-term signing public-keys of the
+               peers, these are copied into the arena.
+   @param [in] lock: if not 0, the arena is locked into memory with
+               sodium_mlock(), in this case it must be released with
+               tpdkg_arena_wipe() with lock also set.
+   @return 0 if no errors, 1 if the arena is too small, 2 if it
+           cannot be locked.
+ */
+int tpdkg_tp_set_arena(TP_DKG_TPState *ctx, uint8_t *arena, const size_t arena_len,
+                       const uint8_t (*peer_lt_pks)[][crypto_sign_PUBLICKEYBYTES],
+                       const int lock);
+
+/**
+   This function enables verifying the messages of the peers in
+   parallel in the TP. By default - and if parallel is NULL - the TP
+   processes all messages serially.
+
+   The results - including the contents and order of the cheaters
+   list - are the same as when processing serially.
+
+   This function must be called after tpdkg_start_tp().
+
+   @code
+   WorkerPool *pool = workerpool_new(8);
+   tpdkg_tp_set_workers(&tp, workerpool_run, pool);
+   // run the protocol, and workerpool_free(pool) when done
+   @endcode
+
+    @param [in] ctx: a TP state initialized by tpdkg_start_tp()
+    @param [in] parallel: a function running jobs in parallel
+    @param [in] pool: passed as the first parameter to parallel
+ */
+void tpdkg_tp_set_workers(TP_DKG_TPState *ctx, const tpdkg_parallel_fn parallel, void *pool);
+
+/**
+   This function enables collecting metrics about each step of the
+   TP into metrics, which is not zeroed, so the counters of many
+   sessions can be accumulated. The metrics contain no secrets and no
+   message contents, unlike the log_file tracing, they are meant to be
+   exported to monitoring.
+
+   Counting is only compiled in if liboprf is built with
+   -DTPDKG_METRICS (make TPDKG_METRICS=1), otherwise this function
+   does nothing and the protocol has no overhead at all.
+
+   With tpdkg_tp_set_workers() the counters are updated from the
+   worker threads, they can only be read safely between steps.
+
+   This function must be called after tpdkg_start_tp().
+
+    @param [in] ctx: a TP state initialized by tpdkg_start_tp()
+    @param [in] metrics: receives the metrics, or NULL to disable collecting them
+    @return The function returns 0 if metrics are collected, 1 if
+            liboprf is built without support for metrics.
+ */
+int tpdkg_tp_set_metrics(TP_DKG_TPState *ctx, TP_DKG_Metrics *metrics);
 
 /**
    This function calculates the size of the buffer needed to hold all
@@ -385,7 +756,8 @@ size_t tpdkg_tp_output_size(const TP_DKG_TPState *ctx);
    @param [in] ctx: pointer to a valid TP_DKG_TPState.
    @param [in] input: buffer to the input of the current step.
    @param [in] input_len: size of the input buffer.
-   @param [out] output: buffer to the output of the current step.
+   @param [out] output: buffer to the output of the current step, can
+          be NULL if tpdkg_tp_routes() is 1, see tpdkg_tp_peer_iov().
    @param [in] output_len: size of the output buffer.
    @return 0 if no error
 
@@ -401,6 +773,45 @@ size_t tpdkg_tp_output_size(const TP_DKG_TPState *ctx);
  */
 int tpdkg_tp_next(TP_DKG_TPState *ctx, const uint8_t *input, const size_t input_len, uint8_t *output, const size_t output_len);
 
+/**
+   This function absorbs the message of one peer for the current step
+   as soon as it arrives, instead of waiting for all peers. The
+   signatures and envelopes of the message are verified immediately
+   and the message is placed at its position in input, which must be
+   the input buffer later passed to tpdkg_tp_next(). When the last
+   peer has been fed, tpdkg_tp_next() only verifies what has not been
+   fed and emits the output of the step.
+
+   If msg already points to the position of the peer in input, it is
+   verified in place and not copied.
+
+   Messages that fail verification are kept, tpdkg_tp_next() verifies
+   them again and records the cheater as usual. tpdkg_tp_next() also
+   hashes every fed message in its input again, and fully verifies
+   those which differ from what was fed.
+
+   @param [in] ctx: pointer to a valid TP_DKG_TPState.
+   @param [in] peer: the index of the sending peer (starting with 0 for the first)
+   @param [in] msg: the complete output of the peer for this step
+   @param [in] msg_len: the size of msg, must be the size for this peer
+               reported by tpdkg_tp_input_sizes()
+   @param [out] input: the input buffer of the current step
+   @param [in] input_len: the size of input, tpdkg_tp_input_size()
+   @return 0 if the message has been verified, 1 if peer is invalid or
+           the current step has no input, 2 if input_len is wrong, 3 if
+           msg_len is wrong, 4 if a message from this peer has already
+           been fed in this step, 5 if the message failed verification.
+
+   @code
+    uint8_t tp_in[tpdkg_tp_input_size(&tp)];
+    // for each message as it is received from peer i
+    tpdkg_tp_feed(&tp, i, msg, msg_len, tp_in, sizeof tp_in);
+    // once all peers have been fed
+    ret = tpdkg_tp_next(&tp, tp_in, sizeof(tp_in), tp_out, sizeof tp_out);
+   @endcode
+ */
+int tpdkg_tp_feed(TP_DKG_TPState *ctx, const uint16_t peer, const uint8_t *msg, const size_t msg_len, uint8_t *input, const size_t input_len);
+
 /**
    This function "converts" the output of tpdkg_tp_next() into a message for the ith peer.
 
@@ -440,7 +851,77 @@ int tpdkg_tp_next(TP_DKG_TPState *ctx, const uint8_t *input, const size_t input_
     @endcode
 
  */
-int tpdkg_tp_peer_msg(const TP_DKG_TPState *ctx, const uint8_t *base, const size_t base_size, const uint8_t peer, const uint8_t **msg, size_t *len);
+int tpdkg_tp_peer_msg(const TP_DKG_TPState *ctx, const uint8_t *base, const size_t base_size, const uint16_t peer, const uint8_t **msg, size_t *len);
+
+/**
+   This function returns 1 if the next tpdkg_tp_next() call only
+   routes the messages of the peers to each other (steps 6, 8 and 14).
+
+   For these steps tpdkg_tp_next() can be called with an output of
+   NULL and an output_len of 0, then the messages are only verified
+   and not copied into an output buffer, and tpdkg_tp_peer_iov()
+   describes the message for each peer as the parts of the input
+   buffer. This halves the memory the TP needs for these - the
+   largest - steps, and saves copying n^2 messages.
+
+   @param [in] ctx: pointer to a valid TP_DKG_TPState.
+   @return 1 if the next step only routes messages, 0 otherwise
+ */
+int tpdkg_tp_routes(const TP_DKG_TPState *ctx);
+
+/**
+   This function is a vectored variant of tpdkg_tp_peer_msg(), it
+   describes the message for the ith peer as a list of segments which
+   can be sent with writev() or sendmsg() without copying.
+
+   The segments of broadcast messages point to the same base for all
+   peers, so a broadcast is sent from a single buffer to all n peers.
+
+   If frame is not NULL, the length of the message is written to it
+   as a tpdkg_frame_SIZE bytes big-endian integer and it becomes the
+   first segment, so the peer can read the message from a stream
+   without knowing its size in advance.
+
+   If base is NULL, the previous step must have been a routing step -
+   see tpdkg_tp_routes() - run with no output; the segments then point
+   to the messages for the peer in input, which must be kept until the
+   segments have been sent. Note that the messages relayed in the
+   broadcasts are covered by the signature of the TP over the whole
+   broadcast, and thus must be copied into it by tpdkg_tp_next().
+
+   @param [in] ctx: pointer to a valid TP_DKG_TPState.
+   @param [in] base: the output of the tpdkg_tp_next() function or NULL.
+   @param [in] base_size: the size of the output of the tpdkg_tp_next() function.
+   @param [in] input: the input of the tpdkg_tp_next() function if base is NULL.
+   @param [in] input_len: the size of input.
+   @param [in] peer: the index of the peer (starting with 0 for the first)
+   @param [out] frame: buffer receiving the length prefix, or NULL for unframed messages.
+   @param [out] iov: an array of iov_len segments set to the message.
+   @param [in] iov_len: the number of items in iov, at most n+1 are needed.
+   @param [out] iovcnt: the number of segments set in iov, is 0 if
+                there is no message for the peer.
+   @return 0 if no error, 1 on an invalid step, 2 if base_size is too
+           small, 3 if base is NULL after a step that is not routing, 4
+           if input_len is wrong, 5 if iov_len is too small, -1 if the
+           peer is invalid.
+
+   @code
+    uint8_t frame[tpdkg_frame_SIZE];
+    struct iovec iov[tp.n + 1];
+    size_t iovcnt;
+    for(int i=0;i<tp.n;i++) {
+      if(0!=tpdkg_tp_peer_iov(&tp, tp_out, tp_out_len, tp_in, sizeof tp_in, i, frame,
+                              iov, tp.n + 1, &iovcnt)) {
+        return 1;
+      }
+      if(iovcnt>0) writev(fds[i], iov, (int) iovcnt);
+    }
+   @endcode
+ */
+int tpdkg_tp_peer_iov(const TP_DKG_TPState *ctx, const uint8_t *base, const size_t base_size,
+                      const uint8_t *input, const size_t input_len, const uint16_t peer,
+                      uint8_t frame[tpdkg_frame_SIZE], struct iovec *iov, const size_t iov_len,
+                      size_t *iovcnt);
 
 /** This function checks if the protocol has finished for the TP or
     more tpdk_tp_next() calls are necessary.
@@ -456,7 +937,7 @@ int tpdkg_tp_not_done(const TP_DKG_TPState *tp);
     @param [in] outlen: the size of the pre-allocated buffer
     @return the index of the cheating peer.
  */
-uint8_t tpdkg_cheater_msg(const TP_DKG_Cheater *c, char *out, const size_t outlen);
+uint16_t tpdkg_cheater_msg(const TP_DKG_Cheater *c, char *out, const size_t outlen);
 
 /*
  * Peer functions
@@ -480,12 +961,82 @@ uint8_t tpdkg_cheater_msg(const TP_DKG_Cheater *c, char *out, const size_t outle
 
     @param [in] t: the msg0 sent from the TP after the TP run tpdkg_tp_start().
 
-    @return 0 if no errors.
+    The peer follows the flags the TP announces in msg0, see
+    tpdkg_start_tp_flags(), a msg0 for a refresh is refused with 6.
+
+    @return 0 if no errors, 9 if msg0 is of another version than
+            tpdkg_VERSION.
  **/
 int tpdkg_start_peer(TP_DKG_PeerState *ctx, const uint64_t ts_epsilon,
                const uint8_t peer_lt_sk[crypto_sign_SECRETKEYBYTES],
                const TP_DKG_Message *msg0);
 
+/** Starts a new execution of a share refresh for a peer.
+
+    Like tpdkg_start_peer() but for a refresh started by
+    tpdkg_start_tp_refresh(). At the end of the refresh the
+    share field of the state contains the refreshed share, which
+    replaces the existing one. The refresh fails if the TP assigns
+    the peer another index than the one of its existing share.
+
+    @param [in] share: the existing share of the peer, it is copied
+           into the state and wiped from it when the refresh finishes.
+
+    @return 0 if no errors.
+ **/
+int tpdkg_start_peer_refresh(TP_DKG_PeerState *ctx, const uint64_t ts_epsilon,
+                             const uint8_t peer_lt_sk[crypto_sign_SECRETKEYBYTES],
+                             const TP_DKG_Message *msg0,
+                             const TOPRF_WideShare *share);
+
+/** Starts a new execution of a TP DKG protocol for a peer, which can
+    resume the channels of an earlier run.
+
+    Like tpdkg_start_peer(), or tpdkg_start_peer_refresh() if share
+    is not NULL. If the TP resumes the channels of an earlier run -
+    see tpdkg_start_tp_resume() - the peer uses the channel keys from
+    cache, otherwise cache is ignored, so a peer can always pass the
+    cache it has.
+
+    @param [in] share: the existing share of the peer for a refresh,
+           NULL otherwise.
+    @param [in] cache: the channel cache saved by
+           tpdkg_peer_save_resume(). It is only read while the
+           protocol runs and must stay valid until it is finished.
+    @param [in] cache_len: the size of cache, tpdkg_resume_SIZE(n).
+
+    @return 0 if no errors, 8 if the TP resumes the channels of a
+            run that cache is not for, or has no uses left.
+ **/
+int tpdkg_start_peer_resume(TP_DKG_PeerState *ctx, const uint64_t ts_epsilon,
+                            const uint8_t peer_lt_sk[crypto_sign_SECRETKEYBYTES],
+                            const TP_DKG_Message *msg0,
+                            const TOPRF_WideShare *share,
+                            const uint8_t *cache, const size_t cache_len);
+
+/** Saves the channels of a finished run into a cache, so that the
+    next run can resume them, see tpdkg_start_tp_resume().
+
+    After a full run the keys of the noise sessions with all the
+    other peers are saved, so this function must be called before
+    tpdkg_peer_free(). After a resumed run the cache it used is
+    ratcheted forward, cache may be the same buffer as the one passed
+    to tpdkg_start_peer_resume(), which should be overwritten anyway.
+
+    The cache holds secret keys, it should be stored like the share of
+    the peer.
+
+    @param [in] ctx: the state of a peer which finished the protocol.
+    @param [out] cache: receives the cache.
+    @param [in] cache_len: the size of cache, tpdkg_resume_SIZE(n).
+
+    @return 0 if no errors, 1 if the protocol did not finish, 2 if
+            cache_len is wrong, 3 if there were complaints, 4 if the
+            cache used by this run has no more uses, 5 if the noise
+            sessions have been freed.
+ **/
+int tpdkg_peer_save_resume(const TP_DKG_PeerState *ctx, uint8_t *cache, const size_t cache_len);
+
 /** This function sets all the variable sized buffers in the TP_DKG_PeerState structure.
 
   The buffer sizes depend on the N and T parameters to the DKG, if
@@ -501,11 +1052,11 @@ int tpdkg_start_peer(TP_DKG_PeerState *ctx, const uint64_t ts_epsilon,
   uint8_t peers_noise_pks[peerstate.n][crypto_scalarmult_BYTES];
   Noise_XK_session_t *noise_outs[peerstate.n];
   Noise_XK_session_t *noise_ins[peerstate.n];
-  TOPRF_Share ishares[peerstate.n];
-  TOPRF_Share xshares[peerstate.n];
+  TOPRF_WideShare ishares[peerstate.n];
+  TOPRF_WideShare xshares[peerstate.n];
   uint8_t commitments[peerstate.n *peerstate.t][crypto_core_ristretto255_BYTES];
-  uint16_t peer_complaints[peersstate.n*peersstate.n];
-  uint8_t peer_my_complaints[peerstate.n];
+  uint32_t peer_complaints[peersstate.n*peersstate.n];
+  uint16_t peer_my_complaints[peerstate.n];
   @endcode
 
 **/
@@ -514,13 +1065,61 @@ void tpdkg_peer_set_bufs(TP_DKG_PeerState *ctx,
                          uint8_t (*peers_noise_pks)[][crypto_scalarmult_BYTES],
                          Noise_XK_session_t *(*noise_outs)[],
                          Noise_XK_session_t *(*noise_ins)[],
-                         TOPRF_Share (*shares)[],
-                         TOPRF_Share (*xshares)[],
+                         TOPRF_WideShare (*shares)[],
+                         TOPRF_WideShare (*xshares)[],
                          uint8_t (*commitments)[][crypto_core_ristretto255_BYTES],
-                         uint16_t *complaints,
-                         uint8_t *my_complaints,
+                         uint32_t *complaints,
+                         uint16_t *my_complaints,
                          uint64_t *last_ts);
 
+/**
+   This function returns the size of the arena needed by
+   tpdkg_peer_set_arena() for a DKG with n peers and threshold t.
+ */
+size_t tpdkg_peer_arena_size(const uint16_t n, const uint16_t t);
+
+/**
+   This function is an alternative to tpdkg_peer_set_bufs(), it lays
+   out all the variable sized buffers of the peer state in one
+   caller-provided arena, each buffer aligned to tpdkg_arena_ALIGN
+   bytes. Since the N and T parameters are only known after
+   tpdkg_start_peer(), this function must be called after that:
+
+   @code
+   const size_t arena_len = tpdkg_peer_arena_size(peer.n, peer.t);
+   uint8_t *arena = malloc(arena_len);
+   tpdkg_peer_set_arena(&peer, arena, arena_len, 1);
+   // run the protocol
+   tpdkg_peer_free(&peer);
+   tpdkg_arena_wipe(arena, arena_len, 1);
+   free(arena);
+   @endcode
+
+   The arena holds the noise sessions of the peer, so
+   tpdkg_peer_free() must be called before wiping it.
+
+   @param [in] ctx: the peer state initialized by tpdkg_start_peer()
+   @param [in] arena: a buffer of at least tpdkg_peer_arena_size() bytes
+   @param [in] arena_len: the size of arena
+   @param [in] lock: if not 0, the arena is locked into memory with
+               sodium_mlock(), in this case it must be released with
+               tpdkg_arena_wipe() with lock also set.
+   @return 0 if no errors, 1 if the arena is too small, 2 if it
+           cannot be locked.
+ */
+int tpdkg_peer_set_arena(TP_DKG_PeerState *ctx, uint8_t *arena, const size_t arena_len, const int lock);
+
+/**
+   This function zeroes an arena set by tpdkg_tp_set_arena() or
+   tpdkg_peer_set_arena() and unlocks it if it was locked, after this
+   the arena can be freed.
+
+   @param [in] arena: the arena
+   @param [in] arena_len: the size of arena
+   @param [in] locked: the lock parameter the arena was set with
+ */
+void tpdkg_arena_wipe(uint8_t *arena, const size_t arena_len, const int locked);
+
 
 
 /**
@@ -594,4 +1193,35 @@ int tpdkg_peer_not_done(const TP_DKG_PeerState *peer);
  */
 void tpdkg_peer_free(TP_DKG_PeerState *ctx);
 
+/**
+   This function enables collecting metrics about each step of a
+   peer, see tpdkg_tp_set_metrics().
+
+   This function must be called after tpdkg_start_peer().
+
+    @param [in] ctx: a peer state initialized by tpdkg_start_peer()
+    @param [in] metrics: receives the metrics, or NULL to disable collecting them
+    @return The function returns 0 if metrics are collected, 1 if
+            liboprf is built without support for metrics.
+ */
+int tpdkg_peer_set_metrics(TP_DKG_PeerState *ctx, TP_DKG_Metrics *metrics);
+
+/**
+   This function enables running the noise handshakes and the
+   encryption and decryption of the shares with the other peers in
+   parallel, see tpdkg_tp_set_workers().
+
+   Only the work on the individual noise sessions is spread over the
+   workers, adding the other peers to the noise device and creating
+   the sessions is always done serially, as the device is not safe to
+   modify concurrently.
+
+   This function must be called after tpdkg_start_peer().
+
+    @param [in] ctx: a peer state initialized by tpdkg_start_peer()
+    @param [in] parallel: a function running jobs in parallel
+    @param [in] pool: passed as the first parameter to parallel
+ */
+void tpdkg_peer_set_workers(TP_DKG_PeerState *ctx, const tpdkg_parallel_fn parallel, void *pool);
+
 #endif //tp_dkg_h
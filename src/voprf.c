@@ -0,0 +1,295 @@
+/*
+    @copyright 2024, Stefan Marsiske toprf@ctrlc.hu
+    This file is part of liboprf.
+
+    liboprf is free software: you can redistribute it and/or
+    modify it under the terms of the GNU Lesser General Public License
+    as published by the Free Software Foundation, either version 3 of
+    the License, or (at your option) any later version.
+
+    liboprf is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Lesser General Public License for more details.
+
+    You should have received a copy of the License
+    along with liboprf. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <stdlib.h>
+#include <string.h>
+#include "oprf.h"
+#include "ristretto255.h"
+#include "voprf.h"
+
+// contextString of RFC 9497 for the VOPRF mode (0x01) of ristretto255-SHA512
+#define VOPRF_CONTEXT "OPRFV1-\x01-ristretto255-SHA512"
+
+#ifdef UNIT_TEST
+// if set, used instead of a random r, so that the tests can reproduce
+// the proofs of the RFC 9497 test vectors
+const uint8_t *voprf_test_proof_r = NULL;
+#endif
+
+static const uint8_t generator[crypto_core_ristretto255_BYTES] = {
+  0xe2, 0xf2, 0xae, 0x0a, 0x6a, 0xbc, 0x4e, 0x71, 0xa8, 0x84, 0xa9, 0x61, 0xc5, 0x00, 0x51, 0x5f,
+  0x58, 0xe3, 0x0b, 0x6a, 0xa5, 0x82, 0xdd, 0x8d, 0xb6, 0xa6, 0x59, 0x45, 0xe0, 0x8d, 0x2d, 0x76};
+
+// scalars in proofs must be fully reduced, ristretto255_msm() would
+// silently use them modulo 2^255
+static int is_canonical(const uint8_t s[crypto_core_ristretto255_SCALARBYTES]) {
+  uint8_t wide[crypto_core_ristretto255_NONREDUCEDSCALARBYTES]={0}, r[crypto_core_ristretto255_SCALARBYTES];
+  memcpy(wide, s, crypto_core_ristretto255_SCALARBYTES);
+  crypto_core_ristretto255_scalar_reduce(r, wide);
+  return memcmp(r, s, sizeof r)==0;
+}
+
+// I2OSP(len, 2) || x
+static void update_lv(crypto_hash_sha512_state *state, const uint8_t *x, const uint16_t len) {
+  const uint8_t l[2] = {(uint8_t) (len >> 8), (uint8_t) len};
+  crypto_hash_sha512_update(state, l, 2);
+  crypto_hash_sha512_update(state, x, len);
+}
+
+// HashToScalar() over the message absorbed by state, which must have
+// been initialized with expand_message_xmd_init()
+static int hash_to_scalar_final(crypto_hash_sha512_state *state,
+                                uint8_t s[crypto_core_ristretto255_SCALARBYTES]) {
+  const uint8_t dst[] = "HashToScalar-" VOPRF_CONTEXT;
+  uint8_t uniform_bytes[crypto_core_ristretto255_NONREDUCEDSCALARBYTES];
+  if(expand_message_xmd_final(state, dst, sizeof dst - 1, sizeof uniform_bytes, uniform_bytes)) return -1;
+  crypto_core_ristretto255_scalar_reduce(s, uniform_bytes);
+  return 0;
+}
+
+// ComputeComposites() of RFC 9497, M = sum(d_i*C[i]), and if k is
+// NULL Z = sum(d_i*D[i]), otherwise the faster Z = M*k
+static int composites(const uint8_t pk[crypto_core_ristretto255_BYTES],
+                      const size_t n,
+                      const uint8_t C[n][crypto_core_ristretto255_BYTES],
+                      const uint8_t D[n][crypto_core_ristretto255_BYTES],
+                      const uint8_t *k,
+                      uint8_t M[crypto_core_ristretto255_BYTES],
+                      uint8_t Z[crypto_core_ristretto255_BYTES]) {
+  // the index of each element is hashed as 16 bits
+  if(n==0 || n>0xffff) return -1;
+
+  const uint8_t seed_dst[] = "Seed-" VOPRF_CONTEXT;
+  uint8_t seed[crypto_hash_sha512_BYTES];
+  crypto_hash_sha512_state state;
+  crypto_hash_sha512_init(&state);
+  update_lv(&state, pk, crypto_core_ristretto255_BYTES);
+  update_lv(&state, seed_dst, sizeof seed_dst - 1);
+  crypto_hash_sha512_final(&state, seed);
+
+  uint8_t (*d)[crypto_core_ristretto255_SCALARBYTES] = malloc(n * crypto_core_ristretto255_SCALARBYTES);
+  if(d==NULL) return -1;
+  for(size_t i=0;i<n;i++) {
+    const uint8_t idx[2] = {(uint8_t) (i >> 8), (uint8_t) i};
+    expand_message_xmd_init(&state);
+    update_lv(&state, seed, sizeof seed);
+    crypto_hash_sha512_update(&state, idx, 2);
+    update_lv(&state, C[i], crypto_core_ristretto255_BYTES);
+    update_lv(&state, D[i], crypto_core_ristretto255_BYTES);
+    crypto_hash_sha512_update(&state, (const uint8_t*) "Composite", 9);
+    if(hash_to_scalar_final(&state, d[i])) goto fail;
+  }
+
+  // the weights and elements are public, only k needs constant time
+  if(ristretto255_msm_vartime(M, n, d, C)) goto fail;
+  if(k!=NULL) {
+    if(crypto_scalarmult_ristretto255(Z, k, M)) goto fail;
+  } else {
+    if(ristretto255_msm_vartime(Z, n, d, D)) goto fail;
+  }
+  free(d);
+  return 0;
+
+fail:
+  free(d);
+  return -1;
+}
+
+static int challenge(const uint8_t pk[crypto_core_ristretto255_BYTES],
+                     const uint8_t M[crypto_core_ristretto255_BYTES],
+                     const uint8_t Z[crypto_core_ristretto255_BYTES],
+                     const uint8_t t2[crypto_core_ristretto255_BYTES],
+                     const uint8_t t3[crypto_core_ristretto255_BYTES],
+                     uint8_t c[crypto_core_ristretto255_SCALARBYTES]) {
+  crypto_hash_sha512_state state;
+  expand_message_xmd_init(&state);
+  update_lv(&state, pk, crypto_core_ristretto255_BYTES);
+  update_lv(&state, M, crypto_core_ristretto255_BYTES);
+  update_lv(&state, Z, crypto_core_ristretto255_BYTES);
+  update_lv(&state, t2, crypto_core_ristretto255_BYTES);
+  update_lv(&state, t3, crypto_core_ristretto255_BYTES);
+  crypto_hash_sha512_update(&state, (const uint8_t*) "Challenge", 9);
+  return hash_to_scalar_final(&state, c);
+}
+
+int voprf_PublicKey(const uint8_t k[crypto_core_ristretto255_SCALARBYTES],
+                    uint8_t pk[crypto_core_ristretto255_BYTES]) {
+  return crypto_scalarmult_ristretto255_base(pk, k);
+}
+
+int voprf_GenerateProof(const uint8_t k[crypto_core_ristretto255_SCALARBYTES],
+                        const uint8_t pk[crypto_core_ristretto255_BYTES],
+                        const size_t n,
+                        const uint8_t C[n][crypto_core_ristretto255_BYTES],
+                        const uint8_t D[n][crypto_core_ristretto255_BYTES],
+                        uint8_t proof[VOPRF_PROOF_BYTES]) {
+  uint8_t M[crypto_core_ristretto255_BYTES], Z[crypto_core_ristretto255_BYTES];
+  if(composites(pk, n, C, D, k, M, Z)) return -1;
+
+  uint8_t r[crypto_core_ristretto255_SCALARBYTES];
+  if(-1==sodium_mlock(r, sizeof r)) return -1;
+#ifdef UNIT_TEST
+  if(voprf_test_proof_r) memcpy(r, voprf_test_proof_r, sizeof r);
+  else
+#endif
+  crypto_core_ristretto255_scalar_random(r);
+
+  int ret = -1;
+  uint8_t t2[crypto_core_ristretto255_BYTES], t3[crypto_core_ristretto255_BYTES];
+  if(crypto_scalarmult_ristretto255_base(t2, r)) goto done;
+  if(crypto_scalarmult_ristretto255(t3, r, M)) goto done;
+
+  // proof = c || s, s = r - c*k
+  uint8_t *c = proof, *s = proof + crypto_core_ristretto255_SCALARBYTES;
+  if(challenge(pk, M, Z, t2, t3, c)) goto done;
+  crypto_core_ristretto255_scalar_mul(s, c, k);
+  crypto_core_ristretto255_scalar_sub(s, r, s);
+  ret = 0;
+
+done:
+  sodium_munlock(r, sizeof r);
+  return ret;
+}
+
+int voprf_VerifyProof(const uint8_t pk[crypto_core_ristretto255_BYTES],
+                      const size_t n,
+                      const uint8_t C[n][crypto_core_ristretto255_BYTES],
+                      const uint8_t D[n][crypto_core_ristretto255_BYTES],
+                      const uint8_t proof[VOPRF_PROOF_BYTES]) {
+  if(crypto_core_ristretto255_is_valid_point(pk)!=1) return -1;
+  const uint8_t *c = proof, *s = proof + crypto_core_ristretto255_SCALARBYTES;
+  if(!is_canonical(c) || !is_canonical(s)) return 1;
+
+  uint8_t M[crypto_core_ristretto255_BYTES], Z[crypto_core_ristretto255_BYTES];
+  if(composites(pk, n, C, D, NULL, M, Z)) return -1;
+
+  uint8_t scalars[2][crypto_core_ristretto255_SCALARBYTES];
+  uint8_t points[2][crypto_core_ristretto255_BYTES];
+  memcpy(scalars[0], s, crypto_core_ristretto255_SCALARBYTES);
+  memcpy(scalars[1], c, crypto_core_ristretto255_SCALARBYTES);
+
+  // t2 = g*s + pk*c
+  uint8_t t2[crypto_core_ristretto255_BYTES], t3[crypto_core_ristretto255_BYTES];
+  memcpy(points[0], generator, sizeof generator);
+  memcpy(points[1], pk, crypto_core_ristretto255_BYTES);
+  // everything in a proof being verified is public
+  if(ristretto255_msm_vartime(t2, 2, scalars, points)) return -1;
+  // t3 = M*s + Z*c
+  memcpy(points[0], M, sizeof M);
+  memcpy(points[1], Z, sizeof Z);
+  if(ristretto255_msm_vartime(t3, 2, scalars, points)) return -1;
+
+  uint8_t expected[crypto_core_ristretto255_SCALARBYTES];
+  if(challenge(pk, M, Z, t2, t3, expected)) return -1;
+  if(sodium_memcmp(expected, c, sizeof expected)!=0) return 1;
+  return 0;
+}
+
+int voprf_EvaluateBatch(const uint8_t k[crypto_core_ristretto255_SCALARBYTES],
+                        const size_t n,
+                        const uint8_t blinded[n][crypto_core_ristretto255_BYTES],
+                        uint8_t Z[n][crypto_core_ristretto255_BYTES],
+                        uint8_t proof[VOPRF_PROOF_BYTES]) {
+  uint8_t *fails = malloc(n ? n : 1);
+  if(fails==NULL) return -1;
+  // the proof covers the whole batch, so any invalid element fails it
+  const int ret = oprf_EvaluateBatch_cfg(NULL, k, n, blinded, Z, fails);
+  free(fails);
+  if(ret) return ret;
+  uint8_t pk[crypto_core_ristretto255_BYTES];
+  if(voprf_PublicKey(k, pk)) return -1;
+  return voprf_GenerateProof(k, pk, n, blinded, (const uint8_t (*)[crypto_core_ristretto255_BYTES]) Z, proof);
+}
+
+int toprf_voprf_EvaluateBatch(const uint8_t share[TOPRF_Share_BYTES],
+                              const size_t n,
+                              const uint8_t blinded[n][crypto_core_ristretto255_BYTES],
+                              uint8_t parts[n][TOPRF_Part_BYTES],
+                              uint8_t proof[VOPRF_PROOF_BYTES]) {
+  uint8_t (*Z)[crypto_core_ristretto255_BYTES] = malloc(n * crypto_core_ristretto255_BYTES);
+  if(Z==NULL) return -1;
+  const int ret = voprf_EvaluateBatch(share+1, n, blinded, Z, proof);
+  if(ret==0) {
+    for(size_t i=0;i<n;i++) {
+      parts[i][0] = share[0];
+      memcpy(parts[i]+1, Z[i], crypto_core_ristretto255_BYTES);
+    }
+  }
+  free(Z);
+  return ret;
+}
+
+int toprf_voprf_VerifyBatch(const uint8_t pk[crypto_core_ristretto255_BYTES],
+                            const uint8_t index,
+                            const size_t n,
+                            const uint8_t blinded[n][crypto_core_ristretto255_BYTES],
+                            const uint8_t parts[n][TOPRF_Part_BYTES],
+                            const uint8_t proof[VOPRF_PROOF_BYTES]) {
+  for(size_t i=0;i<n;i++) if(parts[i][0]!=index) return 1;
+  uint8_t (*Z)[crypto_core_ristretto255_BYTES] = malloc(n * crypto_core_ristretto255_BYTES);
+  if(Z==NULL) return -1;
+  for(size_t i=0;i<n;i++) memcpy(Z[i], parts[i]+1, crypto_core_ristretto255_BYTES);
+  const int ret = voprf_VerifyProof(pk, n, blinded, (const uint8_t (*)[crypto_core_ristretto255_BYTES]) Z, proof);
+  free(Z);
+  return ret;
+}
+
+int toprf_voprf_thresholdmult(const size_t response_len,
+                              const uint8_t threshold,
+                              const size_t n,
+                              const uint8_t blinded[n][crypto_core_ristretto255_BYTES],
+                              const uint8_t pks[response_len][crypto_core_ristretto255_BYTES],
+                              const uint8_t indexes[response_len],
+                              const uint8_t parts[response_len][n][TOPRF_Part_BYTES],
+                              const uint8_t proofs[response_len][VOPRF_PROOF_BYTES],
+                              uint8_t result[n][crypto_core_ristretto255_BYTES],
+                              uint8_t bad[response_len]) {
+  memset(bad, 0, response_len);
+  if(threshold==0 || n==0) return -1;
+
+  // the positions in parts of the shareholders that are combined
+  size_t good[threshold];
+  uint8_t peers[threshold];
+  uint8_t good_len=0;
+  for(size_t i=0;i<response_len && good_len<threshold;i++) {
+    // the index comes from the caller, so that a shareholder can not
+    // claim the index of another one with a proof for its own key
+    int ret = (indexes[i]==0);
+    for(uint8_t k=0;k<good_len && ret==0;k++) ret = (peers[k]==indexes[i]);
+    if(ret==0) ret = toprf_voprf_VerifyBatch(pks[i], indexes[i], n, blinded, parts[i], proofs[i]);
+    if(ret==-1) return -1;
+    if(ret!=0) {
+      bad[i]=1;
+      continue;
+    }
+    good[good_len]=i;
+    peers[good_len++]=indexes[i];
+  }
+  if(good_len<threshold) return 1;
+
+  uint8_t coeffs[threshold][crypto_scalarmult_ristretto255_SCALARBYTES];
+  if(toprf_coeffs(threshold, peers, coeffs)) return -1;
+  uint8_t responses[threshold][TOPRF_Part_BYTES];
+  for(size_t j=0;j<n;j++) {
+    for(uint8_t i=0;i<threshold;i++) memcpy(responses[i], parts[good[i]][j], TOPRF_Part_BYTES);
+    if(toprf_thresholdmult_coeffs(threshold, (const uint8_t (*)[TOPRF_Part_BYTES]) responses, peers,
+                                  (const uint8_t (*)[crypto_scalarmult_ristretto255_SCALARBYTES]) coeffs,
+                                  result[j])) return -1;
+  }
+  return 0;
+}
@@ -0,0 +1,201 @@
+/*
+    @copyright 2024, Stefan Marsiske toprf@ctrlc.hu
+    This file is part of liboprf.
+
+    liboprf is free software: you can redistribute it and/or
+    modify it under the terms of the GNU Lesser General Public License
+    as published by the Free Software Foundation, either version 3 of
+    the License, or (at your option) any later version.
+
+    liboprf is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Lesser General Public License for more details.
+
+    You should have received a copy of the License
+    along with liboprf. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef VOPRF_H
+#define VOPRF_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <sodium.h>
+#include "toprf.h"
+
+/**
+ * Verifiable evaluation.
+ *
+ * The server proves with a DLEQ proof - as specified for the VOPRF
+ * mode of RFC 9497 with the ristretto255-SHA512 suite - that it
+ * evaluated the blinded elements with the private key belonging to
+ * its public key pk = g*k. A single proof covers a whole batch of
+ * evaluations, and verifying it costs two multi-scalar
+ * multiplications over the batch plus a constant.
+ *
+ * With threshold evaluation the public key of a shareholder is g*s_i
+ * for its share s_i, which for shares from a DKG anyone holding the
+ * commitments can compute with dkg_public_share(). A client verifies
+ * the parts of each shareholder before combining them and can drop
+ * the parts of a misbehaving one instead of failing the whole
+ * evaluation.
+ *
+ * The blinded elements are still produced by oprf_Blind(), so the
+ * outputs are the same as of the base mode of this library.
+ */
+
+#define VOPRF_PROOF_BYTES (2*crypto_core_ristretto255_SCALARBYTES)
+
+/**
+ * Computes the public key of a private key or of the value of a share.
+ *
+ * @param [in] k - the private key
+ * @param [out] pk - the public key, g*k
+ *
+ * @return The function returns 0 if everything is correct.
+ */
+int voprf_PublicKey(const uint8_t k[crypto_core_ristretto255_SCALARBYTES],
+                    uint8_t pk[crypto_core_ristretto255_BYTES]);
+
+/**
+ * Proves that D[i] = C[i]*k for all i, and that pk = g*k. This is
+ * GenerateProof() of RFC 9497.
+ *
+ * @param [in] k - the private key
+ * @param [in] pk - the public key of k
+ * @param [in] n - the number of elements in C and D
+ * @param [in] C - the blinded elements
+ * @param [in] D - the evaluated elements
+ * @param [out] proof - the proof
+ *
+ * @return The function returns 0 if everything is correct.
+ */
+int voprf_GenerateProof(const uint8_t k[crypto_core_ristretto255_SCALARBYTES],
+                        const uint8_t pk[crypto_core_ristretto255_BYTES],
+                        const size_t n,
+                        const uint8_t C[n][crypto_core_ristretto255_BYTES],
+                        const uint8_t D[n][crypto_core_ristretto255_BYTES],
+                        uint8_t proof[VOPRF_PROOF_BYTES]);
+
+/**
+ * Verifies a proof of voprf_GenerateProof(). This is VerifyProof()
+ * of RFC 9497.
+ *
+ * @return The function returns 0 if the proof is valid, 1 if it is
+ *         not, -1 on error.
+ */
+int voprf_VerifyProof(const uint8_t pk[crypto_core_ristretto255_BYTES],
+                      const size_t n,
+                      const uint8_t C[n][crypto_core_ristretto255_BYTES],
+                      const uint8_t D[n][crypto_core_ristretto255_BYTES],
+                      const uint8_t proof[VOPRF_PROOF_BYTES]);
+
+/**
+ * Same as oprf_EvaluateBatch() but also produces a proof over the
+ * whole batch. The evaluation is always done locally, a proxy set by
+ * oprf_set_evalproxy() is not used.
+ *
+ * @param [in] k - the private key
+ * @param [in] n - the number of elements in the batch
+ * @param [in] blinded - the outputs of oprf_Blind()
+ * @param [out] Z - the evaluated elements, inputs to oprf_Unblind()
+ * @param [out] proof - the proof, to be checked by the client with
+ *              voprf_VerifyProof()
+ *
+ * @return The function returns 0 if everything is correct, 1 if some
+ *         element of blinded is invalid, and -1 on errors. No proof
+ *         is produced unless it returns 0.
+ */
+int voprf_EvaluateBatch(const uint8_t k[crypto_core_ristretto255_SCALARBYTES],
+                        const size_t n,
+                        const uint8_t blinded[n][crypto_core_ristretto255_BYTES],
+                        uint8_t Z[n][crypto_core_ristretto255_BYTES],
+                        uint8_t proof[VOPRF_PROOF_BYTES]);
+
+/**
+ * Evaluates a batch with a share, producing parts for
+ * toprf_thresholdmult() and a proof over all of them for the public
+ * key of the share.
+ *
+ * Unlike with toprf_Evaluate() the lagrange coefficient is not
+ * applied, as then the public key would depend on the set of
+ * shareholders answering, toprf_thresholdmult() applies it instead.
+ *
+ * @param [in] share - the share of the private key
+ * @param [in] n - the number of elements in the batch
+ * @param [in] blinded - the outputs of oprf_Blind()
+ * @param [out] parts - the evaluated parts
+ * @param [out] proof - the proof
+ *
+ * @return The function returns the same as voprf_EvaluateBatch().
+ */
+int toprf_voprf_EvaluateBatch(const uint8_t share[TOPRF_Share_BYTES],
+                              const size_t n,
+                              const uint8_t blinded[n][crypto_core_ristretto255_BYTES],
+                              uint8_t parts[n][TOPRF_Part_BYTES],
+                              uint8_t proof[VOPRF_PROOF_BYTES]);
+
+/**
+ * Verifies the parts and the proof of toprf_voprf_EvaluateBatch().
+ *
+ * @param [in] pk - the public key of the share of the shareholder,
+ *             see dkg_public_share()
+ * @param [in] index - the index of the shareholder, all parts must
+ *             carry this index
+ * @param [in] n - the number of elements in the batch
+ * @param [in] blinded - the elements sent to the shareholder
+ * @param [in] parts - the parts of the shareholder
+ * @param [in] proof - the proof of the shareholder
+ *
+ * @return The function returns 0 if the parts are correct, 1 if they
+ *         are not, -1 on error.
+ */
+int toprf_voprf_VerifyBatch(const uint8_t pk[crypto_core_ristretto255_BYTES],
+                            const uint8_t index,
+                            const size_t n,
+                            const uint8_t blinded[n][crypto_core_ristretto255_BYTES],
+                            const uint8_t parts[n][TOPRF_Part_BYTES],
+                            const uint8_t proof[VOPRF_PROOF_BYTES]);
+
+/**
+ * Robust version of toprf_thresholdmult() for a batch: verifies the
+ * answers of the shareholders in order until threshold of them are
+ * correct, and combines those. A corrupt shareholder is identified by
+ * its failing proof, instead of by a wrong output after finalizing,
+ * so the client does not have to search for a correct subset.
+ *
+ * @param [in] response_len - the number of shareholders that answered,
+ *             should be more than threshold to tolerate cheaters
+ * @param [in] threshold - the threshold
+ * @param [in] n - the number of elements in the batch
+ * @param [in] blinded - the elements sent to all shareholders
+ * @param [in] pks - the public keys of the shares of the shareholders,
+ *             in the same order as parts
+ * @param [in] indexes - the indexes of the shares the keys in pks
+ *             belong to, the parts of a shareholder must carry this
+ *             index. Zero and repeated indexes are marked as bad.
+ * @param [in] parts - the parts of each shareholder, outputs of
+ *             toprf_voprf_EvaluateBatch()
+ * @param [in] proofs - the proof of each shareholder
+ * @param [out] result - the combined elements, inputs to oprf_Unblind()
+ * @param [out] bad - bad[i] is set to 1 if the parts of the i-th
+ *              shareholder are invalid. Shareholders after the
+ *              threshold-th correct one are not verified and are set
+ *              to 0.
+ *
+ * @return The function returns 0 if everything is correct, 1 if there
+ *         are not enough correct shareholders, -1 on errors.
+ */
+int toprf_voprf_thresholdmult(const size_t response_len,
+                              const uint8_t threshold,
+                              const size_t n,
+                              const uint8_t blinded[n][crypto_core_ristretto255_BYTES],
+                              const uint8_t pks[response_len][crypto_core_ristretto255_BYTES],
+                              const uint8_t indexes[response_len],
+                              const uint8_t parts[response_len][n][TOPRF_Part_BYTES],
+                              const uint8_t proofs[response_len][VOPRF_PROOF_BYTES],
+                              uint8_t result[n][crypto_core_ristretto255_BYTES],
+                              uint8_t bad[response_len]);
+
+#endif // VOPRF_H
@@ -0,0 +1,141 @@
+/*
+    @copyright 2024, Stefan Marsiske toprf@ctrlc.hu
+    This file is part of liboprf.
+
+    liboprf is free software: you can redistribute it and/or
+    modify it under the terms of the GNU Lesser General Public License
+    as published by the Free Software Foundation, either version 3 of
+    the License, or (at your option) any later version.
+
+    liboprf is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Lesser General Public License for more details.
+
+    You should have received a copy of the License
+    along with liboprf. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+// The javascript side of liboprf.js, appended to the module by make
+// wasm with --post-js.
+//
+// Every call copies its inputs into one buffer on the wasm heap, which
+// is kept between calls and only grown when a batch does not fit, and
+// returns views into the same buffer instead of copies. The views are
+// only valid until the next call, keep them with slice(). wipe()
+// clears the buffer, for example after the blinding factors are no
+// longer needed.
+//
+//   const oprf = await liboprf();
+//   const {r, blinded} = oprf.blindBatch([pw1, pw2]);
+//   // ... evaluate and combine blinded at the shareholders ...
+//   const N = oprf.unblindBatch(r, Z);
+//   const rwd = oprf.finalizeBatch([pw1, pw2], N);
+
+var OPRF_SCALARBYTES = 32, OPRF_ELEMENTBYTES = 32, OPRF_PARTBYTES = 33, OPRF_BYTES = 64;
+
+var oprfBuf = {ptr: 0, len: 0}, oprfReady = false;
+
+// returns the offsets of buffers of the given sizes in the heap buffer,
+// each aligned to 16 bytes
+function oprfLayout(sizes) {
+  if(!oprfReady) {
+    if(Module['_sodium_init']() < 0) throw new Error('liboprf: sodium_init failed');
+    oprfReady = true;
+  }
+  var offsets = [], len = 0;
+  for(var i=0;i<sizes.length;i++) {
+    offsets.push(len);
+    len += (sizes[i] + 15) & ~15;
+  }
+  if(len > oprfBuf.len) {
+    Module['wipe']();
+    if(oprfBuf.ptr) Module['_free'](oprfBuf.ptr);
+    oprfBuf.ptr = Module['_malloc'](len);
+    if(!oprfBuf.ptr) {
+      oprfBuf.len = 0;
+      throw new Error('liboprf: out of memory');
+    }
+    oprfBuf.len = len;
+  }
+  return offsets.map(function(o) { return oprfBuf.ptr + o; });
+}
+
+function oprfView(ptr, len) {
+  return HEAPU8.subarray(ptr, ptr + len);
+}
+
+function oprfCheck(ret, what) {
+  if(ret!==0) throw new Error('liboprf: ' + what + ' failed');
+}
+
+// copies the inputs back to back to ptr and their lengths to lens,
+// an array of 2 byte integers
+function oprfPack(inputs, ptr, lens) {
+  var off = ptr;
+  for(var i=0;i<inputs.length;i++) {
+    HEAPU8.set(inputs[i], off);
+    off += inputs[i].length;
+    HEAPU16[(lens >> 1) + i] = inputs[i].length;
+  }
+}
+
+function oprfTotal(inputs, max) {
+  var total = 0;
+  for(var i=0;i<inputs.length;i++) {
+    if(inputs[i].length > max) throw new Error('liboprf: input too long');
+    total += inputs[i].length;
+  }
+  return total;
+}
+
+Module['wipe'] = function() {
+  if(oprfBuf.ptr) HEAPU8.fill(0, oprfBuf.ptr, oprfBuf.ptr + oprfBuf.len);
+};
+
+// inputs is an array of Uint8Arrays, returns the n blinding scalars
+// and the n blinded elements, each as one flat Uint8Array
+Module['blindBatch'] = function(inputs) {
+  var n = inputs.length;
+  var p = oprfLayout([oprfTotal(inputs, 65535), 2 * n, n * OPRF_SCALARBYTES, n * OPRF_ELEMENTBYTES]);
+  oprfPack(inputs, p[0], p[1]);
+  oprfCheck(Module['_oprf_wasm_BlindBatch'](n, p[0], p[1], p[2], p[3]), 'blinding');
+  return {r: oprfView(p[2], n * OPRF_SCALARBYTES), blinded: oprfView(p[3], n * OPRF_ELEMENTBYTES)};
+};
+
+// r and Z are flat Uint8Arrays of n scalars and n elements
+Module['unblindBatch'] = function(r, Z) {
+  var n = r.length / OPRF_SCALARBYTES;
+  if(Z.length !== n * OPRF_ELEMENTBYTES) throw new Error('liboprf: r and Z differ in length');
+  var p = oprfLayout([r.length, Z.length, n * OPRF_ELEMENTBYTES, n]);
+  HEAPU8.set(r, p[0]);
+  HEAPU8.set(Z, p[1]);
+  oprfCheck(Module['_oprf_UnblindBatch'](n, p[0], p[1], p[2], p[3]), 'unblinding');
+  return oprfView(p[2], n * OPRF_ELEMENTBYTES);
+};
+
+// inputs is the array passed to blindBatch(), N the output of unblindBatch()
+Module['finalizeBatch'] = function(inputs, N) {
+  var n = inputs.length;
+  if(N.length !== n * OPRF_ELEMENTBYTES) throw new Error('liboprf: inputs and N differ in length');
+  var p = oprfLayout([oprfTotal(inputs, 65535), 2 * n, N.length, n * OPRF_BYTES]);
+  oprfPack(inputs, p[0], p[1]);
+  HEAPU8.set(N, p[2]);
+  oprfCheck(Module['_oprf_wasm_FinalizeBatch'](n, p[0], p[1], p[2], p[3]), 'finalizing');
+  return oprfView(p[3], n * OPRF_BYTES);
+};
+
+// parts is an array of the answers of the shareholders, each a flat
+// Uint8Array of the parts of all n elements, returns the n combined
+// elements as one flat Uint8Array
+Module['thresholdmultBatch'] = function(parts) {
+  var t = parts.length, n = t ? parts[0].length / OPRF_PARTBYTES : 0;
+  var p = oprfLayout([t * n * OPRF_PARTBYTES, n * OPRF_ELEMENTBYTES]);
+  for(var i=0;i<t;i++) {
+    if(parts[i].length !== n * OPRF_PARTBYTES) throw new Error('liboprf: the answers differ in length');
+    HEAPU8.set(parts[i], p[0] + i * n * OPRF_PARTBYTES);
+  }
+  oprfCheck(Module['_toprf_wasm_thresholdmult_batch'](n, t, p[0], p[1]), 'combining');
+  return oprfView(p[1], n * OPRF_ELEMENTBYTES);
+};
+
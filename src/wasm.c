@@ -0,0 +1,97 @@
+/*
+    @copyright 2024, Stefan Marsiske toprf@ctrlc.hu
+    This file is part of liboprf.
+
+    liboprf is free software: you can redistribute it and/or
+    modify it under the terms of the GNU Lesser General Public License
+    as published by the Free Software Foundation, either version 3 of
+    the License, or (at your option) any later version.
+
+    liboprf is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Lesser General Public License for more details.
+
+    You should have received a copy of the License
+    along with liboprf. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sodium.h>
+#include "oprf.h"
+#include "toprf.h"
+#include "ristretto255.h"
+#include "soa.h"
+#include "wasm.h"
+
+int oprf_wasm_BlindBatch(const size_t n,
+                         const uint8_t *x, const uint16_t x_len[n],
+                         uint8_t r[n][crypto_core_ristretto255_SCALARBYTES],
+                         uint8_t blinded[n][crypto_core_ristretto255_BYTES]) {
+  const uint8_t *xs[OPRF_WASM_CHUNK];
+  size_t lens[OPRF_WASM_CHUNK];
+  for(size_t i=0;i<n;i+=OPRF_WASM_CHUNK) {
+    const size_t len = (n - i < OPRF_WASM_CHUNK) ? n - i : OPRF_WASM_CHUNK;
+    for(size_t j=0;j<len;j++) {
+      xs[j] = x;
+      lens[j] = x_len[i+j];
+      x += x_len[i+j];
+    }
+    if(oprf_BlindBatch(len, xs, lens, &r[i], &blinded[i])) return -1;
+  }
+  return 0;
+}
+
+int oprf_wasm_FinalizeBatch(const size_t n,
+                            const uint8_t *x, const uint16_t x_len[n],
+                            const uint8_t N[n][crypto_core_ristretto255_BYTES],
+                            uint8_t rwdU[n][OPRF_BYTES]) {
+  const uint8_t *xs[OPRF_WASM_CHUNK];
+  for(size_t i=0;i<n;i+=OPRF_WASM_CHUNK) {
+    const size_t len = (n - i < OPRF_WASM_CHUNK) ? n - i : OPRF_WASM_CHUNK;
+    for(size_t j=0;j<len;j++) {
+      xs[j] = x;
+      x += x_len[i+j];
+    }
+    if(oprf_FinalizeBatch(len, xs, &x_len[i], &N[i], &rwdU[i])) return -1;
+  }
+  return 0;
+}
+
+int toprf_wasm_thresholdmult_batch(const size_t n,
+                                   const size_t response_len,
+                                   const uint8_t parts[response_len][n][TOPRF_Part_BYTES],
+                                   uint8_t result[n][crypto_scalarmult_ristretto255_BYTES]) {
+  memset(result, 0, n * crypto_scalarmult_ristretto255_BYTES);
+  if(n==0) return 0;
+  if(response_len==0 || response_len>255) return 1;
+
+  uint8_t indexes[response_len];
+  for(size_t i=0;i<response_len;i++) {
+    indexes[i] = parts[i][0][0];
+    for(size_t j=1;j<n;j++) {
+      if(parts[i][j][0]!=indexes[i]) return 1;
+    }
+  }
+  uint8_t lpoly[response_len][crypto_scalarmult_ristretto255_SCALARBYTES];
+  if(toprf_coeffs(response_len, indexes, lpoly)) return 1;
+
+  uint8_t values[response_len][crypto_scalarmult_ristretto255_BYTES] TOPRF_SOA_ALIGNED;
+  for(size_t j=0;j<n;j++) {
+    toprf_soa_split(response_len, parts[0][j], n * TOPRF_Part_BYTES, NULL, values);
+    for(size_t i=0;i<response_len;i++) {
+      // like crypto_scalarmult_ristretto255() we do not accept the identity element
+      if(sodium_is_zero(values[i], crypto_scalarmult_ristretto255_BYTES)) goto fail;
+    }
+    if(ristretto255_msm(result[j], response_len, (const uint8_t (*)[crypto_scalarmult_ristretto255_SCALARBYTES]) lpoly,
+                        (const uint8_t (*)[crypto_scalarmult_ristretto255_BYTES]) values)) goto fail;
+  }
+  return 0;
+
+fail:
+  memset(result, 0, n * crypto_scalarmult_ristretto255_BYTES);
+  return 1;
+}
@@ -0,0 +1,96 @@
+/*
+    @copyright 2024, Stefan Marsiske toprf@ctrlc.hu
+    This file is part of liboprf.
+
+    liboprf is free software: you can redistribute it and/or
+    modify it under the terms of the GNU Lesser General Public License
+    as published by the Free Software Foundation, either version 3 of
+    the License, or (at your option) any later version.
+
+    liboprf is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Lesser General Public License for more details.
+
+    You should have received a copy of the License
+    along with liboprf. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+#ifndef WASM_H
+#define WASM_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <sodium.h>
+#include "oprf.h"
+#include "toprf.h"
+
+/*
+ * The client side batch functions in the shape needed by liboprf.js,
+ * see make wasm and wasm-api.js.
+ *
+ * Inputs of different lengths are passed as one buffer holding all of
+ * them back to back and an array of the lengths, instead of an array
+ * of pointers, so that javascript can copy a whole batch into the
+ * wasm heap with a single set() and needs no allocation per input.
+ * Batches are processed in chunks of OPRF_WASM_CHUNK elements, which
+ * keeps the temporaries within the small default stack of emscripten.
+ *
+ * The functions work the same outside of webassembly.
+ */
+
+#define OPRF_WASM_CHUNK 64
+
+/**
+ * Same as oprf_BlindBatch() but with the n inputs concatenated in x.
+ *
+ * @param [in] n - the number of inputs
+ * @param [in] x - the inputs, back to back
+ * @param [in] x_len - the lengths of the n inputs in x
+ * @param [out] r - an array of n OPRF scalars used for randomization
+ * @param [out] blinded - an array of n serialized OPRF group elements
+ * @return The function returns 0 if everything is correct.
+ */
+int oprf_wasm_BlindBatch(const size_t n,
+                         const uint8_t *x, const uint16_t x_len[n],
+                         uint8_t r[n][crypto_core_ristretto255_SCALARBYTES],
+                         uint8_t blinded[n][crypto_core_ristretto255_BYTES]);
+
+/**
+ * Same as oprf_FinalizeBatch() but with the n inputs concatenated in x.
+ *
+ * @param [in] n - the number of inputs
+ * @param [in] x - the values that were blinded, back to back
+ * @param [in] x_len - the lengths of the n values in x
+ * @param [in] N - an array of n outputs of oprf_UnblindBatch()
+ * @param [out] rwdU - an array of n outputs
+ * @return The function returns 0 if everything is correct.
+ */
+int oprf_wasm_FinalizeBatch(const size_t n,
+                            const uint8_t *x, const uint16_t x_len[n],
+                            const uint8_t N[n][crypto_core_ristretto255_BYTES],
+                            uint8_t rwdU[n][OPRF_BYTES]);
+
+/**
+ * Combines the parts of a batch of n elements answered by the same
+ * response_len shareholders, the lagrange coefficients are calculated
+ * only once for the whole batch, every element is then one
+ * multi-scalar multiplication. The result of every element is the same
+ * as of toprf_thresholdmult() of its parts.
+ *
+ * @param [in] n - the number of elements
+ * @param [in] response_len - the number of shareholders
+ * @param [in] parts - the parts of every shareholder for every element,
+ *        all the parts of a shareholder must have the same index
+ * @param [out] result - the n combined elements
+ * @return The function returns 0 if everything is correct, 1 if the
+ *         indexes are not all different and non-zero, differ between
+ *         the parts of a shareholder, or a part is invalid.
+ */
+int toprf_wasm_thresholdmult_batch(const size_t n,
+                                   const size_t response_len,
+                                   const uint8_t parts[response_len][n][TOPRF_Part_BYTES],
+                                   uint8_t result[n][crypto_scalarmult_ristretto255_BYTES]);
+
+#endif // WASM_H
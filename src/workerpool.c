@@ -0,0 +1,144 @@
+/*
+    @copyright 2024, Stefan Marsiske toprf@ctrlc.hu
+    This file is part of liboprf.
+
+    liboprf is free software: you can redistribute it and/or
+    modify it under the terms of the GNU Lesser General Public License
+    as published by the Free Software Foundation, either version 3 of
+    the License, or (at your option) any later version.
+
+    liboprf is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Lesser General Public License for more details.
+
+    You should have received a copy of the License
+    along with liboprf. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <pthread.h>
+#include <stdlib.h>
+#include "workerpool.h"
+
+struct WorkerPool {
+  pthread_mutex_t lock;
+  pthread_cond_t start;
+  pthread_cond_t done;
+  // signalled when the current batch is over and the next may start
+  pthread_cond_t idle;
+  int busy;
+  unsigned threads;
+  pthread_t *tids;
+  // the current batch of jobs
+  workerpool_job fn;
+  void *arg;
+  size_t jobs;
+  size_t next;
+  size_t finished;
+  // incremented for every batch, so that the threads know when there is new work
+  unsigned long generation;
+  int stop;
+};
+
+// the pool whose job the calling thread is running, if any
+static __thread const WorkerPool *running = NULL;
+
+// grabs and runs jobs from the current batch until there are none
+// left, must be called with the lock held.
+static void run_jobs(WorkerPool *pool) {
+  while(pool->next < pool->jobs) {
+    const size_t job = pool->next++;
+    pthread_mutex_unlock(&pool->lock);
+    const WorkerPool *outer = running;
+    running = pool;
+    pool->fn(pool->arg, job);
+    running = outer;
+    pthread_mutex_lock(&pool->lock);
+    if(++pool->finished == pool->jobs) pthread_cond_broadcast(&pool->done);
+  }
+}
+
+static void *worker(void *arg) {
+  WorkerPool *pool = (WorkerPool*) arg;
+  unsigned long generation = 0;
+  pthread_mutex_lock(&pool->lock);
+  for(;;) {
+    while(!pool->stop && generation == pool->generation) {
+      pthread_cond_wait(&pool->start, &pool->lock);
+    }
+    if(pool->stop) break;
+    generation = pool->generation;
+    run_jobs(pool);
+  }
+  pthread_mutex_unlock(&pool->lock);
+  return NULL;
+}
+
+WorkerPool* workerpool_new(const unsigned threads) {
+  WorkerPool *pool = calloc(1, sizeof(WorkerPool));
+  if(pool==NULL) return NULL;
+  if(threads>0) {
+    pool->tids = calloc(threads, sizeof(pthread_t));
+    if(pool->tids==NULL) {
+      free(pool);
+      return NULL;
+    }
+  }
+  pthread_mutex_init(&pool->lock, NULL);
+  pthread_cond_init(&pool->start, NULL);
+  pthread_cond_init(&pool->done, NULL);
+  pthread_cond_init(&pool->idle, NULL);
+  for(;pool->threads<threads;pool->threads++) {
+    if(0!=pthread_create(&pool->tids[pool->threads], NULL, worker, pool)) {
+      workerpool_free(pool);
+      return NULL;
+    }
+  }
+  return pool;
+}
+
+void workerpool_run(void *_pool, const size_t jobs, workerpool_job fn, void *arg) {
+  WorkerPool *pool = (WorkerPool*) _pool;
+  if(jobs==0) return;
+  // a job running another batch on its own pool would wait for itself
+  if(running==pool) {
+    for(size_t i=0;i<jobs;i++) fn(arg, i);
+    return;
+  }
+  pthread_mutex_lock(&pool->lock);
+  // there is only one batch per pool, other callers wait for their turn
+  while(pool->busy) pthread_cond_wait(&pool->idle, &pool->lock);
+  pool->busy = 1;
+  pool->fn = fn;
+  pool->arg = arg;
+  pool->jobs = jobs;
+  pool->next = 0;
+  pool->finished = 0;
+  pool->generation++;
+  pthread_cond_broadcast(&pool->start);
+  // the calling thread also does its part
+  run_jobs(pool);
+  while(pool->finished < pool->jobs) {
+    pthread_cond_wait(&pool->done, &pool->lock);
+  }
+  pool->jobs = 0;
+  pool->next = 0;
+  pool->busy = 0;
+  pthread_cond_signal(&pool->idle);
+  pthread_mutex_unlock(&pool->lock);
+}
+
+void workerpool_free(WorkerPool *pool) {
+  if(pool==NULL) return;
+  pthread_mutex_lock(&pool->lock);
+  pool->stop = 1;
+  pthread_cond_broadcast(&pool->start);
+  pthread_mutex_unlock(&pool->lock);
+  for(unsigned i=0;i<pool->threads;i++) pthread_join(pool->tids[i], NULL);
+  pthread_mutex_destroy(&pool->lock);
+  pthread_cond_destroy(&pool->start);
+  pthread_cond_destroy(&pool->done);
+  pthread_cond_destroy(&pool->idle);
+  free(pool->tids);
+  free(pool);
+}
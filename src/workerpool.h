@@ -0,0 +1,73 @@
+/*
+    @copyright 2024, Stefan Marsiske toprf@ctrlc.hu
+    This file is part of liboprf.
+
+    liboprf is free software: you can redistribute it and/or
+    modify it under the terms of the GNU Lesser General Public License
+    as published by the Free Software Foundation, either version 3 of
+    the License, or (at your option) any later version.
+
+    liboprf is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Lesser General Public License for more details.
+
+    You should have received a copy of the License
+    along with liboprf. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef WORKERPOOL_H
+#define WORKERPOOL_H
+
+#include <stddef.h>
+
+/**
+ * A minimal pool of threads for running independent jobs in
+ * parallel. It is used by the TP of tp-dkg to verify the messages of
+ * the peers concurrently, see tpdkg_tp_set_workers().
+ */
+typedef struct WorkerPool WorkerPool;
+
+/**
+ * The signature of a job, it gets called with the arg passed to
+ * workerpool_run() and the index of the job.
+ */
+typedef void (*workerpool_job)(void *arg, const size_t job);
+
+/**
+ * Creates a new pool.
+ *
+ * @param [in] threads - the number of threads to start, the thread
+ *             calling workerpool_run() also runs jobs, so 0 is valid
+ *             and the same as running everything serially.
+ *
+ * @return The function returns a new pool, or NULL on error.
+ */
+WorkerPool* workerpool_new(const unsigned threads);
+
+/**
+ * Runs fn(arg, 0) .. fn(arg, jobs-1) in parallel and returns when all
+ * of them are finished. The order in which the jobs run is not
+ * defined.
+ *
+ * A pool runs one batch at a time: if several threads call this on
+ * the same pool, their batches run one after the other. If a job
+ * calls this again on its own pool, the nested batch runs serially in
+ * the thread of that job.
+ *
+ * The signature matches tpdkg_parallel_fn, so this can be passed
+ * directly to tpdkg_tp_set_workers() together with the pool.
+ *
+ * @param [in] pool - a WorkerPool created with workerpool_new()
+ * @param [in] jobs - the number of jobs to run
+ * @param [in] fn - the function running a job
+ * @param [in] arg - passed to every call of fn
+ */
+void workerpool_run(void *pool, const size_t jobs, workerpool_job fn, void *arg);
+
+/**
+ * Stops the threads of the pool and frees it.
+ */
+void workerpool_free(WorkerPool *pool);
+
+#endif // WORKERPOOL_H